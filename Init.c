@@ -4,10 +4,12 @@
 
 
 #ifndef IE_XL
+#include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 
 #include "QL68000.h"
+#include "op_stats.h"
 
 void UseIPC(void);
 void ReadIPC(void);
@@ -304,7 +306,16 @@ void InvalidCode(void);
 void move_from_ccr(void);
 void movec(void);
 void rtd(void);
-extern int cpu68010;
+void mull(void);
+void divl(void);
+void extb_l(void);
+void bcc_32(void);
+void bsr_32(void);
+void bitfield(void);
+extern MACHINE_LOCAL int cpu68010;
+#ifdef EA_VARIANTS
+void SetEAVariants(void (**itable)(void));
+#endif
 #endif  /* IE_XL */
 
 #ifdef IE_XL
@@ -373,6 +384,15 @@ void SetTable(void (**itable)(void),
 }
 #endif
 
+#ifdef OPTABLE_GEN
+// gen_optable stands in a token for each handler, by name
+void (*genHandler(const char *name))(void);
+#define SetTable(_t_, _s_, _f_)	SetTable(_t_, _s_, genHandler(#_f_))
+#elif !defined(IE_XL)
+// Every handler SetTable installs is named in the --op_stats report
+#define SetTable(_t_, _s_, _f_)	(SetTable(_t_, _s_, _f_), opStatsName(_f_, #_f_))
+#endif
+
 #ifndef IE_XL
 void SetInvalEntries(void (**itable)(void),void *code)
 {
@@ -383,7 +403,40 @@ void SetInvalEntries(void (**itable)(void),void *code)
 #endif
 
 
-#ifndef IE_XL
+#ifdef OPTABLE_GEN
+#define SetInvalEntries(_t_, _f_)	SetInvalEntries(_t_, genHandler(#_f_))
+#endif
+
+#if defined(GENERATED_TABLE) && !defined(OPTABLE_GEN)
+#include "optable.h"
+
+/* The patterns as gen_optable expanded them, then the options' changes */
+static void SetTabEntries(void (**itable)(void))
+{
+	int i;
+
+	for (i = 0; i < 65536; i++)
+		itable[i] = optable_handlers[optable_index[i]];
+	for (i = 0; i < optable_nhandlers; i++)
+		opStatsName(optable_handlers[i], optable_names[i]);
+
+#ifdef EA_VARIANTS
+	SetEAVariants(itable);
+#endif
+	if (cpu68010) {
+		for (i = 0; i < optable_68010_n; i++)
+			itable[optable_68010[i].code] = optable_handlers[optable_68010[i].handler];
+	}
+	if (cpu68020) {
+		for (i = 0; i < optable_68020_n; i++)
+			itable[optable_68020[i].code] = optable_handlers[optable_68020[i].handler];
+	}
+}
+#else
+
+#if defined(OPTABLE_GEN)
+void SetTabEntries(void (**itable)(void))
+#elif !defined(IE_XL)
 static void SetTabEntries(void (**itable)(void))
 #endif
 
@@ -687,6 +740,11 @@ static void SetTabEntries(void (**itable)(void))
         SetTable(itable, "1010xxxxxxxxxxxx", LR code1010);
         SetTable(itable, "1111xxxxxxxxxxxx", LR code1111);
 
+#if defined(EA_VARIANTS) && !defined(OPTABLE_GEN)
+        /* Per addressing mode move/add/sub/cmp over the generic ones */
+        SetEAVariants(itable);
+#endif
+
         /* 68010-specific instructions */
         if (cpu68010) {
                 SetTable(itable, "0100001011xxxxxx", LR move_from_ccr); /* MOVE from CCR */
@@ -694,8 +752,70 @@ static void SetTabEntries(void (**itable)(void))
                 SetTable(itable, "0100111001111011", LR movec);          /* MOVEC Rn,Rc */
                 SetTable(itable, "0100111001110100", LR rtd);            /* RTD */
         }
+
+        /* 68020 subset */
+        if (cpu68020) {
+                SetTable(itable, "0100110000xxxxxx", LR mull);           /* MULS.L/MULU.L */
+                SetTable(itable, "0100110001xxxxxx", LR divl);           /* DIVS.L/DIVU.L */
+                SetTable(itable, "0100100111000xxx", LR extb_l);         /* EXTB.L */
+                SetTable(itable, "0110xxxx11111111", LR bcc_32);         /* Bcc.L, BRA.L */
+                SetTable(itable, "0110000111111111", LR bsr_32);         /* BSR.L */
+                SetTable(itable, "11101xxx11xxxxxx", LR bitfield);       /* BFTST..BFINS */
+        }
 }
 #endif
+#endif /* GENERATED_TABLE */
+
+#ifndef OPTABLE_GEN
+#ifdef COMPACT_TABLE
+static int nhandlers;
+
+void SetOpcodeHandler(uw16 c, void (*f)(void))
+{
+	static int last;
+	int h = last;
+
+	// Runs of opcodes share a handler, so the last one is tried first
+	if (h >= nhandlers || qlux_handlers[h] != f) {
+		for (h = 0; h < nhandlers && qlux_handlers[h] != f; h++)
+			;
+		if (h == nhandlers) {
+			if (nhandlers == QLUX_MAX_HANDLERS) {
+				fprintf(stderr, "More than %d opcode handlers\n", QLUX_MAX_HANDLERS);
+				exit(1);
+			}
+			qlux_handlers[nhandlers++] = f;
+		}
+		last = h;
+	}
+	qlux_index[c] = h;
+}
+
+int EmulatorTable()
+{
+	void (**itable)(void);
+	long c;
+
+	// Built as pointers, as SetTable and the variants want, then indexed
+	itable = malloc(65536 * sizeof(void *));
+	qlux_index = malloc(65536 * sizeof(*qlux_index));
+	if (!itable || !qlux_index) {
+		free(itable);
+		return -ENOMEM;
+	}
+
+	SetTabEntries(itable);
+	for (c = 0; c < 65536; c++)
+		SetOpcodeHandler(c, itable[c]);
+	free(itable);
+
+	return 0;
+}
+#else
+void SetOpcodeHandler(uw16 c, void (*f)(void))
+{
+	qlux_table[c] = f;
+}
 
 int EmulatorTable()
 {
@@ -708,6 +828,8 @@ int EmulatorTable()
 
 	return 0;
 }
+#endif
+#endif /* OPTABLE_GEN */
 
 
 
@@ -18,6 +18,7 @@
 #include <string.h>
 
 #include "QDisk.h"
+#include "async_io.h"
 #include "QFilesPriv.h"
 #include "QL.h"
 #include "QL_config.h"
@@ -39,6 +40,11 @@
 #define LF_FOUND -9832
 #define ERR_BUFFER_FULL -9833
 
+#define QDISK_DATA_BUFS 64 /* sector buffers besides the FAT */
+#define QDISK_HASH_SIZE 128 /* power of two */
+#define QDISK_READ_AHEAD 8 /* sectors loaded past a sequential miss */
+#define QDISK_EXTENTS 8 /* files with a cached map position */
+
 #if 0
 struct qDiscHeader {
   uw16	id;
@@ -131,6 +137,15 @@ struct sectorInfo {
 	Cond free;
 	Cond changed;
 	Cond locked;
+	int hnext; /* hash chain, -1 terminated */
+	int prev, next; /* LRU list of unlocked buffers */
+};
+
+/* last map lookup of a file: QLWA group -> cluster, floppy block -> slot */
+struct extent {
+	int file; /* -1 if unused */
+	int group;
+	int phys;
 };
 
 struct formatInfo {
@@ -166,6 +181,12 @@ struct FLP_FCB {
 
 	Ptr lastSector;
 
+	int hash[QDISK_HASH_SIZE]; /* logical sector -> buffer chains */
+	int lru_head, lru_tail; /* most and least recently used */
+	int lastMiss; /* to spot sequential reads */
+	struct extent ext[QDISK_EXTENTS];
+	int extNext; /* next entry to recycle */
+
 	short fatSectors;
 	Cond isValid;
 	/*Cond		isDisk;   */
@@ -175,27 +196,63 @@ struct FLP_FCB {
 struct FLP_FCB *curr_flpfcb;
 
 static OSErr DiskRead(long, Ptr, long, long);
+static OSErr DiskWrite(long, Ptr, long, long);
 static OSErr LoadLogSector(int, Ptr);
 static void FixLogical(uw8 *, Cond);
 static OSErr WriteLogSector(int, Ptr);
 static OSErr WriteBlock0(void);
 w32 qfLen(FileNum);
 
+static int cmp_dirty(const void *a, const void *b)
+{
+	int sa = curr_flpfcb->si[*(const int *)a].logSector;
+	int sb = curr_flpfcb->si[*(const int *)b].logSector;
+
+	return (sa > sb) - (sa < sb);
+}
+
 /* replaces dangerous FlushFile */
 void FlushSectors()
 {
-	int k;
+	int dirty[QDISK_DATA_BUFS];
+	int n = 0, i, j, k;
 
 	/* this should not be necessary but the code is not yet very clean..*/
 	WriteBlock0();
 
-	for (k = 0; k < curr_flpfcb->bufcount; k++) {
-		if (!curr_flpfcb->si[k].free && curr_flpfcb->si[k].changed) {
-			WriteLogSector(curr_flpfcb->si[k].logSector,
-				       curr_flpfcb->buffer + ((long)k << 9));
-			curr_flpfcb->si[k].changed = false;
-			/*printf("flushing buffer %d\n",k);*/
+	/* WriteBlock0 has written the FAT buffers */
+	for (k = curr_flpfcb->fatSectors; k < curr_flpfcb->bufcount; k++) {
+		if (!curr_flpfcb->si[k].free && curr_flpfcb->si[k].changed)
+			dirty[n++] = k;
+	}
+
+	/* QXL.WIN sectors are linear, so runs go out in one write each */
+	if (curr_flpfcb->DiskType == qlwa && n > 1) {
+		char run[QDISK_DATA_BUFS << 9];
+
+		qsort(dirty, n, sizeof(dirty[0]), cmp_dirty);
+		for (i = 0; i < n; i = j) {
+			int first = curr_flpfcb->si[dirty[i]].logSector;
+
+			for (j = i; j < n &&
+				    curr_flpfcb->si[dirty[j]].logSector == first + j - i;
+			     j++) {
+				memcpy(run + ((long)(j - i) << 9),
+				       curr_flpfcb->buffer + ((long)dirty[j] << 9), 512);
+				curr_flpfcb->si[dirty[j]].changed = false;
+			}
+			DiskWrite(curr_flpfcb->refNum, run, (long)(j - i) << 9,
+				  (long)first << 9);
 		}
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		k = dirty[i];
+		WriteLogSector(curr_flpfcb->si[k].logSector,
+			       curr_flpfcb->buffer + ((long)k << 9));
+		curr_flpfcb->si[k].changed = false;
+		/*printf("flushing buffer %d\n",k);*/
 	}
 }
 
@@ -214,6 +271,7 @@ void TestCloseDevs()
 				    (curr_flpfcb->lastclose != -1) &&
 				    (time(NULL) - curr_flpfcb->lastclose > 3)) {
 					FlushSectors();
+					asyncIoForget(curr_flpfcb->refNum);
 					close(curr_flpfcb->refNum);
 					free(curr_flpfcb->buffer);
 					free(curr_flpfcb->si);
@@ -225,13 +283,87 @@ void TestCloseDevs()
 
 /* routines initialization */
 
+static void lru_unlink(int i)
+{
+	struct sectorInfo *si = curr_flpfcb->si;
+
+	if (si[i].prev >= 0)
+		si[si[i].prev].next = si[i].next;
+	else
+		curr_flpfcb->lru_head = si[i].next;
+	if (si[i].next >= 0)
+		si[si[i].next].prev = si[i].prev;
+	else
+		curr_flpfcb->lru_tail = si[i].prev;
+}
+
+static void lru_push(int i)
+{
+	struct sectorInfo *si = curr_flpfcb->si;
+
+	si[i].prev = -1;
+	si[i].next = curr_flpfcb->lru_head;
+	if (curr_flpfcb->lru_head >= 0)
+		si[curr_flpfcb->lru_head].prev = i;
+	curr_flpfcb->lru_head = i;
+	if (curr_flpfcb->lru_tail < 0)
+		curr_flpfcb->lru_tail = i;
+}
+
+static void lru_touch(int i)
+{
+	curr_flpfcb->si[i].time = ++(curr_flpfcb->counter);
+	if (!curr_flpfcb->si[i].locked && curr_flpfcb->lru_head != i) {
+		lru_unlink(i);
+		lru_push(i);
+	}
+}
+
+static void hash_insert(int i)
+{
+	int *h = &curr_flpfcb->hash[curr_flpfcb->si[i].logSector &
+				    (QDISK_HASH_SIZE - 1)];
+
+	curr_flpfcb->si[i].hnext = *h;
+	*h = i;
+}
+
+static void hash_remove(int i)
+{
+	int *h = &curr_flpfcb->hash[curr_flpfcb->si[i].logSector &
+				    (QDISK_HASH_SIZE - 1)];
+
+	while (*h != i)
+		h = &curr_flpfcb->si[*h].hnext;
+	*h = curr_flpfcb->si[i].hnext;
+}
+
+static int hash_find(int sector)
+{
+	int i = curr_flpfcb->hash[sector & (QDISK_HASH_SIZE - 1)];
+
+	while (i >= 0 && curr_flpfcb->si[i].logSector != sector)
+		i = curr_flpfcb->si[i].hnext;
+	return i;
+}
+
+/* buffers below fatSectors hold the FAT and stay out of the LRU list */
 static void InitDiskTables()
 {
 	int i;
 
+	for (i = 0; i < QDISK_HASH_SIZE; i++)
+		curr_flpfcb->hash[i] = -1;
+	curr_flpfcb->lru_head = curr_flpfcb->lru_tail = -1;
+	curr_flpfcb->lastMiss = -2;
+	for (i = 0; i < QDISK_EXTENTS; i++)
+		curr_flpfcb->ext[i].file = -1;
+	curr_flpfcb->extNext = 0;
 	for (i = 0; i < curr_flpfcb->bufcount; i++) {
 		curr_flpfcb->si[i].free = true;
 		curr_flpfcb->si[i].locked = false;
+		if (i >= curr_flpfcb->fatSectors)
+			lru_push(i);
 	}
 }
 
@@ -317,12 +449,17 @@ static OSErr LoadSector0(void)
 			/* printf("guessing %d sectors FAT length\n",curr_flpfcb->fatSectors); */
 		}
 
+		/* Fit FAT + some buffer (HD floppies double fatSectors below) */
 		curr_flpfcb->bufcount =
-			curr_flpfcb->fatSectors + 9; /* Fit FAT + some buffer */
+			curr_flpfcb->fatSectors *
+				(curr_flpfcb->DiskType == floppyHD ? 2 : 1) +
+			QDISK_DATA_BUFS;
 
 		/* free old buffers */
 		if (curr_flpfcb->buffer)
 			free(curr_flpfcb->buffer);
+		if (curr_flpfcb->si)
+			free(curr_flpfcb->si);
 
 		curr_flpfcb->buffer =
 			(char *)malloc(512 * (curr_flpfcb->bufcount));
@@ -350,6 +487,7 @@ static OSErr LoadSector0(void)
 			curr_flpfcb->si[i].locked = true;
 			curr_flpfcb->si[i].logSector = i;
 			curr_flpfcb->si[i].fileNum = fat_fn();
+			hash_insert(i);
 		}
 	}
 
@@ -468,20 +606,13 @@ OSErr QFOpenDisk(struct mdvFile *f)
 		return 0; /* nothing to do */
 }
 
+/* Through async_io.h: writes land in the background, so reads of
+   what hasn't been written yet wait for it */
 static OSErr DiskRead(long fref, Ptr dest, long count, long offset)
 {
-	int res, fd;
-
-	fd = fref;
-
-	/*printf("positioning at %d\n",offset);*/
-	res = lseek(fd, offset, SEEK_SET);
-	if (res < 0) {
-		perror("DiskRead:lseek");
-		return -1;
-	}
+	long res;
 
-	res = x_read(fd, dest, count);
+	res = asyncIoRead(fref, dest, count, offset);
 	/*  printf("calling DiskRead, res %d\n",res);*/
 	if (res < 0) {
 		perror("DiskRead:read");
@@ -493,20 +624,8 @@ static OSErr DiskRead(long fref, Ptr dest, long count, long offset)
 
 static OSErr DiskWrite(long fref, Ptr dest, long count, long offset)
 {
-	int res, fd;
-	fd = fref;
-
-	res = lseek(fd, offset, SEEK_SET);
-	if (res < 0) {
-		perror("DiskWrite:lseek");
-		return -1;
-	}
-
-	res = write(fd, dest, count);
 	/*  printf("calling DiksWrite\n");*/
-	if (res < 0)
-		return -1;
-	return 0;
+	return asyncIoWrite(fref, dest, count, offset) < 0 ? -1 : 0;
 }
 
 /* read/write sectors */
@@ -594,10 +713,76 @@ static OSErr WriteLogSector(int sector, Ptr p)
 
 /* read/write sectors through buffer */
 
+/* Take the least recently used buffer for sector, writing it back first */
+static int ClaimBuffer(int sector, FileNum fileNum)
+{
+	int k = curr_flpfcb->lru_tail;
+
+	if (!curr_flpfcb->si[k].free) {
+		if (curr_flpfcb->si[k].changed)
+			WriteLogSector(curr_flpfcb->si[k].logSector,
+				       curr_flpfcb->buffer + ((long)k << 9));
+		hash_remove(k);
+	}
+	curr_flpfcb->si[k].logSector = sector;
+	curr_flpfcb->si[k].fileNum = fileNum;
+	curr_flpfcb->si[k].free = false;
+	curr_flpfcb->si[k].changed = false;
+	hash_insert(k);
+	lru_touch(k);
+	return k;
+}
+
+static void ReleaseBuffer(int k)
+{
+	hash_remove(k);
+	curr_flpfcb->si[k].free = true;
+	lru_unlink(k);
+	curr_flpfcb->si[k].prev = curr_flpfcb->lru_tail;
+	curr_flpfcb->si[k].next = -1;
+	if (curr_flpfcb->lru_tail >= 0)
+		curr_flpfcb->si[curr_flpfcb->lru_tail].next = k;
+	curr_flpfcb->lru_tail = k;
+	if (curr_flpfcb->lru_head < 0)
+		curr_flpfcb->lru_head = k;
+}
+
+/*
+ * After a miss that follows the previous one, load the next few
+ * sectors too.  QXL.WIN sectors are linear in the image, so the run
+ * comes in with a single read; the buffers holding it are the least
+ * recently used ones, and the demand sector is touched after them.
+ * The run after it is started in the background for the next miss.
+ * Returns 0 once demand holds sector.
+ */
+static OSErr ReadAhead(int sector, FileNum fileNum, Ptr demand)
+{
+	char run[(QDISK_READ_AHEAD + 1) << 9];
+	int n, i, k;
+	long got;
+
+	for (n = 0; n < QDISK_READ_AHEAD && hash_find(sector + 1 + n) < 0; n++)
+		;
+	if (n == 0)
+		return -1;
+	got = asyncIoRead(curr_flpfcb->refNum, run, (long)(n + 1) << 9, (long)sector << 9);
+	if (got < 512)
+		return -1;
+	if (got == (long)(n + 1) << 9)
+		asyncIoReadAhead(curr_flpfcb->refNum, (long)(QDISK_READ_AHEAD + 1) << 9,
+				 (long)(sector + n + 1) << 9);
+	memcpy(demand, run, 512);
+	for (i = 1; i <= n && ((long)(i + 1) << 9) <= got; i++) {
+		k = ClaimBuffer(sector + i, fileNum);
+		memcpy(curr_flpfcb->buffer + ((long)k << 9), run + ((long)i << 9), 512);
+	}
+	return 0;
+}
+
 static Ptr GetSector(int sector, FileNum fileNum)
 {
-	int i, k;
-	long t = 2000000000l;
+	int k;
+	Cond sequential;
 	Ptr p;
 
 	/*printf("GetSector sector %d, file %d\n",sector,fileNum);*/
@@ -606,44 +791,29 @@ static Ptr GetSector(int sector, FileNum fileNum)
 		gError = ERR_UNINITIALIZED_DISK;
 		return nil;
 	}
-	for (i = 0; i < curr_flpfcb->bufcount; i++) {
-		if (curr_flpfcb->si[i].free) {
-			k = i;
-			t = -1;
-		} else if (curr_flpfcb->si[i].logSector == sector) {
-			curr_flpfcb->si[i].time = ++(curr_flpfcb->counter);
-			gError = 0;
-			/*printf("... returns cached sector %d\n",i);*/
-			return curr_flpfcb->buffer + ((long)i << 9);
-		} else if (!curr_flpfcb->si[i]
-				    .locked /* && curr_flpfcb->si[i].time<t  */) {
-			t = curr_flpfcb->si[i].time;
-			k = i;
-		}
-#if 0
-      else {
-        printf("GetSector1 : Dropped out of if clause!\n");
-      }
 
-      printf("GetSector1 : !locked = %d, time %d t %d \t\t",!curr_flpfcb->si[i].locked,curr_flpfcb->si[i].time,t);
-      printf(": time<t = %d\n",((long)curr_flpfcb->si[i].time)<t);
-      printf("GetSector1 : i = %d, k = %d\n",i, k);
-#endif
+	k = hash_find(sector);
+	if (k >= 0) {
+		lru_touch(k);
+		gError = 0;
+		/*printf("... returns cached sector %d\n",k);*/
+		return curr_flpfcb->buffer + ((long)k << 9);
 	}
-	/*printf("... uses buffer %d,\t",k);*/
 
+	sequential = sector == curr_flpfcb->lastMiss + 1;
+	curr_flpfcb->lastMiss = sector;
+
+	k = ClaimBuffer(sector, fileNum);
 	p = curr_flpfcb->buffer + ((long)k << 9);
-	if (!curr_flpfcb->si[k].free && curr_flpfcb->si[k].changed)
-		WriteLogSector(curr_flpfcb->si[k].logSector, p);
+	if (sequential && curr_flpfcb->DiskType == qlwa &&
+	    ReadAhead(sector, fileNum, p) == 0) {
+		lru_touch(k);
+		gError = 0;
+		return p;
+	}
 	gError = LoadLogSector(sector, p);
-	if (gError == 0) {
-		curr_flpfcb->si[k].logSector = sector;
-		curr_flpfcb->si[k].fileNum = fileNum;
-		curr_flpfcb->si[k].time = ++(curr_flpfcb->counter);
-		curr_flpfcb->si[k].free = false;
-		curr_flpfcb->si[k].changed = false;
-	} else {
-		curr_flpfcb->si[k].free = true;
+	if (gError != 0) {
+		ReleaseBuffer(k);
 		p = nil;
 	}
 	/*printf("returns %d\n",p);*/
@@ -659,7 +829,7 @@ static void PutSector(Ptr p)
 		CustomErrorAlert("Bad written sector buffer");
 	else {
 		curr_flpfcb->si[k].changed = true;
-		curr_flpfcb->si[k].time = ++(curr_flpfcb->counter);
+		lru_touch(k);
 	}
 }
 
@@ -668,9 +838,18 @@ static OSErr WriteBlock0(void)
 	int i;
 	OSErr e = 0;
 
-	for (i = 1; i < curr_flpfcb->fatSectors && e == 0; i++) {
-		e = WriteLogSector(i, curr_flpfcb->buffer + ((long)i << 9));
-		curr_flpfcb->si[i].changed = false;
+	if (curr_flpfcb->DiskType == qlwa) {
+		/* the map is contiguous on disk and in the buffer */
+		if (curr_flpfcb->fatSectors > 1)
+			e = DiskWrite(curr_flpfcb->refNum, curr_flpfcb->buffer + 512,
+				      (long)(curr_flpfcb->fatSectors - 1) << 9, 512);
+		for (i = 1; i < curr_flpfcb->fatSectors; i++)
+			curr_flpfcb->si[i].changed = false;
+	} else {
+		for (i = 1; i < curr_flpfcb->fatSectors && e == 0; i++) {
+			e = WriteLogSector(i, curr_flpfcb->buffer + ((long)i << 9));
+			curr_flpfcb->si[i].changed = false;
+		}
 	}
 	if (e == 0) {
 		e = WriteLogSector(0, curr_flpfcb->buffer);
@@ -679,6 +858,31 @@ static OSErr WriteBlock0(void)
 	return e;
 }
 
+static struct extent *ExtentFind(int file, Cond create)
+{
+	struct extent *e;
+	int i;
+
+	for (i = 0; i < QDISK_EXTENTS; i++)
+		if (curr_flpfcb->ext[i].file == file)
+			return &curr_flpfcb->ext[i];
+	if (!create)
+		return NULL;
+	e = &curr_flpfcb->ext[curr_flpfcb->extNext];
+	curr_flpfcb->extNext = (curr_flpfcb->extNext + 1) % QDISK_EXTENTS;
+	e->file = file;
+	e->group = -1;
+	return e;
+}
+
+static void ExtentForget(int file)
+{
+	struct extent *e = ExtentFind(file, false);
+
+	if (e)
+		e->file = -1;
+}
+
 static int QLWA_KillFileTail(FileNum fileNum, int sector)
 {
 	uw16 *p, *pl;
@@ -728,25 +932,30 @@ static int QLWA_KillFileTail(FileNum fileNum, int sector)
 /* QLWA version */
 static int QLWA_GetFileSectNum(FileNum fileNum, int sector)
 {
-	uw16 *p;
+	uw16 *fat, *p;
 	int group, sr, g;
+	struct extent *e;
 
-	p = (uw16 *)(curr_flpfcb->buffer + 0x40);
+	fat = (uw16 *)(curr_flpfcb->buffer + 0x40);
 	group = sector / QWA_SPC(curr_flpfcb->qdh);
 	sr = sector % QWA_SPC(curr_flpfcb->qdh);
 
-	/*get first cluster of file */
-	/*printf("\n SpC %d, first cluster %d\t",QWA_SPC(curr_flpfcb->qdh),fileNum.file);*/
-	for (p += fileNum.file, g = 0; g != group && *p; g++) {
-		/*printf("p-(buffer+0x40)=%d\t",(int)p-((int) (curr_flpfcb->buffer+0x40)));
-      printf("next block nr. %d\t",(uw16)RW(p));*/
-		p = (uw16 *)(curr_flpfcb->buffer + 0x40) + (uw16)RW(p);
+	/* walk the chain from the last position, or the first cluster */
+	e = ExtentFind(fileNum.file, true);
+	if (e->group >= 0 && e->group <= group) {
+		p = fat + e->phys;
+		g = e->group;
+	} else {
+		p = fat + fileNum.file;
+		g = 0;
+	}
+	for (; g != group && *p; g++)
+		p = fat + (uw16)RW(p);
+	if (g == group) {
+		e->group = g;
+		e->phys = p - fat;
+		return e->phys * QWA_SPC(curr_flpfcb->qdh) + sr;
 	}
-	if (g == group)
-		return ((int)((uintptr_t)p -
-			      (uintptr_t)(curr_flpfcb->buffer + 0x40))) /
-			       2 * QWA_SPC(curr_flpfcb->qdh) +
-		       sr;
 
 	gError = ERR_NO_FILE_BLOCK;
 	return -1;
@@ -756,7 +965,8 @@ static int FileBlockSector(FileNum fileNum, int sector)
 {
 	register uw8 *p;
 	register w32 value;
-	register w16 i, n;
+	register w16 i, k, n;
+	struct extent *e;
 	int res;
 	w16 w;
 
@@ -766,11 +976,16 @@ static int FileBlockSector(FileNum fileNum, int sector)
 	}
 
 	n = (QDH_TOTAL(curr_flpfcb->qdh) / QDH_SPB(curr_flpfcb->qdh)) >> 1;
-	p = (uw8 *)(curr_flpfcb->buffer + 96);
 	value = ((w32)(fileNum.file & 0x0fff) << 12) +
 		((sector / QDH_SPB(curr_flpfcb->qdh)) & 0x0fff);
 	w = -1;
-	for (i = 0; i < n; i++) {
+	/* files are mostly allocated in order, so scan on from the last hit */
+	e = ExtentFind(fileNum.file, true);
+	i = e->group >= 0 && (e->phys >> 1) < n ? e->phys >> 1 : 0;
+	for (k = 0; k < n; k++, i++) {
+		if (i == n)
+			i = 0;
+		p = (uw8 *)(curr_flpfcb->buffer + 96) + i * 6;
 		if ((RL((w32 *)p) >> 8) == value) {
 			w = i << 1;
 			break;
@@ -778,9 +993,10 @@ static int FileBlockSector(FileNum fileNum, int sector)
 			w = (i << 1) + 1;
 			break;
 		}
-		p += 6;
 	}
 	if (w >= 0) {
+		e->group = sector / QDH_SPB(curr_flpfcb->qdh);
+		e->phys = w;
 		w = w * QDH_SPB(curr_flpfcb->qdh) +
 		    (sector % QDH_SPB(curr_flpfcb->qdh));
 	} else
@@ -811,6 +1027,7 @@ static Ptr QLWA_GetFreeBlock0(FileNum *fe)
 		QWA_SETFC(curr_flpfcb->qdh, QWA_FC(curr_flpfcb->qdh) - 1);
 
 		(*fe).file = nb;
+		ExtentForget(nb);
 
 		return GetSector(nb * QWA_SPC(curr_flpfcb->qdh), *fe);
 	} else {
@@ -825,6 +1042,7 @@ static Ptr QLWA_GetFreeBlock(FileNum fileNum, int block)
 	int g, i;
 	int nb;
 	uw16 *p;
+	struct extent *e;
 
 	if (QWA_FC(curr_flpfcb->qdh) > 0 && QWA_FFC(curr_flpfcb->qdh)) {
 		nb = QWA_FFC(curr_flpfcb->qdh);
@@ -838,8 +1056,10 @@ static Ptr QLWA_GetFreeBlock(FileNum fileNum, int block)
 		curr_flpfcb->si[((char *)p - curr_flpfcb->buffer) >> 9].changed =
 			true;
 
+		/* find the end of the chain, from the last position if known */
+		e = ExtentFind(fileNum.file, false);
 		p = (uw16 *)(curr_flpfcb->buffer + 0x40);
-		for (p += fileNum.file; *p;
+		for (p += e && e->group >= 0 ? e->phys : fileNum.file; *p;
 		     p = (uw16 *)(curr_flpfcb->buffer + 0x40) + (uw16)RW(p)) {
 			/*printf("GetFreeBlock: %d\n",((int)p-(int)(curr_flpfcb->buffer+0x40))/2);*/
 		}
@@ -947,6 +1167,7 @@ static OSErr KillFile(FileNum fileNum)
 	register uw8 *p;
 	register w16 i, n;
 
+	ExtentForget(fileNum.file);
 	if (curr_flpfcb->DiskType == qlwa) {
 		return QLWA_KillFile(fileNum);
 	} else {
@@ -981,6 +1202,7 @@ OSErr KillFileTail(FileNum fileNum, int nBlock)
 	register w16 i, n;
 	Cond changed = false;
 
+	ExtentForget(fileNum.file);
 	if (curr_flpfcb->DiskType == qlwa)
 		return QLWA_KillFileTail(fileNum, nBlock);
 
@@ -1711,6 +1933,7 @@ OSErr QDiskIO(struct mdvFile *f, short op)
 		if (count > 0) {
 			reg[0] = QRead(f, (Ptr)memBase + from, &count, false,
 				       nil);
+			MemoryDMAWritten(from, count);
 			/*	printf("io.fstrg res: %d\n",e);*/
 
 			to = from + count;
@@ -1844,6 +2067,7 @@ OSErr QDiskIO(struct mdvFile *f, short op)
 
 		if (count > 0) {
 			*reg = QRead(f, (Ptr)memBase + from, &count, false, nil);
+			MemoryDMAWritten(from, count);
 			to = from + count;
 			aReg[1] = to;
 		}
@@ -1954,6 +2178,7 @@ OSErr QDiskIO(struct mdvFile *f, short op)
 		WriteLong(aReg[1] + 0x24, free * sect_per_cluster() / 2);
 		WriteLong(aReg[1] + 0x20, mxs * sect_per_cluster() / 2);
 		WriteLong(aReg[1] + 0x28, 64);
+		MemoryDMAWritten(aReg[1], 64);
 	}
 #else
 		*reg = -15;
@@ -1,6 +1,9 @@
+#include <SDL_atomic.h>
 #include <SDL_endian.h>
 #include <stdint.h>
 
+#include "machine_local.h"
+
 #ifndef QL68000_H
 #define QL68000_H
 
@@ -64,7 +67,21 @@ struct qFloat
 /* end QLtypes.h */
 #define FIX_INS
 
+#ifdef COMPACT_TABLE
+/* Opcode to handler through a 16 bit index per opcode, 128KB instead of
+   512KB of pointers for a few hundred distinct handlers */
+#define QLUX_MAX_HANDLERS	4096
+extern uw16 *qlux_index;
+extern void (*qlux_handlers[])(void);
+#define QLUX_HANDLER(c)	(qlux_handlers[qlux_index[c]])
+#else
 extern void (**qlux_table)(void);
+#define QLUX_HANDLER(c)	(qlux_table[c])
+#endif
+
+/* Install the handler for opcode c, at init or when a pseudo-op is
+   patched in; the decode cache wants flushing after */
+void SetOpcodeHandler(uw16 c, void (*f)(void));
 
 typedef int OSErr;
 
@@ -74,12 +91,51 @@ typedef int OSErr;
 
 extern int gKeyDown, shiftKey, controlKey, optionKey, alphaLock, altKey;
 
-extern w32              reg[16];
-extern w32              usp,ssp;
-
-extern uw16 *pc;
-extern gshort code;
-extern int nInst;    /* dangerous - it is 'volatile' to some extent */
+extern MACHINE_LOCAL w32              reg[16];
+extern MACHINE_LOCAL uw16 *pc;
+extern MACHINE_LOCAL gshort code;
+
+/* The rest of the state the interpreter touches on every instruction or
+ * chunk, kept together in one cache line.  The old global names stay as
+ * macros; reg, pc and code are left out as those names are also used by
+ * locals, struct members and other headers. */
+struct cpu_state {
+	int nInst;	/* dangerous - it is 'volatile' to some extent */
+	int nInst2;
+	int cc_op;
+	w32 cc_src, cc_dst, cc_res;
+	w32 usp, ssp;
+	Cond trace, supervisor, xflag, negative, zero, overflow, carry;
+	Cond stopped;
+	volatile Cond extraFlag;
+	char iMask;
+	short exception;
+	SDL_atomic_t irqPending;	/* bit n: level n requested */
+} __attribute__((aligned(64)));
+
+extern MACHINE_LOCAL struct cpu_state cpu;
+
+#define nInst		(cpu.nInst)
+#define nInst2		(cpu.nInst2)
+#define cc_op		(cpu.cc_op)
+#define cc_src		(cpu.cc_src)
+#define cc_dst		(cpu.cc_dst)
+#define cc_res		(cpu.cc_res)
+#define usp		(cpu.usp)
+#define ssp		(cpu.ssp)
+#define trace		(cpu.trace)
+#define supervisor	(cpu.supervisor)
+#define xflag		(cpu.xflag)
+#define negative	(cpu.negative)
+#define zero		(cpu.zero)
+#define overflow	(cpu.overflow)
+#define carry		(cpu.carry)
+#define stopped		(cpu.stopped)
+#define extraFlag	(cpu.extraFlag)
+#define iMask		(cpu.iMask)
+#define exception	(cpu.exception)
+#define irqPending	(cpu.irqPending)
+void ExecuteLoopReselect(void);
 
 #if defined(__x86_64__) || defined(__aarch64__)
 #define HUGE_POINTER
@@ -105,11 +161,51 @@ extern void TraceInit(void);
 extern void DoTrace(void);
 #endif
 
-extern int   nInst2;
-extern Cond             trace,supervisor,xflag,negative,zero,overflow,carry;
-extern char             iMask;
-extern Cond             stopped;
-extern volatile char    pendingInterrupt;
+
+/* Lazy C/V/X: add/sub/cmp handlers set N and Z and leave their operands
+ * here; carry, overflow and xflag are only valid after CC_FLUSH().
+ * Everything that reads or writes those three outside the lazy handlers
+ * must flush first. */
+#define CC_NONE		0
+#define CC_ADD_B	1
+#define CC_ADD_W	2
+#define CC_ADD_L	3
+#define CC_SUB_B	5
+#define CC_SUB_W	6
+#define CC_SUB_L	7
+#define CC_CMP_B	9	/* as CC_SUB_x, but X is not touched */
+#define CC_CMP_W	10
+#define CC_CMP_L	11
+void cc_eval(void);
+void cc_eval_x(void);
+#define CC_FLUSH()	do { if (cc_op) cc_eval(); } while (0)
+#define CC_LAZY(_op_, _s_, _d_, _r_) \
+	do { cc_op = (_op_); cc_src = (_s_); cc_dst = (_d_); cc_res = (_r_); } while (0)
+#define CC_LAZY_CMP(_op_, _s_, _d_, _r_) \
+	do { if (cc_op && cc_op < CC_CMP_B) cc_eval_x(); \
+	     CC_LAZY(_op_, _s_, _d_, _r_); } while (0)
+
+/* Any thread; the CPU looks at them at chunk and exception boundaries */
+void RaiseInterrupt(int level);
+void ClearInterrupt(int level);
+
+/* Highest requested level, 0 if none */
+static inline int PendingInterrupt(void)
+{
+	int m = SDL_AtomicGet(&irqPending);
+	int l = 7;
+
+	while (l && !(m & (1 << l)))
+		l--;
+	return l;
+}
+
+static inline Cond InterruptDue(void)
+{
+	int l = PendingInterrupt();
+
+	return l == 7 || l > iMask;
+}
 
 #define   aReg  (reg+8)
 #define   m68k_sp    (aReg+7)
@@ -119,34 +215,32 @@ extern volatile char    pendingInterrupt;
 #ifdef ZEROMAP
 #define memBase          ((w32*)0)
 #else
-extern w32              *memBase;
+extern MACHINE_LOCAL w32              *memBase;
 #endif
 
 //extern w32              *ramTop;
-extern w32              RTOP;
-extern short            exception;
-extern w32              badAddress;
-extern w16              readOrWrite;
-extern w32              dummy;
-extern Ptr              dest;
+extern MACHINE_LOCAL w32              RTOP;
+extern MACHINE_LOCAL w32              badAddress;
+extern MACHINE_LOCAL w16              readOrWrite;
+extern MACHINE_LOCAL w32              dummy;
+extern MACHINE_LOCAL Ptr              dest;
 #if 1
 #define MEA_DISP 1
 #define MEA_HW 2
-extern Cond mea_acc;
+extern MACHINE_LOCAL Cond mea_acc;
 #else
 #ifndef VM_SCR
 extern Cond             isDisplay;
 #endif
 extern Cond             isHW;
 #endif
-extern w32              lastAddr;
-extern volatile Cond    extraFlag;
-extern volatile w8      intReg;
-extern volatile w8      theInt;
+extern MACHINE_LOCAL w32              lastAddr;
+extern MACHINE_LOCAL volatile w8      intReg;
+extern MACHINE_LOCAL volatile w8      theInt;
 
 extern char             dispScreen;
 extern Cond             dispMode;
-extern Cond             badCodeAddress;
+extern MACHINE_LOCAL Cond             badCodeAddress;
 
 #define RM_SHIFT pageshift
 
@@ -161,8 +255,24 @@ extern w32  displayTo;
 
 extern int isMinerva;
 
-extern int cpu68010; /* 1 = 68010 mode, 0 = 68000 mode */
-extern w32 vbr;      /* Vector Base Register (68010+) */
+extern MACHINE_LOCAL int cpu68010; /* 1 = 68010 mode, 0 = 68000 mode */
+extern MACHINE_LOCAL w32 vbr;      /* Vector Base Register (68010+) */
+extern MACHINE_LOCAL int cpu68020; /* 1 = 68020 subset, with cpu68010 */
+
+/* d8(base,Xn) from the extension word just read at pc - 1; the 68020
+   scales the index and has the full format, whose words follow */
+rw32 IndexEAFull(w32 base, uw16 ext);
+
+static inline w32 IndexEA(w32 base, w16 ext)
+{
+	w32 x = reg[(ext >> 12) & 15];
+
+	if (unlikely(ext & 0x100) && cpu68020)
+		return IndexEAFull(base, ext);
+	if ((ext & 2048) == 0)
+		x = (w16)x;
+	return base + (x << ((ext >> 9) & (cpu68020 * 3))) + (w8)ext;
+}
 
 #ifndef vml
 #define vml static
@@ -263,40 +373,54 @@ extern char * oldscr;
 #define WB(_addr_,_val_)(*(uw8*)(_addr_)=(_val_))
 #define RB(_addr_) (*(uw8 *)(_addr_))
 
+/*
+ * Guest RAM stays big endian, so DMA, the loaders and the buffers behind
+ * the HW regions all see guest byte order.  On little endian hosts the
+ * swaps are compiler builtins, which fold into the load or store (movbe,
+ * rev); older SDL versions swap through inline asm, which cannot.
+ */
+#if defined(__GNUC__) && SDL_BYTEORDER == SDL_LIL_ENDIAN
+#define QL_SWAP16(x)	__builtin_bswap16(x)
+#define QL_SWAP32(x)	__builtin_bswap32(x)
+#else
+#define QL_SWAP16(x)	SDL_SwapBE16(x)
+#define QL_SWAP32(x)	SDL_SwapBE32(x)
+#endif
+
 static inline ruw16 q2hw(uw16 val)
 {
-  return SDL_SwapBE16(val);
+  return QL_SWAP16(val);
 }
 static inline ruw32 q2hl(uw32 val)
 {
-	return SDL_SwapBE32(val);
+	return QL_SWAP32(val);
 }
 static inline ruw16 h2qw(uw16 v)
 {
-	return SDL_SwapBE16(v);
+	return QL_SWAP16(v);
 }
 static inline ruw32 h2ql(uw32 v)
 {
-	return SDL_SwapBE32(v);
+	return QL_SWAP32(v);
 }
 
 static inline ruw16 _rw_(uw16 *s)
 {
-	return SDL_SwapBE16(*s);
+	return QL_SWAP16(*s);
 }
 static inline ruw32 _rl_(uw32 *s)
 {
-	return SDL_SwapBE32(*s);
+	return QL_SWAP32(*s);
 }
 
 static inline void _ww_(uw16 *d, uw16 v)
 {
-	*d = SDL_SwapBE16(v);
+	*d = QL_SWAP16(v);
 }
 
 static inline void _wl_(uw32 *d, uw32 v)
 {
-	*d = SDL_SwapBE32(v);
+	*d = QL_SWAP32(v);
 }
 
 #ifdef PROFILER
@@ -305,13 +429,13 @@ static inline void _wl_(uw32 *d, uw32 v)
 static inline ruw16 _rw_pc_(uw16 *s) {
 	uw32 addr = (uw32)(uintptr_t)s - (uw32)(uintptr_t)memBase;
 	Profiler_RecordInstrRead(addr);
-	return SDL_SwapBE16(*s);
+	return QL_SWAP16(*s);
 }
 static inline ruw32 _rl_pc_(uw32 *s) {
 	uw32 addr = (uw32)(uintptr_t)s - (uw32)(uintptr_t)memBase;
 	Profiler_RecordInstrRead(addr);
 	Profiler_RecordInstrRead(addr + 2);  // 32-bit read is two 16-bit fetches
-	return SDL_SwapBE32(*s);
+	return QL_SWAP32(*s);
 }
 #define RW_PC(_r_a) _rw_pc_((uw16 *)(_r_a))
 #define RL_PC(_r_al) _rl_pc_((uw32 *)(_r_al))
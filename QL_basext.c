@@ -25,6 +25,7 @@
 #include "instructions.h"
 #include "QDOS.h"
 #include "QL_screen.h"
+#include "memaccess.h"
 
 #include "unixstuff.h"
 #include "xcodes.h"
@@ -449,6 +450,7 @@ int bas_retstr(int len, const char *str)
 	p = bas_resstack(len + 2);
 	WriteWord(p, len);
 	memcpy((char *)memBase + p + 2, str, len);
+	MemoryDMAWritten(p + 2, len);
 
 	reg[4] = 1;
 	return 0;
@@ -486,7 +488,7 @@ int bas_retfloat(int i)
 	int shift = 0;
 	int mantissa = 0;
 	int exponent = 0x81F;
-	int negative = 0;
+	int neg = 0;
 
 	p = bas_resstack(6);
 
@@ -505,7 +507,7 @@ int bas_retfloat(int i)
 	}
 
 	if (i < 0) {
-		negative = 1;
+		neg = 1;
 		i = ~i;
 	}
 
@@ -522,7 +524,7 @@ int bas_retfloat(int i)
 		i <<= 1;
 	}
 
-	if (negative) {
+	if (neg) {
 		i ^= (0xFFFFFFFF << shift);
 	}
 
@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include "debug.h"
 #include "emulator_options.h"
+#include "memaccess.h"
 #include "iexl_general.h"
 #include "xcodes.h"
 #include "QDOS.h"
@@ -274,6 +275,8 @@ int LoadMainRom(void) /* load and modify QL ROM */
 		p = InstallQemlRom();
 
 		PatchBootDev();
+		// Patched behind the decode cache
+		MemoryDMAWritten(QL_ROM_BASE, QL_ROM_SIZE);
 	}
 	if (!p && !emulatorOptionInt("no_patch"))
 		printf("warning : could not complete ROM patch\n");
@@ -325,6 +328,7 @@ void InitROM(void)
 	gPC += 2;
 #else
 	WW((Ptr)gPC - 2, 0x0c93); /* restore original instruction */
+	MemoryDMAWritten(ROMINIT_CMD_ADDR, 2);
 #endif
 #if 0
 	KillSound();
@@ -407,12 +411,14 @@ void InitROM(void)
 		QLtrap(1, 0x18, 200000);
 		if (reg[0] == 0) {
 			WW((Ptr)memBase + MIPC_CMD_ADDR, MIPC_CMD_CODE);
+			MemoryDMAWritten(MIPC_CMD_ADDR, 2);
 			WL((Ptr)memBase + aReg[0],
 			   RL((Ptr)memBase + sxvars + 0x14));
 			WL((Ptr)memBase + aReg[0] + 4, MIPC_CMD_ADDR);
 			WL((Ptr)memBase + sxvars + 0x14, aReg[0]);
 		}
 		WW((Ptr)memBase + KBENC_CMD_ADDR, KBENC_CMD_CODE);
+		MemoryDMAWritten(KBENC_CMD_ADDR, 2);
 		orig_kbenc = RL((Ptr)memBase + sxvars + 0x10);
 		WL((Ptr)memBase + sxvars + 0x10, KBENC_CMD_ADDR);
 #if 0
@@ -431,7 +437,7 @@ void InitROM(void)
 #endif
 
 #ifndef OLD_PATCH
-	qlux_table[code = 0x0c93](); /* run the original routine */
+	QLUX_HANDLER(code = 0x0c93)(); /* run the original routine */
 #endif
 }
 
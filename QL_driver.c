@@ -252,18 +252,36 @@ struct DRV Drivers[] = {
 
 w32 DEV_IO_ADDR, DEV_CLOSE_ADDR;
 
+/* Linked drivers by linkage block address, for every open, io and close */
+#define DRV_HASH_SIZE 64 /* power of two */
+
+static struct DRV *drv_hash[DRV_HASH_SIZE];
+
+static unsigned drv_slot(w32 ref)
+{
+	return ((ref >> 4) ^ (ref >> 10)) & (DRV_HASH_SIZE - 1);
+}
+
+static void drv_hash_add(struct DRV *driver)
+{
+	unsigned i = drv_slot(driver->ref);
+
+	while (drv_hash[i])
+		i = (i + 1) & (DRV_HASH_SIZE - 1);
+	drv_hash[i] = driver;
+}
+
 struct DRV *dget_drv()
 {
-	struct DRV *p;
+	w32 ref = aReg[3] + 0x18;
+	unsigned i = drv_slot(ref);
 
-	p = Drivers;
-	while (p->open != NULL) {
-		if (p->ref == aReg[3] + 0x18)
-			return p;
-		p++;
+	while (drv_hash[i]) {
+		if (drv_hash[i]->ref == ref)
+			return drv_hash[i];
+		i = (i + 1) & (DRV_HASH_SIZE - 1);
 	}
 	return 0;
-	/*if (found=(*(p->open_test))(p-Drivers,name)) break;*/
 }
 
 static void InitDevDriver(struct DRV *driver, int indx)
@@ -294,6 +312,7 @@ static void InitDevDriver(struct DRV *driver, int indx)
 	       200000l); /* allocate memory for the driver linkage block */
 	if ((*reg) == 0) {
 		driver->ref = aReg[0];
+		drv_hash_add(driver);
 		p = (w32 *)(aReg[0] + (Ptr)memBase + 4);
 		WL(p, DEV_IO_ADDR); /* io    */
 		WL(p + 1, (w32)((Ptr)(p + 3) - (Ptr)memBase)); /* open  */
@@ -307,6 +326,7 @@ static void InitDevDriver(struct DRV *driver, int indx)
 		   0x264f4eba); /* so much code is needed to fool QPAC2 ...*/
 		WL((Ptr)(p + 4) + 2, 0x2c566046);
 		WL((Ptr)(p + 5) + 2, 0x6044604a);
+		MemoryDMAWritten(driver->ref, 40 + namelen);
 
 		if ((*(driver->init))(indx, p - 1) < 0)
 			goto ddier;
@@ -329,10 +349,11 @@ void InitDrivers()
 	WW(((uw16 *)((Ptr)memBase + DEV_IO_ADDR)), DEVIO_CMD_CODE);
 	WW(((uw16 *)((Ptr)memBase + DEV_CLOSE_ADDR)), DEVC_CMD_CODE);
 	/*WW(((uw16*)((Ptr)memBase+DEV_OPEN_ADDR)),DEV_OPEN_INSTR);*/
+	MemoryDMAWritten(DEV_IO_ADDR, 4);
 
-	qlux_table[DEVO_CMD_CODE] = DrvOpen;
-	qlux_table[DEVIO_CMD_CODE] = DrvIO;
-	qlux_table[DEVC_CMD_CODE] = DrvClose;
+	SetOpcodeHandler(DEVO_CMD_CODE, DrvOpen);
+	SetOpcodeHandler(DEVIO_CMD_CODE, DrvIO);
+	SetOpcodeHandler(DEVC_CMD_CODE, DrvClose);
 
 	while (p->open != NULL) {
 		struct DRV *old_p = p++;
@@ -680,8 +701,27 @@ int parse_option(char **name, int nlen, char *opts, open_arg *vals,
 	return 1;
 }
 
-/* returns -1 bad name, 0 not found, >0 success*/
-int decode_name(char *name, struct NAME_PARS *ndescr, open_arg *parblk)
+/*
+ * decode_name() keeps its last result per device name, so opening the
+ * same name again (guest code reopening tcp_ or ser channels) restores
+ * the parsed values instead of parsing again.  String values point into
+ * rest_name, which is restored with them.
+ */
+#define NAME_CACHE_LEN 128
+#define NAME_CACHE_PARS 8
+
+struct name_cache {
+	int res;
+	int len; /* of the QDOS name */
+	int used; /* bytes of rest_name */
+	int npars;
+	char name[NAME_CACHE_LEN];
+	char rest[2 * NAME_CACHE_LEN];
+	open_arg parblk[NAME_CACHE_PARS];
+};
+
+static int decode_pars(char *name, struct NAME_PARS *ndescr, open_arg *parblk,
+		       int *npars)
 {
 	int res;
 	open_arg rval;
@@ -720,6 +760,7 @@ int decode_name(char *name, struct NAME_PARS *ndescr, open_arg *parblk)
 		case 1:
 			pars++;
 			*parblk++ = rval;
+			(*npars)++;
 			break;
 		default:
 #ifdef TEST
@@ -734,6 +775,39 @@ int decode_name(char *name, struct NAME_PARS *ndescr, open_arg *parblk)
 		return 1;
 }
 
+/* returns -1 bad name, 0 not found, >0 success*/
+int decode_name(char *name, struct NAME_PARS *ndescr, open_arg *parblk)
+{
+	struct name_cache *c = ndescr->cache;
+	int len = RW(name);
+	int res, used, npars = 0;
+
+	if (c && c->len == len && !memcmp(c->name, name + 2, len)) {
+		memcpy(rest_name, c->rest, c->used);
+		memcpy(parblk, c->parblk, c->npars * sizeof(*parblk));
+		return c->res;
+	}
+
+	res = decode_pars(name, ndescr, parblk, &npars);
+	if (!res)
+		return res;
+
+	used = max(ppname - rest_name, len + 1);
+	if (len > NAME_CACHE_LEN || npars > NAME_CACHE_PARS ||
+	    used > sizeof(c->rest))
+		return res;
+	if (!c && !(c = ndescr->cache = malloc(sizeof(*c))))
+		return res;
+	c->res = res;
+	c->len = len;
+	c->used = used;
+	c->npars = npars;
+	memcpy(c->name, name + 2, len);
+	memcpy(c->rest, rest_name, used);
+	memcpy(c->parblk, parblk, npars * sizeof(*parblk));
+	return res;
+}
+
 static char buf[1024];
 
 int ioskip(int (*io_read)(void *, void *, int), void *priv, int len)
@@ -837,6 +911,8 @@ void ioread(int (*io_read)(void *priv, Ptr from, int cnt), void *priv,
 
 errexit:
 	*count = cnt;
+	if (cnt > 0)
+		MemoryDMAWritten(from, cnt);
 
 	reg[0] = e;
 	return;
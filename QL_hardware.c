@@ -114,7 +114,7 @@ void UseIPC(void)		/* ROM patch: executing IPC command */
 {
 	if((Ptr)gPC-(Ptr)memBase-2==IPC_CMD_ADDR)
 	{	if(IPC_Command()) rts();
-		else qlux_table[code=0x40e7]();
+		else QLUX_HANDLER(code=0x40e7)();
 	}
 	else
 	{	exception=4;
@@ -261,7 +261,7 @@ void QL_KeyTrans(void)
 		WriteLong(aReg[7],ReadLong(aReg[7])+4);
 		rts();
 	}
-	else qlux_table[code=KEYTRANS_OCODE]();
+	else QLUX_HANDLER(code=KEYTRANS_OCODE)();
 }
 
 /* Minerva Keyboard handling */
@@ -13,6 +13,7 @@
 #include "QDOS.h"
 #include "QInstAddr.h"
 #include "QL_hardware.h"
+#include "memaccess.h"
 #include "unix.h"
 
 /*extern int schedCount;*/
@@ -40,6 +41,7 @@ void init_poll()
 
       WL( p, POLL_CMD_ADDR);
       WW((Ptr)memBase+POLL_CMD_ADDR, POLL_CMD_CODE);
+      MemoryDMAWritten(POLL_CMD_ADDR, 2);
 
       QLtrap(1,0x1c,200000l);
     }
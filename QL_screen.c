@@ -32,6 +32,9 @@ uint8_t screen_transform = 0;   // screen transform mode (0x5f2c mirror)
 uint8_t high_colour_mode = 0;   // high-colour mode (0x5f5f mirror)
 uint8_t secondaryPalette[2][16]; // double-buffered secondary palette
 uint8_t highColourBitfield[2][16]; // double-buffered per-line palette bitfield
+uint8_t frameLineDirty[2][128];
+uint8_t overlayLineDirty[2][128];
+uint8_t screenRedrawAll = 1;
 #endif
 
 struct SCREENDEF
@@ -30,4 +30,9 @@ extern uint8_t screen_transform;
 extern uint8_t high_colour_mode;
 extern uint8_t secondaryPalette[2][16];
 extern uint8_t highColourBitfield[2][16];
+/* Lines written since the last refresh, per bank; set by the HW write
+ * paths, cleared by the renderer.  screenRedrawAll covers palette writes. */
+extern uint8_t frameLineDirty[2][128];
+extern uint8_t overlayLineDirty[2][128];
+extern uint8_t screenRedrawAll;
 #endif
@@ -2,9 +2,15 @@
 #include <SDL.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 #include "debug.h"
 #include "QL68000.h"
 #include "QL_sound.h"
+#include "audio_mixer.h"
+#ifdef NEXTP8
+#include "audio_stats.h"
+#include "emulator_options.h"
+#endif
 
 /*
  * Structures only used in this file
@@ -46,9 +52,8 @@ typedef struct {
 static bool sound_enabled = false;	// True if sound enabled successfully
 static int audio_volume; 		// audio volume, 0 to 127
 
-static SDL_AudioDeviceID QLSDLAudio;
-static SDL_AudioSpec want;
-static SDL_AudioSpec have;
+static SDL_AudioSpec have;		// The mixer's rate, all else is unused
+static SDL_atomic_t beep_active;	// The beep has samples to play
 
 static sound_data sound;
 static current_sound c_sound;
@@ -56,7 +61,12 @@ static current_sound c_sound;
 /*
  * Local functions
  */
+#ifdef NEXTP8
+static bool daSource(int16_t *samples, int count);
+#else
+static bool beepSource(int16_t *samples, int count);
 void audioCallback(void* userdata, Uint8* stream, int len);
+#endif
 
 static void setVolume(int volume);
 static void setPitchDuration();
@@ -74,13 +84,6 @@ static void silenceBuffer(int start, Sint8* buffer, int len);
 #define UNUSED(x) (void)(x)
 #define TICK_8049 22917		// Number of IPC ticks per second
 
-#ifdef NEXTP8
-#define FREQUENCY 5513		// Requested sampling frequency
-#define SAMPLES 64		// Number of samples in a callback (small to minimise da_address jumps)
-#else
-#define FREQUENCY 24000		// Requested sampling frequency
-#define SAMPLES 256		// Number of samples in a callback
-#endif
 #define MAX_IPC_PARAMS 16 	// For the case where all 16 slots yield 8 bits
 
 #ifdef NEXTP8
@@ -89,46 +92,32 @@ bool da_mono = 0;
 uint16_t da_period = 0;
 int16_t da_memory[DA_SAMPLES];
 unsigned da_address = 0;
-/* Fractional accumulator for da_period-based address advancement.
- * Incremented by DA_CLOCK_FREQ each output sample; da_address advances
- * when it reaches da_period * FREQUENCY, giving correct playback rate. */
-static unsigned long long da_addr_accum = 0;
-#define DA_CLOCK_FREQ 65000000ULL
+
+/* Playback position in da_memory, 32.32 fixed point; da_address is its
+ * integer part once a callback is done. */
+static uint64_t da_pos = 0;
+
+/* What the last callback played, for the guest's view of da_address:
+ * written by the callback under an odd da_seq. */
+static SDL_atomic_t da_seq;
+static unsigned da_cb_address;	// da_address at the start of the callback
+static uint64_t da_cb_step;	// da_memory samples per output sample, 32.32
+static unsigned da_cb_count;	// output samples
+static uint64_t da_cb_ticks;	// SDL performance counter at the callback
+
+static SDL_atomic_t da_resync;	// 1 + the sample to move to, 0 for none
 #endif
 
 void initSound(int volume) {
 	//printf("initSound\n");
 	if ((volume != 0) && (!sound_enabled)) {
-		//printf("A\n");
-		// Create the sound driver
-		if(SDL_Init(SDL_INIT_AUDIO)) {
-			//printf("B\n");
-			if (V1) {
-				printf("Audio Failed to initialize: %s\n", SDL_GetError());
-			}
-			return;
-		}
-
-		SDL_zero(want);
-		want.freq = FREQUENCY;
+		// Sound goes out through the shared mixer
 #ifdef NEXTP8
-		want.format = AUDIO_S16SYS;
+		audioMixerInit(emulatorOptionInt("audio_buffer"));
 #else
-		want.format = AUDIO_S8;
+		audioMixerInit(0);
 #endif
-		want.channels = 1;
-		want.samples = SAMPLES;
-		want.callback = audioCallback;
-
-		QLSDLAudio = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
-		//printf("called OpenAudio\n");
-
-		if(!QLSDLAudio) {
-			if (V1) {
-				printf("Failed to open audio device: %s\n", SDL_GetError());
-			}
-			return;
-		}
+		have.freq = audioMixerRate();
 
 		sound.mutex = SDL_CreateMutex();
 
@@ -145,7 +134,9 @@ void initSound(int volume) {
 		sound_enabled = true;
 
 #ifdef NEXTP8
-		SDL_PauseAudioDevice(QLSDLAudio, 0);
+		audioMixerAdd(daSource);
+#else
+		audioMixerAdd(beepSource);
 #endif
 	}
 	return;
@@ -154,12 +145,11 @@ void initSound(int volume) {
 void closeSound() {
 	sound_enabled = false;
 
+	// Every source has stopped once the callback has
+	audioMixerClose();
+
 	if (sound.mutex)
 		SDL_DestroyMutex(sound.mutex);
-
-	if (QLSDLAudio) {
-		SDL_CloseAudioDevice(QLSDLAudio);
-	}
 }
 
 static void setVolume(int volume) {
@@ -263,8 +253,8 @@ void BeepSound(unsigned char *arg) {
 		sound.beep[write_num].fuzz, sound.beep[write_num].random);
 #endif
 
-		// Always unpause the sound here, in case the callback has paused itself
-		SDL_PauseAudioDevice(QLSDLAudio, 0);
+		// Always restart the sound here, in case the callback has stopped it
+		SDL_AtomicSet(&beep_active, 1);
 	}
 }
 
@@ -281,38 +271,145 @@ void KillSound() {
 }
 
 #ifdef NEXTP8
-void audioCallback(void* userdata, Uint8* stream, int len) {
-	UNUSED(userdata);
-	int16_t *samples = (int16_t *)stream;
-	/* Advance da_address at DA_CLOCK_FREQ / da_period Hz (the hardware rate),
-	 * independent of the SDL output rate (FREQUENCY Hz).
-	 * Uses a fractional accumulator: increment by DA_CLOCK_FREQ each output
-	 * sample; each time it reaches da_period * FREQUENCY, advance da_address. */
-	const unsigned long long threshold = (unsigned long long)da_period * FREQUENCY;
-	while (len >= (int)sizeof(int16_t)) {
-		if (da_start && da_period > 0) {
-			/* Output current sample */
+static inline int16_t daSample(unsigned i)
+{
 #if __BYTE_ORDER == __BIG_ENDIAN
-			*samples++ = da_memory[da_address];
+	return da_memory[i];
 #else
-			*samples++ = __builtin_bswap16(da_memory[da_address]);
+	return __builtin_bswap16(da_memory[i]);
 #endif
-			/* Advance address by da_period-derived ratio */
-			da_addr_accum += DA_CLOCK_FREQ;
-			while (da_addr_accum >= threshold) {
-				da_addr_accum -= threshold;
-				da_address++;
-				if (da_address >= DA_SAMPLES)
-					da_address = 0;
-			}
-		} else {
-			/* Stopped: output silence */
-			*samples++ = 0;
+}
+
+/* Straight copy while the DA rate matches the output */
+static int daCopy(int16_t *out, int count)
+{
+	int wraps = 0;
+
+	while (count) {
+		unsigned i = da_pos >> 32;
+		int n = DA_SAMPLES - i;
+
+		if (n > count)
+			n = count;
+		for (int j = 0; j < n; j++)
+			out[j] = daSample(i + j);
+		out += n;
+		count -= n;
+		da_pos += (uint64_t)n << 32;
+		if ((da_pos >> 32) >= DA_SAMPLES) {
+			da_pos -= (uint64_t)DA_SAMPLES << 32;
+			wraps++;
+		}
+	}
+	return wraps;
+}
+
+/* Linear interpolation between neighbouring da_memory samples */
+static int daResample(int16_t *out, int count, uint64_t step)
+{
+	int wraps = 0;
+
+	while (count--) {
+		unsigned i = da_pos >> 32;
+		int s0 = daSample(i);
+		int s1 = daSample(i + 1 < DA_SAMPLES ? i + 1 : 0);
+		int frac = (da_pos >> 16) & 0xffff;
+
+		*out++ = s0 + (((s1 - s0) * frac) >> 16);
+		da_pos += step;
+		while ((da_pos >> 32) >= DA_SAMPLES) {
+			da_pos -= (uint64_t)DA_SAMPLES << 32;
+			wraps++;
 		}
-		len -= sizeof(int16_t);
 	}
+	return wraps;
+}
+
+static bool daSource(int16_t *samples, int count) {
+	uint64_t start = audio_stats_enabled ? audioStatsNow() : 0;
+	int wraps = 0;
+	/* da_memory is read at DA_CLOCK_FREQ / da_period Hz, the hardware
+	 * rate, whatever rate the device was opened at */
+	uint64_t step = 0;
+
+	int resync = SDL_AtomicSet(&da_resync, 0);
+
+	if (resync)
+		da_pos = (uint64_t)(resync - 1) << 32;
+	if (da_start && da_period > 0)
+		step = (DA_CLOCK_FREQ << 32) / ((uint64_t)da_period * have.freq);
+
+	SDL_AtomicIncRef(&da_seq);
+	da_cb_address = da_pos >> 32;
+	da_cb_step = step;
+	da_cb_count = count;
+	da_cb_ticks = SDL_GetPerformanceCounter();
+
+	if (step == (UINT64_C(1) << 32) && !(uint32_t)da_pos)
+		wraps = daCopy(samples, count);
+	else if (step)
+		wraps = daResample(samples, count, step);
+	da_address = da_pos >> 32;
+	SDL_AtomicIncRef(&da_seq);
+
+	if (wraps)
+		audioStatsCount(AUDIO_COUNT_DA_WRAP, wraps);
+	if (audio_stats_enabled) {
+		audioStatsAdd(AUDIO_HIST_DA_CALLBACK_US, audioStatsSinceUs(start));
+		audioStatsAdd(AUDIO_HIST_DA_CALLBACK_SAMPLES, count);
+	}
+	return step != 0;
+}
+
+/* The sample the device is playing now: moves on smoothly between
+ * callbacks, however large the buffer, instead of jumping a buffer at a
+ * time, so the guest can keep a larger buffer ahead of it */
+unsigned daReadAddress(void)
+{
+	unsigned address, count;
+	uint64_t step, ticks, played;
+	int seq;
+
+	do {
+		seq = SDL_AtomicGet(&da_seq);
+		address = da_cb_address;
+		step = da_cb_step;
+		count = da_cb_count;
+		ticks = da_cb_ticks;
+	} while ((seq & 1) || seq != SDL_AtomicGet(&da_seq));
+
+	if (!step)
+		return da_address;
+	played = (SDL_GetPerformanceCounter() - ticks) * have.freq /
+		 SDL_GetPerformanceFrequency();
+	if (played > count)
+		played = count;
+	return (address + (unsigned)((played * (step >> 16)) >> 16)) % DA_SAMPLES;
+}
+
+void daResync(unsigned address)
+{
+	SDL_AtomicSet(&da_resync, address % DA_SAMPLES + 1);
 }
 #else
+/* The beep generator writes 8 bit samples */
+static bool beepSource(int16_t *samples, int count) {
+	Sint8 buf[256];
+
+	if (!SDL_AtomicGet(&beep_active))
+		return false;
+	while (count > 0) {
+		int n = count < (int)sizeof(buf) ? count : (int)sizeof(buf);
+
+		audioCallback(NULL, (Uint8 *)buf, n);
+		for (int i = 0; i < n; i++)
+			samples[i] = buf[i] * 256;
+		samples += n;
+		count -= n;
+	}
+	return true;
+}
+
 void audioCallback(void* userdata, Uint8* stream, int len) {
 	UNUSED(userdata);
 
@@ -353,7 +450,8 @@ void audioCallback(void* userdata, Uint8* stream, int len) {
 	}
 
 	if ((c_sound.left < 0) || (sound.in_use == -1)){
-		SDL_PauseAudioDevice(QLSDLAudio, 1);
+		SDL_AtomicSet(&beep_active, 0);
+		silenceBuffer(0, (Sint8*)stream, len);
 		soundOn = false;
 	}
 	else {
@@ -22,6 +22,13 @@ extern uint16_t da_period;
 extern unsigned da_address;
 
 #define DA_SAMPLES (_DA_MEMORY_SIZE / 2)
+#define DA_CLOCK_FREQ 65000000ULL
 extern int16_t da_memory[DA_SAMPLES];
+
+/* da_address as the guest sees it, at the sample playing now */
+unsigned daReadAddress(void);
+
+/* Have the next callback play on from sample address (dastream.c) */
+void daResync(unsigned address);
 #endif
 #endif
@@ -33,6 +33,11 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <sys/ioctl.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
 #endif
 #include <SDL_endian.h>
 
@@ -45,6 +50,7 @@
 #include "util.h"
 #include "iptraps.h"
 #include "QLip.h"
+#include "scheduler.h"
 #include "xc68.h"
 
 #define IPDEBUGGER 1
@@ -64,6 +70,148 @@ WSADATA wsaData;
 #define SOCKET int
 #endif
 
+/*
+ * Readiness of all open sockets is gathered once per scheduler tick, by
+ * one edge triggered epoll_wait on Linux or one poll() on other Unixes,
+ * rather than a select() per socket on every guest poll.  ip_pend and
+ * the connect check answer from the cached bits; a read that would block
+ * clears its bit until the next event.  Stream reads from the byte and
+ * string calls fill a per socket buffer, so io.fbyte is one syscall per
+ * IP_RBUF_SIZE bytes.  Windows keeps the select()s.
+ */
+#define IP_RD		1
+#define IP_WR		2
+#define IP_EX		4
+#define IP_POLL_INSNS	20000	/* about a millisecond */
+#define IP_RBUF_SIZE	4096
+
+#ifndef __WIN32__
+static ipdev_t *ip_socks;
+static int ip_nsocks;
+static sched_event ip_poll_event;
+#ifdef __linux__
+static int ip_epfd = -1;
+#else
+static struct pollfd *ip_pfds;
+static ipdev_t **ip_pfd_socks;
+static int ip_pfd_size;
+#endif
+
+static void ip_poll_tick(void *arg)
+{
+#ifdef __linux__
+	struct epoll_event ev[64];
+	int i, n;
+
+	do {
+		n = epoll_wait(ip_epfd, ev, 64, 0);
+		for (i = 0; i < n; i++) {
+			ipdev_t *s = ev[i].data.ptr;
+			uint32_t e = ev[i].events;
+
+			if (e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+				s->ready |= IP_RD;
+			if (e & EPOLLOUT)
+				s->ready |= IP_WR;
+			if (e & (EPOLLHUP | EPOLLERR))
+				s->ready |= IP_EX;
+		}
+	} while (n == 64);
+#else
+	ipdev_t *s;
+	int i, n = 0;
+
+	if (ip_pfd_size < ip_nsocks) {
+		ip_pfds = realloc(ip_pfds, ip_nsocks * sizeof(*ip_pfds));
+		ip_pfd_socks = realloc(ip_pfd_socks, ip_nsocks * sizeof(*ip_pfd_socks));
+		ip_pfd_size = ip_nsocks;
+	}
+	for (s = ip_socks; s; s = s->next, n++) {
+		ip_pfds[n].fd = s->sock;
+		ip_pfds[n].events = (s->status == -1) ? POLLOUT : POLLIN;
+		ip_pfds[n].revents = 0;
+		ip_pfd_socks[n] = s;
+	}
+	if (poll(ip_pfds, n, 0) < 0)
+		return;
+	for (i = 0; i < n; i++) {
+		short e = ip_pfds[i].revents;
+
+		ip_pfd_socks[i]->ready =
+			((e & (POLLIN | POLLHUP | POLLERR)) ? IP_RD : 0) |
+			((e & POLLOUT) ? IP_WR : 0) |
+			((e & (POLLHUP | POLLERR)) ? IP_EX : 0);
+	}
+#endif
+}
+#endif
+
+/* Add s to the readiness set; if that fails it is probed directly */
+static void ip_watch(ipdev_t *s)
+{
+#ifndef __WIN32__
+#ifdef __linux__
+	struct epoll_event ev;
+
+	if (ip_epfd < 0)
+		ip_epfd = epoll_create1(EPOLL_CLOEXEC);
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = s;
+	if (ip_epfd < 0 || epoll_ctl(ip_epfd, EPOLL_CTL_ADD, s->sock, &ev) < 0) {
+		perror("ip_watch");
+		return;
+	}
+#endif
+	s->watched = 1;
+	s->next = ip_socks;
+	ip_socks = s;
+	if (!ip_nsocks++) {
+		schedInit(&ip_poll_event, "ip_poll", ip_poll_tick, NULL);
+		schedEvery(&ip_poll_event, IP_POLL_INSNS);
+	}
+#endif
+}
+
+static void ip_unwatch(ipdev_t *s)
+{
+#ifndef __WIN32__
+	ipdev_t **pp;
+
+	if (!s->watched)
+		return;
+	for (pp = &ip_socks; *pp != s; pp = &(*pp)->next)
+		;
+	*pp = s->next;
+	s->watched = 0;
+#ifdef __linux__
+	epoll_ctl(ip_epfd, EPOLL_CTL_DEL, s->sock, NULL);
+#endif
+	if (!--ip_nsocks)
+		schedCancel(&ip_poll_event);
+#endif
+}
+
+static int ip_ready(ipdev_t *s, int bit)
+{
+	if (!s->watched)
+		return check_pend(s->sock, (bit == IP_RD) ? SLC_READ :
+					   (bit == IP_WR) ? SLC_WRITE : SLC_ERR) > 0;
+	return (s->ready & bit) != 0;
+}
+
+/* Hand out buffered bytes first, so nothing is read out of order */
+static int ip_take(ipdev_t *s, void *buf, int len, int peek)
+{
+	int n = s->rlen - s->rpos;
+
+	if (n > len)
+		n = len;
+	memcpy(buf, s->rbuf + s->rpos, n);
+	if (!peek)
+		s->rpos += n;
+	return n;
+}
+
 int ip_init(int idx, void *p)
 {
 #ifdef __WIN32__
@@ -215,11 +363,14 @@ int ip_open(int id, void **priv)
 		qerr = QERR_BP;
 
 	if (qerr == 0) {
-		*priv = malloc(sizeof(ipdev_t));
+		*priv = calloc(1, sizeof(ipdev_t));
 		((ipdev_t *)(*priv))->sock = fd;
 		((ipdev_t *)(*priv))->name = name;
 		((ipdev_t *)(*priv))->status = cnstatus;
 		((ipdev_t *)(*priv))->lerrno = 0;
+		((ipdev_t *)(*priv))->stream = !(dindx & 1);
+		if (fd >= 0)
+			ip_watch(*priv);
 	} else {
 		reg[0] = qerr;
 		*priv = NULL;
@@ -239,9 +390,9 @@ void static check_status(ipdev_t *s)
 	/*printf("calling check_status, status %d\n",s->status);*/
 
 	if (s->status == -1) {
-		if (check_pend(s->sock, SLC_WRITE) > 0)
+		if (ip_ready(s, IP_WR))
 			s->status = 0;
-		else if (check_pend(s->sock, SLC_ERR) > 0) {
+		else if (ip_ready(s, IP_EX)) {
 			socklen_t e = sizeof(errno);
 
 			s->status = -2;
@@ -270,7 +421,7 @@ int ip_pend(ipdev_t *p)
 	switch (p->status) {
 	case 0:
 	case -2:
-		if (check_pend(p->sock, SLC_READ))
+		if (p->rpos < p->rlen || ip_ready(p, IP_RD))
 			return 0;
 		else
 			return QERR_NC;
@@ -295,8 +446,22 @@ static int ip_read(ipdev_t *sd, void *buf, int pno)
 	ci = 0;
 	c = buf;
 
+	if (sd->rpos < sd->rlen)
+		return ip_take(sd, buf, pno, 0);
 #ifndef __WIN32__
-	res = recv(sd->sock, buf, pno, MSG_DONTWAIT);
+	if (sd->stream && sd->watched) {
+		if (!sd->rbuf)
+			sd->rbuf = malloc(IP_RBUF_SIZE);
+		res = recv(sd->sock, sd->rbuf, IP_RBUF_SIZE, MSG_DONTWAIT);
+		if (res > 0) {
+			sd->rpos = 0;
+			sd->rlen = res;
+			return ip_take(sd, buf, pno, 0);
+		}
+	} else
+		res = recv(sd->sock, buf, pno, MSG_DONTWAIT);
+	if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		sd->ready &= ~IP_RD;
 #else
 	res = recv(sd->sock, buf, pno, 0);
 	if (res == SOCKET_ERROR) {
@@ -927,11 +1092,15 @@ static int ip_recv(ipdev_t *p, void *buf, long blen, int flag,
 
 	if (from) {
 		res = recvfrom(p->sock, buf, blen, flag, from, flen);
+	} else if (p->rpos < p->rlen) {
+		return ip_take(p, buf, blen, flag & MSG_PEEK);
 	} else {
 		res = recv(p->sock, buf, blen, flag);
 		if (res == -1)
 			strerror(errno);
 	}
+	if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		p->ready &= ~IP_RD;
 	QERRNO(qerr, res);
 	return qerr;
 }
@@ -1436,7 +1605,9 @@ void ip_close(int id, void *p)
 {
 	ipdev_t *priv = p;
 
+	ip_unwatch(priv);
 	close(priv->sock);
+	free(priv->rbuf);
 	free(priv);
 }
 
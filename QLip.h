@@ -18,11 +18,17 @@
 #include <netinet/in.h>
 #endif
 
-typedef struct {
+typedef struct ipdev {
 	int status; /* 0 OK, -1 check connection(async), -2 error */
 	int lerrno;
 	int sock;
 	struct sockaddr_in name;
+	int stream;		/* SOCK_STREAM, reads may be buffered */
+	int watched;		/* in the readiness set, see QLip.c */
+	int ready;		/* IP_RD/IP_WR/IP_EX as last seen */
+	char *rbuf;		/* read ahead for the byte/string calls */
+	int rpos, rlen;
+	struct ipdev *next;
 } ipdev_t;
 
 int ip_init(int, void *);
@@ -23,6 +23,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <poll.h>
 #include <sys/time.h>
 #if 0
 #include <sys/termio.h>
@@ -33,6 +34,7 @@
 #include "QL_cconv.h"
 #include "driver.h"
 #include "emulator_options.h"
+#include "scheduler.h"
 
 #ifdef __linux__
 #include <sys/ioctl.h>
@@ -63,15 +65,142 @@ struct {
 #define OPTC 1
 #define OPTZ 0
 
+/*
+ * Serial ports and ptys are non-blocking with a read and a write buffer
+ * each.  One poll() per scheduler tick over all open devices refills the
+ * read buffers and drains the write buffers, so io.fbyte and io.sstrg
+ * are served from memory and a string goes out in one write() instead
+ * of one per byte.  A read that finds its buffer empty tries the device
+ * itself; a write only waits for the device when its buffer is full.
+ */
+#define SER_BUF_SIZE	4096
+#define SER_POLL_INSNS	20000	/* about a millisecond */
+
+static serdev_t *ser_devs;
+static int ser_ndevs;
+static sched_event ser_poll_event;
+static struct pollfd *ser_pfds;
+static serdev_t **ser_pfd_devs;
+static int ser_pfd_size;
+
+static void ser_fill(serdev_t *sd)
+{
+	int n;
+
+	if (sd->rpos == sd->rlen) {
+		sd->rpos = sd->rlen = 0;
+	} else if (sd->rpos) {
+		memmove(sd->rbuf, sd->rbuf + sd->rpos, sd->rlen - sd->rpos);
+		sd->rlen -= sd->rpos;
+		sd->rpos = 0;
+	}
+	if (sd->rlen == SER_BUF_SIZE || sd->rerr)
+		return;
+	n = read(sd->fd, sd->rbuf + sd->rlen, SER_BUF_SIZE - sd->rlen);
+	if (n > 0)
+		sd->rlen += n;
+	else if (n < 0 && errno != EAGAIN && errno != EINTR)
+		sd->rerr = QERR_TE;
+}
+
+/* 0 when everything went or wait is 0, -1 on a device error */
+static int ser_flush(serdev_t *sd, int wait)
+{
+	struct pollfd p;
+	int n;
+
+	while (sd->wpos < sd->wlen) {
+		n = write(sd->fd, sd->wbuf + sd->wpos, sd->wlen - sd->wpos);
+		if (n > 0) {
+			sd->wpos += n;
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno != EAGAIN)
+			return -1;
+		if (!wait)
+			break;
+		p.fd = sd->fd;
+		p.events = POLLOUT;
+		poll(&p, 1, -1);
+	}
+	if (sd->wpos == sd->wlen) {
+		sd->wpos = sd->wlen = 0;
+	} else if (sd->wpos) {
+		memmove(sd->wbuf, sd->wbuf + sd->wpos, sd->wlen - sd->wpos);
+		sd->wlen -= sd->wpos;
+		sd->wpos = 0;
+	}
+	return 0;
+}
+
+static void ser_poll_tick(void *arg)
+{
+	serdev_t *sd;
+	int i, n = 0;
+
+	if (ser_pfd_size < ser_ndevs) {
+		ser_pfds = realloc(ser_pfds, ser_ndevs * sizeof(*ser_pfds));
+		ser_pfd_devs = realloc(ser_pfd_devs, ser_ndevs * sizeof(*ser_pfd_devs));
+		ser_pfd_size = ser_ndevs;
+	}
+	for (sd = ser_devs; sd; sd = sd->next, n++) {
+		ser_pfds[n].fd = sd->fd;
+		ser_pfds[n].events = (sd->wpos < sd->wlen) ? POLLIN | POLLOUT : POLLIN;
+		ser_pfds[n].revents = 0;
+		ser_pfd_devs[n] = sd;
+	}
+	if (poll(ser_pfds, n, 0) <= 0)
+		return;
+	for (i = 0; i < n; i++) {
+		short e = ser_pfds[i].revents;
+
+		if (e & (POLLIN | POLLHUP | POLLERR))
+			ser_fill(ser_pfd_devs[i]);
+		if (e & POLLOUT)
+			ser_flush(ser_pfd_devs[i], 0);
+	}
+}
+
+/* Buffers sd and adds it to the poll set, after sd->fd is open */
+void ser_watch(serdev_t *sd)
+{
+	sd->rbuf = malloc(SER_BUF_SIZE);
+	sd->wbuf = malloc(SER_BUF_SIZE);
+	sd->rpos = sd->rlen = sd->wpos = sd->wlen = 0;
+	sd->rerr = 0;
+	fcntl(sd->fd, F_SETFL, fcntl(sd->fd, F_GETFL) | O_NONBLOCK);
+	sd->next = ser_devs;
+	ser_devs = sd;
+	if (!ser_ndevs++) {
+		schedInit(&ser_poll_event, "ser_poll", ser_poll_tick, NULL);
+		schedEvery(&ser_poll_event, SER_POLL_INSNS);
+	}
+}
+
+/* Sends what is still buffered; before sd->fd is closed */
+void ser_unwatch(serdev_t *sd)
+{
+	serdev_t **pp;
+
+	for (pp = &ser_devs; *pp && *pp != sd; pp = &(*pp)->next)
+		;
+	if (!*pp)
+		return;
+	*pp = sd->next;
+	ser_flush(sd, 1);
+	free(sd->rbuf);
+	free(sd->wbuf);
+	sd->rbuf = sd->wbuf = NULL;
+	if (!--ser_ndevs)
+		schedCancel(&ser_poll_event);
+}
+
 int ser_read(serdev_t *sd, void *buf, int pno)
 {
 	long count = pno;
-	long ci;
 	long res;
-	char *c;
-
-	ci = 0;
-	c = buf;
 
 	/* check for chr$(26) == EOF */
 	if (sd->teof) {
@@ -79,25 +208,17 @@ int ser_read(serdev_t *sd, void *buf, int pno)
 		return 0;
 	}
 
-#ifdef NO_FIONREAD
-	if (sd->bfc_valid) {
-		*c++ = sd->bfc;
-		sd->bfc_valid = 0;
-		count--;
-		ci = 1;
-	}
-#endif
-	res = readio(sd, c, &count, 0);
+	res = readio(sd, buf, &count, 0);
 
 	if (res == QERR_EOF)
 		sd->teof = 1;
 
-	if (sd->xlate == 3 && count + ci > 0)
-		iso2ql_mem(buf, count + ci);
+	if (sd->xlate == 3 && count > 0)
+		iso2ql_mem(buf, count);
 
 	/*printf("readio result: %d count: %d\n",res,count);*/
-	if (!res || count > 0 || ci)
-		return count + ci;
+	if (!res || count > 0)
+		return count;
 	else
 		return res;
 }
@@ -124,9 +245,6 @@ int ser_write(serdev_t *sd, void *buf, int pno)
 	char *conv;
 	int xf = 0;
 
-#ifdef NO_FIONREAD
-#endif
-
 	if (sd->xlate == 3 && pno > 0) {
 		conv = cva(pno);
 		memcpy(conv, buf, pno);
@@ -183,9 +301,6 @@ int ser_open(int id, void **priv)
 	p->hshake = (long)ser_par[2].i;
 	p->xlate = (long)ser_par[3].i;
 	p->baud = (long)ser_par[5].i; /* par 4 is dummy ! */
-#ifdef NO_FIONREAD
-	p->bfc_valid = 0;
-#endif
 	p->killed = 0;
 	p->teof = 0;
 
@@ -215,27 +330,11 @@ int ser_open(int id, void **priv)
 
 int ser_pend(serdev_t *p)
 {
-#ifdef NO_FIONREAD
-	long count;
-	int res;
-
-	if (p->bfc_valid)
-		return 0;
-
-	count = 1;
-	res = readio(p, &(p->bfc), &count, 0);
-	/*printf("pend: readio result: %d, count %d\n",res,count);*/
-	if (!res && count == 1) {
-		p->bfc_valid = 1;
-		return 0;
-	}
-	if (res == -10)
-		return QERR_EF;
-	else
+	if (p->rpos == p->rlen)
+		ser_fill(p);
+	if (p->rpos < p->rlen)
 		return 0;
-#else
-	return pendingio(p->fd);
-#endif
+	return p->rerr ? p->rerr : QERR_NC;
 }
 void ser_io(int id, serdev_t *priv)
 {
@@ -243,6 +342,7 @@ void ser_io(int id, serdev_t *priv)
 }
 int ser_close(int id, serdev_t *priv)
 {
+	ser_unwatch(priv);
 	tty_close(priv->fd);
 	sparams[priv->unit] = NULL;
 
@@ -337,12 +437,10 @@ void tty_baud(serdev_t *sd)
 int tty_open(const char *dev, serdev_t *sd)
 {
 	if ((sd->fd = open(dev, O_RDWR | O_NONBLOCK)) > 0) {
-#ifndef NO_FIONREAD
-		fcntl(sd->fd, F_SETFL, fcntl(sd->fd, F_GETFL) & ~O_NONBLOCK);
-#endif
 		QLsetmode(sd);
 		if (sd->baud)
 			tty_baud(sd);
+		ser_watch(sd);
 	}
 	return sd->fd;
 }
@@ -358,107 +456,36 @@ void tty_close(int f)
 	close(f);
 }
 
-#ifndef FIONREAD
-#define FIONREAD FIORDCHK
-#endif
-
-int pendingio(int f)
-{
-	int res, nn;
-
-#ifndef NO_FIONREAD
-	if (ioctl(f, FIONREAD, &nn) == 0)
-		res = (nn) ? 0 : -1;
-	else
-		res = -6;
-	return res;
-#else
-	return QERR_EF; /* should not get there !! */
-#endif
-}
-
-#ifdef USE_IOSZ
-#define IOSZ 32
-#endif
-
+/* Bytes go through the write buffer; translation is done on the copy */
 int writeio(serdev_t *sd, char *buf, long *pno)
 {
-	int no = *pno;
-	int nw;
-	int res;
-	short done = 0;
-	int nr = (sd->xlate == -1) ? no : 1;
-	int sum = 0;
-	int sts;
+	long no = *pno;
+	long sum = 0;
+	int sts = 0;
+	char c;
 
 #ifdef IOTEST
 	printf("call writeio: sd %d, bufp %x, count %d\n", sd, buf, *pno);
 #endif
 
-#ifdef USE_IOSZ
-	no = nw = *pno;
-#endif
-	if (no == 0)
-		nr = 0;
-
-	while (!done) {
-#ifdef USE_IOSZ
-		if (nw > IOSZ)
-			nr = IOSZ;
-		else
-			nr = nw;
-#endif
-		if (sd->xlate == OPTC && *buf == 10)
-			*buf = 13;
-
-		res = write(sd->fd, buf, nr);
-		if (res <= 0) {
-			if (res < 0) {
-				if (errno == EINTR || errno == EAGAIN)
-					continue;
-
-				done = 1;
-				sts = -6;
-			} else {
-				done = 1;
-				sts = 0;
-			}
-		} else {
-#ifdef USE_IOSZ
-			nw -= res;
-#endif
-			sum += res;
-			if (sd->xlate == OPTZ && *buf == 26) {
-				done = 1;
-				res = 0;
-			}
-			if (sum == no) {
-				done = 1;
-				sts = 0;
-			}
-#if 0
-	  if (res != nr)
-	    {
-	      done = 1;
-	      sts = -1;
-	    }
-#endif
-			buf += res;
+	while (sum < no) {
+		if (sd->wlen == SER_BUF_SIZE && ser_flush(sd, 1) < 0) {
+			sts = -6;
+			break;
 		}
+		c = buf[sum++];
+		if (sd->xlate == OPTC && c == 10)
+			c = 13;
+		sd->wbuf[sd->wlen++] = c;
+		if (sd->xlate == OPTZ && c == 26)
+			break;
 	}
-#if 0
-    if (res == 0)
-	sts = -10;
-    else if (res < 0)
-    {
-	if (errno == EINTR)
-	    sts = -1;
-	else
-	    sts = -6;
-    }
-    else
-	sts = 0;
-#endif
+	if (!no) {
+		/* flush, then let a zero length write reach the device */
+		if (ser_flush(sd, 1) < 0 || write(sd->fd, buf, 0) < 0)
+			sts = -6;
+	} else if (!sts && ser_flush(sd, 0) < 0)
+		sts = -6;
 
 #ifdef IOTEST
 	printf("exit writeio: count %d, err %d\n", sum, sts);
@@ -467,100 +494,38 @@ int writeio(serdev_t *sd, char *buf, long *pno)
 	return sts;
 }
 
+/* QERR_NC when nothing is buffered or waiting, QERR_EOF after a chr$(26) */
 int readio(serdev_t *sd, char *buf, long *pno, short tc)
 {
-	int no = *pno;
-	int res;
-	short done = 0;
-	int nr;
-	int sum = 0;
-	int nn;
-	int sts;
-	char *xx = buf;
+	long no = *pno;
+	long sum = 0;
+	int sts = 0;
+	char c;
 
 #ifdef IOTEST
 	printf("call readio: sd %d, bufp %x, count %d\n", sd, buf, *pno);
 #endif
 
-	if (*pno <= 0) {
-		done = 1;
-		sts = 0;
+	if (no > 0 && sd->rpos == sd->rlen)
+		ser_fill(sd);
+	while (sum < no) {
+		if (sd->rpos == sd->rlen) {
+			if (!sum)
+				sts = sd->rerr ? sd->rerr : sd->killed ? 0 : QERR_NC;
+			break;
+		}
+		c = sd->rbuf[sd->rpos++];
+		if (sd->xlate == OPTC && c == 13)
+			c = 10;
+		buf[sum++] = c;
+		if (sd->xlate == OPTZ && c == 26) {
+			sts = QERR_EOF;
+			break;
+		}
+		if (tc && c == tc)
+			break;
 	}
 
-#ifndef NO_FIONREAD
-	res = ioctl(sd->fd, FIONREAD, &nn);
-#if 0
-    if (res<0) perror("ioctl() FIONREAD problem:");
-#endif
-#else
-	nn = no;
-#endif
-
-#ifndef NO_FIONREAD
-	if (res) {
-		sts = -6;
-	} else
-#endif
-	{
-		if (nn < no)
-			no = nn;
-
-		if (no > 0) {
-			nr = (sd->xlate != -1 || tc) ? 1 : no;
-			while (!done) {
-				res = read(sd->fd, buf, nr);
-				if (res <= 0) {
-					done = 1;
-					if (res < 0) {
-						switch (errno) {
-						case EINTR:
-						case EAGAIN:
-							if (!sd->killed)
-								sts = QERR_NC;
-							else
-								sts = 0;
-							break;
-						default:
-							sts = QERR_TE;
-							break;
-						}
-#if 0
-			if (errno == EINTR)
-			    sts = -1;
-			else
-			    sts = -6;
-#endif
-					}
-				} else {
-					if (sd->xlate == OPTC && *buf == 13) {
-						*buf = 10;
-					}
-
-					if (sd->xlate == OPTZ && *buf == 26) {
-						done = 1;
-						sts = -10;
-					}
-
-					if (tc && *buf == tc) {
-						sts = 0;
-						done = 1;
-					}
-
-					buf += res;
-					sum += res;
-					if (sum == no) {
-						done = 1;
-						sts = 0;
-					}
-					if (res != nr) {
-						done = 1;
-						sts = -1;
-					}
-				}
-			}
-		} else
-			sts = -1;
-	}
 #ifdef IOTEST
 	printf("exit readio: count %d, err %d char %d\n", sum, sts, *buf);
 #endif
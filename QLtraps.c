@@ -13,6 +13,10 @@
 #include "QDOS.h"
 #include "QL_screen.h"
 #include "unixstuff.h"
+#ifdef DECODE_CACHE
+#include "decode_cache.h"
+#endif
+#include "memaccess.h"
 
 /*extern int schedCount;*/
 extern int HasPTR;
@@ -201,6 +205,7 @@ void trap1(void)
 
 		case 2:
 		  strncpy(reg[1]+(Ptr)memBase,release,reg[2]);
+		  MemoryDMAWritten(reg[1],reg[2]);
 		  if (strlen(release)>reg[2])
 		      reg[0]=QERR_BF;
 		  break;
@@ -254,7 +259,10 @@ void btrap3(void)
 		/*printf("btrap3: a0=%x\n",aReg[0]);*/
 		*((char *)reg + 4 + RBO) = (char)BOOT_SELECT;
 		reg[0] = 0;
-		qlux_table[code] = trap3;
+		SetOpcodeHandler(code, trap3);
+#ifdef DECODE_CACHE
+		dcache_flush();
+#endif
 	} else
 		trap3();
 }
@@ -280,6 +288,7 @@ void FastStartup(void)
 	}
 
 	memset((Ptr)memBase + 131072l, 0, RTOP - 131072l);
+	MemoryDMAWritten(131072l, RTOP - 131072l);
 
 	while (RL((w32 *)gPC) != 0x28000l)
 		gPC++;
@@ -40,14 +40,15 @@ typedef struct SERDEV
   long xlate;
   long baud;
   int fd;
-#ifdef NO_FIONREAD
-  int bfc_valid;
-  char bfc;
-#endif
   /* some pty special values */
   FakeTerm w;
   int killed;
   int teof;    /* chr$(26) occured and should cause 1 EOF*/
+  /* buffered I/O, see QLserio.c */
+  unsigned char *rbuf, *wbuf;
+  int rpos, rlen, wpos, wlen;
+  int rerr;
+  struct SERDEV *next;
 } serdev_t;
 
 
@@ -58,7 +59,8 @@ void tty_close(int );
 int pty_open(int, void **);
 void pty_close(int, void *);
 
-int pendingio (int f);
+void ser_watch(serdev_t *sd);
+void ser_unwatch(serdev_t *sd);
 int writeio (serdev_t * sd, char *buf, long *pno);
 int readio (serdev_t * sd, char *buf, long *pno, short tc);
 
@@ -42,6 +42,7 @@
 
 #include "QLfiles.h"
 #include "QFilesPriv.h"
+#include "uxfile.h"
 #include "QL_driver.h"
 #include "QVFS.h"
 #include "util.h"
@@ -104,13 +105,14 @@ int qvf_test(int id, char *name)
   if (*pname=='/') pname++;
 
 
+  /* name resolution goes through the uxfile lookup cache */
   if (key==4)
-    res=match(qvf_mount, qvf_mname, pname, 1,0,4000,0);
+    res=uxLookupName(qvf_mount, qvf_mname, pname, 1,0,4000,0);
   else
     {
       creat=0;
       if (key==2 &&
-	  (res=match(qvf_mount, qvf_mname, pname, 0,creat,4000,0)))
+	  (res=uxLookupName(qvf_mount, qvf_mname, pname, 0,creat,4000,0)))
 	{
 	  qerrno=QERR_EX;
 	  return -2;
@@ -126,7 +128,7 @@ int qvf_test(int id, char *name)
       if (*pname=='/') pname++;
 
       if (key >=2 ) creat=1;
-      res=match(qvf_mount, qvf_mname, pname, 0,creat,4000,0);
+      res=uxLookupName(qvf_mount, qvf_mname, pname, 0,creat,4000,0);
     }
 
   /*printf("qvf_mount: %s\nqvf_mname: %s\nres=%d\n",qvf_mount,qvf_mname,res);*/
@@ -149,13 +151,16 @@ int qvf_open(int id, void **priv)
     return -1;
   else
     {
-      perm = O_RDWR | O_CREAT ;
-      fd = qopenfile(qvf_mount,qvf_mname,perm,0666,4000);
+      /* only a file that is really created invalidates cached names */
+      fd = qopenfile(qvf_mount,qvf_mname,O_RDWR,0666,4000);
       if (fd<0)
+	fd = qopenfile(qvf_mount,qvf_mname,O_RDONLY ,0666,4000);
+      if (fd<0 && errno==ENOENT)
 	{
-	  fd = qopenfile(qvf_mount,qvf_mname,O_RDWR,0666,4000);
-	  if (fd<0)
-	    fd = qopenfile(qvf_mount,qvf_mname,O_RDONLY ,0666,4000);
+	  perm = O_RDWR | O_CREAT ;
+	  fd = qopenfile(qvf_mount,qvf_mname,perm,0666,4000);
+	  if (fd>=0)
+	    uxLookupFlush();
 	}
     }
 
@@ -165,6 +170,7 @@ int qvf_open(int id, void **priv)
   fstat(fd,&sbuf);
 
   p=*priv=malloc(sizeof(qvf_priv));
+  p->rpos=p->rlen=0;
 
   f=&(p->f);
 
@@ -212,20 +218,37 @@ void qvf_close(int id, void *priv)
 {
   qvf_priv *p=priv;
 
+  QHostFlush();
   close(GET_HFILE(&(p->f)));
 
 }
 
 int qvf_pend(qvf_priv *p)
 {
-  if (check_pend(p->fd,SLC_READ)) return 0;
+  if (p->rpos<p->rlen || check_pend(p->fd,SLC_READ)) return 0;
   else return QERR_NC;
 }
 
+/* Short reads are served from one read of up to QVF_RBUF_SIZE */
 int qvf_read(qvf_priv *p, void *buf, int pno)
 {
   int res;
 
+  if (p->rpos==p->rlen && pno>0 && pno<QVF_RBUF_SIZE)
+    {
+      res=read(p->fd,p->rbuf,QVF_RBUF_SIZE);
+      if (res<=0) return res<0 ? qmaperr() : 0;
+      p->rpos=0;
+      p->rlen=res;
+    }
+  if (p->rpos<p->rlen)
+    {
+      res=min(pno,p->rlen-p->rpos);
+      memcpy(buf,p->rbuf+p->rpos,res);
+      p->rpos+=res;
+      return res;
+    }
+
   res=read(p->fd,buf,pno);
 
   if (res<0) res=qmaperr();
@@ -17,10 +17,14 @@ void qvf_close(int, void *);
 void qvf_io(int, void *);
 
 
+#define QVF_RBUF_SIZE 4096
+
 typedef struct QVF_PRIV
 {
   int isdev;
   int fd;
+  int rpos,rlen;       /* read-ahead for devices, files use QHostIO's */
+  char rbuf[QVF_RBUF_SIZE];
   struct mdvFile f;
   struct HF_FCB fcb;
   char padd[4000];   /* longer than standard name in FCB !*/
@@ -132,7 +132,7 @@ void devpefio_cmd()
 	}
 
 	code = DEVPEFIO_OCODE;
-	qlux_table[code]();
+	QLUX_HANDLER(code)();
 }
 open_arg scr_par[6];
 extern struct NAME_PARS con_name, scr_name;
@@ -226,13 +226,13 @@ void init_xscreen()
 	DEVPEFIO_OCODE = ReadWord(orig_io);
 	WW((Ptr)memBase + orig_io, DEVPEF_CMD_CODE);
 
-	qlux_table[DEVPEF_CMD_CODE] = devpefio_cmd;
+	SetOpcodeHandler(DEVPEF_CMD_CODE, devpefio_cmd);
 
 	scan_patch_chans(orig_cdrv);
 
 	DEVPEFO_OCODE = ReadWord(orig_open);
 	WW((Ptr)memBase + orig_open, DEVPEFO_CMD_CODE);
-	qlux_table[DEVPEFO_CMD_CODE] = devpefo_cmd;
+	SetOpcodeHandler(DEVPEFO_CMD_CODE, devpefo_cmd);
 }
 
 /***************************************************************/
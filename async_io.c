@@ -0,0 +1,619 @@
+/*
+ * async_io.c
+ *
+ * Asynchronous disk I/O, see async_io.h.  Requests live in AIO_SLOTS
+ * slots and are only ever started and finished off on the calling
+ * thread; the backend just sets the result.  A write first waits for
+ * any queued write of the same bytes and drops read-ahead of them, so a
+ * file's writes land in order and read-ahead never holds stale data,
+ * and an fsync runs after everything queued before it.
+ *
+ * io_uring is driven through the raw system calls with one ring of
+ * AIO_SLOTS entries, an fsync being an IOSQE_IO_DRAIN entry; liburing
+ * isn't needed.  The
+ * worker backend runs the slots in the order they were queued.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "async_io.h"
+#include "emulator_options.h"
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define AIO_ASYNC
+#include <SDL.h>
+#include "thread_policy.h"
+#endif
+
+#if defined(AIO_ASYNC) && defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define AIO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#define AIO_SLOTS		32		/* power of two, for the ring */
+#define AIO_READ_AHEAD_MAX	(256 * 1024)
+#define AIO_MAX_FD		1024		/* errors kept per fd below this */
+
+enum { AIO_SYNC, AIO_THREAD, AIO_RING };
+enum { SLOT_FREE, SLOT_BUSY, SLOT_DONE };
+enum { OP_READ, OP_WRITE, OP_FSYNC };
+
+typedef struct {
+	int state;
+	int op;
+	int fd;
+	int64_t off;
+	size_t len;
+	uint8_t *buf;		/* the written copy, or read-ahead data */
+	long res;		/* bytes, or -errno */
+	bool finished;		/* res is set; under lock with the worker */
+	uint64_t seq;		/* order queued */
+} aio_slot;
+
+static int backend = -1;
+static aio_slot slots[AIO_SLOTS];
+static uint64_t next_seq;
+static uint8_t failed[AIO_MAX_FD / 8];
+
+#ifdef _WIN32
+#include <io.h>
+
+/* Only ever called inline, so the file position is ours */
+static long aio_pread(int fd, void *buf, size_t len, int64_t off)
+{
+	if (_lseeki64(fd, off, SEEK_SET) < 0)
+		return -1;
+	return read(fd, buf, len);
+}
+
+static long aio_pwrite(int fd, const void *buf, size_t len, int64_t off)
+{
+	if (_lseeki64(fd, off, SEEK_SET) < 0)
+		return -1;
+	return write(fd, buf, len);
+}
+#define pread aio_pread
+#define pwrite aio_pwrite
+#define fsync(fd) 0
+#endif
+
+/* All of a read or write, the way it is done inline; bytes or -errno */
+static long run_op(int op, int fd, uint8_t *buf, size_t len, int64_t off)
+{
+	size_t done = 0;
+
+	if (op == OP_FSYNC)
+		return fsync(fd) < 0 ? -errno : 0;
+	while (done < len) {
+		long n = op == OP_WRITE ? pwrite(fd, buf + done, len - done, off + done)
+					: pread(fd, buf + done, len - done, off + done);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -errno;
+		if (n == 0)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+static void record_error(int fd, long res, const char *what)
+{
+	fprintf(stderr, "Async IO: %s of fd %d failed: %s\n", what, fd, strerror(-res));
+	if (fd >= 0 && fd < AIO_MAX_FD)
+		failed[fd >> 3] |= 1 << (fd & 7);
+}
+
+static int take_error(int fd)
+{
+	int bad;
+
+	if (fd < 0 || fd >= AIO_MAX_FD)
+		return 0;
+	bad = failed[fd >> 3] & (1 << (fd & 7));
+	failed[fd >> 3] &= ~(1 << (fd & 7));
+	return bad ? -1 : 0;
+}
+
+#ifdef AIO_URING
+
+static int ring_fd = -1;
+static uint8_t *sq_ring, *cq_ring;
+static size_t sq_ring_len, cq_ring_len, sqes_len;
+static unsigned *sq_tail, *sq_mask, *sq_array;
+static unsigned *cq_head, *cq_tail, *cq_mask;
+static struct io_uring_sqe *sqes;
+static struct io_uring_cqe *cqes;
+
+static bool ring_setup(void)
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	ring_fd = syscall(__NR_io_uring_setup, AIO_SLOTS, &p);
+	if (ring_fd < 0)
+		return false;
+	// IORING_OP_READ and _WRITE came in 5.6, with this
+	if (!(p.features & IORING_FEAT_RW_CUR_POS))
+		goto fail;
+
+	sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if ((p.features & IORING_FEAT_SINGLE_MMAP) && cq_ring_len > sq_ring_len)
+		sq_ring_len = cq_ring_len;
+	sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	sq_ring = mmap(NULL, sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       ring_fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED)
+		goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq_ring = sq_ring;
+	} else {
+		cq_ring = mmap(NULL, cq_ring_len, PROT_READ | PROT_WRITE,
+			       MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+		if (cq_ring == MAP_FAILED)
+			goto fail_sq;
+	}
+	sqes = mmap(NULL, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		    ring_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		goto fail_cq;
+
+	sq_tail = (unsigned *)(sq_ring + p.sq_off.tail);
+	sq_mask = (unsigned *)(sq_ring + p.sq_off.ring_mask);
+	sq_array = (unsigned *)(sq_ring + p.sq_off.array);
+	cq_head = (unsigned *)(cq_ring + p.cq_off.head);
+	cq_tail = (unsigned *)(cq_ring + p.cq_off.tail);
+	cq_mask = (unsigned *)(cq_ring + p.cq_off.ring_mask);
+	cqes = (struct io_uring_cqe *)(cq_ring + p.cq_off.cqes);
+	return true;
+
+fail_cq:
+	if (cq_ring != sq_ring)
+		munmap(cq_ring, cq_ring_len);
+fail_sq:
+	munmap(sq_ring, sq_ring_len);
+fail:
+	close(ring_fd);
+	ring_fd = -1;
+	return false;
+}
+
+static void ring_close(void)
+{
+	munmap(sqes, sqes_len);
+	if (cq_ring != sq_ring)
+		munmap(cq_ring, cq_ring_len);
+	munmap(sq_ring, sq_ring_len);
+	close(ring_fd);
+	ring_fd = -1;
+}
+
+/* Never more slots busy than entries, so there is always room */
+static void ring_submit(aio_slot *s)
+{
+	unsigned tail = *sq_tail;
+	unsigned i = tail & *sq_mask;
+	struct io_uring_sqe *e = &sqes[i];
+
+	memset(e, 0, sizeof(*e));
+	e->opcode = s->op == OP_READ ? IORING_OP_READ :
+		    s->op == OP_WRITE ? IORING_OP_WRITE : IORING_OP_FSYNC;
+	e->fd = s->fd;
+	// Writes would otherwise be copied to the page cache right here
+	if (s->op == OP_FSYNC) {
+		e->flags = IOSQE_IO_DRAIN | IOSQE_ASYNC;
+	} else {
+		e->flags = s->op == OP_WRITE ? IOSQE_ASYNC : 0;
+		e->addr = (uintptr_t)s->buf;
+		e->len = s->len;
+		e->off = s->off;
+	}
+	e->user_data = s - slots;
+	sq_array[i] = i;
+	__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+	while (syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, NULL, 0) < 0 && errno == EINTR)
+		;
+}
+
+/* Take the completions there are, waiting for one if wait is set */
+static void ring_collect(bool wait)
+{
+	unsigned head = *cq_head;
+
+	if (wait && head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+		syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+	while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *c = &cqes[head & *cq_mask];
+		aio_slot *s = &slots[c->user_data];
+
+		s->res = c->res;
+		s->finished = true;
+		head++;
+	}
+	__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+#endif /* AIO_URING */
+
+#ifdef AIO_ASYNC
+
+static SDL_mutex *lock;
+static SDL_cond *cond_work, *cond_done;
+static int queue[AIO_SLOTS];
+static int q_head, q_count;
+
+/* Short reads and writes are finished off here as inline */
+static int aio_worker_thread(void *data)
+{
+	threadPolicyApply(THREAD_WORKER);
+	SDL_LockMutex(lock);
+	for (;;) {
+		aio_slot *s;
+		long res;
+
+		while (q_count == 0)
+			SDL_CondWait(cond_work, lock);
+		s = &slots[queue[q_head]];
+		q_head = (q_head + 1) % AIO_SLOTS;
+		q_count--;
+		SDL_UnlockMutex(lock);
+
+		res = run_op(s->op, s->fd, s->buf, s->len, s->off);
+
+		SDL_LockMutex(lock);
+		s->res = res;
+		s->finished = true;
+		SDL_CondBroadcast(cond_done);
+	}
+	return 0;
+}
+
+static bool thread_setup(void)
+{
+	SDL_Thread *worker = NULL;
+
+	lock = SDL_CreateMutex();
+	cond_work = SDL_CreateCond();
+	cond_done = SDL_CreateCond();
+	if (lock && cond_work && cond_done)
+		worker = SDL_CreateThread(aio_worker_thread, "sQLux disk IO", NULL);
+	if (!worker)
+		return false;
+	SDL_DetachThread(worker);
+	return true;
+}
+
+#endif /* AIO_ASYNC */
+
+static void aio_flush_all(void)
+{
+	asyncIoFlush(-1);
+}
+
+static bool aio_start(void)
+{
+	if (backend >= 0)
+		return backend != AIO_SYNC;
+
+	backend = AIO_SYNC;
+#ifdef AIO_ASYNC
+	if (emulatorOptionFlag("sync_io"))
+		return false;
+#ifdef AIO_URING
+	if (ring_setup())
+		backend = AIO_RING;
+	else
+#endif
+	if (thread_setup())
+		backend = AIO_THREAD;
+	else
+		fprintf(stderr, "Async IO: no io_uring or worker thread, doing disk IO inline\n");
+	if (backend != AIO_SYNC) {
+		static bool registered;
+
+		if (!registered)
+			atexit(aio_flush_all);
+		registered = true;
+	}
+#endif
+	return backend != AIO_SYNC;
+}
+
+static void submit(aio_slot *s)
+{
+	s->state = SLOT_BUSY;
+	s->finished = false;
+	s->seq = next_seq++;
+#ifdef AIO_URING
+	if (backend == AIO_RING) {
+		ring_submit(s);
+		return;
+	}
+#endif
+#ifdef AIO_ASYNC
+	SDL_LockMutex(lock);
+	queue[(q_head + q_count) % AIO_SLOTS] = s - slots;
+	q_count++;
+	SDL_CondSignal(cond_work);
+	SDL_UnlockMutex(lock);
+#endif
+}
+
+static void release(aio_slot *s)
+{
+	free(s->buf);
+	s->buf = NULL;
+	s->state = SLOT_FREE;
+}
+
+/* A finished slot: writes and fsyncs are done with, read-ahead stays */
+static void finish(aio_slot *s)
+{
+	s->state = SLOT_DONE;
+	if (s->op == OP_READ)
+		return;
+	if (s->res < 0)
+		record_error(s->fd, s->res, s->op == OP_WRITE ? "write" : "fsync");
+	else if (s->op == OP_WRITE && (size_t)s->res < s->len)
+		record_error(s->fd, -EIO, "write");
+	release(s);
+}
+
+/* Finish off whatever has completed */
+static void poll_slots(void)
+{
+	int i;
+
+#ifdef AIO_URING
+	if (backend == AIO_RING)
+		ring_collect(false);
+#endif
+#ifdef AIO_ASYNC
+	if (backend == AIO_THREAD)
+		SDL_LockMutex(lock);
+#endif
+	for (i = 0; i < AIO_SLOTS; i++) {
+		if (slots[i].state == SLOT_BUSY && slots[i].finished)
+			finish(&slots[i]);
+	}
+#ifdef AIO_ASYNC
+	if (backend == AIO_THREAD)
+		SDL_UnlockMutex(lock);
+#endif
+}
+
+static void wait_slot(aio_slot *s)
+{
+	if (s->state != SLOT_BUSY)
+		return;
+#ifdef AIO_URING
+	if (backend == AIO_RING) {
+		while (!s->finished)
+			ring_collect(true);
+	}
+#endif
+#ifdef AIO_ASYNC
+	if (backend == AIO_THREAD) {
+		SDL_LockMutex(lock);
+		while (!s->finished)
+			SDL_CondWait(cond_done, lock);
+		SDL_UnlockMutex(lock);
+	}
+#endif
+	finish(s);
+}
+
+static bool overlaps(const aio_slot *s, int fd, int64_t off, size_t len)
+{
+	return s->state != SLOT_FREE && s->op != OP_FSYNC && s->fd == fd &&
+	       off < s->off + (int64_t)s->len && s->off < off + (int64_t)len;
+}
+
+/* A free slot, dropping the oldest read-ahead or, with wait, waiting for
+   the oldest request when there is none; NULL without */
+static aio_slot *alloc_slot(bool wait)
+{
+	aio_slot *oldest, *s;
+	int i;
+
+	poll_slots();
+	for (;;) {
+		oldest = NULL;
+		for (i = 0; i < AIO_SLOTS; i++) {
+			s = &slots[i];
+			if (s->state == SLOT_FREE)
+				return s;
+			if ((s->state == SLOT_DONE || wait) && (!oldest || s->seq < oldest->seq))
+				oldest = s;
+		}
+		if (!oldest)
+			return NULL;
+		wait_slot(oldest);
+		if (oldest->state == SLOT_DONE)
+			release(oldest);
+	}
+}
+
+long asyncIoRead(int fd, void *buf, size_t len, int64_t off)
+{
+	long res;
+	int i;
+
+	if (!aio_start()) {
+		res = run_op(OP_READ, fd, buf, len, off);
+		return res < 0 ? -1 : res;
+	}
+
+	poll_slots();
+	for (i = 0; i < AIO_SLOTS; i++) {
+		aio_slot *s = &slots[i];
+
+		if (!overlaps(s, fd, off, len))
+			continue;
+		if (s->op == OP_WRITE) {
+			wait_slot(s);
+			continue;
+		}
+		// Read-ahead holding all of it, or up to where the file ends
+		if (off < s->off || off + (int64_t)len > s->off + (int64_t)s->len)
+			continue;
+		wait_slot(s);
+		if (s->res < 0) {
+			release(s);
+			continue;
+		}
+		res = s->off + s->res - off;
+		if (res < 0)
+			res = 0;
+		if (res > (long)len)
+			res = len;
+		memcpy(buf, s->buf + (off - s->off), res);
+		return res;
+	}
+	res = run_op(OP_READ, fd, buf, len, off);
+	return res < 0 ? -1 : res;
+}
+
+int asyncIoWrite(int fd, const void *buf, size_t len, int64_t off)
+{
+	aio_slot *s;
+	uint8_t *copy;
+	int i;
+
+	if (!aio_start())
+		return run_op(OP_WRITE, fd, (uint8_t *)buf, len, off) == (long)len ? 0 : -1;
+
+	poll_slots();
+	for (i = 0; i < AIO_SLOTS; i++) {
+		s = &slots[i];
+		if (!overlaps(s, fd, off, len))
+			continue;
+		wait_slot(s);
+		if (s->state == SLOT_DONE)
+			release(s);
+	}
+	copy = malloc(len);
+	if (!copy) {
+		asyncIoFlush(fd);
+		return run_op(OP_WRITE, fd, (uint8_t *)buf, len, off) == (long)len ? 0 : -1;
+	}
+	memcpy(copy, buf, len);
+	s = alloc_slot(true);
+	s->op = OP_WRITE;
+	s->fd = fd;
+	s->off = off;
+	s->len = len;
+	s->buf = copy;
+	submit(s);
+	return 0;
+}
+
+void asyncIoReadAhead(int fd, size_t len, int64_t off)
+{
+	aio_slot *s;
+	int i;
+
+	if (!aio_start() || !len)
+		return;
+	if (len > AIO_READ_AHEAD_MAX)
+		len = AIO_READ_AHEAD_MAX;
+
+	poll_slots();
+	for (i = 0; i < AIO_SLOTS; i++) {
+		s = &slots[i];
+		// Not past a write that may not have landed yet
+		if (overlaps(s, fd, off, len) && (s->op == OP_WRITE ||
+		    (off >= s->off && off + (int64_t)len <= s->off + (int64_t)s->len)))
+			return;
+	}
+	s = alloc_slot(false);
+	if (!s || !(s->buf = malloc(len)))
+		return;
+	s->op = OP_READ;
+	s->fd = fd;
+	s->off = off;
+	s->len = len;
+	submit(s);
+}
+
+int asyncIoSync(int fd, bool wait)
+{
+	aio_slot *s;
+
+	if (!aio_start())
+		return run_op(OP_FSYNC, fd, NULL, 0, 0) < 0 ? -1 : 0;
+
+	s = alloc_slot(true);
+	s->op = OP_FSYNC;
+	s->fd = fd;
+	s->off = 0;
+	s->len = 0;
+	s->buf = NULL;
+	submit(s);
+	if (wait)
+		wait_slot(s);
+	else
+		poll_slots();
+	return take_error(fd);
+}
+
+int asyncIoFlush(int fd)
+{
+	int i;
+
+	if (backend <= AIO_SYNC)
+		return 0;
+	for (i = 0; i < AIO_SLOTS; i++) {
+		aio_slot *s = &slots[i];
+
+		if (s->state == SLOT_BUSY && s->op != OP_READ && (fd < 0 || s->fd == fd))
+			wait_slot(s);
+	}
+	return take_error(fd);
+}
+
+int asyncIoForget(int fd)
+{
+	int res = asyncIoFlush(fd);
+	int i;
+
+	for (i = 0; i < AIO_SLOTS && backend > AIO_SYNC; i++) {
+		aio_slot *s = &slots[i];
+
+		if (s->state != SLOT_FREE && s->fd == fd) {
+			wait_slot(s);
+			release(s);
+		}
+	}
+	return res;
+}
+
+void asyncIoForked(void)
+{
+	int i;
+
+	if (backend <= AIO_SYNC)
+		return;
+	// Flushed already; any read-ahead left is the parent's to finish
+	for (i = 0; i < AIO_SLOTS; i++)
+		release(&slots[i]);
+#ifdef AIO_URING
+	if (backend == AIO_RING)
+		ring_close();
+#endif
+#ifdef AIO_ASYNC
+	q_head = q_count = 0;
+#endif
+	backend = -1;
+}
@@ -0,0 +1,46 @@
+/*
+ * async_io.h
+ *
+ * Host disk I/O off the emulator thread, for BDI, QDisk and SD overlay
+ * files.  Writes are copied and land in the background; a read waits
+ * only for queued writes it overlaps, and is served from a read-ahead
+ * started earlier when one covers it.  Data is on disk once
+ * asyncIoSync() with wait set has returned.  On Linux requests go
+ * through io_uring, elsewhere to a worker thread using pread/pwrite;
+ * on Windows and WASM, or with --sync_io, everything runs inline.
+ *
+ * Emulator thread only (or one thread at a time), like the files.
+ */
+
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Like pread: bytes read, short at end of file, or -1 */
+long asyncIoRead(int fd, void *buf, size_t len, int64_t off);
+
+/* Queue a write of a copy of buf, or write it now if it can't be;
+   -1 if it failed then */
+int asyncIoWrite(int fd, const void *buf, size_t len, int64_t off);
+
+/* Start reading len bytes at off for an asyncIoRead() to come */
+void asyncIoReadAhead(int fd, size_t len, int64_t off);
+
+/* fsync behind the writes so far; with wait, until it is done.  -1 if a
+   write or fsync of fd has failed since the last check */
+int asyncIoSync(int fd, bool wait);
+
+/* Wait for fd's queued writes (every file's for fd -1); -1 as above */
+int asyncIoFlush(int fd);
+
+/* Before closing fd: flush it and drop its read-ahead */
+int asyncIoForget(int fd);
+
+/* In the child of a fork, after asyncIoFlush(-1): the ring or worker
+   didn't come along, the next request starts afresh */
+void asyncIoForked(void);
+
+#endif /* ASYNC_IO_H */
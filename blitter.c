@@ -0,0 +1,201 @@
+/*
+ * blitter.c
+ *
+ * Blitter registers, see blitter.h.  The whole blit is drawn natively
+ * when it completes, after every source row has been checked, so an
+ * ERROR blit draws nothing.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "QL68000.h"
+#include "QL_screen.h"
+#include "blitter.h"
+#include "memaccess.h"
+#include "savestate.h"
+#include "scheduler.h"
+
+#define BLIT_REGS	(_BLITTER_SIZE / 2)
+#define SCREEN_W	128
+#define SCREEN_H	128
+#define SCREEN_STRIDE	(SCREEN_W / 2)
+
+#define R(name)		(regs[BLITTER_REG_##name >> 1])
+
+static bool blit_enabled;
+static int blit_rate;
+static uint16_t regs[BLIT_REGS];
+static uint16_t blit_ctrl;		/* of the blit running */
+static uint16_t blit_status;
+static sched_event blit_event;
+
+static inline int get_px(const uint8_t *row, int x)
+{
+	return (row[x >> 1] >> ((x & 1) * 4)) & 15;
+}
+
+static inline void put_px(uint8_t *row, int x, int c)
+{
+	uint8_t *p = &row[x >> 1];
+
+	if (x & 1)
+		*p = (*p & 0x0f) | c << 4;
+	else
+		*p = (*p & 0xf0) | c;
+}
+
+/* Source row y of the blit, from the byte holding pixel SRC_X */
+static const uint8_t *src_row(int y, int w, int h)
+{
+	uint32_t src = (uint32_t)R(SRC_HI) << 16 | R(SRC_LO);
+	int sx = R(SRC_X);
+	int sy = R(SRC_Y) + (blit_ctrl & BLITTER_CTRL_FLIP_Y ? h - 1 - y : y);
+
+	return MemoryHostRange(src + (uint32_t)sy * R(SRC_STRIDE) + sx / 2,
+			       (sx + w - 1) / 2 - sx / 2 + 1, 0);
+}
+
+static bool blit(void)
+{
+	bool fill = blit_ctrl & BLITTER_CTRL_FILL;
+	bool flip_x = blit_ctrl & BLITTER_CTRL_FLIP_X;
+	int w = R(WIDTH), h = R(HEIGHT);
+	int dx = (int16_t)R(DST_X), dy = (int16_t)R(DST_Y);
+	int x0 = dx < 0 ? -dx : 0, x1 = dx + w > SCREEN_W ? SCREEN_W - dx : w;
+	int y0 = dy < 0 ? -dy : 0, y1 = dy + h > SCREEN_H ? SCREEN_H - dy : h;
+	int sx = R(SRC_X) & 1;
+	uint8_t *buf, *dirty;
+	uint8_t map[16];
+	int x, y, c;
+
+	if (x0 >= x1 || y0 >= y1)
+		return true;
+
+	for (c = 0; c < 16; c++)
+		map[c] = c;
+	if (blit_ctrl & BLITTER_CTRL_REMAP) {
+		uint32_t table = (uint32_t)R(REMAP_HI) << 16 | R(REMAP_LO);
+		const uint8_t *p = MemoryHostRange(table, 16, 0);
+
+		if (!p)
+			return false;
+		for (c = 0; c < 16; c++)
+			map[c] = p[c] & 15;
+	}
+	if (!fill) {
+		for (y = y0; y < y1; y++) {
+			if (!src_row(y, w, h))
+				return false;
+		}
+	}
+
+	if (blit_ctrl & BLITTER_CTRL_OVERLAY) {
+		buf = overlayBuffer[1 - vfront];
+		dirty = overlayLineDirty[1 - vfront];
+	} else {
+		buf = frameBuffer[1 - vfront];
+		dirty = frameLineDirty[1 - vfront];
+	}
+
+	for (y = y0; y < y1; y++) {
+		uint8_t *drow = buf + (dy + y) * SCREEN_STRIDE;
+
+		if (fill) {
+			c = map[R(COLOUR) & 15];
+			for (x = x0; x < x1; x++)
+				put_px(drow, dx + x, c);
+		} else {
+			const uint8_t *srow = src_row(y, w, h);
+
+			for (x = x0; x < x1; x++) {
+				c = get_px(srow, sx + (flip_x ? w - 1 - x : x));
+				if (!(R(KEY) >> c & 1))
+					put_px(drow, dx + x, map[c]);
+			}
+		}
+		dirty[dy + y] = 1;
+	}
+	return true;
+}
+
+static void blit_complete(void *arg)
+{
+	blit_status = BLITTER_STATUS_DONE | (blit() ? 0 : BLITTER_STATUS_ERROR);
+	if (blit_ctrl & BLITTER_CTRL_IRQ)
+		RaiseInterrupt(BLITTER_IRQ_LEVEL);
+}
+
+void blitter_init(int enable, int rate)
+{
+	blit_enabled = enable;
+	blit_rate = rate > 0 ? rate : 0;
+	blit_status = 0;
+	memset(regs, 0, sizeof(regs));
+	schedInit(&blit_event, "blitter", blit_complete, NULL);
+}
+
+uint16_t blitter_read(unsigned reg)
+{
+	if (!blit_enabled || reg >= _BLITTER_SIZE)
+		return 0;
+
+	switch (reg) {
+	case BLITTER_REG_ID:
+		return BLITTER_ID;
+	case BLITTER_REG_CTRL:
+		return blit_status;
+	}
+	return regs[reg >> 1];
+}
+
+void blitter_write(unsigned reg, uint16_t d)
+{
+	uint64_t pixels;
+
+	if (!blit_enabled || reg >= _BLITTER_SIZE || (blit_status & BLITTER_STATUS_BUSY))
+		return;
+
+	switch (reg) {
+	case BLITTER_REG_ID:
+		break;
+	case BLITTER_REG_CTRL:
+		if (d & BLITTER_CTRL_ACK) {
+			blit_status = 0;
+			ClearInterrupt(BLITTER_IRQ_LEVEL);
+		}
+		if (d & BLITTER_CTRL_START) {
+			blit_ctrl = d;
+			blit_status = BLITTER_STATUS_BUSY;
+			pixels = (uint64_t)R(WIDTH) * R(HEIGHT);
+			schedAt(&blit_event, blit_rate ? (pixels + blit_rate - 1) / blit_rate : 0);
+		}
+		break;
+	default:
+		regs[reg >> 1] = d;
+		break;
+	}
+}
+
+void blitter_save_state(ss_buf *b)
+{
+	int i;
+
+	for (i = 0; i < BLIT_REGS; i++)
+		ssPut16(b, regs[i]);
+	ssPut16(b, blit_ctrl);
+	ssPut16(b, blit_status);
+}
+
+int blitter_load_state(ss_buf *b)
+{
+	int i;
+
+	for (i = 0; i < BLIT_REGS; i++)
+		regs[i] = ssGet16(b);
+	blit_ctrl = ssGet16(b);
+	blit_status = ssGet16(b);
+	// The completion, if BUSY, comes back with the scheduler's events
+	return b->error ? -1 : 0;
+}
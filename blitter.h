@@ -0,0 +1,95 @@
+/*
+ * blitter.h
+ *
+ * Prototype 2D blitter registers (--blitter), for judging what one in
+ * nextp8-core would save before it is built.  A blit draws a WIDTH by
+ * HEIGHT rectangle of 4bpp pixels into the back buffer or the overlay
+ * back buffer at DST_X, DST_Y, clipped to the 128x128 screen.  Pixels
+ * come from a 4bpp image in guest RAM (SRC, SRC_STRIDE bytes a row, low
+ * nibble first as in the framebuffer) starting at SRC_X, SRC_Y, or are
+ * all COLOUR for a fill.  Source colours whose bit is set in KEY are
+ * left out; with REMAP each colour drawn is looked up in the 16 byte
+ * table at REMAP.  ID reads 0 when disabled.
+ *
+ * A blit stays BUSY for --blitter_rate pixels an instruction and is
+ * drawn when it completes, raising BLITTER_IRQ_LEVEL with CTRL_IRQ
+ * until acknowledged.
+ *
+ * All registers are 16 bits, big endian:
+ *   +0x00 ID          'BL' (0x424c) when enabled
+ *   +0x02 CTRL        write: bit 0 start, bit 1 fill, bit 2 flip x,
+ *                     bit 3 flip y, bit 4 remap, bit 5 to the overlay,
+ *                     bit 6 interrupt when done, bit 15 clear DONE and
+ *                     ERROR
+ *         STATUS      read: bit 0 BUSY, bit 1 DONE, bit 2 ERROR (the
+ *                     source or table isn't plain RAM)
+ *   +0x04 SRC_HI
+ *   +0x06 SRC_LO
+ *   +0x08 SRC_STRIDE
+ *   +0x0a SRC_X
+ *   +0x0c SRC_Y
+ *   +0x0e DST_X       signed
+ *   +0x10 DST_Y       signed
+ *   +0x12 WIDTH
+ *   +0x14 HEIGHT
+ *   +0x16 KEY         transparent source colours, bit n for colour n
+ *   +0x18 COLOUR      fill colour, bits 0-3
+ *   +0x1a REMAP_HI
+ *   +0x1c REMAP_LO
+ */
+
+#ifndef BLITTER_H
+#define BLITTER_H
+
+#include <stdint.h>
+
+#ifndef _BLITTER_BASE
+#define _BLITTER_BASE		0x8f0050
+#endif
+#define _BLITTER_SIZE		0x20
+
+#define BLITTER_ID		0x424c
+#define BLITTER_IRQ_LEVEL	3
+
+#define BLITTER_CTRL_START	0x0001
+#define BLITTER_CTRL_FILL	0x0002
+#define BLITTER_CTRL_FLIP_X	0x0004
+#define BLITTER_CTRL_FLIP_Y	0x0008
+#define BLITTER_CTRL_REMAP	0x0010
+#define BLITTER_CTRL_OVERLAY	0x0020
+#define BLITTER_CTRL_IRQ	0x0040
+#define BLITTER_CTRL_ACK	0x8000
+#define BLITTER_STATUS_BUSY	0x0001
+#define BLITTER_STATUS_DONE	0x0002
+#define BLITTER_STATUS_ERROR	0x0004
+
+#define BLITTER_REG_ID		0x00
+#define BLITTER_REG_CTRL	0x02
+#define BLITTER_REG_SRC_HI	0x04
+#define BLITTER_REG_SRC_LO	0x06
+#define BLITTER_REG_SRC_STRIDE	0x08
+#define BLITTER_REG_SRC_X	0x0a
+#define BLITTER_REG_SRC_Y	0x0c
+#define BLITTER_REG_DST_X	0x0e
+#define BLITTER_REG_DST_Y	0x10
+#define BLITTER_REG_WIDTH	0x12
+#define BLITTER_REG_HEIGHT	0x14
+#define BLITTER_REG_KEY		0x16
+#define BLITTER_REG_COLOUR	0x18
+#define BLITTER_REG_REMAP_HI	0x1a
+#define BLITTER_REG_REMAP_LO	0x1c
+
+struct ss_buf;
+
+/* rate: pixels drawn in an instruction's time, 0 to finish at once */
+void blitter_init(int enable, int rate);
+
+/* Word access to the register at offset reg */
+uint16_t blitter_read(unsigned reg);
+void blitter_write(unsigned reg, uint16_t d);
+
+/* Save state: the registers and a blit in progress */
+void blitter_save_state(struct ss_buf *b);
+int blitter_load_state(struct ss_buf *b);
+
+#endif /* BLITTER_H */
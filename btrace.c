@@ -0,0 +1,384 @@
+/*
+ * btrace.c
+ *
+ * Binary execution trace, see btrace.h.  The emulator thread fills the
+ * ring and publishes its tail every BT_PUBLISH records and at the end of
+ * each traced loop; the writer thread owns the head.  A full ring stalls
+ * the emulator rather than losing records.  The flight recorder's ring
+ * has no writer and just wraps.
+ */
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "QL68000.h"
+#include "btrace.h"
+#include "emulator_options.h"
+#include "thread_policy.h"
+
+#define BT_MAGIC	"SQLUXBT"
+#define BT_RING		(1u << 20)	/* records, 32MB */
+#define BT_PUBLISH	256
+#define BT_FLIGHT_RECS	(2u << 20)	/* records per million instructions */
+
+bool btrace_on = false;
+bool btrace_flight = false;
+
+static FILE *bt_file;
+static btrace_rec *ring;
+static unsigned ring_size = BT_RING;
+static SDL_atomic_t bt_head;	/* next record the writer takes */
+static SDL_atomic_t bt_tail;	/* records published */
+static SDL_atomic_t bt_quit;
+static SDL_Thread *bt_thread;
+
+/* Emulator thread only */
+static uint64_t tail;		/* next free record */
+static uint32_t shadow[16];	/* registers as the decoder has them */
+static bool shadow_valid;
+static unsigned since_sync;
+
+/* Flight recorder triggers */
+static char *flight_file;
+static int flight_dumps;	/* dumps left */
+static int flight_done;
+static uint32_t flight_pc = 0xffffffff;
+static uint32_t flight_wr_lo = 1, flight_wr_hi;	/* none while lo > hi */
+static int flight_post = -1;
+static bool flight_reset;
+static int flight_vector = -1;
+static char flight_why[64];	/* trigger waiting for the end of the instruction */
+
+static void write_header(FILE *f)
+{
+	uint32_t hdr[2] = { BTRACE_VERSION, sizeof(btrace_rec) };
+
+	fwrite(BT_MAGIC, 1, 8, f);
+	fwrite(hdr, sizeof(hdr), 1, f);
+}
+
+static int bt_writer(void *arg)
+{
+	threadPolicyApply(THREAD_WORKER);
+	for (;;) {
+		unsigned head = (unsigned)SDL_AtomicGet(&bt_head);
+		unsigned end = (unsigned)SDL_AtomicGet(&bt_tail);
+		unsigned idx = head & (ring_size - 1), n = end - head;
+
+		if (!n) {
+			// The final publish comes before the quit
+			if (SDL_AtomicGet(&bt_quit) &&
+			    head == (unsigned)SDL_AtomicGet(&bt_tail))
+				break;
+			SDL_Delay(1);
+			continue;
+		}
+		if (idx + n > ring_size)
+			n = ring_size - idx;
+		if (fwrite(&ring[idx], sizeof(*ring), n, bt_file) != n) {
+			perror("trace_file");
+			break;
+		}
+		SDL_AtomicSet(&bt_head, (int)(head + n));
+	}
+	return 0;
+}
+
+bool btraceInit(const char *path)
+{
+	if (!path || !*path)
+		return false;
+	if (btrace_flight) {
+		fprintf(stderr, "Binary trace: trace_file can't be used with the flight recorder\n");
+		return false;
+	}
+	bt_file = fopen(path, "wb");
+	if (!bt_file) {
+		perror(path);
+		return false;
+	}
+	ring = malloc(BT_RING * sizeof(*ring));
+	if (!ring) {
+		fprintf(stderr, "Binary trace: no memory for the ring\n");
+		fclose(bt_file);
+		return false;
+	}
+	write_header(bt_file);
+
+	SDL_AtomicSet(&bt_head, 0);
+	SDL_AtomicSet(&bt_tail, 0);
+	SDL_AtomicSet(&bt_quit, 0);
+	bt_thread = SDL_CreateThread(bt_writer, "sQLux Trace", NULL);
+	if (!bt_thread) {
+		fprintf(stderr, "Binary trace: writer thread creation failed: %s\n",
+			SDL_GetError());
+		free(ring);
+		fclose(bt_file);
+		return false;
+	}
+	btrace_on = true;
+	atexit(btraceClose);
+	printf("Binary trace: asyncTrace output goes to %s\n", path);
+	return true;
+}
+
+static void flight_exit(void);
+
+void btraceFlightInit(void)
+{
+	int n = emulatorOptionInt("flight_recorder");
+	const char *s;
+	char *end;
+
+	if (n <= 0)
+		return;
+	ring_size = 1;
+	while (ring_size < (uint64_t)n * BT_FLIGHT_RECS && ring_size < (1u << 31))
+		ring_size <<= 1;
+	ring = malloc((size_t)ring_size * sizeof(*ring));
+	if (!ring) {
+		fprintf(stderr, "Flight recorder: no memory for %u records\n", ring_size);
+		ring_size = BT_RING;
+		return;
+	}
+	flight_file = strdup(emulatorOptionString("flight_file"));
+	flight_dumps = emulatorOptionInt("flight_dumps");
+	s = emulatorOptionString("flight_pc");
+	if (s && *s)
+		flight_pc = strtoul(s, NULL, 0) & ADDR_MASK_E;
+	s = emulatorOptionString("flight_write");
+	if (s && *s) {
+		flight_wr_lo = flight_wr_hi = strtoul(s, &end, 0);
+		if (*end == '-' || *end == ',')
+			flight_wr_hi = strtoul(end + 1, NULL, 0);
+	}
+	flight_post = emulatorOptionInt("flight_post");
+	flight_reset = emulatorOptionFlag("flight_reset");
+	flight_vector = emulatorOptionInt("flight_vector");
+
+	btrace_on = btrace_flight = true;
+	atexit(flight_exit);
+	printf("Flight recorder: keeping the last %u trace records, dumped to %s\n",
+	       ring_size, flight_file);
+}
+
+static void flight_dump(void)
+{
+	uint64_t first = tail > ring_size ? tail - ring_size : 0, i;
+	char name[4096];
+	FILE *f;
+
+	if (flight_done)
+		snprintf(name, sizeof(name), "%s.%d", flight_file, flight_done);
+	else
+		snprintf(name, sizeof(name), "%s", flight_file);
+	flight_done++;
+
+	f = fopen(name, "wb");
+	if (!f) {
+		perror(name);
+		return;
+	}
+	write_header(f);
+	// Oldest first, in at most two runs
+	for (i = first; i < tail; ) {
+		uint64_t idx = i & (ring_size - 1);
+		uint64_t n = tail - i;
+
+		if (idx + n > ring_size)
+			n = ring_size - idx;
+		fwrite(&ring[idx], sizeof(*ring), n, f);
+		i += n;
+	}
+	fclose(f);
+	printf("Flight recorder: %s, %llu records written to %s\n", flight_why,
+	       (unsigned long long)(tail - first), name);
+}
+
+/* A trigger just before the guest shut the emulator down */
+static void flight_exit(void)
+{
+	if (*flight_why)
+		flight_dump();
+}
+
+void btraceTrigger(const char *why)
+{
+	if (!btrace_flight || flight_done >= flight_dumps || *flight_why)
+		return;
+	snprintf(flight_why, sizeof(flight_why), "%s at pc=0x%lx", why,
+		 (unsigned long)((Ptr)pc - (Ptr)memBase));
+}
+
+void btracePost(unsigned d)
+{
+	char why[32];
+
+	if (btrace_flight && (int)d == flight_post) {
+		snprintf(why, sizeof(why), "POST code %u", d);
+		btraceTrigger(why);
+	}
+}
+
+void btraceResetReq(void)
+{
+	if (flight_reset)
+		btraceTrigger("RESET_REQ");
+}
+
+void btraceVector(int vector)
+{
+	char why[32];
+
+	if (vector == flight_vector) {
+		snprintf(why, sizeof(why), "exception vector %d", vector);
+		btraceTrigger(why);
+	}
+}
+
+void btraceClose(void)
+{
+	if (!btrace_on || btrace_flight)
+		return;
+	btrace_on = false;
+	btracePublish();
+	SDL_AtomicSet(&bt_quit, 1);
+	SDL_WaitThread(bt_thread, NULL);
+	bt_thread = NULL;
+	fclose(bt_file);
+	bt_file = NULL;
+}
+
+void btracePublish(void)
+{
+	if (!btrace_flight)
+		SDL_AtomicSet(&bt_tail, (int)(unsigned)tail);
+}
+
+static btrace_rec *bt_next(void)
+{
+	if (btrace_flight)
+		return &ring[tail++ & (ring_size - 1)];
+	if (!(tail & (BT_PUBLISH - 1)))
+		btracePublish();
+	while ((unsigned)tail - (unsigned)SDL_AtomicGet(&bt_head) >= ring_size)
+		SDL_Delay(1);
+	return &ring[tail++ & (ring_size - 1)];
+}
+
+/* Moves up to four values of the registers in *mask into r */
+static void bt_values(btrace_rec *r, const uint32_t *val, unsigned *mask)
+{
+	unsigned i, n = 0, put = 0;
+
+	for (i = 0; i < 16 && n < 4; i++) {
+		if (*mask & (1u << i)) {
+			r->v[n++] = val[i];
+			put |= 1u << i;
+		}
+	}
+	*mask &= ~put;
+	r->count = n;
+	if (r->type != BT_INSN)
+		r->mask = put;
+}
+
+static void bt_regs(const uint32_t *val, unsigned mask, unsigned flags)
+{
+	while (mask) {
+		btrace_rec *r = bt_next();
+
+		r->type = BT_REGS;
+		r->opcode = 0;
+		r->addr = r->data = 0;
+		r->flags = flags;
+		bt_values(r, val, &mask);
+		flags = 0;
+	}
+}
+
+void btraceInsn(uint32_t old_pc, uint32_t new_pc, uint16_t opcode,
+		const uint32_t *old_reg)
+{
+	const uint32_t *now = (const uint32_t *)reg;
+	btrace_rec *r;
+	unsigned mask = 0, i;
+
+	if (!shadow_valid || ++since_sync >= BT_SYNC_INSNS) {
+		bt_regs(old_reg, 0xffff, BT_REGS_FULL);
+		shadow_valid = true;
+		since_sync = 0;
+	} else {
+		// Exceptions and interrupts change registers between instructions
+		for (i = 0; i < 16; i++) {
+			if (old_reg[i] != shadow[i])
+				mask |= 1u << i;
+		}
+		if (mask)
+			bt_regs(old_reg, mask, 0);
+	}
+
+	mask = 0;
+	for (i = 0; i < 16; i++) {
+		if (now[i] != old_reg[i])
+			mask |= 1u << i;
+	}
+	r = bt_next();
+	r->type = BT_INSN;
+	r->opcode = opcode;
+	r->addr = old_pc;
+	r->data = new_pc;
+	r->mask = mask;
+	r->flags = 0;
+	bt_values(r, now, &mask);
+	while (mask) {
+		r = bt_next();
+		r->type = BT_MORE;
+		r->opcode = 0;
+		r->addr = r->data = 0;
+		r->flags = 0;
+		bt_values(r, now, &mask);
+	}
+	memcpy(shadow, now, sizeof(shadow));
+
+	if (unlikely(old_pc == flight_pc))
+		btraceTrigger("flight_pc reached");
+	// Dumped once the instruction that fired it is in the ring
+	if (unlikely(*flight_why)) {
+		flight_dump();
+		*flight_why = 0;
+	}
+}
+
+void btraceMem(int type, uint32_t addr, uint32_t data)
+{
+	btrace_rec *r = bt_next();
+
+	r->type = type;
+	r->count = 0;
+	r->opcode = 0;
+	r->addr = addr;
+	r->data = data;
+	r->mask = 0;
+	r->flags = 0;
+
+	if (unlikely(type >= BT_MEM_WR_B && addr >= flight_wr_lo && addr <= flight_wr_hi))
+		btraceTrigger("write to flight_write");
+}
+
+void btraceMark(uint32_t addr, const char *name)
+{
+	btrace_rec *r = bt_next();
+
+	r->type = BT_MARK;
+	r->count = 4;
+	r->opcode = 0;
+	r->addr = addr;
+	r->data = 0;
+	r->mask = 0;
+	r->flags = 0;
+	memset(r->v, 0, sizeof(r->v));
+	strncpy((char *)r->v, name, sizeof(r->v));
+}
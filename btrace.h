@@ -0,0 +1,100 @@
+/*
+ * btrace.h
+ *
+ * Binary execution trace (--trace_file).  With asyncTrace on, the traced
+ * loop and the memory accessors write one fixed-size record per
+ * instruction and per memory access into a ring that a writer thread
+ * drains to the file, instead of printing a text line for each.
+ * btrace_dump turns the file back into the asyncTrace text.
+ *
+ * The flight recorder (--flight_recorder <N>) keeps the records of about
+ * the last N million instructions in a circular ring instead, whether or
+ * not asyncTrace is on, and writes the ring to --flight_file when a
+ * trigger fires: executing --flight_pc, a write to --flight_write, POST
+ * code --flight_post, a RESET_REQ write with --flight_reset, taking
+ * exception vector --flight_vector, or a calling convention violation.
+ *
+ * An instruction record holds the PC before and after, the opcode and
+ * the mask of registers it changed; the new values follow in it and in
+ * BT_MORE records.  BT_REGS records set registers that changed between
+ * instructions; a full set is written at the start and every
+ * BT_SYNC_INSNS instructions, so a decoder can start at any of these.
+ *
+ * File format: "SQLUXBT\0", u32 version, u32 record size, then records,
+ * all in host byte order.
+ */
+
+#ifndef BTRACE_H
+#define BTRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BTRACE_VERSION	1
+#define BT_SYNC_INSNS	65536
+
+enum {
+	BT_INSN = 1,
+	BT_MORE,	/* further new values of the BT_INSN before */
+	BT_REGS,	/* registers set outside an instruction */
+	BT_MEM_RD_B,	/* byte: data=0xzzNN or 0xNNzz */
+	BT_MEM_RD_HB,	/* hardware byte: data=0xNNNN */
+	BT_MEM_RD_W,
+	BT_MEM_WR_B,	/* data=0xNNNN */
+	BT_MEM_WR_W,
+	BT_MARK,	/* perfctr marker: addr=name, v[]=its first 16 characters */
+};
+
+#define BT_REGS_FULL	1	/* flags: first BT_REGS of a full set */
+
+typedef struct {
+	uint8_t type;
+	uint8_t count;		/* values in v[] */
+	uint16_t opcode;
+	uint32_t addr;		/* BT_INSN: PC before; memory: address */
+	uint32_t data;		/* BT_INSN: PC after; memory: data */
+	uint16_t mask;		/* BT_INSN: all registers changed; else those in v[] */
+	uint16_t flags;
+	uint32_t v[4];		/* register values, lowest register first */
+} btrace_rec;
+
+extern bool asyncTrace;
+
+/* Records go into the ring: to a file, or the flight recorder's */
+extern bool btrace_on;
+extern bool btrace_flight;
+
+/* The traced loop runs: for asyncTrace or for the flight recorder */
+#define BTRACE_ANY()	(asyncTrace || btrace_flight)
+
+/* asyncTrace prints text: it isn't going to the trace file */
+#define BTRACE_TEXT()	(asyncTrace && (!btrace_on || btrace_flight))
+
+/* Starts the writer; false if the file can't be opened */
+bool btraceInit(const char *path);
+
+/* Sets up the flight recorder from its options */
+void btraceFlightInit(void);
+
+/* Flight recorder triggers, each dumps the ring if armed */
+void btraceTrigger(const char *why);
+void btracePost(unsigned d);
+void btraceResetReq(void);
+void btraceVector(int vector);
+
+/* Drains the ring and closes the file */
+void btraceClose(void);
+
+/* After an instruction traced from old_pc with registers old_reg[] */
+void btraceInsn(uint32_t old_pc, uint32_t new_pc, uint16_t opcode,
+		const uint32_t *old_reg);
+
+void btraceMem(int type, uint32_t addr, uint32_t data);
+
+/* A marker the guest named with the string at addr */
+void btraceMark(uint32_t addr, const char *name);
+
+/* Hands what has been recorded so far to the writer */
+void btracePublish(void);
+
+#endif /* BTRACE_H */
@@ -0,0 +1,169 @@
+/*
+ * btrace_dump.c
+ *
+ * Prints a --trace_file binary trace (see btrace.h) as the asyncTrace
+ * text: "MEM RD:"/"MEM WR:" lines and a "PC=... D0=..." line per
+ * instruction.  Instructions before the first full register set are
+ * counted but not printed.
+ *
+ * Usage: btrace_dump <trace file>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "btrace.h"
+
+static uint32_t regs[16];
+static unsigned known;		/* registers that have had a value */
+
+static btrace_rec insn;		/* instruction waiting for its BT_MORE values */
+static uint32_t old_regs[16];
+static unsigned pending;	/* its registers still to come */
+static bool have_insn;
+static unsigned long long skipped;
+
+static const char *change_to_str(char *buf, uint32_t old_val, uint32_t new_val)
+{
+	if (old_val == new_val)
+		snprintf(buf, 32, "0x%x", new_val);
+	else
+		snprintf(buf, 32, "0x%x->0x%x", old_val, new_val);
+	return buf;
+}
+
+static void apply(const btrace_rec *r, unsigned mask)
+{
+	unsigned i, n = 0;
+
+	for (i = 0; i < 16 && n < r->count; i++) {
+		if (mask & (1u << i))
+			regs[i] = r->v[n++];
+	}
+}
+
+/* The lowest r->count registers of mask */
+static unsigned first_regs(unsigned mask, unsigned count)
+{
+	unsigned i, put = 0;
+
+	for (i = 0; i < 16 && count; i++) {
+		if (mask & (1u << i)) {
+			put |= 1u << i;
+			count--;
+		}
+	}
+	return put;
+}
+
+static void print_insn(void)
+{
+	char buf[17][32];
+	static const char *const names[16] = {
+		"D0", "D1", "D2", "D3", "D4", "D5", "D6", "D7",
+		"A0", "A1", "A2", "A3", "A4", "A5", "A6", "A7"
+	};
+	unsigned i;
+
+	have_insn = false;
+	if (known != 0xffff) {
+		skipped++;
+		return;
+	}
+	printf("PC=%s", change_to_str(buf[0], insn.addr, insn.data));
+	for (i = 0; i < 16; i++)
+		printf(" %s=%s", names[i], change_to_str(buf[i + 1], old_regs[i], regs[i]));
+	putchar('\n');
+}
+
+/* An instruction is complete at the first record that isn't its BT_MORE */
+static void finish_insn(void)
+{
+	if (have_insn)
+		print_insn();
+}
+
+int main(int argc, char *argv[])
+{
+	char magic[8];
+	uint32_t hdr[2];
+	btrace_rec r;
+	FILE *f;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <trace file>\n", argv[0]);
+		return 2;
+	}
+	f = fopen(argv[1], "rb");
+	if (!f) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (fread(magic, 1, 8, f) != 8 || memcmp(magic, "SQLUXBT", 8) ||
+	    fread(hdr, sizeof(hdr), 1, f) != 1 || hdr[0] != BTRACE_VERSION ||
+	    hdr[1] != sizeof(btrace_rec)) {
+		fprintf(stderr, "%s: not a version %d binary trace\n", argv[1], BTRACE_VERSION);
+		return 1;
+	}
+
+	while (fread(&r, sizeof(r), 1, f) == 1) {
+		unsigned put;
+
+		if (r.type == BT_MORE) {
+			if (!have_insn)
+				continue;
+			apply(&r, r.mask);
+			pending &= ~r.mask;
+			if (!pending)
+				print_insn();
+			continue;
+		}
+		finish_insn();
+
+		switch (r.type) {
+		case BT_INSN:
+			insn = r;
+			memcpy(old_regs, regs, sizeof(regs));
+			put = first_regs(r.mask, r.count);
+			apply(&r, r.mask);
+			pending = r.mask & ~put;
+			if (pending)
+				have_insn = true;
+			else
+				print_insn();
+			break;
+		case BT_REGS:
+			apply(&r, r.mask);
+			known |= r.mask;
+			break;
+		case BT_MEM_RD_B:
+			if (r.addr & 1)
+				printf("MEM RD: addr=0x%x data=0xzz%02x\n", r.addr, r.data & 0xff);
+			else
+				printf("MEM RD: addr=0x%x data=0x%02xzz\n", r.addr, r.data & 0xff);
+			break;
+		case BT_MEM_RD_HB:
+		case BT_MEM_RD_W:
+			printf("MEM RD: addr=0x%x data=0x%x\n", r.addr, r.data);
+			break;
+		case BT_MEM_WR_B:
+		case BT_MEM_WR_W:
+			printf("MEM WR: addr=0x%x data=0x%x\n", r.addr, r.data);
+			break;
+		case BT_MARK:
+			printf("MARK: %.*s\n", (int)sizeof(r.v), (const char *)r.v);
+			break;
+		default:
+			fprintf(stderr, "%s: unknown record type %u\n", argv[1], r.type);
+			return 1;
+		}
+	}
+	finish_insn();
+	fclose(f);
+
+	if (skipped)
+		fprintf(stderr, "%llu instructions before the first register sync not shown\n",
+			skipped);
+	return 0;
+}
@@ -16,21 +16,25 @@ static inline Cond CondF(void)
 
 static inline Cond CondHI(void)
 {   
+  CC_FLUSH();
   return !(carry||zero);
 }
 
 static inline Cond CondLS(void)
 {    
+  CC_FLUSH();
   return carry||zero;
 }
 
 static inline Cond CondCC(void)
 {  
+  CC_FLUSH();
   return !carry;
 }
 
 static inline Cond CondCS(void)
 {     
+  CC_FLUSH();
   return carry;
 }
 
@@ -46,11 +50,13 @@ static inline Cond CondEQ(void)
 
 static inline Cond CondVC(void)
 {   
+  CC_FLUSH();
   return !overflow;
 }
 
 static inline Cond CondVS(void)
 {   
+  CC_FLUSH();
   return overflow;
 }
 
@@ -66,20 +72,24 @@ static inline Cond CondMI(void)
 
 static inline Cond CondGE(void)
 {   
+  CC_FLUSH();
   return (negative==overflow);/*  return (negative&&overflow)||(!(negative||overflow));*/
 }
 
 static inline Cond CondLT(void)
 {    
+  CC_FLUSH();
   return (negative!=overflow);/*  return (negative&&(!overflow))||((!negative)&&overflow);*/
 }
 
 static inline Cond CondGT(void)
 {    
+  CC_FLUSH();
   return (!zero)&&(negative==overflow);/*  return (!zero)&&((negative&&overflow)||(!(negative||overflow)));*/
 }
 
 static inline Cond CondLE(void)
 { 
+  CC_FLUSH();
   return zero||(negative!=overflow);/*  return zero||(negative&&(!overflow))||((!negative)&&overflow);*/
 }
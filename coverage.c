@@ -0,0 +1,58 @@
+/*
+ * coverage.c
+ *
+ * Guest code coverage, see coverage.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coverage.h"
+#ifdef PROFILER
+#include "profiler/profiler_coverage.h"
+#endif
+
+#define COVERAGE_BYTES	((ADDR_MASK + 1) >> 4)
+
+uint8_t *coverage_bits;
+
+#ifdef PROFILER
+
+static char *out_file;
+static const char *elf_files[2];
+static int nelf;
+
+static void coverage_write(void)
+{
+	Profiler_WriteCoverage(out_file, coverage_bits, elf_files, nelf);
+}
+
+void coverageInit(const char *file, const char *cart_elf, const char *rom_elf)
+{
+	if (!file || !*file)
+		return;
+	coverage_bits = calloc(1, COVERAGE_BYTES);
+	if (!coverage_bits) {
+		fprintf(stderr, "Coverage: out of memory\n");
+		return;
+	}
+	out_file = strdup(file);
+	if (cart_elf && *cart_elf)
+		elf_files[nelf++] = strdup(cart_elf);
+	if (rom_elf && *rom_elf)
+		elf_files[nelf++] = strdup(rom_elf);
+	if (!nelf)
+		fprintf(stderr, "Coverage: no cart_elf or rom1_elf, %s will be empty\n", file);
+	atexit(coverage_write);
+}
+
+#else
+
+void coverageInit(const char *file, const char *cart_elf, const char *rom_elf)
+{
+	if (file && *file)
+		fprintf(stderr, "Coverage: needs the profiler's symbol tables, not in this build\n");
+}
+
+#endif
@@ -0,0 +1,32 @@
+/*
+ * coverage.h
+ *
+ * Guest code coverage (--coverage): one "has run" bit per instruction
+ * address, set when the decode cache fills the entry for it, so a run
+ * pays for it once per cache miss and nothing per instruction.  Builds
+ * without the decode cache set it from the dispatch loop instead.  At
+ * exit the bits are written as an lcov tracefile, with the functions
+ * and source lines of cart_elf and rom1_elf (see
+ * profiler/profiler_coverage.h), for genhtml or a CI coverage report.
+ */
+
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <stdint.h>
+
+#include "QL68000.h"
+
+/* Bit (addr >> 1) & 7 of byte addr >> 4; NULL if coverage is off */
+extern uint8_t *coverage_bits;
+
+static inline void coverageMark(uw32 addr)
+{
+	addr &= ADDR_MASK;
+	coverage_bits[addr >> 4] |= 1 << ((addr >> 1) & 7);
+}
+
+/* Option: lcov file to write at exit, NULL or "" for none */
+void coverageInit(const char *file, const char *cart_elf, const char *rom_elf);
+
+#endif /* COVERAGE_H */
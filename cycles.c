@@ -0,0 +1,541 @@
+/*
+ * cycles.c
+ *
+ * Per-opcode cycle costs, see cycles.h.  The table is built once from
+ * the opcode fields, following the instruction timing tables of the
+ * M68000 family manuals.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "cycles.h"
+
+/* Charged where the cost depends on operands or the register list */
+#define SHIFT_COUNT		4	/* shift count held in a register */
+#define MOVEM_REGS		6	/* registers moved by MOVEM */
+
+MACHINE_LOCAL uint64_t cpu_cycles = 0;
+MACHINE_LOCAL uint64_t cpu_insns;
+bool insn_counting;
+uint8_t cycle_table[65536];
+bool cycle_timing = false;
+unsigned cpu_mhz = 1;
+int utimer_mode = UTIMER_SYNC;
+MACHINE_LOCAL uint64_t utimer_base, utimer_base_cycles, utimer_last;
+
+static bool m68010, m68020;
+
+/* Effective address calculation time, byte/word or long */
+static unsigned ea_time(unsigned mode, unsigned reg, bool is_long)
+{
+	static const uint8_t modes[8][2] = {
+		{ 0, 0 },	/* Dn */
+		{ 0, 0 },	/* An */
+		{ 4, 8 },	/* (An) */
+		{ 4, 8 },	/* (An)+ */
+		{ 6, 10 },	/* -(An) */
+		{ 8, 12 },	/* d16(An) */
+		{ 10, 14 },	/* d8(An,Xn) */
+	};
+	static const uint8_t other[5][2] = {
+		{ 8, 12 },	/* abs.W */
+		{ 12, 16 },	/* abs.L */
+		{ 8, 12 },	/* d16(PC) */
+		{ 10, 14 },	/* d8(PC,Xn) */
+		{ 4, 8 },	/* #imm */
+	};
+
+	if (mode < 7)
+		return modes[mode][is_long];
+	return reg < 5 ? other[reg][is_long] : 0;
+}
+
+/* Time to write a MOVE destination, beyond the source */
+static unsigned move_dest_time(unsigned mode, unsigned reg, bool is_long)
+{
+	static const uint8_t modes[7][2] = {
+		{ 0, 0 }, { 0, 0 }, { 4, 8 }, { 4, 8 }, { 4, 8 }, { 8, 12 }, { 10, 14 },
+	};
+
+	if (mode < 7)
+		return modes[mode][is_long];
+	if (reg == 0)
+		return is_long ? 12 : 8;
+	if (reg == 1)
+		return is_long ? 16 : 12;
+	return 0;
+}
+
+/* JMP, JSR, LEA and PEA by control addressing mode */
+static unsigned control_time(unsigned mode, unsigned reg, const uint8_t t[6])
+{
+	switch (mode) {
+	case 2: return t[0];
+	case 5: return t[1];
+	case 6: return t[2];
+	case 7:
+		switch (reg) {
+		case 0: return t[3];
+		case 1: return t[4];
+		case 2: return t[1];
+		case 3: return t[2];
+		}
+	}
+	return t[0];
+}
+
+static unsigned exception_time(void)
+{
+	return m68010 ? 38 : 34;
+}
+
+/* Immediate and bit operations, line 0 */
+static unsigned line0(uint16_t op, unsigned mode, unsigned reg)
+{
+	unsigned size = (op >> 6) & 3;
+	bool is_long = size == 2;
+	bool dreg = mode == 0;
+
+	if (op & 0x0100) {
+		if (mode == 1)				/* MOVEP */
+			return (op & 0x0040) ? 24 : 16;
+		switch (size) {				/* BTST/BCHG/BCLR/BSET Dn */
+		case 0: return dreg ? 6 : 4 + ea_time(mode, reg, false);
+		case 2: return dreg ? 10 : 8 + ea_time(mode, reg, false);
+		default: return dreg ? 8 : 8 + ea_time(mode, reg, false);
+		}
+	}
+	if ((op & 0x0f00) == 0x0800) {			/* BTST/BCHG/BCLR/BSET #n */
+		switch (size) {
+		case 0: return dreg ? 10 : 8 + ea_time(mode, reg, false);
+		case 2: return dreg ? 14 : 12 + ea_time(mode, reg, false);
+		default: return dreg ? 12 : 12 + ea_time(mode, reg, false);
+		}
+	}
+	if ((op & 0x0f00) == 0x0e00)			/* MOVES */
+		return 18 + ea_time(mode, reg, is_long);
+	if (mode == 7 && reg == 4)			/* to CCR/SR */
+		return 20;
+	if ((op & 0x0f00) == 0x0c00)			/* CMPI */
+		return dreg ? (is_long ? 14 : 8) : (is_long ? 12 : 8) + ea_time(mode, reg, is_long);
+	return dreg ? (is_long ? 16 : 8) : (is_long ? 20 : 12) + ea_time(mode, reg, is_long);
+}
+
+/* MOVE and MOVEA, lines 1 to 3 */
+static unsigned line_move(uint16_t op, unsigned mode, unsigned reg)
+{
+	bool is_long = (op >> 12) == 2;
+
+	return 4 + ea_time(mode, reg, is_long) +
+		move_dest_time((op >> 6) & 7, (op >> 9) & 7, is_long);
+}
+
+/* Miscellaneous, line 4 */
+static unsigned line4(uint16_t op, unsigned mode, unsigned reg)
+{
+	static const uint8_t jmp[6] = { 8, 10, 14, 10, 12 };
+	static const uint8_t jsr[6] = { 16, 18, 22, 18, 20 };
+	static const uint8_t lea[6] = { 4, 8, 12, 8, 12 };
+	static const uint8_t pea[6] = { 12, 16, 20, 16, 20 };
+	static const uint8_t movem_load[6] = { 12, 16, 18, 16, 20 };
+	static const uint8_t movem_store[6] = { 8, 12, 14, 12, 16 };
+	unsigned size = (op >> 6) & 3;
+	bool is_long = size == 2;
+	bool dreg = mode == 0;
+
+	switch (op) {
+	case 0x4afc: return exception_time();		/* ILLEGAL */
+	case 0x4e70: return 132;			/* RESET */
+	case 0x4e71: return 4;				/* NOP */
+	case 0x4e72: return 4;				/* STOP */
+	case 0x4e73: return m68010 ? 24 : 20;		/* RTE */
+	case 0x4e74: return 16;				/* RTD */
+	case 0x4e75: return 16;				/* RTS */
+	case 0x4e76: return 4;				/* TRAPV */
+	case 0x4e77: return 20;				/* RTR */
+	case 0x4e7a: return 12;				/* MOVEC */
+	case 0x4e7b: return 10;
+	}
+
+	switch (op & 0xfff8) {
+	case 0x4e50: return 16;				/* LINK */
+	case 0x4e58: return 12;				/* UNLK */
+	case 0x4e60:
+	case 0x4e68: return 4;				/* MOVE USP */
+	case 0x4840: return 4;				/* SWAP */
+	case 0x4848: return exception_time();		/* BKPT */
+	case 0x4880: case 0x48c0: return 4;		/* EXT */
+	}
+	if ((op & 0xfff0) == 0x4e40)			/* TRAP */
+		return exception_time();
+
+	switch (op & 0xffc0) {
+	case 0x4e80: return control_time(mode, reg, jsr);
+	case 0x4ec0: return control_time(mode, reg, jmp);
+	case 0x4840: return control_time(mode, reg, pea);
+	case 0x40c0:					/* MOVE from SR */
+	case 0x42c0:					/* MOVE from CCR */
+		if (dreg)
+			return m68010 ? 4 : 6;
+		return 8 + ea_time(mode, reg, false);
+	case 0x44c0:					/* MOVE to CCR */
+	case 0x46c0:					/* MOVE to SR */
+		return 12 + ea_time(mode, reg, false);
+	case 0x4800: return dreg ? 6 : 8 + ea_time(mode, reg, false);	/* NBCD */
+	case 0x4ac0: return dreg ? 4 : 10 + ea_time(mode, reg, false);	/* TAS */
+	}
+	if ((op & 0xf1c0) == 0x41c0)
+		return control_time(mode, reg, lea);
+	if ((op & 0xf1c0) == 0x4180)			/* CHK */
+		return 10 + ea_time(mode, reg, false);
+	if ((op & 0xfb80) == 0x4880) {			/* MOVEM */
+		unsigned per = (op & 0x0040) ? 8 : 4;
+		const uint8_t *t = (op & 0x0400) ? movem_load : movem_store;
+
+		if (mode == 3)
+			t = movem_load;
+		else if (mode == 4)
+			t = movem_store;
+		if (mode == 3 || mode == 4)
+			return t[0] + per * MOVEM_REGS;
+		return control_time(mode, reg, t) + per * MOVEM_REGS;
+	}
+	if (size != 3 && (op & 0xf900) == 0x4000)
+		/* NEGX, CLR, NEG, NOT */
+		return dreg ? (is_long ? 6 : 4) : (is_long ? 12 : 8) + ea_time(mode, reg, is_long);
+	if (size != 3 && (op & 0xff00) == 0x4a00)	/* TST */
+		return 4 + ea_time(mode, reg, is_long);
+	return exception_time();
+}
+
+/* ADDQ, SUBQ, Scc and DBcc, line 5 */
+static unsigned line5(uint16_t op, unsigned mode, unsigned reg)
+{
+	bool is_long = ((op >> 6) & 3) == 2;
+
+	if (((op >> 6) & 3) == 3) {
+		if (mode == 1)				/* DBcc */
+			return 10;
+		return mode == 0 ? 6 : 8 + ea_time(mode, reg, false);
+	}
+	if (mode == 0)
+		return is_long ? 8 : 4;
+	if (mode == 1)
+		return 8;
+	return (is_long ? 12 : 8) + ea_time(mode, reg, is_long);
+}
+
+/* The ADD/SUB/AND/OR/CMP family with a data register operand */
+static unsigned arith(unsigned opmode, unsigned mode, unsigned reg, bool cmp)
+{
+	bool is_long = (opmode & 3) == 2;
+
+	if (opmode < 4) {				/* <ea>,Dn */
+		if (!is_long)
+			return 4 + ea_time(mode, reg, false);
+		if (cmp)
+			return 6 + ea_time(mode, reg, true);
+		return (mode < 2 || (mode == 7 && reg == 4) ? 8 : 6) + ea_time(mode, reg, true);
+	}
+	return (is_long ? 12 : 8) + ea_time(mode, reg, is_long);	/* Dn,<ea> */
+}
+
+/* OR, DIVU, DIVS, SBCD (line 8) and AND, MULU, MULS, ABCD, EXG (line C) */
+static unsigned line8c(uint16_t op, unsigned mode, unsigned reg)
+{
+	unsigned opmode = (op >> 6) & 7;
+	bool mul = (op >> 12) == 0xc;
+
+	if (opmode == 3) {				/* DIVU, MULU */
+		if (mul)
+			return (m68010 ? 40 : 54) + ea_time(mode, reg, false);
+		return (m68010 ? 108 : 140) + ea_time(mode, reg, false);
+	}
+	if (opmode == 7) {				/* DIVS, MULS */
+		if (mul)
+			return (m68010 ? 42 : 54) + ea_time(mode, reg, false);
+		return (m68010 ? 122 : 158) + ea_time(mode, reg, false);
+	}
+	if ((op & 0x01f0) == 0x0100)			/* SBCD, ABCD */
+		return (op & 0x0008) ? 18 : 6;
+	if (mul && ((op & 0x01f8) == 0x0140 || (op & 0x01f8) == 0x0148 ||
+		    (op & 0x01f8) == 0x0188))		/* EXG */
+		return 6;
+	return arith(opmode, mode, reg, false);
+}
+
+/* SUB, SUBA, SUBX (line 9) and ADD, ADDA, ADDX (line D) */
+static unsigned line9d(uint16_t op, unsigned mode, unsigned reg)
+{
+	unsigned opmode = (op >> 6) & 7;
+
+	if (opmode == 3)				/* ADDA.W */
+		return 8 + ea_time(mode, reg, false);
+	if (opmode == 7)				/* ADDA.L */
+		return (mode < 2 || (mode == 7 && reg == 4) ? 8 : 6) + ea_time(mode, reg, true);
+	if (opmode >= 4 && mode < 2) {			/* ADDX */
+		bool is_long = opmode == 6;
+
+		if (mode == 1)
+			return is_long ? 30 : 18;
+		return is_long ? 8 : 4;
+	}
+	return arith(opmode, mode, reg, false);
+}
+
+/* CMP, CMPA, CMPM and EOR, line B */
+static unsigned lineb(uint16_t op, unsigned mode, unsigned reg)
+{
+	unsigned opmode = (op >> 6) & 7;
+
+	if (opmode == 3 || opmode == 7)			/* CMPA */
+		return 6 + ea_time(mode, reg, opmode == 7);
+	if (opmode < 4)
+		return arith(opmode, mode, reg, true);
+	if (mode == 1)					/* CMPM */
+		return opmode == 6 ? 20 : 12;
+	if (mode == 0)					/* EOR Dn,Dn */
+		return opmode == 6 ? 8 : 4;
+	return arith(opmode, mode, reg, false);
+}
+
+/* Shifts and rotates, line E */
+static unsigned linee(uint16_t op, unsigned mode, unsigned reg)
+{
+	unsigned count;
+
+	if (((op >> 6) & 3) == 3)			/* memory, by one */
+		return 8 + ea_time(mode, reg, false);
+	if (op & 0x0020)
+		count = SHIFT_COUNT;
+	else
+		count = ((op >> 9) & 7) ? (op >> 9) & 7 : 8;
+	return (((op >> 6) & 3) == 2 ? 8 : 6) + 2 * count;
+}
+
+/*
+ * 68020 cache case times (MC68020 User's Manual section 8): operand
+ * fetch by mode, then a cost per operation that, unlike the 68000, does
+ * not grow with the shift count or a long size on the 32-bit bus.
+ */
+static unsigned ea020(unsigned mode, unsigned reg)
+{
+	static const uint8_t modes[7] = { 0, 0, 3, 4, 3, 3, 4 };
+	static const uint8_t other[5] = { 3, 3, 3, 4, 0 };
+
+	if (mode < 7)
+		return modes[mode];
+	return reg < 5 ? other[reg] : 0;
+}
+
+/* Store to a MOVE destination, or write back a read-modify-write */
+static unsigned store020(unsigned mode, unsigned reg)
+{
+	static const uint8_t modes[7] = { 0, 0, 3, 4, 3, 4, 6 };
+
+	if (mode < 7)
+		return modes[mode];
+	return reg == 0 ? 4 : 6;
+}
+
+static unsigned rmw020(unsigned mode, unsigned reg, unsigned dreg_time)
+{
+	return mode == 0 ? dreg_time : 2 + ea020(mode, reg) + store020(mode, reg);
+}
+
+static unsigned op_cycles_020(uint16_t op)
+{
+	unsigned mode = (op >> 3) & 7;
+	unsigned reg = op & 7;
+	unsigned size = (op >> 6) & 3;
+	unsigned opmode = (op >> 6) & 7;
+
+	switch (op >> 12) {
+	case 0x0:
+		if (op & 0x0100) {
+			if (mode == 1)				/* MOVEP */
+				return (op & 0x0040) ? 20 : 12;
+			return size == 0 ? 4 + ea020(mode, reg) : rmw020(mode, reg, 6);
+		}
+		if ((op & 0x0f00) == 0x0800)			/* bit ops #n */
+			return size == 0 ? 4 + ea020(mode, reg) : rmw020(mode, reg, 6);
+		if (mode == 7 && reg == 4)			/* to CCR/SR */
+			return 12;
+		if ((op & 0x0f00) == 0x0c00)			/* CMPI */
+			return 2 + ea020(mode, reg);
+		return rmw020(mode, reg, 2);
+	case 0x1:
+	case 0x2:
+	case 0x3:
+		return 2 + ea020(mode, reg) + store020((op >> 6) & 7, (op >> 9) & 7);
+	case 0x4:
+		switch (op) {
+		case 0x4afc: return 20;				/* ILLEGAL */
+		case 0x4e70: return 518;			/* RESET */
+		case 0x4e71: return 2;				/* NOP */
+		case 0x4e72: return 8;				/* STOP */
+		case 0x4e73: return 20;				/* RTE */
+		case 0x4e74: return 10;				/* RTD */
+		case 0x4e75: return 10;				/* RTS */
+		case 0x4e76: return 4;				/* TRAPV */
+		case 0x4e77: return 14;				/* RTR */
+		case 0x4e7a:
+		case 0x4e7b: return 6;				/* MOVEC */
+		}
+		switch (op & 0xfff8) {
+		case 0x4808: return 7;				/* LINK.L */
+		case 0x4e50: return 5;				/* LINK */
+		case 0x4e58: return 6;				/* UNLK */
+		case 0x4e60:
+		case 0x4e68: return 2;				/* MOVE USP */
+		case 0x4840: return 4;				/* SWAP */
+		case 0x4848: return 20;				/* BKPT */
+		case 0x4880: case 0x48c0: case 0x49c0: return 4;	/* EXT, EXTB */
+		}
+		if ((op & 0xfff0) == 0x4e40)			/* TRAP */
+			return 20;
+		switch (op & 0xff80) {
+		case 0x4c00: return 43 + ea020(mode, reg);		/* MULS.L/MULU.L */
+		case 0x4c40: return 84 + ea020(mode, reg);		/* DIVS.L/DIVU.L */
+		}
+		switch (op & 0xffc0) {
+		case 0x4e80: return 5 + ea020(mode, reg);	/* JSR */
+		case 0x4ec0: return 2 + ea020(mode, reg);	/* JMP */
+		case 0x4840: return 5 + ea020(mode, reg);	/* PEA */
+		case 0x40c0:					/* MOVE from SR */
+		case 0x42c0:					/* MOVE from CCR */
+			return 4 + store020(mode, reg);
+		case 0x44c0:					/* MOVE to CCR */
+		case 0x46c0:					/* MOVE to SR */
+			return 8 + ea020(mode, reg);
+		case 0x4800: return rmw020(mode, reg, 6);	/* NBCD */
+		case 0x4ac0: return rmw020(mode, reg, 4);	/* TAS */
+		}
+		if ((op & 0xf1c0) == 0x41c0)			/* LEA */
+			return 2 + ea020(mode, reg);
+		if ((op & 0xf140) == 0x4100)			/* CHK */
+			return 8 + ea020(mode, reg);
+		if ((op & 0xfb80) == 0x4880)			/* MOVEM */
+			return ((op & 0x0400) ? 8 + 4 * MOVEM_REGS : 4 + 3 * MOVEM_REGS) +
+				ea020(mode, reg);
+		if (size != 3 && (op & 0xf900) == 0x4000)	/* NEGX, CLR, NEG, NOT */
+			return rmw020(mode, reg, 2);
+		if (size != 3 && (op & 0xff00) == 0x4a00)	/* TST */
+			return 2 + ea020(mode, reg);
+		return 20;
+	case 0x5:
+		if (size == 3) {
+			if (mode == 1)				/* DBcc */
+				return 6;
+			return mode == 0 ? 4 : 6 + store020(mode, reg);	/* Scc */
+		}
+		return mode < 2 ? 2 : rmw020(mode, reg, 2);	/* ADDQ, SUBQ */
+	case 0x6:
+		return ((op >> 8) & 0xf) == 1 ? 7 : 6;		/* BSR, Bcc */
+	case 0x7:
+		return 2;					/* MOVEQ */
+	case 0x8:
+	case 0xc:
+		if (opmode == 3)				/* DIVU.W, MULU.W */
+			return ((op >> 12) == 0xc ? 27 : 44) + ea020(mode, reg);
+		if (opmode == 7)				/* DIVS.W, MULS.W */
+			return ((op >> 12) == 0xc ? 27 : 56) + ea020(mode, reg);
+		if ((op & 0x01f0) == 0x0100)			/* SBCD, ABCD */
+			return (op & 0x0008) ? 16 : 4;
+		if ((op & 0x01f0) == 0x0140 || (op & 0x01f8) == 0x0188)	/* PACK, UNPK, EXG */
+			return 2;
+		/* fall through */
+	case 0x9:
+	case 0xb:
+	case 0xd:
+		if (opmode == 3 || opmode == 7)			/* ADDA, SUBA, CMPA */
+			return 2 + ea020(mode, reg);
+		if (opmode >= 4 && mode < 2 && (op >> 12) != 0xb && (op >> 12) != 0xc &&
+		    (op >> 12) != 0x8)				/* ADDX, SUBX */
+			return mode == 1 ? 10 : 2;
+		if ((op >> 12) == 0xb && opmode >= 4 && mode == 1)	/* CMPM */
+			return 8;
+		if (opmode < 4 || ((op >> 12) == 0xb && mode == 0))
+			return 2 + ea020(mode, reg);
+		return 2 + ea020(mode, reg) + store020(mode, reg);
+	case 0xe:
+		if ((op & 0x08c0) == 0x08c0)			/* bit field */
+			return mode == 0 ? 8 : 16 + ea020(mode, reg);
+		if (size == 3)					/* memory, by one */
+			return 5 + ea020(mode, reg) + store020(mode, reg);
+		if ((op & 0x0018) == 0x0010)			/* ROXL, ROXR */
+			return 12;
+		return 4;
+	}
+	return 20;					/* line A, line F */
+}
+
+static unsigned op_cycles(uint16_t op)
+{
+	unsigned mode = (op >> 3) & 7;
+	unsigned reg = op & 7;
+
+	switch (op >> 12) {
+	case 0x0: return line0(op, mode, reg);
+	case 0x1:
+	case 0x2:
+	case 0x3: return line_move(op, mode, reg);
+	case 0x4: return line4(op, mode, reg);
+	case 0x5: return line5(op, mode, reg);
+	case 0x6: return ((op >> 8) & 0xf) == 1 ? 18 : 10;	/* BSR, Bcc */
+	case 0x7: return 4;					/* MOVEQ */
+	case 0x8:
+	case 0xc: return line8c(op, mode, reg);
+	case 0x9:
+	case 0xd: return line9d(op, mode, reg);
+	case 0xb: return lineb(op, mode, reg);
+	case 0xe: return linee(op, mode, reg);
+	}
+	return exception_time();			/* line A, line F */
+}
+
+void cyclesInit(unsigned model, bool timing, unsigned mhz)
+{
+	unsigned op;
+
+	m68010 = model >= 68010;
+	m68020 = model >= 68020;
+	for (op = 0; op < 65536; op++) {
+		unsigned c = m68020 ? op_cycles_020(op) : op_cycles(op);
+
+		cycle_table[op] = c > 255 ? 255 : c;
+	}
+	cycle_timing = timing;
+	cpu_mhz = mhz ? mhz : 1;
+	if (timing)
+		printf("Cycle timing: %u at %uMHz\n", model, cpu_mhz);
+}
+
+void utimerInit(const char *mode)
+{
+	if (cycle_timing || (mode && !strcmp(mode, "emulated")))
+		utimer_mode = UTIMER_EMULATED;
+	else if (mode && !strcmp(mode, "host"))
+		utimer_mode = UTIMER_HOST;
+	else {
+		if (mode && *mode && strcmp(mode, "sync"))
+			printf("Unknown utimer mode %s, using sync\n", mode);
+		utimer_mode = UTIMER_SYNC;
+	}
+	utimerSync();
+}
+
+void utimerSync(void)
+{
+	struct timespec ts;
+
+	if (utimer_mode != UTIMER_SYNC)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	utimer_base = ts.tv_sec * UINT64_C(1000000) + ts.tv_nsec / UINT64_C(1000);
+	utimer_base_cycles = cpu_cycles;
+}
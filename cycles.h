@@ -0,0 +1,77 @@
+/*
+ * cycles.h
+ *
+ * Emulated CPU clock.  Every instruction adds its 68000, 68010 or 68020
+ * cost (see --cpu) from a per-opcode table to cpu_cycles, in all builds.  With
+ * --cycle_timing the scheduler, the pacer's 50Hz tick and the 1MHz user
+ * timer follow cpu_cycles at --cpu_mhz instead of counting instructions
+ * or reading the host clock, so timings taken in the emulator stand for
+ * the real hardware.
+ *
+ * Without it the 1MHz user timer follows --utimer: by default the host
+ * clock is read once per chunk and cpu_cycles advance it in between, so
+ * polling the counter costs no clock read.
+ *
+ * Costs are the Motorola tables for the opcode and its addressing modes.
+ * What depends on operand values or the register list (MULU/MULS, DIVU/
+ * DIVS, shift counts in a register, MOVEM) is charged a typical value,
+ * branches are charged as taken and the 68010 loop mode is not modelled.
+ */
+
+#ifndef CYCLES_H
+#define CYCLES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "machine_local.h"
+
+/* Cycles for one 68000 instruction when --cycle_timing converts the
+   instruction counts peripherals schedule in */
+#define CYCLES_PER_INSN	8
+
+extern MACHINE_LOCAL uint64_t cpu_cycles;
+/* Instructions retired, counted only while insn_counting (see perfctr.h) */
+extern MACHINE_LOCAL uint64_t cpu_insns;
+extern bool insn_counting;
+extern uint8_t cycle_table[65536];
+extern bool cycle_timing;
+extern unsigned cpu_mhz;
+
+enum {
+	UTIMER_SYNC,
+	UTIMER_HOST,
+	UTIMER_EMULATED
+};
+
+extern int utimer_mode;
+extern MACHINE_LOCAL uint64_t utimer_base, utimer_base_cycles, utimer_last;
+
+/* Build the table for the CPU model (68000, 68010 or 68020), and set the
+   timing mode and clock */
+void cyclesInit(unsigned model, bool timing, unsigned mhz);
+
+static inline uint64_t cyclesToUs(uint64_t cycles)
+{
+	return cycles / cpu_mhz;
+}
+
+/* Sets the user timer mode from --utimer */
+void utimerInit(const char *mode);
+
+/* Rebases the synced user timer on the host clock, once per chunk */
+void utimerSync(void);
+
+/* Microseconds from the last host clock read plus the emulated time since,
+   never going back when the host clock is behind */
+static inline uint64_t utimerSynced(void)
+{
+	uint64_t t = utimer_base + cyclesToUs(cpu_cycles - utimer_base_cycles);
+
+	if (t < utimer_last)
+		t = utimer_last;
+	utimer_last = t;
+	return t;
+}
+
+#endif /* CYCLES_H */
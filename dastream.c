@@ -0,0 +1,175 @@
+/*
+ * dastream.c
+ *
+ * DA streaming registers, see dastream.h.  POSITION is worked out from
+ * pacerEmuNs() when it is read and on a poll every DASTREAM_POLL_INSNS,
+ * which is when HALF and WRAP are raised; it keeps its own place rather
+ * than the callback's, so interrupts come in emulated time.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "QL68000.h"
+#include "QL_sound.h"
+#include "dastream.h"
+#include "pacer.h"
+#include "savestate.h"
+#include "scheduler.h"
+
+#define DASTREAM_POLL_INSNS	256
+#define NS_PER_SECOND		UINT64_C(1000000000)
+
+static bool ds_enabled;
+static bool ds_running;			/* da_start as last seen */
+static uint16_t ds_ctrl;
+static uint16_t ds_status;
+static uint16_t ds_write;
+static uint64_t ds_played;		/* samples since init */
+static uint64_t ds_frac;		/* towards the next, in ns * DA_CLOCK_FREQ */
+static uint64_t ds_ns;			/* pacerEmuNs() of ds_played */
+static sched_event ds_event;
+
+static void ds_raise(void)
+{
+	if (ds_status & ds_ctrl & (DASTREAM_STATUS_HALF | DASTREAM_STATUS_WRAP))
+		RaiseInterrupt(DASTREAM_IRQ_LEVEL);
+}
+
+/* Play the samples due since ds_ns at the current rate */
+static void ds_advance(void)
+{
+	uint64_t now = pacerEmuNs();
+	uint64_t elapsed = now > ds_ns ? now - ds_ns : 0;
+	uint64_t per = (uint64_t)da_period * NS_PER_SECOND;
+	uint64_t n = 0, old = ds_played, filled;
+
+	ds_ns = now;
+	if (!ds_running || !da_period)
+		return;
+
+	// A second at a time, so ns * DA_CLOCK_FREQ stays in range
+	while (elapsed) {
+		uint64_t chunk = elapsed < NS_PER_SECOND ? elapsed : NS_PER_SECOND;
+		uint64_t acc = ds_frac + chunk * DA_CLOCK_FREQ;
+
+		n += acc / per;
+		ds_frac = acc % per;
+		elapsed -= chunk;
+	}
+	if (!n)
+		return;
+
+	ds_played += n;
+	filled = (ds_write + DA_SAMPLES - old % DA_SAMPLES) % DA_SAMPLES;
+	if (n >= filled)
+		ds_status |= DASTREAM_STATUS_UNDERRUN;
+	if ((old + DA_SAMPLES / 2) / DA_SAMPLES != (ds_played + DA_SAMPLES / 2) / DA_SAMPLES)
+		ds_status |= DASTREAM_STATUS_HALF;
+	if (old / DA_SAMPLES != ds_played / DA_SAMPLES)
+		ds_status |= DASTREAM_STATUS_WRAP;
+	ds_raise();
+}
+
+static void ds_poll(void *arg)
+{
+	(void)arg;
+	ds_advance();
+}
+
+void dastream_init(int enable)
+{
+	ds_enabled = enable;
+	ds_running = false;
+	ds_ctrl = ds_status = ds_write = 0;
+	ds_played = ds_frac = 0;
+	ds_ns = 0;
+	schedInit(&ds_event, "dastream", ds_poll, NULL);
+	if (enable)
+		schedEvery(&ds_event, DASTREAM_POLL_INSNS);
+}
+
+uint16_t dastream_read(unsigned reg)
+{
+	if (!ds_enabled || reg >= _DASTREAM_SIZE)
+		return 0;
+
+	ds_advance();
+	switch (reg) {
+	case DASTREAM_REG_ID:
+		return DASTREAM_ID;
+	case DASTREAM_REG_CTRL:
+		return ds_status | (ds_running ? DASTREAM_STATUS_RUNNING : 0);
+	case DASTREAM_REG_POSITION:
+		return ds_played % DA_SAMPLES;
+	case DASTREAM_REG_WRITE:
+		return ds_write;
+	case DASTREAM_REG_FREE:
+		return (ds_played + 2 * DA_SAMPLES - 1 - ds_write) % DA_SAMPLES;
+	}
+	return 0;
+}
+
+void dastream_write(unsigned reg, uint16_t d)
+{
+	if (!ds_enabled || reg >= _DASTREAM_SIZE)
+		return;
+
+	switch (reg) {
+	case DASTREAM_REG_CTRL:
+		ds_advance();
+		if (d & DASTREAM_CTRL_ACK) {
+			ds_status = 0;
+			ClearInterrupt(DASTREAM_IRQ_LEVEL);
+		}
+		ds_ctrl = d & (DASTREAM_CTRL_HALF | DASTREAM_CTRL_WRAP);
+		ds_raise();
+		break;
+	case DASTREAM_REG_WRITE:
+		ds_advance();
+		ds_write = d % DA_SAMPLES;
+		break;
+	}
+}
+
+void dastream_sync(void)
+{
+	if (ds_enabled)
+		ds_advance();
+}
+
+void dastream_changed(void)
+{
+	bool start = da_start && da_period;
+
+	if (!ds_enabled)
+		return;
+	// Output picks up where the DA is, so the halves line up with it
+	if (start && !ds_running)
+		daResync(ds_played % DA_SAMPLES);
+	ds_running = start;
+}
+
+void dastream_save_state(ss_buf *b)
+{
+	ssPut16(b, ds_ctrl);
+	ssPut16(b, ds_status);
+	ssPut16(b, ds_write);
+	ssPut16(b, ds_running);
+	ssPut64(b, ds_played);
+	ssPut64(b, ds_frac);
+	ssPut64(b, ds_ns);
+}
+
+int dastream_load_state(ss_buf *b)
+{
+	ds_ctrl = ssGet16(b);
+	ds_status = ssGet16(b);
+	ds_write = ssGet16(b);
+	ds_running = ssGet16(b);
+	ds_played = ssGet64(b);
+	ds_frac = ssGet64(b);
+	ds_ns = ssGet64(b);
+	// The poll comes back with the scheduler's events
+	return b->error ? -1 : 0;
+}
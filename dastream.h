@@ -0,0 +1,77 @@
+/*
+ * dastream.h
+ *
+ * Emulator-only DA streaming registers (--dastream), so guest PCM
+ * streaming can be interrupt driven instead of polling the host's view
+ * of da_address through _DA_CONTROL.  DA memory is treated as a ring of
+ * two halves: POSITION is the sample the DA is at in emulated time,
+ * moving one sample at a time at the _DA_PERIOD rate while _DA_CONTROL
+ * has it started, and HALF and WRAP are set as it crosses into the
+ * second and first half.  With CTRL_HALF or CTRL_WRAP they raise
+ * DASTREAM_IRQ_LEVEL until acknowledged, so the guest refills the half
+ * just played.
+ *
+ * The guest can also keep its own place in WRITE, the next sample it
+ * will fill; FREE is then how many it can write before reaching
+ * POSITION, and UNDERRUN is set when POSITION catches up with WRITE.
+ * The host's output is moved to POSITION when the DA starts.  ID reads
+ * 0 when disabled.
+ *
+ * All registers are 16 bits, big endian:
+ *   +0x00 ID          'DS' (0x4453) when enabled
+ *   +0x02 CTRL        write: bit 0 interrupt on HALF, bit 1 interrupt on
+ *                     WRAP, bit 15 clear HALF, WRAP and UNDERRUN
+ *         STATUS      read: bit 0 HALF, bit 1 WRAP, bit 2 UNDERRUN,
+ *                     bit 3 the DA is running
+ *   +0x04 POSITION    sample index in DA memory, read only
+ *   +0x06 WRITE       sample index
+ *   +0x08 FREE        samples from WRITE up to POSITION, read only
+ */
+
+#ifndef DASTREAM_H
+#define DASTREAM_H
+
+#include <stdint.h>
+
+#ifndef _DASTREAM_BASE
+#define _DASTREAM_BASE		0x8f00a0
+#endif
+#define _DASTREAM_SIZE		0x10
+
+#define DASTREAM_ID		0x4453
+#define DASTREAM_IRQ_LEVEL	5
+
+#define DASTREAM_CTRL_HALF	0x0001
+#define DASTREAM_CTRL_WRAP	0x0002
+#define DASTREAM_CTRL_ACK	0x8000
+#define DASTREAM_STATUS_HALF	0x0001
+#define DASTREAM_STATUS_WRAP	0x0002
+#define DASTREAM_STATUS_UNDERRUN 0x0004
+#define DASTREAM_STATUS_RUNNING	0x0008
+
+#define DASTREAM_REG_ID		0x00
+#define DASTREAM_REG_CTRL	0x02
+#define DASTREAM_REG_POSITION	0x04
+#define DASTREAM_REG_WRITE	0x06
+#define DASTREAM_REG_FREE	0x08
+
+struct ss_buf;
+
+void dastream_init(int enable);
+
+/* Word access to the register at offset reg */
+uint16_t dastream_read(unsigned reg);
+void dastream_write(unsigned reg, uint16_t d);
+
+/* Before _DA_CONTROL or _DA_PERIOD change, to bring POSITION up to now
+   at the old rate */
+void dastream_sync(void);
+
+/* After they have: the DA started or its rate changed */
+void dastream_changed(void);
+
+/* Save state: the registers and the position */
+void dastream_save_state(struct ss_buf *b);
+int dastream_load_state(struct ss_buf *b);
+
+#endif /* DASTREAM_H */
@@ -0,0 +1,86 @@
+/*
+ * decode_cache.c
+ *
+ * Pre-decoded instruction cache for the 68K dispatch loop.
+ */
+
+#include <string.h>
+
+#include "QL68000.h"
+#include "coverage.h"
+#include "decode_cache.h"
+#include "forkserver.h"
+#include "fuse.h"
+#include "gdbstub.h"
+#include "hle.h"
+#ifdef NEXTP8
+#include "savestate.h"
+#endif
+
+MACHINE_LOCAL dcache_entry dcache[DCACHE_SIZE];
+
+void dcache_fill(dcache_entry *e, uw32 addr)
+{
+	uw16 c = (uw16)RW((Ptr)memBase + addr);
+
+	e->addr = addr;
+	e->code = c;
+	e->ea_mode = (c >> 3) & 7;
+	e->ea_reg = c & 7;
+	e->reg = (c >> 9) & 7;
+	e->handler = fuse_select(addr, c);
+	if (unlikely(coverage_bits))
+		coverageMark(addr);
+	// No fused pair may run over the fork server's trap either
+	if (unlikely(addr == fork_pc))
+		e->handler = forkServerBreak;
+	else if (unlikely(fork_pc - addr <= 4))
+		e->handler = QLUX_HANDLER(c);
+#ifdef NEXTP8
+	// Likewise the boot snapshot's
+	if (unlikely(addr == boot_snapshot_pc))
+		e->handler = savestateBreak;
+	else if (unlikely(boot_snapshot_pc - addr <= 4) && addr != fork_pc)
+		e->handler = QLUX_HANDLER(c);
+#endif
+	// HLE entry points the same way
+	if (unlikely(hle_count)) {
+		if (hleAt(addr))
+			e->handler = hleCall;
+		else if (hleAt(addr + 2) || hleAt(addr + 4))
+			e->handler = QLUX_HANDLER(c);
+	}
+	// And gdb's breakpoints, which win over all of them
+	if (unlikely(gdb_breaks)) {
+		if (gdbBreakAt(addr))
+			e->handler = gdbBreak;
+		else if (gdbBreakAt(addr + 2) || gdbBreakAt(addr + 4))
+			e->handler = QLUX_HANDLER(c);
+	}
+#ifdef JIT
+	e->hits = 0;
+	e->block = NULL;
+	if (unlikely(jit_cache_page[(addr & ADDR_MASK) >> JIT_PAGE_SHIFT]))
+		jit_cache_fill(e);
+#endif
+}
+
+void dcache_flush(void)
+{
+	memset(dcache, 0xff, sizeof(dcache));
+#ifdef JIT
+	jit_flush();
+#endif
+}
+
+void dcache_invalidate_range(uw32 addr, uw32 len)
+{
+	uw32 a;
+
+	if (len >= (DCACHE_SIZE << 1)) {
+		dcache_flush();
+		return;
+	}
+	for (a = addr & ~1u; a < addr + len; a += 2)
+		dcache_store(a);
+}
@@ -0,0 +1,77 @@
+/*
+ * decode_cache.h
+ *
+ * Pre-decoded instruction cache for the 68K dispatch loop.
+ *
+ * Each entry caches the decoded form of the instruction at one guest PC:
+ * the opcode word, its handler and the EA/register fields the
+ * handlers would otherwise extract again.  The cache is direct mapped on
+ * (addr >> 1) and tagged with the full guest address, so a lookup is one
+ * compare.  Stores to guest memory drop the entry covering the written
+ * word; anything that rewrites code or the dispatch table behind the
+ * normal write path must call dcache_invalidate_range()/dcache_flush().
+ */
+
+#ifndef DECODE_CACHE_H
+#define DECODE_CACHE_H
+
+#include "QL68000.h"
+
+#ifdef JIT
+#include "jit.h"
+#endif
+
+#define DCACHE_BITS	14
+#define DCACHE_SIZE	(1 << DCACHE_BITS)
+#define DCACHE_MASK	(DCACHE_SIZE - 1)
+#define DCACHE_EMPTY	0xffffffffu
+
+typedef struct dcache_entry {
+	uw32 addr;		/* guest address of the opcode, DCACHE_EMPTY if unused */
+	uw16 code;		/* opcode word */
+	uw8 ea_mode;		/* source/destination EA mode (bits 5-3) */
+	uw8 ea_reg;		/* EA register (bits 2-0) */
+	uw8 reg;		/* register field (bits 11-9) */
+#ifdef JIT
+	uw16 hits;		/* executions, for hot block detection */
+#endif
+	void (*handler)(void);	/* QLUX_HANDLER(code) at fill time, or fused (fuse.h) */
+#ifdef JIT
+	struct jit_block *block; /* translated block starting here */
+#endif
+} dcache_entry;
+
+extern MACHINE_LOCAL dcache_entry dcache[DCACHE_SIZE];
+
+void dcache_fill(dcache_entry *e, uw32 addr);
+void dcache_flush(void);
+void dcache_invalidate_range(uw32 addr, uw32 len);
+
+static inline dcache_entry *dcache_lookup(uw32 addr)
+{
+	dcache_entry *e = &dcache[(addr >> 1) & DCACHE_MASK];
+
+	if (unlikely(e->addr != addr))
+		dcache_fill(e, addr);
+	return e;
+}
+
+static inline void dcache_invalidate(uw32 addr)
+{
+	dcache_entry *e = &dcache[(addr >> 1) & DCACHE_MASK];
+
+	if (e->addr == (addr & ~1u))
+		e->addr = DCACHE_EMPTY;
+}
+
+/* Called for every store to guest RAM */
+static inline void dcache_store(uw32 addr)
+{
+	dcache_invalidate(addr);
+#ifdef JIT
+	if (unlikely(jit_code_page[(addr & ADDR_MASK) >> JIT_PAGE_SHIFT]))
+		jit_invalidate(addr);
+#endif
+}
+
+#endif /* DECODE_CACHE_H */
@@ -51,6 +51,7 @@ struct NAME_PARS {
 	char *name;
 	int pcount;
 	struct PARENTRY *pars;
+	struct name_cache *cache; /* last decode_name() result */
 };
 
 struct DRV {
@@ -25,9 +25,9 @@ extern int ESP8266_WiFiConnect(ESP8266_t *esp, const char *ssid, const char *pas
 extern void ESP8266_WiFiDisconnect(ESP8266_t *esp);
 extern int ESP8266_WiFiScan(ESP8266_t *esp, ScanResult *results, int max_results);
 extern int ESP8266_GetConnectedAPInfo(ESP8266_t *esp, char *bssid, uint8_t *channel, int8_t *rssi);
-extern int ESP8266_SocketConnect(ESP8266_t *esp, const char *remote_ip, uint16_t remote_port, Connection_Type type);
+extern int ESP8266_SocketConnect(ESP8266_t *esp, const char *remote_ip, uint16_t remote_port, Connection_Type type,
+                                 uint16_t local_port, uint8_t udp_mode);
 extern int ESP8266_SocketClose(ESP8266_t *esp, uint8_t link_id);
-extern int ESP8266_SocketSend(ESP8266_t *esp, uint8_t link_id, const uint8_t *data, uint16_t len);
 
 /* Virtual AP database access - we need this to query connected AP info */
 #define MAX_VIRTUAL_APS 10
@@ -71,23 +71,28 @@ static CommandEntry command_table[] = {
     { "CIPSTAMAC", AT_CIPSTAMAC_CUR_Handler },
     // Phase 3: TCP/IP commands
     { "CIPMUX", AT_CIPMUX_Handler },
+    { "CIPMODE", AT_CIPMODE_Handler },
     { "CIPSTART", AT_CIPSTART_Handler },
     { "CIPSEND", AT_CIPSEND_Handler },
     { "CIPCLOSE", AT_CIPCLOSE_Handler },
     { "CIPSTATUS", AT_CIPSTATUS_Handler },
     { "CIPSERVER", AT_CIPSERVER_Handler },
     { "CIPDOMAIN", AT_CIPDOMAIN_Handler },
+    { "CIPDINFO", AT_CIPDINFO_Handler },
     { "CIPSSLSIZE", AT_CIPSSLSIZE_Handler },
     { NULL, NULL }
 };
 
 /* ========== Parser State ========== */
 
+#define AT_MAX_PARAMS 16
+
 typedef struct {
     char command_name[64];      // e.g., "CWMODE_CUR"
     char command_type;          // '?'=query, '='=set, '\0'=execute, 'T'=test
-    char *params[16];           // Parsed parameter strings
+    char *params[AT_MAX_PARAMS]; // Point into line
     int param_count;
+    char line[256];             // Copy of the command, tokenised in place
 } ParsedCommand;
 
 /* ========== Helper Functions ========== */
@@ -95,19 +100,26 @@ typedef struct {
 static int ESP8266_ParseCommand(const char *line, ParsedCommand *parsed) {
     if (!line || !parsed) return -1;
 
-    memset(parsed, 0, sizeof(*parsed));
+    parsed->command_name[0] = '\0';
     parsed->command_type = '\0';
+    parsed->param_count = 0;
 
     // Skip "AT" prefix
     if (line[0] != 'A' || line[1] != 'T') {
         return -1;
     }
 
-    const char *p = &line[2];
+    size_t line_len = strlen(line);
+    if (line_len >= sizeof(parsed->line)) {
+        line_len = sizeof(parsed->line) - 1;
+    }
+    memcpy(parsed->line, line, line_len);
+    parsed->line[line_len] = '\0';
+
+    char *p = &parsed->line[2];
 
     // Handle bare "AT" command
     if (*p == '\0' || *p == '\r' || *p == '\n') {
-        strcpy(parsed->command_name, "");
         return 0;
     }
 
@@ -121,7 +133,7 @@ static int ESP8266_ParseCommand(const char *line, ParsedCommand *parsed) {
     char *cmd = parsed->command_name;
     int cmd_len = 0;
     while (*p && (size_t)cmd_len < sizeof(parsed->command_name) - 1) {
-        if (isalnum(*p) || *p == '_') {
+        if (isalnum((unsigned char)*p) || *p == '_') {
             *cmd++ = *p++;
             cmd_len++;
         } else {
@@ -145,59 +157,47 @@ static int ESP8266_ParseCommand(const char *line, ParsedCommand *parsed) {
             p++;
         } else {
             parsed->command_type = '=';  // Set
-            // Parse parameters
-            while (*p && parsed->param_count < 16) {
+            // Parse parameters; each is terminated in place, never ahead
+            // of the text still to be read
+            while (*p && parsed->param_count < AT_MAX_PARAMS) {
                 // Skip whitespace
-                while (*p && isspace(*p) && *p != '\r' && *p != '\n') p++;
+                while (*p && isspace((unsigned char)*p) && *p != '\r' && *p != '\n') p++;
 
                 if (*p == '\r' || *p == '\n' || *p == '\0') break;
 
-                // Handle quoted strings
+                char next;
                 if (*p == '"') {
-                    p++;
-                    char param_buf[256];
-                    int plen = 0;
+                    // Quoted string, unescaped over its opening quote
+                    char *out = p++;
+                    parsed->params[parsed->param_count++] = out;
 
-                    while (*p && *p != '"' && (size_t)plen < sizeof(param_buf) - 1) {
+                    while (*p && *p != '"') {
                         if (*p == '\\' && *(p + 1)) {
                             // Handle escape sequences
                             p++;
-                            param_buf[plen++] = *p++;
-                        } else {
-                            param_buf[plen++] = *p++;
                         }
+                        *out++ = *p++;
                     }
 
                     if (*p == '"') p++;
-
-                    param_buf[plen] = '\0';
-                    parsed->params[parsed->param_count] = malloc(plen + 1);
-                    if (parsed->params[parsed->param_count]) {
-                        strcpy(parsed->params[parsed->param_count], param_buf);
-                        parsed->param_count++;
-                    }
+                    next = *p;
+                    *out = '\0';
                 } else {
                     // Unquoted parameter (number, etc)
-                    char param_buf[256];
-                    int plen = 0;
+                    char *start = p;
 
-                    while (*p && *p != ',' && !isspace(*p) && (size_t)plen < sizeof(param_buf) - 1) {
-                        param_buf[plen++] = *p++;
-                    }
+                    while (*p && *p != ',' && !isspace((unsigned char)*p)) p++;
 
-                    if (plen > 0) {
-                        param_buf[plen] = '\0';
-                        parsed->params[parsed->param_count] = malloc(plen + 1);
-                        if (parsed->params[parsed->param_count]) {
-                            strcpy(parsed->params[parsed->param_count], param_buf);
-                            parsed->param_count++;
-                        }
+                    next = *p;
+                    if (p > start) {
+                        *p = '\0';
+                        parsed->params[parsed->param_count++] = start;
                     }
                 }
 
                 // Skip to next parameter
-                while (*p && *p != ',' && !isspace(*p) && *p != '\r' && *p != '\n') p++;
-                if (*p == ',') p++;
+                while (next && next != ',' && !isspace((unsigned char)next)) next = *++p;
+                if (next) p++;
             }
         }
     } else {
@@ -205,7 +205,7 @@ static int ESP8266_ParseCommand(const char *line, ParsedCommand *parsed) {
     }
 
     // Skip any trailing whitespace/CRLF
-    while (*p && (isspace(*p) || *p == '\r' || *p == '\n')) p++;
+    while (*p && (isspace((unsigned char)*p) || *p == '\r' || *p == '\n')) p++;
 
     // Command must end cleanly
     if (*p != '\0') {
@@ -215,23 +215,24 @@ static int ESP8266_ParseCommand(const char *line, ParsedCommand *parsed) {
     return 0;
 }
 
-static void ESP8266_FreeParseResult(ParsedCommand *parsed) {
-    for (int i = 0; i < parsed->param_count; i++) {
-        if (parsed->params[i]) {
-            free(parsed->params[i]);
-            parsed->params[i] = NULL;
-        }
-    }
-    parsed->param_count = 0;
+/* command_table sorted by name, for a binary search per line */
+static CommandEntry sorted_commands[sizeof(command_table) / sizeof(command_table[0])];
+static size_t sorted_command_count = 0;
+
+static int ESP8266_CompareCommands(const void *a, const void *b) {
+    return strcmp(((const CommandEntry *)a)->command, ((const CommandEntry *)b)->command);
 }
 
 static ATCommandHandler ESP8266_FindHandler(const char *cmd_name) {
-    for (int i = 0; command_table[i].command != NULL; i++) {
-        if (strcmp(command_table[i].command, cmd_name) == 0) {
-            return command_table[i].handler;
-        }
+    CommandEntry key = { cmd_name, NULL };
+    const CommandEntry *found;
+
+    if (!sorted_command_count) {
+        ESP8266_ATCommandsInit();
     }
-    return NULL;
+    found = bsearch(&key, sorted_commands, sorted_command_count,
+                    sizeof(sorted_commands[0]), ESP8266_CompareCommands);
+    return found ? found->handler : NULL;
 }
 
 /* ========== Core Parser Functions ========== */
@@ -242,36 +243,8 @@ void ESP8266_ATProcessByte(ESP8266_t *esp, uint8_t byte) {
     ESP8266_Internal *state = &esp->state;
 
     // Check if we're in CIPSEND data collection mode
-    if (state->send_mode) {
-        // Collect data bytes
-        if (state->send_bytes_collected < state->send_bytes_expected) {
-            state->send_buffer[state->send_bytes_collected++] = byte;
-
-            // Check if we've collected all bytes
-            if (state->send_bytes_collected >= state->send_bytes_expected) {
-                // Send the data
-                int result = ESP8266_SocketSend(esp, state->send_link_id,
-                                               state->send_buffer,
-                                               state->send_bytes_expected);
-
-                if (result >= 0) {
-                    // Success
-                    if (state->mux_enabled) {
-                        ESP8266_ATResponse(esp, "SEND OK");
-                    } else {
-                        ESP8266_ATResponse(esp, "SEND OK");
-                    }
-                } else {
-                    // Error
-                    ESP8266_ATResponse(esp, "SEND FAIL");
-                }
-
-                // Exit send mode
-                state->send_mode = 0;
-                state->send_bytes_collected = 0;
-                state->send_bytes_expected = 0;
-            }
-        }
+    if (state->send_mode != ESP8266_SEND_IDLE) {
+        ESP8266_ATProcessBytes(esp, &byte, 1);
         return;
     }
 
@@ -279,11 +252,7 @@ void ESP8266_ATProcessByte(ESP8266_t *esp, uint8_t byte) {
     // Echo if enabled
     if (state->echo_enabled && byte >= 32 && byte < 127) {
         // Queue echo character to TX
-        uint16_t next_head = (state->tx_head + 1) % ESP8266_TX_BUFFER_SIZE;
-        if (next_head != state->tx_tail) {
-            state->tx_buffer[state->tx_head] = byte;
-            state->tx_head = next_head;
-        }
+        ESP8266_TXQueue(esp, &byte, 1);
     }
 
     // Handle backspace
@@ -326,6 +295,50 @@ void ESP8266_ATProcessByte(ESP8266_t *esp, uint8_t byte) {
     }
 }
 
+void ESP8266_ATProcessBytes(ESP8266_t *esp, const uint8_t *data, size_t len) {
+    if (!esp) return;
+
+    ESP8266_Internal *state = &esp->state;
+
+    while (len > 0) {
+        if (state->send_mode == ESP8266_SEND_LENGTH) {
+            // Collect payload bytes straight into the link's send ring
+            size_t n = state->send_bytes_expected - state->send_bytes_collected;
+            if (n > len) n = len;
+            if (ESP8266_SocketQueue(esp, state->send_link_id, data, n) < 0) {
+                state->send_failed = 1;
+            }
+            state->send_bytes_collected += n;
+            data += n;
+            len -= n;
+
+            // Check if we've collected all bytes
+            if (state->send_bytes_collected >= state->send_bytes_expected) {
+                ESP8266_SendComplete(esp);
+            }
+        } else if (state->send_mode == ESP8266_SEND_STREAM) {
+            // Transparent transmission: everything goes out, in packets
+            ESP8266_SendRing *ring = &state->send_rings[state->send_link_id];
+            size_t room = ESP8266_SEND_RING_SIZE - (ring->head - ring->tail);
+            size_t n = len < room ? len : room;
+
+            ESP8266_SocketQueue(esp, state->send_link_id, data, n);
+            state->stream_last_ms = ESP8266_GetTimestampMS();
+            if (ring->head - ring->tail >= ESP8266_STREAM_PACKET_SIZE &&
+                ESP8266_SocketFlush(esp, state->send_link_id) < 0) {
+                ring->tail = ring->head;
+            }
+            if (n < len) {
+                fprintf(stderr, "[ESP] transparent send overflow, dropping %zu bytes\n", len - n);
+            }
+            return;
+        } else {
+            ESP8266_ATProcessByte(esp, *data++);
+            len--;
+        }
+    }
+}
+
 void ESP8266_ATDispatch(ESP8266_t *esp, const char *cmd_str) {
     if (!esp || !cmd_str) return;
 
@@ -333,8 +346,11 @@ void ESP8266_ATDispatch(ESP8266_t *esp, const char *cmd_str) {
     char response[ESP8266_RESPONSE_BUFFER_SIZE];
     int result = -1;
 
+    esp->state.stats.commands++;
+
     // Parse the command
-    printf("[ESP] Received command: %s\n", cmd_str);
+    if (esp->state.verbose >= 2)
+        printf("[ESP] Received command: %s\n", cmd_str);
     if (ESP8266_ParseCommand(cmd_str, &parsed) < 0) {
         ESP8266_ATError(esp);
         return;
@@ -346,15 +362,15 @@ void ESP8266_ATDispatch(ESP8266_t *esp, const char *cmd_str) {
         return;
     }
 
-    printf("[ESP] Parsed command: %s, type: %c, params: %d\n",
-           parsed.command_name, parsed.command_type, parsed.param_count);
+    if (esp->state.verbose >= 2)
+        printf("[ESP] Parsed command: %s, type: %c, params: %d\n",
+               parsed.command_name, parsed.command_type, parsed.param_count);
 
     // Find and invoke handler
     ATCommandHandler handler = ESP8266_FindHandler(parsed.command_name);
 
     if (!handler) {
         ESP8266_ATError(esp);
-        ESP8266_FreeParseResult(&parsed);
         return;
     }
 
@@ -375,8 +391,6 @@ void ESP8266_ATDispatch(ESP8266_t *esp, const char *cmd_str) {
         // Handler failed
         ESP8266_ATError(esp);
     }
-
-    ESP8266_FreeParseResult(&parsed);
 }
 
 /* ========== Handler Implementations (Phase 1) ========== */
@@ -820,12 +834,15 @@ int AT_CIPMUX_Handler(ESP8266_t *esp, const char *command_name, const char **par
         if (mode < 0 || mode > 1) return -1;
 
         // Cannot change mode if any connections are active
-        for (int i = 0; i < ESP8266_MAX_CONNECTIONS; i++) {
+        for (int i = 0; i < state->link_count; i++) {
             if (state->connections[i].active) {
                 return -1;  // ERROR: connections active
             }
         }
 
+        // Transparent transmission needs a single connection
+        if (mode == 1 && state->transparent_mode) return -1;
+
         state->mux_enabled = (uint8_t)mode;
         response[0] = '\0';
         return 0;
@@ -834,10 +851,39 @@ int AT_CIPMUX_Handler(ESP8266_t *esp, const char *command_name, const char **par
     return -1;
 }
 
+/**
+ * AT+CIPMODE - Transfer mode
+ * Query:   AT+CIPMODE?
+ * Set:     AT+CIPMODE=<mode> (0=normal, 1=transparent, needs CIPMUX=0)
+ */
+int AT_CIPMODE_Handler(ESP8266_t *esp, const char *command_name, const char **params, int param_count,
+                       char *response, size_t max_len) {
+    if (!esp || !response) return -1;
+    (void)command_name;
+
+    ESP8266_Internal *state = &esp->state;
+
+    if (param_count == 0) {
+        snprintf(response, max_len, "+CIPMODE:%d", state->transparent_mode);
+        return 0;
+    } else if (param_count == 1) {
+        long mode = ESP8266_ParseInt(params[0]);
+        if (mode < 0 || mode > 1) return -1;
+        if (mode == 1 && state->mux_enabled) return -1;
+
+        state->transparent_mode = (uint8_t)mode;
+        response[0] = '\0';
+        return 0;
+    }
+
+    return -1;
+}
+
 /**
  * AT+CIPSTART - Start TCP/UDP connection
- * Format: AT+CIPSTART=<type>,<remote_ip>,<remote_port>[,<local_port>]
- * Or with mux: AT+CIPSTART=<link_id>,<type>,<remote_ip>,<remote_port>[,<local_port>]
+ * Format: AT+CIPSTART=<type>,<remote_ip>,<remote_port>[,<local_port>[,<udp_mode>]]
+ * Or with mux: AT+CIPSTART=<link_id>,<type>,<remote_ip>,<remote_port>[,<local_port>[,<udp_mode>]]
+ * local_port and udp_mode are for UDP only
  */
 int AT_CIPSTART_Handler(ESP8266_t *esp, const char *command_name, const char **params, int param_count,
                         char *response, size_t max_len) {
@@ -852,7 +898,7 @@ int AT_CIPSTART_Handler(ESP8266_t *esp, const char *command_name, const char **p
     if (state->mux_enabled) {
         if (param_count < 4) return -1;
         link_id = ESP8266_ParseInt(params[0]);
-        if (link_id < 0 || link_id >= ESP8266_MAX_CONNECTIONS) return -1;
+        if (link_id < 0 || link_id >= state->link_count) return -1;
         param_offset = 1;
     } else {
         if (param_count < 3) return -1;
@@ -887,8 +933,20 @@ int AT_CIPSTART_Handler(ESP8266_t *esp, const char *command_name, const char **p
     long remote_port = ESP8266_ParseInt(params[param_offset + 2]);
     if (remote_port < 0 || remote_port > 65535) return -1;
 
+    // UDP local port and whether the remote follows who sends to it
+    long local_port = 0, udp_mode = 0;
+    if (type == CONNECTION_TYPE_UDP && param_count > param_offset + 3) {
+        local_port = ESP8266_ParseInt(params[param_offset + 3]);
+        if (local_port < 0 || local_port > 65535) return -1;
+        if (param_count > param_offset + 4) {
+            udp_mode = ESP8266_ParseInt(params[param_offset + 4]);
+            if (udp_mode < 0 || udp_mode > 2) return -1;
+        }
+    }
+
     // Connect
-    int result = ESP8266_SocketConnect(esp, remote_ip, (uint16_t)remote_port, type);
+    int result = ESP8266_SocketConnect(esp, remote_ip, (uint16_t)remote_port, type,
+                                       (uint16_t)local_port, (uint8_t)udp_mode);
     if (result < 0) {
         snprintf(response, max_len, "ERROR");
         return -1;
@@ -898,7 +956,7 @@ int AT_CIPSTART_Handler(ESP8266_t *esp, const char *command_name, const char **p
     // For TCP/SSL, connection is asynchronous and CONNECT message will be sent by poll loop
     if (type == CONNECTION_TYPE_UDP) {
         if (state->mux_enabled) {
-            snprintf(response, max_len, "%d,CONNECT", link_id);
+            snprintf(response, max_len, "%d,CONNECT", result);
         } else {
             snprintf(response, max_len, "CONNECT");
         }
@@ -931,15 +989,13 @@ int AT_CIPDOMAIN_Handler(ESP8266_t *esp, const char *command_name, const char **
         domain = domain_buf;
     }
 
-    // Perform DNS lookup using gethostbyname
-    struct hostent *host = gethostbyname(domain);
-    if (!host || !host->h_addr_list[0]) {
+    // Perform DNS lookup through the cache
+    struct in_addr addr;
+    if (ESP8266_Resolve(domain, &addr) < 0) {
         return -1;
     }
 
     // Convert IP address to string
-    struct in_addr addr;
-    memcpy(&addr, host->h_addr_list[0], sizeof(struct in_addr));
     const char *ip_str = inet_ntoa(addr);
     if (!ip_str) {
         return -1;
@@ -950,10 +1006,38 @@ int AT_CIPDOMAIN_Handler(ESP8266_t *esp, const char *command_name, const char **
     return 0;
 }
 
+/**
+ * AT+CIPDINFO - Show the remote address in +IPD
+ * Query: AT+CIPDINFO?
+ * Set:   AT+CIPDINFO=<mode> (0=off, 1=on)
+ */
+int AT_CIPDINFO_Handler(ESP8266_t *esp, const char *command_name, const char **params, int param_count,
+                        char *response, size_t max_len) {
+    if (!esp || !response) return -1;
+    (void)command_name;
+
+    ESP8266_Internal *state = &esp->state;
+
+    if (param_count == 0) {
+        snprintf(response, max_len, "+CIPDINFO:%d", state->dinfo_enabled);
+        return 0;
+    } else if (param_count == 1) {
+        long mode = ESP8266_ParseInt(params[0]);
+        if (mode < 0 || mode > 1) return -1;
+
+        state->dinfo_enabled = (uint8_t)mode;
+        response[0] = '\0';
+        return 0;
+    }
+
+    return -1;
+}
+
 /**
  * AT+CIPSEND - Send data on a connection
- * Format: AT+CIPSEND=<length> (single connection)
- * Or: AT+CIPSEND=<link_id>,<length> (multiple connections)
+ * Format: AT+CIPSEND=<length>[,<remote_ip>,<remote_port>] (single connection)
+ * Or: AT+CIPSEND=<link_id>,<length>[,<remote_ip>,<remote_port>] (multiple connections)
+ * The remote address is for UDP, this datagram only
  * This initiates send mode - we return ">" prompt and wait for data
  */
 int AT_CIPSEND_Handler(ESP8266_t *esp, const char *command_name, const char **params, int param_count,
@@ -964,12 +1048,26 @@ int AT_CIPSEND_Handler(ESP8266_t *esp, const char *command_name, const char **pa
     ESP8266_Internal *state = &esp->state;
     int link_id = 0;
     int length = 0;
+    int addr_param = 1;
+
+    // Transparent transmission: stream until "+++"
+    if (state->transparent_mode && param_count == 0) {
+        if (!state->connections[0].active || !state->connections[0].connected) {
+            snprintf(response, max_len, "link is not valid");
+            return -1;
+        }
+        state->send_mode = ESP8266_SEND_STREAM;
+        state->send_link_id = 0;
+        snprintf(response, max_len, ">");
+        return 0;
+    }
 
     if (state->mux_enabled) {
         if (param_count < 2) return -1;
         link_id = ESP8266_ParseInt(params[0]);
-        if (link_id < 0 || link_id >= ESP8266_MAX_CONNECTIONS) return -1;
+        if (link_id < 0 || link_id >= state->link_count) return -1;
         length = ESP8266_ParseInt(params[1]);
+        addr_param = 2;
     } else {
         if (param_count < 1) return -1;
         link_id = 0;
@@ -984,11 +1082,30 @@ int AT_CIPSEND_Handler(ESP8266_t *esp, const char *command_name, const char **pa
         return -1;
     }
 
+    // A UDP datagram can go somewhere other than the link's remote
+    state->send_to_host[0] = '\0';
+    if (param_count >= addr_param + 2) {
+        long port = ESP8266_ParseInt(params[addr_param + 1]);
+        if (state->connections[link_id].type != CONNECTION_TYPE_UDP || port <= 0 || port > 65535) {
+            return -1;
+        }
+        snprintf(state->send_to_host, sizeof(state->send_to_host), "%s", params[addr_param]);
+        state->send_to_port = (uint16_t)port;
+    }
+
+    // The link is still sending: the guest tries again after SEND OK
+    ESP8266_SendRing *ring = &state->send_rings[link_id];
+    if (ESP8266_SEND_RING_SIZE - (ring->head - ring->tail) < (uint32_t)length) {
+        ESP8266_ATResponse(esp, "busy s...");
+        return -1;
+    }
+
     // Enter data collection mode
-    state->send_mode = 1;
+    state->send_mode = ESP8266_SEND_LENGTH;
     state->send_link_id = link_id;
     state->send_bytes_expected = length;
     state->send_bytes_collected = 0;
+    state->send_failed = 0;
 
     // Send ">" prompt to indicate ready for data
     snprintf(response, max_len, ">");
@@ -1016,7 +1133,7 @@ int AT_CIPCLOSE_Handler(ESP8266_t *esp, const char *command_name, const char **p
         // Close specific connection
         if (state->mux_enabled) {
             link_id = ESP8266_ParseInt(params[0]);
-            if (link_id < 0 || link_id >= ESP8266_MAX_CONNECTIONS) return -1;
+            if (link_id < 0 || link_id >= state->link_count) return -1;
         } else {
             link_id = 0;
         }
@@ -1024,7 +1141,7 @@ int AT_CIPCLOSE_Handler(ESP8266_t *esp, const char *command_name, const char **p
         return -1;
     }
 
-    if (ESP8266_SocketClose(esp, link_id) < 0) {
+    if (ESP8266_SocketRelease(esp, link_id) < 0) {
         return -1;
     }
 
@@ -1067,7 +1184,7 @@ int AT_CIPSTATUS_Handler(ESP8266_t *esp, const char *command_name, const char **
     remaining -= written;
 
     // List active connections
-    for (int i = 0; i < ESP8266_MAX_CONNECTIONS; i++) {
+    for (int i = 0; i < state->link_count; i++) {
         Connection *conn = &state->connections[i];
         if (conn->active && remaining > 0) {
             const char *type_str;
@@ -1077,7 +1194,7 @@ int AT_CIPSTATUS_Handler(ESP8266_t *esp, const char *command_name, const char **
 
             written = snprintf(p, remaining, "+CIPSTATUS:%d,\"%s\",\"%s\",%u,%u,%d\n",
                              i, type_str, conn->remote_ip, conn->remote_port,
-                             conn->local_port, 0);  // 0 = client mode
+                             conn->local_port, conn->is_server);
             if (written > 0 && (size_t)written < remaining) {
                 p += written;
                 remaining -= written;
@@ -1120,21 +1237,13 @@ int AT_CIPSERVER_Handler(ESP8266_t *esp, const char *command_name, const char **
             return -1;
         }
 
-        // TODO: Create listening socket
-        // For now, just mark server as active
-        state->server_active = 1;
-        state->server_port = port;
-        state->server_socket = -1;  // Placeholder
+        if (ESP8266_ServerStart(esp, port) < 0) return -1;
 
         response[0] = '\0';
         return 0;
     } else {
-        // Delete server
-        if (state->server_socket >= 0) {
-            // TODO: Close listening socket
-        }
-        state->server_active = 0;
-        state->server_socket = -1;
+        // Delete server; links it accepted stay open
+        ESP8266_ServerStop(esp);
 
         response[0] = '\0';
         return 0;
@@ -1214,5 +1323,13 @@ int ESP8266_StrCmp(const char *s1, const char *s2) {
 }
 
 void ESP8266_ATCommandsInit(void) {
-    // Initialize command table if needed (could register handlers dynamically)
+    if (sorted_command_count) return;
+
+    size_t n = 0;
+    while (command_table[n].command != NULL) {
+        sorted_commands[n] = command_table[n];
+        n++;
+    }
+    qsort(sorted_commands, n, sizeof(sorted_commands[0]), ESP8266_CompareCommands);
+    sorted_command_count = n;
 }
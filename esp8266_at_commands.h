@@ -53,6 +53,12 @@ typedef int (*ATCommandHandler)(ESP8266_t *esp,
  */
 extern void ESP8266_ATProcessByte(ESP8266_t *esp, uint8_t byte);
 
+/**
+ * Process a run of characters from the UART
+ * CIPSEND payloads are copied into the link's send ring in one go
+ */
+extern void ESP8266_ATProcessBytes(ESP8266_t *esp, const uint8_t *data, size_t len);
+
 /**
  * Dispatch and execute an AT command string
  * Called internally by ATProcessByte after line is complete
@@ -234,11 +240,20 @@ extern int AT_CIPSTAMAC_CUR_Handler(ESP8266_t *esp, const char *command_name, co
 extern int AT_CIPMUX_Handler(ESP8266_t *esp, const char *command_name, const char **params, int param_count,
                              char *response, size_t max_len);
 
+/**
+ * AT+CIPMODE - Set transfer mode (0=normal, 1=transparent transmission)
+ * Query:   AT+CIPMODE?
+ * Response: +CIPMODE:<mode>
+ */
+extern int AT_CIPMODE_Handler(ESP8266_t *esp, const char *command_name, const char **params, int param_count,
+                              char *response, size_t max_len);
+
 /**
  * AT+CIPSTART - Establish TCP/UDP/SSL connection
- * Single: AT+CIPSTART=<type>,<remote_ip>,<remote_port>[,<local_port>]
- * Multi:  AT+CIPSTART=<link_id>,<type>,<remote_ip>,<remote_port>[,<local_port>]
+ * Single: AT+CIPSTART=<type>,<remote_ip>,<remote_port>[,<local_port>[,<udp_mode>]]
+ * Multi:  AT+CIPSTART=<link_id>,<type>,<remote_ip>,<remote_port>[,<local_port>[,<udp_mode>]]
  * type: "TCP", "UDP", or "SSL"
+ * udp_mode: 0 = fixed remote, 1 = remote becomes the first sender, 2 = each sender
  * Response: CONNECT or ERROR
  */
 extern int AT_CIPSTART_Handler(ESP8266_t *esp, const char *command_name, const char **params, int param_count,
@@ -252,10 +267,19 @@ extern int AT_CIPSTART_Handler(ESP8266_t *esp, const char *command_name, const c
 extern int AT_CIPDOMAIN_Handler(ESP8266_t *esp, const char *command_name, const char **params, int param_count,
                                 char *response, size_t max_len);
 
+/**
+ * AT+CIPDINFO - Remote address in +IPD
+ * Set: AT+CIPDINFO=<mode> (0=off, 1=on)
+ * Response: +IPD,[<link_id>,]<len>,<remote_ip>,<remote_port>:<data> when on
+ */
+extern int AT_CIPDINFO_Handler(ESP8266_t *esp, const char *command_name, const char **params, int param_count,
+                               char *response, size_t max_len);
+
 /**
  * AT+CIPSEND - Send data on connection
- * Single: AT+CIPSEND=<length>
- * Multi:  AT+CIPSEND=<link_id>,<length>
+ * Single: AT+CIPSEND=<length>[,<remote_ip>,<remote_port>]
+ * Multi:  AT+CIPSEND=<link_id>,<length>[,<remote_ip>,<remote_port>]
+ * The remote address is for UDP links only
  * Response: > (then wait for data)
  */
 extern int AT_CIPSEND_Handler(ESP8266_t *esp, const char *command_name, const char **params, int param_count,
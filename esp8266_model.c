@@ -17,33 +17,46 @@
 #include <unistd.h>
 #include <stdarg.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
 #include <errno.h>
-#include <poll.h>
+#include <pthread.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 
 /* Forward Declarations ========== */
 
-static uint64_t ESP8266_GetTimestampMS(void);
-static void ESP8266_TXQueueChar(ESP8266_t *esp, uint8_t byte);
 static void ESP8266_TXQueueString(ESP8266_t *esp, const char *str);
 static void ESP8266_GenerateMAC(char *mac_str);
 static VirtualAP* ESP8266_FindVirtualAP(const char *ssid);
 static int ESP8266_SetNonBlocking(int fd);
 static void ESP8266_CheckSocketData(ESP8266_t *esp);
+static void ESP8266_SendResume(ESP8266_t *esp, int link_id);
+static void ESP8266_StreamPoll(ESP8266_t *esp);
+static void ESP8266_ServerAccept(ESP8266_t *esp);
+static void ESP8266_PoolExpire(ESP8266_t *esp, int all);
+static void ESP8266_PoolClose(ESP8266_t *esp, ESP8266_PooledSocket *slot);
+static int ESP8266_PoolTake(ESP8266_t *esp, const char *host, uint16_t port,
+                            Connection_Type type, void **ssl);
+static int ESP8266_NewSession(SSL *ssl, SSL_SESSION *session);
+static void ESP8266_FreeSessionKey(void *parent, void *ptr, CRYPTO_EX_DATA *ad,
+                                   int idx, long argl, void *argp);
 int ESP8266_SocketClose(ESP8266_t *esp, uint8_t link_id);
 static SSL_CTX *ssl_ctx = NULL;
+static int tls_key_index = -1;
 
 /* ========== SSL Initialization ========== */
 
-static void ESP8266_InitSSL(void) {
+static void ESP8266_InitSSL(ESP8266_Internal *state) {
+    struct timespec t0, t1;
+
     if (ssl_ctx) return;
 
+    clock_gettime(CLOCK_MONOTONIC, &t0);
     SSL_library_init();
     SSL_load_error_strings();
     OpenSSL_add_all_algorithms();
@@ -56,6 +69,81 @@ static void ESP8266_InitSSL(void) {
 
     // Disable certificate verification for simplicity
     SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
+
+    // Sessions are cached per host:port below, not by OpenSSL
+    SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ssl_ctx, ESP8266_NewSession);
+    tls_key_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, ESP8266_FreeSessionKey);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    state->stats.ssl_init_us = (uint64_t)((t1.tv_sec - t0.tv_sec) * 1000000 +
+                                          (t1.tv_nsec - t0.tv_nsec) / 1000);
+}
+
+/* ========== TLS Session Cache ========== */
+
+/*
+ * The last session (ID or ticket) each recent endpoint gave us, so a
+ * reconnect resumes instead of running a full handshake.  New sessions
+ * can arrive on the network thread, with TLS 1.3 tickets after the
+ * handshake, hence the lock.
+ */
+#define TLS_SESSION_CACHE_SIZE 8
+
+typedef struct {
+    char key[ESP8266_MAX_DOMAIN_LEN + 8];  // host:port
+    SSL_SESSION *session;
+    uint64_t used;
+} TLSSessionEntry;
+
+static TLSSessionEntry tls_sessions[TLS_SESSION_CACHE_SIZE];
+static pthread_mutex_t tls_session_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void ESP8266_FreeSessionKey(void *parent, void *ptr, CRYPTO_EX_DATA *ad,
+                                   int idx, long argl, void *argp) {
+    (void)parent; (void)ad; (void)idx; (void)argl; (void)argp;
+    free(ptr);
+}
+
+/* Called by OpenSSL with a reference for us to keep */
+static int ESP8266_NewSession(SSL *ssl, SSL_SESSION *session) {
+    const char *key = SSL_get_ex_data(ssl, tls_key_index);
+    TLSSessionEntry *e = &tls_sessions[0];
+
+    if (!key) return 0;
+
+    pthread_mutex_lock(&tls_session_lock);
+    for (int i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+        if (!strcmp(tls_sessions[i].key, key)) {
+            e = &tls_sessions[i];
+            break;
+        }
+        if (tls_sessions[i].used < e->used) e = &tls_sessions[i];
+    }
+    if (e->session) SSL_SESSION_free(e->session);
+    snprintf(e->key, sizeof(e->key), "%s", key);
+    e->session = session;
+    e->used = ESP8266_GetTimestampMS();
+    pthread_mutex_unlock(&tls_session_lock);
+    return 1;
+}
+
+/* Tag a new SSL object with its endpoint and offer the cached session */
+static void ESP8266_ResumeSession(SSL *ssl, const char *host, uint16_t port) {
+    char *key = malloc(ESP8266_MAX_DOMAIN_LEN + 8);
+
+    if (!key) return;
+    snprintf(key, ESP8266_MAX_DOMAIN_LEN + 8, "%s:%u", host, port);
+    SSL_set_ex_data(ssl, tls_key_index, key);
+
+    pthread_mutex_lock(&tls_session_lock);
+    for (int i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+        if (tls_sessions[i].session && !strcmp(tls_sessions[i].key, key)) {
+            SSL_set_session(ssl, tls_sessions[i].session);
+            tls_sessions[i].used = ESP8266_GetTimestampMS();
+            break;
+        }
+    }
+    pthread_mutex_unlock(&tls_session_lock);
 }
 
 /* ========== Virtual AP Database ========== */
@@ -210,7 +298,7 @@ int ESP8266_GetConnectedAPInfo(ESP8266_t *esp, char *bssid, uint8_t *channel, in
 
 /* ========== Utility Functions ========== */
 
-static uint64_t ESP8266_GetTimestampMS(void) {
+uint64_t ESP8266_GetTimestampMS(void) {
     struct timespec ts;
     clock_gettime(CLOCK_MONOTONIC, &ts);
     return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
@@ -234,26 +322,34 @@ static VirtualAP* ESP8266_FindVirtualAP(const char *ssid) {
 
 /* ========== TX Queue Functions ========== */
 
-static void ESP8266_TXQueueChar(ESP8266_t *esp, uint8_t byte) {
+#if (ESP8266_TX_BUFFER_SIZE & (ESP8266_TX_BUFFER_SIZE - 1)) != 0
+#error ESP8266_TX_BUFFER_SIZE must be a power of two
+#endif
+
+#define TX_MASK (ESP8266_TX_BUFFER_SIZE - 1)
+
+int ESP8266_TXQueue(ESP8266_t *esp, const uint8_t *data, size_t len) {
     ESP8266_Internal *state = &esp->state;
-    uint16_t next_head = (state->tx_head + 1) % ESP8266_TX_BUFFER_SIZE;
+    uint32_t off = state->tx_head & TX_MASK;
+    size_t first = ESP8266_TX_BUFFER_SIZE - off;
 
     // Drop if queue is full
-    if (next_head == state->tx_tail) {
-        printf("[ESP] TX buffer overflow, dropping byte\n");
-        abort();
-        return;
+    if (len > ESP8266_TX_BUFFER_SIZE - (state->tx_head - state->tx_tail)) {
+        fprintf(stderr, "[ESP] TX buffer overflow, dropping %zu bytes\n", len);
+        return -1;
     }
 
-    state->tx_buffer[state->tx_head] = byte;
-    state->tx_head = next_head;
+    if (first > len) first = len;
+    memcpy(state->tx_buffer + off, data, first);
+    memcpy(state->tx_buffer, data + first, len - first);
+    state->tx_head += (uint32_t)len;
+    return 0;
 }
 
 static void ESP8266_TXQueueString(ESP8266_t *esp, const char *str) {
-    printf("[ESP] Queuing response: %s\n", str);
-    for (const char *p = str; *p; p++) {
-        ESP8266_TXQueueChar(esp, (uint8_t)*p);
-    }
+    if (esp->state.verbose >= 2)
+        printf("[ESP] Queuing response: %s\n", str);
+    ESP8266_TXQueue(esp, (const uint8_t *)str, strlen(str));
 }
 
 /* ========== Public API Implementation ========== */
@@ -303,16 +399,16 @@ ESP8266_t* ESP8266_Create(void) {
     esp->state.ap_encryption = ENCRYPTION_WPA2_PSK;
 
     // Initialize connections
+    esp->state.link_count = ESP8266_DEFAULT_LINKS;
     for (int i = 0; i < ESP8266_MAX_CONNECTIONS; i++) {
         esp->state.connections[i].active = 0;
         esp->state.connections[i].socket_fd = -1;
         esp->state.connections[i].ssl = NULL;
-        esp->state.connections[i].rx_buffer = NULL;
-        esp->state.connections[i].rx_buffer_len = 0;
     }
+    esp->state.server_socket = -1;
 
     // Initialize CIPSEND state
-    esp->state.send_mode = 0;
+    esp->state.send_mode = ESP8266_SEND_IDLE;
     esp->state.send_link_id = 0;
     esp->state.send_bytes_expected = 0;
     esp->state.send_bytes_collected = 0;
@@ -323,20 +419,25 @@ ESP8266_t* ESP8266_Create(void) {
     // Initialize AT command system
     ESP8266_ATCommandsInit();
 
+    if (ESP8266_NetStart(esp) < 0) {
+        free(esp);
+        return NULL;
+    }
+
     return esp;
 }
 
 void ESP8266_Destroy(ESP8266_t *esp) {
     if (!esp) return;
 
+    ESP8266_NetStop(esp);
+    ESP8266_PoolExpire(esp, 1);
+
     // Close any open sockets
     for (int i = 0; i < ESP8266_MAX_CONNECTIONS; i++) {
         if (esp->state.connections[i].active && esp->state.connections[i].socket_fd >= 0) {
             close(esp->state.connections[i].socket_fd);
         }
-        if (esp->state.connections[i].rx_buffer) {
-            free(esp->state.connections[i].rx_buffer);
-        }
     }
 
     // Close server socket if active
@@ -364,14 +465,19 @@ void ESP8266_Reset(ESP8266_t *esp) {
     memset(esp->state.station_ssid, 0, sizeof(esp->state.station_ssid));
     memset(esp->state.station_password, 0, sizeof(esp->state.station_password));
 
-    // Close all connections
+    // Close all connections and the server
+    ESP8266_ServerStop(esp);
+    ESP8266_NetLock(esp);
     for (int i = 0; i < ESP8266_MAX_CONNECTIONS; i++) {
         if (esp->state.connections[i].active && esp->state.connections[i].socket_fd >= 0) {
+            ESP8266_NetUnwatch(esp, i);
             close(esp->state.connections[i].socket_fd);
         }
         esp->state.connections[i].active = 0;
         esp->state.connections[i].socket_fd = -1;
     }
+    ESP8266_NetUnlock(esp);
+    ESP8266_PoolExpire(esp, 1);
 
     // Notify of reset
     ESP8266_ATUnsolicited(esp, "ready");
@@ -395,6 +501,11 @@ void ESP8266_ProcessUARTByte(ESP8266_t *esp, uint8_t byte) {
     ESP8266_ATProcessByte(esp, byte);
 }
 
+void ESP8266_ProcessUARTBytes(ESP8266_t *esp, const uint8_t *data, size_t len) {
+    if (!esp) return;
+    ESP8266_ATProcessBytes(esp, data, len);
+}
+
 int ESP8266_GetUARTByte(ESP8266_t *esp) {
     if (!esp) return -1;
 
@@ -403,33 +514,92 @@ int ESP8266_GetUARTByte(ESP8266_t *esp) {
         return -1;  // No data
     }
 
-    uint8_t byte = state->tx_buffer[state->tx_tail];
-    state->tx_tail = (state->tx_tail + 1) % ESP8266_TX_BUFFER_SIZE;
+    return state->tx_buffer[state->tx_tail++ & TX_MASK];
+}
 
-    /* // Debug: print received byte
-    if (byte >= 32 && byte < 127) {
-        fprintf(stdout, "[ESP RX] '%c' (0x%02x)\n", byte, byte);
-    } else if (byte == '\r') {
-        fprintf(stdout, "[ESP RX] '\\r' (0x%02x)\n", byte);
-    } else if (byte == '\n') {
-        fprintf(stdout, "[ESP RX] '\\n' (0x%02x)\n", byte);
+size_t ESP8266_GetUARTBytes(ESP8266_t *esp, uint8_t *buf, size_t max) {
+    if (!esp) return 0;
+
+    ESP8266_Internal *state = &esp->state;
+    uint32_t off = state->tx_tail & TX_MASK;
+    size_t len = state->tx_head - state->tx_tail;
+    size_t first = ESP8266_TX_BUFFER_SIZE - off;
+
+    if (len > max) len = max;
+    if (first > len) first = len;
+    memcpy(buf, state->tx_buffer + off, first);
+    memcpy(buf + first, state->tx_buffer, len - first);
+    state->tx_tail += (uint32_t)len;
+    return len;
+}
+
+/* Report a link the peer or a failed connect has closed, and free it */
+static void ESP8266_LinkClosed(ESP8266_t *esp, int link_id) {
+    ESP8266_SocketClose(esp, link_id);
+    if (esp->state.mux_enabled) {
+        ESP8266_ATUnsolicited(esp, "%d,CLOSED", link_id);
     } else {
-        fprintf(stdout, "[ESP RX] 0x%02x\n", byte);
+        ESP8266_ATUnsolicited(esp, "CLOSED");
+    }
+}
+
+/*
+ * Under net_lock: take a connecting link a step further now the network
+ * thread has seen it become ready.  Returns 1 when it has connected, 0
+ * while still in progress and -1 if it failed.
+ */
+static int ESP8266_ConnectStep(ESP8266_t *esp, int link_id) {
+    Connection *conn = &esp->state.connections[link_id];
+
+    // Check for TCP connection error
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(conn->socket_fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+        return -1;
     }
-    fflush(stdout);*/
 
-    return (int)byte;
+    if (conn->type == CONNECTION_TYPE_TCP) {
+        // Plain TCP - we're done
+        conn->connected = 1;
+        ESP8266_NetArm(esp, link_id, ESP8266_NET_IN);
+        return 1;
+    }
+
+    if (!conn->ssl) {
+        // SSL object missing - shouldn't happen
+        return -1;
+    }
+
+    // SSL connection - try handshake
+    SSL *ssl = (SSL*)conn->ssl;
+    int ret = SSL_connect(ssl);
+    if (ret <= 0) {
+        int ssl_err = SSL_get_error(ssl, ret);
+        if (ssl_err == SSL_ERROR_WANT_READ) {
+            ESP8266_NetArm(esp, link_id, ESP8266_NET_IN);
+        } else if (ssl_err == SSL_ERROR_WANT_WRITE) {
+            ESP8266_NetArm(esp, link_id, ESP8266_NET_OUT);
+        } else {
+            return -1;  // SSL handshake failed
+        }
+        return 0;
+    }
+
+    // SSL handshake completed successfully
+    conn->connected = 1;
+    ESP8266_NetArm(esp, link_id, ESP8266_NET_IN);
+    return 1;
 }
 
 void ESP8266_Poll(ESP8266_t *esp) {
     if (!esp) return;
 
     ESP8266_Internal *state = &esp->state;
-    uint64_t now = ESP8266_GetTimestampMS();
 
     // Handle WiFi connection state machine
     if (state->wifi_state == WIFI_STATE_CONNECTING) {
         // Simulate 2 second connection delay
+        uint64_t now = ESP8266_GetTimestampMS();
         if (now - state->wifi_state_change_time > 2000) {
             state->wifi_state = WIFI_STATE_CONNECTED;
             ESP8266_ATUnsolicited(esp, "WiFi CONNECTED");
@@ -437,6 +607,7 @@ void ESP8266_Poll(ESP8266_t *esp) {
         }
     } else if (state->wifi_state == WIFI_STATE_CONNECTED) {
         // Simulate 1 second DHCP delay
+        uint64_t now = ESP8266_GetTimestampMS();
         if (now - state->wifi_state_change_time > 1000) {
             state->wifi_state = WIFI_STATE_GOT_IP;
             state->station_has_ip = 1;
@@ -444,97 +615,69 @@ void ESP8266_Poll(ESP8266_t *esp) {
         }
     }
 
-    // Handle TCP and SSL connection establishment
-    for (int i = 0; i < ESP8266_MAX_CONNECTIONS; i++) {
-        Connection *conn = &state->connections[i];
+    if (state->send_mode == ESP8266_SEND_STREAM) {
+        ESP8266_StreamPoll(esp);
+    }
+    if (state->pool_count) {
+        ESP8266_PoolExpire(esp, 0);
+    }
 
-        if (!conn->active || conn->connected) continue;
-        if (conn->type != CONNECTION_TYPE_TCP && conn->type != CONNECTION_TYPE_SSL) continue;
+    // Nothing from the network thread since last time
+    if (!atomic_exchange(&state->net_pending, 0)) return;
 
-        // Check if underlying TCP socket is connected
-        struct pollfd pfd;
-        pfd.fd = conn->socket_fd;
-        pfd.events = POLLOUT;
-        pfd.revents = 0;
+    // Handle TCP and SSL connection establishment, and sends the socket
+    // had no room for
+    for (int i = 0; i < state->link_count; i++) {
+        Connection *conn = &state->connections[i];
 
-        int ret = poll(&pfd, 1, 0);
-        if (ret <= 0 || !(pfd.revents & POLLOUT)) {
-            continue;  // Not ready yet
-        }
+        if (!conn->active) continue;
+        if (!atomic_exchange(&state->net_links[i].attention, 0)) continue;
 
-        // Check for TCP connection error
-        int error = 0;
-        socklen_t len = sizeof(error);
-        if (getsockopt(conn->socket_fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
-            // TCP connection failed
-            ESP8266_SocketClose(esp, i);
-            char msg[64];
-            snprintf(msg, sizeof(msg), "%d,CLOSED", i);
-            ESP8266_ATUnsolicited(esp, msg);
+        if (conn->connected) {
+            ESP8266_SendResume(esp, i);
             continue;
         }
 
-        // TCP socket is connected successfully
-        if (conn->type == CONNECTION_TYPE_TCP) {
-            // Plain TCP - we're done
-            conn->connected = 1;
-            char msg[64];
-            if (state->mux_enabled) {
-                snprintf(msg, sizeof(msg), "%d,CONNECT", i);
-            } else {
-                snprintf(msg, sizeof(msg), "CONNECT");
-            }
-            ESP8266_ATUnsolicited(esp, msg);
-        } else if (conn->type == CONNECTION_TYPE_SSL) {
-            if (!conn->ssl) {
-                // SSL object missing - shouldn't happen
-                ESP8266_SocketClose(esp, i);
-                char msg[64];
-                snprintf(msg, sizeof(msg), "%d,CLOSED", i);
-                ESP8266_ATUnsolicited(esp, msg);
-                continue;
-            }
+        ESP8266_NetLock(esp);
+        int ret = ESP8266_ConnectStep(esp, i);
+        ESP8266_NetUnlock(esp);
 
-            // SSL connection - try handshake
-            SSL *ssl = (SSL*)conn->ssl;
-            ret = SSL_connect(ssl);
-            if (ret <= 0) {
-                int ssl_err = SSL_get_error(ssl, ret);
-                if (ssl_err != SSL_ERROR_WANT_READ && ssl_err != SSL_ERROR_WANT_WRITE) {
-                    // SSL handshake failed
-                    ESP8266_SocketClose(esp, i);
-                    char msg[64];
-                    snprintf(msg, sizeof(msg), "%d,CLOSED", i);
-                    ESP8266_ATUnsolicited(esp, msg);
-                }
-                // Otherwise, handshake in progress (will retry next poll)
+        if (ret < 0) {
+            ESP8266_LinkClosed(esp, i);
+        } else if (ret > 0) {
+            if (state->mux_enabled) {
+                ESP8266_ATUnsolicited(esp, "%d,CONNECT", i);
             } else {
-                // SSL handshake completed successfully
-                conn->connected = 1;
-                char msg[64];
-                if (state->mux_enabled) {
-                    snprintf(msg, sizeof(msg), "%d,CONNECT", i);
-                } else {
-                    snprintf(msg, sizeof(msg), "CONNECT");
-                }
-                ESP8266_ATUnsolicited(esp, msg);
+                ESP8266_ATUnsolicited(esp, "CONNECT");
             }
         }
     }
 
-    // Check all sockets for incoming data
+    // Take connections the server socket has waiting
+    if (atomic_exchange(&state->net_accept, 0)) {
+        ESP8266_ServerAccept(esp);
+    }
+
+    // Pass on data the network thread has received
     ESP8266_CheckSocketData(esp);
 }
 
 size_t ESP8266_TXDataAvailable(ESP8266_t *esp) {
     if (!esp) return 0;
 
+    return esp->state.tx_head - esp->state.tx_tail;
+}
+
+int ESP8266_UARTReady(ESP8266_t *esp) {
+    if (!esp) return 0;
+
     ESP8266_Internal *state = &esp->state;
-    if (state->tx_head >= state->tx_tail) {
-        return state->tx_head - state->tx_tail;
-    } else {
-        return ESP8266_TX_BUFFER_SIZE - (state->tx_tail - state->tx_head);
+    ESP8266_SendRing *ring = &state->send_rings[state->send_link_id];
+
+    if (state->send_mode != ESP8266_SEND_IDLE) {
+        return ring->head - ring->tail < ESP8266_SEND_RING_SIZE;
     }
+    return ESP8266_TX_BUFFER_SIZE - ESP8266_TXDataAvailable(esp) >= ESP8266_RESPONSE_BUFFER_SIZE;
 }
 
 void ESP8266_SetBaudRate(ESP8266_t *esp, uint32_t baud) {
@@ -552,6 +695,26 @@ void ESP8266_SetEcho(ESP8266_t *esp, uint8_t enabled) {
     esp->state.echo_enabled = enabled ? 1 : 0;
 }
 
+void ESP8266_SetKeepAlive(ESP8266_t *esp, unsigned seconds) {
+    if (!esp) return;
+    esp->state.keepalive_ms = seconds * 1000;
+}
+
+void ESP8266_SetLinkCount(ESP8266_t *esp, unsigned links) {
+    if (!esp || !links) return;
+    if (links > ESP8266_MAX_CONNECTIONS) links = ESP8266_MAX_CONNECTIONS;
+    esp->state.link_count = (uint8_t)links;
+}
+
+void ESP8266_SetVerbose(ESP8266_t *esp, int level) {
+    if (!esp) return;
+    esp->state.verbose = level;
+}
+
+const ESP8266_Stats* ESP8266_GetStats(ESP8266_t *esp) {
+    return &esp->state.stats;
+}
+
 uint8_t ESP8266_GetEcho(ESP8266_t *esp) {
     if (!esp) return 0;
     return esp->state.echo_enabled;
@@ -583,7 +746,7 @@ const char* ESP8266_GetAPIP(ESP8266_t *esp) {
 }
 
 Connection* ESP8266_GetConnection(ESP8266_t *esp, uint8_t link_id) {
-    if (!esp || link_id >= ESP8266_MAX_CONNECTIONS) return NULL;
+    if (!esp || link_id >= esp->state.link_count) return NULL;
     if (!esp->state.connections[link_id].active) return NULL;
     return &esp->state.connections[link_id];
 }
@@ -605,8 +768,8 @@ void ESP8266_DebugPrint(ESP8266_t *esp) {
     printf("AP IP: %s\n", state->ap_ip);
     printf("AP SSID: %s\n", state->ap_ssid[0] ? state->ap_ssid : "(not configured)");
     printf("AP MAC: %s\n", state->ap_mac);
-    printf("Connections: %d active\n", ESP8266_MAX_CONNECTIONS);
-    for (int i = 0; i < ESP8266_MAX_CONNECTIONS; i++) {
+    printf("Connections: %d links\n", esp->state.link_count);
+    for (int i = 0; i < esp->state.link_count; i++) {
         if (state->connections[i].active) {
             printf("  [%d] %s %s:%u (FD=%d)\n", i,
                    state->connections[i].type == CONNECTION_TYPE_TCP ? "TCP" :
@@ -652,70 +815,85 @@ static int ESP8266_SetNonBlocking(int fd) {
     return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
+/* The lowest link not in use, or -1 */
+static int ESP8266_FreeLink(ESP8266_t *esp) {
+    for (int i = 0; i < esp->state.link_count; i++) {
+        if (!esp->state.connections[i].active) return i;
+    }
+    return -1;
+}
+
 /**
- * Create a TCP connection to remote host
+ * Create a TCP, SSL or UDP link to remote host; for UDP, local_port
+ * (0 for any) and udp_mode from CIPSTART
  * Returns link_id on success, -1 on error
  */
-int ESP8266_SocketConnect(ESP8266_t *esp, const char *remote_ip, uint16_t remote_port, Connection_Type type) {
+int ESP8266_SocketConnect(ESP8266_t *esp, const char *remote_ip, uint16_t remote_port, Connection_Type type,
+                          uint16_t local_port, uint8_t udp_mode) {
     if (!esp || !remote_ip) return -1;
 
     ESP8266_Internal *state = &esp->state;
+    struct sockaddr_in server_addr;
 
     // Find free connection slot
-    int link_id = -1;
-    for (int i = 0; i < ESP8266_MAX_CONNECTIONS; i++) {
-        if (!state->connections[i].active) {
-            link_id = i;
-            break;
-        }
-    }
+    int link_id = ESP8266_FreeLink(esp);
 
     if (link_id == -1) {
         return -1;  // No free slots
     }
 
-    // Create socket
-    int sockfd;
-    if (type == CONNECTION_TYPE_TCP || type == CONNECTION_TYPE_SSL) {
-        sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    } else {  // UDP
-        sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    }
+    // A socket kept from an earlier CIPCLOSE may still be good
+    void *pooled_ssl = NULL;
+    int sockfd = ESP8266_PoolTake(esp, remote_ip, remote_port, type, &pooled_ssl);
 
     if (sockfd < 0) {
-        return -1;
-    }
+        // Create socket
+        if (type == CONNECTION_TYPE_TCP || type == CONNECTION_TYPE_SSL) {
+            sockfd = socket(AF_INET, SOCK_STREAM, 0);
+        } else {  // UDP
+            sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+        }
 
-    // Set non-blocking
-    if (ESP8266_SetNonBlocking(sockfd) < 0) {
-        close(sockfd);
-        return -1;
-    }
+        if (sockfd < 0) {
+            return -1;
+        }
 
-    // Connect to remote host
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(remote_port);
-
-    // Try to parse IP address
-    if (inet_pton(AF_INET, remote_ip, &server_addr.sin_addr) <= 0) {
-        // Not an IP, try DNS lookup
-        struct hostent *host = gethostbyname(remote_ip);
-        if (!host) {
+        // Set non-blocking
+        if (ESP8266_SetNonBlocking(sockfd) < 0) {
             close(sockfd);
             return -1;
         }
-        memcpy(&server_addr.sin_addr, host->h_addr_list[0], host->h_length);
-    }
 
-    // For TCP/SSL, initiate connection (non-blocking, will complete later)
-    if (type == CONNECTION_TYPE_TCP || type == CONNECTION_TYPE_SSL) {
-        int ret = connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr));
-        if (ret < 0 && errno != EINPROGRESS) {
+        // Connect to remote host
+        memset(&server_addr, 0, sizeof(server_addr));
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_port = htons(remote_port);
+
+        // IP address, or a DNS lookup through the cache
+        if (ESP8266_Resolve(remote_ip, &server_addr.sin_addr) < 0) {
             close(sockfd);
             return -1;
         }
+
+        // For TCP/SSL, initiate connection (non-blocking, will complete later)
+        if (type == CONNECTION_TYPE_TCP || type == CONNECTION_TYPE_SSL) {
+            int ret = connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr));
+            if (ret < 0 && errno != EINPROGRESS) {
+                close(sockfd);
+                return -1;
+            }
+        } else if (local_port) {
+            // UDP takes datagrams from anyone at its local port
+            struct sockaddr_in local_addr;
+            memset(&local_addr, 0, sizeof(local_addr));
+            local_addr.sin_family = AF_INET;
+            local_addr.sin_port = htons(local_port);
+            local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+            if (bind(sockfd, (struct sockaddr*)&local_addr, sizeof(local_addr)) < 0) {
+                close(sockfd);
+                return -1;
+            }
+        }
     }
 
     // Setup connection structure
@@ -732,48 +910,96 @@ int ESP8266_SocketConnect(ESP8266_t *esp, const char *remote_ip, uint16_t remote
     conn->remote_port = remote_port;
     conn->local_port = 0;  // OS assigns
 
-    // For SSL connections, create SSL object
-    if (type == CONNECTION_TYPE_SSL) {
-        ESP8266_InitSSL();
+    if (type == CONNECTION_TYPE_UDP) {
+        // Sends go to the address resolved now, and CIPSTATUS shows both ends
+        struct sockaddr_in local_addr;
+        socklen_t local_len = sizeof(local_addr);
+
+        inet_ntop(AF_INET, &server_addr.sin_addr, conn->remote_ip, sizeof(conn->remote_ip));
+        if (getsockname(sockfd, (struct sockaddr*)&local_addr, &local_len) == 0) {
+            conn->local_port = ntohs(local_addr.sin_port);
+        }
+        conn->udp_mode = udp_mode;
+    }
+
+    snprintf(state->link_host[link_id], sizeof(state->link_host[link_id]), "%s", remote_ip);
+
+    // For SSL connections, create SSL object; a reused socket keeps its own
+    if (pooled_ssl) {
+        conn->ssl = pooled_ssl;
+    } else if (type == CONNECTION_TYPE_SSL) {
+        ESP8266_InitSSL(state);
         if (ssl_ctx) {
             SSL *ssl = SSL_new(ssl_ctx);
             if (ssl) {
                 SSL_set_fd(ssl, sockfd);
+                // Sends come straight from the link's send ring
+                SSL_set_mode(ssl, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                                  SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
                 // Set SNI (Server Name Indication) hostname
                 SSL_set_tlsext_host_name(ssl, remote_ip);
                 SSL_set_connect_state(ssl);
+                ESP8266_ResumeSession(ssl, remote_ip, remote_port);
                 // Non-blocking SSL_connect will happen in poll loop
                 conn->ssl = ssl;
             }
         }
     }
 
-    // Allocate RX buffer
-    conn->rx_buffer = malloc(ESP8266_RX_BUFFER_SIZE);
-    if (!conn->rx_buffer) {
+    memset(&state->send_rings[link_id], 0, sizeof(state->send_rings[link_id]));
+
+    // UDP can receive straight away, TCP/SSL wait to become writable
+    ESP8266_NetLock(esp);
+    int ret = ESP8266_NetWatch(esp, link_id,
+                               type == CONNECTION_TYPE_UDP ? ESP8266_NET_IN : ESP8266_NET_OUT);
+    ESP8266_NetUnlock(esp);
+    if (ret < 0) {
         if (conn->ssl) SSL_free((SSL*)conn->ssl);
         close(sockfd);
         memset(conn, 0, sizeof(Connection));
         return -1;
     }
-    conn->rx_buffer_len = ESP8266_RX_BUFFER_SIZE;
-    conn->rx_buffer_pos = 0;
 
     return link_id;
 }
 
+/* A link has gone: anything still to send goes with it */
+static void ESP8266_LinkReset(ESP8266_t *esp, uint8_t link_id) {
+    ESP8266_Internal *state = &esp->state;
+    ESP8266_SendRing *ring = &state->send_rings[link_id];
+
+    ring->tail = ring->head;
+    ring->ok_pending = 0;
+    ring->ssl_retry_len = 0;
+    if (state->send_mode != ESP8266_SEND_IDLE && state->send_link_id == link_id) {
+        state->send_mode = ESP8266_SEND_IDLE;
+    }
+
+    // A connection the server couldn't take can have this link
+    if (state->server_waiting) {
+        state->server_waiting = 0;
+        atomic_store(&state->net_accept, 1);
+        atomic_store(&state->net_pending, 1);
+    }
+}
+
 /**
  * Close a connection
  * Returns 0 on success, -1 on error
  */
 int ESP8266_SocketClose(ESP8266_t *esp, uint8_t link_id) {
-    if (!esp || link_id >= ESP8266_MAX_CONNECTIONS) return -1;
+    if (!esp || link_id >= esp->state.link_count) return -1;
 
     ESP8266_Internal *state = &esp->state;
     Connection *conn = &state->connections[link_id];
 
     if (!conn->active) return -1;
 
+    ESP8266_NetLock(esp);
+    if (conn->socket_fd >= 0) {
+        ESP8266_NetUnwatch(esp, link_id);
+    }
+
     if (conn->ssl) {
         SSL_shutdown((SSL*)conn->ssl);
         SSL_free((SSL*)conn->ssl);
@@ -784,23 +1010,162 @@ int ESP8266_SocketClose(ESP8266_t *esp, uint8_t link_id) {
         close(conn->socket_fd);
     }
 
-    if (conn->rx_buffer) {
-        free(conn->rx_buffer);
+    memset(conn, 0, sizeof(Connection));
+    ESP8266_NetUnlock(esp);
+
+    ESP8266_LinkReset(esp, link_id);
+    return 0;
+}
+
+int ESP8266_SocketRelease(ESP8266_t *esp, uint8_t link_id) {
+    if (!esp || link_id >= esp->state.link_count) return -1;
+
+    ESP8266_Internal *state = &esp->state;
+    Connection *conn = &state->connections[link_id];
+    ESP8266_SendRing *ring = &state->send_rings[link_id];
+
+    if (!conn->active) return -1;
+
+    // Only a quiet, healthy stream socket is worth keeping
+    if (!state->keepalive_ms || conn->type == CONNECTION_TYPE_UDP || !conn->connected ||
+        ring->head != ring->tail) {
+        return ESP8266_SocketClose(esp, link_id);
+    }
+
+    ESP8266_NetLock(esp);
+    if (ESP8266_NetPeek(esp, link_id) >= 0 || state->net_links[link_id].closed) {
+        ESP8266_NetUnlock(esp);
+        return ESP8266_SocketClose(esp, link_id);
+    }
+    ESP8266_NetUnwatch(esp, link_id);
+    ESP8266_NetUnlock(esp);
+
+    // Make room by dropping the oldest kept socket
+    ESP8266_PooledSocket *slot = &state->pool[0];
+    for (int i = 0; i < state->link_count; i++) {
+        if (!state->pool[i].active) {
+            slot = &state->pool[i];
+            break;
+        }
+        if (state->pool[i].since < slot->since) slot = &state->pool[i];
+    }
+    if (slot->active) {
+        ESP8266_PoolClose(esp, slot);
     }
 
+    slot->active = 1;
+    slot->type = conn->type;
+    slot->socket_fd = conn->socket_fd;
+    slot->ssl = conn->ssl;
+    slot->port = conn->remote_port;
+    slot->since = ESP8266_GetTimestampMS();
+    snprintf(slot->host, sizeof(slot->host), "%s", state->link_host[link_id]);
+    state->pool_count++;
+
     memset(conn, 0, sizeof(Connection));
+    ESP8266_LinkReset(esp, link_id);
     return 0;
 }
 
-/**
- * Send data on a connection
- * Returns number of bytes sent, -1 on error
+/* Close a kept socket for good */
+static void ESP8266_PoolClose(ESP8266_t *esp, ESP8266_PooledSocket *slot) {
+    if (slot->ssl) {
+        SSL_shutdown((SSL*)slot->ssl);
+        SSL_free((SSL*)slot->ssl);
+    }
+    close(slot->socket_fd);
+    memset(slot, 0, sizeof(*slot));
+    esp->state.pool_count--;
+}
+
+/* Close kept sockets past the keep-alive time, or all of them */
+static void ESP8266_PoolExpire(ESP8266_t *esp, int all) {
+    ESP8266_Internal *state = &esp->state;
+    uint64_t now = ESP8266_GetTimestampMS();
+
+    for (int i = 0; i < state->link_count; i++) {
+        ESP8266_PooledSocket *slot = &state->pool[i];
+
+        if (slot->active && (all || now - slot->since >= state->keepalive_ms)) {
+            ESP8266_PoolClose(esp, slot);
+        }
+    }
+}
+
+/*
+ * A kept socket for this endpoint, or -1.  It must have nothing to read:
+ * the peer having closed it or sent more would confuse the next user.
  */
-int ESP8266_SocketSend(ESP8266_t *esp, uint8_t link_id, const uint8_t *data, uint16_t len) {
-    if (!esp || link_id >= ESP8266_MAX_CONNECTIONS || !data) return -1;
+static int ESP8266_PoolTake(ESP8266_t *esp, const char *host, uint16_t port,
+                            Connection_Type type, void **ssl) {
+    ESP8266_Internal *state = &esp->state;
+
+    for (int i = 0; i < state->link_count; i++) {
+        ESP8266_PooledSocket *slot = &state->pool[i];
+        char c;
+
+        if (!slot->active || slot->type != type || slot->port != port || strcmp(slot->host, host)) {
+            continue;
+        }
+        if (recv(slot->socket_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0 &&
+            (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            int fd = slot->socket_fd;
+            *ssl = slot->ssl;
+            memset(slot, 0, sizeof(*slot));
+            state->pool_count--;
+            return fd;
+        }
+        ESP8266_PoolClose(esp, slot);
+    }
+    return -1;
+}
+
+#define SEND_MASK (ESP8266_SEND_RING_SIZE - 1)
+
+/* The send ring's contents as up to two iovecs; returns how many */
+static int ESP8266_SendSegments(ESP8266_SendRing *ring, struct iovec *iov) {
+    uint32_t off = ring->tail & SEND_MASK;
+    size_t len = ring->head - ring->tail;
+    size_t first = ESP8266_SEND_RING_SIZE - off;
+
+    iov[0].iov_base = ring->buf + off;
+    if (first >= len) {
+        iov[0].iov_len = len;
+        return 1;
+    }
+    iov[0].iov_len = first;
+    iov[1].iov_base = ring->buf;
+    iov[1].iov_len = len - first;
+    return 2;
+}
+
+/* Ask the network thread for attention once the socket can take more */
+static void ESP8266_WaitWritable(ESP8266_t *esp, uint8_t link_id) {
+    ESP8266_NetLock(esp);
+    ESP8266_NetArm(esp, link_id, esp->state.net_links[link_id].events | ESP8266_NET_OUT);
+    ESP8266_NetUnlock(esp);
+}
+
+int ESP8266_SocketQueue(ESP8266_t *esp, uint8_t link_id, const uint8_t *data, size_t len) {
+    ESP8266_SendRing *ring = &esp->state.send_rings[link_id];
+    uint32_t off = ring->head & SEND_MASK;
+    size_t first = ESP8266_SEND_RING_SIZE - off;
+
+    if (len > ESP8266_SEND_RING_SIZE - (ring->head - ring->tail)) return -1;
+
+    if (first > len) first = len;
+    memcpy(ring->buf + off, data, first);
+    memcpy(ring->buf, data + first, len - first);
+    ring->head += (uint32_t)len;
+    return 0;
+}
+
+int ESP8266_SocketFlush(ESP8266_t *esp, uint8_t link_id) {
+    if (!esp || link_id >= esp->state.link_count) return -1;
 
     ESP8266_Internal *state = &esp->state;
     Connection *conn = &state->connections[link_id];
+    ESP8266_SendRing *ring = &state->send_rings[link_id];
 
     if (!conn->active) return -1;
 
@@ -809,136 +1174,352 @@ int ESP8266_SocketSend(ESP8266_t *esp, uint8_t link_id, const uint8_t *data, uin
         return -1;  // Not ready yet
     }
 
-    // For UDP, we need to send to the remote address
-    if (conn->type == CONNECTION_TYPE_UDP) {
-        struct sockaddr_in addr;
-        memset(&addr, 0, sizeof(addr));
-        addr.sin_family = AF_INET;
-        addr.sin_port = htons(conn->remote_port);
-        inet_pton(AF_INET, conn->remote_ip, &addr.sin_addr);
-
-        return sendto(conn->socket_fd, data, len, 0, (struct sockaddr*)&addr, sizeof(addr));
-    } else if (conn->type == CONNECTION_TYPE_SSL && conn->ssl) {
-        // SSL - check if handshake is complete first
-        SSL *ssl = (SSL*)conn->ssl;
-        if (!SSL_is_init_finished(ssl)) {
-            // Handshake not complete yet
-            errno = EAGAIN;
-            return -1;
-        }
+    while (ring->head != ring->tail) {
+        struct iovec iov[2];
+        int iovcnt = ESP8266_SendSegments(ring, iov);
+        ssize_t sent;
+
+        if (conn->type == CONNECTION_TYPE_UDP) {
+            // For UDP, we need to send to the remote address, or the one
+            // given to this CIPSEND, all of the ring as one datagram
+            struct sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            if (state->send_to_host[0]) {
+                addr.sin_port = htons(state->send_to_port);
+                if (ESP8266_Resolve(state->send_to_host, &addr.sin_addr) < 0) {
+                    ring->tail = ring->head;
+                    return -1;
+                }
+            } else {
+                addr.sin_port = htons(conn->remote_port);
+                inet_pton(AF_INET, conn->remote_ip, &addr.sin_addr);
+            }
 
-        int ret = SSL_write(ssl, data, len);
-        if (ret <= 0) {
-            int ssl_err = SSL_get_error(ssl, ret);
-            if (ssl_err == SSL_ERROR_WANT_WRITE || ssl_err == SSL_ERROR_WANT_READ) {
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_name = &addr;
+            msg.msg_namelen = sizeof(addr);
+            msg.msg_iov = iov;
+            msg.msg_iovlen = iovcnt;
+
+            sent = sendmsg(conn->socket_fd, &msg, 0);
+            ring->tail = ring->head;
+            if (sent > 0)
+                state->stats.net_tx_bytes += sent;
+            return sent < 0 ? -1 : 1;
+        } else if (conn->type == CONNECTION_TYPE_SSL && conn->ssl) {
+            // SSL - check if handshake is complete first
+            SSL *ssl = (SSL*)conn->ssl;
+            if (!SSL_is_init_finished(ssl)) {
+                // Handshake not complete yet
                 errno = EAGAIN;
+                return -1;
+            }
+
+            // A retry must ask for at least what the last attempt did,
+            // which the first segment still covers
+            int len = ring->ssl_retry_len ? ring->ssl_retry_len : (int)iov[0].iov_len;
+
+            // The network thread may be in SSL_read on the same object
+            ESP8266_NetLock(esp);
+            int ret = SSL_write(ssl, iov[0].iov_base, len);
+            int ssl_err = ret <= 0 ? SSL_get_error(ssl, ret) : SSL_ERROR_NONE;
+            ESP8266_NetUnlock(esp);
+            if (ret <= 0) {
+                if (ssl_err == SSL_ERROR_WANT_WRITE || ssl_err == SSL_ERROR_WANT_READ) {
+                    ring->ssl_retry_len = len;
+                    ESP8266_WaitWritable(esp, link_id);
+                    return 0;
+                }
+                return -1;
+            }
+            ring->ssl_retry_len = 0;
+            sent = ret;
+        } else {
+            // TCP
+            sent = writev(conn->socket_fd, iov, iovcnt);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                    ESP8266_WaitWritable(esp, link_id);
+                    return 0;
+                }
+                return -1;
             }
-            return -1;
         }
-        return ret;
+        ring->tail += (uint32_t)sent;
+        state->stats.net_tx_bytes += sent;
+    }
+    return 1;
+}
+
+/**
+ * Send data on a connection
+ * Returns number of bytes sent or queued, -1 on error
+ */
+int ESP8266_SocketSend(ESP8266_t *esp, uint8_t link_id, const uint8_t *data, uint16_t len) {
+    if (!esp || link_id >= esp->state.link_count || !data) return -1;
+
+    if (ESP8266_SocketQueue(esp, link_id, data, len) < 0) return -1;
+    return ESP8266_SocketFlush(esp, link_id) < 0 ? -1 : len;
+}
+
+void ESP8266_SendComplete(ESP8266_t *esp) {
+    ESP8266_Internal *state = &esp->state;
+    uint8_t link_id = state->send_link_id;
+    ESP8266_SendRing *ring = &state->send_rings[link_id];
+    int failed = state->send_failed;
+
+    // Exit send mode
+    state->send_mode = ESP8266_SEND_IDLE;
+    state->send_failed = 0;
+    state->send_bytes_collected = 0;
+    state->send_bytes_expected = 0;
+
+    int result = failed ? -1 : ESP8266_SocketFlush(esp, link_id);
+    state->send_to_host[0] = '\0';
+    if (result > 0) {
+        ESP8266_ATResponse(esp, "SEND OK");
+    } else if (result == 0) {
+        // Socket busy: ESP8266_Poll reports once the ring has drained
+        ring->ok_at = ring->head;
+        ring->ok_pending = 1;
     } else {
-        // TCP
-        return send(conn->socket_fd, data, len, 0);
+        ring->tail = ring->head;
+        ESP8266_ATResponse(esp, "SEND FAIL");
+    }
+}
+
+/* ESP8266_Poll: a connected link's socket became writable again */
+static void ESP8266_SendResume(ESP8266_t *esp, int link_id) {
+    ESP8266_SendRing *ring = &esp->state.send_rings[link_id];
+    int result = ESP8266_SocketFlush(esp, link_id);
+
+    if (result < 0) {
+        ring->tail = ring->head;
+    }
+    if (ring->ok_pending && (result < 0 || (int32_t)(ring->tail - ring->ok_at) >= 0)) {
+        ring->ok_pending = 0;
+        ESP8266_ATResponse(esp, result < 0 ? "SEND FAIL" : "SEND OK");
+    }
+}
+
+/* ESP8266_Poll: pack what transparent mode has streamed in */
+static void ESP8266_StreamPoll(ESP8266_t *esp) {
+    ESP8266_Internal *state = &esp->state;
+    ESP8266_SendRing *ring = &state->send_rings[state->send_link_id];
+    uint32_t pending = ring->head - ring->tail;
+
+    if (!pending || ESP8266_GetTimestampMS() - state->stream_last_ms < ESP8266_STREAM_FLUSH_MS) {
+        return;
+    }
+
+    // "+++" on its own between pauses leaves transparent transmission
+    if (pending == 3 &&
+        ring->buf[ring->tail & SEND_MASK] == '+' &&
+        ring->buf[(ring->tail + 1) & SEND_MASK] == '+' &&
+        ring->buf[(ring->tail + 2) & SEND_MASK] == '+') {
+        ring->tail = ring->head;
+        state->send_mode = ESP8266_SEND_IDLE;
+        return;
     }
+
+    if (ESP8266_SocketFlush(esp, state->send_link_id) < 0) {
+        ring->tail = ring->head;
+    }
+}
+
+/* ========== Server ========== */
+
+int ESP8266_ServerStart(ESP8266_t *esp, uint16_t port) {
+    ESP8266_Internal *state = &esp->state;
+    struct sockaddr_in addr;
+    int one = 1;
+
+    if (state->server_active) return state->server_port == port ? 0 : -1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    // Clients on this machine reach the guest at 127.0.0.1:port
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, ESP8266_MAX_CONNECTIONS) < 0 || ESP8266_SetNonBlocking(fd) < 0) {
+        fprintf(stderr, "[ESP] server on port %u: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    state->server_socket = fd;
+    state->server_port = port;
+    state->server_active = 1;
+    state->server_waiting = 0;
+    ESP8266_NetLock(esp);
+    ESP8266_NetListen(esp, ESP8266_NET_IN);
+    ESP8266_NetUnlock(esp);
+    return 0;
+}
+
+void ESP8266_ServerStop(ESP8266_t *esp) {
+    ESP8266_Internal *state = &esp->state;
+
+    if (!state->server_active) return;
+
+    ESP8266_NetLock(esp);
+    ESP8266_NetUnlisten(esp);
+    ESP8266_NetUnlock(esp);
+    close(state->server_socket);
+    state->server_socket = -1;
+    state->server_active = 0;
+    state->server_waiting = 0;
+    atomic_store(&state->net_accept, 0);
+}
+
+/*
+ * ESP8266_Poll: accept what the server socket has into free links.  When
+ * none is free the rest wait in the listen queue, the socket unwatched,
+ * until ESP8266_LinkReset frees one.
+ */
+static void ESP8266_ServerAccept(ESP8266_t *esp) {
+    ESP8266_Internal *state = &esp->state;
+
+    if (!state->server_active) return;
+
+    for (;;) {
+        int link_id = ESP8266_FreeLink(esp);
+        if (link_id < 0) {
+            state->server_waiting = 1;
+            return;
+        }
+
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        int fd = accept(state->server_socket, (struct sockaddr *)&addr, &addr_len);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("[ESP] accept");
+            break;
+        }
+        if (ESP8266_SetNonBlocking(fd) < 0) {
+            close(fd);
+            continue;
+        }
+
+        Connection *conn = &state->connections[link_id];
+        memset(conn, 0, sizeof(Connection));
+        conn->active = 1;
+        conn->type = CONNECTION_TYPE_TCP;
+        conn->is_server = 1;
+        conn->connected = 1;
+        conn->socket_fd = fd;
+        inet_ntop(AF_INET, &addr.sin_addr, conn->remote_ip, sizeof(conn->remote_ip));
+        conn->remote_port = ntohs(addr.sin_port);
+        conn->local_port = state->server_port;
+        snprintf(state->link_host[link_id], sizeof(state->link_host[link_id]), "%s", conn->remote_ip);
+        memset(&state->send_rings[link_id], 0, sizeof(state->send_rings[link_id]));
+
+        ESP8266_NetLock(esp);
+        int ret = ESP8266_NetWatch(esp, link_id, ESP8266_NET_IN);
+        ESP8266_NetUnlock(esp);
+        if (ret < 0) {
+            close(fd);
+            memset(conn, 0, sizeof(Connection));
+            break;
+        }
+        ESP8266_ATUnsolicited(esp, "%d,CONNECT", link_id);
+    }
+
+    ESP8266_NetLock(esp);
+    ESP8266_NetListen(esp, ESP8266_NET_IN);
+    ESP8266_NetUnlock(esp);
 }
 
 /**
- * Check all active sockets for incoming data
+ * Turn data the network thread has queued into +IPD messages, straight
+ * from the link's receive ring
  * Called from ESP8266_Poll()
  */
 static void ESP8266_CheckSocketData(ESP8266_t *esp) {
     if (!esp) return;
 
     ESP8266_Internal *state = &esp->state;
+    int more = 0;
 
-    // Build poll array for all active connections
-    struct pollfd fds[ESP8266_MAX_CONNECTIONS];
-    int fd_to_link[ESP8266_MAX_CONNECTIONS];
-    int nfds = 0;
+    for (int link_id = 0; link_id < state->link_count; link_id++) {
+        Connection *conn = &state->connections[link_id];
+        struct iovec iov[2];
+        struct sockaddr_in from;
+        int len;
 
-    for (int i = 0; i < ESP8266_MAX_CONNECTIONS; i++) {
-        if (state->connections[i].active && state->connections[i].socket_fd >= 0) {
-            fds[nfds].fd = state->connections[i].socket_fd;
-            fds[nfds].events = POLLIN;
-            fds[nfds].revents = 0;
-            fd_to_link[nfds] = i;
-            nfds++;
-        }
-    }
+        if (!conn->active) continue;
 
-    if (nfds == 0) return;
+        while ((len = ESP8266_NetRecord(esp, link_id, iov, &from)) >= 0) {
+            // Leave it queued until the UART side has room for the message
+            if (ESP8266_TX_BUFFER_SIZE - ESP8266_TXDataAvailable(esp) < (size_t)len + 64) {
+                more = 1;
+                break;
+            }
 
-    // Poll with 0 timeout (non-blocking check)
-    int ret = poll(fds, nfds, 0);
-    if (ret <= 0) return;
+            if (len == 0) {
+                // Connection closed or error
+                ESP8266_LinkClosed(esp, link_id);
+                break;
+            }
 
-    // Check each socket for data
-    for (int i = 0; i < nfds; i++) {
-        if (fds[i].revents & POLLIN) {
-            int link_id = fd_to_link[i];
-            Connection *conn = &state->connections[link_id];
+            // UDP replies go back to the sender in modes 1 (once) and 2
+            if (conn->type == CONNECTION_TYPE_UDP && conn->udp_mode) {
+                inet_ntop(AF_INET, &from.sin_addr, conn->remote_ip, sizeof(conn->remote_ip));
+                conn->remote_port = ntohs(from.sin_port);
+                if (conn->udp_mode == 1) conn->udp_mode = 0;
+            }
 
-            // Try to read data into RX buffer
-            // rx_buffer is used as a temporary staging area - always read from beginning
-            if (conn->rx_buffer_len > 0) {
-                ssize_t bytes_read;
-                if (conn->type == CONNECTION_TYPE_UDP) {
-                    bytes_read = recvfrom(conn->socket_fd,
-                                        conn->rx_buffer,
-                                        conn->rx_buffer_len, 0, NULL, NULL);
-                } else if (conn->type == CONNECTION_TYPE_SSL && conn->ssl) {
-                    // SSL read
-                    bytes_read = SSL_read((SSL*)conn->ssl,
-                                        conn->rx_buffer,
-                                        conn->rx_buffer_len);
-                    if (bytes_read <= 0) {
-                        int ssl_err = SSL_get_error((SSL*)conn->ssl, bytes_read);
-                        if (ssl_err == SSL_ERROR_WANT_READ || ssl_err == SSL_ERROR_WANT_WRITE) {
-                            bytes_read = -1;
-                            errno = EAGAIN;
-                        } else {
-                            bytes_read = 0;  // Connection closed or error
-                        }
-                    }
-                } else {
-                    // TCP read
-                    bytes_read = recv(conn->socket_fd,
-                                    conn->rx_buffer,
-                                    conn->rx_buffer_len, 0);
-                }
+            // Transparent transmission passes data through bare
+            if (state->send_mode == ESP8266_SEND_STREAM && state->send_link_id == link_id) {
+                ESP8266_TXQueue(esp, iov[0].iov_base, iov[0].iov_len);
+                ESP8266_TXQueue(esp, iov[1].iov_base, iov[1].iov_len);
+                ESP8266_NetConsume(esp, link_id);
+                continue;
+            }
 
-                if (bytes_read > 0) {
-                    // Got data! Send +IPD unsolicited message
-                    // Format: \r\n+IPD,<len>:<data>\r\n (no CRLF between : and data!)
-                    char ipd_header[64];
-                    if (state->mux_enabled) {
-                        snprintf(ipd_header, sizeof(ipd_header), "\r\n+IPD,%d,%d:", link_id, (int)bytes_read);
-                    } else {
-                        snprintf(ipd_header, sizeof(ipd_header), "\r\n+IPD,%d:", (int)bytes_read);
-                    }
-                    ESP8266_TXQueueString(esp, ipd_header);
-
-                    // Queue the actual data
-                    for (ssize_t j = 0; j < bytes_read; j++) {
-                        ESP8266_TXQueueChar(esp, conn->rx_buffer[j]);
-                    }
-
-                    // Queue terminating CRLF
-                    ESP8266_TXQueueString(esp, "\r\n");
-
-                    // rx_buffer is reused on each read, no need to increment rx_buffer_pos
-                } else if (bytes_read == 0 || (bytes_read < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
-                    // Connection closed or error
-                    if (state->mux_enabled) {
-                        ESP8266_ATUnsolicited(esp, "%d,CLOSED", link_id);
-                    } else {
-                        ESP8266_ATUnsolicited(esp, "CLOSED");
-                    }
-                    ESP8266_SocketClose(esp, link_id);
+            // Got data! Send +IPD unsolicited message
+            // Format: \r\n+IPD,<len>:<data>\r\n (no CRLF between : and data!)
+            // With CIPDINFO: \r\n+IPD,<len>,<remote ip>,<remote port>:<data>
+            char ipd_header[64];
+            char dinfo[32] = "";
+            if (state->dinfo_enabled) {
+                char ip[ESP8266_MAX_IP_STR_LEN];
+                uint16_t port = conn->remote_port;
+
+                snprintf(ip, sizeof(ip), "%s", conn->remote_ip);
+                if (conn->type == CONNECTION_TYPE_UDP) {
+                    inet_ntop(AF_INET, &from.sin_addr, ip, sizeof(ip));
+                    port = ntohs(from.sin_port);
                 }
+                snprintf(dinfo, sizeof(dinfo), ",%s,%u", ip, port);
+            }
+            if (state->mux_enabled) {
+                snprintf(ipd_header, sizeof(ipd_header), "\r\n+IPD,%d,%d%s:", link_id, len, dinfo);
+            } else {
+                snprintf(ipd_header, sizeof(ipd_header), "\r\n+IPD,%d%s:", len, dinfo);
             }
+            ESP8266_TXQueueString(esp, ipd_header);
+
+            // Queue the actual data
+            ESP8266_TXQueue(esp, iov[0].iov_base, iov[0].iov_len);
+            ESP8266_TXQueue(esp, iov[1].iov_base, iov[1].iov_len);
+            ESP8266_NetConsume(esp, link_id);
+
+            // Queue terminating CRLF
+            ESP8266_TXQueueString(esp, "\r\n");
         }
     }
+
+    // Look again next poll for what didn't fit
+    if (more) atomic_store(&state->net_pending, 1);
 }
 
 /* ========== Internal Response Functions ========== */
@@ -69,11 +69,12 @@ typedef enum {
 #define ESP8266_MAX_IP_STR_LEN 16
 #define ESP8266_MAX_MAC_STR_LEN 18
 #define ESP8266_MAX_DOMAIN_LEN 256
-#define ESP8266_MAX_CONNECTIONS 5
+#define ESP8266_MAX_CONNECTIONS 32  /* links the model can be given */
+#define ESP8266_DEFAULT_LINKS 5     /* what the real module has */
 #define ESP8266_MAX_AP_RESULTS 10
 #define ESP8266_RX_BUFFER_SIZE 2048
 #define ESP8266_RESPONSE_BUFFER_SIZE (ESP8266_RX_BUFFER_SIZE + 256)
-#define ESP8266_TX_BUFFER_SIZE 65536
+#define ESP8266_TX_BUFFER_SIZE 65536  /* power of two */
 
 /* Default configuration */
 #define ESP8266_DEFAULT_BAUD_RATE 115200
@@ -136,11 +137,19 @@ typedef struct {
     char remote_ip[ESP8266_MAX_IP_STR_LEN + 1];
     uint16_t remote_port;
     uint16_t local_port;
-    uint8_t *rx_buffer;
-    uint16_t rx_buffer_len;
-    uint16_t rx_buffer_pos;
+    uint8_t udp_mode;   // UDP: 0 = fixed peer, 1 = first sender, 2 = each sender
 } Connection;
 
+/**
+ * Running totals, for the emulator's metrics
+ */
+typedef struct {
+    uint64_t commands;      // AT command lines dispatched
+    uint64_t net_tx_bytes;  // sent on sockets
+    uint64_t net_rx_bytes;  // received on sockets, by the network thread
+    uint64_t ssl_init_us;   // OpenSSL set-up, 0 until the first TLS link
+} ESP8266_Stats;
+
 /* ========== Public API ========== */
 
 /**
@@ -165,12 +174,25 @@ extern void ESP8266_Reset(ESP8266_t *esp);
  */
 extern void ESP8266_ProcessUARTByte(ESP8266_t *esp, uint8_t byte);
 
+/**
+ * Process a run of bytes received from UART
+ * Same as calling ESP8266_ProcessUARTByte for each, but CIPSEND
+ * payloads are copied in bulk
+ */
+extern void ESP8266_ProcessUARTBytes(ESP8266_t *esp, const uint8_t *data, size_t len);
+
 /**
  * Get the next byte to transmit to UART
  * Returns -1 if no data available
  */
 extern int ESP8266_GetUARTByte(ESP8266_t *esp);
 
+/**
+ * Copy up to max bytes waiting for the UART into buf
+ * Returns the number copied
+ */
+extern size_t ESP8266_GetUARTBytes(ESP8266_t *esp, uint8_t *buf, size_t max);
+
 /**
  * Poll for periodic updates (socket timeouts, connection state changes, etc)
  * Should be called regularly from the main loop
@@ -183,6 +205,13 @@ extern void ESP8266_Poll(ESP8266_t *esp);
  */
 extern size_t ESP8266_TXDataAvailable(ESP8266_t *esp);
 
+/**
+ * Whether the model can take another byte from the host now: 0 while the
+ * send being collected has no room in its link's send ring, or there is
+ * no room for a command's reply
+ */
+extern int ESP8266_UARTReady(ESP8266_t *esp);
+
 /**
  * Set the UART baud rate (stored for querying)
  * Note: Actual UART speed is handled by uart.h, this just stores the value
@@ -242,6 +271,28 @@ extern Connection* ESP8266_GetConnection(ESP8266_t *esp, uint8_t link_id);
 
 /* ========== Debugging/Info ========== */
 
+/**
+ * Hold TCP/SSL sockets closed with AT+CIPCLOSE open for this many
+ * seconds, for a CIPSTART to the same host and port (0 = off)
+ */
+extern void ESP8266_SetKeepAlive(ESP8266_t *esp, unsigned seconds);
+
+/**
+ * Number of links (1 to ESP8266_MAX_CONNECTIONS, default 5) for
+ * CIPSTART and the server; before any link is opened
+ */
+extern void ESP8266_SetLinkCount(ESP8266_t *esp, unsigned links);
+
+/**
+ * Set the log level (0-3); 2 and up logs each queued response
+ */
+extern void ESP8266_SetVerbose(ESP8266_t *esp, int level);
+
+/**
+ * Totals since the instance was created
+ */
+extern const ESP8266_Stats* ESP8266_GetStats(ESP8266_t *esp);
+
 /**
  * Print ESP8266 state to stdout (for debugging)
  */
@@ -14,15 +14,82 @@
 
 #include "esp8266_model.h"
 #include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/* ========== Network Thread ========== */
+
+/* Per-link receive rings, powers of two; they start small and double
+   while a link keeps them full.  A UDP datagram must fit the smallest */
+#define ESP8266_NET_RING_MIN 4096
+#define ESP8266_NET_RING_MAX 262144
+
+/*
+ * Socket data received by the network thread for one link, as records of
+ * a little endian u16 length then the payload; length 0 means the peer
+ * closed.  A UDP link's records have the sender's IPv4 address and port,
+ * in network order, between the two.  The network thread is the only writer of head, the emulator
+ * the only writer of tail.
+ */
+typedef struct {
+    uint8_t *ring;          // Under net_lock to replace, NULL when unwatched
+    unsigned size;
+    uint8_t datagram;       // UDP: records carry the sender's address
+    atomic_uint head;
+    atomic_uint tail;
+    atomic_int attention;   // Became ready while connecting
+    // Under net_lock
+    uint32_t gen;           // Bumped when the link is watched or dropped
+    int events;             // ESP8266_NET_IN/OUT currently armed
+    atomic_int throttled;   // Ring was full, input disarmed
+    uint8_t closed;         // Close record queued
+} ESP8266_NetLink;
+
+#define ESP8266_NET_IN  1
+#define ESP8266_NET_OUT 2
+
+/* Per-link data waiting to go out on the socket; emulator thread only */
+#define ESP8266_SEND_RING_SIZE 8192  /* power of two */
+
+typedef struct {
+    uint8_t buf[ESP8266_SEND_RING_SIZE];
+    uint32_t head, tail;        // Free running, masked on use
+    uint32_t ok_at;             // SEND OK once tail reaches this
+    uint8_t ok_pending;
+    int ssl_retry_len;          // SSL_write wants the same length again
+} ESP8266_SendRing;
+
+/* A closed link's socket kept open for reuse (esp_keepalive) */
+typedef struct {
+    uint8_t active;
+    Connection_Type type;
+    int socket_fd;
+    void *ssl;
+    char host[ESP8266_MAX_DOMAIN_LEN];
+    uint16_t port;
+    uint64_t since;
+} ESP8266_PooledSocket;
+
+/* send_mode values */
+#define ESP8266_SEND_IDLE   0
+#define ESP8266_SEND_LENGTH 1   // AT+CIPSEND=<len>: collecting len bytes
+#define ESP8266_SEND_STREAM 2   // CIPMODE=1 AT+CIPSEND: until "+++"
+
+/* Transparent mode packs what arrives within this long, or this much */
+#define ESP8266_STREAM_FLUSH_MS    20
+#define ESP8266_STREAM_PACKET_SIZE 2048
 
 /* ========== Internal State Structure ========== */
 
 typedef struct {
-    // Ring buffers for UART I/O
+    // Ring buffers for UART I/O; tx indices run free, masked on use
     uint8_t rx_buffer[ESP8266_RX_BUFFER_SIZE];
     uint8_t tx_buffer[ESP8266_TX_BUFFER_SIZE];
     uint16_t rx_head, rx_tail;
-    uint16_t tx_head, tx_tail;
+    uint32_t tx_head, tx_tail;
+
+    // Log level: 2 and up logs every response queued
+    int verbose;
 
     // AT command line assembly
     char cmd_line_buffer[256];
@@ -64,30 +131,59 @@ typedef struct {
     // DHCP
     uint8_t dhcp_enabled[2];  // [0]=SoftAP, [1]=Station
 
-    // TCP/IP connections
+    // TCP/IP connections; link_count of them in use (esp_links)
     Connection connections[ESP8266_MAX_CONNECTIONS];
+    uint8_t link_count;
     uint8_t mux_enabled;
     uint8_t transparent_mode;
+    uint8_t dinfo_enabled;      // AT+CIPDINFO: peer address in +IPD
 
-    // CIPSEND state machine
-    uint8_t send_mode;          // 0=normal, 1=collecting data
+    // CIPSEND state machine; data goes straight into the link's send ring
+    uint8_t send_mode;          // ESP8266_SEND_*
     uint8_t send_link_id;       // Which connection to send on
+    uint8_t send_failed;        // Send ring overflowed during this CIPSEND
     uint16_t send_bytes_expected; // How many bytes to collect
     uint16_t send_bytes_collected; // How many bytes collected so far
-    uint8_t send_buffer[2048];  // Buffer for data collection
+    char send_to_host[ESP8266_MAX_IP_STR_LEN + 1]; // UDP peer for this CIPSEND
+    uint16_t send_to_port;
+    uint64_t stream_last_ms;    // Last byte received while streaming
+    ESP8266_SendRing send_rings[ESP8266_MAX_CONNECTIONS];
 
-    // Server mode
+    // Server mode: the network thread sets net_accept when the listening
+    // socket is ready, and stops watching it until ESP8266_Poll is done
     int server_socket;
     uint16_t server_port;
     uint8_t server_active;
+    uint8_t server_waiting;     // A connection waits for a free link
+    uint8_t server_watched;     // Under net_lock: in the poller's set
+    int server_events;          // Under net_lock: ESP8266_NET_IN or 0
 
     // SSL configuration
     uint16_t ssl_buffer_size;  // 2048-4096, default 2048
 
+    // Host name each link was opened to, and sockets held for reuse
+    char link_host[ESP8266_MAX_CONNECTIONS][ESP8266_MAX_DOMAIN_LEN];
+    ESP8266_PooledSocket pool[ESP8266_MAX_CONNECTIONS];
+    uint8_t pool_count;
+    uint32_t keepalive_ms;     // 0 = close sockets on CIPCLOSE
+
+    ESP8266_Stats stats;
+
     // Version strings
     char at_version[64];
     char sdk_version[64];
     char build_date[32];
+
+    // Network thread; net_lock serialises socket and SSL calls with it
+    ESP8266_NetLink net_links[ESP8266_MAX_CONNECTIONS];
+    pthread_mutex_t net_lock;
+    pthread_t net_thread;
+    uint8_t net_running;
+    int net_poll_fd;        // epoll or kqueue, -1 when using poll()
+    int net_wake[2];
+    atomic_int net_pending; // Set by the network thread when it has news
+    atomic_int net_accept;  // The server socket has connections to accept
+    atomic_int net_quit;
 } ESP8266_Internal;
 
 /* ========== Public Structure Definition ========== */
@@ -103,4 +199,59 @@ void ESP8266_ATUnsolicited(ESP8266_t *esp, const char *fmt, ...);
 void ESP8266_ATError(ESP8266_t *esp);
 void ESP8266_ATOKK(ESP8266_t *esp);
 
+/* Queue bytes for the UART side; drops the lot if they don't fit */
+int ESP8266_TXQueue(ESP8266_t *esp, const uint8_t *data, size_t len);
+
+uint64_t ESP8266_GetTimestampMS(void);
+
+/* AT+CIPCLOSE: close a link, or keep its socket for reuse */
+int ESP8266_SocketRelease(ESP8266_t *esp, uint8_t link_id);
+
+/* Append to a link's send ring; -1 if it doesn't fit */
+int ESP8266_SocketQueue(ESP8266_t *esp, uint8_t link_id, const uint8_t *data, size_t len);
+/* Write what the send ring holds; 1 when it is empty, 0 while the socket
+   is busy (finished from ESP8266_Poll), -1 on error */
+int ESP8266_SocketFlush(ESP8266_t *esp, uint8_t link_id);
+/* The CIPSEND in progress has all its data: flush and report */
+void ESP8266_SendComplete(ESP8266_t *esp);
+
+/* AT+CIPSERVER: listen on port, accepting into free links; or stop,
+   leaving accepted links open */
+int ESP8266_ServerStart(ESP8266_t *esp, uint16_t port);
+void ESP8266_ServerStop(ESP8266_t *esp);
+
+/* ========== Network thread (esp8266_net.c) ========== */
+
+int ESP8266_NetStart(ESP8266_t *esp);
+void ESP8266_NetStop(ESP8266_t *esp);
+void ESP8266_NetLock(ESP8266_t *esp);
+void ESP8266_NetUnlock(ESP8266_t *esp);
+/* Under net_lock: start watching a link's socket for events; -1 if its
+   receive ring can't be allocated */
+int ESP8266_NetWatch(ESP8266_t *esp, int link_id, int events);
+/* Under net_lock: change the events armed for a watched link */
+void ESP8266_NetArm(ESP8266_t *esp, int link_id, int events);
+/* Under net_lock, before the socket is closed: forget a link */
+void ESP8266_NetUnwatch(ESP8266_t *esp, int link_id);
+/* Under net_lock: watch the server socket for a connection (events
+   ESP8266_NET_IN) or pause (0) */
+void ESP8266_NetListen(ESP8266_t *esp, int events);
+/* Under net_lock, before the server socket is closed */
+void ESP8266_NetUnlisten(ESP8266_t *esp);
+/* Emulator: the next record for a link, left in the ring as up to two
+   segments (iov[1] may be empty) until ESP8266_NetConsume, and for UDP
+   who sent it when from isn't NULL.  Returns its length, 0 if the peer
+   closed, -1 if there is none */
+struct iovec;
+struct sockaddr_in;
+int ESP8266_NetRecord(ESP8266_t *esp, int link_id, struct iovec *iov, struct sockaddr_in *from);
+/* Emulator: drop the record ESP8266_NetRecord returned */
+void ESP8266_NetConsume(ESP8266_t *esp, int link_id);
+/* Emulator: length of the next record without removing it, -1 if none */
+int ESP8266_NetPeek(ESP8266_t *esp, int link_id);
+/* Name or dotted quad to an IPv4 address through the DNS cache; -1 if
+   it doesn't resolve */
+struct in_addr;
+int ESP8266_Resolve(const char *host, struct in_addr *addr);
+
 #endif  /* ESP8266_MODEL_INTERNAL_H */
@@ -0,0 +1,730 @@
+/*
+ * ESP8266 Model - Network Thread
+ *
+ * Waits for socket readiness with epoll (Linux), kqueue (macOS/BSD) or
+ * poll() and reads connected sockets into per-link rings, so the emulator
+ * side never makes network syscalls while idle; it also watches the
+ * server socket, leaving the accept to ESP8266_Poll.  Links still connecting,
+ * or waiting for room to send, only raise attention; the connect, TLS
+ * handshake and send steps stay in ESP8266_Poll.
+ *
+ * Copyright (C) 2026 Chris January
+ * GPL-3 with exception for sQLux linking
+ */
+
+#include "esp8266_model.h"
+#include "esp8266_model_internal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+
+#if defined(__linux__)
+#define ESP_NET_EPOLL
+#include <sys/epoll.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__)
+#define ESP_NET_KQUEUE
+#include <sys/event.h>
+#endif
+
+/* Datagrams taken per recvmmsg, where there is one */
+#if defined(__linux__)
+#define ESP_NET_RECVMMSG
+#define NET_UDP_BATCH   8
+#endif
+
+/* A record's header: its length, then a UDP sender's address */
+#define NET_HDR_SIZE(link)  ((link)->datagram ? 8u : 2u)
+
+#define NET_MAX_EVENTS  (2 * ESP8266_MAX_CONNECTIONS + 2)
+#define NET_TAG_LISTEN  0xfe
+#define NET_TAG_WAKE    0xff
+
+/* Event tags carry the link generation so stale events can be dropped */
+static uint32_t net_tag(ESP8266_Internal *state, int link_id) {
+    return (state->net_links[link_id].gen << 8) | (uint32_t)link_id;
+}
+
+/* ========== Poller Backends ========== */
+
+static void net_poller_ctl(ESP8266_Internal *state, int fd, uint32_t tag, int events, int add) {
+#if defined(ESP_NET_EPOLL)
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = ((events & ESP8266_NET_IN) ? EPOLLIN : 0) |
+                ((events & ESP8266_NET_OUT) ? EPOLLOUT : 0);
+    ev.data.u32 = tag;
+    epoll_ctl(state->net_poll_fd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+#elif defined(ESP_NET_KQUEUE)
+    struct kevent kev[2];
+    EV_SET(&kev[0], fd, EVFILT_READ,
+           EV_ADD | ((events & ESP8266_NET_IN) ? EV_ENABLE : EV_DISABLE),
+           0, 0, (void *)(uintptr_t)tag);
+    EV_SET(&kev[1], fd, EVFILT_WRITE,
+           EV_ADD | ((events & ESP8266_NET_OUT) ? EV_ENABLE : EV_DISABLE),
+           0, 0, (void *)(uintptr_t)tag);
+    kevent(state->net_poll_fd, kev, 2, NULL, 0, NULL);
+#else
+    // poll() rebuilds its set every wait; make it wait again
+    (void)fd;
+    (void)tag;
+    (void)add;
+    char c = 0;
+    (void)write(state->net_wake[1], &c, 1);
+#endif
+}
+
+static void net_poller_del(ESP8266_Internal *state, int fd) {
+#if defined(ESP_NET_EPOLL)
+    epoll_ctl(state->net_poll_fd, EPOLL_CTL_DEL, fd, NULL);
+#elif defined(ESP_NET_KQUEUE)
+    struct kevent kev[2];
+    EV_SET(&kev[0], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    EV_SET(&kev[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+    kevent(state->net_poll_fd, kev, 2, NULL, 0, NULL);
+#else
+    (void)state;
+    (void)fd;
+#endif
+}
+
+static void net_poller_set(ESP8266_Internal *state, int link_id, int events, int add) {
+    net_poller_ctl(state, state->connections[link_id].socket_fd,
+                   net_tag(state, link_id), events, add);
+    state->net_links[link_id].events = events;
+}
+
+static void net_poller_remove(ESP8266_Internal *state, int link_id) {
+    net_poller_del(state, state->connections[link_id].socket_fd);
+    state->net_links[link_id].events = 0;
+}
+
+/* Wait for events; fills tags[] and ready[] (ESP8266_NET_IN/OUT) */
+static int net_poller_wait(ESP8266_Internal *state, uint32_t *tags, int *ready) {
+    int n;
+
+#if defined(ESP_NET_EPOLL)
+    struct epoll_event evs[NET_MAX_EVENTS];
+    n = epoll_wait(state->net_poll_fd, evs, NET_MAX_EVENTS, -1);
+    for (int i = 0; i < n; i++) {
+        tags[i] = evs[i].data.u32;
+        // Errors and hangups show up on the next read or connect check
+        ready[i] = ((evs[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) ? ESP8266_NET_IN : 0) |
+                   ((evs[i].events & EPOLLOUT) ? ESP8266_NET_OUT : 0);
+    }
+#elif defined(ESP_NET_KQUEUE)
+    struct kevent evs[NET_MAX_EVENTS];
+    n = kevent(state->net_poll_fd, NULL, 0, evs, NET_MAX_EVENTS, NULL);
+    for (int i = 0; i < n; i++) {
+        tags[i] = (uint32_t)(uintptr_t)evs[i].udata;
+        ready[i] = evs[i].filter == EVFILT_WRITE ? ESP8266_NET_OUT : ESP8266_NET_IN;
+    }
+#else
+    struct pollfd fds[NET_MAX_EVENTS];
+    uint32_t fd_tags[NET_MAX_EVENTS];
+    int nfds = 0, m = 0;
+
+    pthread_mutex_lock(&state->net_lock);
+    fds[nfds].fd = state->net_wake[0];
+    fds[nfds].events = POLLIN;
+    fd_tags[nfds++] = NET_TAG_WAKE;
+    if (state->server_events) {
+        fds[nfds].fd = state->server_socket;
+        fds[nfds].events = POLLIN;
+        fd_tags[nfds++] = NET_TAG_LISTEN;
+    }
+    for (int i = 0; i < state->link_count; i++) {
+        int events = state->net_links[i].events;
+        if (!events) continue;
+        fds[nfds].fd = state->connections[i].socket_fd;
+        fds[nfds].events = ((events & ESP8266_NET_IN) ? POLLIN : 0) |
+                           ((events & ESP8266_NET_OUT) ? POLLOUT : 0);
+        fd_tags[nfds++] = net_tag(state, i);
+    }
+    pthread_mutex_unlock(&state->net_lock);
+
+    n = poll(fds, nfds, -1);
+    for (int i = 0; i < nfds && n > 0; i++) {
+        if (!fds[i].revents) continue;
+        tags[m] = fd_tags[i];
+        ready[m++] = ((fds[i].revents & (POLLIN | POLLERR | POLLHUP)) ? ESP8266_NET_IN : 0) |
+                     ((fds[i].revents & POLLOUT) ? ESP8266_NET_OUT : 0);
+    }
+    n = n > 0 ? m : n;
+#endif
+    return n;
+}
+
+/* ========== Receive Ring ========== */
+
+static unsigned net_ring_free(ESP8266_NetLink *link) {
+    return link->size -
+           (atomic_load_explicit(&link->head, memory_order_relaxed) -
+            atomic_load_explicit(&link->tail, memory_order_acquire));
+}
+
+static void net_ring_copy_in(uint8_t *ring, unsigned size, unsigned pos, const uint8_t *src, unsigned len) {
+    unsigned off = pos & (size - 1);
+    unsigned first = size - off;
+
+    if (first > len) first = len;
+    memcpy(ring + off, src, first);
+    memcpy(ring, src + first, len - first);
+}
+
+static void net_ring_push(ESP8266_Internal *state, ESP8266_NetLink *link, const uint8_t *data, unsigned len,
+                          const struct sockaddr_in *from) {
+    unsigned head = atomic_load_explicit(&link->head, memory_order_relaxed);
+    uint8_t hdr[8] = { len & 0xff, len >> 8 };
+
+    if (from) {
+        memcpy(hdr + 2, &from->sin_addr.s_addr, 4);
+        memcpy(hdr + 6, &from->sin_port, 2);
+    }
+    net_ring_copy_in(link->ring, link->size, head, hdr, NET_HDR_SIZE(link));
+    net_ring_copy_in(link->ring, link->size, head + NET_HDR_SIZE(link), data, len);
+    atomic_store_explicit(&link->head, head + NET_HDR_SIZE(link) + len, memory_order_release);
+    atomic_store(&state->net_pending, 1);
+}
+
+/* Under net_lock, while throttled: double the ring, keeping its contents
+   at the same positions.  -1 if it is as big as it goes or out of memory */
+static int net_ring_grow(ESP8266_NetLink *link) {
+    unsigned tail = atomic_load_explicit(&link->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&link->head, memory_order_relaxed);
+    unsigned size = link->size * 2;
+    uint8_t *ring;
+
+    if (size > ESP8266_NET_RING_MAX || !(ring = malloc(size))) return -1;
+    for (unsigned pos = tail; pos != head; ) {
+        unsigned off = pos & (link->size - 1);
+        unsigned n = link->size - off;
+
+        if (n > head - pos) n = head - pos;
+        net_ring_copy_in(ring, size, pos, link->ring + off, n);
+        pos += n;
+    }
+    free(link->ring);
+    link->ring = ring;
+    link->size = size;
+    return 0;
+}
+
+/* ========== Network Thread ========== */
+
+/* Under net_lock: the link's ring can't take another read; resumed by the
+   emulator once it has drained it */
+static void net_throttle(ESP8266_Internal *state, int link_id) {
+    ESP8266_NetLink *link = &state->net_links[link_id];
+
+    atomic_store(&link->throttled, 1);
+    net_poller_set(state, link_id, link->events & ~ESP8266_NET_IN, 0);
+}
+
+/* A UDP socket error that leaves the link usable */
+static int net_udp_transient(int err) {
+    return err == ECONNREFUSED || err == EHOSTUNREACH || err == ENETUNREACH;
+}
+
+/*
+ * Under net_lock: queue the datagrams a UDP socket has, each with its
+ * sender, as many to a system call as the ring has room for.  Empty
+ * datagrams are dropped, as length 0 means closed.
+ */
+static void net_read_datagrams(ESP8266_Internal *state, int link_id) {
+    Connection *conn = &state->connections[link_id];
+    ESP8266_NetLink *link = &state->net_links[link_id];
+    const unsigned per = 8 + ESP8266_RX_BUFFER_SIZE;
+
+#if defined(ESP_NET_RECVMMSG)
+    uint8_t bufs[NET_UDP_BATCH][ESP8266_RX_BUFFER_SIZE];
+    struct sockaddr_in from[NET_UDP_BATCH];
+    struct iovec iov[NET_UDP_BATCH];
+    struct mmsghdr msgs[NET_UDP_BATCH];
+
+    for (;;) {
+        unsigned want = net_ring_free(link) / per;
+        int got;
+
+        if (!want) {
+            net_throttle(state, link_id);
+            return;
+        }
+        if (want > NET_UDP_BATCH) want = NET_UDP_BATCH;
+
+        memset(msgs, 0, want * sizeof(msgs[0]));
+        for (unsigned i = 0; i < want; i++) {
+            iov[i].iov_base = bufs[i];
+            iov[i].iov_len = sizeof(bufs[i]);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &from[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+        }
+        got = recvmmsg(conn->socket_fd, msgs, want, MSG_DONTWAIT, NULL);
+        if (got < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || net_udp_transient(errno))
+                return;
+            break;
+        }
+        for (int i = 0; i < got; i++) {
+            if (!msgs[i].msg_len) continue;
+            state->stats.net_rx_bytes += msgs[i].msg_len;
+            net_ring_push(state, link, bufs[i], msgs[i].msg_len, &from[i]);
+        }
+        if ((unsigned)got < want)
+            return;
+    }
+#else
+    uint8_t buf[ESP8266_RX_BUFFER_SIZE];
+
+    for (;;) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t bytes_read;
+
+        if (net_ring_free(link) < per) {
+            net_throttle(state, link_id);
+            return;
+        }
+        bytes_read = recvfrom(conn->socket_fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_len);
+        if (bytes_read < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || net_udp_transient(errno))
+                return;
+            break;
+        }
+        if (bytes_read > 0) {
+            state->stats.net_rx_bytes += bytes_read;
+            net_ring_push(state, link, buf, (unsigned)bytes_read, &from);
+        }
+    }
+#endif
+
+    // Socket error: report it and stop watching
+    net_ring_push(state, link, NULL, 0, NULL);
+    link->closed = 1;
+    net_poller_set(state, link_id, 0, 0);
+}
+
+/* Under net_lock: read what a connected socket has into its ring */
+static void net_read_link(ESP8266_Internal *state, int link_id) {
+    Connection *conn = &state->connections[link_id];
+    ESP8266_NetLink *link = &state->net_links[link_id];
+    uint8_t buf[ESP8266_RX_BUFFER_SIZE];
+
+    if (conn->type == CONNECTION_TYPE_UDP) {
+        net_read_datagrams(state, link_id);
+        return;
+    }
+
+    for (;;) {
+        unsigned room = net_ring_free(link);
+        ssize_t bytes_read;
+
+        if (room < 2 + sizeof(buf)) {
+            net_throttle(state, link_id);
+            return;
+        }
+
+        if (conn->type == CONNECTION_TYPE_SSL && conn->ssl) {
+            bytes_read = SSL_read((SSL *)conn->ssl, buf, sizeof(buf));
+            if (bytes_read <= 0) {
+                int ssl_err = SSL_get_error((SSL *)conn->ssl, bytes_read);
+                if (ssl_err == SSL_ERROR_WANT_READ || ssl_err == SSL_ERROR_WANT_WRITE) {
+                    bytes_read = -1;
+                    errno = EAGAIN;
+                } else {
+                    bytes_read = 0;  // Connection closed or error
+                }
+            }
+        } else {
+            bytes_read = recv(conn->socket_fd, buf, sizeof(buf), 0);
+        }
+
+        if (bytes_read > 0) {
+            state->stats.net_rx_bytes += bytes_read;
+            net_ring_push(state, link, buf, (unsigned)bytes_read, NULL);
+            // Decrypted data can be buffered without the socket being readable
+            if (conn->type == CONNECTION_TYPE_SSL && conn->ssl && SSL_pending((SSL *)conn->ssl))
+                continue;
+            return;
+        }
+        if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            return;
+
+        // Peer closed or error: report it and stop watching
+        net_ring_push(state, link, NULL, 0, NULL);
+        link->closed = 1;
+        net_poller_set(state, link_id, 0, 0);
+        return;
+    }
+}
+
+static void *net_thread(void *arg) {
+    ESP8266_Internal *state = arg;
+    uint32_t tags[NET_MAX_EVENTS];
+    int ready[NET_MAX_EVENTS];
+
+    while (!atomic_load(&state->net_quit)) {
+        int n = net_poller_wait(state, tags, ready);
+
+        if (n < 0 && errno != EINTR) {
+            perror("[ESP] network wait");
+            break;
+        }
+
+        pthread_mutex_lock(&state->net_lock);
+        for (int i = 0; i < n; i++) {
+            int link_id = tags[i] & 0xff;
+
+            if (link_id == NET_TAG_WAKE) {
+                char c[64];
+                while (read(state->net_wake[0], c, sizeof(c)) > 0)
+                    ;
+                continue;
+            }
+            if (link_id == NET_TAG_LISTEN) {
+                // ESP8266_Poll accepts, then watches again
+                if (state->server_events) {
+                    net_poller_ctl(state, state->server_socket, NET_TAG_LISTEN, 0, 0);
+                    state->server_events = 0;
+                    atomic_store(&state->net_accept, 1);
+                    atomic_store(&state->net_pending, 1);
+                }
+                continue;
+            }
+            if (link_id >= state->link_count || tags[i] != net_tag(state, link_id))
+                continue;  // Link closed or reused since the wait returned
+
+            Connection *conn = &state->connections[link_id];
+            ESP8266_NetLink *link = &state->net_links[link_id];
+            if (!link->events)
+                continue;
+            if (!conn->connected) {
+                // Connect and handshake steps belong to ESP8266_Poll
+                net_poller_set(state, link_id, 0, 0);
+                atomic_store(&link->attention, 1);
+                atomic_store(&state->net_pending, 1);
+            } else {
+                // Room to send again: the emulator flushes the send ring
+                if ((ready[i] & ESP8266_NET_OUT) && (link->events & ESP8266_NET_OUT)) {
+                    net_poller_set(state, link_id, link->events & ~ESP8266_NET_OUT, 0);
+                    atomic_store(&link->attention, 1);
+                    atomic_store(&state->net_pending, 1);
+                }
+                if ((ready[i] & ESP8266_NET_IN) && (link->events & ESP8266_NET_IN))
+                    net_read_link(state, link_id);
+            }
+        }
+        pthread_mutex_unlock(&state->net_lock);
+    }
+    return NULL;
+}
+
+/* ========== DNS Cache ========== */
+
+/*
+ * Names resolved for CIPSTART and CIPDOMAIN.  A miss resolves in line,
+ * as the AT reply waits on it; an entry past its TTL is still answered
+ * from the cache while a background thread looks it up again.
+ */
+#define DNS_CACHE_SIZE   16
+#define DNS_TTL_MS       60000
+#define DNS_STALE_MS     (10 * 60000)
+
+typedef struct {
+    char host[ESP8266_MAX_DOMAIN_LEN];
+    struct in_addr addr;
+    uint64_t expires;
+    uint64_t used;
+    int refreshing;
+} DNSEntry;
+
+static DNSEntry dns_cache[DNS_CACHE_SIZE];
+static pthread_mutex_t dns_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int dns_lookup(const char *host, struct in_addr *addr) {
+    struct addrinfo hints, *res;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0 || !res) return -1;
+    *addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+    freeaddrinfo(res);
+    return 0;
+}
+
+/* Under dns_lock: store a result, replacing host's entry or the oldest */
+static void dns_store(const char *host, struct in_addr addr) {
+    DNSEntry *e = &dns_cache[0];
+
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        if (!strcmp(dns_cache[i].host, host)) {
+            e = &dns_cache[i];
+            break;
+        }
+        if (dns_cache[i].used < e->used) e = &dns_cache[i];
+    }
+    if (strcmp(e->host, host)) {
+        snprintf(e->host, sizeof(e->host), "%s", host);
+        e->refreshing = 0;
+    }
+    e->addr = addr;
+    e->expires = ESP8266_GetTimestampMS() + DNS_TTL_MS;
+    e->used = ESP8266_GetTimestampMS();
+}
+
+static void *dns_refresh_thread(void *arg) {
+    char *host = arg;
+    struct in_addr addr;
+    int ok = dns_lookup(host, &addr) == 0;
+
+    pthread_mutex_lock(&dns_lock);
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        if (!strcmp(dns_cache[i].host, host)) {
+            dns_cache[i].refreshing = 0;
+            if (ok) dns_store(host, addr);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&dns_lock);
+    free(host);
+    return NULL;
+}
+
+int ESP8266_Resolve(const char *host, struct in_addr *addr) {
+    uint64_t now = ESP8266_GetTimestampMS();
+    pthread_t thread;
+
+    if (inet_pton(AF_INET, host, addr) == 1) return 0;
+
+    pthread_mutex_lock(&dns_lock);
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        DNSEntry *e = &dns_cache[i];
+
+        if (!e->host[0] || strcmp(e->host, host)) continue;
+        if (now >= e->expires + DNS_STALE_MS) break;
+
+        *addr = e->addr;
+        e->used = now;
+        if (now >= e->expires && !e->refreshing) {
+            char *name = strdup(host);
+            if (name && pthread_create(&thread, NULL, dns_refresh_thread, name) == 0) {
+                pthread_detach(thread);
+                e->refreshing = 1;
+            } else {
+                free(name);
+            }
+        }
+        pthread_mutex_unlock(&dns_lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&dns_lock);
+
+    if (dns_lookup(host, addr) < 0) return -1;
+
+    pthread_mutex_lock(&dns_lock);
+    dns_store(host, *addr);
+    pthread_mutex_unlock(&dns_lock);
+    return 0;
+}
+
+/* ========== Interface ========== */
+
+int ESP8266_NetStart(ESP8266_t *esp) {
+    ESP8266_Internal *state = &esp->state;
+
+    pthread_mutex_init(&state->net_lock, NULL);
+    atomic_store(&state->net_quit, 0);
+    atomic_store(&state->net_pending, 0);
+
+    if (pipe(state->net_wake) < 0) {
+        perror("[ESP] pipe");
+        return -1;
+    }
+    fcntl(state->net_wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(state->net_wake[1], F_SETFL, O_NONBLOCK);
+
+#if defined(ESP_NET_EPOLL)
+    state->net_poll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (state->net_poll_fd >= 0) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = NET_TAG_WAKE;
+        epoll_ctl(state->net_poll_fd, EPOLL_CTL_ADD, state->net_wake[0], &ev);
+    }
+#elif defined(ESP_NET_KQUEUE)
+    state->net_poll_fd = kqueue();
+    if (state->net_poll_fd >= 0) {
+        struct kevent kev;
+        EV_SET(&kev, state->net_wake[0], EVFILT_READ, EV_ADD, 0, 0,
+               (void *)(uintptr_t)NET_TAG_WAKE);
+        kevent(state->net_poll_fd, &kev, 1, NULL, 0, NULL);
+    }
+#else
+    state->net_poll_fd = -1;
+#endif
+
+    if (pthread_create(&state->net_thread, NULL, net_thread, state) != 0) {
+        fprintf(stderr, "[ESP] network thread creation failed\n");
+        return -1;
+    }
+    state->net_running = 1;
+    return 0;
+}
+
+void ESP8266_NetStop(ESP8266_t *esp) {
+    ESP8266_Internal *state = &esp->state;
+    char c = 0;
+
+    if (!state->net_running) return;
+
+    atomic_store(&state->net_quit, 1);
+    (void)write(state->net_wake[1], &c, 1);
+    pthread_join(state->net_thread, NULL);
+    state->net_running = 0;
+
+    for (int i = 0; i < ESP8266_MAX_CONNECTIONS; i++) {
+        free(state->net_links[i].ring);
+        state->net_links[i].ring = NULL;
+    }
+    if (state->net_poll_fd >= 0) close(state->net_poll_fd);
+    close(state->net_wake[0]);
+    close(state->net_wake[1]);
+    pthread_mutex_destroy(&state->net_lock);
+}
+
+void ESP8266_NetLock(ESP8266_t *esp) {
+    pthread_mutex_lock(&esp->state.net_lock);
+}
+
+void ESP8266_NetUnlock(ESP8266_t *esp) {
+    pthread_mutex_unlock(&esp->state.net_lock);
+}
+
+int ESP8266_NetWatch(ESP8266_t *esp, int link_id, int events) {
+    ESP8266_Internal *state = &esp->state;
+    ESP8266_NetLink *link = &state->net_links[link_id];
+
+    // Each connection starts with the smallest ring
+    if (!link->ring || link->size != ESP8266_NET_RING_MIN) {
+        free(link->ring);
+        link->ring = malloc(ESP8266_NET_RING_MIN);
+        if (!link->ring) return -1;
+        link->size = ESP8266_NET_RING_MIN;
+    }
+    link->gen++;
+    link->datagram = state->connections[link_id].type == CONNECTION_TYPE_UDP;
+    atomic_store(&link->head, 0);
+    atomic_store(&link->tail, 0);
+    atomic_store(&link->attention, 0);
+    atomic_store(&link->throttled, 0);
+    link->closed = 0;
+    net_poller_set(state, link_id, events, 1);
+    return 0;
+}
+
+void ESP8266_NetArm(ESP8266_t *esp, int link_id, int events) {
+    net_poller_set(&esp->state, link_id, events, 0);
+}
+
+void ESP8266_NetUnwatch(ESP8266_t *esp, int link_id) {
+    ESP8266_Internal *state = &esp->state;
+    ESP8266_NetLink *link = &state->net_links[link_id];
+
+    net_poller_remove(state, link_id);
+    link->gen++;
+    atomic_store(&link->head, 0);
+    atomic_store(&link->tail, 0);
+    atomic_store(&link->attention, 0);
+    atomic_store(&link->throttled, 0);
+    free(link->ring);
+    link->ring = NULL;
+    link->size = 0;
+}
+
+void ESP8266_NetListen(ESP8266_t *esp, int events) {
+    ESP8266_Internal *state = &esp->state;
+
+    net_poller_ctl(state, state->server_socket, NET_TAG_LISTEN, events, !state->server_watched);
+    state->server_watched = 1;
+    state->server_events = events;
+}
+
+void ESP8266_NetUnlisten(ESP8266_t *esp) {
+    ESP8266_Internal *state = &esp->state;
+
+    if (state->server_watched) net_poller_del(state, state->server_socket);
+    state->server_watched = 0;
+    state->server_events = 0;
+}
+
+int ESP8266_NetPeek(ESP8266_t *esp, int link_id) {
+    struct iovec iov[2];
+
+    return ESP8266_NetRecord(esp, link_id, iov, NULL);
+}
+
+int ESP8266_NetRecord(ESP8266_t *esp, int link_id, struct iovec *iov, struct sockaddr_in *from) {
+    ESP8266_NetLink *link = &esp->state.net_links[link_id];
+    unsigned tail = atomic_load_explicit(&link->tail, memory_order_relaxed);
+    unsigned mask = link->size - 1;
+    unsigned off, first;
+    int len;
+
+    if (atomic_load_explicit(&link->head, memory_order_acquire) == tail)
+        return -1;
+    len = link->ring[tail & mask] | (link->ring[(tail + 1) & mask] << 8);
+
+    if (link->datagram && from) {
+        uint8_t addr[6];
+
+        for (int i = 0; i < 6; i++)
+            addr[i] = link->ring[(tail + 2 + i) & mask];
+        memset(from, 0, sizeof(*from));
+        from->sin_family = AF_INET;
+        memcpy(&from->sin_addr.s_addr, addr, 4);
+        memcpy(&from->sin_port, addr + 4, 2);
+    }
+
+    off = (tail + NET_HDR_SIZE(link)) & mask;
+    first = link->size - off;
+    if (first > (unsigned)len) first = len;
+    iov[0].iov_base = link->ring + off;
+    iov[0].iov_len = first;
+    iov[1].iov_base = link->ring;
+    iov[1].iov_len = len - first;
+    return len;
+}
+
+void ESP8266_NetConsume(ESP8266_t *esp, int link_id) {
+    ESP8266_Internal *state = &esp->state;
+    ESP8266_NetLink *link = &state->net_links[link_id];
+    unsigned tail = atomic_load_explicit(&link->tail, memory_order_relaxed);
+    struct iovec iov[2];
+    int len = ESP8266_NetRecord(esp, link_id, iov, NULL);
+
+    if (len < 0) return;
+    atomic_store_explicit(&link->tail, tail + NET_HDR_SIZE(link) + len, memory_order_release);
+
+    // A link that fills its ring gets a bigger one; at the biggest it
+    // resumes once half of it is free again
+    if (atomic_load(&link->throttled)) {
+        pthread_mutex_lock(&state->net_lock);
+        if (atomic_load(&link->throttled) && !link->closed &&
+            (net_ring_grow(link) == 0 || net_ring_free(link) >= link->size / 2)) {
+            atomic_store(&link->throttled, 0);
+            net_poller_set(state, link_id, link->events | ESP8266_NET_IN, 0);
+        }
+        pthread_mutex_unlock(&state->net_lock);
+    }
+}
@@ -4,6 +4,12 @@
  * Standalone tool to test ESP8266 model with UART interface
  * Reads from stdin, sends to ESP8266, outputs ESP8266 responses to stdout
  *
+ * With --bench it instead drives the model against an echo server (its
+ * own on localhost unless --host/--port are given), with both UART
+ * directions paced to --baud (0 = unpaced), and prints one JSON line of
+ * results: AT commands/sec, CIPSEND payload MB/s, CIPSEND round trip
+ * latency and process CPU time per UART byte.
+ *
  * Copyright (C) 2026 Chris January
  * GPL-3 with exception for sQLux linking
  */
@@ -18,6 +24,11 @@
 #include <signal.h>
 #include <errno.h>
 #include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 static volatile int running = 1;
 
@@ -26,9 +37,342 @@ void signal_handler(int sig) {
     running = 0;
 }
 
+/* ========== Benchmark ========== */
+
+#define BENCH_BLOCK      2048    // CIPSEND size for the throughput run
+#define BENCH_PING       16      // CIPSEND size for round trips
+#define BENCH_PINGS      100
+#define BENCH_TIMEOUT_NS 5000000000ULL
+
+typedef struct {
+    ESP8266_t *esp;
+    unsigned baud;
+    uint64_t start_ns;         // pacing starts here
+    uint64_t uart_in;          // bytes fed to the model
+    uint64_t uart_out;         // bytes taken from the model
+    uint64_t in_slot;          // byte times used so far each way; an
+    uint64_t out_slot;         // idle line doesn't bank them
+
+    // Response scanner
+    char line[64];
+    size_t line_len;
+    size_t ipd_left;           // +IPD payload still to skip
+    uint64_t rx_payload;
+    unsigned ok, send_ok, prompt, error, connect;
+} Bench;
+
+static uint64_t bench_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_scan(Bench *b, uint8_t c) {
+    if (b->ipd_left) {
+        b->ipd_left--;
+        b->rx_payload++;
+        return;
+    }
+    if (c == '\r' || c == '\n') {
+        b->line[b->line_len] = 0;
+        if (!strcmp(b->line, "OK")) b->ok++;
+        else if (!strcmp(b->line, "SEND OK")) b->send_ok++;
+        else if (!strcmp(b->line, "CONNECT")) b->connect++;
+        else if (!strcmp(b->line, "ERROR") || !strcmp(b->line, "SEND FAIL")) b->error++;
+        b->line_len = 0;
+        return;
+    }
+    if (b->line_len == 0 && c == '>') {
+        b->prompt++;
+        return;
+    }
+    if (b->line_len < sizeof(b->line) - 1) {
+        b->line[b->line_len++] = c;
+    }
+    if (c == ':' && !strncmp(b->line, "+IPD,", 5)) {
+        b->line[b->line_len] = 0;
+        b->ipd_left = strtoul(b->line + 5, NULL, 10);
+        b->line_len = 0;
+    }
+}
+
+/* UART bytes either way allowed by now at the baud rate (8N1) */
+static uint64_t bench_allowance(Bench *b) {
+    if (!b->baud) return UINT64_MAX;
+    return (bench_ns(CLOCK_MONOTONIC) - b->start_ns) * b->baud / 10 / 1000000000ULL;
+}
+
+/* Poll the model and take its output, as fast as the line allows */
+static size_t bench_pump(Bench *b) {
+    uint8_t buf[256];
+    uint64_t allow = bench_allowance(b);
+    size_t n, total = 0;
+
+    ESP8266_Poll(b->esp);
+    while (b->out_slot < allow) {
+        size_t max = allow - b->out_slot < sizeof(buf) ? allow - b->out_slot : sizeof(buf);
+        n = ESP8266_GetUARTBytes(b->esp, buf, max);
+        if (!n) {
+            if (b->baud) b->out_slot = allow;
+            break;
+        }
+        for (size_t i = 0; i < n; i++) {
+            bench_scan(b, buf[i]);
+        }
+        b->out_slot += n;
+        b->uart_out += n;
+        total += n;
+    }
+    return total;
+}
+
+/* Pump, napping when idle so waits don't count as model CPU time */
+static void bench_idle(Bench *b) {
+    if (!bench_pump(b)) usleep(20);
+}
+
+static void bench_send(Bench *b, const void *data, size_t len) {
+    const uint8_t *p = data;
+    uint64_t allow = bench_allowance(b);
+
+    if (b->baud && b->in_slot < allow) b->in_slot = allow;
+    while (len) {
+        size_t n = len;
+
+        allow = bench_allowance(b);
+        if (b->in_slot >= allow) {
+            bench_idle(b);
+            continue;
+        }
+        if (allow - b->in_slot < n) n = allow - b->in_slot;
+        ESP8266_ProcessUARTBytes(b->esp, p, n);
+        b->in_slot += n;
+        b->uart_in += n;
+        p += n;
+        len -= n;
+        bench_pump(b);
+    }
+}
+
+/* Pump until *counter reaches target; 0 on timeout */
+static int bench_wait(Bench *b, unsigned *counter, unsigned target) {
+    uint64_t deadline = bench_ns(CLOCK_MONOTONIC) + BENCH_TIMEOUT_NS;
+
+    while (*counter < target && !b->error) {
+        if (bench_ns(CLOCK_MONOTONIC) > deadline) return 0;
+        bench_idle(b);
+    }
+    return !b->error;
+}
+
+static int bench_wait_rx(Bench *b, uint64_t target) {
+    uint64_t deadline = bench_ns(CLOCK_MONOTONIC) + BENCH_TIMEOUT_NS;
+
+    while (b->rx_payload < target) {
+        if (bench_ns(CLOCK_MONOTONIC) > deadline) return 0;
+        bench_idle(b);
+    }
+    return 1;
+}
+
+static int bench_command(Bench *b, const char *cmd) {
+    unsigned ok = b->ok;
+
+    bench_send(b, cmd, strlen(cmd));
+    bench_send(b, "\r\n", 2);
+    return bench_wait(b, &b->ok, ok + 1);
+}
+
+/*
+ * CIPSEND one block and wait for SEND OK; with rtt, also wait for the
+ * echo and return the time from the last byte in to the last byte back
+ */
+static int bench_cipsend(Bench *b, const uint8_t *data, size_t len, uint64_t *rtt) {
+    char cmd[32];
+    unsigned prompt = b->prompt, send_ok = b->send_ok;
+    uint64_t start, want = b->rx_payload + len;
+
+    snprintf(cmd, sizeof(cmd), "AT+CIPSEND=%zu\r\n", len);
+    bench_send(b, cmd, strlen(cmd));
+    if (!bench_wait(b, &b->prompt, prompt + 1)) return 0;
+    bench_send(b, data, len - 1);
+    start = bench_ns(CLOCK_MONOTONIC);
+    bench_send(b, data + len - 1, 1);
+    if (rtt) {
+        if (!bench_wait_rx(b, want)) return 0;
+        *rtt = bench_ns(CLOCK_MONOTONIC) - start;
+    }
+    return bench_wait(b, &b->send_ok, send_ok + 1);
+}
+
+static void *bench_echo_client(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    char buf[8192];
+    ssize_t n;
+
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+        for (ssize_t off = 0; off < n; ) {
+            ssize_t w = send(fd, buf + off, n - off, 0);
+            if (w <= 0) break;
+            off += w;
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+static void *bench_echo_server(void *arg) {
+    int listener = (int)(intptr_t)arg;
+    int fd;
+
+    while ((fd = accept(listener, NULL, NULL)) >= 0) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, bench_echo_client, (void *)(intptr_t)fd) == 0) {
+            pthread_detach(t);
+        } else {
+            close(fd);
+        }
+    }
+    return NULL;
+}
+
+/* Listen on an ephemeral localhost port; returns the port, or 0 */
+static int bench_start_echo(void) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    pthread_t t;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd < 0) return 0;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &len) < 0 ||
+        pthread_create(&t, NULL, bench_echo_server, (void *)(intptr_t)fd) != 0) {
+        close(fd);
+        return 0;
+    }
+    pthread_detach(t);
+    return ntohs(addr.sin_port);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int bench_run(unsigned baud, double seconds, const char *host, int port) {
+    static uint8_t block[BENCH_BLOCK];
+    uint64_t lat[BENCH_PINGS];
+    uint64_t bench_ns_total = (uint64_t)(seconds * 1e9);
+    uint64_t t0, t1, cpu0, cpu1, uart0, tx = 0;
+    unsigned commands = 0;
+    char cmd[128];
+    Bench b;
+
+    if (!host) {
+        host = "127.0.0.1";
+        port = bench_start_echo();
+        if (!port) {
+            fprintf(stderr, "Benchmark: can't start echo server\n");
+            return 1;
+        }
+    }
+
+    memset(&b, 0, sizeof(b));
+    b.baud = baud;
+    b.esp = ESP8266_Create();
+    if (!b.esp) {
+        fprintf(stderr, "Failed to create ESP8266 instance\n");
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(block); i++) {
+        block[i] = 'a' + i % 26;
+    }
+    b.start_ns = bench_ns(CLOCK_MONOTONIC);
+
+    // Let the boot banner out, then time plain AT round trips
+    bench_command(&b, "ATE0");
+    t0 = bench_ns(CLOCK_MONOTONIC);
+    while (bench_ns(CLOCK_MONOTONIC) - t0 < bench_ns_total / 3) {
+        if (!bench_command(&b, "AT")) goto fail;
+        commands++;
+    }
+    t1 = bench_ns(CLOCK_MONOTONIC);
+    double cmd_rate = commands * 1e9 / (t1 - t0);
+
+    snprintf(cmd, sizeof(cmd), "AT+CIPSTART=\"TCP\",\"%s\",%d", host, port);
+    // OK comes back before the socket has connected
+    if (!bench_command(&b, cmd) || !bench_wait(&b, &b.connect, 1)) goto fail;
+
+    // Round trips: last payload byte in to last echoed byte out
+    for (int i = 0; i < BENCH_PINGS; i++) {
+        if (!bench_cipsend(&b, block, BENCH_PING, &lat[i])) goto fail;
+    }
+    qsort(lat, BENCH_PINGS, sizeof(lat[0]), cmp_u64);
+    uint64_t lat_sum = 0;
+    for (int i = 0; i < BENCH_PINGS; i++) lat_sum += lat[i];
+
+    // Payload throughput, echoes coming back while we send
+    uint64_t rx0 = b.rx_payload;
+    uart0 = b.uart_in + b.uart_out;
+    cpu0 = bench_ns(CLOCK_PROCESS_CPUTIME_ID);
+    t0 = bench_ns(CLOCK_MONOTONIC);
+    while (bench_ns(CLOCK_MONOTONIC) - t0 < bench_ns_total / 3) {
+        if (!bench_cipsend(&b, block, sizeof(block), NULL)) goto fail;
+        tx += sizeof(block);
+    }
+    if (!bench_wait_rx(&b, rx0 + tx)) goto fail;
+    t1 = bench_ns(CLOCK_MONOTONIC);
+    cpu1 = bench_ns(CLOCK_PROCESS_CPUTIME_ID);
+    uint64_t uart_bytes = b.uart_in + b.uart_out - uart0;
+
+    bench_command(&b, "AT+CIPCLOSE");
+    ESP8266_Destroy(b.esp);
+
+    printf("{\"baud\":%u,\"commands_per_sec\":%.1f,"
+           "\"tx_mb_per_sec\":%.3f,\"rx_mb_per_sec\":%.3f,"
+           "\"rtt_us_min\":%.1f,\"rtt_us_avg\":%.1f,\"rtt_us_p99\":%.1f,"
+           "\"cpu_ns_per_byte\":%.1f,\"uart_bytes\":%llu}\n",
+           baud, cmd_rate,
+           tx / 1e6 / ((t1 - t0) / 1e9), (b.rx_payload - rx0) / 1e6 / ((t1 - t0) / 1e9),
+           lat[0] / 1e3, lat_sum / 1e3 / BENCH_PINGS, lat[BENCH_PINGS * 99 / 100] / 1e3,
+           uart_bytes ? (double)(cpu1 - cpu0) / uart_bytes : 0.0,
+           (unsigned long long)uart_bytes);
+    return 0;
+
+fail:
+    fprintf(stderr, "Benchmark: no response from the model (%u errors)\n", b.error);
+    ESP8266_Destroy(b.esp);
+    return 1;
+}
+
 int main(int argc, char *argv[]) {
-    (void)argc;
-    (void)argv;
+    const char *host = NULL;
+    unsigned baud = 115200;
+    double seconds = 3;
+    int bench = 0, port = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--bench")) {
+            bench = 1;
+        } else if (!strcmp(argv[i], "--baud") && i + 1 < argc) {
+            baud = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--host") && i + 1 < argc) {
+            host = argv[++i];
+        } else if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--bench [--baud N] [--seconds S] [--host H --port P]]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (bench) {
+        return bench_run(baud, seconds, host, port);
+    }
 
     // Set up signal handler for clean exit
     signal(SIGINT, signal_handler);
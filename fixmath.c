@@ -0,0 +1,188 @@
+/*
+ * fixmath.c
+ *
+ * Fixed point math unit, see fixmath.h.  The result is worked out when
+ * the operation starts; only its ready time is modelled.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cycles.h"
+#include "fixmath.h"
+#include "savestate.h"
+
+static bool fx_enabled;
+static int32_t fx_a, fx_b, fx_result;
+static uint16_t fx_op;
+static bool fx_error;
+static uint64_t fx_ready;		/* cpu_cycles when the result is */
+
+static const uint8_t fx_latency[FIXMATH_OPS] = {
+	[FIXMATH_OP_MUL] = FIXMATH_LAT_MUL,
+	[FIXMATH_OP_DIV] = FIXMATH_LAT_DIV,
+	[FIXMATH_OP_SQRT] = FIXMATH_LAT_SQRT,
+	[FIXMATH_OP_SIN] = FIXMATH_LAT_SIN,
+	[FIXMATH_OP_COS] = FIXMATH_LAT_COS,
+	[FIXMATH_OP_ATAN2] = FIXMATH_LAT_ATAN2,
+};
+
+static int32_t fx_from_double(double v)
+{
+	return (int32_t)floor(v * 65536.0 + 0.5);
+}
+
+static uint32_t fx_isqrt(uint64_t v)
+{
+	uint64_t r = 0, bit = (uint64_t)1 << 62;
+
+	while (bit > v)
+		bit >>= 2;
+	while (bit) {
+		if (v >= r + bit) {
+			v -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+		bit >>= 2;
+	}
+	return r;
+}
+
+static int32_t fx_compute(void)
+{
+	int64_t q;
+	int32_t r;
+
+	fx_error = false;
+	switch (fx_op) {
+	case FIXMATH_OP_MUL:
+		return (int32_t)(((int64_t)fx_a * fx_b) >> 16);
+	case FIXMATH_OP_DIV:
+		if (fx_b == 0) {
+			fx_error = true;
+			return fx_a >= 0 ? INT32_MAX : -INT32_MAX;
+		}
+		q = ((int64_t)fx_a << 16) / fx_b;
+		return q > INT32_MAX ? INT32_MAX : q < INT32_MIN ? INT32_MIN : q;
+	case FIXMATH_OP_SQRT:
+		if (fx_a < 0) {
+			fx_error = true;
+			return 0;
+		}
+		return fx_isqrt((uint64_t)fx_a << 16);
+	case FIXMATH_OP_SIN:
+		return fx_from_double(-sin(fx_a / 65536.0 * 2 * M_PI));
+	case FIXMATH_OP_COS:
+		return fx_from_double(cos(fx_a / 65536.0 * 2 * M_PI));
+	case FIXMATH_OP_ATAN2:
+		if (fx_a == 0 && fx_b == 0)
+			return 0x4000;
+		r = fx_from_double(atan2(-(double)fx_b, fx_a) / (2 * M_PI));
+		return r < 0 ? r + 0x10000 : r;
+	}
+	return 0;
+}
+
+static void fx_start(void)
+{
+	if (fx_op == FIXMATH_OP_NONE)
+		return;
+	fx_result = fx_compute();
+	fx_ready = cpu_cycles + fx_latency[fx_op];
+}
+
+void fixmath_init(int enable)
+{
+	fx_enabled = enable;
+	fx_a = fx_b = fx_result = 0;
+	fx_op = FIXMATH_OP_NONE;
+	fx_error = false;
+	fx_ready = 0;
+}
+
+uint16_t fixmath_read(unsigned reg)
+{
+	if (!fx_enabled)
+		return 0;
+
+	switch (reg) {
+	case FIXMATH_REG_ID:
+		return FIXMATH_ID;
+	case FIXMATH_REG_CTRL:
+		return (cpu_cycles < fx_ready ? FIXMATH_STATUS_BUSY : 0) |
+		       (fx_error ? FIXMATH_STATUS_ERROR : 0) | fx_op << 8;
+	case FIXMATH_REG_A_HI:
+		return (uint32_t)fx_a >> 16;
+	case FIXMATH_REG_A_LO:
+		return fx_a;
+	case FIXMATH_REG_B_HI:
+		return (uint32_t)fx_b >> 16;
+	case FIXMATH_REG_B_LO:
+		return fx_b;
+	case FIXMATH_REG_RESULT_HI:
+	case FIXMATH_REG_RESULT_LO:
+		if (cpu_cycles < fx_ready)
+			cpu_cycles = fx_ready;
+		return reg == FIXMATH_REG_RESULT_HI ? (uint32_t)fx_result >> 16 : fx_result;
+	}
+	return 0;
+}
+
+void fixmath_write(unsigned reg, uint16_t d)
+{
+	if (!fx_enabled)
+		return;
+
+	switch (reg) {
+	case FIXMATH_REG_CTRL:
+		fx_op = d & 15;
+		if (fx_op >= FIXMATH_OPS)
+			fx_op = FIXMATH_OP_NONE;
+		fx_start();
+		break;
+	case FIXMATH_REG_A_HI:
+		fx_a = (uint32_t)d << 16 | (fx_a & 0xffff);
+		break;
+	case FIXMATH_REG_A_LO:
+		fx_a = (fx_a & 0xffff0000) | d;
+		if (fx_op == FIXMATH_OP_SQRT || fx_op == FIXMATH_OP_SIN ||
+		    fx_op == FIXMATH_OP_COS)
+			fx_start();
+		break;
+	case FIXMATH_REG_B_HI:
+		fx_b = (uint32_t)d << 16 | (fx_b & 0xffff);
+		break;
+	case FIXMATH_REG_B_LO:
+		fx_b = (fx_b & 0xffff0000) | d;
+		if (fx_op == FIXMATH_OP_MUL || fx_op == FIXMATH_OP_DIV ||
+		    fx_op == FIXMATH_OP_ATAN2)
+			fx_start();
+		break;
+	}
+}
+
+void fixmath_save_state(ss_buf *b)
+{
+	ssPut32(b, fx_a);
+	ssPut32(b, fx_b);
+	ssPut32(b, fx_result);
+	ssPut16(b, fx_op);
+	ssPut8(b, fx_error);
+	ssPut32(b, cpu_cycles < fx_ready ? fx_ready - cpu_cycles : 0);
+}
+
+int fixmath_load_state(ss_buf *b)
+{
+	fx_a = ssGet32(b);
+	fx_b = ssGet32(b);
+	fx_result = ssGet32(b);
+	fx_op = ssGet16(b);
+	fx_error = ssGet8(b);
+	fx_ready = cpu_cycles + ssGet32(b);
+	if (fx_op >= FIXMATH_OPS)
+		fx_op = FIXMATH_OP_NONE;
+	return b->error ? -1 : 0;
+}
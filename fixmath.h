@@ -0,0 +1,88 @@
+/*
+ * fixmath.h
+ *
+ * Emulator-only fixed point math unit (--fixmath), for measuring what
+ * one in nextp8-core would save femto8 before it is built.  Operands and
+ * results are PICO-8 16.16 numbers.  CTRL selects the operation and
+ * starts it on the operands written so far; after that, writing the last
+ * operand an operation uses (A_LO for one operand, B_LO for two) starts
+ * it again, so a stream of multiplies is two long writes and a long read
+ * each.
+ *
+ * A result is ready a fixed number of CPU cycles after the start (the
+ * FIXMATH_LAT_* values); reading RESULT before then holds the bus, the
+ * wait going into cpu_cycles.  BUSY shows without waiting.
+ *
+ *   MUL    A * B, wrapping as in PICO-8
+ *   DIV    A / B, saturating; ERROR for B = 0
+ *   SQRT   sqrt(A); ERROR and 0 for A < 0
+ *   SIN    PICO-8 sin(A): A in turns, the result inverted
+ *   COS    PICO-8 cos(A)
+ *   ATAN2  PICO-8 atan2(A, B), A = dx, B = dy: turns in [0, 1)
+ *
+ * All registers are 16 bits, big endian:
+ *   +0x00 ID          'FX' (0x4658) when enabled
+ *   +0x02 CTRL        write: bits 0-3 operation, 0 none
+ *         STATUS      read: bit 0 BUSY, bit 2 ERROR, bits 8-11 operation
+ *   +0x04 A_HI
+ *   +0x06 A_LO
+ *   +0x08 B_HI
+ *   +0x0a B_LO
+ *   +0x0c RESULT_HI   read only
+ *   +0x0e RESULT_LO
+ */
+
+#ifndef FIXMATH_H
+#define FIXMATH_H
+
+#include <stdint.h>
+
+#ifndef _FIXMATH_BASE
+#define _FIXMATH_BASE		0x8f0090
+#endif
+#define _FIXMATH_SIZE		0x10
+
+#define FIXMATH_ID		0x4658
+
+#define FIXMATH_OP_NONE		0
+#define FIXMATH_OP_MUL		1
+#define FIXMATH_OP_DIV		2
+#define FIXMATH_OP_SQRT		3
+#define FIXMATH_OP_SIN		4
+#define FIXMATH_OP_COS		5
+#define FIXMATH_OP_ATAN2	6
+#define FIXMATH_OPS		7
+
+/* Latency of each operation in CPU cycles */
+#define FIXMATH_LAT_MUL		4
+#define FIXMATH_LAT_DIV		36
+#define FIXMATH_LAT_SQRT	20
+#define FIXMATH_LAT_SIN		12
+#define FIXMATH_LAT_COS		12
+#define FIXMATH_LAT_ATAN2	24
+
+#define FIXMATH_STATUS_BUSY	0x0001
+#define FIXMATH_STATUS_ERROR	0x0004
+
+#define FIXMATH_REG_ID		0x00
+#define FIXMATH_REG_CTRL	0x02
+#define FIXMATH_REG_A_HI	0x04
+#define FIXMATH_REG_A_LO	0x06
+#define FIXMATH_REG_B_HI	0x08
+#define FIXMATH_REG_B_LO	0x0a
+#define FIXMATH_REG_RESULT_HI	0x0c
+#define FIXMATH_REG_RESULT_LO	0x0e
+
+struct ss_buf;
+
+void fixmath_init(int enable);
+
+/* Word access to the register at offset reg */
+uint16_t fixmath_read(unsigned reg);
+void fixmath_write(unsigned reg, uint16_t d);
+
+/* Save state: the operands, the result and when it is ready */
+void fixmath_save_state(struct ss_buf *b);
+int fixmath_load_state(struct ss_buf *b);
+
+#endif /* FIXMATH_H */
@@ -0,0 +1,299 @@
+/*
+ * forkserver.c
+ *
+ * Fork server, see forkserver.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cycles.h"
+#include "forkserver.h"
+#include "fuzz.h"
+#include "async_io.h"
+#include "io_worker.h"
+#include "sd_image.h"
+#include "unixstuff.h"
+#ifdef DECODE_CACHE
+#include "decode_cache.h"
+#endif
+
+#if !defined(__WIN32__) && !defined(__EMSCRIPTEN__)
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define FORK_MAX_TESTS	256
+#define FORK_LINE	4096
+/* afl-fuzz's control and status pipes */
+#define AFL_CTL_FD	198
+#define AFL_STATUS_FD	199
+
+uw32 fork_pc = 0xffffffff;
+
+static char *server_path;
+static int server_post = -1;
+static bool server_pending;
+static bool in_child;
+
+static struct {
+	pid_t pid;
+	int fd;
+} tests[FORK_MAX_TESTS];
+
+void forkServerInit(const char *socket, int post, const char *pc, bool headless)
+{
+	if ((!socket || !*socket) && !fuzz_on)
+		return;
+	if (!headless) {
+		fprintf(stderr, "Fork server: needs --headless, not started\n");
+		fuzz_on = false;
+		return;
+	}
+	server_path = strdup(fuzz_on ? "afl" : socket);
+	server_post = post;
+	if (pc && *pc) {
+#ifdef DECODE_CACHE
+		fork_pc = strtoul(pc, NULL, 0) & ADDR_MASK_E;
+#else
+		fprintf(stderr, "Fork server: fork_server_pc needs DECODE_CACHE\n");
+#endif
+	}
+	if (server_post < 0 && fork_pc == 0xffffffff) {
+		fprintf(stderr, "Fork server: no fork_server_post or fork_server_pc, serving at once\n");
+		server_pending = true;
+	}
+}
+
+bool forkServerChild(void)
+{
+	return in_child;
+}
+
+void forkServerPost(unsigned d)
+{
+	if (server_path && (int)d == server_post) {
+		server_pending = true;
+		server_post = -1;
+	}
+}
+
+void forkServerBreak(void)
+{
+#ifdef DECODE_CACHE
+	uw32 addr = fork_pc;
+
+	// Not run yet: the children start with this instruction
+	pc--;
+	cpu_cycles -= cycle_table[code];
+	nInst = 0;
+	fork_pc = 0xffffffff;
+	dcache_invalidate_range(addr, 2);
+	server_pending = true;
+#endif
+}
+
+/* The first line the client sends, without the newline */
+static int read_request(int fd, char *line, size_t n)
+{
+	struct timeval tv = { 5, 0 };
+	size_t len = 0;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	while (len + 1 < n) {
+		ssize_t r = read(fd, line + len, 1);
+
+		if (r <= 0)
+			return -1;
+		if (line[len] == '\n')
+			break;
+		len++;
+	}
+	line[len] = 0;
+	if (len && line[len - 1] == '\r')
+		line[len - 1] = 0;
+	return 0;
+}
+
+static void reap(void)
+{
+	int status, i;
+	pid_t pid;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (i = 0; i < FORK_MAX_TESTS; i++) {
+			if (tests[i].pid != pid)
+				continue;
+			if (WIFEXITED(status))
+				dprintf(tests[i].fd, "EXIT %d\n", WEXITSTATUS(status));
+			else
+				dprintf(tests[i].fd, "EXIT signal %d\n", WTERMSIG(status));
+			close(tests[i].fd);
+			tests[i].pid = 0;
+			break;
+		}
+	}
+}
+
+/* Serves until shutdown; returns in a test's child too, to run the test */
+static void serve(void)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	int lfd, i;
+
+	signal(SIGPIPE, SIG_IGN);
+	lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	strncpy(sa.sun_path, server_path, sizeof(sa.sun_path) - 1);
+	unlink(server_path);
+	if (lfd < 0 || bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) ||
+	    listen(lfd, 16)) {
+		perror(server_path);
+		if (lfd >= 0)
+			close(lfd);
+		return;
+	}
+	// Children must not inherit queued writes or a half-flushed card
+	ioWorkerFlush();
+	sdImageFlush();
+	asyncIoFlush(-1);
+	printf("Fork server: listening on %s at pc=0x%lx\n", server_path,
+	       (unsigned long)((Ptr)pc - (Ptr)memBase));
+
+	while (!QLdone) {
+		struct pollfd p = { lfd, POLLIN, 0 };
+		char line[FORK_LINE];
+		int fd;
+		pid_t pid;
+
+		reap();
+		if (poll(&p, 1, 100) <= 0)
+			continue;
+		fd = accept(lfd, NULL, NULL);
+		if (fd < 0)
+			continue;
+		for (i = 0; i < FORK_MAX_TESTS && tests[i].pid; i++)
+			;
+		if (i == FORK_MAX_TESTS || read_request(fd, line, sizeof(line))) {
+			dprintf(fd, "EXIT busy\n");
+			close(fd);
+			continue;
+		}
+
+		pid = fork();
+		if (pid == 0) {
+			close(lfd);
+			in_child = true;
+			if (*line && chdir(line)) {
+				dprintf(fd, "Fork server: can't enter %s\n", line);
+				_exit(127);
+			}
+			dup2(fd, 1);
+			dup2(fd, 2);
+			close(fd);
+			ioWorkerForked();
+			asyncIoForked();
+			return;
+		}
+		if (pid < 0) {
+			dprintf(fd, "EXIT fork failed\n");
+			close(fd);
+			continue;
+		}
+		tests[i].pid = pid;
+		tests[i].fd = fd;
+	}
+
+	close(lfd);
+	unlink(server_path);
+}
+
+/* afl-fuzz's side: a child per 4 bytes on the control pipe, its pid and
+   then its wait status back on the status pipe */
+static void serve_afl(void)
+{
+	uint32_t msg = 0;
+	int status;
+	pid_t pid;
+
+	ioWorkerFlush();
+	sdImageFlush();
+	asyncIoFlush(-1);
+	fuzzAttach();
+	if (write(AFL_STATUS_FD, &msg, 4) != 4) {
+		printf("Fuzz: not under afl-fuzz, running the input once at pc=0x%lx\n",
+		       (unsigned long)((Ptr)pc - (Ptr)memBase));
+		fuzzStart(false);
+		return;
+	}
+
+	for (;;) {
+		// afl-fuzz has gone
+		if (read(AFL_CTL_FD, &msg, 4) != 4)
+			exit(0);
+		pid = fork();
+		if (pid == 0) {
+			close(AFL_CTL_FD);
+			close(AFL_STATUS_FD);
+			in_child = true;
+			ioWorkerForked();
+			asyncIoForked();
+			fuzzStart(true);
+			return;
+		}
+		if (pid < 0) {
+			perror("Fuzz: fork");
+			exit(1);
+		}
+		if (write(AFL_STATUS_FD, &pid, 4) != 4 ||
+		    waitpid(pid, &status, 0) < 0 ||
+		    write(AFL_STATUS_FD, &status, 4) != 4)
+			exit(1);
+	}
+}
+
+void forkServerPoll(void)
+{
+	if (!server_pending)
+		return;
+	server_pending = false;
+	if (fuzz_on)
+		serve_afl();
+	else
+		serve();
+}
+
+#else
+
+uw32 fork_pc = 0xffffffff;
+
+void forkServerInit(const char *socket, int post, const char *pc, bool headless)
+{
+	if (socket && *socket)
+		fprintf(stderr, "Fork server: not supported on this platform\n");
+}
+
+bool forkServerChild(void)
+{
+	return false;
+}
+
+void forkServerPost(unsigned d)
+{
+}
+
+void forkServerBreak(void)
+{
+}
+
+void forkServerPoll(void)
+{
+}
+
+#endif
@@ -0,0 +1,37 @@
+/*
+ * forkserver.h
+ *
+ * Fork server (--fork_server <socket>).  The emulator boots headless up
+ * to --fork_server_post <code> or --fork_server_pc <address> and then
+ * listens on a Unix socket instead of running on.  Each connection gets
+ * a copy-on-write child that carries on from that point: the client
+ * sends one line, the directory the test runs in ("" for the server's),
+ * and reads the test's stdout and stderr, then "EXIT <status>" once it
+ * has finished.  With --fuzz it serves afl-fuzz instead, see fuzz.h.
+ */
+
+#ifndef FORKSERVER_H
+#define FORKSERVER_H
+
+#include <stdbool.h>
+
+#include "QL68000.h"
+
+/* Guest address the decode cache traps, 0xffffffff if none */
+extern uw32 fork_pc;
+
+void forkServerInit(const char *socket, int post, const char *pc, bool headless);
+
+/* True in a test's child: nothing else is left to end the process */
+bool forkServerChild(void);
+
+/* The guest wrote POST code d */
+void forkServerPost(unsigned d);
+
+/* Decode cache handler for the instruction at fork_pc */
+void forkServerBreak(void);
+
+/* Emulator thread, between chunks: serve once the boot point is reached */
+void forkServerPoll(void);
+
+#endif /* FORKSERVER_H */
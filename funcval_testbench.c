@@ -15,25 +15,55 @@
  *     - 0x380026: Mouse Z scroll (signed 4-bit) + triggers movement packet
  *     - 0x380041: Screenshot register (write to trigger PNG save)
  *     - 0x380043: Trace trigger register (write to set trace flag for logging)
- *     - 0x380045: WAV recording control (write 1 to start, 0 to stop recording)
+ *     - 0x380045: WAV recording control (write 1 to start, 0 to stop recording;
+ *                 2 captures for the audio compare without writing a file)
+ *     - 0x380047: Frame capture (write non-zero to freeze the rendered frame
+ *                 for VGA readback, 0 to read the live display again)
+ *     - 0x380049: p8audio trace mark (write to trace the p8audio model
+ *                 around now, see --p8audio_trace_on)
+ *     - 0x3800A1: Golden image path (write bytes, NUL loads the reference)
+ *     - 0x3800A3: Golden mask path (write bytes, NUL loads the mask)
+ *     - 0x3800A5: Golden tolerance per 4-bit channel
+ *     - 0x3800A7: Golden compare (write to compare the frame; read status:
+ *                 0 = not run, 1 = match, 2 = mismatch, 0xFF = no reference)
+ *     - 0x3800A8: Golden mismatch count (long, pixels over the tolerance)
+ *     - 0x3800B1: Audio golden WAV path (write bytes, NUL loads the reference)
+ *     - 0x3800B3: Audio compare (write to compare the last recording; read
+ *                 status as for 0x3800A7)
+ *     - 0x3800B4: Audio alignment search (word, samples either way)
+ *     - 0x3800B6: Audio RMS difference tolerance (word)
+ *     - 0x3800B8: Audio peak difference tolerance (word)
+ *     - 0x3800BA: Audio offset found (signed word, recording minus reference)
+ *     - 0x3800BC: Audio RMS difference (long, rounded)
+ *     - 0x3800C0: Audio peak difference (long)
  *     - 0x380061: Joystick 0 input (bits for directions/buttons)
  *     - 0x380063: Joystick 1 input (bits for directions/buttons)
  *   - 0x390000-0x392000: VGA framebuffer readback (128x128x16-bit 0RGB, 1/6 scale downsampled)
  */
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/signal.h>
 #include <SDL2/SDL.h>
 #include "QL68000.h"
+#include "audio_mixer.h"
+#include "debug.h"
+#include "emulator_options.h"
 #include "funcval_testbench.h"
 #include "SDL2screen.h"
 #include "QL_sound.h"
+#include "io_worker.h"
+#include "p8audio_verilated.h"
+#include "pacer.h"
 
 /* External asyncTrace flag for test logging */
 extern bool asyncTrace;
 
+/* Directory for screenshots and recordings, "" for the current one */
+static const char *funcval_outdir = "";
+
 /* Screenshot counter for generating unique filenames */
 static int screenshot_counter = 0;
 
@@ -43,20 +73,13 @@ static FILE *wav_file = NULL;
 static int wav_sample_count = 0;
 static int wav_counter = 0;
 
-/* Audio callback shim state */
-static SDL_AudioCallback p8audio_callback = NULL;
-static void *p8audio_userdata = NULL;
-static SDL_AudioSpec p8audio_spec;
-static int p8audio_shim_active = 0;
+/* Audio mixer device state (audio_mixer.c uses SDL_OpenAudioDevice) */
+static SDL_AudioCallback mixer_callback = NULL;
+static void *mixer_userdata = NULL;
+static SDL_AudioSpec mixer_spec;
+static double mixer_src_pos = 0.0;
 static double p8audio_src_pos = 0.0;
 
-/* QL_sound.c audio device state (uses SDL_OpenAudioDevice) */
-static SDL_AudioCallback da_callback = NULL;
-static void *da_userdata = NULL;
-static SDL_AudioSpec da_spec;
-static int da_shim_active = 0;
-static double da_src_pos = 0.0;
-
 /* Keyboard registers (0x380001) */
 #define FUNCVAL_KB_SCANCODE      0x380001
 
@@ -76,6 +99,29 @@ static double da_src_pos = 0.0;
 /* WAV recording register (0x380045) - write to start/stop recording */
 #define FUNCVAL_WAV_REC_REG   	 0x380045
 
+/* Frame capture register (0x380047) - write to freeze/release the readback frame */
+#define FUNCVAL_FB_CAPTURE_REG   0x380047
+
+/* p8audio trace mark (0x380049) - write to trace the model around now */
+#define FUNCVAL_P8AUDIO_TRACE_REG 0x380049
+
+/* Golden image registers (0x3800A1-0x3800AB) */
+#define FUNCVAL_GOLDEN_PATH      0x3800A1
+#define FUNCVAL_GOLDEN_MASK      0x3800A3
+#define FUNCVAL_GOLDEN_TOL       0x3800A5
+#define FUNCVAL_GOLDEN_CMP       0x3800A7
+#define FUNCVAL_GOLDEN_COUNT     0x3800A8
+
+/* Audio golden registers (0x3800B1-0x3800C3) */
+#define FUNCVAL_AUDIO_PATH       0x3800B1
+#define FUNCVAL_AUDIO_CMP        0x3800B3
+#define FUNCVAL_AUDIO_ALIGN      0x3800B4
+#define FUNCVAL_AUDIO_RMS_TOL    0x3800B6
+#define FUNCVAL_AUDIO_PEAK_TOL   0x3800B8
+#define FUNCVAL_AUDIO_OFFSET     0x3800BA
+#define FUNCVAL_AUDIO_RMS        0x3800BC
+#define FUNCVAL_AUDIO_PEAK       0x3800C0
+
 /* Joystick registers (0x380061-0x380063) */
 #define FUNCVAL_JOY0             0x380061
 #define FUNCVAL_JOY1             0x380063
@@ -215,6 +261,39 @@ static ps2_state_t ps2_state = PS2_STATE_NORMAL;
 #define FUNCVAL_VGA_FB_START    0x390000
 #define FUNCVAL_VGA_FB_END      0x398000
 
+/* Frame frozen by the capture register; readback comes from here while set */
+static uint16_t fb_capture[128 * 128];
+static int fb_captured = 0;
+
+/* Golden image comparison: reference and mask in 0RGB, compared on the host */
+#define GOLDEN_PATH_MAX  256
+static uint16_t golden_ref[128 * 128];
+static uint16_t golden_mask[128 * 128];
+static int golden_have_ref = 0;
+static int golden_have_mask = 0;
+static int golden_tolerance = 0;
+static uint8_t golden_status = 0;
+static uint32_t golden_mismatches = 0;
+static char golden_path[GOLDEN_PATH_MAX];
+static int golden_path_len = 0;
+
+/* Audio golden comparison: the last recording is kept in memory and
+   compared against a reference WAV on the host */
+static int16_t *wav_capture = NULL;
+static size_t wav_capture_len = 0;
+static size_t wav_capture_max = 0;
+static int16_t *audio_ref = NULL;
+static size_t audio_ref_len = 0;
+static int audio_align = 0;
+static int audio_rms_tol = 0;
+static int audio_peak_tol = 0;
+static uint8_t audio_status = 0;
+static int16_t audio_offset = 0;
+static uint32_t audio_rms = 0;
+static uint32_t audio_peak = 0;
+static char audio_path[GOLDEN_PATH_MAX];
+static int audio_path_len = 0;
+
 /* Process PS/2 scancode byte - handles Set 2 protocol */
 static void funcval_latch_scancode(uint8_t data)
 {
@@ -239,6 +318,7 @@ static void funcval_latch_scancode(uint8_t data)
 
 	/* Update keyboard matrix */
 	SDLQLKeyrowChg(code, press);
+	inputPublish();
 
 	/* Reset state machine */
 	ps2_state = PS2_STATE_NORMAL;
@@ -254,7 +334,8 @@ static void funcval_save_screenshot(void)
 {
 	char filename[256];
 
-	snprintf(filename, sizeof(filename), "screenshot_%04d.ppm", screenshot_counter++);
+	snprintf(filename, sizeof(filename), "%s%sscreenshot_%04d.ppm", funcval_outdir,
+		 *funcval_outdir ? "/" : "", screenshot_counter++);
 	QLSDLSaveFuncvalScreenshot(filename);
 }
 
@@ -298,52 +379,79 @@ static void wav_write_header(FILE *f, int n_samples)
 }
 
 static void funcval_wav_stop_recording(void);
+static void funcval_offline_audio_tap(const int16_t *samples, int n);
 static void sighandler(int signo)
 {
+    ioWorkerFlush();
     funcval_wav_stop_recording();
 	raise(signo);
 }
 
-/* Start WAV recording */
-static void funcval_wav_start_recording(void)
+/* Start WAV recording; without to_file the samples are only kept for
+   the audio compare */
+static void funcval_wav_start_recording(int to_file)
 {
 	char filename[256];
 
 	if (wav_file) {
 		// Already recording, close previous file
+		ioWorkerFlush();
 		fclose(wav_file);
+		wav_file = NULL;
 	}
 
-	snprintf(filename, sizeof(filename), "funcval_audio_%04d.wav", wav_counter++);
-	wav_file = fopen(filename, "wb");
+	if (to_file) {
+		snprintf(filename, sizeof(filename), "%s%sfuncval_audio_%04d.wav", funcval_outdir,
+			 *funcval_outdir ? "/" : "", wav_counter++);
+		wav_file = fopen(filename, "wb");
 
-	if (!wav_file) {
-		printf("ERROR: Could not open %s for WAV recording\n", filename);
-		wav_recording = 0;
-		return;
-	}
+		if (!wav_file) {
+			printf("ERROR: Could not open %s for WAV recording\n", filename);
+			wav_recording = 0;
+			return;
+		}
 
-	// Write WAV header with size=0 (will be updated on close)
-	wav_write_header(wav_file, 0);
+		// Write WAV header with size=0 (will be updated on close)
+		wav_write_header(wav_file, 0);
+	}
 	wav_sample_count = 0;
+	wav_capture_len = 0;
+	if (p8audio_verilated_offline()) {
+		/* Only what is generated from now on belongs in this file */
+		p8audio_verilated_advance_to(pacerEmuNs());
+		p8audio_verilated_add_tap(funcval_offline_audio_tap);
+	}
 	wav_recording = 1;
 
 	atexit(funcval_wav_stop_recording);
 	signal(SIGINT, sighandler);
 	signal(SIGTERM, sighandler);
 
-	printf("Started WAV recording to %s\n", filename);
+	if (to_file)
+		printf("Started WAV recording to %s\n", filename);
+	else
+		printf("Started audio capture\n");
 }
 
 /* Stop WAV recording */
 static void funcval_wav_stop_recording(void)
 {
+	if (!wav_recording && !wav_file)
+		return;
+
+	// Let queued sample writes land, then rewrite the header with the
+	// actual sample count
+	if (p8audio_verilated_offline())
+		p8audio_verilated_remove_tap(funcval_offline_audio_tap);
+	audioMixerLock();
+	wav_recording = 0;
+	audioMixerUnlock();
 	if (!wav_file) {
-		wav_recording = 0;
+		printf("Stopped audio capture: %d samples\n", wav_sample_count);
+		wav_sample_count = 0;
 		return;
 	}
-
-	// Rewind and rewrite header with actual sample count
+	ioWorkerFlush();
 	fseek(wav_file, 0, SEEK_SET);
 	wav_write_header(wav_file, wav_sample_count);
 	fclose(wav_file);
@@ -355,28 +463,48 @@ static void funcval_wav_stop_recording(void)
 	wav_sample_count = 0;
 }
 
+/* Converted samples queued for the IO worker */
+typedef struct {
+	FILE *f;
+	int n;
+	int16_t s[];
+} wav_chunk;
+
+static void wav_write_chunk(void *arg)
+{
+	wav_chunk *c = arg;
+
+	fwrite(c->s, 2, c->n, c->f);
+	free(c);
+}
+
 static void funcval_capture_audio(const SDL_AudioSpec *spec, Uint8 *stream, int len, double *src_pos)
 {
-	if (!wav_recording || !wav_file || !spec || spec->format == 0) {
+	if (!wav_recording || !spec || spec->format == 0) {
 		return;
 	}
 
 	int samples = len / ((spec->format & 0xFF) / 8);  // Calculate number of samples
 
+	/* At most 4 output samples per input sample (5513 Hz upsampling) */
+	wav_chunk *c = malloc(sizeof(wav_chunk) + (size_t)samples * 4 * sizeof(int16_t));
+	if (!c)
+		return;
+	int16_t *out = c->s;
+	int n = 0;
+
 	if (spec->format == AUDIO_S16SYS && spec->freq == 44100) {
 		/* 44100 Hz S16 -> 22050 Hz S16: Simple 2:1 downsample */
 		int16_t *s16_stream = (int16_t *)stream;
 		for (int i = 0; i < samples; i += 2) {
 			if (i + 1 < samples) {
-				int16_t sample = ((int32_t)s16_stream[i] + (int32_t)s16_stream[i + 1]) / 2;
-				fwrite(&sample, 2, 1, wav_file);
-				wav_sample_count++;
+				out[n++] = ((int32_t)s16_stream[i] + (int32_t)s16_stream[i + 1]) / 2;
 			}
 		}
 	} else if (spec->format == AUDIO_S16SYS && spec->freq == 22050) {
 		/* 22050 Hz S16 -> 22050 Hz S16: Direct copy */
-		fwrite(stream, len, 1, wav_file);
-		wav_sample_count += samples;
+		memcpy(out, stream, (size_t)samples * 2);
+		n = samples;
 	} else if (spec->format == AUDIO_S8 && spec->freq == 24000) {
 		/* 24000 Hz S8 -> 22050 Hz S16: Resample and convert */
 		int8_t *s8_stream = (int8_t *)stream;
@@ -388,9 +516,7 @@ static void funcval_capture_audio(const SDL_AudioSpec *spec, Uint8 *stream, int
 			int src_idx = (int)(*src_pos);
 			if (src_idx >= samples) break;
 
-			int16_t sample = ((int16_t)s8_stream[src_idx]) << 8;
-			fwrite(&sample, 2, 1, wav_file);
-			wav_sample_count++;
+			out[n++] = ((int16_t)s8_stream[src_idx]) << 8;
 
 			*src_pos += src_rate / dst_rate;
 		}
@@ -400,78 +526,75 @@ static void funcval_capture_audio(const SDL_AudioSpec *spec, Uint8 *stream, int
 		int16_t *s16_stream = (int16_t *)stream;
 		for (int i = 0; i < samples; i++) {
 			for (int j = 0; j < 4; j++) {
-				fwrite(&s16_stream[i], 2, 1, wav_file);
-				wav_sample_count++;
+				out[n++] = s16_stream[i];
 			}
 		}
 	} else {
 		/* Fallback: write as-is (may be wrong format/rate) */
 		if (spec->format == AUDIO_S16SYS) {
-			fwrite(stream, len, 1, wav_file);
-			wav_sample_count += samples;
+			memcpy(out, stream, (size_t)samples * 2);
+			n = samples;
 		} else if (spec->format == AUDIO_S8) {
 			int8_t *s8_stream = (int8_t *)stream;
 			for (int i = 0; i < samples; i++) {
-				int16_t sample = ((int16_t)s8_stream[i]) << 8;
-				fwrite(&sample, 2, 1, wav_file);
-				wav_sample_count++;
+				out[n++] = ((int16_t)s8_stream[i]) << 8;
 			}
 		}
 	}
-}
 
-/* Audio callback wrapper for WAV recording */
-static void funcval_p8audio_callback_wrapper(void *userdata, Uint8 *stream, int len)
-{
-	/* Call the original callback first */
-	if (p8audio_callback) {
-		p8audio_callback(p8audio_userdata, stream, len);
+	/* Kept for the audio compare */
+	if (wav_capture_len + n > wav_capture_max) {
+		size_t max = wav_capture_max ? wav_capture_max * 2 : 22050 * 16;
+		int16_t *grown;
+
+		while (max < wav_capture_len + n)
+			max *= 2;
+		grown = realloc(wav_capture, max * sizeof(int16_t));
+		if (grown) {
+			wav_capture = grown;
+			wav_capture_max = max;
+		}
+	}
+	if (wav_capture_len + n <= wav_capture_max) {
+		memcpy(wav_capture + wav_capture_len, out, (size_t)n * sizeof(int16_t));
+		wav_capture_len += n;
 	}
 
-	funcval_capture_audio(&p8audio_spec, stream, len, &p8audio_src_pos);
-}
-
-/* QL_sound.c audio callback wrapper */
-static void funcval_da_audio_callback_wrapper(void *userdata, Uint8 *stream, int len)
-{
-	/* Call the original callback first */
-	if (da_callback) {
-		da_callback(da_userdata, stream, len);
+	wav_sample_count += n;
+	if (!wav_file) {
+		free(c);
+		return;
 	}
 
-	//funcval_capture_audio(&da_spec, stream, len, &da_src_pos);
+	/* File writes happen on the IO worker, off the audio thread */
+	c->f = wav_file;
+	c->n = n;
+	ioWorkerSubmit(wav_write_chunk, c);
 }
 
-/* SDL_OpenAudio shim for intercepting audio callbacks (p8_audio.c) */
-int SDL_OpenAudio_shim(SDL_AudioSpec *desired, SDL_AudioSpec *obtained)
+/* Offline audio tap: samples generated from emulated time on the emulator
+   thread, in the model's native 22050 Hz S16 format */
+static void funcval_offline_audio_tap(const int16_t *samples, int n)
 {
-	/* Store the original callback and userdata */
-	p8audio_callback = desired->callback;
-	p8audio_userdata = desired->userdata;
+	static const SDL_AudioSpec spec = { .freq = 22050, .format = AUDIO_S16SYS, .channels = 1 };
 
-	/* Replace with our wrapper */
-	desired->callback = funcval_p8audio_callback_wrapper;
-	desired->userdata = NULL;
-
-	/* Call the real SDL_OpenAudio (no define applies here, so this is the real function) */
-	int result = SDL_OpenAudio(desired, obtained);
+	funcval_capture_audio(&spec, (Uint8 *)samples, n * (int)sizeof(int16_t), &p8audio_src_pos);
+}
 
-	if (result == 0) {
-		/* Store the spec for format conversion */
-		if (obtained) {
-			p8audio_spec = *obtained;
-		} else {
-			p8audio_spec = *desired;
-		}
-		p8audio_shim_active = 1;
-		printf("FuncVal audio shim: Intercepted SDL_OpenAudio (freq=%d, format=0x%x, channels=%d, samples=%d)\n",
-		       p8audio_spec.freq, p8audio_spec.format, p8audio_spec.channels, p8audio_spec.samples);
+/* Audio mixer callback wrapper for WAV recording: every source, on one clock */
+static void funcval_mixer_callback_wrapper(void *userdata, Uint8 *stream, int len)
+{
+	/* Call the original callback first */
+	if (mixer_callback) {
+		mixer_callback(mixer_userdata, stream, len);
 	}
 
-	return result;
+	/* Offline audio reaches the WAV through the tap instead */
+	if (!p8audio_verilated_offline())
+		funcval_capture_audio(&mixer_spec, stream, len, &mixer_src_pos);
 }
 
-/* SDL_OpenAudioDevice shim for intercepting audio callbacks (QL_sound.c) */
+/* SDL_OpenAudioDevice shim for intercepting the audio mixer callback */
 SDL_AudioDeviceID SDL_OpenAudioDevice_shim(const char *device, int iscapture,
                                             const SDL_AudioSpec *desired,
                                             SDL_AudioSpec *obtained,
@@ -483,11 +606,11 @@ SDL_AudioDeviceID SDL_OpenAudioDevice_shim(const char *device, int iscapture,
 		modified_spec = *desired;
 
 		/* Store the original callback and userdata */
-		da_callback = modified_spec.callback;
-		da_userdata = modified_spec.userdata;
+		mixer_callback = modified_spec.callback;
+		mixer_userdata = modified_spec.userdata;
 
 		/* Replace with our wrapper */
-		modified_spec.callback = funcval_da_audio_callback_wrapper;
+		modified_spec.callback = funcval_mixer_callback_wrapper;
 		modified_spec.userdata = NULL;
 	}
 
@@ -500,22 +623,357 @@ SDL_AudioDeviceID SDL_OpenAudioDevice_shim(const char *device, int iscapture,
 	if (result != 0) {
 		/* Store the spec for format conversion */
 		if (obtained) {
-			da_spec = *obtained;
+			mixer_spec = *obtained;
 		} else if (desired) {
-			da_spec = modified_spec;
+			mixer_spec = modified_spec;
 		}
-		da_shim_active = 1;
 		printf("FuncVal audio shim: Intercepted SDL_OpenAudioDevice (freq=%d, format=0x%x, channels=%d, samples=%d)\n",
-		       da_spec.freq, da_spec.format, da_spec.channels, da_spec.samples);
+		       mixer_spec.freq, mixer_spec.format, mixer_spec.channels, mixer_spec.samples);
 	}
 
 	return result;
 }
 
+/* Next number of a PPM header, skipping whitespace and comments */
+static int ppm_number(FILE *f)
+{
+	int c, n = 0;
+
+	do {
+		c = getc(f);
+		if (c == '#') {
+			while (c != '\n' && c != EOF)
+				c = getc(f);
+		}
+	} while (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+	if (c < '0' || c > '9')
+		return -1;
+	while (c >= '0' && c <= '9') {
+		n = n * 10 + c - '0';
+		c = getc(f);
+	}
+	return n;
+}
+
+/* Load a P3 or P6 PPM as a 128x128 0RGB frame; screenshots scaled by
+   a whole factor (as funcval_save_screenshot writes them) are sampled
+   once per block */
+static int funcval_load_ppm(const char *path, uint16_t *out)
+{
+	FILE *f = fopen(path, "rb");
+	int magic, w, h, max, scale, x, y, sx, sy, i;
+	uint8_t *img;
+
+	if (!f) {
+		printf("FuncVal golden: could not open %s\n", path);
+		return -1;
+	}
+	magic = getc(f) == 'P' ? getc(f) : 0;
+	w = ppm_number(f);
+	h = ppm_number(f);
+	max = ppm_number(f);
+	if ((magic != '3' && magic != '6') || w <= 0 || w != h || w % 128 ||
+	    max <= 0 || max > 255) {
+		printf("FuncVal golden: %s is not a square 8-bit PPM of 128x128 or a multiple\n", path);
+		fclose(f);
+		return -1;
+	}
+	img = malloc((size_t)w * h * 3);
+	if (!img) {
+		fclose(f);
+		return -1;
+	}
+	for (i = 0; i < w * h * 3; i++) {
+		int v = magic == '6' ? getc(f) : ppm_number(f);
+
+		if (v < 0) {
+			printf("FuncVal golden: %s is truncated\n", path);
+			free(img);
+			fclose(f);
+			return -1;
+		}
+		img[i] = v * 255 / max;
+	}
+	fclose(f);
+
+	scale = w / 128;
+	for (y = 0; y < 128; y++) {
+		sy = y * scale;
+		for (x = 0; x < 128; x++) {
+			const uint8_t *p;
+
+			sx = x * scale;
+			p = &img[((size_t)sy * w + sx) * 3];
+			out[y * 128 + x] = ((p[0] >> 4) << 8) | ((p[1] >> 4) << 4) | (p[2] >> 4);
+		}
+	}
+	free(img);
+	return 0;
+}
+
+/* Byte written to one of the path registers */
+static void funcval_golden_path_byte(aw8 data, int mask)
+{
+	if (data && golden_path_len < GOLDEN_PATH_MAX - 1) {
+		golden_path[golden_path_len++] = data;
+		return;
+	}
+	if (data)
+		return;
+	golden_path[golden_path_len] = 0;
+	golden_path_len = 0;
+	if (mask)
+		golden_have_mask = funcval_load_ppm(golden_path, golden_mask) == 0;
+	else
+		golden_have_ref = funcval_load_ppm(golden_path, golden_ref) == 0;
+}
+
+/* Pixels whose 4-bit channels differ by more than the tolerance, outside
+   the mask's black pixels; branch free so the compiler vectorises it */
+static uint32_t funcval_golden_diff(const uint16_t *frame)
+{
+	uint32_t count = 0;
+	int i;
+
+	for (i = 0; i < 128 * 128; i++) {
+		int a = frame[i], b = golden_ref[i];
+		int dr = ((a >> 8) & 0xF) - ((b >> 8) & 0xF);
+		int dg = ((a >> 4) & 0xF) - ((b >> 4) & 0xF);
+		int db = (a & 0xF) - (b & 0xF);
+		int over = (dr > golden_tolerance) | (-dr > golden_tolerance) |
+			   (dg > golden_tolerance) | (-dg > golden_tolerance) |
+			   (db > golden_tolerance) | (-db > golden_tolerance);
+
+		count += over & (!golden_have_mask | (golden_mask[i] != 0));
+	}
+	return count;
+}
+
+static void funcval_golden_compare(void)
+{
+	static uint16_t frame[128 * 128];
+
+	if (!golden_have_ref) {
+		golden_status = 0xFF;
+		golden_mismatches = 0;
+		return;
+	}
+	if (fb_captured)
+		memcpy(frame, fb_capture, sizeof(frame));
+	else if (QLSDLCaptureFramebuffer(frame) < 0) {
+		golden_status = 0xFF;
+		return;
+	}
+	golden_mismatches = funcval_golden_diff(frame);
+	golden_status = golden_mismatches ? 2 : 1;
+	printf("FuncVal golden: %s, %u pixels differ\n",
+	       golden_mismatches ? "mismatch" : "match", golden_mismatches);
+}
+
+static uint32_t le_bytes(const uint8_t *p, int n)
+{
+	uint32_t v = 0;
+
+	while (n--)
+		v = (v << 8) | p[n];
+	return v;
+}
+
+/* Load a PCM WAV at the recording's 22050 Hz as mono S16, stereo mixed
+   down and 8-bit widened as the capture does */
+static int funcval_load_wav(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	uint8_t hdr[16], *data;
+	uint32_t size, frames, i;
+	int channels = 0, bits = 0, bytes;
+	int16_t *ref;
+
+	if (!f) {
+		printf("FuncVal audio golden: could not open %s\n", path);
+		return -1;
+	}
+	if (fread(hdr, 1, 12, f) != 12 || memcmp(hdr, "RIFF", 4) || memcmp(hdr + 8, "WAVE", 4)) {
+		printf("FuncVal audio golden: %s is not a WAV file\n", path);
+		fclose(f);
+		return -1;
+	}
+	for (;;) {
+		if (fread(hdr, 1, 8, f) != 8) {
+			printf("FuncVal audio golden: %s has no PCM data\n", path);
+			fclose(f);
+			return -1;
+		}
+		size = le_bytes(hdr + 4, 4);
+		if (!memcmp(hdr, "data", 4) && channels)
+			break;
+		if (!memcmp(hdr, "fmt ", 4) && size >= 16) {
+			if (fread(hdr, 1, 16, f) != 16)
+				memset(hdr, 0, 16);
+			channels = le_bytes(hdr + 2, 2);
+			bits = le_bytes(hdr + 14, 2);
+			if (le_bytes(hdr, 2) != 1 || channels < 1 || channels > 2 ||
+			    (bits != 8 && bits != 16) || le_bytes(hdr + 4, 4) != 22050) {
+				printf("FuncVal audio golden: %s is not 22050 Hz 8 or 16-bit PCM\n", path);
+				fclose(f);
+				return -1;
+			}
+			size -= 16;
+		}
+		fseek(f, size + (size & 1), SEEK_CUR);
+	}
+
+	bytes = channels * bits / 8;
+	frames = size / bytes;
+	data = malloc((size_t)frames * bytes);
+	ref = malloc(((size_t)frames + 1) * sizeof(int16_t));
+	if (!data || !ref || fread(data, bytes, frames, f) != frames) {
+		printf("FuncVal audio golden: could not read %s\n", path);
+		free(data);
+		free(ref);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	for (i = 0; i < frames; i++) {
+		const uint8_t *p = data + (size_t)i * bytes;
+		int l, r;
+
+		if (bits == 8) {
+			l = (p[0] - 128) << 8;
+			r = channels == 2 ? (p[1] - 128) << 8 : l;
+		} else {
+			l = (int16_t)le_bytes(p, 2);
+			r = channels == 2 ? (int16_t)le_bytes(p + 2, 2) : l;
+		}
+		ref[i] = (l + r) / 2;
+	}
+	free(data);
+	free(audio_ref);
+	audio_ref = ref;
+	audio_ref_len = frames;
+	return 0;
+}
+
+static void funcval_audio_path_byte(aw8 data)
+{
+	if (data && audio_path_len < GOLDEN_PATH_MAX - 1) {
+		audio_path[audio_path_len++] = data;
+		return;
+	}
+	if (data)
+		return;
+	audio_path[audio_path_len] = 0;
+	audio_path_len = 0;
+	funcval_load_wav(audio_path);
+}
+
+/* Squared difference summed over where the recording, offset samples
+   later than the reference, overlaps it; peak set when non-NULL */
+static uint64_t funcval_audio_diff(int offset, size_t *n, uint32_t *peak)
+{
+	int64_t start = offset < 0 ? -offset : 0;
+	int64_t end = (int64_t)wav_capture_len - offset;
+	uint64_t sum = 0;
+	int64_t i;
+
+	if (end > (int64_t)audio_ref_len)
+		end = audio_ref_len;
+	*n = end > start ? end - start : 0;
+	for (i = start; i < end; i++) {
+		int d = wav_capture[i + offset] - audio_ref[i];
+
+		sum += (int64_t)d * d;
+		if (peak && (uint32_t)abs(d) > *peak)
+			*peak = abs(d);
+	}
+	return sum;
+}
+
+/* The recording at its best alignment to the reference within the search
+   range, by mean squared difference; nearer offsets win ties */
+static void funcval_audio_compare(void)
+{
+	double best = -1, rms;
+	size_t n, best_n = 0;
+	int k, offset;
+
+	if (!audio_ref) {
+		audio_status = 0xFF;
+		return;
+	}
+	if (wav_recording && p8audio_verilated_offline())
+		p8audio_verilated_advance_to(pacerEmuNs());
+
+	audioMixerLock();
+	for (k = 0; k <= 2 * audio_align; k++) {
+		double mean;
+
+		offset = (k & 1) ? (k + 1) / 2 : -(k / 2);
+		mean = (double)funcval_audio_diff(offset, &n, NULL);
+		if (!n)
+			continue;
+		mean /= n;
+		if (best < 0 || mean < best) {
+			best = mean;
+			best_n = n;
+			audio_offset = offset;
+		}
+	}
+	audio_peak = 0;
+	if (best_n)
+		funcval_audio_diff(audio_offset, &n, &audio_peak);
+	audioMixerUnlock();
+
+	if (!best_n) {
+		audio_status = 0xFF;
+		audio_rms = 0;
+		printf("FuncVal audio golden: no recorded samples to compare\n");
+		return;
+	}
+	rms = sqrt(best);
+	audio_rms = (uint32_t)(rms + 0.5);
+	audio_status = rms <= audio_rms_tol && audio_peak <= (uint32_t)audio_peak_tol ? 1 : 2;
+	printf("FuncVal audio golden: %s at offset %d, RMS %.1f, peak %u over %zu samples\n",
+	       audio_status == 1 ? "match" : "mismatch", audio_offset, rms, audio_peak, best_n);
+}
+
+/* Result registers from FUNCVAL_AUDIO_OFFSET, big-endian */
+static uint8_t funcval_audio_result_byte(aw32 addr)
+{
+	const uint8_t r[10] = {
+		(uint16_t)audio_offset >> 8, (uint16_t)audio_offset & 0xFF,
+		audio_rms >> 24, audio_rms >> 16, audio_rms >> 8, audio_rms,
+		audio_peak >> 24, audio_peak >> 16, audio_peak >> 8, audio_peak,
+	};
+
+	return r[addr - FUNCVAL_AUDIO_OFFSET];
+}
+
+static int funcval_is_audio_result(aw32 addr, int size)
+{
+	return addr >= FUNCVAL_AUDIO_OFFSET && addr + size <= FUNCVAL_AUDIO_PEAK + 4;
+}
+
 /* Initialize FuncVal testbench */
 void funcval_init(void)
 {
-	/* Nothing to initialize - we read directly from SDL window */
+	const char *ref = emulatorOptionString("funcval_golden");
+	const char *mask = emulatorOptionString("funcval_golden_mask");
+	const char *wav = emulatorOptionString("funcval_audio_golden");
+
+	/* Nothing else to initialize - we read directly from SDL window */
+	funcval_outdir = emulatorOptionString("funcval_outdir");
+	golden_tolerance = emulatorOptionInt("funcval_golden_tolerance");
+	if (ref && *ref)
+		golden_have_ref = funcval_load_ppm(ref, golden_ref) == 0;
+	if (mask && *mask)
+		golden_have_mask = funcval_load_ppm(mask, golden_mask) == 0;
+	audio_align = emulatorOptionInt("funcval_audio_align");
+	audio_rms_tol = emulatorOptionInt("funcval_audio_rms");
+	audio_peak_tol = emulatorOptionInt("funcval_audio_peak");
+	if (wav && *wav)
+		funcval_load_wav(wav);
 }
 
 /* Check if address is in FuncVal testbench range */
@@ -544,7 +1002,8 @@ static int funcval_addr_to_coords(aw32 addr, int *vga_x, int *vga_y)
 	*vga_x = downsamp_x * 6 + 3 + 130;
 	*vga_y = downsamp_y * 6 + 3;
 
-	printf("Mapping FuncVal address 0x%06X (offset 0x%06X) to downsampled space (%d, %d), VGA coordinates (%d, %d)\n", addr, offset, downsamp_x, downsamp_y, *vga_x, *vga_y);
+	if (V3)
+		printf("Mapping FuncVal address 0x%06X (offset 0x%06X) to downsampled space (%d, %d), VGA coordinates (%d, %d)\n", addr, offset, downsamp_x, downsamp_y, *vga_x, *vga_y);
 
 	/* Check downsampled bounds */
 	if (downsamp_x >= 128 || downsamp_y >= 128)
@@ -559,6 +1018,21 @@ rw8 funcval_read_byte(aw32 addr)
 	int x, y;
 	uint16_t pixel;
 
+	if (addr == FUNCVAL_GOLDEN_CMP)
+		return golden_status;
+	if (addr >= FUNCVAL_GOLDEN_COUNT && addr < FUNCVAL_GOLDEN_COUNT + 4)
+		return golden_mismatches >> (8 * (FUNCVAL_GOLDEN_COUNT + 3 - addr));
+	if (addr == FUNCVAL_AUDIO_CMP)
+		return audio_status;
+	if (funcval_is_audio_result(addr, 1))
+		return funcval_audio_result_byte(addr);
+
+	/* Captured frame: a plain load */
+	if (fb_captured && addr >= FUNCVAL_VGA_FB_START && addr < FUNCVAL_VGA_FB_END) {
+		pixel = fb_capture[(addr - FUNCVAL_VGA_FB_START) >> 1];
+		return (addr & 1) ? pixel & 0xFF : pixel >> 8;
+	}
+
 	/* VGA framebuffer readback */
 	if (funcval_addr_to_coords(addr, &x, &y) == 0) {
 		if (QLSDLReadFramebufferPixel(x, y, &pixel) == 0) {
@@ -581,6 +1055,16 @@ rw16 funcval_read_word(aw32 addr)
 	int x, y;
 	uint16_t pixel;
 
+	if (addr == FUNCVAL_GOLDEN_COUNT)
+		return golden_mismatches >> 16;
+	if (addr == FUNCVAL_GOLDEN_COUNT + 2)
+		return golden_mismatches & 0xFFFF;
+	if (funcval_is_audio_result(addr, 2))
+		return (funcval_audio_result_byte(addr) << 8) | funcval_audio_result_byte(addr + 1);
+
+	if (fb_captured && addr >= FUNCVAL_VGA_FB_START && addr < FUNCVAL_VGA_FB_END)
+		return fb_capture[(addr - FUNCVAL_VGA_FB_START) >> 1];
+
 	/* VGA framebuffer readback */
 	if (funcval_addr_to_coords(addr, &x, &y) == 0) {
 		if (QLSDLReadFramebufferPixel(x, y, &pixel) == 0) {
@@ -599,6 +1083,19 @@ rw32 funcval_read_long(aw32 addr)
 	int x, y;
 	uint16_t pixel1, pixel2;
 
+	if (addr == FUNCVAL_GOLDEN_COUNT)
+		return golden_mismatches;
+	if (funcval_is_audio_result(addr, 4))
+		return ((rw32)funcval_audio_result_byte(addr) << 24) |
+		       (funcval_audio_result_byte(addr + 1) << 16) |
+		       (funcval_audio_result_byte(addr + 2) << 8) | funcval_audio_result_byte(addr + 3);
+
+	if (fb_captured && addr >= FUNCVAL_VGA_FB_START && addr + 3 < FUNCVAL_VGA_FB_END) {
+		aw32 i = (addr - FUNCVAL_VGA_FB_START) >> 1;
+
+		return ((aw32)fb_capture[i] << 16) | fb_capture[i + 1];
+	}
+
 	/* VGA framebuffer readback - read two pixels */
 	if (funcval_addr_to_coords(addr, &x, &y) == 0) {
 		if (QLSDLReadFramebufferPixel(x, y, &pixel1) == 0 &&
@@ -631,28 +1128,69 @@ void funcval_write_byte(aw32 addr, aw8 data)
 	/* asyncTrace register - set flag on any non-zero write */
 	if (addr == FUNCVAL_ASYNCTRACE_REG) {
 		asyncTrace = (data != 0);
+		ExecuteLoopReselect();
 		return;
 	}
 
 	/* WAV recording register - start/stop recording */
 	if (addr == FUNCVAL_WAV_REC_REG) {
 		if (data && !wav_recording) {
-			funcval_wav_start_recording();
+			funcval_wav_start_recording(data != 2);
 		} else if (!data && wav_recording) {
+			/* Offline: everything up to this write is in the file */
+			p8audio_verilated_advance_to(pacerEmuNs());
 			funcval_wav_stop_recording();
 		}
 		return;
 	}
 
+	/* Frame capture register - freeze the frame once instead of rendering per read */
+	if (addr == FUNCVAL_FB_CAPTURE_REG) {
+		fb_captured = data && QLSDLCaptureFramebuffer(fb_capture) == 0;
+		return;
+	}
+
+	/* p8audio trace mark - a trace window around this write */
+	if (addr == FUNCVAL_P8AUDIO_TRACE_REG) {
+		p8audio_verilated_trace_mark(pacerEmuNs());
+		return;
+	}
+
+	/* Golden image registers */
+	if (addr == FUNCVAL_GOLDEN_PATH || addr == FUNCVAL_GOLDEN_MASK) {
+		funcval_golden_path_byte(data, addr == FUNCVAL_GOLDEN_MASK);
+		return;
+	}
+	if (addr == FUNCVAL_GOLDEN_TOL) {
+		golden_tolerance = data;
+		return;
+	}
+	if (addr == FUNCVAL_GOLDEN_CMP) {
+		funcval_golden_compare();
+		return;
+	}
+
+	/* Audio golden registers */
+	if (addr == FUNCVAL_AUDIO_PATH) {
+		funcval_audio_path_byte(data);
+		return;
+	}
+	if (addr == FUNCVAL_AUDIO_CMP) {
+		funcval_audio_compare();
+		return;
+	}
+
 	/* Joystick registers */
 	if (addr == FUNCVAL_JOY0) {
 		joy_state[0] = data & 0xff;
-		joy_latched[0] |= data & 0xff;
+		inputLatchSet(&joy_latched[0], data & 0xff);
+		inputPublish();
 	}
 
 	if (addr == FUNCVAL_JOY1) {
 		joy_state[1] = data & 0xff;
-		joy_latched[1] |= data & 0xff;
+		inputLatchSet(&joy_latched[1], data & 0xff);
+		inputPublish();
 	}
 
 	/* Built-in keyboard matrix writes (0x380080-0x380087)
@@ -683,6 +1221,7 @@ void funcval_write_byte(aw32 addr, aw8 data)
 				       row, bit, scancode, code, bit_set ? "press" : "release");
 			}
 		}
+		inputPublish();
 		return;
 	}
 
@@ -711,13 +1250,28 @@ void funcval_write_word(aw32 addr, aw16 data)
 		return;
 	}
 
+	/* Audio golden settings */
+	if (addr == FUNCVAL_AUDIO_ALIGN) {
+		audio_align = data;
+		return;
+	}
+	if (addr == FUNCVAL_AUDIO_RMS_TOL) {
+		audio_rms_tol = data;
+		return;
+	}
+	if (addr == FUNCVAL_AUDIO_PEAK_TOL) {
+		audio_peak_tol = data;
+		return;
+	}
+
 	/* Mouse Z scroll - latch all staged values and trigger update */
 	if (addr == FUNCVAL_MOUSE_Z) {
 		sdl_mouse_buttons = pending_mouse_buttons;
-		sdl_mouse_buttons_latched |= pending_mouse_buttons;
+		inputLatchSet(&sdl_mouse_buttons_latched, pending_mouse_buttons);
 		sdl_mouse_x_accum += pending_mouse_x;
 		sdl_mouse_y_accum += pending_mouse_y;
 		sdl_mouse_z_accum += (int16_t)data;
+		inputPublish();
 		pending_mouse_buttons = 0;
 		pending_mouse_x = 0;
 		pending_mouse_y = 0;
@@ -30,8 +30,7 @@ void funcval_write_long(aw32 addr, aw32 data);
 /* Check if address is in FuncVal testbench range */
 int funcval_is_testbench_addr(aw32 addr);
 
-/* SDL audio shims for audio recording */
-int SDL_OpenAudio_shim(SDL_AudioSpec *desired, SDL_AudioSpec *obtained);
+/* SDL audio shim for audio recording, applied to the audio mixer */
 SDL_AudioDeviceID SDL_OpenAudioDevice_shim(const char *device, int iscapture,
                                             const SDL_AudioSpec *desired,
                                             SDL_AudioSpec *obtained,
@@ -0,0 +1,393 @@
+/*
+ * fuse.c
+ *
+ * Opcode pair fusion and the pair counter, see fuse.h.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "QL68000.h"
+#include "btrace.h"
+#include "cycles.h"
+#include "fuse.h"
+#include "memaccess.h"
+
+#define PAIR_BITS	16
+#define PAIR_SLOTS	(1 << PAIR_BITS)
+#define PAIR_PROBES	16
+#define PAIR_SHOW	32
+
+Cond fuse_enabled;
+Cond fuse_counting;
+
+static struct {
+	uw32 key;		/* first opcode << 16 | second */
+	uint64_t n;		/* 0 if unused */
+} pairs[PAIR_SLOTS];
+static uint64_t pairs_total, pairs_dropped;
+static uw16 prev_code;
+
+/* No extension words, whatever the opcode does */
+static bool one_word(uw16 c)
+{
+	unsigned mode = (c >> 3) & 7;
+	unsigned size = (c >> 6) & 3;
+
+	switch (c >> 12) {
+	case 0x1: case 0x2: case 0x3:		/* move, movea */
+		return mode <= 4 && ((c >> 6) & 7) <= 4;
+	case 0x4:				/* negx, clr, neg, not, tst */
+		return ((c & 0xf900) == 0x4000 || (c & 0xff00) == 0x4a00) &&
+		       size != 3 && mode <= 4;
+	case 0x5:				/* addq, subq */
+		return size != 3 && mode <= 4;
+	case 0x7:				/* moveq */
+		return true;
+	case 0x8: case 0x9: case 0xb: case 0xc: case 0xd:
+		return mode <= 4;
+	case 0xe:				/* shifts and rotates */
+		return size != 3 || mode <= 4;
+	}
+	return false;
+}
+
+static bool is_bcc(uw16 c)
+{
+	// Bcc.s or Bcc.w, not BRA/BSR and no odd displacement
+	return (c & 0xf001) == 0x6000 && (c & 0x0e00) != 0;
+}
+
+static bool is_dbf(uw16 c)
+{
+	return (c & 0xfff8) == 0x51c8;
+}
+
+/* Condition cc of the 68000 after the pending lazy subtract or compare */
+static Cond lazy_cond(int cc)
+{
+	uw32 m = (cc_op & 3) == 1 ? 0xff : (cc_op & 3) == 2 ? 0xffff : 0xffffffff;
+	uw32 ud = cc_dst & m, us = cc_src & m;
+	w32 sd, ss;
+
+	switch (cc_op & 3) {
+	case 1:
+		sd = (w8)cc_dst;
+		ss = (w8)cc_src;
+		break;
+	case 2:
+		sd = (w16)cc_dst;
+		ss = (w16)cc_src;
+		break;
+	default:
+		sd = cc_dst;
+		ss = cc_src;
+		break;
+	}
+
+	switch (cc) {
+	case 2:  return ud > us;		/* HI */
+	case 3:  return ud <= us;		/* LS */
+	case 4:  return ud >= us;		/* CC */
+	case 5:  return ud < us;		/* CS */
+	case 12: return sd >= ss;		/* GE */
+	case 13: return sd < ss;		/* LT */
+	case 14: return sd > ss;		/* GT */
+	case 15: return sd <= ss;		/* LE */
+	}
+	return ConditionTrue[cc]();
+}
+
+/* Set up the instruction at pc as the second of the pair if it still
+   looks like one and the budget allows; false leaves it to the loop */
+static inline bool fuse_next(uw16 c)
+{
+	if (unlikely(nInst <= 0 || extraFlag || BTRACE_ANY()))
+		return false;
+	nInst--;
+	code = c;
+	cpu_cycles += cycle_table[c];
+	pc++;
+	return true;
+}
+
+static void fuse_bcc(void)
+{
+	uw16 c;
+	int cc;
+	Cond taken;
+
+	QLUX_HANDLER(code)();
+	c = RW(pc);
+	if (!is_bcc(c) || !fuse_next(c))
+		return;
+
+	cc = (c >> 8) & 15;
+	// N and Z are always current, the rest only after a subtract or compare
+	if (cc == 6)
+		taken = !zero;
+	else if (cc == 7)
+		taken = zero;
+	else if (cc_op >= CC_SUB_B)
+		taken = lazy_cond(cc);
+	else
+		taken = ConditionTrue[cc]();
+
+	if (c & 0xff) {
+		if (taken)
+			pc = (uw16 *)((Ptr)pc + (w8)c);
+	} else if (taken) {
+		SetPC((Ptr)pc - (Ptr)memBase + (w16)RW(pc));
+	} else {
+		pc++;
+	}
+}
+
+static void fuse_dbf(void)
+{
+	uw16 c, *d;
+
+	QLUX_HANDLER(code)();
+	c = RW(pc);
+	if (!is_dbf(c) || !fuse_next(c))
+		return;
+
+	d = (uw16 *)((Ptr)&reg[c & 7] + RWO);
+	if ((*d)-- == 0) {
+		pc++;
+		return;
+	}
+	pc = (uw16 *)((Ptr)pc + (w16)RW(pc));
+	if ((uintptr_t)pc & 1) {
+		exception = 3;
+		extraFlag = true;
+		nInst2 = nInst;
+		nInst = 0;
+		readOrWrite = 16;
+		badAddress = (Ptr)pc - (Ptr)memBase;
+		badCodeAddress = true;
+	}
+}
+
+/* move.x (Ay)+,(Ax)+ */
+static bool is_copy(uw16 c)
+{
+	return (c & 0xc1f8) == 0x00d8 && (c & 0x3000);
+}
+
+/* move.x Dm,(Ax)+ or clr.x (Ax)+ */
+static bool is_fill(uw16 c)
+{
+	return ((c & 0xc1f8) == 0x00c0 && (c & 0x3000)) ||
+	       ((c & 0xff38) == 0x4218 && (c & 0x00c0) != 0x00c0);
+}
+
+static unsigned move_size(uw16 c)
+{
+	if ((c & 0xf000) == 0x4000)
+		return 1 << ((c >> 6) & 3);
+	return (c & 0x3000) == 0x1000 ? 1 : (c & 0x3000) == 0x3000 ? 2 : 4;
+}
+
+/*
+ * Iterations of the DBRA loop round the instruction before pc that can
+ * be done in bulk: all but the last one left, as far as the budget goes.
+ * The last always runs through the handlers, which leave the flags, the
+ * exit and anything unusual exactly as the interpreter would.
+ */
+static uw32 loop_bulk(void)
+{
+	uw16 c = RW(pc);
+	uw32 k;
+
+	if (!is_dbf(c) || (w16)RW(pc + 1) != -4 || BTRACE_ANY() || extraFlag)
+		return 0;
+	k = *(uw16 *)((Ptr)&reg[c & 7] + RWO);
+	if (k > (uw32)nInst / 2)
+		k = nInst / 2;
+	return k;
+}
+
+/* Account for k iterations done in bulk */
+static void loop_commit(uw32 k)
+{
+	uw16 c = RW(pc);
+
+	nInst -= 2 * k;
+	cpu_cycles += (uint64_t)k * (cycle_table[code] + cycle_table[c]);
+	*(uw16 *)((Ptr)&reg[c & 7] + RWO) -= k;
+}
+
+/* len bytes at dst don't cover the loop's own code */
+static bool loop_clear_of(uw32 dst, uw32 len)
+{
+	uw32 start = (Ptr)pc - (Ptr)memBase - 2;
+
+	return dst >= start + 6 || dst + len <= start;
+}
+
+static bool loop_regs_ok(unsigned size, int x, uw32 addr)
+{
+	// a7 steps by 2 for bytes, and odd word addresses trap
+	return size == 1 ? x != 7 : !(addr & 1);
+}
+
+static void fuse_copy(void)
+{
+	uw32 k = loop_bulk();
+
+	if (k) {
+		int x = (code >> 9) & 7, y = code & 7;
+		unsigned size = move_size(code);
+		uw32 src = aReg[y] & ADDR_MASK, dst = aReg[x] & ADDR_MASK;
+		uw32 len = k * size;
+		void *s, *d;
+
+		// Forward element copy: an overlap with dst ahead of src repeats data
+		if (x != y && loop_regs_ok(size, x, dst) && loop_regs_ok(size, y, src) &&
+		    (dst <= src || dst >= src + len) && loop_clear_of(dst, len) &&
+		    (s = MemoryCPURange(src, len, 0)) &&
+		    (d = MemoryCPURange(dst, len, 1))) {
+			memmove(d, s, len);
+			aReg[y] += len;
+			aReg[x] += len;
+			loop_commit(k);
+			MemoryDMAWritten(dst, len);
+		}
+	}
+	fuse_dbf();
+}
+
+static void fuse_fill(void)
+{
+	uw32 k = loop_bulk();
+
+	if (k) {
+		bool clr = (code & 0xf000) == 0x4000;
+		int x = clr ? code & 7 : (code >> 9) & 7;
+		unsigned size = move_size(code);
+		uw32 dst = aReg[x] & ADDR_MASK, len = k * size;
+		uw32 v = clr ? 0 : reg[code & 7];
+		uw8 b[4] = { v >> 24, v >> 16, v >> 8, v };
+		uw8 *d;
+		uw32 i;
+
+		// The counter can't be the value stored
+		if ((clr || (code & 7) != (RW(pc) & 7)) &&
+		    loop_regs_ok(size, x, dst) && loop_clear_of(dst, len) &&
+		    (d = MemoryCPURange(dst, len, 1))) {
+			if (size == 1 || (v & (size == 2 ? 0xffff : 0xffffffff)) == 0) {
+				memset(d, v & 0xff, len);
+			} else {
+				for (i = 0; i < len; i += size)
+					memcpy(d + i, b + 4 - size, size);
+			}
+			aReg[x] += len;
+			loop_commit(k);
+			MemoryDMAWritten(dst, len);
+		}
+	}
+	fuse_dbf();
+}
+
+static void (*fuse_rule(uw16 c1, uw16 c2))(void)
+{
+	if (!one_word(c1))
+		return NULL;
+	if (is_bcc(c2))
+		return fuse_bcc;
+	if (is_dbf(c2))
+		return fuse_dbf;
+	return NULL;
+}
+
+void (*fuse_select(uw32 addr, uw16 c))(void)
+{
+	void (*h)(void);
+
+	if (!fuse_enabled || addr + 4 > (uw32)RTOP)
+		return QLUX_HANDLER(c);
+	h = fuse_rule(c, (uw16)RW((Ptr)memBase + addr + 2));
+	// The DBRA loops round this one instruction that copy or fill memory
+	if (h == fuse_dbf && addr + 6 <= (uw32)RTOP &&
+	    (w16)RW((Ptr)memBase + addr + 4) == -4) {
+		if (is_copy(c))
+			h = fuse_copy;
+		else if (is_fill(c))
+			h = fuse_fill;
+	}
+	return h ? h : QLUX_HANDLER(c);
+}
+
+Cond fuse_pair(void (*h)(void))
+{
+	return h == fuse_bcc || h == fuse_dbf;
+}
+
+void fuse_count(uw16 c)
+{
+	uw32 key = (uw32)prev_code << 16 | c;
+	uw32 h = (key * 2654435761u) >> (32 - PAIR_BITS);
+	int i;
+
+	prev_code = c;
+	pairs_total++;
+	for (i = 0; i < PAIR_PROBES; i++, h = (h + 1) & (PAIR_SLOTS - 1)) {
+		if (pairs[h].n && pairs[h].key != key)
+			continue;
+		pairs[h].key = key;
+		pairs[h].n++;
+		return;
+	}
+	pairs_dropped++;
+}
+
+static int pair_cmp(const void *a, const void *b)
+{
+	uint64_t na = pairs[*(const int *)a].n, nb = pairs[*(const int *)b].n;
+
+	return na < nb ? 1 : na > nb ? -1 : 0;
+}
+
+static void fuse_stats_dump(void)
+{
+	static int order[PAIR_SLOTS];
+	int i, n = 0;
+
+	if (!pairs_total)
+		return;
+	for (i = 0; i < PAIR_SLOTS; i++) {
+		if (pairs[i].n)
+			order[n++] = i;
+	}
+	qsort(order, n, sizeof(order[0]), pair_cmp);
+
+	printf("Opcode pairs: %" PRIu64 " executed, %d distinct, %" PRIu64 " not counted\n",
+	       pairs_total, n, pairs_dropped);
+	for (i = 0; i < n && i < PAIR_SHOW; i++) {
+		uw32 key = pairs[order[i]].key;
+		void (*h)(void) = fuse_rule(key >> 16, key & 0xffff);
+
+		printf("  %04x %04x %14" PRIu64 " %6.2f%%  %s\n",
+		       key >> 16, key & 0xffff, pairs[order[i]].n,
+		       100.0 * pairs[order[i]].n / pairs_total,
+		       h == fuse_bcc ? "bcc" : h == fuse_dbf ? "dbf" : "-");
+	}
+}
+
+void fuseInit(int enable, bool stats)
+{
+	fuse_counting = stats;
+	// The profiler turns it off while it records, see profiler_control.h
+	fuse_enabled = enable && !stats;
+#if defined(TRACE) || defined(DEBUG)
+	// Every instruction has to go through the loop's hooks
+	fuse_enabled = false;
+#endif
+	if (stats)
+		atexit(fuse_stats_dump);
+}
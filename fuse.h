@@ -0,0 +1,45 @@
+/*
+ * fuse.h
+ *
+ * Opcode pair fusion for the decode cache.  When an instruction without
+ * extension words is followed by a Bcc or DBRA, its cache entry gets a
+ * fused handler that runs the instruction and then the branch straight
+ * away, without a trip round the dispatch loop.  A branch after a
+ * compare or subtract is decided from the pending lazy flags, so C and V
+ * are never worked out for it.  The branch word is re-read every time,
+ * so code written behind the cache only loses the fusion.
+ *
+ * A DBRA looping round a single move.x (Ay)+,(Ax)+, move.x Dm,(Ax)+ or
+ * clr.x (Ax)+ runs as memmove or memset over as many iterations as the
+ * instruction budget allows, when both ranges are unwatched plain RAM (see
+ * MemoryCPURange()).  The last iteration still goes through the
+ * handlers, so registers and flags end up as interpreted; anything else
+ * (MMIO, odd addresses, the loop writing itself) is just interpreted.
+ *
+ * --fuse_stats counts executed opcode pairs instead (fusion is off so
+ * every pair is seen) and prints the most frequent at exit, with the
+ * rule that fuses each, to tune the rules from real workloads.
+ */
+
+#ifndef FUSE_H
+#define FUSE_H
+
+#include <stdbool.h>
+
+#include "QL68000.h"
+
+extern Cond fuse_enabled;
+extern Cond fuse_counting;
+
+void fuseInit(int enable, bool stats);
+
+/* Handler for the entry at addr holding opcode c */
+void (*fuse_select(uw32 addr, uw16 c))(void);
+
+/* h runs its instruction and then the Bcc or DBRA after it */
+Cond fuse_pair(void (*h)(void));
+
+/* Dispatch loop, --fuse_stats: opcode c is about to run */
+void fuse_count(uw16 c);
+
+#endif /* FUSE_H */
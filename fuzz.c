@@ -0,0 +1,190 @@
+/*
+ * fuzz.c
+ *
+ * Fuzzing under afl-fuzz, see fuzz.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "QL68000.h"
+#include "fuzz.h"
+#include "memaccess.h"
+#include "sd_image.h"
+
+bool fuzz_on;
+bool fuzz_running;
+uint8_t *fuzz_map;
+MACHINE_LOCAL uint32_t fuzz_prev;
+
+#if !defined(__WIN32__) && !defined(__EMSCRIPTEN__)
+
+#include <signal.h>
+#include <sys/shm.h>
+#include <unistd.h>
+
+static char *input_path;
+static uint32_t input_addr = 0xffffffff;
+static int input_lba = -1;
+static int input_max;
+static int done_post = -1;
+static uint8_t *afl_map;
+static bool in_child;
+
+void fuzzInit(bool on, const char *input, const char *addr, int lba, int max,
+	      int done, const char *sd_overlay)
+{
+	if (!on)
+		return;
+	input_path = input && *input ? strdup(input) : NULL;
+	if (addr && *addr)
+		input_addr = strtoul(addr, NULL, 0);
+	input_lba = lba;
+	if (input_lba >= 0 && (!sd_overlay || strcmp(sd_overlay, "mem"))) {
+		fprintf(stderr, "Fuzz: fuzz_lba needs --sdcard_overlay mem, the children would write the image\n");
+		input_lba = -1;
+	}
+	input_max = max > 0 ? max : 4096;
+	done_post = done;
+	if (input_addr == 0xffffffff && input_lba < 0)
+		fprintf(stderr, "Fuzz: no fuzz_addr or fuzz_lba, inputs go nowhere\n");
+	if (done_post < 0)
+		fprintf(stderr, "Fuzz: no fuzz_done_post, every test runs until afl's timeout\n");
+	fuzz_on = true;
+}
+
+void fuzzAttach(void)
+{
+	const char *id = getenv("__AFL_SHM_ID");
+	void *p;
+
+	if (!id)
+		return;
+	p = shmat(atoi(id), NULL, 0);
+	if (p == (void *)-1) {
+		perror("Fuzz: shmat");
+		return;
+	}
+	afl_map = p;
+}
+
+static int read_input(uint8_t *buf)
+{
+	FILE *f = stdin;
+	size_t n;
+
+	if (input_path) {
+		f = fopen(input_path, "rb");
+		if (!f) {
+			perror(input_path);
+			return -1;
+		}
+	} else {
+		// afl rewrites the file behind stdin for each test
+		rewind(stdin);
+	}
+	n = fread(buf, 1, input_max, f);
+	if (f != stdin)
+		fclose(f);
+	return (int)n;
+}
+
+static void inject_ram(const uint8_t *buf, int len)
+{
+	uint8_t *p = MemoryHostRange(input_addr, 4 + input_max, 1);
+
+	if (!p) {
+		fprintf(stderr, "Fuzz: 0x%x+%d is not RAM\n", input_addr, 4 + input_max);
+		return;
+	}
+	p[0] = len >> 24;
+	p[1] = len >> 16;
+	p[2] = len >> 8;
+	p[3] = len;
+	memcpy(p + 4, buf, len);
+	memset(p + 4 + len, 0, input_max - len);
+	MemoryDMAWritten(input_addr, 4 + input_max);
+}
+
+static void inject_sd(uint8_t *buf, int len)
+{
+	uint32_t count = (input_max + SD_SECTOR_SIZE - 1) / SD_SECTOR_SIZE;
+
+	// The rest of the last sector, and of a short input, reads as zero
+	memset(buf + len, 0, count * SD_SECTOR_SIZE - len);
+	if (sdImageWrite(input_lba, buf, count))
+		fprintf(stderr, "Fuzz: sectors %d+%u are past the end of the SD image\n",
+			input_lba, count);
+}
+
+void fuzzStart(bool child)
+{
+	uint8_t *buf;
+	int len;
+
+	in_child = child;
+	buf = calloc(1, input_max + SD_SECTOR_SIZE);
+	if (!buf)
+		_exit(1);
+	len = read_input(buf);
+	if (len < 0)
+		_exit(1);
+	if (input_addr != 0xffffffff)
+		inject_ram(buf, len);
+	if (input_lba >= 0)
+		inject_sd(buf, len);
+	free(buf);
+
+	fuzz_prev = 0;
+	fuzz_map = child ? afl_map : NULL;
+	fuzz_running = true;
+}
+
+void fuzzPost(unsigned d)
+{
+	if (!fuzz_running || (int)d != done_post)
+		return;
+	if (in_child)
+		_exit(0);
+	printf("Fuzz: done\n");
+	exit(0);
+}
+
+void fuzzException(int vector)
+{
+	if (vector < 2 || vector > 4)
+		return;
+	fprintf(stderr, "Fuzz: exception %d at pc=0x%lx\n", vector,
+		(unsigned long)((Ptr)pc - (Ptr)memBase));
+	// What afl counts as a crash, whatever handlers are installed
+	signal(SIGABRT, SIG_DFL);
+	abort();
+}
+
+#else
+
+void fuzzInit(bool on, const char *input, const char *addr, int lba, int max,
+	      int done, const char *sd_overlay)
+{
+	if (on)
+		fprintf(stderr, "Fuzz: not supported on this platform\n");
+}
+
+void fuzzAttach(void)
+{
+}
+
+void fuzzStart(bool child)
+{
+}
+
+void fuzzPost(unsigned d)
+{
+}
+
+void fuzzException(int vector)
+{
+}
+
+#endif
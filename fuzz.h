@@ -0,0 +1,63 @@
+/*
+ * fuzz.h
+ *
+ * Coverage-guided fuzzing of guest code (--fuzz) under afl-fuzz.  The
+ * fork server (see forkserver.h) speaks afl's fork server protocol at
+ * its boot point instead of listening on a socket: each test is a
+ * copy-on-write child that reads the input (--fuzz_input, or stdin as
+ * afl gives it), puts it into guest RAM at --fuzz_addr (a big-endian
+ * u32 length, then the bytes) and/or the SD image at --fuzz_lba, and
+ * runs until the guest writes --fuzz_done_post.  A bus error, address
+ * error or illegal instruction exception is a crash.
+ *
+ * Coverage is afl's edge bitmap, filled from a variant of the dispatch
+ * loop that hashes the address of every instruction run with the one
+ * before, so it is only paid for in the children.  Not started by
+ * afl-fuzz, the input is run once in the process that booted, with the
+ * same crash checks, to reproduce a finding.
+ */
+
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "machine_local.h"
+
+#define FUZZ_MAP_SIZE	65536
+
+extern bool fuzz_on;
+/* A test is running: exceptions go through fuzzException() */
+extern bool fuzz_running;
+/* afl's bitmap while a test runs under it, else NULL */
+extern uint8_t *fuzz_map;
+extern MACHINE_LOCAL uint32_t fuzz_prev;
+
+/* About to run the instruction at addr */
+static inline void fuzzEdge(uint32_t addr)
+{
+	uint32_t cur = (addr >> 1) * 0x9e3779b1u >> 16;
+
+	fuzz_map[cur ^ fuzz_prev]++;
+	fuzz_prev = cur >> 1;
+}
+
+/* Options.  addr of NULL or "" and lba -1 for none; lba needs an SD
+   overlay of "mem", so that the children's writes stay in memory */
+void fuzzInit(bool on, const char *input, const char *addr, int lba, int max,
+	      int done_post, const char *sd_overlay);
+
+/* In the fork server, before the first child: attach afl's bitmap */
+void fuzzAttach(void);
+
+/* In the test's process: inject the input and start the coverage */
+void fuzzStart(bool child);
+
+/* The guest wrote POST code d */
+void fuzzPost(unsigned d);
+
+/* The guest takes exception vector */
+void fuzzException(int vector);
+
+#endif /* FUZZ_H */
@@ -0,0 +1,654 @@
+/*
+ * gdbstub.c
+ *
+ * GDB remote stub, see gdbstub.h.  Registers and memory are read and
+ * written in place: memory straight from memBase, without the bus and
+ * so without HW register side effects.  While the CPU runs, the socket
+ * is only looked at every GDB_POLL_CHUNKS chunks, for gdb's interrupt.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "QL68000.h"
+#include "QL.h"
+#include "cycles.h"
+#include "gdbstub.h"
+#include "memaccess.h"
+#include "unixstuff.h"
+#ifdef DECODE_CACHE
+#include "decode_cache.h"
+#endif
+
+int gdb_breaks;
+
+#if !defined(__WIN32__) && !defined(__EMSCRIPTEN__)
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define GDB_PACKET_MAX	4096
+#define GDB_MAX_BREAKS	64
+#define GDB_MAX_WATCHES	16
+#define GDB_POLL_CHUNKS	64	/* a power of two */
+#define GDB_REGS	18	/* d0-d7, a0-a7, sr, pc */
+#define GDB_NONE	0xffffffffu
+
+#define GDB_SIGINT	2
+#define GDB_SIGTRAP	5
+
+/* Z packet types */
+#define GDB_Z_SOFT	0
+#define GDB_Z_HARD	1
+#define GDB_Z_WRITE	2
+#define GDB_Z_READ	3
+#define GDB_Z_ACCESS	4
+
+typedef struct {
+	uw32 addr;
+	uw32 len;
+	int type;
+} gdb_watch;
+
+static int listen_fd = -1;
+static int fd = -1;
+static bool attached_once;
+static unsigned polls;
+
+static uw32 breaks[GDB_MAX_BREAKS];
+static uw32 step_over = GDB_NONE;
+static gdb_watch watches[GDB_MAX_WATCHES];
+static int nwatches;
+
+static int stop_signal;			/* stop pending, 0 for none */
+static const gdb_watch *watch_hit;
+static uw32 watch_hit_addr;
+
+static uint8_t in[GDB_PACKET_MAX];
+static size_t in_len, in_pos;
+
+static const char hexdigit[] = "0123456789abcdef";
+
+static uw32 cur_pc(void)
+{
+	return (uw32)((Ptr)pc - (Ptr)memBase);
+}
+
+void gdbInit(int port)
+{
+	struct sockaddr_in addr;
+	int one = 1;
+
+	if (port <= 0)
+		return;
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0) {
+		perror("gdb_port");
+		return;
+	}
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(listen_fd, 1) < 0) {
+		perror("gdb_port");
+		close(listen_fd);
+		listen_fd = -1;
+		return;
+	}
+#ifndef DECODE_CACHE
+	fprintf(stderr, "GDB: breakpoints need DECODE_CACHE, only watchpoints and stepping work\n");
+#endif
+	printf("GDB: target remote 127.0.0.1:%d\n", port);
+}
+
+bool gdbEnabled(void)
+{
+	return listen_fd >= 0;
+}
+
+bool gdbBreakAt(uw32 addr)
+{
+	int i;
+
+	if (addr == step_over)
+		return false;
+	for (i = 0; i < gdb_breaks; i++) {
+		if (breaks[i] == addr)
+			return true;
+	}
+	return false;
+}
+
+void gdbBreak(void)
+{
+#ifdef DECODE_CACHE
+	// Not run yet: gdb sees the PC at the breakpoint
+	pc--;
+	cpu_cycles -= cycle_table[code];
+	nInst = 0;
+	nInst2 = 0;
+	stop_signal = GDB_SIGTRAP;
+#endif
+}
+
+void gdbWatchAccess(uw32 addr, int len, bool write)
+{
+	int i;
+
+	for (i = 0; i < nwatches; i++) {
+		const gdb_watch *w = &watches[i];
+
+		if (addr >= w->addr + w->len || addr + len <= w->addr)
+			continue;
+		if ((w->type == GDB_Z_WRITE && !write) || (w->type == GDB_Z_READ && write))
+			continue;
+		// The access finishes its instruction first, as on a real target
+		watch_hit = w;
+		watch_hit_addr = addr > w->addr ? addr : w->addr;
+		stop_signal = GDB_SIGTRAP;
+		nInst = 0;
+		nInst2 = 0;
+		return;
+	}
+}
+
+static void watch_pages(void)
+{
+	int i;
+
+	MemoryWatchClear();
+	for (i = 0; i < nwatches; i++)
+		MemoryWatchRange(watches[i].addr, watches[i].len,
+				 watches[i].type != GDB_Z_WRITE);
+	MemoryMapUpdate();
+}
+
+static void break_changed(uw32 addr)
+{
+#ifdef DECODE_CACHE
+	// Fused pairs starting up to two words before it run over it too
+	uw32 from = addr >= 4 ? addr - 4 : 0;
+
+	dcache_invalidate_range(from, addr + 2 - from);
+#endif
+}
+
+/* Z and z packets: 0 OK, -1 an error, 1 not supported */
+static int set_point(int type, uw32 addr, uw32 len, bool set)
+{
+	int i;
+
+	if (type == GDB_Z_SOFT || type == GDB_Z_HARD) {
+#ifndef DECODE_CACHE
+		return 1;
+#endif
+		for (i = 0; i < gdb_breaks && breaks[i] != addr; i++)
+			;
+		if (set && i == gdb_breaks) {
+			if (gdb_breaks == GDB_MAX_BREAKS)
+				return -1;
+			breaks[gdb_breaks++] = addr;
+		} else if (!set && i < gdb_breaks) {
+			breaks[i] = breaks[--gdb_breaks];
+		}
+		break_changed(addr);
+		return 0;
+	}
+	if (type < GDB_Z_WRITE || type > GDB_Z_ACCESS)
+		return 1;
+
+	for (i = 0; i < nwatches; i++) {
+		if (watches[i].addr == addr && watches[i].len == len &&
+		    watches[i].type == type)
+			break;
+	}
+	if (set && i == nwatches) {
+		if (nwatches == GDB_MAX_WATCHES || !len)
+			return -1;
+		watches[nwatches].addr = addr;
+		watches[nwatches].len = len;
+		watches[nwatches].type = type;
+		nwatches++;
+	} else if (!set && i < nwatches) {
+		watches[i] = watches[--nwatches];
+	}
+	watch_pages();
+	return 0;
+}
+
+static void drop_points(void)
+{
+	while (gdb_breaks)
+		set_point(GDB_Z_SOFT, breaks[0], 0, false);
+	nwatches = 0;
+	watch_pages();
+}
+
+/* The next byte from gdb, -1 once it has gone */
+static int get_byte(void)
+{
+	if (in_pos == in_len) {
+		ssize_t n = recv(fd, in, sizeof(in), 0);
+
+		if (n <= 0)
+			return -1;
+		in_len = n;
+		in_pos = 0;
+	}
+	return in[in_pos++];
+}
+
+static int unhex(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* A packet's contents, NUL terminated; -1 once gdb has gone */
+static int get_packet(char *buf)
+{
+	for (;;) {
+		size_t len = 0;
+		uint8_t sum = 0;
+		int c, h, l;
+
+		do {
+			c = get_byte();
+			if (c < 0)
+				return -1;
+		} while (c != '$');
+
+		while ((c = get_byte()) != '#') {
+			if (c < 0)
+				return -1;
+			if (len + 1 < GDB_PACKET_MAX)
+				buf[len++] = c;
+			sum += c;
+		}
+		buf[len] = 0;
+		h = unhex(get_byte());
+		l = unhex(get_byte());
+		if (h >= 0 && l >= 0 && (h << 4 | l) == sum) {
+			send(fd, "+", 1, 0);
+			return len;
+		}
+		send(fd, "-", 1, 0);
+	}
+}
+
+static void put_packet(const char *data)
+{
+	static char out[GDB_PACKET_MAX + 4];
+	size_t len = strlen(data);
+	uint8_t sum = 0;
+	size_t i;
+	int c;
+
+	out[0] = '$';
+	for (i = 0; i < len; i++) {
+		out[i + 1] = data[i];
+		sum += (uint8_t)data[i];
+	}
+	out[len + 1] = '#';
+	out[len + 2] = hexdigit[sum >> 4];
+	out[len + 3] = hexdigit[sum & 15];
+	do {
+		send(fd, out, len + 4, 0);
+		c = get_byte();
+	} while (c == '-');
+}
+
+static char *put_hex32(char *p, uw32 v)
+{
+	int i;
+
+	for (i = 28; i >= 0; i -= 4)
+		*p++ = hexdigit[(v >> i) & 15];
+	return p;
+}
+
+static uw32 get_hex(const char **s)
+{
+	uw32 v = 0;
+	int d;
+
+	while ((d = unhex(**s)) >= 0) {
+		v = v << 4 | d;
+		(*s)++;
+	}
+	return v;
+}
+
+static uw32 get_reg(int r)
+{
+	if (r < 16)
+		return reg[r];
+	if (r == 16)
+		return (uw16)GetSR();
+	return cur_pc();
+}
+
+static void set_reg(int r, uw32 v)
+{
+	if (r < 16)
+		reg[r] = v;
+	else if (r == 16)
+		PutSR(v);
+	else
+		SetPC(v);
+}
+
+static void read_regs(char *out)
+{
+	char *p = out;
+	int r;
+
+	for (r = 0; r < GDB_REGS; r++)
+		p = put_hex32(p, get_reg(r));
+	*p = 0;
+}
+
+static bool write_regs(const char *s)
+{
+	uw32 v[GDB_REGS];
+	int r, i;
+
+	if (strlen(s) < GDB_REGS * 8)
+		return false;
+	for (r = 0; r < GDB_REGS; r++) {
+		v[r] = 0;
+		for (i = 0; i < 8; i++)
+			v[r] = v[r] << 4 | unhex(*s++);
+	}
+	// SR first, so a mode change doesn't swap the A7 written with it
+	set_reg(16, v[16]);
+	for (r = 0; r < GDB_REGS; r++) {
+		if (r != 16)
+			set_reg(r, v[r]);
+	}
+	return true;
+}
+
+/* Beyond the RAM and ROM image reads as 0 */
+static void read_mem(char *out, uw32 addr, uw32 len)
+{
+	const uint8_t *m = (const uint8_t *)memBase;
+	uw32 i;
+
+	if (len > (GDB_PACKET_MAX - 4) / 2)
+		len = (GDB_PACKET_MAX - 4) / 2;
+	for (i = 0; i < len; i++) {
+		uint8_t b = addr + i < (uw32)RTOP ? m[addr + i] : 0;
+
+		*out++ = hexdigit[b >> 4];
+		*out++ = hexdigit[b & 15];
+	}
+	*out = 0;
+}
+
+static bool write_mem(uw32 addr, uw32 len, const char *hex)
+{
+	uint8_t *m = (uint8_t *)memBase;
+	uw32 i;
+
+	if (addr >= (uw32)RTOP || len > (uw32)RTOP - addr || strlen(hex) < 2 * len)
+		return false;
+	for (i = 0; i < len; i++)
+		m[addr + i] = unhex(hex[2 * i]) << 4 | unhex(hex[2 * i + 1]);
+	// Drops decoded and translated copies and marks the pages written
+	MemoryDMAWritten(addr, len);
+	return true;
+}
+
+static void send_stop(void)
+{
+	char buf[64];
+
+	if (watch_hit) {
+		static const char *const kind[] = { "watch", "rwatch", "awatch" };
+
+		snprintf(buf, sizeof(buf), "T%02x%s:%x;", stop_signal,
+			 kind[watch_hit->type - GDB_Z_WRITE], watch_hit_addr);
+	} else {
+		snprintf(buf, sizeof(buf), "S%02x", stop_signal ? stop_signal : GDB_SIGTRAP);
+	}
+	put_packet(buf);
+}
+
+/* One instruction, run even if a breakpoint is on it */
+static void step(void)
+{
+	uw32 at = cur_pc();
+	bool over = gdbBreakAt(at);
+
+	if (over) {
+		step_over = at;
+		break_changed(at);
+	}
+	stop_signal = 0;
+	watch_hit = NULL;
+	ExecuteChunk(0);
+	if (over) {
+		step_over = GDB_NONE;
+		break_changed(at);
+	}
+}
+
+static void detach(void)
+{
+	drop_points();
+	close(fd);
+	fd = -1;
+	stop_signal = 0;
+	watch_hit = NULL;
+}
+
+/* Serves gdb until it continues or detaches; false if it has gone */
+static bool serve(void)
+{
+	static char buf[GDB_PACKET_MAX], out[GDB_PACKET_MAX];
+	const char *s;
+	uw32 addr, len;
+	int r;
+
+	for (;;) {
+		if (get_packet(buf) < 0)
+			return false;
+		s = buf + 1;
+		out[0] = 0;
+
+		switch (buf[0]) {
+		case '?':
+			send_stop();
+			continue;
+		case 'g':
+			read_regs(out);
+			break;
+		case 'G':
+			strcpy(out, write_regs(s) ? "OK" : "E01");
+			break;
+		case 'p':
+			r = get_hex(&s);
+			if (r < GDB_REGS)
+				*put_hex32(out, get_reg(r)) = 0;
+			else
+				strcpy(out, "E01");
+			break;
+		case 'P':
+			r = get_hex(&s);
+			if (r < GDB_REGS && *s++ == '=') {
+				set_reg(r, get_hex(&s));
+				strcpy(out, "OK");
+			} else {
+				strcpy(out, "E01");
+			}
+			break;
+		case 'm':
+			addr = get_hex(&s);
+			s++;
+			read_mem(out, addr, get_hex(&s));
+			break;
+		case 'M':
+			addr = get_hex(&s);
+			s++;
+			len = get_hex(&s);
+			strcpy(out, *s == ':' && write_mem(addr, len, s + 1) ? "OK" : "E01");
+			break;
+		case 'c':
+		case 's':
+			if (*s)
+				SetPC(get_hex(&s));
+			step();
+			if (buf[0] == 'c' && !stop_signal)
+				return true;
+			send_stop();
+			continue;
+		case 'Z':
+		case 'z':
+			r = get_hex(&s);
+			s++;
+			addr = get_hex(&s);
+			s++;
+			len = get_hex(&s);
+			r = set_point(r, addr, len, buf[0] == 'Z');
+			strcpy(out, r < 0 ? "E01" : r ? "" : "OK");
+			break;
+		case 'D':
+			put_packet("OK");
+			detach();
+			return true;
+		case 'k':
+			detach();
+			QLdone = 1;
+			return true;
+		case 'H':
+		case 'T':
+			strcpy(out, "OK");
+			break;
+		case 'q':
+			if (!strncmp(s, "Supported", 9))
+				snprintf(out, sizeof(out), "PacketSize=%x", GDB_PACKET_MAX - 4);
+			else if (!strcmp(s, "Attached"))
+				strcpy(out, "1");
+			else if (!strcmp(s, "C"))
+				strcpy(out, "QC1");
+			else if (!strcmp(s, "fThreadInfo"))
+				strcpy(out, "m1");
+			else if (!strcmp(s, "sThreadInfo"))
+				strcpy(out, "l");
+			break;
+		}
+		put_packet(out);
+	}
+}
+
+/* Nonblocking, unless wait is set */
+static bool accept_client(bool wait)
+{
+	struct pollfd p = { listen_fd, POLLIN, 0 };
+	int one = 1;
+
+	if (!wait && poll(&p, 1, 0) <= 0)
+		return false;
+	if (wait)
+		printf("GDB: waiting for a connection\n");
+	fd = accept(listen_fd, NULL, NULL);
+	if (fd < 0)
+		return false;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	in_len = in_pos = 0;
+	printf("GDB: connected\n");
+	return true;
+}
+
+/* gdb's interrupt, a bare 0x03 */
+static void check_interrupt(void)
+{
+	struct pollfd p = { fd, POLLIN, 0 };
+	int c;
+
+	while (in_pos < in_len || poll(&p, 1, 0) > 0) {
+		c = get_byte();
+		if (c < 0) {
+			printf("GDB: connection lost, running on\n");
+			detach();
+			return;
+		}
+		if (c == 3)
+			stop_signal = GDB_SIGINT;
+	}
+}
+
+void gdbPoll(void)
+{
+	bool fresh = false;
+
+	if (listen_fd < 0)
+		return;
+	if (fd < 0) {
+		// Before the first instruction, and later whenever gdb comes back
+		if (!attached_once || !(++polls & (GDB_POLL_CHUNKS - 1)))
+			fresh = accept_client(!attached_once);
+		attached_once = true;
+		if (!fresh)
+			return;
+	} else if (!stop_signal && !(++polls & (GDB_POLL_CHUNKS - 1))) {
+		check_interrupt();
+	}
+	if (!stop_signal && !fresh)
+		return;
+
+	// gdb asks why a new connection stopped with '?'
+	if (!fresh)
+		send_stop();
+	if (!serve()) {
+		printf("GDB: connection lost, running on\n");
+		detach();
+	}
+	stop_signal = 0;
+	watch_hit = NULL;
+}
+
+#else
+
+void gdbInit(int port)
+{
+	if (port > 0)
+		fprintf(stderr, "GDB: not supported on this platform\n");
+}
+
+bool gdbEnabled(void)
+{
+	return false;
+}
+
+bool gdbBreakAt(uw32 addr)
+{
+	return false;
+}
+
+void gdbBreak(void)
+{
+}
+
+void gdbWatchAccess(uw32 addr, int len, bool write)
+{
+}
+
+void gdbPoll(void)
+{
+}
+
+#endif
@@ -0,0 +1,39 @@
+/*
+ * gdbstub.h
+ *
+ * GDB remote serial protocol stub (--gdb_port <port>).  The emulator
+ * waits for m68k-elf-gdb to connect before the first instruction, then
+ * serves it from the emulator thread between chunks, so nothing is
+ * checked per instruction.  A breakpoint is a decode cache entry whose
+ * handler stops the CPU, like the fork server's trap.  A watchpoint
+ * marks its pages so their accesses take the memory slow path, which
+ * checks the watched ranges.  Needs DECODE_CACHE for breakpoints; the
+ * JIT is off while the stub is enabled.
+ */
+
+#ifndef GDBSTUB_H
+#define GDBSTUB_H
+
+#include <stdbool.h>
+
+#include "QL68000.h"
+
+/* Breakpoints set, for a quick test in dcache_fill() */
+extern int gdb_breaks;
+
+void gdbInit(int port);
+bool gdbEnabled(void);
+
+/* A breakpoint the decode cache should trap is set at addr */
+bool gdbBreakAt(uw32 addr);
+
+/* Decode cache handler for the instruction at a breakpoint */
+void gdbBreak(void);
+
+/* Memory slow path, on a watched page: len bytes at addr were accessed */
+void gdbWatchAccess(uw32 addr, int len, bool write);
+
+/* Emulator thread, between chunks: serve gdb while the CPU is stopped */
+void gdbPoll(void);
+
+#endif /* GDBSTUB_H */
@@ -0,0 +1,118 @@
+/*
+ * gen_optable.c
+ *
+ * Build step for GENERATED_TABLE: runs the SetTable patterns in Init.c
+ * (built with OPTABLE_GEN) for the 68000, 68010 and 68020 and writes the
+ * result as const data, see optable.h.  Handlers are only seen by name
+ * here, so nothing of the core is linked in.
+ *
+ * Usage: gen_optable <optable.c>
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "QL68000.h"
+
+#define MAX_NAMES	1024
+
+void SetTabEntries(void (**itable)(void));
+
+MACHINE_LOCAL int cpu68010;
+MACHINE_LOCAL int cpu68020;
+
+static const char *names[MAX_NAMES];
+static int nnames;
+static void (*tables[3][65536])(void);	/* 68000, 68010, 68020 */
+
+/* Handler i + 1 as a token; it is only ever compared and stored */
+void (*genHandler(const char *name))(void)
+{
+	int i;
+
+	// As SetTable's argument was spelt, maybe with LR in front
+	if (!strncmp(name, "LR ", 3))
+		name += 3;
+	for (i = 0; i < nnames && strcmp(names[i], name); i++)
+		;
+	if (i == nnames) {
+		if (nnames == MAX_NAMES) {
+			fprintf(stderr, "gen_optable: more than %d handlers\n", MAX_NAMES);
+			exit(1);
+		}
+		names[nnames++] = name;
+	}
+	return (void (*)(void))(uintptr_t)(i + 1);
+}
+
+static unsigned handler(void (*f)(void))
+{
+	return (unsigned)(uintptr_t)f - 1;
+}
+
+/* What cpu changes from the table before it */
+static void write_patch(FILE *f, const char *name, int cpu)
+{
+	int c, n = 0;
+
+	fprintf(f, "const optable_patch %s[] = {\n", name);
+	for (c = 0; c < 65536; c++) {
+		if (tables[cpu][c] == tables[cpu - 1][c])
+			continue;
+		fprintf(f, "\t{ 0x%04x, %u },\n", c, handler(tables[cpu][c]));
+		n++;
+	}
+	fprintf(f, "};\nconst int %s_n = %d;\n\n", name, n);
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *f;
+	int i;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <optable.c>\n", argv[0]);
+		return 2;
+	}
+
+	SetTabEntries(tables[0]);
+	cpu68010 = 1;
+	SetTabEntries(tables[1]);
+	cpu68020 = 1;
+	SetTabEntries(tables[2]);
+
+	f = fopen(argv[1], "w");
+	if (!f) {
+		perror(argv[1]);
+		return 1;
+	}
+	fprintf(f, "/* Generated by gen_optable from the SetTable patterns in Init.c */\n\n");
+	fprintf(f, "#include \"optable.h\"\n\n");
+	for (i = 0; i < nnames; i++)
+		fprintf(f, "void %s(void);\n", names[i]);
+
+	fprintf(f, "\nvoid (*const optable_handlers[])(void) = {\n");
+	for (i = 0; i < nnames; i++)
+		fprintf(f, "\t%s,\n", names[i]);
+	fprintf(f, "};\n\nconst char *const optable_names[] = {\n");
+	for (i = 0; i < nnames; i++)
+		fprintf(f, "\t\"%s\",\n", names[i]);
+	fprintf(f, "};\nconst int optable_nhandlers = %d;\n\n", nnames);
+
+	fprintf(f, "const uint16_t optable_index[65536] = {\n");
+	for (i = 0; i < 65536; i++)
+		fprintf(f, "%s%u,%s", i % 16 ? " " : "\t", handler(tables[0][i]),
+			i % 16 == 15 ? "\n" : "");
+	fprintf(f, "};\n\n");
+
+	write_patch(f, "optable_68010", 1);
+	write_patch(f, "optable_68020", 2);
+
+	if (fclose(f)) {
+		perror(argv[1]);
+		return 1;
+	}
+	return 0;
+}
@@ -22,17 +22,39 @@
 #include "nextp8.h"
 #include "sdspi.h"
 #include "p8audio_verilated.h"
+#include "pacer.h"
+#include "scheduler.h"
 #include "uart.h"
 #include "i2c_rtc.h"
 #include "esp8266_model.h"
 #include "emulator_options.h"
+#include "sd_dma.h"
+#include "perfctr.h"
+#include "semihost.h"
+#include "blitter.h"
+#include "memdma.h"
+#include "fixmath.h"
+#include "dastream.h"
+#include "cycles.h"
+#include "idle.h"
+#include "savestate.h"
+#include "replay.h"
+#include "btrace.h"
+#include "forkserver.h"
+#include "fuzz.h"
+#include "logger.h"
+#include "metrics.h"
+#include "netplay.h"
+#include "startup_timing.h"
 #endif
 
 #ifdef PROFILER
-#include "profiler/profiler_cost_model.h"
+#include "profiler/profiler_api.h"
 #endif
 
 #include <signal.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <assert.h>
 
@@ -160,14 +182,48 @@ static uint16_t debug_reg_hi = 0;
 static uint16_t debug_reg_lo = 0;
 static uint8_t last_post_code = 0;
 
-void UART_TickAndReceive(int cycles)
+/*
+ * Bytes received from the UART, written to stdout on a newline, when the
+ * buffer fills or UART_OUT_MAX_NS after the oldest unwritten byte.
+ */
+#define UART_OUT_MAX_NS		(20 * 1000000ULL)
+static char uart_out[4096];
+static int uart_out_len = 0;
+static uint64_t uart_out_since;
+
+static void UART_FlushOut(void)
 {
-	if (uart == NULL) {
-		uart = UART_Create();
-		uart2 = UART_Create();
-		esp8266 = ESP8266_Create();
+	if (uart_out_len) {
+		(void) write(STDOUT_FILENO, uart_out, uart_out_len);
+		uart_out_len = 0;
 	}
-	if (cycles > 1) cycles *= UART_GetSpeed(uart);
+}
+
+static void UART_Out(char c)
+{
+	if (!uart_out_len)
+		uart_out_since = pacerNowNs();
+	uart_out[uart_out_len++] = c;
+	if (c == '\n' || uart_out_len == sizeof(uart_out))
+		UART_FlushOut();
+}
+
+/*
+ * Bit times the UART pair still has to run in the background.  Every
+ * register access leaves the line busy for at most a frame (UART_FRAME_BITS
+ * bit times, a data write already runs them itself), which the uart event
+ * runs at the end of the current chunk; once the line is idle nothing is
+ * scheduled.  Buffered output re-arms it until the flush timeout passes.
+ */
+#define UART_FRAME_BITS		12
+#define UART_FLUSH_INSNS	30000
+#define ESP8266_POLL_INSNS	3000
+static int uart_busy_bits = 0;
+static sched_event uart_event;
+static sched_event esp8266_event;
+
+static void UART_Run(int cycles)
+{
 	for (int i=0;i<cycles;++i) {
 		UART_Tick(uart);
         UART_Tick(uart2);
@@ -175,13 +231,79 @@ void UART_TickAndReceive(int cycles)
 		if (UART_GetDataReady(uart2)) {
 			UART_SetRead(uart2, 1);
 			UART_Tick(uart2);
-			char c = UART_GetDataOut(uart2);
-			(void) write(STDOUT_FILENO, &c, 1);
+			UART_Out(UART_GetDataOut(uart2));
 			UART_SetRead(uart2, 0);
 			UART_Tick(uart2);
 		}
 	}
 }
+
+static void UART_Event(void *arg)
+{
+	if (uart_busy_bits) {
+		UART_Run(uart_busy_bits * UART_GetSpeed(uart));
+		uart_busy_bits = 0;
+	}
+	if (uart_out_len && pacerNowNs() - uart_out_since > UART_OUT_MAX_NS)
+		UART_FlushOut();
+	if (uart_out_len)
+		schedAt(&uart_event, UART_FLUSH_INSNS);
+}
+
+static void ESP8266_Event(void *arg)
+{
+	static bool ssl_timed;
+	const ESP8266_Stats *st;
+
+	ESP8266_Poll(esp8266);
+	st = ESP8266_GetStats(esp8266);
+	// OpenSSL is set up with the first TLS link
+	if (!ssl_timed && st->ssl_init_us) {
+		startupAddUs(STARTUP_SSL, st->ssl_init_us);
+		ssl_timed = true;
+	}
+	if (metrics_enabled) {
+		metricSet(METRIC_ESP_COMMANDS, st->commands);
+		metricSet(METRIC_ESP_NET_TX, st->net_tx_bytes);
+		metricSet(METRIC_ESP_NET_RX, st->net_rx_bytes);
+	}
+}
+
+static void UART_Init(void)
+{
+	uint64_t t;
+
+	uart = UART_Create();
+	uart2 = UART_Create();
+	t = startupNow();
+	esp8266 = ESP8266_Create();
+	startupAdd(STARTUP_ESP, t);
+	ESP8266_SetVerbose(esp8266, emulatorOptionInt("verbose"));
+	ESP8266_SetKeepAlive(esp8266, emulatorOptionInt("esp_keepalive"));
+	ESP8266_SetLinkCount(esp8266, emulatorOptionInt("esp_links"));
+	atexit(UART_FlushOut);
+	schedInit(&uart_event, "uart", UART_Event, NULL);
+	schedInit(&esp8266_event, "esp8266", ESP8266_Event, NULL);
+	if (esp8266)
+		schedEvery(&esp8266_event, ESP8266_POLL_INSNS);
+}
+
+void UART_TickAndReceive(int cycles)
+{
+	if (uart == NULL)
+		UART_Init();
+	if (cycles > 1) cycles *= UART_GetSpeed(uart);
+	UART_Run(cycles);
+	uart_busy_bits = UART_FRAME_BITS;
+	schedAt(&uart_event, 0);
+}
+
+/* Emulator start: create the UARTs and the ESP8266 and register their events */
+void UART_Start(void)
+{
+	if (uart == NULL)
+		UART_Init();
+}
 #endif
 
 w8 ReadRTClock(w32 addr)
@@ -201,11 +323,8 @@ void FrameInt(void)
 	{
 		theInt = 8;
 		intReg ^= 8;
-		pendingInterrupt = 2;
+		RaiseInterrupt(2);
 		*((uw8 *)memBase + 0x280a0l) = 16;
-		extraFlag = true;
-		nInst2 = nInst;
-		nInst = 0;
 	}
 }
 
@@ -296,8 +415,369 @@ void ipc_write(uint8_t d)
 	}
 }
 
+#ifdef NEXTP8
+/*
+ * Memory-like MMIO regions (buffers, palettes, matrices).  Looked up from
+ * the default: branch of the HW accessors through a bucket map on address
+ * bits 23-8, so a framebuffer access costs one table load and one range
+ * compare instead of a walk through every region.  Regions backed by a
+ * host byte array provide ptr() instead of byte handlers; word and long
+ * accesses then go straight to the array in big-endian order, as long as
+ * they stay within one span of it.  Peripherals with 16-bit registers
+ * give read16()/write16() instead, see HW_REGS().  A region with none of
+ * these means the access is not decoded and is reported as before.
+ */
+typedef struct {
+	uw32 base;
+	uw32 size;
+	uw32 span;	/* bytes contiguous behind ptr(), power of 2 */
+	uint8_t *(*ptr)(aw32 addr);
+	void (*dirty)(aw32 addr, unsigned n);	/* after a store through ptr() */
+	rw8 (*read_byte)(aw32 addr);
+	void (*write_byte)(aw32 addr, aw8 d);
+	rw16 (*read_word)(aw32 addr);
+	void (*write_word)(aw32 addr, aw16 d);
+	/* Blocks of 16-bit registers, reg the offset from base */
+	uint16_t (*read16)(unsigned reg);
+	void (*write16)(unsigned reg, uint16_t d);
+	int strobe;	/* register whose other half a byte write clears, -1 for none */
+} hw_region;
+
+#define HW_REGION_SHIFT		8
+#define HW_REGION_BUCKETS	((ADDR_MASK + 1) >> HW_REGION_SHIFT)
+
+/* Status registers an idle guest polls, see idle.h */
+static inline uint16_t idle_poll(aw32 addr, uint16_t value)
+{
+	idlePoll(addr, value, false);
+	return value;
+}
+
+static rw8 kbd_read(aw32 addr)
+{
+	int row = addr - _KEYBOARD_MATRIX;
+
+	return idle_poll(addr, replayValue(REPLAY_KBD,
+		netplay_on ? netplayKeyrow(row) : inputSnapshot()->keyrow[row]));
+}
+
+static rw8 kbd_latched_read(aw32 addr)
+{
+	int row = addr - _KEYBOARD_MATRIX_LATCHED;
+
+	return idle_poll(addr, replayValue(REPLAY_KBD, netplay_on ?
+		netplayKeyrowLatched(row) : SDL_AtomicGet(&sdl_keyrow_latched[row])));
+}
+
+static void kbd_latched_write(aw32 addr, aw8 d)
+{
+	int row = addr - _KEYBOARD_MATRIX_LATCHED;
+
+	if (netplay_on)
+		netplayKeyrowLatchClear(row, d);
+	else
+		inputLatchClear(&sdl_keyrow_latched[row], d);
+}
+
+static rw8 da_read(aw32 addr)
+{
+	if ((addr & 1) == 0)
+		return da_memory[(addr - _DA_MEMORY_BASE) >> 1] >> 8;
+	else
+		return da_memory[(addr - _DA_MEMORY_BASE) >> 1] & 0xff;
+}
+
+static void da_write(aw32 addr, aw8 d)
+{
+	int i = (addr - _DA_MEMORY_BASE) >> 1;
+
+	if ((addr & 1) == 0)
+		da_memory[i] = (da_memory[i] & 0xff) | (d << 8);
+	else
+		da_memory[i] = (da_memory[i] & 0xff00) | (uw8)d;
+}
+
+static rw16 da_read_word(aw32 addr)
+{
+#if __BYTE_ORDER == __BIG_ENDIAN
+	return da_memory[(addr - _DA_MEMORY_BASE) >> 1];
+#else
+	return __builtin_bswap16(da_memory[(addr - _DA_MEMORY_BASE) >> 1]);
+#endif
+}
+
+static void da_write_word(aw32 addr, aw16 d)
+{
+#if __BYTE_ORDER == __BIG_ENDIAN
+	da_memory[(addr - _DA_MEMORY_BASE) >> 1] = d;
+#else
+	da_memory[(addr - _DA_MEMORY_BASE) >> 1] = __builtin_bswap16(d);
+#endif
+}
+
+static void back_dirty(aw32 addr, unsigned n)
+{
+	frameLineDirty[1-vfront][(addr - _BACK_BUFFER_BASE) >> 6] = 1;
+	frameLineDirty[1-vfront][(addr + n - 1 - _BACK_BUFFER_BASE) >> 6] = 1;
+}
+
+static void front_dirty(aw32 addr, unsigned n)
+{
+	frameLineDirty[vfront][(addr - _FRONT_BUFFER_BASE) >> 6] = 1;
+	frameLineDirty[vfront][(addr + n - 1 - _FRONT_BUFFER_BASE) >> 6] = 1;
+}
+
+static void overlay_back_dirty(aw32 addr, unsigned n)
+{
+	overlayLineDirty[1-vfront][(addr - _OVERLAY_BACK_BUFFER_BASE) >> 6] = 1;
+	overlayLineDirty[1-vfront][(addr + n - 1 - _OVERLAY_BACK_BUFFER_BASE) >> 6] = 1;
+}
+
+static void overlay_front_dirty(aw32 addr, unsigned n)
+{
+	overlayLineDirty[vfront][(addr - _OVERLAY_FRONT_BUFFER_BASE) >> 6] = 1;
+	overlayLineDirty[vfront][(addr + n - 1 - _OVERLAY_FRONT_BUFFER_BASE) >> 6] = 1;
+}
+
+static void palette_dirty(aw32 addr, unsigned n)
+{
+	screenRedrawAll = 1;
+}
+
+static uint8_t *back_ptr(aw32 addr)
+{
+	return &frameBuffer[1-vfront][addr - _BACK_BUFFER_BASE];
+}
+
+static uint8_t *front_ptr(aw32 addr)
+{
+	return &frameBuffer[vfront][addr - _FRONT_BUFFER_BASE];
+}
+
+static uint8_t *overlay_back_ptr(aw32 addr)
+{
+	return &overlayBuffer[1-vfront][addr - _OVERLAY_BACK_BUFFER_BASE];
+}
+
+static uint8_t *overlay_front_ptr(aw32 addr)
+{
+	return &overlayBuffer[vfront][addr - _OVERLAY_FRONT_BUFFER_BASE];
+}
+
+/* Both banks share the region; addr bit 4 picks front or back */
+static uint8_t *palette_ptr(aw32 addr)
+{
+	int bank = (addr & 0x10) ? vfront : (1 - vfront);
+	return &screenPalette[bank][addr & 0x0F];
+}
+
+static uint8_t *secondary_palette_ptr(aw32 addr)
+{
+	return &secondaryPalette[1 - vfront][addr - _SECONDARY_PALETTE_BASE];
+}
+
+static uint8_t *high_colour_ptr(aw32 addr)
+{
+	return &highColourBitfield[1 - vfront][addr - _HIGH_COLOUR_BITFIELD_BASE];
+}
+
+static rw8 p8audio_read(aw32 addr)
+{
+	if (addr >= _P8AUDIO_STAT46 && addr <= _P8AUDIO_STAT57 + 1) {
+		uint16_t w = p8audio_verilated_mmio_read(
+			(uint8_t)((addr & ~1u) - _P8AUDIO_BASE));
+		return (addr & 1u) ? (w & 0xFF) : ((w >> 8) & 0xFF);
+	}
+	return 0;
+}
+
+/* A block of word registers, name_read() and name_write(); byte accesses
+   go through hw_regs_read_byte() and hw_regs_write_byte() */
+#define HW_REGS(_base_, _size_, _name_, _strobe_) \
+	{ _base_, _size_, 0, NULL, NULL, NULL, NULL, NULL, NULL, \
+	  _name_##_read, _name_##_write, _strobe_ }
+
+static hw_region hw_regions[] = {
+	{ _KEYBOARD_MATRIX, 0x20, 0, NULL, NULL, kbd_read, NULL, NULL, NULL },
+	{ _KEYBOARD_MATRIX_LATCHED, 0x20, 0, NULL, NULL, kbd_latched_read, kbd_latched_write, NULL, NULL },
+	{ _DA_MEMORY_BASE, _DA_MEMORY_SIZE, 0, NULL, NULL, da_read, da_write, da_read_word, da_write_word },
+	{ _BACK_BUFFER_BASE, _FRAME_BUFFER_SIZE, _FRAME_BUFFER_SIZE, back_ptr, back_dirty, NULL, NULL, NULL, NULL },
+	{ _FRONT_BUFFER_BASE, _FRAME_BUFFER_SIZE, _FRAME_BUFFER_SIZE, front_ptr, front_dirty, NULL, NULL, NULL, NULL },
+	{ _OVERLAY_BACK_BUFFER_BASE, _FRAME_BUFFER_SIZE, _FRAME_BUFFER_SIZE, overlay_back_ptr, overlay_back_dirty, NULL, NULL, NULL, NULL },
+	{ _OVERLAY_FRONT_BUFFER_BASE, _FRAME_BUFFER_SIZE, _FRAME_BUFFER_SIZE, overlay_front_ptr, overlay_front_dirty, NULL, NULL, NULL, NULL },
+	{ _PALETTE_BASE, _PALETTE_SIZE * 2, _PALETTE_SIZE, palette_ptr, palette_dirty, NULL, NULL, NULL, NULL },
+	{ _SECONDARY_PALETTE_BASE, _PALETTE_SIZE, _PALETTE_SIZE, secondary_palette_ptr, palette_dirty, NULL, NULL, NULL, NULL },
+	{ _HIGH_COLOUR_BITFIELD_BASE, _PALETTE_SIZE, _PALETTE_SIZE, high_colour_ptr, palette_dirty, NULL, NULL, NULL, NULL },
+	{ _P8AUDIO_BASE, 0x100, 0, NULL, NULL, p8audio_read, NULL, NULL, NULL },
+	HW_REGS(_SD_DMA_BASE, _SD_DMA_SIZE, sd_dma, SD_DMA_REG_CTRL),
+	HW_REGS(_PERFCTR_BASE, _PERFCTR_SIZE, perfctr, -1),
+	HW_REGS(_SEMIHOST_BASE, _SEMIHOST_SIZE, semihost, SEMIHOST_REG_CMD),
+	HW_REGS(_BLITTER_BASE, _BLITTER_SIZE, blitter, BLITTER_REG_CTRL),
+	HW_REGS(_MEMDMA_BASE, _MEMDMA_SIZE, memdma, MEMDMA_REG_CTRL),
+	HW_REGS(_FIXMATH_BASE, _FIXMATH_SIZE, fixmath, FIXMATH_REG_CTRL),
+	HW_REGS(_DASTREAM_BASE, _DASTREAM_SIZE, dastream, DASTREAM_REG_CTRL),
+};
+
+#define HW_NREGIONS	(sizeof(hw_regions) / sizeof(hw_regions[0]))
+
+/* 1 + index of the first region reaching into each bucket, 0 for none */
+static uw8 hw_region_bucket[HW_REGION_BUCKETS];
+
+static int hw_region_cmp(const void *a, const void *b)
+{
+	const hw_region *ra = a, *rb = b;
+
+	return (ra->base > rb->base) - (ra->base < rb->base);
+}
+
+void HWRegionsInit(void)
+{
+	unsigned i, b;
+
+	qsort(hw_regions, HW_NREGIONS, sizeof(hw_regions[0]), hw_region_cmp);
+	memset(hw_region_bucket, 0, sizeof(hw_region_bucket));
+	for (i = HW_NREGIONS; i-- > 0;) {
+		for (b = hw_regions[i].base >> HW_REGION_SHIFT;
+		     b <= (hw_regions[i].base + hw_regions[i].size - 1) >> HW_REGION_SHIFT;
+		     b++)
+			hw_region_bucket[b] = i + 1;
+	}
+}
+
+#ifdef PROFILER
+/* Names for the profiler's data access heatmap */
+static const struct {
+	const char *name;
+	aw32 base, size;
+} profile_regions[] = {
+	{ "DA memory", _DA_MEMORY_BASE, _DA_MEMORY_SIZE },
+	{ "back buffer", _BACK_BUFFER_BASE, _FRAME_BUFFER_SIZE },
+	{ "front buffer", _FRONT_BUFFER_BASE, _FRAME_BUFFER_SIZE },
+	{ "overlay back buffer", _OVERLAY_BACK_BUFFER_BASE, _FRAME_BUFFER_SIZE },
+	{ "overlay front buffer", _OVERLAY_FRONT_BUFFER_BASE, _FRAME_BUFFER_SIZE },
+	{ "palette", _PALETTE_BASE, _PALETTE_SIZE * 2 },
+	{ "secondary palette", _SECONDARY_PALETTE_BASE, _PALETTE_SIZE },
+	{ "high colour bitfield", _HIGH_COLOUR_BITFIELD_BASE, _PALETTE_SIZE },
+	{ "p8audio", _P8AUDIO_BASE, 0x100 },
+	{ "SD DMA", _SD_DMA_BASE, _SD_DMA_SIZE },
+	{ "PERFCTR", _PERFCTR_BASE, _PERFCTR_SIZE },
+	{ "semihosting", _SEMIHOST_BASE, _SEMIHOST_SIZE },
+	{ "blitter", _BLITTER_BASE, _BLITTER_SIZE },
+	{ "memory DMA", _MEMDMA_BASE, _MEMDMA_SIZE },
+	{ "math unit", _FIXMATH_BASE, _FIXMATH_SIZE },
+	{ "DA streaming", _DASTREAM_BASE, _DASTREAM_SIZE },
+	{ "UART_CTRL", _UART_CTRL, 2 },
+	{ "UART_DATA", _UART_DATA, 2 },
+	{ "UART_BAUD_DIV", _UART_BAUD_DIV, 2 },
+	{ "ESP_CTRL", _ESP_CTRL, 2 },
+	{ "ESP_DATA", _ESP_DATA, 2 },
+	{ "ESP_BAUD_DIV", _ESP_BAUD_DIV, 2 },
+};
+
+void HWRegionsProfile(void)
+{
+	unsigned i;
+
+	Profiler_AddMemoryRegion("RAM", 0, RTOP);
+	for (i = 0; i < sizeof(profile_regions) / sizeof(profile_regions[0]); i++)
+		Profiler_AddMemoryRegion(profile_regions[i].name, profile_regions[i].base,
+					 profile_regions[i].size);
+}
+#endif
+
+static inline const hw_region *hw_region_find(aw32 addr)
+{
+	const hw_region *r;
+	unsigned i = hw_region_bucket[(addr & ADDR_MASK) >> HW_REGION_SHIFT];
+
+	if (i == 0)
+		return NULL;
+	for (r = &hw_regions[i - 1]; r < &hw_regions[HW_NREGIONS] && r->base <= addr; r++) {
+		if (addr - r->base < r->size)
+			return r;
+	}
+	return NULL;
+}
+
+/* Host pointer for an n-byte access at addr, NULL if ptr() cannot serve it */
+static inline uint8_t *hw_region_ptr(const hw_region *r, aw32 addr, unsigned n)
+{
+	if (r == NULL || r->ptr == NULL ||
+	    ((addr - r->base) & (r->span - 1)) + n > r->span)
+		return NULL;
+	return r->ptr(addr);
+}
+
+static rw8 hw_regs_read_byte(const hw_region *r, aw32 addr)
+{
+	uint16_t w = r->read16((addr & ~1u) - r->base);
+
+	return (addr & 1) ? (w & 0xff) : (w >> 8);
+}
+
+/* Half a register, the other half as read, or 0 for the strobe register */
+static void hw_regs_write_byte(const hw_region *r, aw32 addr, aw8 d)
+{
+	unsigned reg = (addr & ~1u) - r->base;
+	uint16_t w = (int)reg == r->strobe ? 0 : r->read16(reg);
+
+	if (addr & 1)
+		w = (w & 0xff00) | (uw8)d;
+	else
+		w = (w & 0x00ff) | ((uw8)d << 8);
+	r->write16(reg, w);
+}
+
+uint8_t *HWHostRange(uw32 addr, uw32 len, int write)
+{
+	const hw_region *r = hw_region_find(addr);
+	uint8_t *p = len ? hw_region_ptr(r, addr, len) : NULL;
+	uw32 a;
+
+	if (p && write) {
+		/* dirty() marks the ends of a store, so go a line at a time */
+		for (a = addr; a - addr < len; a += 64)
+			r->dirty(a, 1);
+		r->dirty(addr + len - 1, 1);
+	}
+	return p;
+}
+
+/* Region of a HW access, for the runtime counters */
+static int hw_metric_region(uw32 addr)
+{
+	if (addr - _DA_MEMORY_BASE < _DA_MEMORY_SIZE)
+		return METRIC_REGION_DA;
+	if (addr - _BACK_BUFFER_BASE < _FRAME_BUFFER_SIZE ||
+	    addr - _FRONT_BUFFER_BASE < _FRAME_BUFFER_SIZE ||
+	    addr - _OVERLAY_BACK_BUFFER_BASE < _FRAME_BUFFER_SIZE ||
+	    addr - _OVERLAY_FRONT_BUFFER_BASE < _FRAME_BUFFER_SIZE)
+		return METRIC_REGION_FB;
+	if (addr - _PALETTE_BASE < _PALETTE_SIZE * 2 ||
+	    addr - _SECONDARY_PALETTE_BASE < _PALETTE_SIZE ||
+	    addr - _HIGH_COLOUR_BITFIELD_BASE < _PALETTE_SIZE)
+		return METRIC_REGION_PALETTE;
+	if (addr - _KEYBOARD_MATRIX < 0x20 || addr - _KEYBOARD_MATRIX_LATCHED < 0x20)
+		return METRIC_REGION_KBD;
+	if (addr - _P8AUDIO_BASE < 0x100)
+		return METRIC_REGION_P8AUDIO;
+	if (addr - _SD_DMA_BASE < _SD_DMA_SIZE)
+		return METRIC_REGION_SD_DMA;
+	return METRIC_REGION_REGS;
+}
+
+static inline void hw_metric(uint64_t *counts, aw32 addr)
+{
+	if (unlikely(metrics_enabled))
+		counts[hw_metric_region(addr)]++;
+}
+#else
+#define hw_metric(counts, addr)
+#endif
+
 void WriteHWByte(aw32 addr, aw8 d)
 {
+	hw_metric(metric_hw_writes, addr);
 	/*
 	if (!(addr >= _DA_MEMORY_BASE && addr < _DA_MEMORY_BASE + _DA_MEMORY_SIZE) &&
         !(addr >= _FRAME_BUFFER_BASE && addr < _FRAME_BUFFER_BASE + _FRAME_BUFFER_SIZE) &&
@@ -311,15 +791,23 @@ void WriteHWByte(aw32 addr, aw8 d)
 	case _POST_CODE:
 		printf("POST: %u [pc=0x%lx]\n", d, (unsigned long)((Ptr)pc - (Ptr)memBase - 2));
 		last_post_code = d;
+		savestatePost(d);
+		forkServerPost(d);
+		btracePost(d);
+		startupPost(d);
+		fuzzPost(d);
 		break;
 	case _VFRONTREQ:
 		//printf("VFRONTREQ: %d\n", d);
 		vfrontreq = d & 1;
+#ifdef PROFILER
+		Profiler_RecordMarker(PROFILER_MARKER_FLIP, d & 1);
+#endif
 		break;
 	case _VBLANK_INTR_CTRL:
 		vblank_intr_enable = d & 1;
 		// Clear pending VBLANK interrupt
-		pendingInterrupt = 0; extraFlag = true;
+		ClearInterrupt(2);
 		break;
 	case _SDSPI_CHIP_SELECT:
 		SDSPI_SetChipSelect(d);
@@ -350,6 +838,7 @@ void WriteHWByte(aw32 addr, aw8 d)
 			if ((d & 1) && !(esp_ctrl_prev & 1)) {
 				// Write strobe 0→1 transition - send latched data
 				ESP8266_ProcessUARTByte(esp8266, esp_data_latch);
+				metricAdd(METRIC_ESP_UART_TX, 1);
 			}
 		}
 		esp_ctrl_prev = d;
@@ -379,6 +868,7 @@ void WriteHWByte(aw32 addr, aw8 d)
 		break;
 	case _RESET_REQ:
 		printf("RESET_REQ: 0x%02x [pc=0x%lx]\n", d & 0xff, (unsigned long)((Ptr)pc - (Ptr)memBase - 2));
+		btraceResetReq();
 		if ((d & 0xff) == 0xff) {
 			extern bool exit_on_cpu_disable;
 			if (exit_on_cpu_disable) {
@@ -390,13 +880,19 @@ void WriteHWByte(aw32 addr, aw8 d)
 		}
 		break;
 	case _MOUSE_BUTTONS_LATCHED:
-		sdl_mouse_buttons_latched &= ~d;
+		inputLatchClear(&sdl_mouse_buttons_latched, d);
 		break;
 	case _JOYSTICK0_LATCHED:
-		joy_latched[0] &= ~d;
+		if (netplay_on)
+			netplayJoyLatchClear(0, d);
+		else
+			inputLatchClear(&joy_latched[0], d);
 		break;
 	case _JOYSTICK1_LATCHED:
-		joy_latched[1] &= ~d;
+		if (netplay_on)
+			netplayJoyLatchClear(1, d);
+		else
+			inputLatchClear(&joy_latched[1], d);
 		break;
 #else
 	case 0x018063: /* Display control */
@@ -440,46 +936,24 @@ void WriteHWByte(aw32 addr, aw8 d)
 #endif
 	default:
 #ifdef NEXTP8
-		if (addr >= _DA_MEMORY_BASE && addr < _DA_MEMORY_BASE + _DA_MEMORY_SIZE) {
-			if ((addr & 1) == 0)
-				da_memory[addr >> 1] = (da_memory[addr >> 1] & 0xff) | (d << 8);
-			else
-				da_memory[addr >> 1] = (da_memory[addr >> 1] & 0xff00) | d;
-			return;
-		}
-		if (addr >= _BACK_BUFFER_BASE && addr < _BACK_BUFFER_BASE + _FRAME_BUFFER_SIZE) {
-			frameBuffer[1-vfront][addr - _BACK_BUFFER_BASE] = d;
-			return;
-		}
-		if (addr >= _FRONT_BUFFER_BASE && addr < _FRONT_BUFFER_BASE + _FRAME_BUFFER_SIZE) {
-			frameBuffer[vfront][addr - _FRONT_BUFFER_BASE] = d;
-			return;
-		}
-		if (addr >= _OVERLAY_BACK_BUFFER_BASE && addr < _OVERLAY_BACK_BUFFER_BASE + _FRAME_BUFFER_SIZE) {
-			overlayBuffer[1-vfront][addr - _OVERLAY_BACK_BUFFER_BASE] = d;
-			return;
-		}
-		if (addr >= _OVERLAY_FRONT_BUFFER_BASE && addr < _OVERLAY_FRONT_BUFFER_BASE + _FRAME_BUFFER_SIZE) {
-			overlayBuffer[vfront][addr - _OVERLAY_FRONT_BUFFER_BASE] = d;
-			return;
-		}
-		if (addr >= _PALETTE_BASE && addr < _PALETTE_BASE + _PALETTE_SIZE * 2) {
-			int bank = (addr & 0x10) ? vfront : (1 - vfront);
-			screenPalette[bank][addr & 0x0F] = d;
-			return;
-		}
-		if (addr >= _SECONDARY_PALETTE_BASE && addr < _SECONDARY_PALETTE_BASE + _PALETTE_SIZE) {
-			secondaryPalette[1 - vfront][addr - _SECONDARY_PALETTE_BASE] = d;
-			return;
-		}
-		if (addr >= _HIGH_COLOUR_BITFIELD_BASE && addr < _HIGH_COLOUR_BITFIELD_BASE + _PALETTE_SIZE) {
-			highColourBitfield[1 - vfront][addr - _HIGH_COLOUR_BITFIELD_BASE] = d;
-			return;
-		}
-		if (addr >= _KEYBOARD_MATRIX_LATCHED &&
-			addr < _KEYBOARD_MATRIX_LATCHED + 0x20) {
-			sdl_keyrow_latched[addr - _KEYBOARD_MATRIX_LATCHED] &= ~d;
-			return;
+		{
+			const hw_region *r = hw_region_find(addr);
+			uint8_t *p = hw_region_ptr(r, addr, 1);
+
+			if (p) {
+				*p = d;
+				if (r->dirty)
+					r->dirty(addr, 1);
+				return;
+			}
+			if (r && r->write_byte) {
+				r->write_byte(addr, d);
+				return;
+			}
+			if (r && r->write16) {
+				hw_regs_write_byte(r, addr, d);
+				return;
+			}
 		}
 #endif
 		debug2("Write to HW register ", addr);
@@ -497,6 +971,8 @@ rw8 ReadHWByte(aw32 addr)
 	struct timespec timer;
 	uint8_t ret_byte;
 
+	hw_metric(metric_hw_reads, addr);
+
 	//printf("read HWreg %x, ",addr);
 
 	switch (addr) {
@@ -511,7 +987,7 @@ rw8 ReadHWByte(aw32 addr)
 		return patch_version;  /* PATCH_VERSION */
 	case _VFRONT:
 		//printf("VFRONT: %d\n", vfront);
-		return vfront;
+		return idle_poll(addr, vfront);
 	case _SDSPI_DATA_OUT:
 		return SDSPI_GetDataOut();
 	case _SDSPI_READY:
@@ -537,9 +1013,11 @@ rw8 ReadHWByte(aw32 addr)
 				ctrl |= 1;
 			}
 			// Bit 1: Ready (can accept write)
-			ctrl |= 2;  // Always ready for now
+			if (ESP8266_UARTReady(esp8266)) {
+				ctrl |= 2;
+			}
 		}
-		return ctrl;
+		return replayValue(REPLAY_ESP, ctrl);
 	}
 	case _ESP_DATA: {
 		// Read byte from ESP8266 UART
@@ -548,9 +1026,10 @@ rw8 ReadHWByte(aw32 addr)
 			int byte = ESP8266_GetUARTByte(esp8266);
 			if (byte >= 0) {
 				ret = (uint8_t)byte;
+				metricAdd(METRIC_ESP_UART_RX, 1);
 			}
 		}
-		return ret;
+		return replayValue(REPLAY_ESP, ret);
 	}
 	case _ESP_BAUD_DIV:
 		// Return current baud divisor (default 115200)
@@ -566,13 +1045,22 @@ rw8 ReadHWByte(aw32 addr)
 	case _HIGH_COLOUR_MODE:
 		return high_colour_mode;
 	case _JOYSTICK0:
-		return joy_state[0];
+		return idle_poll(addr, replayValue(REPLAY_JOY,
+			netplay_on ? netplayJoy(0) : inputSnapshot()->joy[0]));
 	case _JOYSTICK1:
-		return joy_state[1];
+		return idle_poll(addr, replayValue(REPLAY_JOY,
+			netplay_on ? netplayJoy(1) : inputSnapshot()->joy[1]));
 	case _JOYSTICK0_LATCHED:
-		return joy_latched[0];
+		return idle_poll(addr, replayValue(REPLAY_JOY,
+			netplay_on ? netplayJoyLatched(0) : SDL_AtomicGet(&joy_latched[0])));
 	case _JOYSTICK1_LATCHED:
-		return joy_latched[1];
+		return idle_poll(addr, replayValue(REPLAY_JOY,
+			netplay_on ? netplayJoyLatched(1) : SDL_AtomicGet(&joy_latched[1])));
+	case _MOUSE_BUTTONS:
+		return idle_poll(addr, replayValue(REPLAY_MOUSE, inputSnapshot()->mouse_buttons));
+	case _MOUSE_BUTTONS_LATCHED:
+		return idle_poll(addr, replayValue(REPLAY_MOUSE,
+			SDL_AtomicGet(&sdl_mouse_buttons_latched)));
 #else
 	case 0x018000: /* Read from real-time clock */
 	case 0x018001:
@@ -629,50 +1117,16 @@ rw8 ReadHWByte(aw32 addr)
 #endif
 	default:
 #ifdef NEXTP8
-		if (addr >= _KEYBOARD_MATRIX &&
-			addr < _KEYBOARD_MATRIX + 0x20) {
-			// read from keyboard
-			return sdl_keyrow[addr - _KEYBOARD_MATRIX];
-		}
-		if (addr >= _KEYBOARD_MATRIX_LATCHED &&
-			addr < _KEYBOARD_MATRIX_LATCHED + 0x20) {
-			return sdl_keyrow_latched[addr - _KEYBOARD_MATRIX_LATCHED];
-		}
-		if (addr == _MOUSE_BUTTONS) {
-			return sdl_mouse_buttons;
-		}
-		if (addr == _MOUSE_BUTTONS_LATCHED) {
-			return sdl_mouse_buttons_latched;
-		}
-		if (addr >= _DA_MEMORY_BASE && addr < _DA_MEMORY_BASE + _DA_MEMORY_SIZE) {
-			if ((addr & 1) == 0)
-				return da_memory[(addr - _DA_MEMORY_BASE) >> 1] >> 8;
-			else
-				return da_memory[(addr - _DA_MEMORY_BASE) >> 1] & 0xff;
-		}
-		if (addr >= _BACK_BUFFER_BASE && addr < _BACK_BUFFER_BASE + _FRAME_BUFFER_SIZE)
-			return frameBuffer[1-vfront][addr - _BACK_BUFFER_BASE] & 0xff;
-		if (addr >= _FRONT_BUFFER_BASE && addr < _FRONT_BUFFER_BASE + _FRAME_BUFFER_SIZE)
-			return frameBuffer[vfront][addr - _FRONT_BUFFER_BASE] & 0xff;
-		if (addr >= _OVERLAY_BACK_BUFFER_BASE && addr < _OVERLAY_BACK_BUFFER_BASE + 8192)
-			return overlayBuffer[1-vfront][addr - _OVERLAY_BACK_BUFFER_BASE] & 0xff;
-		if (addr >= _OVERLAY_FRONT_BUFFER_BASE && addr < _OVERLAY_FRONT_BUFFER_BASE + 8192)
-			return overlayBuffer[vfront][addr - _OVERLAY_FRONT_BUFFER_BASE] & 0xff;
-		if (addr >= _PALETTE_BASE && addr < _PALETTE_BASE + _PALETTE_SIZE * 2) {
-			int bank = (addr & 0x10) ? vfront : (1 - vfront);
-			return screenPalette[bank][addr & 0x0F] & 0xff;
-		}
-		if (addr >= _SECONDARY_PALETTE_BASE && addr < _SECONDARY_PALETTE_BASE + _PALETTE_SIZE)
-			return secondaryPalette[1 - vfront][addr - _SECONDARY_PALETTE_BASE] & 0xff;
-		if (addr >= _HIGH_COLOUR_BITFIELD_BASE && addr < _HIGH_COLOUR_BITFIELD_BASE + _PALETTE_SIZE)
-			return highColourBitfield[1 - vfront][addr - _HIGH_COLOUR_BITFIELD_BASE] & 0xff;
-		if (addr >= _P8AUDIO_BASE && addr < _P8AUDIO_BASE + 0x100) {
-			if (addr >= _P8AUDIO_STAT46 && addr <= _P8AUDIO_STAT57 + 1) {
-				uint16_t w = p8audio_verilated_mmio_read(
-					(uint8_t)((addr & ~1u) - _P8AUDIO_BASE));
-				return (addr & 1u) ? (w & 0xFF) : ((w >> 8) & 0xFF);
-			}
-			return 0;
+		{
+			const hw_region *r = hw_region_find(addr);
+			uint8_t *p = hw_region_ptr(r, addr, 1);
+
+			if (p)
+				return *p;
+			if (r && r->read_byte)
+				return r->read_byte(addr);
+			if (r && r->read16)
+				return hw_regs_read_byte(r, addr);
 		}
 #endif
 		debug2("Read from HW register ", addr);
@@ -686,24 +1140,31 @@ rw8 ReadHWByte(aw32 addr)
 static uint64_t utimer_latched = 0;
 static unsigned utimer_last_slice = 3;
 
-static uint64_t GetUserTimer(void)
+static uint64_t GetHostUserTimer(void)
 {
-#ifdef PROFILER
-	// Use profiler cycle count for deterministic timing
-	return Profiler_CyclesToMicroseconds(Profiler_GetCycleCount());
-#else
+	if (utimer_mode == UTIMER_EMULATED)
+		return cyclesToUs(cpu_cycles);
 	struct timespec ts;
+	// Waiting on the host clock, emulated time can't be skipped
+	idlePoll(_UTIMER_1MHZ_1500, 0, true);
+	if (utimer_mode == UTIMER_SYNC)
+		return utimerSynced();
 	clock_gettime(CLOCK_MONOTONIC, &ts);
 	return ts.tv_sec * UINT64_C(1000000) + ts.tv_nsec / UINT64_C(1000);
-#endif
+}
+
+static uint64_t GetUserTimer(void)
+{
+	return replayValue(REPLAY_UTIMER, GetHostUserTimer());
 }
 
 rw16 ReadHWWord(aw32 addr)
 {
+	hw_metric(metric_hw_reads, addr);
 	switch (addr) {
 #ifdef NEXTP8
 	case _DA_CONTROL:
-		return da_address;
+		return daReadAddress();
 	case _UTIMER_1MHZ_6348: {
 		utimer_latched = GetUserTimer();
 		utimer_last_slice = 0;
@@ -741,17 +1202,26 @@ rw16 ReadHWWord(aw32 addr)
 	case _P8AUDIO_STAT55:
 	case _P8AUDIO_STAT56:
 	case _P8AUDIO_STAT57:
-		return p8audio_verilated_mmio_read((uint8_t)(addr - _P8AUDIO_BASE));
+		return replayValue(REPLAY_AUDIO,
+			p8audio_verilated_mmio_read((uint8_t)(addr - _P8AUDIO_BASE)));
 	case _MOUSE_X:
-		return (uint16_t)sdl_mouse_x_accum;
+		return idle_poll(addr, replayValue(REPLAY_MOUSE, (uint16_t)inputSnapshot()->mouse_x));
 	case _MOUSE_Y:
-		return (uint16_t)sdl_mouse_y_accum;
+		return idle_poll(addr, replayValue(REPLAY_MOUSE, (uint16_t)inputSnapshot()->mouse_y));
 	case _MOUSE_Z:
-		return (uint16_t)sdl_mouse_z_accum;
+		return idle_poll(addr, replayValue(REPLAY_MOUSE, (uint16_t)inputSnapshot()->mouse_z));
 	case _DEBUG_REG_HI:
 		return debug_reg_hi;
 	case _DEBUG_REG_LO:
 		return debug_reg_lo;
+	case _ESP_DATA & ~1: {
+		// Burst read: the next two ESP8266 bytes, the first in the high
+		// byte, so long reads and movem pull a +IPD payload in bulk
+		uint8_t b[2] = { 0, 0 };
+		if (esp8266)
+			metricAdd(METRIC_ESP_UART_RX, ESP8266_GetUARTBytes(esp8266, b, 2));
+		return replayValue(REPLAY_ESP, (b[0] << 8) | b[1]);
+	}
 #else
 	case 0x018108:
 		return SQLUXBDISizeHigh();
@@ -762,12 +1232,16 @@ rw16 ReadHWWord(aw32 addr)
 #endif
 	default:
 #ifdef NEXTP8
-		if (addr >= _DA_MEMORY_BASE && addr < _DA_MEMORY_BASE + _DA_MEMORY_SIZE) {
-#if __BYTE_ORDER == __BIG_ENDIAN
-			return da_memory[(addr - _DA_MEMORY_BASE) >> 1];
-#else
-			return __builtin_bswap16(da_memory[(addr - _DA_MEMORY_BASE) >> 1]);
-#endif
+		{
+			const hw_region *r = hw_region_find(addr);
+			uint8_t *p = hw_region_ptr(r, addr, 2);
+
+			if (p)
+				return (w16)RW(p);
+			if (r && r->read_word)
+				return r->read_word(addr);
+			if (r && r->read16)
+				return r->read16(addr - r->base);
 		}
 #endif
 		return ((w16)ReadHWByte(addr) << 8) | (uw8)ReadHWByte(addr + 1);
@@ -776,25 +1250,36 @@ rw16 ReadHWWord(aw32 addr)
 
 void WriteHWWord(aw32 addr, aw16 d)
 {
-	if (!(addr >= _DA_MEMORY_BASE && addr < _DA_MEMORY_BASE + _DA_MEMORY_SIZE) &&
-		!(addr >= _BACK_BUFFER_BASE && addr < _BACK_BUFFER_BASE + _FRAME_BUFFER_SIZE) &&
-		!(addr >= _FRONT_BUFFER_BASE && addr < _FRONT_BUFFER_BASE + _FRAME_BUFFER_SIZE) &&
-		!(addr >= _OVERLAY_BACK_BUFFER_BASE && addr < _OVERLAY_BACK_BUFFER_BASE + 8192) &&
-		!(addr >= _OVERLAY_FRONT_BUFFER_BASE && addr < _OVERLAY_FRONT_BUFFER_BASE + 8192) &&
-		!(addr >= _PALETTE_BASE && addr < _PALETTE_BASE + _PALETTE_SIZE * 2) &&
-		!(addr >= _KEYBOARD_MATRIX_LATCHED && addr < _KEYBOARD_MATRIX_LATCHED + 0x20) &&
-		addr != _JOYSTICK0_LATCHED && addr != _JOYSTICK1_LATCHED && addr != _MOUSE_BUTTONS_LATCHED)
-		printf("WriteHWWord at 0x%lx val=0x%x [pc=0x%lx]\n", (unsigned long) addr, ((unsigned) d) & 0xffff, (unsigned long)((Ptr)pc - (Ptr)memBase - 2));
+#ifdef NEXTP8
+	const hw_region *r = hw_region_find(addr);
+	uint8_t *p = hw_region_ptr(r, addr, 2);
+
+	hw_metric(metric_hw_writes, addr);
+	if (p) {
+		WW(p, d);
+		if (r->dirty)
+			r->dirty(addr, 2);
+		return;
+	}
+	if ((r == NULL || (r->ptr == NULL && r->write_byte == NULL && r->write16 == NULL)) &&
+		addr != _JOYSTICK0_LATCHED && addr != _JOYSTICK1_LATCHED && addr != _MOUSE_BUTTONS_LATCHED &&
+		addr != (_ESP_DATA & ~1))
+		LOG(LOGM_HW, LOG_WARN, "WriteHWWord at 0x%lx val=0x%x [pc=0x%lx]\n", (unsigned long) addr, ((unsigned) d) & 0xffff, (unsigned long)((Ptr)pc - (Ptr)memBase - 2));
+#endif
 	switch (addr) {
 #ifdef NEXTP8
 	case _DA_CONTROL:
+		dastream_sync();
 		da_start = d & 1;
 		da_mono = (d >> 8) & 1;
-		printf("da_start = %u da_mono = %u\n", da_start, da_mono);
+		dastream_changed();
+		LOG(LOGM_AUDIO, LOG_DEBUG, "da_start = %u da_mono = %u\n", da_start, da_mono);
 		break;
 	case _DA_PERIOD:
+		dastream_sync();
 		da_period = d & 0xfff;
-		printf("da_period = %u\n", da_period);
+		dastream_changed();
+		LOG(LOGM_AUDIO, LOG_DEBUG, "da_period = %u\n", da_period);
 		break;
 	case _P8AUDIO_CTRL:
 	case _P8AUDIO_SFX_BASE_HI:
@@ -805,7 +1290,12 @@ void WriteHWWord(aw32 addr, aw16 d)
 	case _P8AUDIO_MUSIC_FADE:
 	case _P8AUDIO_SFX_CMD:
 	case _P8AUDIO_MUSIC_CMD:
-		p8audio_verilated_mmio_write((uint8_t)(addr - _P8AUDIO_BASE), d);
+#ifdef PROFILER
+		Profiler_RecordMarker(PROFILER_MARKER_AUDIO, addr - _P8AUDIO_BASE);
+		Profiler_RecordMarker(PROFILER_MARKER_VALUE, d);
+#endif
+		p8audio_verilated_mmio_write((uint8_t)(addr - _P8AUDIO_BASE), d,
+					     pacerEmuNs());
 		break;
 	case _UART_BAUD_DIV:
 		UART_TickAndReceive(1);
@@ -819,6 +1309,16 @@ void WriteHWWord(aw32 addr, aw16 d)
 	case _DEBUG_REG_LO:
 		debug_reg_lo = d;
 		break;
+	case _ESP_DATA & ~1: {
+		// Burst write: two bytes to the ESP8266, high byte first, the
+		// counterpart of the burst read for CIPSEND payloads
+		uint8_t b[2] = { d >> 8, d & 0xff };
+		if (esp8266) {
+			ESP8266_ProcessUARTBytes(esp8266, b, 2);
+			metricAdd(METRIC_ESP_UART_TX, 2);
+		}
+		break;
+	}
 #else
 	case 0x018104:
 		SQLUXBDIAddressHigh(d);
@@ -826,15 +1326,24 @@ void WriteHWWord(aw32 addr, aw16 d)
 	case 0x018106:
 		SQLUXBDIAddressLow(d);
 		break;
+	case 0x01810C:
+		SQLUXBDIDMAAddressHigh(d);
+		break;
+	case 0x01810E:
+		SQLUXBDIDMAAddressLow(d);
+		break;
+	case 0x018110:
+		SQLUXBDIDMACount(d);
+		break;
 #endif
 	default:
 #ifdef NEXTP8
-		if (addr >= _DA_MEMORY_BASE && addr < _DA_MEMORY_BASE + _DA_MEMORY_SIZE) {
-#if __BYTE_ORDER == __BIG_ENDIAN
-			da_memory[(addr - _DA_MEMORY_BASE) >> 1] = d;
-#else
-			da_memory[(addr - _DA_MEMORY_BASE) >> 1] = __builtin_bswap16(d);
-#endif
+		if (r && r->write_word) {
+			r->write_word(addr, d);
+			return;
+		}
+		if (r && r->write16) {
+			r->write16(addr - r->base, d);
 			return;
 		}
 #endif
@@ -843,6 +1352,24 @@ void WriteHWWord(aw32 addr, aw16 d)
 	}
 }
 
+void WriteHWLong(aw32 addr, aw32 d)
+{
+#ifdef NEXTP8
+	const hw_region *r = hw_region_find(addr);
+	uint8_t *p = hw_region_ptr(r, addr, 4);
+
+	if (p) {
+		hw_metric(metric_hw_writes, addr);
+		WL(p, d);
+		if (r->dirty)
+			r->dirty(addr, 4);
+		return;
+	}
+#endif
+	WriteHWWord(addr, d >> 16);
+	WriteHWWord(addr + 2, d);
+}
+
 aw32 ReadHWLong(aw32 addr)
 {
 	uint64_t nanotime;
@@ -864,3 +1391,30 @@ aw32 ReadHWLong(aw32 addr)
 		return ((w32)ReadWord(addr) << 16) | (uw16)ReadWord(addr + 2);
 	}
 }
+
+#ifdef NEXTP8
+void HWSaveState(ss_buf *b)
+{
+	ssPut8(b, esp_data_latch);
+	ssPut8(b, esp_ctrl_prev);
+	ssPut16(b, debug_reg_hi);
+	ssPut16(b, debug_reg_lo);
+	ssPut8(b, last_post_code);
+	ssPut32(b, uart_busy_bits);
+	ssPut64(b, utimer_latched);
+	ssPut8(b, utimer_last_slice);
+}
+
+int HWLoadState(ss_buf *b)
+{
+	esp_data_latch = ssGet8(b);
+	esp_ctrl_prev = ssGet8(b);
+	debug_reg_hi = ssGet16(b);
+	debug_reg_lo = ssGet16(b);
+	last_post_code = ssGet8(b);
+	uart_busy_bits = ssGet32(b);
+	utimer_latched = ssGet64(b);
+	utimer_last_slice = ssGet8(b);
+	return b->error ? -1 : 0;
+}
+#endif
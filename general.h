@@ -5,6 +5,22 @@ void WriteHWByte(aw32 addr, aw8 d);
 rw8 ReadHWByte(aw32 addr);
 rw16 ReadHWWord(aw32 addr);
 void WriteHWWord(aw32 addr, aw16 d);
+void WriteHWLong(aw32 addr, aw32 d);
 rw32 ReadHWLong(aw32 addr);
 
+#ifdef NEXTP8
+struct ss_buf;
+
+void HWRegionsInit(void);
+/* Host address of len bytes of a buffer region at addr, or NULL; with
+   write set the bytes are marked for redraw as stored through */
+uint8_t *HWHostRange(uw32 addr, uw32 len, int write);
+/* Save state: the registers general.c keeps itself */
+void HWSaveState(struct ss_buf *b);
+int HWLoadState(struct ss_buf *b);
+#ifdef PROFILER
+void HWRegionsProfile(void);
+#endif
+#endif
+
 #endif /* _GENERAL_H */
@@ -0,0 +1,473 @@
+/*
+ * hle.c
+ *
+ * High-level emulation of libc routines, see hle.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "QL68000.h"
+#include "cycles.h"
+#include "hle.h"
+#include "instructions.h"
+#include "memaccess.h"
+#ifdef DECODE_CACHE
+#include "decode_cache.h"
+#endif
+
+#define HLE_MAX_FUNCS		16
+#define HLE_CHECK_MAX		65536	/* bytes a check compares */
+#define HLE_CHECK_REPORTS	20
+
+/* Cycles charged instead of the guest's: the RTS and a rough loop cost */
+#define HLE_CYCLES_CALL		16
+#define HLE_CYCLES_BYTE		4
+#define HLE_CYCLES_MUL		70
+#define HLE_CYCLES_DIV		150
+
+enum hle_kind {
+	HLE_MEMCPY,
+	HLE_MEMSET,
+	HLE_STRLEN,
+	HLE_MUL,
+	HLE_DIVS,
+	HLE_DIVU,
+	HLE_MODS,
+	HLE_MODU,
+};
+
+static const struct {
+	const char *name;
+	enum hle_kind kind;
+} hle_names[] = {
+	{ "memcpy", HLE_MEMCPY },
+	{ "memmove", HLE_MEMCPY },
+	{ "memset", HLE_MEMSET },
+	{ "strlen", HLE_STRLEN },
+	{ "__mulsi3", HLE_MUL },
+	{ "__divsi3", HLE_DIVS },
+	{ "__udivsi3", HLE_DIVU },
+	{ "__modsi3", HLE_MODS },
+	{ "__umodsi3", HLE_MODU },
+};
+#define HLE_NAMES	(sizeof(hle_names) / sizeof(hle_names[0]))
+
+static struct {
+	uw32 addr;
+	int name;		/* index in hle_names */
+} funcs[HLE_MAX_FUNCS];
+static int nfuncs;
+
+int hle_count;
+
+static bool checking;
+static uint64_t checks, mismatches, skipped;
+
+/* The call whose guest version is running, checked when it returns */
+static struct {
+	int name;
+	uw32 ret;		/* 0xffffffff if none */
+	uw32 sp;		/* a7 after the RTS */
+	uw32 arg[3];
+	uw32 d0;
+	uw32 len;		/* bytes at arg[0] to compare, or 0 */
+	uw8 *mem;
+} pending = { .ret = 0xffffffff };
+
+static uw32 be32(const uw8 *p)
+{
+	return ((uw32)p[0] << 24) | ((uw32)p[1] << 16) | ((uw32)p[2] << 8) | p[3];
+}
+
+static uw16 be16(const uw8 *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static void add_func(uw32 addr, int name)
+{
+	int i;
+
+	addr &= ADDR_MASK;
+	if (addr & 1)
+		return;
+	for (i = 0; i < nfuncs; i++) {
+		if (funcs[i].addr == addr || funcs[i].name == name)
+			return;
+	}
+	if (nfuncs == HLE_MAX_FUNCS)
+		return;
+	funcs[nfuncs].addr = addr;
+	funcs[nfuncs].name = name;
+	nfuncs++;
+	printf("HLE: %s at 0x%06x\n", hle_names[name].name, addr);
+}
+
+/* Global functions among want[] in the symbol tables of a 68K ELF file */
+static void load_symbols(const char *path, const bool *want)
+{
+	FILE *f = fopen(path, "rb");
+	uw8 *data = NULL;
+	long size;
+	uw32 shoff, shentsize, shnum, i, j;
+	int k;
+
+	if (!f) {
+		fprintf(stderr, "HLE: can't open %s\n", path);
+		return;
+	}
+	if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) > 0 &&
+	    fseek(f, 0, SEEK_SET) == 0 && (data = malloc(size)) &&
+	    fread(data, 1, size, f) != (size_t)size) {
+		free(data);
+		data = NULL;
+	}
+	fclose(f);
+	if (!data || size < 52 || memcmp(data, "\177ELF", 4) ||
+	    data[4] != 1 || data[5] != 2) {
+		fprintf(stderr, "HLE: %s is not a 32-bit big endian ELF file\n", path);
+		free(data);
+		return;
+	}
+
+	shoff = be32(data + 0x20);
+	shentsize = be16(data + 0x2e);
+	shnum = be16(data + 0x30);
+	if (shentsize < 40 || shoff > (uw32)size ||
+	    (uint64_t)shnum * shentsize > (uw32)size - shoff) {
+		fprintf(stderr, "HLE: bad section table in %s\n", path);
+		free(data);
+		return;
+	}
+
+	for (i = 0; i < shnum; i++) {
+		const uw8 *sh = data + shoff + i * shentsize;
+		const uw8 *strsh;
+		uw32 off, len, stroff, strsize;
+
+		if (be32(sh + 4) != 2 || be32(sh + 24) >= shnum)	// SHT_SYMTAB
+			continue;
+		strsh = data + shoff + be32(sh + 24) * shentsize;
+		off = be32(sh + 16);
+		len = be32(sh + 20);
+		stroff = be32(strsh + 16);
+		strsize = be32(strsh + 20);
+		if (off > (uw32)size || len > (uw32)size - off ||
+		    stroff > (uw32)size || strsize > (uw32)size - stroff)
+			continue;
+
+		for (j = 16; j + 16 <= len; j += 16) {
+			const uw8 *s = data + off + j;
+			uw32 name = be32(s);
+			unsigned type = s[12] & 0xf, bind = s[12] >> 4;
+			uw16 shndx = be16(s + 14);
+			const char *sym;
+
+			if ((type != 2 && type != 0) || (bind != 1 && bind != 2))
+				continue;	// STT_FUNC or NOTYPE, STB_GLOBAL or WEAK
+			if (shndx == 0 || shndx >= shnum ||
+			    !(be32(data + shoff + shndx * shentsize + 8) & 4))
+				continue;	// SHF_EXECINSTR
+			if (name >= strsize ||
+			    !memchr(data + stroff + name, 0, strsize - name))
+				continue;
+			sym = (const char *)data + stroff + name;
+			for (k = 0; k < (int)HLE_NAMES; k++) {
+				if (want[k] && strcmp(sym, hle_names[k].name) == 0)
+					add_func(be32(s + 4), k);
+			}
+		}
+	}
+	free(data);
+}
+
+static void hle_report(void)
+{
+	printf("HLE check: %llu calls checked, %llu mismatches, %llu skipped\n",
+	       (unsigned long long)checks, (unsigned long long)mismatches,
+	       (unsigned long long)skipped);
+}
+
+void hleInit(const char *list, bool check, const char *cart_elf,
+	     const char *rom_elf)
+{
+	bool want[HLE_NAMES] = { false };
+	char *copy, *tok, *save;
+	int k;
+
+	if (!list || !*list)
+		return;
+#ifndef DECODE_CACHE
+	fprintf(stderr, "HLE: needs DECODE_CACHE\n");
+	return;
+#endif
+	copy = strdup(list);
+	for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		bool all = strcmp(tok, "all") == 0, found = all;
+
+		for (k = 0; k < (int)HLE_NAMES; k++) {
+			if (all || strcmp(tok, hle_names[k].name) == 0)
+				want[k] = found = true;
+		}
+		if (!found)
+			fprintf(stderr, "HLE: unknown routine %s\n", tok);
+	}
+	free(copy);
+
+	if (cart_elf && *cart_elf)
+		load_symbols(cart_elf, want);
+	if (rom_elf && *rom_elf)
+		load_symbols(rom_elf, want);
+	if (!nfuncs) {
+		fprintf(stderr, "HLE: no routines found, give cart_elf or rom1_elf\n");
+		return;
+	}
+
+	checking = check;
+	if (checking) {
+		pending.mem = malloc(HLE_CHECK_MAX);
+		atexit(hle_report);
+	}
+	hle_count = nfuncs;
+#ifdef DECODE_CACHE
+	dcache_flush();
+#endif
+}
+
+static int find_func(uw32 addr)
+{
+	int i;
+
+	for (i = 0; i < nfuncs; i++) {
+		if (funcs[i].addr == addr)
+			return i;
+	}
+	return -1;
+}
+
+bool hleAt(uw32 addr)
+{
+	return addr == pending.ret || find_func(addr) >= 0;
+}
+
+static void copy_bytes(uw32 dst, uw32 src, uw32 n)
+{
+	uw8 *d = MemoryHostRange(dst, n, 1);
+	const uw8 *s = MemoryHostRange(src, n, 0);
+	uw32 i;
+
+	if (d && s) {
+		memmove(d, s, n);
+		MemoryDMAWritten(dst, n);
+	} else if (dst <= src) {
+		for (i = 0; i < n; i++)
+			WriteByte(dst + i, ReadByte(src + i));
+	} else {
+		for (i = n; i-- > 0;)
+			WriteByte(dst + i, ReadByte(src + i));
+	}
+}
+
+static void set_bytes(uw32 dst, uw8 c, uw32 n)
+{
+	uw8 *d = MemoryHostRange(dst, n, 1);
+	uw32 i;
+
+	if (d) {
+		memset(d, c, n);
+		MemoryDMAWritten(dst, n);
+	} else {
+		for (i = 0; i < n; i++)
+			WriteByte(dst + i, c);
+	}
+}
+
+static uw32 string_length(uw32 s)
+{
+	uw32 n = 0;
+
+	while (n <= ADDR_MASK) {
+		const uw8 *p = MemoryHostRange(s + n, 256, 0);
+		const uw8 *z;
+
+		if (!p) {
+			if (!ReadByte(s + n))
+				break;
+			n++;
+		} else if ((z = memchr(p, 0, 256))) {
+			return n + (uw32)(z - p);
+		} else {
+			n += 256;
+		}
+	}
+	return n;
+}
+
+/* libgcc's results, false for a divide by zero, left to the guest's trap */
+static bool arith(enum hle_kind kind, uw32 a, uw32 b, uw32 *r)
+{
+	uw32 ua = (w32)a < 0 ? -a : a;
+	uw32 ub = (w32)b < 0 ? -b : b;
+
+	if (kind == HLE_MUL) {
+		*r = a * b;
+		return true;
+	}
+	if (!b)
+		return false;
+	switch (kind) {
+	case HLE_DIVU:
+		*r = a / b;
+		break;
+	case HLE_MODU:
+		*r = a % b;
+		break;
+	case HLE_DIVS:
+		*r = ((a ^ b) & 0x80000000) ? -(ua / ub) : ua / ub;
+		break;
+	default:
+		*r = (a & 0x80000000) ? -(ua % ub) : ua % ub;
+		break;
+	}
+	return true;
+}
+
+static void disarm(void)
+{
+	uw32 ret = pending.ret;
+
+	pending.ret = 0xffffffff;
+#ifdef DECODE_CACHE
+	dcache_invalidate_range(ret - 4, 6);
+#endif
+}
+
+/* Trap the caller's return to compare the result with the host's */
+static void arm(int name, uw32 sp, const uw32 *arg, uw32 d0)
+{
+	enum hle_kind kind = hle_names[name].kind;
+	uw32 ret = (uw32)ReadLong(sp) & ADDR_MASK;
+	const uw8 *src;
+
+	if (pending.ret != 0xffffffff) {
+		if (sp < pending.sp) {
+			// Called from inside the pending one, an interrupt say
+			skipped++;
+			return;
+		}
+		// The pending one never returned
+		disarm();
+	}
+	if (ret & 1 || !pending.mem) {
+		skipped++;
+		return;
+	}
+
+	pending.name = name;
+	pending.ret = ret;
+	pending.sp = sp + 4;
+	memcpy(pending.arg, arg, sizeof(pending.arg));
+	pending.d0 = d0;
+	pending.len = 0;
+	if ((kind == HLE_MEMCPY || kind == HLE_MEMSET) && arg[2] <= HLE_CHECK_MAX &&
+	    MemoryHostRange(arg[0], arg[2], 0)) {
+		if (kind == HLE_MEMSET) {
+			memset(pending.mem, arg[1] & 0xff, arg[2]);
+			pending.len = arg[2];
+		} else if ((src = MemoryHostRange(arg[1], arg[2], 0))) {
+			memcpy(pending.mem, src, arg[2]);
+			pending.len = arg[2];
+		}
+	}
+#ifdef DECODE_CACHE
+	dcache_invalidate_range(ret - 4, 6);
+#endif
+}
+
+static void check_return(void)
+{
+	const uw8 *p;
+	bool bad;
+
+	if ((uw32)*m68k_sp != pending.sp)
+		return;		// Recursion, or another caller
+	checks++;
+	bad = (uw32)reg[0] != pending.d0;
+	if (pending.len) {
+		p = MemoryHostRange(pending.arg[0], pending.len, 0);
+		bad |= !p || memcmp(p, pending.mem, pending.len) != 0;
+	}
+	if (bad && mismatches++ < HLE_CHECK_REPORTS)
+		fprintf(stderr, "HLE check: %s(0x%x, 0x%x, 0x%x) returned 0x%x%s, host 0x%x\n",
+			hle_names[pending.name].name, pending.arg[0], pending.arg[1],
+			pending.arg[2], (uw32)reg[0],
+			(uw32)reg[0] == pending.d0 ? " and different memory" : "",
+			pending.d0);
+	disarm();
+}
+
+void hleCall(void)
+{
+	uw32 addr = (uw32)((Ptr)pc - (Ptr)memBase) - 2;
+	uw32 sp = *m68k_sp;
+	uw32 arg[3], d0, cost;
+	enum hle_kind kind;
+	int i;
+
+	if (addr == pending.ret)
+		check_return();
+	i = find_func(addr);
+	if (i < 0) {
+		QLUX_HANDLER(code)();
+		return;
+	}
+
+	kind = hle_names[funcs[i].name].kind;
+	arg[0] = ReadLong(sp + 4);
+	arg[1] = ReadLong(sp + 8);
+	arg[2] = ReadLong(sp + 12);
+	switch (kind) {
+	case HLE_MEMCPY:
+	case HLE_MEMSET:
+		if (arg[2] > ADDR_MASK) {
+			QLUX_HANDLER(code)();
+			return;
+		}
+		d0 = arg[0];
+		cost = HLE_CYCLES_BYTE * arg[2];
+		break;
+	case HLE_STRLEN:
+		d0 = string_length(arg[0]);
+		cost = HLE_CYCLES_BYTE * d0;
+		break;
+	default:
+		if (!arith(kind, arg[0], arg[1], &d0)) {
+			QLUX_HANDLER(code)();
+			return;
+		}
+		cost = kind == HLE_MUL ? HLE_CYCLES_MUL : HLE_CYCLES_DIV;
+		break;
+	}
+
+	if (checking) {
+		arm(funcs[i].name, sp, arg, d0);
+		QLUX_HANDLER(code)();
+		return;
+	}
+
+	if (kind == HLE_MEMCPY)
+		copy_bytes(arg[0], arg[1], arg[2]);
+	else if (kind == HLE_MEMSET)
+		set_bytes(arg[0], arg[1] & 0xff, arg[2]);
+	reg[0] = d0;
+	if (kind == HLE_MEMCPY || kind == HLE_MEMSET)
+		aReg[0] = d0;
+	CC_FLUSH();
+	negative = (w32)d0 < 0;
+	zero = d0 == 0;
+	overflow = carry = 0;
+	cpu_cycles += HLE_CYCLES_CALL + cost;
+	rts();
+}
@@ -0,0 +1,37 @@
+/*
+ * hle.h
+ *
+ * High-level emulation of hot libc routines (--hle).  The entry points
+ * of memcpy, memmove, memset, strlen and libgcc's __mulsi3, __divsi3,
+ * __udivsi3, __modsi3 and __umodsi3 are looked up in the cart and rom 1
+ * ELF files, the decode cache traps them, and a host version does the
+ * work and returns to the caller as RTS would.  d0 (and a0 for the
+ * pointer results) holds the result and N and Z are set from d0 with V
+ * and C clear; the other scratch registers keep their values, which the
+ * ABI allows.
+ *
+ * With --hle_check the guest's own code runs instead, and its d0 and the
+ * memory it wrote are compared with the host version's when it returns.
+ */
+
+#ifndef HLE_H
+#define HLE_H
+
+#include <stdbool.h>
+
+#include "QL68000.h"
+
+/* Number of trapped addresses, 0 if HLE is off */
+extern int hle_count;
+
+/* funcs is a comma separated list of the routines above or "all" */
+void hleInit(const char *funcs, bool check, const char *cart_elf,
+	     const char *rom_elf);
+
+/* For the decode cache: addr is trapped */
+bool hleAt(uw32 addr);
+
+/* Decode cache handler for the trapped addresses */
+void hleCall(void);
+
+#endif /* HLE_H */
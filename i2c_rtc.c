@@ -9,6 +9,9 @@
  */
 
 #include "i2c_rtc.h"
+#include "cycles.h"
+#include "replay.h"
+#include "savestate.h"
 #include <string.h>
 #include <stdio.h>
 
@@ -60,6 +63,8 @@ typedef struct {
     bool pending_ctrl;                  /* Is there a pending control write */
     uint8_t last_data_in;               /* Latched data byte from last I2C transaction */
     bool last_rw;                       /* Latched rw bit from last I2C transaction */
+    time_t base_time;                   /* Host time at init, for emulated time */
+    uint64_t base_cycles;               /* cpu_cycles at init */
 } ds1307_state_t;
 
 /* Global DS1307 state */
@@ -81,11 +86,21 @@ static uint8_t bcd_to_bin(uint8_t bcd) {
     return ((bcd >> 4) * 10) + (bcd & 0x0F);
 }
 
+/**
+ * Current time: the host's, or with an emulated user timer the host's at
+ * init plus the emulated time since
+ */
+static time_t rtc_now(void) {
+    if (utimer_mode == UTIMER_EMULATED)
+        return ds1307.base_time +
+               (time_t)(cyclesToUs(cpu_cycles - ds1307.base_cycles) / 1000000);
+    return (time_t)replayValue(REPLAY_RTC, time(NULL));
+}
+
 /**
  * Update RTC registers from system time
  */
-static void update_rtc_registers(void) {
-    time_t now = time(NULL);
+static void update_rtc_registers(time_t now) {
     struct tm *tm_info = localtime(&now);
     
     if (tm_info == NULL) {
@@ -178,7 +193,10 @@ static void process_i2c_transaction(bool is_write) {
                 break;
         }
     } else {
-        /* Master is reading a byte from us */
+        /* Master is reading a byte from us; like the chip, the time is
+           latched once at the start of a read */
+        if (ds1307.state != I2C_READ_DATA && ds1307.reg_ptr < DS1307_RTC_REGS)
+            i2c_rtc_update();
         ds1307.state = I2C_READ_DATA;
         /* Prepare next byte for subsequent read */
         if (ds1307.reg_ptr < DS1307_MEM_SIZE) {
@@ -212,7 +230,9 @@ void i2c_rtc_init(void) {
     ds1307.last_rw = false;
     
     /* Set initial time from system */
-    update_rtc_registers();
+    ds1307.base_time = (time_t)replayValue(REPLAY_RTC, time(NULL));
+    ds1307.base_cycles = cpu_cycles;
+    update_rtc_registers(ds1307.base_time);
     
     /* Clear CH bit to start the clock */
     ds1307.memory[REG_SECONDS] &= ~SECONDS_CH_BIT;
@@ -221,10 +241,10 @@ void i2c_rtc_init(void) {
 }
 
 void i2c_rtc_update(void) {
-    /* Update RTC registers once per second */
-    time_t now = time(NULL);
+    /* Registers change once per second */
+    time_t now = rtc_now();
     if (now != ds1307.last_update) {
-        update_rtc_registers();
+        update_rtc_registers(now);
     }
 }
 
@@ -334,3 +354,16 @@ void i2c_rtc_reset(void) {
     ds1307.last_data_in = 0;
     ds1307.last_rw = false;
 }
+
+/* The chip as a whole: same build, same layout */
+void i2c_rtc_save_state(ss_buf *b) {
+    ssPut32(b, sizeof(ds1307));
+    ssPut(b, &ds1307, sizeof(ds1307));
+}
+
+int i2c_rtc_load_state(ss_buf *b) {
+    if (ssGet32(b) != sizeof(ds1307))
+        return -1;
+    ssGet(b, &ds1307, sizeof(ds1307));
+    return b->error ? -1 : 0;
+}
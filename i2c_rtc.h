@@ -30,8 +30,8 @@ void i2c_rtc_init(void);
 
 /**
  * Update the RTC time
- * Should be called periodically to keep the RTC synchronized
- * with real time (e.g., once per frame)
+ * Brings the time registers up to date; done when the guest starts
+ * reading them, from emulated time if the user timer is emulated
  */
 void i2c_rtc_update(void);
 
@@ -74,4 +74,8 @@ uint8_t i2c_rtc_read_status(void);
  */
 void i2c_rtc_reset(void);
 
+struct ss_buf;
+void i2c_rtc_save_state(struct ss_buf *b);
+int i2c_rtc_load_state(struct ss_buf *b);
+
 #endif /* I2C_RTC_H */
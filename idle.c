@@ -0,0 +1,110 @@
+/*
+ * idle.c
+ *
+ * Idle loop and STOP fast-forward, see idle.h.  A polling loop is found
+ * from the status register reads alone: the same instruction reading the
+ * same register, with the same result, again and again within a few
+ * instructions is a short loop waiting for that register to change.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "QL68000.h"
+#include "SDL2screen.h"
+#include "cycles.h"
+#include "idle.h"
+#include "pacer.h"
+#include "scheduler.h"
+
+#define IDLE_STREAK	16	/* unchanged polls before the loop counts as idle */
+#define IDLE_MAX_LOOP	12	/* instructions per iteration of a polling loop */
+#define IDLE_MAX_SKIP	100000	/* instructions or cycles skipped at a time */
+
+enum { IDLE_NONE, IDLE_POLL, IDLE_TIMER };
+
+bool idle_skip = false;
+
+static int idle_state = IDLE_NONE;
+static int streak;
+
+/* The read the loop is recognised by */
+static uw16 *anchor_pc;
+static uint32_t anchor_addr, anchor_value;
+static int anchor_n;
+static uint64_t anchor_now;
+
+void idleInit(bool enable)
+{
+	idle_skip = enable;
+	idle_state = IDLE_NONE;
+	streak = 0;
+	anchor_pc = NULL;
+}
+
+void idlePoll(uint32_t addr, uint32_t value, bool timer)
+{
+	bool same_chunk = anchor_now == sched_now && nInst <= anchor_n;
+	bool near = !same_chunk || anchor_n - nInst <= IDLE_MAX_LOOP;
+
+	if (!idle_skip)
+		return;
+
+	if (pc == anchor_pc && addr == anchor_addr &&
+	    (timer || value == anchor_value) && near) {
+		anchor_n = nInst;
+		anchor_now = sched_now;
+		if (++streak >= IDLE_STREAK && !extraFlag) {
+			idle_state = timer ? IDLE_TIMER : IDLE_POLL;
+			nInst = 0;
+		}
+		return;
+	}
+
+	// Other reads in the same iteration leave the anchor alone
+	if (pc != anchor_pc && same_chunk && near)
+		return;
+
+	anchor_pc = pc;
+	anchor_addr = addr;
+	anchor_value = value;
+	anchor_n = nInst;
+	anchor_now = sched_now;
+	streak = 0;
+}
+
+bool idleWaiting(void)
+{
+	if (!idle_skip || SDL_AtomicGet(&doPoll))
+		return false;
+	if (InterruptDue())
+		return false;
+	if (stopped)
+		return true;
+	return idle_state != IDLE_NONE;
+}
+
+long idleSkip(void)
+{
+	uint64_t skip, tick;
+	int state = idle_state;
+
+	idle_state = IDLE_NONE;
+
+	// Emulated time wouldn't move the host clock the guest is reading
+	if (state == IDLE_TIMER && !stopped) {
+		pacerIdleWait(true);
+		return 0;
+	}
+
+	skip = schedUntilNext(IDLE_MAX_SKIP);
+	tick = pacerUntilTick();
+	if (tick && tick < skip)
+		skip = tick;
+	else if (!tick && skip == IDLE_MAX_SKIP)
+		pacerIdleWait(false);
+
+	if (cycle_timing)
+		cpu_cycles += skip;
+	return (long)skip;
+}
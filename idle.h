@@ -0,0 +1,37 @@
+/*
+ * idle.h
+ *
+ * Idle fast-forward (--idle_skip).  A guest that has executed STOP, or
+ * keeps re-reading an unchanged status register (VFRONT, keyboard,
+ * joystick and mouse) from the same short loop, only waits for emulated
+ * time to pass: emulation jumps to the next scheduler deadline or pacer
+ * tick instead of running the loop, and the emulator thread sleeps when
+ * the next tick comes from the host.  Polls of the 1MHz user timer only
+ * sleep briefly, and only while it follows the host clock.
+ *
+ * Off by default: a loop that also counts its iterations would see fewer
+ * of them, which is no different from a slower host in windowed timer
+ * mode but does change headless and cycle timed runs.
+ */
+
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+extern bool idle_skip;
+
+void idleInit(bool enable);
+
+/* A status register read; timer reads change on every poll */
+void idlePoll(uint32_t addr, uint32_t value, bool timer);
+
+/* Emulator thread, between chunks: true when the guest is only waiting */
+bool idleWaiting(void);
+
+/* Let time pass for an idle guest; returns the instructions or cycles
+   skipped, for the pacer and scheduler to account */
+long idleSkip(void);
+
+#endif /* IDLE_H */
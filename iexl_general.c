@@ -3,6 +3,8 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "QL68000.h"
 #include "debug.h"
@@ -17,18 +19,34 @@
                    (w32)((void*)pc-(void*)memBase), (reason)); \
     } while(0)
 #include "SDL2screen.h"
+#include "btrace.h"
+#include "coverage.h"
+#include "cycles.h"
+#include "fuzz.h"
 #include "memaccess.h"
+#include "metrics.h"
 #include "mmodes.h"
+#include "op_stats.h"
 #include "unixstuff.h"
+#ifdef DECODE_CACHE
+#include "decode_cache.h"
+#include "fuse.h"
+#endif
 
 #ifdef PROFILER
 #include "profiler/profiler_events.h"
 #endif
 
+#ifdef COMPACT_TABLE
+uw16 *qlux_index;
+void (*qlux_handlers[QLUX_MAX_HANDLERS])(void);
+#else
 void    (**qlux_table)(void);
+#endif
 
-int cpu68010 = 1;  /* 68010 mode by default */
-w32  vbr = 0;      /* Vector Base Register (68010+) */
+MACHINE_LOCAL int cpu68010 = 1;  /* 68010 mode by default */
+MACHINE_LOCAL w32  vbr = 0;      /* Vector Base Register (68010+) */
+MACHINE_LOCAL int cpu68020 = 0;  /* 68020 subset, see SetTable() */
 
 #ifdef DEBUG
 //int trace_rts=0;
@@ -90,61 +108,53 @@ Cond
 vml Cond (**ll_ConditionTrue)(void)=ConditionTrue;
 
 #ifndef G_reg
-w32             reg[16];                        /* registri d0-d7/a0-a7 */
+MACHINE_LOCAL w32 reg[16];                        /* registri d0-d7/a0-a7 */
 #endif
-w32             usp,ssp;                        /* user and system stack
-						   pointer (aggiornato solo quello non attivo) */
-
 #ifndef GREGS
-uw16    *pc;                            /* program counter : Ptr nella */
-gshort    code;
-int      nInst;
+MACHINE_LOCAL uw16 *pc;                            /* program counter : Ptr nella */
+MACHINE_LOCAL gshort code;
 #endif
 
-Cond    trace,supervisor,xflag,negative,zero,overflow,carry;    /*flags */
-char    iMask;                          /* SR interrupt mask */
-Cond    stopped;                        /* processor status */
-volatile char   pendingInterrupt;       /* interrupt requesting service */
+/* nInst, usp/ssp (aggiornato solo quello non attivo), flags, lazy C/V/X,
+   iMask, stopped, exception, extraFlag and irqPending, see QL68000.h */
+MACHINE_LOCAL struct cpu_state cpu;
 
 
 #ifndef ZEROMAP
-w32             *memBase;                        /* Ptr to ROM in Mac memory */
+MACHINE_LOCAL w32 *memBase;                        /* Ptr to ROM in Mac memory */
 #endif
 
-w32             *ramTop;                        /* Ptr to RAM top in Mac
+MACHINE_LOCAL w32 *ramTop;                        /* Ptr to RAM top in Mac
 						   memory */
-w32             RTOP;                           /* QL ram top address */
-short   exception;                      /* pending exception */
-w32             badAddress;                     /* bad address address */
-w16             readOrWrite;            /* bad address action */
-w32             dummy;                          /* free 4 bytes for who care */
-Ptr             dest;                           /* Mac address for
+MACHINE_LOCAL w32 RTOP;                           /* QL ram top address */
+MACHINE_LOCAL w32 badAddress;                     /* bad address address */
+MACHINE_LOCAL w16 readOrWrite;            /* bad address action */
+MACHINE_LOCAL w32 dummy;                          /* free 4 bytes for who care */
+MACHINE_LOCAL Ptr dest;                           /* Mac address for
 read+write operations */
 
 #if 1
-Cond mea_acc;
+MACHINE_LOCAL Cond mea_acc;
 #else
 Cond    isHW;                           /* dest is a HW register ? */
 #if !defined(VM_SCR)
 Cond    isDisplay;                      /* dest is in display RAM ? */
 #endif
 #endif
-w32             lastAddr;                       /* QL address for
+MACHINE_LOCAL w32 lastAddr;                       /* QL address for
 						   read+write operations */
 
-volatile Cond   extraFlag;      /* signals exception or trace */
 
 
 char    dispScreen=0;           /* screen 0 or 1 */
 Cond    dispMode=0;                     /* mode 4 or 8 */
 Cond    dispActive=true;        /* display is on ? */
-Cond    badCodeAddress;
+MACHINE_LOCAL Cond badCodeAddress;
 
-int   nInst2;
 extern int script;
 
-volatile w8     intReg=0;
-volatile w8     theInt=0;
+MACHINE_LOCAL volatile w8 intReg=0;
+MACHINE_LOCAL volatile w8 theInt=0;
 
 Cond doTrace;            /* trace after current instruction */
 
@@ -153,41 +163,132 @@ bool check_calling_convention = false;
 bool exit_on_cpu_disable = true;  /* exit emulator when CPU is disabled (RESET_REQ = 0xff) */
 bool rom_write_protect = true;  /* trap writes to ROM (addr < 32768) */
 
-/* Calling convention checking: stack to track saved register state */
-#define CC_STACK_MAX 1024
+/*
+ * Calling convention checking: a shadow stack of the callee-saved
+ * registers at every call, compared as a whole at the matching return.
+ * Violations are counted per call site and reported at exit.
+ */
+#define CC_SAVED        12      /* d2-d7 then a2-a7, as laid out in reg[] */
+#define CC_SP           11      /* a7 in a frame */
+#define CC_SP_SLACK     16      /* small stack adjustments are allowed */
+#define CC_STACK_LIMIT  (1 << 20)
+
 typedef struct {
-    w32 pc;         /* PC at call site */
-    w32 regs[14];   /* a2-a7 (indices 0-5), d2-d7 (indices 6-11), and extra slots */
+    w32 pc;                     /* PC at call site */
+    uw32 regs[CC_SAVED];
 } cc_frame_t;
 
-static cc_frame_t cc_stack[CC_STACK_MAX];
-static int cc_stack_depth = 0;
+typedef struct {
+    w32 pc;                     /* call site, 0 for an empty slot */
+    uint32_t returns;           /* returns with at least one violation */
+    uint32_t regs[CC_SAVED];    /* violations of each register */
+    w32 last_return;
+} cc_site_t;
+
+static cc_frame_t *cc_stack;
+static int cc_stack_depth, cc_stack_cap;
+static cc_site_t *cc_sites;
+static unsigned cc_sites_cap, cc_sites_used;
+static uint64_t cc_overflows, cc_underflows;
+
+static const char *const cc_reg_names[CC_SAVED] = {
+    "d2", "d3", "d4", "d5", "d6", "d7", "a2", "a3", "a4", "a5", "a6", "a7"
+};
+
+static int cc_site_by_count(const void *a, const void *b)
+{
+    const cc_site_t *x = a, *y = b;
+
+    return (x->returns < y->returns) - (x->returns > y->returns);
+}
+
+static void cc_report(void)
+{
+    unsigned i, j, n = 0;
+    uint64_t total = 0;
+
+    for (i = 0; i < cc_sites_cap; i++) {
+        if (cc_sites[i].pc) {
+            cc_sites[n++] = cc_sites[i];
+            total += cc_sites[i].returns;
+        }
+    }
+    if (!total && !cc_overflows && !cc_underflows)
+        return;
+    qsort(cc_sites, n, sizeof(*cc_sites), cc_site_by_count);
+
+    fprintf(stderr, "Calling convention: %llu violating returns from %u call sites\n",
+            (unsigned long long)total, n);
+    for (i = 0; i < n; i++) {
+        fprintf(stderr, "  called at PC=0x%08x: %u, last returning to PC=0x%08x:",
+                cc_sites[i].pc, cc_sites[i].returns, cc_sites[i].last_return);
+        for (j = 0; j < CC_SAVED; j++) {
+            if (cc_sites[i].regs[j])
+                fprintf(stderr, " %s x%u", cc_reg_names[j], cc_sites[i].regs[j]);
+        }
+        fputc('\n', stderr);
+    }
+    if (cc_underflows)
+        fprintf(stderr, "  %llu RTS without a matching JSR/BSR\n",
+                (unsigned long long)cc_underflows);
+    if (cc_overflows)
+        fprintf(stderr, "  %llu calls not checked, more than %d deep\n",
+                (unsigned long long)cc_overflows, CC_STACK_LIMIT);
+}
+
+static cc_site_t *cc_site(w32 pc)
+{
+    unsigned i;
+
+    if (cc_sites_used * 4 >= cc_sites_cap * 3) {
+        cc_site_t *old = cc_sites;
+        unsigned old_cap = cc_sites_cap;
+
+        cc_sites_cap = old_cap ? old_cap * 2 : 256;
+        cc_sites = calloc(cc_sites_cap, sizeof(*cc_sites));
+        if (!old)
+            atexit(cc_report);
+        for (i = 0; i < old_cap; i++) {
+            if (old[i].pc) {
+                unsigned k = ((uw32)old[i].pc * 2654435761u) & (cc_sites_cap - 1);
+
+                while (cc_sites[k].pc)
+                    k = (k + 1) & (cc_sites_cap - 1);
+                cc_sites[k] = old[i];
+            }
+        }
+        free(old);
+    }
+    i = ((uw32)pc * 2654435761u) & (cc_sites_cap - 1);
+    while (cc_sites[i].pc && cc_sites[i].pc != pc)
+        i = (i + 1) & (cc_sites_cap - 1);
+    if (!cc_sites[i].pc) {
+        cc_sites[i].pc = pc;
+        cc_sites_used++;
+    }
+    return &cc_sites[i];
+}
 
 void cc_push_frame(w32 call_pc) {
     if (!check_calling_convention)
         return;
 
-    if (cc_stack_depth >= CC_STACK_MAX) {
-        fprintf(stderr, "WARNING: Calling convention stack overflow at PC=0x%08x\n", call_pc);
-        return;
+    if (cc_stack_depth == cc_stack_cap) {
+        int cap = cc_stack_cap ? cc_stack_cap * 2 : 1024;
+        cc_frame_t *s = cap <= CC_STACK_LIMIT ? realloc(cc_stack, cap * sizeof(*s)) : NULL;
+
+        if (!s) {
+            cc_overflows++;
+            return;
+        }
+        cc_stack = s;
+        cc_stack_cap = cap;
     }
 
     cc_frame_t *frame = &cc_stack[cc_stack_depth++];
     frame->pc = call_pc;
-    /* Save a2-a7 (aReg indices 2-7) */
-    frame->regs[0] = aReg[2];
-    frame->regs[1] = aReg[3];
-    frame->regs[2] = aReg[4];
-    frame->regs[3] = aReg[5];
-    frame->regs[4] = aReg[6];
-    frame->regs[5] = aReg[7];
-    /* Save d2-d7 (reg indices 2-7) */
-    frame->regs[6] = reg[2];
-    frame->regs[7] = reg[3];
-    frame->regs[8] = reg[4];
-    frame->regs[9] = reg[5];
-    frame->regs[10] = reg[6];
-    frame->regs[11] = reg[7];
+    memcpy(&frame->regs[0], &reg[2], 6 * sizeof(uw32));
+    memcpy(&frame->regs[6], &reg[10], 6 * sizeof(uw32));
 }
 
 void cc_pop_frame_and_check(w32 return_pc) {
@@ -195,39 +296,34 @@ void cc_pop_frame_and_check(w32 return_pc) {
         return;
 
     if (cc_stack_depth <= 0) {
-        fprintf(stderr, "WARNING: Calling convention stack underflow at RTS to PC=0x%08x (RTS without matching JSR/BSR)\n", return_pc);
+        cc_underflows++;
         return;
     }
 
     cc_frame_t *frame = &cc_stack[--cc_stack_depth];
-    int violations = 0;
-
-    /* Check a2-a7 */
-    if (frame->regs[0] != aReg[2]) { fprintf(stderr, "WARNING: a2 modified (0x%08x -> 0x%08x) in function called at PC=0x%08x, returning to PC=0x%08x\n", frame->regs[0], aReg[2], frame->pc, return_pc); violations++; }
-    if (frame->regs[1] != aReg[3]) { fprintf(stderr, "WARNING: a3 modified (0x%08x -> 0x%08x) in function called at PC=0x%08x, returning to PC=0x%08x\n", frame->regs[1], aReg[3], frame->pc, return_pc); violations++; }
-    if (frame->regs[2] != aReg[4]) { fprintf(stderr, "WARNING: a4 modified (0x%08x -> 0x%08x) in function called at PC=0x%08x, returning to PC=0x%08x\n", frame->regs[2], aReg[4], frame->pc, return_pc); violations++; }
-    if (frame->regs[3] != aReg[5]) { fprintf(stderr, "WARNING: a5 modified (0x%08x -> 0x%08x) in function called at PC=0x%08x, returning to PC=0x%08x\n", frame->regs[3], aReg[5], frame->pc, return_pc); violations++; }
-    if (frame->regs[4] != aReg[6]) { fprintf(stderr, "WARNING: a6 modified (0x%08x -> 0x%08x) in function called at PC=0x%08x, returning to PC=0x%08x\n", frame->regs[4], aReg[6], frame->pc, return_pc); violations++; }
-    /* Note: a7 (SP) is allowed to change within reason, but should be restored. We check it but it's common to see variations */
-    if (frame->regs[5] != aReg[7]) {
-        w32 sp_diff = (aReg[7] > frame->regs[5]) ? (aReg[7] - frame->regs[5]) : (frame->regs[5] - aReg[7]);
-        if (sp_diff > 16) {  /* Allow small stack adjustments */
-            fprintf(stderr, "WARNING: a7/SP modified (0x%08x -> 0x%08x, diff=%d) in function called at PC=0x%08x, returning to PC=0x%08x\n", frame->regs[5], aReg[7], (int)sp_diff, frame->pc, return_pc);
-            violations++;
-        }
-    }
-
-    /* Check d2-d7 */
-    if (frame->regs[6] != reg[2]) { fprintf(stderr, "WARNING: d2 modified (0x%08x -> 0x%08x) in function called at PC=0x%08x, returning to PC=0x%08x\n", frame->regs[6], reg[2], frame->pc, return_pc); violations++; }
-    if (frame->regs[7] != reg[3]) { fprintf(stderr, "WARNING: d3 modified (0x%08x -> 0x%08x) in function called at PC=0x%08x, returning to PC=0x%08x\n", frame->regs[7], reg[3], frame->pc, return_pc); violations++; }
-    if (frame->regs[8] != reg[4]) { fprintf(stderr, "WARNING: d4 modified (0x%08x -> 0x%08x) in function called at PC=0x%08x, returning to PC=0x%08x\n", frame->regs[8], reg[4], frame->pc, return_pc); violations++; }
-    if (frame->regs[9] != reg[5]) { fprintf(stderr, "WARNING: d5 modified (0x%08x -> 0x%08x) in function called at PC=0x%08x, returning to PC=0x%08x\n", frame->regs[9], reg[5], frame->pc, return_pc); violations++; }
-    if (frame->regs[10] != reg[6]) { fprintf(stderr, "WARNING: d6 modified (0x%08x -> 0x%08x) in function called at PC=0x%08x, returning to PC=0x%08x\n", frame->regs[10], reg[6], frame->pc, return_pc); violations++; }
-    if (frame->regs[11] != reg[7]) { fprintf(stderr, "WARNING: d7 modified (0x%08x -> 0x%08x) in function called at PC=0x%08x, returning to PC=0x%08x\n", frame->regs[11], reg[7], frame->pc, return_pc); violations++; }
+    const uw32 *d = (const uw32 *)&reg[2], *a = (const uw32 *)&reg[10];
+    uw32 diff = 0, sp_diff;
+    int i;
+
+    /* One pass over d2-d7 and a2-a6; a7 only has to come back close */
+    for (i = 0; i < 6; i++)
+        diff |= frame->regs[i] ^ d[i];
+    for (i = 0; i < 5; i++)
+        diff |= frame->regs[6 + i] ^ a[i];
+    sp_diff = a[5] > frame->regs[CC_SP] ? a[5] - frame->regs[CC_SP] :
+                                          frame->regs[CC_SP] - a[5];
+    if (likely(!diff && sp_diff <= CC_SP_SLACK))
+        return;
 
-    if (violations > 0) {
-        fprintf(stderr, "ERROR: %d calling convention violation(s) detected!\n", violations);
-    }
+    cc_site_t *site = cc_site(frame->pc);
+    site->returns++;
+    site->last_return = return_pc;
+    for (i = 0; i < 6; i++)
+        site->regs[i] += frame->regs[i] != d[i];
+    for (i = 0; i < 5; i++)
+        site->regs[6 + i] += frame->regs[6 + i] != a[i];
+    site->regs[CC_SP] += sp_diff > CC_SP_SLACK;
+    btraceTrigger("calling convention violation");
 }
 
 void cc_poison_scratch_regs(void) {
@@ -239,31 +335,58 @@ void cc_poison_scratch_regs(void) {
     aReg[1] = 0xDEADBEEF;
 }
 
+void RaiseInterrupt(int level)
+{
+  int m;
+
+  do
+    m=SDL_AtomicGet(&irqPending);
+  while(!SDL_AtomicCAS(&irqPending, m, m | (1 << level)));
+}
+
+void ClearInterrupt(int level)
+{
+  int m;
+
+  do
+    m=SDL_AtomicGet(&irqPending);
+  while(!SDL_AtomicCAS(&irqPending, m, m & ~(1 << level)));
+}
+
+/* Switch to the supervisor stack and push the group 1/2 frame: 68000
+   PC and SR, 68010 format $0 with the vector offset.  SR is the one
+   from before the exception. */
+static void PushExceptionFrame(int vector, Cond format0)
+{
+  if(!supervisor)
+    {
+      usp=(*m68k_sp);
+      (*m68k_sp)=ssp;
+    }
+  ExceptionIn(vector);
+  if (format0) {
+    (*m68k_sp)-=8;
+    WriteWord((*m68k_sp)+6, (w16)((vector*4) & 0x0FFF));
+  } else
+    (*m68k_sp)-=6;
+  WriteLong((*m68k_sp)+2,(uintptr_t)pc-(uintptr_t)memBase);
+  WriteWord((*m68k_sp),GetSR());
+}
+
 void ProcessInterrupts(void)
 {
+  int level;
+
   /* gestione interrupts */
-  if( exception==0 && (pendingInterrupt==7 || pendingInterrupt>iMask)
-      && !doTrace)
+  if(exception!=0 || doTrace) return;
+  level=PendingInterrupt();
+  if(level==7 || level>iMask)
     {
-      if(!supervisor)
-	{
-	  usp=(*m68k_sp);
-	  (*m68k_sp)=ssp;
-	}
-      ExceptionIn(24+pendingInterrupt);
-      if (cpu68010) {
-        (*m68k_sp)-=8;
-        WriteWord((*m68k_sp)+6, (w16)(((24+pendingInterrupt)*4) & 0x0FFF)); /* format $0 */
-        WriteLong((*m68k_sp)+2,(uintptr_t)pc-(uintptr_t)memBase);
-        WriteWord((*m68k_sp),GetSR());
-      } else {
-        WriteLong((*m68k_sp)-4,(Ptr)pc-(Ptr)memBase);
-        (*m68k_sp)-=6;
-        WriteWord(*m68k_sp,GetSR());
-      }
-      SetPCX(24+pendingInterrupt);
-      iMask=pendingInterrupt;
-      pendingInterrupt=0;
+      PushExceptionFrame(24+level, cpu68010);
+      metricAdd(METRIC_INTERRUPTS, 1);
+      SetPCX(24+level);
+      iMask=level;
+      ClearInterrupt(level);
       LOG_SUPERVISOR_CHANGE(supervisor, true, "interrupt");
       supervisor=true;
       trace=false;
@@ -272,9 +395,44 @@ void ProcessInterrupts(void)
     }
 }
 
+static const uw32 ccMsb[4]={0,0x80,0x8000,0x80000000};
+
+void cc_eval(void)
+{
+  uw32 m=ccMsb[cc_op&3];
+  uw32 s=cc_src, d=cc_dst, r=cc_res;
+
+  if(cc_op<CC_SUB_B)
+    {
+      carry=(((s&d)|(~r&(s|d)))&m)!=0;
+      overflow=(((s&d&~r)|(~s&~d&r))&m)!=0;
+    }
+  else
+    {
+      carry=(((s&~d)|(r&~d)|(s&r))&m)!=0;
+      overflow=(((~s&d&~r)|(s&~d&r))&m)!=0;
+    }
+  if(cc_op<CC_CMP_B) xflag=carry;
+  cc_op=CC_NONE;
+}
+
+/* X only, for a cmp about to replace a pending add/sub */
+void cc_eval_x(void)
+{
+  uw32 m=ccMsb[cc_op&3];
+  uw32 s=cc_src, d=cc_dst, r=cc_res;
+
+  if(cc_op<CC_SUB_B)
+    xflag=(((s&d)|(~r&(s|d)))&m)!=0;
+  else
+    xflag=(((s&~d)|(r&~d)|(s&r))&m)!=0;
+  cc_op=CC_NONE;
+}
+
 rw16 GetSR(void)
 {
   rw16 sr;
+  CC_FLUSH();
   sr=(w16)iMask<<8;
   if(trace) sr|=0x8000;
   if(supervisor) sr|=0x2000;
@@ -299,6 +457,7 @@ void REGP1 PutSR(aw16 sr)
     }
   LOG_SUPERVISOR_CHANGE(supervisor, (sr&0x2000)!=0, "interrupt");
   supervisor=(sr&0x2000)!=0;
+  cc_op=CC_NONE;
   xflag=(sr&0x0010)!=0;
   negative=(sr&0x0008)!=0;
   zero=(sr&0x0004)!=0;
@@ -334,6 +493,9 @@ void REGP1 SetPCX(int i)
   Ptr p=pc;
 #endif
 
+  if (unlikely(btrace_flight))
+    btraceVector(i);
+
   if (cpu68010)
     pc=(uw16*)((Ptr)memBase+(RL((w32*)((Ptr)memBase+vbr)+i)&ADDR_MASK));
   else
@@ -476,7 +638,7 @@ void ExceptionOut()
 
 void ExceptionProcessing()
 {
-  if(pendingInterrupt!=0 && !doTrace) ProcessInterrupts();
+  ProcessInterrupts();
   if(exception!=0)
     {
       if(exception<32 || exception>36) /* tutte le eccezioni
@@ -492,22 +654,10 @@ void ExceptionProcessing()
 	      nInst=nInst2=0;
 	    }
 	}
-      if(!supervisor)
-	{
-	  usp=(*m68k_sp);
-	  (*m68k_sp)=ssp;
-	}
-      ExceptionIn(exception);
-      if (cpu68010 && exception != 3) {
-        (*m68k_sp)-=8;
-        WriteWord((*m68k_sp)+6, (w16)((exception*4) & 0x0FFF)); /* format $0 */
-        WriteLong((*m68k_sp)+2,(uintptr_t)pc-(uintptr_t)memBase);
-        WriteWord((*m68k_sp),GetSR());
-      } else {
-        (*m68k_sp)-=6;
-        WriteLong((*m68k_sp)+2,(uintptr_t)pc-(uintptr_t)memBase);
-        WriteWord((*m68k_sp),GetSR());
-      }
+      if (unlikely(fuzz_running))
+	fuzzException(exception);
+      PushExceptionFrame(exception, cpu68010 && exception != 3);
+      metricAdd(METRIC_EXCEPTIONS, 1);
       SetPCX(exception);
       if(exception==3) /* address error */
 	{
@@ -525,22 +675,7 @@ void ExceptionProcessing()
     }
    if(doTrace)
     {
-      if(!supervisor)
-	{
-	  usp=(*m68k_sp);
-	  (*m68k_sp)=ssp;
-	}
-      ExceptionIn(9);
-      if (cpu68010) {
-        (*m68k_sp)-=8;
-        WriteWord((*m68k_sp)+6, (w16)((9*4) & 0x0FFF)); /* format $0, trace vector */
-        WriteLong((*m68k_sp)+2,(uintptr_t)pc-(uintptr_t)memBase);
-        WriteWord((*m68k_sp),GetSR());
-      } else {
-        (*m68k_sp)-=6;
-        WriteLong((*m68k_sp)+2,(Ptr)pc-(Ptr)memBase);
-        WriteWord((*m68k_sp),GetSR());
-      }
+      PushExceptionFrame(9, cpu68010);
       SetPCX(9);
       if(nInst==0) exception=9;       /* no interrupt allowed here */
       LOG_SUPERVISOR_CHANGE(supervisor, true, "trace exception");
@@ -551,7 +686,7 @@ void ExceptionProcessing()
     }
   doTrace=trace;
   if(doTrace) {nInst2=nInst;nInst=1;}
-  if(pendingInterrupt!=0 && !doTrace)   /* delay interrupt after trace exception */
+  if(!doTrace && InterruptDue())   /* delay interrupt after trace exception */
     {
       extraFlag=true;
       nInst2=nInst;
@@ -584,82 +719,128 @@ static const char *change_to_str(char *buf, uint32_t old_val, uint32_t new_val)
     return buf;
 }
 
-void ExecuteLoop(void)  /* fetch and dispatch loop */
+#define LOOP_NAME ExecuteLoopPlain
+#define LOOP_TRACED 0
+#define LOOP_PROFILED 0
+#define LOOP_COVERED 0
+#define LOOP_COUNTED 0
+#include "iexl_loop.h"
+#undef LOOP_NAME
+#undef LOOP_TRACED
+#undef LOOP_PROFILED
+#undef LOOP_COVERED
+#undef LOOP_COUNTED
+
+#define LOOP_NAME ExecuteLoopCovered
+#define LOOP_TRACED 0
+#define LOOP_PROFILED 0
+#define LOOP_COVERED 1
+#define LOOP_COUNTED 1
+#include "iexl_loop.h"
+#undef LOOP_NAME
+#undef LOOP_TRACED
+#undef LOOP_PROFILED
+#undef LOOP_COVERED
+#undef LOOP_COUNTED
+
+#define LOOP_NAME ExecuteLoopTraced
+#define LOOP_TRACED 1
+#ifdef PROFILER
+#define LOOP_PROFILED 1
+#else
+#define LOOP_PROFILED 0
+#endif
+#define LOOP_COVERED 0
+#define LOOP_COUNTED 1
+#include "iexl_loop.h"
+#undef LOOP_NAME
+#undef LOOP_TRACED
+#undef LOOP_PROFILED
+#undef LOOP_COVERED
+#undef LOOP_COUNTED
+
+#define LOOP_NAME ExecuteLoopCounted
+#define LOOP_TRACED 0
+#define LOOP_PROFILED 0
+#define LOOP_COVERED 0
+#define LOOP_COUNTED 1
+#include "iexl_loop.h"
+#undef LOOP_NAME
+#undef LOOP_TRACED
+#undef LOOP_PROFILED
+#undef LOOP_COVERED
+#undef LOOP_COUNTED
+
+#ifdef PROFILER
+#define LOOP_NAME ExecuteLoopProfiled
+#define LOOP_TRACED 0
+#define LOOP_PROFILED 1
+#define LOOP_COVERED 0
+#define LOOP_COUNTED 1
+#include "iexl_loop.h"
+#undef LOOP_NAME
+#undef LOOP_TRACED
+#undef LOOP_PROFILED
+#undef LOOP_COVERED
+#undef LOOP_COUNTED
+#endif
+
+#ifdef DECODE_CACHE
+#define LOOP_COVERAGE_ON()	(fuzz_map != NULL)
+#define LOOP_COUNTING_ON()	(fuse_counting || op_counting || insn_counting)
+#else
+/* Without the decode cache --coverage is marked per instruction as well */
+#define LOOP_COVERAGE_ON()	(fuzz_map != NULL || coverage_bits != NULL)
+#define LOOP_COUNTING_ON()	(op_counting || insn_counting)
+#endif
+
+static int reselectInst;
+
+/* Called from the emulator thread after changing asyncTrace or a counter:
+   end the running loop variant after the current instruction and restart
+   the remaining budget in the one that matches. */
+void ExecuteLoopReselect(void)
 {
-  while(--nInst>=0)
+  if (nInst > 0)
     {
-      const bool trace = asyncTrace;
-#ifdef TRACE
-      if (pc>tracelo) DoTrace();
-#endif
-    uint32_t old_pc, old_d0, old_d1, old_d2, old_d3, old_d4, old_d5, old_d6, old_d7;
-    uint32_t old_a0, old_a1, old_a2, old_a3, old_a4, old_a5, old_a6, old_a7;
-    if (trace) {
-        old_pc = (void*)pc-(void*)memBase;
-        old_d0 = reg[0];
-        old_d1 = reg[1];
-        old_d2 = reg[2];
-        old_d3 = reg[3];
-        old_d4 = reg[4];
-        old_d5 = reg[5];
-        old_d6 = reg[6];
-        old_d7 = reg[7];
-        old_a0 = reg[8];
-        old_a1 = reg[9];
-        old_a2 = reg[10];
-        old_a3 = reg[11];
-        old_a4 = reg[12];
-        old_a5 = reg[13];
-        old_a6 = reg[14];
-        old_a7 = reg[15];
+      reselectInst = nInst;
+      nInst = 0;
     }
-    //printf("ExecuteLoop: pc = %x\n", (w32)((void*)pc-(void*)memBase));
-    /*if ((w32)((void*)pc-(void*)memBase) >= 0x40000 ) {
-      printf("ExecuteLoop: pc = %x\n", (w32)((void*)pc-(void*)memBase));
-      if ((w32)((void*)pc-(void*)memBase) > 0x451d8 ) {
-        fflush(stdout);
-        fprintf(stderr, "Invalid PC address: %x\n", (w32)((void*)pc-(void*)memBase));
-        exit(1);
-      }
-    }*/
+}
+
+void ExecuteLoop(void)  /* fetch and dispatch loop */
+{
+  /* asyncTrace, profiler_recording, fuzz_map and the counters are only
+     looked at here; changes from other threads are picked up at the next
+     chunk or exception */
+  do
+    {
+      for (;;)
+        {
+          if (unlikely(BTRACE_ANY()))
+            ExecuteLoopTraced();
+          else if (unlikely(LOOP_COVERAGE_ON()))
+            ExecuteLoopCovered();
 #ifdef PROFILER
-      // Record instruction execution
-      Profiler_RecordInstructionExecute((w32)((void*)pc-(void*)memBase));
+          else if (unlikely(profiler_recording))
+            ExecuteLoopProfiled();
 #endif
-      qlux_table[code=RW_PC(pc++)&0xffff]();
-
-      if (trace) {
-        uint32_t new_pc = (char*)pc-(char*)memBase;
-        printf("PC=%s D0=%s D1=%s D2=%s D3=%s D4=%s D5=%s D6=%s D7=%s A0=%s A1=%s A2=%s A3=%s A4=%s A5=%s A6=%s A7=%s\n",
-               change_to_str(buf1, old_pc, new_pc),
-               change_to_str(buf2, old_d0, reg[0]),
-               change_to_str(buf3, old_d1, reg[1]),
-               change_to_str(buf4, old_d2, reg[2]),
-               change_to_str(buf5, old_d3, reg[3]),
-               change_to_str(buf6, old_d4, reg[4]),
-               change_to_str(buf7, old_d5, reg[5]),
-               change_to_str(buf8, old_d6, reg[6]),
-               change_to_str(buf9, old_d7, reg[7]),
-               change_to_str(buf10, old_a0, reg[8]),
-               change_to_str(buf11, old_a1, reg[9]),
-               change_to_str(buf12, old_a2, reg[10]),
-               change_to_str(buf13, old_a3, reg[11]),
-               change_to_str(buf14, old_a4, reg[12]),
-               change_to_str(buf15, old_a5, reg[13]),
-               change_to_str(buf16, old_a6, reg[14]),
-               change_to_str(buf17, old_a7, reg[15]));
-        fflush(stdout);
-      }
-    }
+          else if (unlikely(LOOP_COUNTING_ON()))
+            ExecuteLoopCounted();
+          else
+            ExecuteLoopPlain();
+          if (likely(!reselectInst)) break;
+          nInst = reselectInst;
+          reselectInst = 0;
+        }
 
-  if (SDL_AtomicGet(&doPoll)) dosignal();
+      if (SDL_AtomicGet(&doPoll)) dosignal();
 
-  if(extraFlag)
-    {
+      if(!extraFlag) break;
       nInst=nInst2;
       ExceptionProcessing();
-      if(nInst>0) ExecuteLoop();
     }
+  while(nInst>0);
 }
 
 void ExecuteChunk(long n)       /* execute n emulated 68K istructions */
@@ -672,8 +853,7 @@ void ExecuteChunk(long n)       /* execute n emulated 68K istructions */
   if(stopped) return;
   exception=0;
 
-  extraFlag=trace || doTrace || pendingInterrupt==7 ||
-    pendingInterrupt>iMask;
+  extraFlag=trace || doTrace || InterruptDue();
 
   nInst=n+1;
   if(extraFlag)
@@ -687,6 +867,10 @@ void ExecuteChunk(long n)       /* execute n emulated 68K istructions */
 
 void InitialSetup(void) /* 68K state when powered on */
 {
+  MemoryMapUpdate();    /* RTOP and ROM protection are final here */
+#ifdef DECODE_CACHE
+  dcache_flush();       /* ROM images and table patches are in place now */
+#endif
   vbr = 0;   /* VBR reset to 0 */
   ssp=*m68k_sp=RL(&memBase[0]);
   SetPC(RL(&memBase[1]));
@@ -697,7 +881,7 @@ void InitialSetup(void) /* 68K state when powered on */
   trace=doTrace=false;
   exception=0;
   extraFlag=false;
-  pendingInterrupt=0;
+  SDL_AtomicSet(&irqPending, 0);
   stopped=false;
   badCodeAddress=false;
 }
@@ -0,0 +1,132 @@
+/*
+ * iexl_loop.h
+ *
+ * Body of the 68K fetch and dispatch loop.  iexl_general.c includes this
+ * once per variant with LOOP_NAME set to the function name and
+ * LOOP_TRACED set to 1 for the asyncTrace variant (register snapshot and
+ * change dump around every instruction) or 0 for the plain one, which
+ * does nothing per instruction beyond --nInst, the cycle count and the
+ * dispatch.  The traced variant writes binary records instead of text
+ * lines with --trace_file, and also runs for the flight recorder (see
+ * btrace.h).  LOOP_PROFILED adds the profiler hooks: PROFILER builds
+ * have a third variant with them for while the profiler records (see
+ * profiler/profiler_control.h), and the traced one has them too.
+ * LOOP_COVERED feeds the fuzzer's edge bitmap (see fuzz.h); --coverage
+ * is marked by the decode cache, or by this variant in builds without
+ * it.  LOOP_COUNTED keeps the --fuse_stats and --op_stats counts and the
+ * perfctr instruction count: every variant has it but the plain one, and
+ * ExecuteLoopCounted has nothing else, for while any of them is on.
+ * Blocks only run from the plain variant.
+ */
+
+static void LOOP_NAME(void)
+{
+  while(--nInst>=0)
+    {
+#ifdef TRACE
+      if (pc>tracelo) DoTrace();
+#endif
+#if LOOP_TRACED
+    uint32_t old_pc, old_reg[16];
+    uint16_t old_code;
+    old_pc = (void*)pc-(void*)memBase;
+    old_code = (uw16)RW(pc);
+    memcpy(old_reg, reg, sizeof(old_reg));
+#endif
+    //printf("ExecuteLoop: pc = %x\n", (w32)((void*)pc-(void*)memBase));
+    /*if ((w32)((void*)pc-(void*)memBase) >= 0x40000 ) {
+      printf("ExecuteLoop: pc = %x\n", (w32)((void*)pc-(void*)memBase));
+      if ((w32)((void*)pc-(void*)memBase) > 0x451d8 ) {
+        fflush(stdout);
+        fprintf(stderr, "Invalid PC address: %x\n", (w32)((void*)pc-(void*)memBase));
+        exit(1);
+      }
+    }*/
+#if LOOP_COVERED
+      if (fuzz_map)
+        fuzzEdge((uint32_t)((Ptr)pc-(Ptr)memBase));
+#ifndef DECODE_CACHE
+      if (coverage_bits)
+        coverageMark((uw32)((Ptr)pc-(Ptr)memBase));
+#endif
+#endif
+#if LOOP_PROFILED
+      // Record instruction execution
+      Profiler_RecordInstructionExecute((w32)((void*)pc-(void*)memBase));
+#endif
+#ifdef DECODE_CACHE
+      {
+        dcache_entry *e = dcache_lookup((uw32)((Ptr)pc-(Ptr)memBase));
+#if defined(JIT) && !LOOP_COUNTED
+        if (e->block) {
+          jit_run(e);
+          continue;
+        } else if (unlikely(jit_recording) || unlikely(++e->hits == JIT_THRESHOLD))
+          jit_record(e);
+#endif
+#if LOOP_PROFILED
+        Profiler_RecordInstrRead(e->addr);
+#endif
+        code = e->code;
+#if LOOP_COUNTED
+        if (unlikely(fuse_counting))
+          fuse_count(code);
+        if (unlikely(op_counting))
+          op_count(code);
+        if (unlikely(insn_counting))
+          cpu_insns++;
+#endif
+        cpu_cycles += cycle_table[code];
+        pc++;
+        e->handler();
+#if defined(JIT) && !LOOP_COUNTED
+        if (unlikely(jit_recording))
+          jit_record_step();
+#endif
+      }
+#else
+      code=RW_PC(pc++)&0xffff;
+#if LOOP_COUNTED
+      if (unlikely(op_counting))
+        op_count(code);
+      if (unlikely(insn_counting))
+        cpu_insns++;
+#endif
+      cpu_cycles += cycle_table[code];
+      QLUX_HANDLER(code)();
+#endif
+
+#if LOOP_TRACED
+      {
+        uint32_t new_pc = (char*)pc-(char*)memBase;
+        if (btrace_on)
+          btraceInsn(old_pc, new_pc, old_code, old_reg);
+        if (BTRACE_TEXT()) {
+        printf("PC=%s D0=%s D1=%s D2=%s D3=%s D4=%s D5=%s D6=%s D7=%s A0=%s A1=%s A2=%s A3=%s A4=%s A5=%s A6=%s A7=%s\n",
+               change_to_str(buf1, old_pc, new_pc),
+               change_to_str(buf2, old_reg[0], reg[0]),
+               change_to_str(buf3, old_reg[1], reg[1]),
+               change_to_str(buf4, old_reg[2], reg[2]),
+               change_to_str(buf5, old_reg[3], reg[3]),
+               change_to_str(buf6, old_reg[4], reg[4]),
+               change_to_str(buf7, old_reg[5], reg[5]),
+               change_to_str(buf8, old_reg[6], reg[6]),
+               change_to_str(buf9, old_reg[7], reg[7]),
+               change_to_str(buf10, old_reg[8], reg[8]),
+               change_to_str(buf11, old_reg[9], reg[9]),
+               change_to_str(buf12, old_reg[10], reg[10]),
+               change_to_str(buf13, old_reg[11], reg[11]),
+               change_to_str(buf14, old_reg[12], reg[12]),
+               change_to_str(buf15, old_reg[13], reg[13]),
+               change_to_str(buf16, old_reg[14], reg[14]),
+               change_to_str(buf17, old_reg[15], reg[15]));
+        fflush(stdout);
+        }
+      }
+#endif
+    }
+#if LOOP_TRACED
+  if (btrace_on)
+    btracePublish();
+#endif
+}
@@ -11,7 +11,7 @@
 bool QLGPUCreateDisplay(int w , int h, int ly, uint32_t* id,
 			const char* name, uint32_t sdl_window_mode,
 			int shader_type, const char* shader_path);
-void QLGPUUpdateDisplay(void);
+bool QLGPUUpdateDisplay(bool force);
 void QLGPUSetFullscreen(void);
 void QLGPUSetSize(int w, int h);
 void QLGPUProcessMouse(int* qlx, int* qly, int x, int y);
@@ -0,0 +1,25 @@
+/*
+ * SDL2pixels.h
+ *
+ * 4bpp framebuffer row to 32-bit pixel expansion for the nextp8 renderer.
+ */
+
+#ifndef _SDL2PIXELS_H
+#define _SDL2PIXELS_H
+#include <stdint.h>
+
+/*
+ * Expand one 64-byte row of 4bpp pixels (low nibble first) into 128
+ * pixels through pal.  If ov is not NULL it is the matching overlay row;
+ * its pixels replace the framebuffer colour with ovpal[] unless they
+ * equal transparent.
+ */
+typedef void (*pixel_expand_row_fn)(uint32_t *dst, const uint8_t *src,
+				    const uint8_t *ov, uint8_t transparent,
+				    const uint32_t pal[16],
+				    const uint32_t ovpal[16]);
+
+/* Best kernel for this CPU, chosen on first use */
+extern pixel_expand_row_fn pixelExpandRow;
+
+#endif
@@ -10,6 +10,7 @@
 #include <SDL.h>
 #include <stdbool.h>
 
+void QLSDLInit(void);
 void QLSDLScreen(void);
 void QLSDLRenderScreen(void);
 void QLSDLProcessEvents(void);
@@ -17,19 +18,69 @@ void QLSDLExit(void);
 Uint32 QLSDL50Hz(Uint32 interval, void *param);
 void QLSDLUpdateScreenWord(uint32_t, uint16_t);
 void QLSDLUpdateScreenLong(uint32_t, uint32_t);
-void QLSDLWritePixels(uint32_t *pixelPtr32);
+bool QLSDLWritePixels(uint32_t *pixelPtr32);
+#ifdef NEXTP8
+/* Everything the renderer needs from one displayed nextp8 frame */
+typedef struct {
+	uint8_t fb[8192];		/* front framebuffer, overlay must follow */
+	uint8_t ov[8192];		/* front overlay */
+	uint8_t palette[16];
+	uint8_t secondary[16];
+	uint8_t bitfield[16];
+	uint8_t transform;
+	uint8_t high_colour;
+	uint8_t overlay_control;
+	uint64_t hash;			/* of everything above */
+	bool full;			/* rows[] not valid, redraw everything */
+	uint8_t rows[128];		/* output lines changed since frame seq-1 */
+	uint32_t seq;
+	uint64_t vblank_time;		/* frame stats timestamp, 0 if off */
+} nextp8_frame;
+
+void QLSDLVblank(void);
+const nextp8_frame *QLSDLFrameAcquire(void);
+void QLSDLFrameRelease(void);
+void QLSDLResolvePalette(const nextp8_frame *f, uint32_t pal[32]);
+void QLSDLFramePixels(uint32_t *pixelPtr32, const nextp8_frame *f);
+/* --render_bench: frames converted per combination; returns the exit code */
+int QLSDLRenderBench(int frames);
+#endif
 
 void QLSDLCreatePalette(const SDL_PixelFormat *format);
 void QLSDLCreateIcon(SDL_Window *window);
 
 #ifdef NEXTP8
+/* UI thread working state, see input_state for what the guest reads */
 extern unsigned int sdl_keyrow[32];
-extern unsigned int sdl_keyrow_latched[32];
 extern int16_t sdl_mouse_x_accum;
 extern int16_t sdl_mouse_y_accum;
 extern int16_t sdl_mouse_z_accum;
 extern unsigned int sdl_mouse_buttons;
-extern unsigned int sdl_mouse_buttons_latched;
+
+/* Input levels as the guest sees them, published once per event batch */
+typedef struct {
+	unsigned int keyrow[32];
+	uint8_t joy[2];
+	unsigned int mouse_buttons;
+	int16_t mouse_x, mouse_y, mouse_z;
+	uint64_t time;		/* metricsNow() of the batch's first change */
+} input_state;
+
+/* Set on publish, cleared by the guest */
+extern SDL_atomic_t sdl_keyrow_latched[32];
+extern SDL_atomic_t sdl_mouse_buttons_latched;
+extern SDL_atomic_t joy_latched[2];
+
+/* Emulator thread: the latest published state, one atomic load when
+   nothing changed */
+const input_state *inputSnapshot(void);
+void inputLatchClear(SDL_atomic_t *latch, unsigned int bits);
+/* Producers: set on the next inputPublish(), which ends a batch of
+   SDLQLKeyrowChg() and working state changes */
+void inputLatchSet(SDL_atomic_t *latch, unsigned int bits);
+void inputPublish(void);
+/* The code the default keymap gives key, -1 if none */
+int QLSDLKeyCode(SDL_Keycode key);
 #else
 extern unsigned int sdl_keyrow[8];
 #endif
@@ -38,6 +89,7 @@ extern int sdl_shiftstate, sdl_controlstate, sdl_altstate;
 extern SDL_atomic_t doPoll;
 extern SDL_sem* sem50Hz;
 extern bool shaders_selected;
+extern bool ql_headless;
 extern bool ql_fullscreen;
 extern double ql_screen_ratio;
 
@@ -47,13 +99,13 @@ void SDLQLKeyrowChg(int code, int press);
 /* FuncVal testbench functions */
 void QLSDLSaveFuncvalScreenshot(const char *filename);
 int QLSDLReadFramebufferPixel(int x, int y, uint16_t *pixel);
+int QLSDLCaptureFramebuffer(uint16_t *pixels);
 
 #define USER_CODE_SCREENREFRESH     0
 #define USER_CODE_EMUEXIT           1
 
 #ifdef NEXTP8
 extern uint8_t joy_state[2];
-extern uint8_t joy_latched[2];
 #endif
 
 #endif
@@ -0,0 +1,45 @@
+/*
+ * audio_mixer.h
+ *
+ * One audio device for every sound source: DA playback, the p8audio
+ * model and the QL beep each fill their samples in the one callback, at
+ * the mixer's rate, and are summed there.
+ */
+
+#ifndef _AUDIO_MIXER_H
+#define _AUDIO_MIXER_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AUDIO_MIXER_RATE	22050	/* the p8audio PCM clock */
+
+/* Fills n mono samples at audioMixerRate() on the audio thread; false if
+   the source is silent and left buf alone */
+typedef bool (*audio_source_fn)(int16_t *buf, int n);
+
+/* Opens the device, or a thread running the callback in real time if
+   there is none; samples is the buffer size.  Safe to call again */
+void audioMixerInit(int samples);
+void audioMixerAdd(audio_source_fn fn);
+
+/* The rate sources generate at, valid after audioMixerInit() */
+int audioMixerRate(void);
+
+/* Sources keep running but the device plays silence, e.g. in fast forward */
+void audioMixerMute(bool on);
+
+/* Keeps the callback out, e.g. while a source changes state */
+void audioMixerLock(void);
+void audioMixerUnlock(void);
+
+void audioMixerClose(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ * audio_stats.h
+ *
+ * Optional audio callback cost, latency and underrun statistics
+ * (--audio_stats).
+ */
+
+#ifndef _AUDIO_STATS_H
+#define _AUDIO_STATS_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+	AUDIO_HIST_P8_CALLBACK_US,	/* p8audio SDL callback duration */
+	AUDIO_HIST_P8_CALLBACK_SAMPLES,
+	AUDIO_HIST_P8_GENERATE_US,	/* model clocking per generated chunk */
+	AUDIO_HIST_P8_GENERATE_SAMPLES,
+	AUDIO_HIST_P8_QUEUE_DEPTH,	/* MMIO writes pending per chunk */
+	AUDIO_HIST_P8_RING_FILL,	/* PCM ring samples at callback */
+	AUDIO_HIST_DA_CALLBACK_US,	/* DA SDL callback duration */
+	AUDIO_HIST_DA_CALLBACK_SAMPLES,
+	AUDIO_HIST_COUNT
+};
+
+enum {
+	AUDIO_COUNT_P8_UNDERRUN,	/* PCM ring ran dry in the callback */
+	AUDIO_COUNT_P8_QUEUE_OVERFLOW,	/* MMIO write dropped */
+	AUDIO_COUNT_P8_IDLE_SAMPLES,	/* samples from the idle fast path */
+	AUDIO_COUNT_DA_WRAP,		/* DA playback wrapped da_memory */
+	AUDIO_COUNT_COUNT
+};
+
+extern bool audio_stats_enabled;
+
+void audioStatsInit(bool enable);
+uint64_t audioStatsNow(void);
+/* Microseconds since an audioStatsNow() value */
+uint64_t audioStatsSinceUs(uint64_t start);
+
+/* Safe from any thread; each histogram has a single writer */
+void audioStatsAdd(int hist, uint64_t value);
+void audioStatsCount(int counter, uint64_t n);
+
+/* Print everything, called at exit */
+void audioStatsDump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
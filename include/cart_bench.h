@@ -0,0 +1,30 @@
+/*
+ * cart_bench.h
+ *
+ * End-to-end cart benchmark (--cart_bench <frames>).  Runs the machine
+ * for that many emulated frames, then exits and writes one JSON document
+ * to --cart_bench_file (stdout by default): wall time per frame as mean,
+ * p50/p95/p99 and max, emulated MIPS, emulator and audio thread CPU time
+ * and peak RSS.  Meant for --headless --speed 0.0, with --replay_inputs
+ * for the input and --funcval for scripted tests.
+ */
+
+#ifndef _CART_BENCH_H
+#define _CART_BENCH_H
+#include <stdbool.h>
+#include <stdint.h>
+
+extern bool cart_bench_enabled;
+
+/* Instructions run, kept by the emulator loop while enabled */
+extern uint64_t cart_bench_insns;
+
+void cartBenchInit(int frames, const char *file);
+
+/* Emulator thread, at each vblank; asks for exit after the last frame */
+void cartBenchFrame(void);
+
+/* Write the report, called at exit */
+void cartBenchDump(void);
+
+#endif
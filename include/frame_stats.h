@@ -0,0 +1,28 @@
+/*
+ * frame_stats.h
+ *
+ * Optional frame pacing and input latency histograms (--frame_stats).
+ */
+
+#ifndef _FRAME_STATS_H
+#define _FRAME_STATS_H
+#include <stdbool.h>
+#include <stdint.h>
+
+extern bool frame_stats_enabled;
+
+void frameStatsInit(bool enable);
+uint64_t frameStatsNow(void);
+
+/* Emulator thread, at each vblank */
+void frameStatsVblank(uint64_t t);
+
+/* SDL thread */
+void frameStatsInput(void);
+void frameStatsFrame(uint64_t vblank, uint64_t render_start,
+		     uint64_t render_end, uint64_t present, bool changed);
+
+/* Print the histograms, called at exit */
+void frameStatsDump(void);
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ * frame_stream.h
+ *
+ * Live view of the native nextp8 display for headless instances
+ * (--fb_stream_port): frames go out as 4bpp line deltas with the
+ * palettes and display registers, LZ4 compressed when the build has
+ * liblz4.  A browser gets a small viewer from http://<addr>:<port>/,
+ * which connects back over a WebSocket; any other client sends "P8FB\n"
+ * and reads the same messages, each with a u32 length in front.
+ *
+ * A message is a 12 byte header: 'K' (key frame) or 'D' (delta), flags
+ * (1 = LZ4), u16 version 1, u32 vblank sequence number and u32 payload
+ * length before compression, all little endian.  The payload is the 16
+ * byte palette, secondary palette and high colour bitfield, then
+ * transform, high colour mode, overlay control and whether the overlay
+ * is on, then 16 bytes of framebuffer and 16 of overlay line bits, and
+ * the 64 bytes of each line set, framebuffer lines first.  A key frame
+ * sets every line; a delta is against the message before it.
+ */
+
+#ifndef _FRAME_STREAM_H
+#define _FRAME_STREAM_H
+
+#include "SDL2screen.h"
+
+/* Open the server from the options, called at screen setup */
+void frameStreamInit(void);
+
+/* Emulator thread, at each vblank */
+void frameStreamFrame(const nextp8_frame *f);
+
+/* Close the server and its clients, called at exit */
+void frameStreamStop(void);
+
+#endif
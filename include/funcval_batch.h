@@ -0,0 +1,18 @@
+/*
+ * funcval_batch.h
+ *
+ * Batch FuncVal runner (--funcval_batch <manifest>).
+ */
+
+#ifndef _FUNCVAL_BATCH_H
+#define _FUNCVAL_BATCH_H
+
+/*
+ * Run the tests of the manifest, called right after the options are
+ * parsed.  Does not return in the batch process itself, which exits with
+ * 0 if every test passed.  Returns in the process of each test with the
+ * options parsed again for it, to carry on as a normal emulator run.
+ */
+void funcvalBatch(int argc, char **argv);
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * logger.h
+ *
+ * Leveled logging for paths that run with the emulator (--log).  A
+ * message below LOG_COMPILED_LEVEL (CMake LOG_LEVEL) compiles away; one
+ * below its module's level costs a byte compare.  The rest is formatted
+ * into a lock-free ring and written out by a logger thread, so the
+ * caller never blocks on the console.  Each call site prints at most
+ * LOG_BURST lines a second and counts the ones it drops.
+ *
+ * Messages carry their own newline, as with printf.  Errors and warnings
+ * go to stderr, the rest to stdout.
+ */
+
+#ifndef _LOGGER_H
+#define _LOGGER_H
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+	LOG_ERROR,
+	LOG_WARN,
+	LOG_INFO,
+	LOG_DEBUG
+};
+
+enum {
+	LOGM_EMU,
+	LOGM_HW,			/* HW register accesses */
+	LOGM_AUDIO,
+	LOG_MODULES
+};
+
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL	LOG_DEBUG
+#endif
+
+#define LOG_BURST	20	/* lines per call site a second */
+
+typedef struct log_site {
+	uint32_t window;		/* SDL_GetTicks() / 1000 */
+	unsigned count;
+	unsigned suppressed;
+} log_site;
+
+extern uint8_t log_levels[LOG_MODULES];
+
+#define LOG(module, level, ...)							\
+	do {									\
+		static log_site log_site_;					\
+		if ((level) <= LOG_COMPILED_LEVEL && (level) <= log_levels[module]) \
+			logWrite(&log_site_, (module), (level), __VA_ARGS__);	\
+	} while (0)
+
+void logWrite(log_site *site, int module, int level, const char *fmt, ...)
+#ifdef __GNUC__
+	__attribute__((format(printf, 4, 5)))
+#endif
+	;
+
+/* Sets the levels from "level" or "module=level,...", starts the thread.
+ * Until then messages are printed directly. */
+void logInit(const char *spec);
+
+/* Writes out what is queued and stops the thread */
+void logClose(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
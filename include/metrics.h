@@ -0,0 +1,96 @@
+/*
+ * metrics.h
+ *
+ * Runtime counters and histograms (--metrics).  Every counter and
+ * histogram has one writing thread, so an update is a flag test and a
+ * plain add; readers on other threads may see a slightly stale value.
+ * Reported as a log line every --metrics_interval seconds, on SIGUSR1
+ * after the DumpState, and in Prometheus text format over HTTP on
+ * 127.0.0.1:--metrics_port.
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+	METRIC_INSNS,			/* emulator thread */
+	METRIC_CHUNKS,
+	METRIC_EXCEPTIONS,
+	METRIC_INTERRUPTS,
+	METRIC_SD_SECTORS_READ,
+	METRIC_SD_SECTORS_WRITTEN,
+	METRIC_SD_CACHE_HITS,
+	METRIC_SD_CACHE_MISSES,
+	METRIC_ESP_UART_TX,		/* guest to ESP8266 */
+	METRIC_ESP_UART_RX,
+	METRIC_ESP_COMMANDS,
+	METRIC_ESP_NET_TX,
+	METRIC_ESP_NET_RX,
+	METRIC_FRAMES_RENDERED,		/* SDL thread */
+	METRIC_FRAMES_SKIPPED,
+	METRIC_AUDIO_CALLBACKS,		/* audio callback */
+	METRIC_AUDIO_UNDERRUNS,
+	METRIC_COUNT
+};
+
+/* HW register accesses by region, emulator thread */
+enum {
+	METRIC_REGION_REGS,
+	METRIC_REGION_KBD,
+	METRIC_REGION_DA,
+	METRIC_REGION_FB,
+	METRIC_REGION_PALETTE,
+	METRIC_REGION_P8AUDIO,
+	METRIC_REGION_SD_DMA,
+	METRIC_REGIONS
+};
+
+enum {
+	METRIC_HIST_RENDER_US,		/* render and present */
+	METRIC_HIST_AUDIO_US,		/* p8audio callback */
+	METRIC_HIST_INPUT_US,		/* input batch to first guest read */
+	METRIC_HIST_COUNT
+};
+
+extern bool metrics_enabled;
+extern uint64_t metric_values[METRIC_COUNT];
+extern uint64_t metric_hw_reads[METRIC_REGIONS];
+extern uint64_t metric_hw_writes[METRIC_REGIONS];
+
+static inline void metricAdd(int m, uint64_t n)
+{
+	if (metrics_enabled)
+		metric_values[m] += n;
+}
+
+/* For totals kept elsewhere, copied by their writing thread */
+static inline void metricSet(int m, uint64_t v)
+{
+	if (metrics_enabled)
+		metric_values[m] = v;
+}
+
+void metricHist(int hist, uint64_t value);
+uint64_t metricsNow(void);
+/* Microseconds since a metricsNow() value */
+uint64_t metricsSinceUs(uint64_t start);
+
+/* Sets up from the options and starts the reporting thread */
+void metricsInit(void);
+
+/* Safe in a signal handler: the reporting thread prints a dump */
+void metricsRequestDump(void);
+
+void metricsClose(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
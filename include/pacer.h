@@ -0,0 +1,59 @@
+/*
+ * pacer.h
+ *
+ * Frame tick and emulation speed pacing against a monotonic clock.
+ */
+
+#ifndef _PACER_H
+#define _PACER_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PACER_TICK_HZ	50
+
+/* true when ticks come from display presents rather than the clock */
+extern bool pacer_vsync;
+
+void pacerInit(void);
+void pacerStop(void);
+uint64_t pacerNowNs(void);
+void pacerSleepUntil(uint64_t deadline_ns);
+
+/* Emulator thread: account for n instructions (cycles with --cycle_timing)
+   run at the current speed */
+void pacerThrottle(long n);
+
+/* Emulator thread: don't sleep or start again after a lag while on, to
+   run frames again as fast as possible */
+void pacerFreeRun(bool on);
+
+#ifdef NEXTP8
+/* The tick's place in emulated time, a save state section */
+struct ss_buf;
+void pacerSaveState(struct ss_buf *b);
+int pacerLoadState(struct ss_buf *b);
+#endif
+
+/* Emulator thread: current emulated time in ns, for ordering and spacing events */
+uint64_t pacerEmuNs(void);
+
+/* Emulator thread: instructions or cycles until the pacer raises the next
+   tick itself, 0 when ticks come from the host clock or the display */
+uint64_t pacerUntilTick(void);
+
+/* Emulator thread, idle guest: sleep until the next host tick, or only
+   briefly when the guest is waiting on the host clock */
+void pacerIdleWait(bool brief);
+
+/* SDL thread, vsync mode: a frame has just been presented */
+void pacerPresented(void);
+
+/* Fast forward: run unthrottled with ticks counted in instructions.
+   refresh_hz paces the frames shown when --turbo_skip is 0 */
+void pacerSetTurbo(bool on, int refresh_hz);
+bool pacerTurbo(void);
+
+/* Ticking thread, fast forward: whether this tick's frame is shown */
+bool pacerTurboFrame(void);
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * startup_timing.h
+ *
+ * Where launch time goes.  Phases are host time spent in a step, added
+ * up over the calls (ROM load and optable are inside emulator_init);
+ * events are when something first happened, from the start of main().
+ * The breakdown is printed with --verbose 2 and written as one JSON
+ * document to --startup_json, when the guest writes --startup_post (the
+ * loader's hand-off) or else at exit.
+ */
+
+#ifndef _STARTUP_TIMING_H
+#define _STARTUP_TIMING_H
+#include <stdbool.h>
+#include <stdint.h>
+
+enum startup_phase {
+	STARTUP_OPTIONS,
+	STARTUP_EMULATOR_INIT,
+	STARTUP_ROM_LOAD,
+	STARTUP_OPTABLE,
+	STARTUP_SCREEN,
+	STARTUP_AUDIO,
+	STARTUP_VERILATOR,
+	STARTUP_ESP,
+	STARTUP_SSL,
+	/* Events */
+	STARTUP_FIRST_INSN,
+	STARTUP_FIRST_VBLANK,
+	STARTUP_FIRST_SD_READ,
+	STARTUP_HANDOFF,
+	STARTUP_PHASES
+};
+
+/* Host ticks of an event, 0 until it happened */
+extern uint64_t startup_at[STARTUP_PHASES];
+
+/* Called first thing in main() */
+void startupTimingStart(void);
+
+/* Options: JSON file (none if empty) and hand-off POST code (-1: none) */
+void startupTimingInit(const char *json, int post);
+
+uint64_t startupNow(void);
+
+/* Add the time from since (a startupNow()) to now to phase p */
+void startupAdd(enum startup_phase p, uint64_t since);
+
+/* For sources with their own clock */
+void startupAddUs(enum startup_phase p, uint64_t us);
+
+void startupEvent(enum startup_phase p);
+
+/* Event p, the first time only; cheap enough for per-frame paths */
+static inline void startupMark(enum startup_phase p)
+{
+	if (!startup_at[p])
+		startupEvent(p);
+}
+
+/* The guest wrote POST code d */
+void startupPost(unsigned d);
+
+/* Print and write the report, once */
+void startupTimingDump(void);
+
+#endif
@@ -0,0 +1,38 @@
+/*
+ * thread_policy.h
+ *
+ * CPU placement and priority of the emulator's threads by role
+ * (--thread_cpus, --thread_priority).  Each thread applies its role's
+ * policy to itself when it starts; what the host doesn't allow is
+ * reported once and left at the default.
+ */
+
+#ifndef _THREAD_POLICY_H
+#define _THREAD_POLICY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+	THREAD_MAIN,			/* SDL events and rendering */
+	THREAD_CPU,			/* emulator, QLRun */
+	THREAD_AUDIO,			/* mixer callback */
+	THREAD_TIMER,			/* pacer tick */
+	THREAD_PROFILER,		/* profiler thread and its workers */
+	THREAD_WORKER,			/* IO, logging, tracing, metrics, shaders */
+	THREAD_ROLES
+};
+
+/* Parse the options and apply THREAD_MAIN to the calling thread; before
+   any other thread starts */
+void threadPolicyInit(const char *cpus, const char *priority);
+
+/* Apply role's policy to the calling thread */
+void threadPolicyApply(int role);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _THREAD_POLICY_H */
@@ -0,0 +1,25 @@
+/*
+ * video_capture.h
+ *
+ * Streaming capture of the native nextp8 display and p8audio output
+ * (--video, --video_format).
+ */
+
+#ifndef _VIDEO_CAPTURE_H
+#define _VIDEO_CAPTURE_H
+#include <stdbool.h>
+
+#include "SDL2screen.h"
+
+extern bool video_capture_enabled;
+
+/* Open the capture from the video options, called at screen setup */
+void videoCaptureInit(void);
+
+/* Emulator thread, at each vblank: f is this tick's frame with its hash */
+void videoCaptureFrame(const nextp8_frame *f);
+
+/* Queue the close of the capture files, called at exit */
+void videoCaptureStop(void);
+
+#endif
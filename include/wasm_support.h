@@ -1,8 +1,25 @@
 #ifndef _WASMSUPPORT_H
 #define _WASMSUPPORT_H
 
+#include <stdint.h>
+
 void wasm_reload(void);
 int wasm_does_boot_file_exist(void);
 void wasm_init_storage(void);
 
+/* Queue a write of /local back to IndexedDB, from any thread */
+void wasm_sync_storage(void);
+
+/* Blocking HTTP access for streamed images, see sd_image.c */
+double wasm_http_size(const char *url);
+int wasm_http_range(const char *url, double offset, int len, uint8_t *buf);
+
+#ifdef AUDIO_WORKLET
+#include <SDL.h>
+
+/* Main thread: play ring (capacity a power of two) through an AudioWorklet */
+int wasm_audio_start(int16_t *ring, SDL_atomic_t *pos, int capacity, int rate);
+void wasm_audio_stop(void);
+#endif
+
 #endif
\ No newline at end of file
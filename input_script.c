@@ -0,0 +1,249 @@
+/*
+ * input_script.c
+ *
+ * Scripted input, see input_script.h.  The script is read whole at
+ * start-up; frame events are taken at the tick and cycle events from a
+ * scheduler event armed for the next one.
+ */
+
+#ifdef NEXTP8
+
+#include <ctype.h>
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cycles.h"
+#include "input_script.h"
+#include "scheduler.h"
+#include "SDL2screen.h"
+
+enum {
+	IS_KEY,
+	IS_JOY,
+	IS_MOUSE
+};
+
+typedef struct {
+	uint64_t when;
+	uint8_t type;
+	uint8_t arg;		/* key code or joystick */
+	uint8_t down;
+	unsigned int bits;	/* joystick or mouse buttons */
+	int16_t dx, dy, dz;
+} script_event;
+
+typedef struct {
+	script_event *ev;
+	int count, size, next;
+} script_queue;
+
+static script_queue by_frame, by_cycle;
+static sched_event cycle_event;
+
+/* SDL_GetKeyFromName() needs the keymap of the video subsystem, which
+   headless runs don't start, so go through the scancode */
+static SDL_Keycode key_from_name(const char *name)
+{
+	SDL_Scancode sc;
+
+	if (!name[1])
+		return tolower((unsigned char)name[0]);
+	sc = SDL_GetScancodeFromName(name);
+	switch (sc) {
+	case SDL_SCANCODE_UNKNOWN:
+		return SDLK_UNKNOWN;
+	case SDL_SCANCODE_RETURN:
+		return SDLK_RETURN;
+	case SDL_SCANCODE_ESCAPE:
+		return SDLK_ESCAPE;
+	case SDL_SCANCODE_BACKSPACE:
+		return SDLK_BACKSPACE;
+	case SDL_SCANCODE_TAB:
+		return SDLK_TAB;
+	case SDL_SCANCODE_SPACE:
+		return SDLK_SPACE;
+	default:
+		return SDL_SCANCODE_TO_KEYCODE(sc);
+	}
+}
+
+static int key_code(const char *s)
+{
+	char *end;
+	long v;
+
+	if (isdigit((unsigned char)s[0]) && s[1]) {
+		v = strtol(s, &end, 0);
+		return *end || v < 0 || v > 0xff ? -1 : (int)v;
+	}
+	return QLSDLKeyCode(key_from_name(s));
+}
+
+static bool push(script_queue *q, const script_event *e)
+{
+	script_event *n;
+
+	if (q->count && e->when < q->ev[q->count - 1].when)
+		return false;
+	if (q->count == q->size) {
+		q->size = q->size ? q->size * 2 : 256;
+		n = realloc(q->ev, q->size * sizeof(*n));
+		if (!n) {
+			fprintf(stderr, "Input script: out of memory\n");
+			exit(1);
+		}
+		q->ev = n;
+	}
+	q->ev[q->count++] = *e;
+	return true;
+}
+
+static void apply(const script_event *e)
+{
+	unsigned int old;
+
+	switch (e->type) {
+	case IS_KEY:
+		SDLQLKeyrowChg(e->arg, e->down);
+		break;
+	case IS_JOY:
+		old = joy_state[e->arg];
+		joy_state[e->arg] = e->bits;
+		inputLatchSet(&joy_latched[e->arg], e->bits & ~old);
+		break;
+	case IS_MOUSE:
+		old = sdl_mouse_buttons;
+		sdl_mouse_buttons = e->bits;
+		inputLatchSet(&sdl_mouse_buttons_latched, e->bits & ~old);
+		sdl_mouse_x_accum += e->dx;
+		sdl_mouse_y_accum += e->dy;
+		sdl_mouse_z_accum += e->dz;
+		break;
+	}
+}
+
+/* Apply q's events due by now; true if any */
+static bool run_due(script_queue *q, uint64_t now)
+{
+	bool any = false;
+
+	while (q->next < q->count && q->ev[q->next].when <= now) {
+		apply(&q->ev[q->next++]);
+		any = true;
+	}
+	return any;
+}
+
+static void arm_cycles(void)
+{
+	uint64_t when;
+
+	if (by_cycle.next == by_cycle.count)
+		return;
+	when = by_cycle.ev[by_cycle.next].when;
+	// Fires early at worst, and is armed again
+	schedAt(&cycle_event, when > cpu_cycles ?
+		(when - cpu_cycles + CYCLES_PER_INSN - 1) / CYCLES_PER_INSN : 0);
+}
+
+static void script_cycles_fn(void *arg)
+{
+	if (run_due(&by_cycle, cpu_cycles))
+		inputPublish();
+	arm_cycles();
+}
+
+static bool parse_line(char *line, script_event *e, bool *by_cycles)
+{
+	char when[32], what[16], a[32], b[16];
+	int dx, dy, dz = 0, n, bits;
+	char *end;
+	int code;
+
+	memset(e, 0, sizeof(*e));
+	if (sscanf(line, "%31s %15s", when, what) != 2)
+		return false;
+	e->when = strtoull(when, &end, 0);
+	*by_cycles = *end == 'c';
+	if (end == when || (*end && strcmp(end, "c")))
+		return false;
+
+	if (!strcmp(what, "key")) {
+		if (sscanf(line, "%*s %*s %31s %15s", a, b) != 2)
+			return false;
+		code = key_code(a);
+		if (code < 0 || (strcmp(b, "down") && strcmp(b, "up")))
+			return false;
+		e->type = IS_KEY;
+		e->arg = code;
+		e->down = !strcmp(b, "down");
+	} else if (!strcmp(what, "joy")) {
+		if (sscanf(line, "%*s %*s %d %i", &n, &bits) != 2 || n < 0 || n > 1)
+			return false;
+		e->type = IS_JOY;
+		e->arg = n;
+		e->bits = bits & 0xff;
+	} else if (!strcmp(what, "mouse")) {
+		if (sscanf(line, "%*s %*s %i %d %d %d", &bits, &dx, &dy, &dz) < 3)
+			return false;
+		e->type = IS_MOUSE;
+		e->bits = bits & 0x1f;
+		e->dx = dx;
+		e->dy = dy;
+		e->dz = dz;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+bool inputScriptInit(const char *path)
+{
+	char line[256], *p;
+	script_event e;
+	bool by_cycles;
+	FILE *f;
+	int n = 0;
+
+	schedInit(&cycle_event, "input_script", script_cycles_fn, NULL);
+	if (!path || !*path)
+		return false;
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return false;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		n++;
+		if ((p = strchr(line, '#')))
+			*p = 0;
+		for (p = line; isspace((unsigned char)*p); p++)
+			;
+		if (!*p)
+			continue;
+		if (!parse_line(p, &e, &by_cycles) ||
+		    !push(by_cycles ? &by_cycle : &by_frame, &e))
+			fprintf(stderr, "Input script: %s:%d: bad or out of order event, skipped\n",
+				path, n);
+	}
+	fclose(f);
+	printf("Input script: %d frame and %d cycle events from %s\n",
+	       by_frame.count, by_cycle.count, path);
+
+	// Frame 0 is reset
+	run_due(&by_frame, 0);
+	run_due(&by_cycle, cpu_cycles);
+	inputPublish();
+	arm_cycles();
+	return true;
+}
+
+void inputScriptFrame(uint64_t frame)
+{
+	if (by_frame.next < by_frame.count && run_due(&by_frame, frame))
+		inputPublish();
+}
+
+#endif /* NEXTP8 */
@@ -0,0 +1,37 @@
+/*
+ * input_script.h
+ *
+ * Scripted input (--input_script): key, joystick and mouse events at
+ * given emulated times, fed straight into the keyboard matrix, joystick
+ * and mouse levels and latches the guest reads, as the funcval
+ * registers do.  Cycle timing is turned on, so with --headless and
+ * --speed 0.0 a run plays out the same however fast it goes.  Meant for
+ * headless runs: with a window, the UI thread's own input lands in the
+ * same state.
+ *
+ * One event per line, # starts a comment:
+ *
+ *   <when> key <name|code> down|up	SDL key name ("a", "Return", "Left")
+ *					or PS/2 set 2 code, 0x80 | extended
+ *   <when> joy <0|1> <bits>		levels: 1 up, 2 down, 4 left,
+ *					8 right, 0x10 on buttons
+ *   <when> mouse <buttons> <dx> <dy> [<dz>]	moves in 1/4 pixels
+ *
+ * <when> is 50Hz frames from reset, or emulated CPU cycles with a "c"
+ * suffix ("120", "2500000c"); events of each kind must be in order.
+ * Frame events land at the tick, before the guest sees its vblank.
+ */
+
+#ifndef INPUT_SCRIPT_H
+#define INPUT_SCRIPT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Option: script file.  True if one was loaded */
+bool inputScriptInit(const char *path);
+
+/* At each 50Hz tick, frame counting from 1 */
+void inputScriptFrame(uint64_t frame);
+
+#endif /* INPUT_SCRIPT_H */
@@ -3,11 +3,16 @@
  */
 
 #include "QL68000.h"
+#include "btrace.h"
+#include "memaccess.h"
 #include "mmodes.h"
 
 #ifdef PROFILER
 #include "profiler/profiler_events.h"
 #endif
+#ifdef DECODE_CACHE
+#include "decode_cache.h"
+#endif
 
 void abcd(void)
 {
@@ -15,6 +20,7 @@ void abcd(void)
 	w8 *dx;
 	uw16 abcd_lo, abcd_hi, abcd_res;
 	int abcd_carry;
+	CC_FLUSH();
 
 	if ((code & 8) != 0) {
 		s = GetFromEA_b_m4();
@@ -57,10 +63,7 @@ void add_b_dn(void)
 	r = *d + s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = (((r & 0x80) == 0) && (((s | *d) & 0x80) != 0)) ||
-			((s & *d & 0x80) != 0);
-	overflow = ((0x80 & s & *d & (r ^ 0x80)) != 0) ||
-		   ((0x80 & r & (*d ^ 0x80) & (s ^ 0x80)) != 0);
+	CC_LAZY(CC_ADD_B, s, *d, r);
 	*d = r;
 }
 
@@ -73,10 +76,7 @@ void add_b_dn_dn(void)
 	r = *d + s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = (((r & 0x80) == 0) && (((s | *d) & 0x80) != 0)) ||
-			((s & *d & 0x80) != 0);
-	overflow = ((0x80 & s & *d & (r ^ 0x80)) != 0) ||
-		   ((0x80 & r & (*d ^ 0x80) & (s ^ 0x80)) != 0);
+	CC_LAZY(CC_ADD_B, s, *d, r);
 	*d = r;
 }
 
@@ -89,11 +89,7 @@ void add_w_dn(void)
 	r = *d + s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = (((r & 0x8000) == 0) && (((s | *d) & 0x8000) != 0)) ||
-			((s & *d & 0x8000) != 0);
-
-	overflow = ((0x8000 & s & *d & (r ^ 0x8000)) != 0) ||
-		   ((0x8000 & r & (*d ^ 0x8000) & (s ^ 0x8000)) != 0);
+	CC_LAZY(CC_ADD_W, s, *d, r);
 	*d = r;
 }
 
@@ -106,11 +102,7 @@ void add_w_dn_dn(void)
 	r = *d + s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = (((r & 0x8000) == 0) && (((s | *d) & 0x8000) != 0)) ||
-			((s & *d & 0x8000) != 0);
-
-	overflow = ((0x8000 & s & *d & (r ^ 0x8000)) != 0) ||
-		   ((0x8000 & r & (*d ^ 0x8000) & (s ^ 0x8000)) != 0);
+	CC_LAZY(CC_ADD_W, s, *d, r);
 	*d = r;
 }
 
@@ -123,13 +115,7 @@ void add_l_dn(void)
 	r = *d + s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry =
-		(((r & 0x80000000) == 0) && (((s | *d) & 0x80000000) != 0)) ||
-		((s & *d & 0x80000000) != 0);
-
-	overflow =
-		((0x80000000 & s & *d & (r ^ 0x80000000)) != 0) ||
-		((0x80000000 & r & (*d ^ 0x80000000) & (s ^ 0x80000000)) != 0);
+	CC_LAZY(CC_ADD_L, s, *d, r);
 	*d = r;
 }
 
@@ -142,13 +128,7 @@ void add_l_dn_dn(void)
 	r = *d + s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry =
-		(((r & 0x80000000) == 0) && (((s | *d) & 0x80000000) != 0)) ||
-		((s & *d & 0x80000000) != 0);
-
-	overflow =
-		((0x80000000 & s & *d & (r ^ 0x80000000)) != 0) ||
-		((0x80000000 & r & (*d ^ 0x80000000) & (s ^ 0x80000000)) != 0);
+	CC_LAZY(CC_ADD_L, s, *d, r);
 	*d = r;
 }
 
@@ -161,10 +141,7 @@ void add_b_ea(void)
 	r = d + s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = (((r & 0x80) == 0) && (((s | d) & 0x80) != 0)) ||
-			((s & d & 0x80) != 0);
-	overflow = ((0x80 & s & d & (r ^ 0x80)) != 0) ||
-		   ((0x80 & r & (d ^ 0x80) & (s ^ 0x80)) != 0);
+	CC_LAZY(CC_ADD_B, s, d, r);
 	RewriteEA_b(r);
 }
 
@@ -178,11 +155,7 @@ void add_w_ea(void)
 	r = d + s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = (((r & 0x8000) == 0) && (((s | d) & 0x8000) != 0)) ||
-			((s & d & 0x8000) != 0);
-
-	overflow = ((0x8000 & s & d & (r ^ 0x8000)) != 0) ||
-		   ((0x8000 & r & (d ^ 0x8000) & (s ^ 0x8000)) != 0);
+	CC_LAZY(CC_ADD_W, s, d, r);
 	RewriteEA_w(r);
 }
 
@@ -196,13 +169,7 @@ void add_l_ea(void)
 	r = d + s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry =
-		(((r & 0x80000000) == 0) && (((s | d) & 0x80000000) != 0)) ||
-		((s & d & 0x80000000) != 0);
-
-	overflow =
-		((0x80000000 & s & d & (r ^ 0x80000000)) != 0) ||
-		((0x80000000 & r & (d ^ 0x80000000) & (s ^ 0x80000000)) != 0);
+	CC_LAZY(CC_ADD_L, s, d, r);
 	RewriteEA_l(r);
 }
 
@@ -247,10 +214,7 @@ void addi_b(void)
 	r = d + s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = (((r & 0x80) == 0) && (((s | d) & 0x80) != 0)) ||
-			((s & d & 0x80) != 0);
-	overflow = ((0x80 & s & d & (r ^ 0x80)) != 0) ||
-		   ((0x80 & r & (d ^ 0x80) & (s ^ 0x80)) != 0);
+	CC_LAZY(CC_ADD_B, s, d, r);
 	RewriteEA_b(r);
 }
 
@@ -264,11 +228,7 @@ void addi_w(void)
 	r = d + s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = (((r & 0x8000) == 0) && (((s | d) & 0x8000) != 0)) ||
-			((s & d & 0x8000) != 0);
-
-	overflow = ((0x8000 & s & d & (r ^ 0x8000)) != 0) ||
-		   ((0x8000 & r & (d ^ 0x8000) & (s ^ 0x8000)) != 0);
+	CC_LAZY(CC_ADD_W, s, d, r);
 	RewriteEA_w(r);
 }
 
@@ -284,13 +244,7 @@ void addi_l(void)
 	r = d + s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry =
-		(((r & 0x80000000) == 0) && (((s | d) & 0x80000000) != 0)) ||
-		((s & d & 0x80000000) != 0);
-
-	overflow =
-		((0x80000000 & s & d & (r ^ 0x80000000)) != 0) ||
-		((0x80000000 & r & (d ^ 0x80000000) & (s ^ 0x80000000)) != 0);
+	CC_LAZY(CC_ADD_L, s, d, r);
 	RewriteEA_l(r);
 }
 
@@ -305,8 +259,7 @@ void addq_b(void)
 	r = d + s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = (((r & 0x80) == 0) && ((d & 0x80) != 0));
-	overflow = (0x80 & r & (d ^ 0x80)) != 0;
+	CC_LAZY(CC_ADD_B, s, d, r);
 	RewriteEA_b(r);
 }
 
@@ -322,8 +275,7 @@ void addq_w(void)
 	r = d + s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = (((r & 0x8000) == 0) && ((d & 0x8000) != 0));
-	overflow = (0x8000 & r & (d ^ 0x8000)) != 0;
+	CC_LAZY(CC_ADD_W, s, d, r);
 	RewriteEA_w(r);
 }
 
@@ -339,8 +291,7 @@ void addq_l(void)
 	r = d + s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = (((r & 0x80000000) == 0) && ((d & 0x80000000) != 0));
-	overflow = (0x80000000 & r & (d ^ 0x80000000)) != 0;
+	CC_LAZY(CC_ADD_L, s, d, r);
 	RewriteEA_l(r);
 }
 
@@ -362,6 +313,7 @@ void addx_b_r(void)
 {
 	w8 s, r;
 	w8 *d;
+	CC_FLUSH();
 	d = (w8 *)((Ptr)reg + ((code >> 7) & 28) + RBO);
 	s = (w8)reg[code & 7];
 	r = *d + s;
@@ -380,6 +332,7 @@ void addx_w_r(void)
 {
 	w16 s, r;
 	w16 *d;
+	CC_FLUSH();
 	d = (w16 *)((Ptr)reg + ((code >> 7) & 28) + RWO);
 	s = (w16)reg[code & 7];
 	r = *d + s;
@@ -399,6 +352,7 @@ void addx_l_r(void)
 {
 	w32 s, r;
 	w32 *d;
+	CC_FLUSH();
 	d = (w32 *)((Ptr)reg + ((code >> 7) & 28));
 	s = reg[code & 7];
 	r = *d + s;
@@ -419,6 +373,7 @@ void addx_l_r(void)
 void addx_b_m(void)
 {
 	w8 s, d, r;
+	CC_FLUSH();
 	s = GetFromEA_b_m4();
 	d = ModifyAtEA_b(4, (code >> 9) & 7);
 	r = d + s;
@@ -436,6 +391,7 @@ void addx_b_m(void)
 void addx_w_m(void)
 {
 	w16 s, d, r;
+	CC_FLUSH();
 
 	s = GetFromEA_w_m4();
 	d = ModifyAtEA_w(4, (code >> 9) & 7);
@@ -455,6 +411,7 @@ void addx_w_m(void)
 void addx_l_m(void)
 {
 	w32 s, d, r;
+	CC_FLUSH();
 
 	s = GetFromEA_l_m4();
 	d = ModifyAtEA_l(4, (code >> 9) & 7);
@@ -476,6 +433,7 @@ void addx_l_m(void)
 void and_b_dn(void)
 {
 	register w8 *d;
+	CC_FLUSH();
 	d = (w8 *)((Ptr)reg + ((code >> 7) & 28) + RBO);
 	*d = *d & GetFromEA_b[(code >> 3) & 7]();
 	negative = *d < 0;
@@ -486,6 +444,7 @@ void and_b_dn(void)
 void and_w_dn(void)
 {
 	register w16 *d;
+	CC_FLUSH();
 	d = (w16 *)((Ptr)reg + ((code >> 7) & 28) + RWO);
 	*d = *d & GetFromEA_w[(code >> 3) & 7]();
 	negative = *d < 0;
@@ -496,6 +455,7 @@ void and_w_dn(void)
 void and_l_dn(void)
 {
 	register w32 *d;
+	CC_FLUSH();
 	d = (w32 *)((Ptr)reg + ((code >> 7) & 28));
 	*d = *d & GetFromEA_l[(code >> 3) & 7]();
 	negative = *d < 0;
@@ -506,6 +466,7 @@ void and_l_dn(void)
 void and_l_dn_dn(void)
 {
 	register w32 *d;
+	CC_FLUSH();
 	d = (w32 *)((Ptr)reg + ((code >> 7) & 28));
 	(*d) &= reg[code & 7];
 	negative = *d < 0;
@@ -516,6 +477,7 @@ void and_l_dn_dn(void)
 void and_b_ea(void)
 {
 	register w8 d;
+	CC_FLUSH();
 	d = ModifyAtEA_b((code >> 3) & 7, code & 7);
 	d = d & *((w8 *)((Ptr)reg + ((code >> 7) & 28) + RBO));
 	negative = d < 0;
@@ -527,6 +489,7 @@ void and_b_ea(void)
 void and_w_ea(void)
 {
 	register w16 d;
+	CC_FLUSH();
 
 	d = ModifyAtEA_w((code >> 3) & 7, code & 7);
 	d = d & *((w16 *)((Ptr)reg + ((code >> 7) & 28) + RWO));
@@ -539,6 +502,7 @@ void and_w_ea(void)
 void and_l_ea(void)
 {
 	register w32 d;
+	CC_FLUSH();
 
 	d = ModifyAtEA_l((code >> 3) & 7, code & 7);
 	d = d & *((w32 *)((Ptr)reg + ((code >> 7) & 28)));
@@ -551,6 +515,7 @@ void and_l_ea(void)
 void andi_b(void)
 {
 	register w8 d;
+	CC_FLUSH();
 	d = (w8)RW_PC(pc++);
 	d = d & ModifyAtEA_b((code >> 3) & 7, code & 7);
 	negative = d < 0;
@@ -562,6 +527,7 @@ void andi_b(void)
 void andi_w(void)
 {
 	register w16 d;
+	CC_FLUSH();
 
 	d = (w16)RW_PC(pc++);
 	d = d & ModifyAtEA_w((code >> 3) & 7, code & 7);
@@ -574,6 +540,7 @@ void andi_w(void)
 void andi_l(void)
 {
 	register w32 d;
+	CC_FLUSH();
 
 	d = RL_PC((Ptr)pc); /* d=*((w32*)pc); */
 	pc += 2;
@@ -587,6 +554,7 @@ void andi_l(void)
 void andi_to_ccr(void)
 {
 	register uw16 d;
+	CC_FLUSH();
 	d = RW_PC(pc++);
 	carry = carry && ((d & 1) != 0);
 	overflow = overflow && ((d & 2) != 0);
@@ -613,6 +581,7 @@ void andi_to_sr(void)
 void asl_m(void)
 {
 	register w16 d;
+	CC_FLUSH();
 
 	d = ModifyAtEA_w((code >> 3) & 7, code & 7);
 	xflag = carry = (d & 0x8000) != 0;
@@ -626,6 +595,7 @@ void asl_m(void)
 void asr_m(void)
 {
 	register w16 d;
+	CC_FLUSH();
 
 	d = ModifyAtEA_w((code >> 3) & 7, code & 7);
 	xflag = carry = (d & 1) != 0;
@@ -730,6 +700,7 @@ void bne_s(void)
 
 void bcs_s(void)
 {
+	CC_FLUSH();
 	if (carry)
 #ifdef DEBUG
 		SetPC((Ptr)pc - (Ptr)memBase + (w8)code);
@@ -743,6 +714,7 @@ void bcs_s(void)
 
 void bccc_s(void)
 {
+	CC_FLUSH();
 	if (!carry)
 #ifdef DEBUG
 		SetPC((Ptr)pc - (Ptr)memBase + (w8)code);
@@ -782,6 +754,7 @@ void bmi_s(void)
 
 void bge_s(void)
 {
+	CC_FLUSH();
 	if ((negative && overflow) || (!(negative || overflow)))
 #ifdef DEBUG
 		SetPC((Ptr)pc - (Ptr)memBase + (w8)code);
@@ -795,6 +768,7 @@ void bge_s(void)
 
 void blt_s(void)
 {
+	CC_FLUSH();
 	if ((negative && (!overflow)) || ((!negative) && overflow))
 #ifdef DEBUG
 		SetPC((Ptr)pc - (Ptr)memBase + (w8)code);
@@ -808,6 +782,7 @@ void blt_s(void)
 
 void bgt_s(void)
 {
+	CC_FLUSH();
 	if ((!zero) && ((negative && overflow) || (!(negative || overflow))))
 #ifdef DEBUG
 		SetPC((Ptr)pc - (Ptr)memBase + (w8)code);
@@ -821,6 +796,7 @@ void bgt_s(void)
 
 void ble_s(void)
 {
+	CC_FLUSH();
 	if (zero || (negative && (!overflow)) || ((!negative) && overflow))
 #ifdef DEBUG
 		SetPC((Ptr)pc - (Ptr)memBase + (w8)code);
@@ -1076,6 +1052,7 @@ void chk(void)
 
 void clr_b(void)
 {
+	CC_FLUSH();
 	ARCALL(PutToEA_b, (code >> 3) & 7, code & 7, 0);
 	/*((void (*)(short,w8)REGP2)PutToEA_b[(code>>3)&7])(code&7,0);*/
 	/*PUT_TOEA_B((code>>3)&7,code&7,0);*/
@@ -1085,6 +1062,7 @@ void clr_b(void)
 
 void clr_w(void)
 {
+	CC_FLUSH();
 	ARCALL(PutToEA_w, (code >> 3) & 7, code & 7, 0);
 	/*PUT_TOEA_W((code>>3)&7,code&7,0);*/
 	negative = overflow = carry = false;
@@ -1093,6 +1071,7 @@ void clr_w(void)
 
 void clr_l(void)
 {
+	CC_FLUSH();
 	ARCALL(PutToEA_l, (code >> 3) & 7, code & 7, 0);
 	/*PUT_TOEA_L((code>>3)&7,code&7,0);*/
 	negative = overflow = carry = false;
@@ -1107,10 +1086,7 @@ void cmp_b(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	carry = (((d & 0x80) == 0) && (((s | r) & 0x80) != 0)) ||
-		((s & r & 0x80) != 0);
-	overflow = ((0x80 & (s ^ 0x80) & d & (r ^ 0x80)) != 0) ||
-		   ((0x80 & r & (d ^ 0x80) & s) != 0);
+	CC_LAZY_CMP(CC_CMP_B, s, d, r);
 }
 
 void cmp_b_dan(void)
@@ -1121,10 +1097,7 @@ void cmp_b_dan(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	carry = (((d & 0x80) == 0) && (((s | r) & 0x80) != 0)) ||
-		((s & r & 0x80) != 0);
-	overflow = ((0x80 & (s ^ 0x80) & d & (r ^ 0x80)) != 0) ||
-		   ((0x80 & r & (d ^ 0x80) & s) != 0);
+	CC_LAZY_CMP(CC_CMP_B, s, d, r);
 }
 
 void cmp_b_dn(void)
@@ -1135,10 +1108,7 @@ void cmp_b_dn(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	carry = (((d & 0x80) == 0) && (((s | r) & 0x80) != 0)) ||
-		((s & r & 0x80) != 0);
-	overflow = ((0x80 & (s ^ 0x80) & d & (r ^ 0x80)) != 0) ||
-		   ((0x80 & r & (d ^ 0x80) & s) != 0);
+	CC_LAZY_CMP(CC_CMP_B, s, d, r);
 }
 
 void cmp_w(void)
@@ -1149,11 +1119,7 @@ void cmp_w(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	carry = (((d & 0x8000) == 0) && (((s | r) & 0x8000) != 0)) ||
-		((s & r & 0x8000) != 0);
-
-	overflow = ((0x8000 & (s ^ 0x8000) & d & (r ^ 0x8000)) != 0) ||
-		   ((0x8000 & r & (d ^ 0x8000) & s) != 0);
+	CC_LAZY_CMP(CC_CMP_W, s, d, r);
 }
 
 void cmp_w_dn(void)
@@ -1164,11 +1130,7 @@ void cmp_w_dn(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	carry = (((d & 0x8000) == 0) && (((s | r) & 0x8000) != 0)) ||
-		((s & r & 0x8000) != 0);
-
-	overflow = ((0x8000 & (s ^ 0x8000) & d & (r ^ 0x8000)) != 0) ||
-		   ((0x8000 & r & (d ^ 0x8000) & s) != 0);
+	CC_LAZY_CMP(CC_CMP_W, s, d, r);
 }
 
 void cmp_l(void)
@@ -1179,12 +1141,7 @@ void cmp_l(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	carry = (((d & 0x80000000) == 0) && (((s | r) & 0x80000000) != 0)) ||
-		((s & r & 0x80000000) != 0);
-
-	overflow =
-		((0x80000000 & (s ^ 0x80000000) & d & (r ^ 0x80000000)) != 0) ||
-		((0x80000000 & r & (d ^ 0x80000000) & s) != 0);
+	CC_LAZY_CMP(CC_CMP_L, s, d, r);
 }
 
 void cmp_l_dn(void)
@@ -1195,12 +1152,7 @@ void cmp_l_dn(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	carry = (((d & 0x80000000) == 0) && (((s | r) & 0x80000000) != 0)) ||
-		((s & r & 0x80000000) != 0);
-
-	overflow =
-		((0x80000000 & (s ^ 0x80000000) & d & (r ^ 0x80000000)) != 0) ||
-		((0x80000000 & r & (d ^ 0x80000000) & s) != 0);
+	CC_LAZY_CMP(CC_CMP_L, s, d, r);
 }
 
 void cmpa_w(void)
@@ -1211,12 +1163,7 @@ void cmpa_w(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	carry = (((d & 0x80000000) == 0) && (((s | r) & 0x80000000) != 0)) ||
-		((s & r & 0x80000000) != 0);
-
-	overflow =
-		((0x80000000 & (s ^ 0x80000000) & d & (r ^ 0x80000000)) != 0) ||
-		((0x80000000 & r & (d ^ 0x80000000) & s) != 0);
+	CC_LAZY_CMP(CC_CMP_L, s, d, r);
 }
 
 void cmpa_l(void)
@@ -1227,12 +1174,7 @@ void cmpa_l(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	carry = (((d & 0x80000000) == 0) && (((s | r) & 0x80000000) != 0)) ||
-		((s & r & 0x80000000) != 0);
-
-	overflow =
-		((0x80000000 & (s ^ 0x80000000) & d & (r ^ 0x80000000)) != 0) ||
-		((0x80000000 & r & (d ^ 0x80000000) & s) != 0);
+	CC_LAZY_CMP(CC_CMP_L, s, d, r);
 }
 
 void cmpa_l_an(void)
@@ -1243,12 +1185,7 @@ void cmpa_l_an(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	carry = (((d & 0x80000000) == 0) && (((s | r) & 0x80000000) != 0)) ||
-		((s & r & 0x80000000) != 0);
-
-	overflow =
-		((0x80000000 & (s ^ 0x80000000) & d & (r ^ 0x80000000)) != 0) ||
-		((0x80000000 & r & (d ^ 0x80000000) & s) != 0);
+	CC_LAZY_CMP(CC_CMP_L, s, d, r);
 }
 
 void cmpi_b(void)
@@ -1259,10 +1196,7 @@ void cmpi_b(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	carry = (((d & 0x80) == 0) && (((s | r) & 0x80) != 0)) ||
-		((s & r & 0x80) != 0);
-	overflow = ((0x80 & (s ^ 0x80) & d & (r ^ 0x80)) != 0) ||
-		   ((0x80 & r & (d ^ 0x80) & s) != 0);
+	CC_LAZY_CMP(CC_CMP_B, s, d, r);
 }
 
 void cmpi_w(void)
@@ -1273,11 +1207,7 @@ void cmpi_w(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	carry = (((d & 0x8000) == 0) && (((s | r) & 0x8000) != 0)) ||
-		((s & r & 0x8000) != 0);
-
-	overflow = ((0x8000 & (s ^ 0x8000) & d & (r ^ 0x8000)) != 0) ||
-		   ((0x8000 & r & (d ^ 0x8000) & s) != 0);
+	CC_LAZY_CMP(CC_CMP_W, s, d, r);
 }
 
 void cmpi_l(void)
@@ -1291,12 +1221,7 @@ void cmpi_l(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	carry = (((d & 0x80000000) == 0) && (((s | r) & 0x80000000) != 0)) ||
-		((s & r & 0x80000000) != 0);
-
-	overflow =
-		((0x80000000 & (s ^ 0x80000000) & d & (r ^ 0x80000000)) != 0) ||
-		((0x80000000 & r & (d ^ 0x80000000) & s) != 0);
+	CC_LAZY_CMP(CC_CMP_L, s, d, r);
 }
 
 void cmpm_b(void)
@@ -1311,10 +1236,7 @@ void cmpm_b(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	carry = (((d & 0x80) == 0) && (((s | r) & 0x80) != 0)) ||
-		((s & r & 0x80) != 0);
-	overflow = ((0x80 & (s ^ 0x80) & d & (r ^ 0x80)) != 0) ||
-		   ((0x80 & r & (d ^ 0x80) & s) != 0);
+	CC_LAZY_CMP(CC_CMP_B, s, d, r);
 }
 
 void cmpm_w(void)
@@ -1327,11 +1249,7 @@ void cmpm_w(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	carry = (((d & 0x8000) == 0) && (((s | r) & 0x8000) != 0)) ||
-		((s & r & 0x8000) != 0);
-
-	overflow = ((0x8000 & (s ^ 0x8000) & d & (r ^ 0x8000)) != 0) ||
-		   ((0x8000 & r & (d ^ 0x8000) & s) != 0);
+	CC_LAZY_CMP(CC_CMP_W, s, d, r);
 }
 
 void cmpm_l(void)
@@ -1344,12 +1262,7 @@ void cmpm_l(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	carry = (((d & 0x80000000) == 0) && (((s | r) & 0x80000000) != 0)) ||
-		((s & r & 0x80000000) != 0);
-
-	overflow =
-		((0x80000000 & (s ^ 0x80000000) & d & (r ^ 0x80000000)) != 0) ||
-		((0x80000000 & r & (d ^ 0x80000000) & s) != 0);
+	CC_LAZY_CMP(CC_CMP_L, s, d, r);
 }
 
 void dbcc(void)
@@ -1412,6 +1325,7 @@ void divs(void)
 	w32 *d;
 	w32 r;
 	w16 s;
+	CC_FLUSH();
 	d = (w32 *)((Ptr)reg + ((code >> 7) & 28));
 	s = GetFromEA_w[(code >> 3) & 7]();
 	if (s != 0) {
@@ -1438,6 +1352,7 @@ void divu(void)
 	uw32 *d;
 	uw32 r;
 	uw16 s;
+	CC_FLUSH();
 	d = (uw32 *)((Ptr)reg + ((code >> 7) & 28));
 	s = GetFromEA_w[(code >> 3) & 7]();
 	if (s != 0) {
@@ -1462,6 +1377,7 @@ void divu(void)
 void eor_b(void)
 {
 	register w8 d;
+	CC_FLUSH();
 	d = ModifyAtEA_b((code >> 3) & 7, code & 7);
 	d = d ^ *((w8 *)((Ptr)reg + ((code >> 7) & 28) + RBO));
 	negative = d < 0;
@@ -1473,6 +1389,7 @@ void eor_b(void)
 void eor_w(void)
 {
 	register w16 d;
+	CC_FLUSH();
 
 	d = ModifyAtEA_w((code >> 3) & 7, code & 7);
 	d = d ^ *((w16 *)((Ptr)reg + ((code >> 7) & 28) + RWO));
@@ -1485,6 +1402,7 @@ void eor_w(void)
 void eor_l(void)
 {
 	register w32 d;
+	CC_FLUSH();
 
 	d = ModifyAtEA_l((code >> 3) & 7, code & 7);
 	d = d ^ *((w32 *)((Ptr)reg + ((code >> 7) & 28)));
@@ -1497,6 +1415,7 @@ void eor_l(void)
 void eori_b(void)
 {
 	register w8 d;
+	CC_FLUSH();
 	d = (w8)RW_PC(pc++);
 	d = d ^ ModifyAtEA_b((code >> 3) & 7, code & 7);
 	negative = d < 0;
@@ -1508,6 +1427,7 @@ void eori_b(void)
 void eori_w(void)
 {
 	register w16 d;
+	CC_FLUSH();
 
 	d = (w16)RW_PC(pc++);
 	d = d ^ ModifyAtEA_w((code >> 3) & 7, code & 7);
@@ -1520,6 +1440,7 @@ void eori_w(void)
 void eori_l(void)
 {
 	register w32 d;
+	CC_FLUSH();
 
 	d = RL_PC((w32 *)pc);
 	pc += 2;
@@ -1533,6 +1454,7 @@ void eori_l(void)
 void eori_to_ccr(void)
 {
 	register uw16 d;
+	CC_FLUSH();
 	d = RW_PC(pc++);
 	if ((d & 1) != 0)
 		carry = !carry;
@@ -1596,6 +1518,7 @@ void exg_ad(void)
 void ext_w(void)
 {
 	register w16 *dn;
+	CC_FLUSH();
 	dn = (w16 *)(RWO + (Ptr)(&reg[code & 7]));
 
 	*dn = WordFromByte((w8)(*dn));
@@ -1607,6 +1530,7 @@ void ext_w(void)
 void ext_l(void)
 {
 	register w32 *dn;
+	CC_FLUSH();
 	dn = &reg[code & 7];
 	*dn = (w32)((w16)(*dn));
 	zero = *dn == 0;
@@ -1691,6 +1615,7 @@ void link_ins(void)
 void lsl_m(void)
 {
 	register uw16 d;
+	CC_FLUSH();
 
 	d = (uw16)ModifyAtEA_w((code >> 3) & 7, code & 7);
 	carry = xflag = (d & 0x8000) != 0;
@@ -1704,6 +1629,7 @@ void lsl_m(void)
 void lsr_m(void)
 {
 	register uw16 d;
+	CC_FLUSH();
 
 	d = (uw16)ModifyAtEA_w((code >> 3) & 7, code & 7);
 	carry = xflag = (d & 1) != 0;
@@ -1716,6 +1642,7 @@ void lsr_m(void)
 void move_b(void)
 {
 	register w8 d;
+	CC_FLUSH();
 	d = GetFromEA_b[(code >> 3) & 7]();
 	ARCALL(PutToEA_b, (code >> 6) & 7, (code >> 9) & 7, d);
 	/*PUT_TOEA_B((code>>6)&7,(code>>9)&7,d);*/
@@ -1727,6 +1654,7 @@ void move_b(void)
 void move_b_from_dn(void)
 {
 	register w8 d;
+	CC_FLUSH();
 	d = *((w8 *)(&reg[code & 7]) + RBO);
 	ARCALL(PutToEA_b, (code >> 6) & 7, (code >> 9) & 7, d);
 	/*PUT_TOEA_B((code>>6)&7,(code>>9)&7,d);*/
@@ -1738,6 +1666,7 @@ void move_b_from_dn(void)
 void move_b_to_dn(void)
 {
 	register w8 d;
+	CC_FLUSH();
 	d = *((w8 *)reg + ((code >> 7) & 28) + RBO) =
 		GetFromEA_b[(code >> 3) & 7]();
 	negative = d < 0;
@@ -1748,6 +1677,7 @@ void move_b_to_dn(void)
 void move_b_reg(void)
 {
 	register w8 d;
+	CC_FLUSH();
 	d = *((w8 *)reg + ((code >> 7) & 28) + RBO) =
 		*((w8 *)(&reg[code & 7]) + RBO);
 	negative = d < 0;
@@ -1758,6 +1688,7 @@ void move_b_reg(void)
 void move_w(void)
 {
 	register w16 d;
+	CC_FLUSH();
 	d = GetFromEA_w[(code >> 3) & 7]();
 	ARCALL(PutToEA_w, (code >> 6) & 7, (code >> 9) & 7, d);
 	/*PUT_TOEA_W((code>>6)&7,(code>>9)&7,d);*/
@@ -1769,6 +1700,7 @@ void move_w(void)
 void move_w_from_dn(void)
 {
 	register w16 d;
+	CC_FLUSH();
 	d = (w16)reg[code & 7];
 	ARCALL(PutToEA_w, (code >> 6) & 7, (code >> 9) & 7, d);
 	/*PUT_TOEA_W((code>>6)&7,(code>>9)&7,d);*/
@@ -1780,6 +1712,7 @@ void move_w_from_dn(void)
 void move_w_to_dn(void)
 {
 	register w16 d;
+	CC_FLUSH();
 	d = GetFromEA_w[(code >> 3) & 7]();
 	*((w16 *)((Ptr)reg + RWO + ((code >> 7) & 28))) = d;
 	negative = d < 0;
@@ -1790,6 +1723,7 @@ void move_w_to_dn(void)
 void move_w_reg(void)
 {
 	register w16 d;
+	CC_FLUSH();
 	d = *((w16 *)((Ptr)reg + ((code >> 7) & 28) + RWO)) =
 		*(w16 *)((Ptr)(&reg[code & 7]) + RWO);
 	negative = d < 0;
@@ -1800,6 +1734,7 @@ void move_w_reg(void)
 void move_l(void)
 {
 	register w32 d;
+	CC_FLUSH();
 	d = GetFromEA_l[((code >> 3) & 7)]();
 	ARCALL(PutToEA_l, ((code >> 6) & 7), ((code >> 9) & 7), d);
 	/*PUT_TOEA_L(((code>>6)&7),((code>>9)&7),d);*/
@@ -1811,6 +1746,7 @@ void move_l(void)
 void move_l_from_dn(void)
 {
 	register w32 d;
+	CC_FLUSH();
 	d = reg[code & 7];
 	ARCALL(PutToEA_l, (code >> 6) & 7, (code >> 9) & 7, d);
 	/*PUT_TOEA_L((code>>6)&7,(code>>9)&7,d);*/
@@ -1822,6 +1758,7 @@ void move_l_from_dn(void)
 void move_l_to_dn(void)
 {
 	register w32 d;
+	CC_FLUSH();
 	d = GetFromEA_l[(code >> 3) & 7]();
 	*((w32 *)((Ptr)reg + ((code >> 7) & 28))) = d;
 	negative = d < 0;
@@ -1831,6 +1768,7 @@ void move_l_to_dn(void)
 void move_l_reg(void)
 {
 	register w32 d;
+	CC_FLUSH();
 	d = *((w32 *)((Ptr)reg + ((code >> 7) & 28))) = reg[code & 7];
 	negative = d < 0;
 	zero = d == 0;
@@ -1840,6 +1778,7 @@ void move_l_reg(void)
 void move_to_ccr(void)
 {
 	register w16 x;
+	CC_FLUSH();
 	x = GetFromEA_w[(code >> 3) & 7]();
 	carry = (x & 1) != 0;
 	overflow = (x & 2) != 0;
@@ -1917,21 +1856,83 @@ void movea_l_an(void)
 	*((w32 *)((Ptr)aReg + ((code >> 7) & 28))) = aReg[code & 7];
 }
 
+/*
+ * movem fast path: when the whole transfer is plain RAM (and no memory
+ * tracing or profiling wants to see each access) the registers are
+ * copied to and from memBase directly, visiting only the set mask bits.
+ * Anything else, MMIO included, takes the per register path.
+ */
+#ifdef __GNUC__
+#define MOVEM_COUNT(_m_)	__builtin_popcount(_m_)
+#define MOVEM_FIRST(_m_)	__builtin_ctz(_m_)
+#else
+static int MOVEM_COUNT(unsigned m)
+{
+	int n = 0;
+
+	for (; m; m &= m - 1)
+		n++;
+	return n;
+}
+
+static int MOVEM_FIRST(unsigned m)
+{
+	int i = 0;
+
+	for (; !(m & 1); m >>= 1)
+		i++;
+	return i;
+}
+#endif
+
+static inline Ptr movem_range(w32 ea, uw32 len, int write)
+{
+	// Tracing and profiling see every register moved
+#ifdef PROFILER
+	if (profiler_recording)
+		return NULL;
+#endif
+	if (BTRACE_ANY())
+		return NULL;
+	return MemoryCPURange(ea & ADDR_MASK, len, write);
+}
+
+static inline void movem_stored(w32 ea, uw32 len)
+{
+#ifdef DECODE_CACHE
+	uw32 a;
+
+	for (a = 0; a < len; a += 2)
+		dcache_store((ea + a) & ADDR_MASK);
+#endif
+}
+
 void movem_save_w(void)
 {
 	register uw16 mask;
 	register w32 ea;
 	register short i;
 	w8 eaMode;
+	uw32 len;
+	Ptr p;
 
 	mask = RW_PC(pc++);
 	eaMode = ((w8)code >> 3) & 7;
+	len = MOVEM_COUNT(mask) * 2;
 	if (eaMode == 4) /* predecrement mode */
 	{
 		ea = aReg[eaMode = (code & 7)];
 		if ((ea & 1) != 0)
 			WriteWord(ea, 0); /* bad address */
-		else {
+		else if (len && (p = movem_range(ea - len, len, 1)) != NULL) {
+			p += len;
+			for (; mask; mask &= mask - 1) {
+				p -= 2;
+				WW(p, (w16)reg[15 - MOVEM_FIRST(mask)]);
+			}
+			aReg[eaMode] = ea - len;
+			movem_stored(ea - len, len);
+		} else {
 			for (i = 15; mask != 0; mask >>= 1, i--) {
 				if ((mask & 1) != 0)
 					WriteWord(ea -= 2, (w16)reg[i]);
@@ -1942,7 +1943,13 @@ void movem_save_w(void)
 		ea = ARCALL(GetEA, eaMode, (code & 7));
 		if ((ea & 1) != 0)
 			WriteWord(ea, 0); /* bad address */
-		else {
+		else if (len && (p = movem_range(ea, len, 1)) != NULL) {
+			for (; mask; mask &= mask - 1) {
+				WW(p, (w16)reg[MOVEM_FIRST(mask)]);
+				p += 2;
+			}
+			movem_stored(ea, len);
+		} else {
 			for (i = 0; mask != 0; mask >>= 1, i++) {
 				if ((mask & 1) != 0) {
 					WriteWord(ea, (w16)reg[i]);
@@ -1959,15 +1966,26 @@ void movem_save_l(void)
 	register w32 ea;
 	register short i;
 	w8 eaMode;
+	uw32 len;
+	Ptr p;
 
 	mask = RW_PC(pc++);
 	eaMode = ((w8)code >> 3) & 7;
+	len = MOVEM_COUNT(mask) * 4;
 	if (eaMode == 4) /* predecrement mode */
 	{
 		ea = aReg[eaMode = (code & 7)];
 		if ((ea & 1) != 0)
 			WriteLong(ea, 0); /* bad address */
-		else {
+		else if (len && (p = movem_range(ea - len, len, 1)) != NULL) {
+			p += len;
+			for (; mask; mask &= mask - 1) {
+				p -= 4;
+				WL(p, reg[15 - MOVEM_FIRST(mask)]);
+			}
+			aReg[eaMode] = ea - len;
+			movem_stored(ea - len, len);
+		} else {
 			for (i = 15; mask != 0; mask >>= 1, i--) {
 				if ((mask & 1) != 0)
 					WriteLong(ea -= 4, reg[i]);
@@ -1978,7 +1996,13 @@ void movem_save_l(void)
 		ea = ARCALL(GetEA, eaMode, (code & 7));
 		if ((ea & 1) != 0)
 			WriteLong(ea, 0); /* bad address */
-		else {
+		else if (len && (p = movem_range(ea, len, 1)) != NULL) {
+			for (; mask; mask &= mask - 1) {
+				WL(p, reg[MOVEM_FIRST(mask)]);
+				p += 4;
+			}
+			movem_stored(ea, len);
+		} else {
 			for (i = 0; mask != 0; mask >>= 1, i++) {
 				if ((mask & 1) != 0) {
 					WriteLong(ea, reg[i]);
@@ -1995,14 +2019,24 @@ void movem_load_w(void)
 	register w32 ea;
 	register short i;
 	w8 eaMode, eaReg;
+	uw32 len;
+	Ptr p;
 
 	mask = RW_PC(pc++);
 	eaMode = ((w8)code >> 3) & 7;
 	eaReg = code & 7;
 	ea = (eaMode == 3) ? aReg[eaReg] : ARCALL(GetEA, eaMode, (eaReg));
+	len = MOVEM_COUNT(mask) * 2;
 	if ((ea & 1) != 0)
 		ReadWord(ea); /* bad address */
-	else {
+	else if (len && (p = movem_range(ea, len, 0)) != NULL) {
+		for (; mask; mask &= mask - 1) {
+			reg[MOVEM_FIRST(mask)] = LongFromWord((w16)RW(p));
+			p += 2;
+		}
+		if (eaMode == 3)
+			aReg[eaReg] = ea + len;
+	} else {
 		for (i = 0; mask != 0; mask >>= 1, i++) {
 			if ((mask & 1) != 0) {
 				reg[i] = LongFromWord(ReadWord(ea));
@@ -2020,14 +2054,24 @@ void movem_load_l(void)
 	register w32 ea;
 	register short i;
 	w8 eaMode, eaReg;
+	uw32 len;
+	Ptr p;
 
 	mask = RW_PC(pc++);
 	eaMode = ((w8)code >> 3) & 7;
 	eaReg = code & 7;
 	ea = (eaMode == 3) ? aReg[eaReg] : ARCALL(GetEA, eaMode, (eaReg));
+	len = MOVEM_COUNT(mask) * 4;
 	if ((ea & 1) != 0)
 		ReadLong(ea); /* bad address */
-	else {
+	else if (len && (p = movem_range(ea, len, 0)) != NULL) {
+		for (; mask; mask &= mask - 1) {
+			reg[MOVEM_FIRST(mask)] = (w32)RL(p);
+			p += 4;
+		}
+		if (eaMode == 3)
+			aReg[eaReg] = ea + len;
+	} else {
 		for (i = 0; mask != 0; mask >>= 1, i++) {
 			if ((mask & 1) != 0) {
 				reg[i] = ReadLong(ea);
@@ -2152,6 +2196,7 @@ void movep_l_rm(void) /* long to memory */
 void moveq(void)
 {
 	register w32 d;
+	CC_FLUSH();
 	d = LongFromByte((w8)code);
 	*((w32 *)((Ptr)reg + ((code >> 7) & 28))) = d;
 	negative = d < 0;
@@ -2162,6 +2207,7 @@ void moveq(void)
 void muls(void)
 {
 	register w32 *d;
+	CC_FLUSH();
 	d = (w32 *)((Ptr)reg + ((code >> 7) & 28));
 	*d = *((w16 *)((Ptr)d + RWO)) * (w32)GetFromEA_w[(code >> 3) & 7]();
 	zero = *d == 0;
@@ -2172,6 +2218,7 @@ void muls(void)
 void mulu(void)
 {
 	register uw32 *d;
+	CC_FLUSH();
 	d = (uw32 *)((Ptr)reg + ((code >> 7) & 28));
 	*d = *((uw16 *)((Ptr)d + RWO)) *
 	     (uw32)((uw16)GetFromEA_w[(code >> 3) & 7]());
@@ -2185,6 +2232,7 @@ void nbcd(void)
 	w8 d, r;
 	uw16 nbcd_lo, nbcd_hi, nbcd_res;
 	int nbcd_carry;
+	CC_FLUSH();
 
 	d = ModifyAtEA_b((code >> 3) & 7, code & 7);
 	nbcd_lo = -(d & 0xF) - (xflag ? 1 : 0);
@@ -2211,6 +2259,7 @@ void nbcd(void)
 void neg_b(void)
 {
 	w8 r, d;
+	CC_FLUSH();
 	d = ModifyAtEA_b((code >> 3) & 7, code & 7);
 	r = -d;
 	negative = r < 0;
@@ -2223,6 +2272,7 @@ void neg_b(void)
 void neg_w(void)
 {
 	w16 r, d;
+	CC_FLUSH();
 
 	d = ModifyAtEA_w((code >> 3) & 7, code & 7);
 	r = -d;
@@ -2236,6 +2286,7 @@ void neg_w(void)
 void neg_l(void)
 {
 	w32 r, d;
+	CC_FLUSH();
 
 	d = ModifyAtEA_l((code >> 3) & 7, code & 7);
 	r = -d;
@@ -2249,6 +2300,7 @@ void neg_l(void)
 void negx_b(void)
 {
 	w8 r, d;
+	CC_FLUSH();
 	d = ModifyAtEA_b((code >> 3) & 7, code & 7);
 	r = -d;
 	if (xflag)
@@ -2263,6 +2315,7 @@ void negx_b(void)
 void negx_w(void)
 {
 	w16 r, d;
+	CC_FLUSH();
 
 	d = ModifyAtEA_w((code >> 3) & 7, code & 7);
 	r = -d;
@@ -2278,6 +2331,7 @@ void negx_w(void)
 void negx_l(void)
 {
 	w32 r, d;
+	CC_FLUSH();
 
 	d = ModifyAtEA_l((code >> 3) & 7, code & 7);
 	r = -d;
@@ -2297,6 +2351,7 @@ void nop(void)
 void not_b(void)
 {
 	register w8 d;
+	CC_FLUSH();
 	d = ModifyAtEA_b((code >> 3) & 7, code & 7) ^ 0xff;
 	zero = d == 0;
 	negative = d < 0;
@@ -2307,6 +2362,7 @@ void not_b(void)
 void not_w(void)
 {
 	register w16 d;
+	CC_FLUSH();
 
 	d = ModifyAtEA_w((code >> 3) & 7, code & 7) ^ 0xffff;
 	zero = d == 0;
@@ -2318,6 +2374,7 @@ void not_w(void)
 void not_l(void)
 {
 	register w32 d;
+	CC_FLUSH();
 
 	d = ModifyAtEA_l((code >> 3) & 7, code & 7) ^ 0xffffffff;
 	zero = d == 0;
@@ -2329,6 +2386,7 @@ void not_l(void)
 void or_b_dn(void)
 {
 	register w8 *d;
+	CC_FLUSH();
 	d = (w8 *)((Ptr)reg + ((code >> 7) & 28) + RBO);
 	*d = *d | GetFromEA_b[(code >> 3) & 7]();
 	negative = *d < 0;
@@ -2339,6 +2397,7 @@ void or_b_dn(void)
 void or_w_dn(void)
 {
 	register w16 *d;
+	CC_FLUSH();
 	d = (w16 *)((Ptr)reg + ((code >> 7) & 28) + RWO);
 	*d = *d | GetFromEA_w[(code >> 3) & 7]();
 	negative = *d < 0;
@@ -2349,6 +2408,7 @@ void or_w_dn(void)
 void or_l_dn(void)
 {
 	register w32 *d;
+	CC_FLUSH();
 	d = (w32 *)((Ptr)reg + ((code >> 7) & 28));
 	*d = *d | GetFromEA_l[(code >> 3) & 7]();
 	negative = *d < 0;
@@ -2359,6 +2419,7 @@ void or_l_dn(void)
 void or_b_ea(void)
 {
 	register w8 d;
+	CC_FLUSH();
 	d = ModifyAtEA_b((code >> 3) & 7, code & 7);
 	d = d | *((w8 *)((Ptr)reg + ((code >> 7) & 28) + RBO));
 	negative = d < 0;
@@ -2370,6 +2431,7 @@ void or_b_ea(void)
 void or_w_ea(void)
 {
 	register w16 d;
+	CC_FLUSH();
 
 	d = ModifyAtEA_w((code >> 3) & 7, code & 7);
 	d = d | *((w16 *)((Ptr)reg + ((code >> 7) & 28) + RWO));
@@ -2382,6 +2444,7 @@ void or_w_ea(void)
 void or_l_ea(void)
 {
 	register w32 d;
+	CC_FLUSH();
 
 	d = ModifyAtEA_l((code >> 3) & 7, code & 7);
 	d = d | *((w32 *)((Ptr)reg + ((code >> 7) & 28)));
@@ -2394,6 +2457,7 @@ void or_l_ea(void)
 void ori_b(void)
 {
 	register w8 d;
+	CC_FLUSH();
 	d = (w8)RW_PC(pc++);
 	d = d | ModifyAtEA_b((code >> 3) & 7, code & 7);
 	negative = d < 0;
@@ -2405,6 +2469,7 @@ void ori_b(void)
 void ori_w(void)
 {
 	register w16 d;
+	CC_FLUSH();
 
 	d = (w16)RW_PC(pc++);
 	d = d | ModifyAtEA_w((code >> 3) & 7, code & 7);
@@ -2417,6 +2482,7 @@ void ori_w(void)
 void ori_l(void)
 {
 	register w32 d;
+	CC_FLUSH();
 
 	d = RL_PC((w32 *)pc);
 	pc += 2;
@@ -2430,6 +2496,7 @@ void ori_l(void)
 void ori_to_ccr(void)
 {
 	register w16 d;
+	CC_FLUSH();
 	d = (w16)RW_PC(pc++);
 	carry = carry || ((d & 1) != 0);
 	overflow = overflow || ((d & 2) != 0);
@@ -2455,7 +2522,7 @@ void ori_to_sr(void)
 void code1111(void)
 {
 #ifdef IE_XL
-	qlux_table[code]();
+	QLUX_HANDLER(code)();
 #else
 	exception = 11;
 	extraFlag = true;
@@ -2534,6 +2601,225 @@ void rtd(void)
 	(*m68k_sp) += 4 + disp;
 }
 
+/* -----------------------------------------------------------------------
+ * 68020 subset (--cpu 68020)
+ * ----------------------------------------------------------------------- */
+
+/* MULS.L/MULU.L <ea>,Dl or <ea>,Dh:Dl (0x4C00-0x4C3F) */
+void mull(void)
+{
+	uw16 ext;
+	w32 s, *dl, *dh;
+	uint64_t p;
+
+	CC_FLUSH();
+	ext = (uw16)RW_PC(pc++);
+	s = GetFromEA_l[(code >> 3) & 7]();
+	dl = &reg[(ext >> 12) & 7];
+	dh = &reg[ext & 7];
+	if (ext & 0x0800)
+		p = (uint64_t)((int64_t)*dl * s);
+	else
+		p = (uint64_t)(uw32)*dl * (uw32)s;
+	if (ext & 0x0400) {
+		*dh = (w32)(p >> 32);
+		*dl = (w32)p;
+		zero = p == 0;
+		negative = (int64_t)p < 0;
+		overflow = false;
+	} else {
+		*dl = (w32)p;
+		zero = *dl == 0;
+		negative = *dl < 0;
+		if (ext & 0x0800)
+			overflow = (int64_t)p != (int64_t)*dl;
+		else
+			overflow = (p >> 32) != 0;
+	}
+	carry = false;
+}
+
+/* DIVS.L/DIVU.L <ea>,Dq, <ea>,Dr:Dq and DIVSL/DIVUL (0x4C40-0x4C7F) */
+void divl(void)
+{
+	uw16 ext;
+	w32 s, *dq, *dr;
+	uint64_t q, r;
+
+	CC_FLUSH();
+	ext = (uw16)RW_PC(pc++);
+	s = GetFromEA_l[(code >> 3) & 7]();
+	dq = &reg[(ext >> 12) & 7];
+	dr = &reg[ext & 7];
+	if (s == 0) {
+		exception = 5;
+		extraFlag = true;
+		nInst2 = nInst;
+		nInst = 0;
+		return;
+	}
+	carry = false;
+	if (ext & 0x0800) {
+		int64_t n = (ext & 0x0400) ?
+			(int64_t)((uint64_t)(uw32)*dr << 32 | (uw32)*dq) : *dq;
+
+		if (n == INT64_MIN && s == -1) {
+			overflow = true;
+			return;
+		}
+		q = (uint64_t)(n / s);
+		r = (uint64_t)(n % s);
+		if ((int64_t)q != (w32)q) {
+			overflow = true;
+			return;
+		}
+	} else {
+		uint64_t n = (ext & 0x0400) ?
+			(uint64_t)(uw32)*dr << 32 | (uw32)*dq : (uw32)*dq;
+
+		q = n / (uw32)s;
+		r = n % (uw32)s;
+		if (q >> 32) {
+			overflow = true;
+			return;
+		}
+	}
+	*dr = (w32)r;
+	*dq = (w32)q;
+	zero = *dq == 0;
+	negative = *dq < 0;
+	overflow = false;
+}
+
+/* EXTB.L Dn (0x49C0-0x49C7) */
+void extb_l(void)
+{
+	register w32 *dn;
+	CC_FLUSH();
+	dn = &reg[code & 7];
+	*dn = (w32)((w8)(*dn));
+	zero = *dn == 0;
+	negative = *dn < 0;
+	overflow = carry = false;
+}
+
+/* Bcc.L and BRA.L, a 32-bit displacement (0x6xFF) */
+void bcc_32(void)
+{
+	if (ConditionTrue[(code >> 8) & 15]()) {
+		SetPC((Ptr)pc - (Ptr)memBase + (w32)RL_PC((w32 *)pc));
+#ifdef PROFILER
+		Profiler_RecordJump((Ptr)pc - (Ptr)memBase);
+#endif
+	} else
+		pc += 2;
+}
+
+/* BSR.L (0x61FF) */
+void bsr_32(void)
+{
+	w32 displ = (w32)RL_PC((w32 *)pc);
+	w32 oldPC = (Ptr)pc - (Ptr)memBase;
+
+#ifdef PROFILER
+	Profiler_RecordCall(oldPC + displ, 4);
+#endif
+	WriteLong((*m68k_sp) -= 4, oldPC + 4);
+	cc_push_frame(oldPC - 2);
+#ifdef BACKTRACE
+	SetPCB(oldPC + displ, BSR);
+#else
+	SetPC(oldPC + displ);
+#endif
+}
+
+/* BFTST, BFEXTU, BFCHG, BFEXTS, BFCLR, BFFFO, BFSET, BFINS (0xE8C0-0xEFFF).
+ * The field is width bits from offset, wrapping round Dn, or starting in
+ * memory at the EA plus offset / 8, which is signed, and up to 5 bytes. */
+void bitfield(void)
+{
+	uw16 ext;
+	int mode = (code >> 3) & 7;
+	w32 offset;
+	int width, bit, nbytes = 0, i;
+	uw32 field, mask, v, ins, fm;
+	uint64_t w = 0, m64;
+	uw32 addr = 0;
+
+	CC_FLUSH();
+	ext = (uw16)RW_PC(pc++);
+	offset = (ext & 0x0800) ? reg[(ext >> 6) & 7] : (ext >> 6) & 31;
+	width = (ext & 0x0020) ? reg[ext & 7] : ext;
+	width = ((width - 1) & 31) + 1;
+	mask = 0xffffffffu >> (32 - width);
+
+	if (mode == 0) {
+		bit = offset & 31;
+		v = reg[code & 7];
+		if (bit)
+			v = v << bit | v >> (32 - bit);
+		field = v >> (32 - width);
+	} else {
+		addr = ARCALL(GetEA, mode, code & 7);
+		if (exception)
+			return;
+		addr += offset >> 3;
+		bit = offset & 7;
+		nbytes = (bit + width + 7) >> 3;
+		for (i = 0; i < nbytes; i++)
+			w |= (uint64_t)(uw8)ReadByte(addr + i) << (56 - 8 * i);
+		field = (uw32)((w << bit) >> (64 - width));
+	}
+	negative = (field >> (width - 1)) & 1;
+	zero = field == 0;
+	overflow = carry = false;
+
+	switch ((code >> 8) & 7) {
+	case 0:						/* BFTST */
+		return;
+	case 1:						/* BFEXTU */
+		reg[(ext >> 12) & 7] = field;
+		return;
+	case 2:						/* BFCHG */
+		ins = ~field & mask;
+		break;
+	case 3:						/* BFEXTS */
+		reg[(ext >> 12) & 7] = (w32)(field << (32 - width)) >> (32 - width);
+		return;
+	case 4:						/* BFCLR */
+		ins = 0;
+		break;
+	case 5:						/* BFFFO */
+		for (i = 0; i < width && !((field >> (width - 1 - i)) & 1); i++)
+			;
+		reg[(ext >> 12) & 7] = offset + i;
+		return;
+	case 6:						/* BFSET */
+		ins = mask;
+		break;
+	default:					/* BFINS */
+		ins = reg[(ext >> 12) & 7] & mask;
+		negative = (ins >> (width - 1)) & 1;
+		zero = ins == 0;
+		break;
+	}
+
+	if (mode == 0) {
+		fm = mask << (32 - width);
+		v = ins << (32 - width);
+		if (bit) {
+			fm = fm >> bit | fm << (32 - bit);
+			v = v >> bit | v << (32 - bit);
+		}
+		reg[code & 7] = (reg[code & 7] & ~fm) | v;
+	} else {
+		m64 = (uint64_t)mask << (64 - width - bit);
+		w = (w & ~m64) | (uint64_t)ins << (64 - width - bit);
+		for (i = 0; i < nbytes; i++)
+			WriteByte(addr + i, (w8)(w >> (56 - 8 * i)));
+	}
+}
+
 void InvalidCode(void)
 {
 	exception = 4;
@@ -2547,7 +2833,7 @@ void InvalidCode(void)
 void code1010(void)
 {
 #ifdef IE_XL
-	qlux_table[code]();
+	QLUX_HANDLER(code)();
 #else
 	exception = 10;
 	extraFlag = true;
@@ -0,0 +1,345 @@
+/*
+ * instructions_ea.c
+ *
+ * Per addressing mode variants of the commonest handlers (EA_VARIANTS).
+ * move, and add/sub/cmp <ea>,Dn, go through GetFromEA_x[mode]() and
+ * PutToEA_x[mode]() for every operand; here one handler is generated for
+ * each of the register and register indirect modes (Dn, (An), (An)+,
+ * -(An), d16(An)) with the operand access inlined, and installed over
+ * the generic handler.  The other modes, and builds without
+ * EA_VARIANTS, keep the table driven handlers.
+ */
+
+#include <stdbool.h>
+
+#include "QL68000.h"
+#include "memaccess.h"
+#include "mmodes.h"
+
+#ifdef EA_VARIANTS
+
+#ifdef __GNUC__
+#define EA_INLINE	static inline __attribute__((always_inline))
+#else
+#define EA_INLINE	static inline
+#endif
+
+/* Operand access for a constant mode: 0, 2, 3, 4 or 5 */
+
+EA_INLINE w8 ea_get_b(int mode, int r)
+{
+	uw32 a;
+
+	switch (mode) {
+	case 0:
+		return (w8)reg[r];
+	case 2:
+		return ReadByte(aReg[r]);
+	case 3:
+		a = aReg[r]++;
+		if (r == 7)
+			aReg[r]++;
+		return ReadByte(a);
+	case 4:
+		if (r == 7)
+			aReg[r]--;
+		return ReadByte(--aReg[r]);
+	default:
+		return ReadByte(aReg[r] + (w16)RW_PC(pc++));
+	}
+}
+
+EA_INLINE w16 ea_get_w(int mode, int r)
+{
+	uw32 a;
+
+	switch (mode) {
+	case 0:
+		return (w16)reg[r];
+	case 2:
+		return ReadWord(aReg[r]);
+	case 3:
+		a = aReg[r];
+		aReg[r] += 2;
+		return ReadWord(a);
+	case 4:
+		return ReadWord(aReg[r] -= 2);
+	default:
+		return ReadWord(aReg[r] + (w16)RW_PC(pc++));
+	}
+}
+
+EA_INLINE w32 ea_get_l(int mode, int r)
+{
+	uw32 a;
+
+	switch (mode) {
+	case 0:
+		return reg[r];
+	case 2:
+		return ReadLong(aReg[r]);
+	case 3:
+		a = aReg[r];
+		aReg[r] += 4;
+		return ReadLong(a);
+	case 4:
+		return ReadLong(aReg[r] -= 4);
+	default:
+		return ReadLong(aReg[r] + (w16)RW_PC(pc++));
+	}
+}
+
+EA_INLINE void ea_put_b(int mode, int r, w8 d)
+{
+	uw32 a;
+
+	switch (mode) {
+	case 0:
+		*((w8 *)((Ptr)(&(reg[r])) + RBO)) = d;
+		break;
+	case 2:
+		WriteByte(aReg[r], d);
+		break;
+	case 3:
+		a = aReg[r]++;
+		if (r == 7)
+			aReg[r]++;
+		WriteByte(a, d);
+		break;
+	case 4:
+		if (r == 7)
+			aReg[r]--;
+		WriteByte(--aReg[r], d);
+		break;
+	default:
+		WriteByte(aReg[r] + (w16)RW_PC(pc++), d);
+		break;
+	}
+}
+
+EA_INLINE void ea_put_w(int mode, int r, w16 d)
+{
+	uw32 a;
+
+	switch (mode) {
+	case 0:
+		reg[r] = (reg[r] & 0xFFFF0000) | (uw16)d;
+		break;
+	case 2:
+		WriteWord(aReg[r], d);
+		break;
+	case 3:
+		a = aReg[r];
+		aReg[r] += 2;
+		WriteWord(a, d);
+		break;
+	case 4:
+		WriteWord(aReg[r] -= 2, d);
+		break;
+	default:
+		WriteWord(aReg[r] + (w16)RW_PC(pc++), d);
+		break;
+	}
+}
+
+EA_INLINE void ea_put_l(int mode, int r, w32 d)
+{
+	uw32 a;
+
+	switch (mode) {
+	case 0:
+		reg[r] = d;
+		break;
+	case 2:
+		WriteLong(aReg[r], d);
+		break;
+	case 3:
+		a = aReg[r];
+		aReg[r] += 4;
+		WriteLong(a, d);
+		break;
+	case 4:
+		WriteLong(aReg[r] -= 4, d);
+		break;
+	default:
+		WriteLong(aReg[r] + (w16)RW_PC(pc++), d);
+		break;
+	}
+}
+
+/* move.x <src>,<dst>, as move_b/move_w/move_l */
+#define MOVE_VARIANT(_sz_, _type_, _s_, _d_)					\
+static void move_##_sz_##_##_s_##_d_(void)					\
+{										\
+	_type_ d;								\
+	CC_FLUSH();								\
+	d = ea_get_##_sz_(_s_, code & 7);					\
+	ea_put_##_sz_(_d_, (code >> 9) & 7, d);					\
+	negative = d < 0;							\
+	zero = d == 0;								\
+	overflow = carry = false;						\
+}
+
+#define MOVE_DST(_sz_, _type_, _s_)						\
+	MOVE_VARIANT(_sz_, _type_, _s_, 0)					\
+	MOVE_VARIANT(_sz_, _type_, _s_, 2)					\
+	MOVE_VARIANT(_sz_, _type_, _s_, 3)					\
+	MOVE_VARIANT(_sz_, _type_, _s_, 4)					\
+	MOVE_VARIANT(_sz_, _type_, _s_, 5)
+
+#define MOVE_SIZE(_sz_, _type_)							\
+	MOVE_DST(_sz_, _type_, 0)						\
+	MOVE_DST(_sz_, _type_, 2)						\
+	MOVE_DST(_sz_, _type_, 3)						\
+	MOVE_DST(_sz_, _type_, 4)						\
+	MOVE_DST(_sz_, _type_, 5)
+
+MOVE_SIZE(b, w8)
+MOVE_SIZE(w, w16)
+MOVE_SIZE(l, w32)
+
+#define MOVE_ROW(_sz_, _s_)							\
+	{ move_##_sz_##_##_s_##0, NULL, move_##_sz_##_##_s_##2,			\
+	  move_##_sz_##_##_s_##3, move_##_sz_##_##_s_##4, move_##_sz_##_##_s_##5 }
+#define MOVE_TABLE(_sz_)							\
+	{ MOVE_ROW(_sz_, 0), { NULL }, MOVE_ROW(_sz_, 2), MOVE_ROW(_sz_, 3),	\
+	  MOVE_ROW(_sz_, 4), MOVE_ROW(_sz_, 5) }
+
+/* [size][src mode][dst mode] */
+static void (*const move_variants[3][6][6])(void) = {
+	MOVE_TABLE(b), MOVE_TABLE(w), MOVE_TABLE(l)
+};
+
+/* add/sub <ea>,Dn and cmp <ea>,Dn, as add_x_dn/sub_x_dn/cmp_x */
+#define ALU_VARIANT(_op_, _sz_, _type_, _rwo_, _cc_, _s_)			\
+static void _op_##_##_sz_##_dn_##_s_(void)					\
+{										\
+	_type_ r, s;								\
+	_type_ *d;								\
+	s = ea_get_##_sz_(_s_, code & 7);					\
+	d = (_type_ *)((Ptr)reg + ((code >> 7) & 28) + _rwo_);			\
+	r = ALU_##_op_(*d, s);							\
+	negative = r < 0;							\
+	zero = r == 0;								\
+	ALU_STORE_##_op_(_cc_, s, *d, r, d);					\
+}
+
+#define ALU_add(_d_, _s_)	((_d_) + (_s_))
+#define ALU_sub(_d_, _s_)	((_d_) - (_s_))
+#define ALU_cmp(_d_, _s_)	((_d_) - (_s_))
+#define ALU_STORE_add(_cc_, _s_, _dv_, _r_, _d_) \
+	do { CC_LAZY(CC_ADD_##_cc_, _s_, _dv_, _r_); *(_d_) = (_r_); } while (0)
+#define ALU_STORE_sub(_cc_, _s_, _dv_, _r_, _d_) \
+	do { CC_LAZY(CC_SUB_##_cc_, _s_, _dv_, _r_); *(_d_) = (_r_); } while (0)
+#define ALU_STORE_cmp(_cc_, _s_, _dv_, _r_, _d_) \
+	CC_LAZY_CMP(CC_CMP_##_cc_, _s_, _dv_, _r_)
+
+#define ALU_MODES(_op_, _sz_, _type_, _rwo_, _cc_)				\
+	ALU_VARIANT(_op_, _sz_, _type_, _rwo_, _cc_, 2)				\
+	ALU_VARIANT(_op_, _sz_, _type_, _rwo_, _cc_, 3)				\
+	ALU_VARIANT(_op_, _sz_, _type_, _rwo_, _cc_, 4)				\
+	ALU_VARIANT(_op_, _sz_, _type_, _rwo_, _cc_, 5)
+
+#define ALU_SIZES(_op_)								\
+	ALU_MODES(_op_, b, w8, RBO, B)						\
+	ALU_MODES(_op_, w, w16, RWO, W)						\
+	ALU_MODES(_op_, l, w32, 0, L)
+
+ALU_SIZES(add)
+ALU_SIZES(sub)
+ALU_SIZES(cmp)
+
+#define ALU_ROW(_op_, _sz_)							\
+	{ _op_##_##_sz_##_dn_2, _op_##_##_sz_##_dn_3,				\
+	  _op_##_##_sz_##_dn_4, _op_##_##_sz_##_dn_5 }
+
+/* [op][size][src mode - 2] */
+static void (*const alu_variants[3][3][4])(void) = {
+	{ ALU_ROW(add, b), ALU_ROW(add, w), ALU_ROW(add, l) },
+	{ ALU_ROW(sub, b), ALU_ROW(sub, w), ALU_ROW(sub, l) },
+	{ ALU_ROW(cmp, b), ALU_ROW(cmp, w), ALU_ROW(cmp, l) },
+};
+
+void move_b(void);
+void move_w(void);
+void move_l(void);
+void move_b_from_dn(void);
+void move_w_from_dn(void);
+void move_l_from_dn(void);
+void move_b_to_dn(void);
+void move_w_to_dn(void);
+void move_l_to_dn(void);
+void add_b_dn(void);
+void add_w_dn(void);
+void add_l_dn(void);
+void sub_b_dn(void);
+void sub_w_dn(void);
+void sub_l_dn(void);
+void cmp_b(void);
+void cmp_w(void);
+void cmp_l(void);
+
+/* The generic handler an opcode must still have for a variant to replace it */
+static bool is_generic(void (*h)(void), void (*const *set)(void), int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (h == set[i])
+			return true;
+	}
+	return false;
+}
+
+void SetEAVariants(void (**itable)(void))
+{
+	static void (*const moves[3][3])(void) = {
+		{ move_b, move_b_from_dn, move_b_to_dn },
+		{ move_w, move_w_from_dn, move_w_to_dn },
+		{ move_l, move_l_from_dn, move_l_to_dn },
+	};
+	static void (*const alus[3][3])(void) = {
+		{ add_b_dn, add_w_dn, add_l_dn },
+		{ sub_b_dn, sub_w_dn, sub_l_dn },
+		{ cmp_b, cmp_w, cmp_l },
+	};
+	static const uw16 move_line[3] = { 0x1000, 0x3000, 0x2000 };
+	static const uw16 alu_line[3] = { 0xd000, 0x9000, 0xb000 };
+	int sz, s, d, op, rs, rd;
+
+	for (sz = 0; sz < 3; sz++) {
+		for (s = 0; s < 6; s++) {
+			for (d = 0; d < 6; d++) {
+				void (*h)(void) = move_variants[sz][s][d];
+
+				if (!h)
+					continue;
+				for (rs = 0; rs < 8; rs++) {
+					for (rd = 0; rd < 8; rd++) {
+						uw16 c = move_line[sz] | rd << 9 | d << 6 | s << 3 | rs;
+
+						if (is_generic(itable[c], moves[sz], 3))
+							itable[c] = h;
+					}
+				}
+			}
+		}
+	}
+
+	for (op = 0; op < 3; op++) {
+		for (sz = 0; sz < 3; sz++) {
+			for (s = 2; s < 6; s++) {
+				for (rs = 0; rs < 8; rs++) {
+					for (rd = 0; rd < 8; rd++) {
+						uw16 c = alu_line[op] | rd << 9 | sz << 6 | s << 3 | rs;
+
+						if (itable[c] == alus[op][sz])
+							itable[c] = alu_variants[op][sz][s - 2];
+					}
+				}
+			}
+		}
+	}
+}
+
+#endif /* EA_VARIANTS */
@@ -37,6 +37,7 @@ void reset(void)
 void rol_m(void)
 {
 	register uw16 d;
+	CC_FLUSH();
 	;
 	d = (uw16)ModifyAtEA_w((code >> 3) & 7, code & 7);
 	carry = (d & 0x8000) != 0;
@@ -52,6 +53,7 @@ void rol_m(void)
 void ror_m(void)
 {
 	register uw16 d;
+	CC_FLUSH();
 	;
 	d = (uw16)ModifyAtEA_w((code >> 3) & 7, code & 7);
 	carry = negative = (d & 1) != 0;
@@ -66,6 +68,7 @@ void ror_m(void)
 void roxl_m(void)
 {
 	register uw16 d;
+	CC_FLUSH();
 	;
 	d = (uw16)ModifyAtEA_w((code >> 3) & 7, code & 7);
 	carry = (d & 0x8000) != 0;
@@ -82,6 +85,7 @@ void roxl_m(void)
 void roxr_m(void)
 {
 	register uw16 d;
+	CC_FLUSH();
 	;
 	d = (uw16)ModifyAtEA_w((code >> 3) & 7, code & 7);
 	carry = (d & 1) != 0;
@@ -134,6 +138,7 @@ void rte(void)
 void rtr(void)
 {
 	register w16 cc;
+	CC_FLUSH();
 	cc = ReadWord((*m68k_sp));
 #ifdef BACKTRACE
 	SetPCB(ReadLong((*m68k_sp) + 2), RTR);
@@ -201,6 +206,7 @@ void sbcd(void)
 	w8 *dx;
 	uw16 sbcd_lo, sbcd_hi, sbcd_res;
 	int bcd = 0;
+	CC_FLUSH();
 
 	if ((code & 8) != 0) {
 		s = GetFromEA_b_m4();
@@ -296,10 +302,7 @@ void sub_b_dn(void)
 	r = *d - s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = (((*d & 0x80) == 0) && (((s | r) & 0x80) != 0)) ||
-			((s & r & 0x80) != 0);
-	overflow = ((0x80 & (s ^ 0x80) & *d & (r ^ 0x80)) != 0) ||
-		   ((0x80 & r & (*d ^ 0x80) & s) != 0);
+	CC_LAZY(CC_SUB_B, s, *d, r);
 	*d = r;
 }
 
@@ -312,11 +315,7 @@ void sub_w_dn(void)
 	r = *d - s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = (((*d & 0x8000) == 0) && (((s | r) & 0x8000) != 0)) ||
-			((s & r & 0x8000) != 0);
-
-	overflow = ((0x8000 & (s ^ 0x8000) & *d & (r ^ 0x8000)) != 0) ||
-		   ((0x8000 & r & (*d ^ 0x8000) & s) != 0);
+	CC_LAZY(CC_SUB_W, s, *d, r);
 	*d = r;
 }
 
@@ -329,13 +328,7 @@ void sub_l_dn(void)
 	r = *d - s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry =
-		(((*d & 0x80000000) == 0) && (((s | r) & 0x80000000) != 0)) ||
-		((s & r & 0x80000000) != 0);
-
-	overflow = ((0x80000000 & (s ^ 0x80000000) & *d & (r ^ 0x80000000)) !=
-		    0) ||
-		   ((0x80000000 & r & (*d ^ 0x80000000) & s) != 0);
+	CC_LAZY(CC_SUB_L, s, *d, r);
 	*d = r;
 }
 
@@ -348,10 +341,7 @@ void sub_b_ea(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = (((d & 0x80) == 0) && (((s | r) & 0x80) != 0)) ||
-			((s & r & 0x80) != 0);
-	overflow = ((0x80 & (s ^ 0x80) & d & (r ^ 0x80)) != 0) ||
-		   ((0x80 & r & (d ^ 0x80) & s) != 0);
+	CC_LAZY(CC_SUB_B, s, d, r);
 	RewriteEA_b(r);
 }
 
@@ -365,11 +355,7 @@ void sub_w_ea(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = (((d & 0x8000) == 0) && (((s | r) & 0x8000) != 0)) ||
-			((s & r & 0x8000) != 0);
-
-	overflow = ((0x8000 & (s ^ 0x8000) & d & (r ^ 0x8000)) != 0) ||
-		   ((0x8000 & r & (d ^ 0x8000) & s) != 0);
+	CC_LAZY(CC_SUB_W, s, d, r);
 	RewriteEA_w(r);
 }
 
@@ -383,13 +369,7 @@ void sub_l_ea(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry =
-		(((d & 0x80000000) == 0) && (((s | r) & 0x80000000) != 0)) ||
-		((s & r & 0x80000000) != 0);
-
-	overflow =
-		((0x80000000 & (s ^ 0x80000000) & d & (r ^ 0x80000000)) != 0) ||
-		((0x80000000 & r & (d ^ 0x80000000) & s) != 0);
+	CC_LAZY(CC_SUB_L, s, d, r);
 	RewriteEA_l(r);
 }
 
@@ -416,10 +396,7 @@ void subi_b(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = (((d & 0x80) == 0) && (((s | r) & 0x80) != 0)) ||
-			((s & r & 0x80) != 0);
-	overflow = ((0x80 & (s ^ 0x80) & d & (r ^ 0x80)) != 0) ||
-		   ((0x80 & r & (d ^ 0x80) & s) != 0);
+	CC_LAZY(CC_SUB_B, s, d, r);
 	RewriteEA_b(r);
 }
 
@@ -433,11 +410,7 @@ void subi_w(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = (((d & 0x8000) == 0) && (((s | r) & 0x8000) != 0)) ||
-			((s & r & 0x8000) != 0);
-
-	overflow = ((0x8000 & (s ^ 0x8000) & d & (r ^ 0x8000)) != 0) ||
-		   ((0x8000 & r & (d ^ 0x8000) & s) != 0);
+	CC_LAZY(CC_SUB_W, s, d, r);
 	RewriteEA_w(r);
 }
 
@@ -452,13 +425,7 @@ void subi_l(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry =
-		(((d & 0x80000000) == 0) && (((s | r) & 0x80000000) != 0)) ||
-		((s & r & 0x80000000) != 0);
-
-	overflow =
-		((0x80000000 & (s ^ 0x80000000) & d & (r ^ 0x80000000)) != 0) ||
-		((0x80000000 & r & (d ^ 0x80000000) & s) != 0);
+	CC_LAZY(CC_SUB_L, s, d, r);
 	RewriteEA_l(r);
 }
 
@@ -473,8 +440,7 @@ void subq_b(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = ((d & 0x80) == 0) && ((r & 0x80) != 0);
-	overflow = (0x80 & d & (r ^ 0x80)) != 0;
+	CC_LAZY(CC_SUB_B, s, d, r);
 	RewriteEA_b(r);
 }
 
@@ -490,8 +456,7 @@ void subq_w(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = ((d & 0x8000) == 0) && ((r & 0x8000) != 0);
-	overflow = (0x8000 & d & (r ^ 0x8000)) != 0;
+	CC_LAZY(CC_SUB_W, s, d, r);
 	RewriteEA_w(r);
 }
 
@@ -507,8 +472,7 @@ void subq_l(void)
 	r = d - s;
 	negative = r < 0;
 	zero = r == 0;
-	xflag = carry = ((d & 0x80000000) == 0) && ((r & 0x80000000) != 0);
-	overflow = (0x80000000 & d & (r ^ 0x80000000)) != 0;
+	CC_LAZY(CC_SUB_L, s, d, r);
 	RewriteEA_l(r);
 }
 
@@ -530,6 +494,7 @@ void subx_b_r(void)
 {
 	w8 s, r;
 	w8 *d;
+	CC_FLUSH();
 	d = (w8 *)((Ptr)reg + ((code >> 7) & 28) + RBO);
 	s = (w8)reg[code & 7];
 	r = *d - s;
@@ -548,6 +513,7 @@ void subx_w_r(void)
 {
 	w16 s, r;
 	w16 *d;
+	CC_FLUSH();
 	d = (w16 *)((Ptr)reg + ((code >> 7) & 28) + RWO);
 	s = (w16)reg[code & 7];
 	r = *d - s;
@@ -567,6 +533,7 @@ void subx_l_r(void)
 {
 	w32 s, r;
 	w32 *d;
+	CC_FLUSH();
 	d = (w32 *)((Ptr)reg + ((code >> 7) & 28));
 	s = reg[code & 7];
 	r = *d - s;
@@ -587,6 +554,7 @@ void subx_l_r(void)
 void subx_b_m(void)
 {
 	w8 s, d, r;
+	CC_FLUSH();
 	s = GetFromEA_b_m4();
 	d = ModifyAtEA_b(4, (code >> 9) & 7);
 	r = d - s;
@@ -604,6 +572,7 @@ void subx_b_m(void)
 void subx_w_m(void)
 {
 	w16 s, d, r;
+	CC_FLUSH();
 	;
 	s = GetFromEA_w_m4();
 	d = ModifyAtEA_w(4, (code >> 9) & 7);
@@ -623,6 +592,7 @@ void subx_w_m(void)
 void subx_l_m(void)
 {
 	w32 s, d, r;
+	CC_FLUSH();
 	;
 	s = GetFromEA_l_m4();
 	d = ModifyAtEA_l(4, (code >> 9) & 7);
@@ -645,6 +615,7 @@ void swap(void)
 {
 	register w32 d;
 	register w32 *r;
+	CC_FLUSH();
 	r = &(reg[code & 7]);
 	d = *r << 16;
 	d += (*r >> 16) & 0x0ffff;
@@ -657,6 +628,7 @@ void swap(void)
 void tas(void)
 {
 	register w8 d;
+	CC_FLUSH();
 	d = ModifyAtEA_b((code >> 3) & 7, code & 7);
 	RewriteEA_b(d | 0x80);
 	negative = d < 0;
@@ -667,7 +639,7 @@ void tas(void)
 void trap(void)
 {
 #ifdef IE_XL
-	qlux_table[code]();
+	QLUX_HANDLER(code)();
 #else
 	exception = 32 + (code & 15);
 	extraFlag = true;
@@ -678,6 +650,7 @@ void trap(void)
 
 void trapv(void)
 {
+	CC_FLUSH();
 	if (overflow) {
 		exception = 7;
 		extraFlag = true;
@@ -689,6 +662,7 @@ void trapv(void)
 void tst_b(void)
 {
 	register w8 d;
+	CC_FLUSH();
 	d = GetFromEA_b[(code >> 3) & 7]();
 	negative = d < 0;
 	zero = d == 0;
@@ -698,6 +672,7 @@ void tst_b(void)
 void tst_w(void)
 {
 	register w16 d;
+	CC_FLUSH();
 	d = GetFromEA_w[(code >> 3) & 7]();
 	negative = d < 0;
 	zero = d == 0;
@@ -707,6 +682,7 @@ void tst_w(void)
 void tst_l(void)
 {
 	register w32 d;
+	CC_FLUSH();
 	d = GetFromEA_l[(code >> 3) & 7]();
 	negative = d < 0;
 	zero = d == 0;
@@ -728,6 +704,7 @@ void asr_b_i(void)
 {
 	register w8 *d;
 	register short c;
+	CC_FLUSH();
 	d = ((w8 *)(&(reg[code & 7]))) + RBO;
 	negative = *d < 0;
 	if ((c = (code >> 9) & 7) != 0) {
@@ -746,6 +723,7 @@ void asl_b_i(void)
 	w8 *d;
 	short c;
 	uw8 mask;
+	CC_FLUSH();
 	d = ((w8 *)(&(reg[code & 7]))) + RBO;
 	if ((c = (code >> 9) & 7) != 0) {
 		carry = xflag = (*d & ((uw8)128 >> (c - 1))) != 0;
@@ -771,6 +749,7 @@ void asr_w_i(void)
 {
 	register w16 *d;
 	register short c;
+	CC_FLUSH();
 	d = (w16 *)(((w8 *)(&(reg[code & 7]))) + RWO);
 	negative = *d < 0;
 	if ((c = (code >> 9) & 7) == 0)
@@ -786,6 +765,7 @@ void asl_w_i(void)
 	w16 *d;
 	short c;
 	uw16 mask;
+	CC_FLUSH();
 	d = (w16 *)(((w8 *)(&(reg[code & 7]))) + RWO);
 	if ((c = (code >> 9) & 7) == 0)
 		c = 8;
@@ -805,6 +785,7 @@ void asr_l_i(void)
 {
 	register w32 *d;
 	register short c;
+	CC_FLUSH();
 	d = &(reg[code & 7]);
 	negative = *d < 0;
 	if ((c = (code >> 9) & 7) == 0)
@@ -820,6 +801,7 @@ void asl_l_i(void)
 	w32 *d;
 	short c;
 	uw32 mask;
+	CC_FLUSH();
 	d = &(reg[code & 7]);
 	if ((c = (code >> 9) & 7) == 0)
 		c = 8;
@@ -839,6 +821,7 @@ void asr_b_r(void)
 {
 	register w8 *d;
 	register uw8 c;
+	CC_FLUSH();
 	d = (w8 *)((Ptr)reg + ((code & 7) << 2) + RBO);
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	negative = *d < 0;
@@ -866,6 +849,7 @@ void asl_b_r(void)
 	w8 *d;
 	uw8 c;
 	uw8 mask;
+	CC_FLUSH();
 	d = (w8 *)((Ptr)reg + ((code & 7) << 2) + RBO);
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	negative = *d < 0;
@@ -900,6 +884,7 @@ void asr_w_r(void)
 {
 	register w16 *d;
 	register uw8 c;
+	CC_FLUSH();
 	d = (w16 *)((Ptr)reg + ((code & 7) << 2) + RWO);
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	negative = *d < 0;
@@ -927,6 +912,7 @@ void asl_w_r(void)
 	w16 *d;
 	uw8 c;
 	uw16 mask;
+	CC_FLUSH();
 	d = (w16 *)((Ptr)reg + ((code & 7) << 2) + RWO);
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	negative = *d < 0;
@@ -961,6 +947,7 @@ void asr_l_r(void)
 {
 	register w32 *d;
 	register uw8 c;
+	CC_FLUSH();
 	d = &(reg[code & 7]);
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	negative = *d < 0;
@@ -988,6 +975,7 @@ void asl_l_r(void)
 	w32 *d;
 	uw8 c;
 	uw32 mask;
+	CC_FLUSH();
 	d = &(reg[code & 7]);
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	negative = *d < 0;
@@ -1023,6 +1011,7 @@ void lsr_b_i(void)
 {
 	register uw8 *d;
 	register short c;
+	CC_FLUSH();
 	d = ((uw8 *)(&(reg[code & 7]))) + RBO;
 	if ((c = (code >> 9) & 7) != 0) {
 		carry = xflag = (*d & ((uw8)1 << (c - 1))) != 0;
@@ -1039,6 +1028,7 @@ void lsr_b_i(void)
 void lsr1_b(void)
 {
 	register uw8 *d;
+	CC_FLUSH();
 	d = ((uw8 *)(&(reg[code & 7]))) + RBO;
 	carry = xflag = (*d & ((uw8)1)) != 0;
 	(*d) >>= 1;
@@ -1050,6 +1040,7 @@ void lsl_b_i(void)
 {
 	register uw8 *d;
 	register short c;
+	CC_FLUSH();
 	d = ((uw8 *)(&(reg[code & 7]))) + RBO;
 	if ((c = (code >> 9) & 7) != 0) {
 		carry = xflag = (*d & ((uw8)128 >> (c - 1))) != 0;
@@ -1068,6 +1059,7 @@ void lsl_b_i(void)
 void lsl1_b(void)
 {
 	register uw8 *d;
+	CC_FLUSH();
 	d = ((uw8 *)(&(reg[code & 7]))) + RBO;
 	carry = xflag = (*d & ((uw8)0x80)) != 0;
 	(*d) <<= 1;
@@ -1080,6 +1072,7 @@ void lsr_w_i(void)
 {
 	register uw16 *d;
 	register short c;
+	CC_FLUSH();
 	d = (uw16 *)((Ptr)reg + ((code & 7) << 2) + RWO);
 	if ((c = (code >> 9) & 7) == 0)
 		c = 8;
@@ -1092,6 +1085,7 @@ void lsr_w_i(void)
 void lsr1_w(void)
 {
 	register uw16 *d;
+	CC_FLUSH();
 	d = (uw16 *)((Ptr)reg + ((code & 7) << 2) + RWO);
 	carry = xflag = (*d & ((uw16)1)) != 0;
 	(*d) >>= 1;
@@ -1103,6 +1097,7 @@ void lsl_w_i(void)
 {
 	register uw16 *d;
 	register short c;
+	CC_FLUSH();
 	d = (uw16 *)((Ptr)reg + ((code & 7) << 2) + RWO);
 	if ((c = (code >> 9) & 7) == 0)
 		c = 8;
@@ -1116,6 +1111,7 @@ void lsl_w_i(void)
 void lsl1_w(void)
 {
 	register uw16 *d;
+	CC_FLUSH();
 	d = (uw16 *)((Ptr)reg + ((code & 7) << 2) + RWO);
 	carry = xflag = (*d & ((uw16)0x8000)) != 0;
 	(*d) <<= 1;
@@ -1128,6 +1124,7 @@ void lsr_l_i(void)
 {
 	register uw32 *d;
 	register short c;
+	CC_FLUSH();
 	d = (uw32 *)(&(reg[code & 7]));
 	if ((c = (code >> 9) & 7) == 0)
 		c = 8;
@@ -1140,6 +1137,7 @@ void lsr_l_i(void)
 void lsr1_l(void)
 {
 	register uw32 *d;
+	CC_FLUSH();
 	d = (uw32 *)(&(reg[code & 7]));
 	carry = xflag = (*d & ((uw32)1)) != 0;
 	(*d) >>= 1;
@@ -1151,6 +1149,7 @@ void lsl_l_i(void)
 {
 	register uw32 *d;
 	register short c;
+	CC_FLUSH();
 	d = (uw32 *)(&(reg[code & 7]));
 	if ((c = (code >> 9) & 7) == 0)
 		c = 8;
@@ -1164,6 +1163,7 @@ void lsl_l_i(void)
 void lsl1_l(void)
 {
 	register uw32 *d;
+	CC_FLUSH();
 	d = (uw32 *)(&(reg[code & 7]));
 	carry = xflag = ((*d) & ((uw32)0x80000000)) != 0;
 	(*d) <<= 1;
@@ -1175,6 +1175,7 @@ void lsl1_l(void)
 void lsl2_l(void)
 {
 	register uw32 *d;
+	CC_FLUSH();
 	d = (uw32 *)(&(reg[code & 7]));
 	carry = xflag = ((*d) & 0x40000000l) != 0;
 	(*d) <<= 2;
@@ -1187,6 +1188,7 @@ void lsr_b_r(void)
 {
 	register uw8 *d;
 	register uw8 c;
+	CC_FLUSH();
 	d = (uw8 *)((Ptr)reg + ((code & 7) << 2) + RBO);
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	if (c == 0) {
@@ -1214,6 +1216,7 @@ void lsl_b_r(void)
 {
 	register uw8 *d;
 	register uw8 c;
+	CC_FLUSH();
 	d = (uw8 *)((Ptr)reg + ((code & 7) << 2) + RBO);
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	if (c == 0) {
@@ -1242,6 +1245,7 @@ void lsr_w_r(void)
 {
 	register uw16 *d;
 	register uw8 c;
+	CC_FLUSH();
 	d = (uw16 *)((Ptr)reg + ((code & 7) << 2) + RWO);
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	if (c == 0) {
@@ -1269,6 +1273,7 @@ void lsl_w_r(void)
 {
 	register uw16 *d;
 	register uw8 c;
+	CC_FLUSH();
 	d = (uw16 *)((Ptr)reg + ((code & 7) << 2) + RWO);
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	if (c == 0) {
@@ -1297,6 +1302,7 @@ void lsr_l_r(void)
 {
 	register uw32 *d;
 	register uw8 c;
+	CC_FLUSH();
 	d = (uw32 *)(&(reg[code & 7]));
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	if (c == 0) {
@@ -1324,6 +1330,7 @@ void lsl_l_r(void)
 {
 	register uw32 *d;
 	register uw8 c;
+	CC_FLUSH();
 	d = (uw32 *)(&(reg[code & 7]));
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	if (c == 0) {
@@ -1353,6 +1360,7 @@ void ror_b_i(void)
 {
 	register uw8 *d;
 	register short c;
+	CC_FLUSH();
 	d = ((uw8 *)(&(reg[code & 7]))) + RBO;
 	if ((c = (code >> 9) & 7) != 0)
 		(*d) = ((*d) >> c) | ((*d) << (8 - c));
@@ -1365,6 +1373,7 @@ void rol_b_i(void)
 {
 	register uw8 *d;
 	register short c;
+	CC_FLUSH();
 	d = ((uw8 *)(&(reg[code & 7]))) + RBO;
 	if ((c = (code >> 9) & 7) != 0)
 		(*d) = ((*d) << c) | ((*d) >> (8 - c));
@@ -1378,6 +1387,7 @@ void ror_w_i(void)
 {
 	register uw16 *d;
 	register short c;
+	CC_FLUSH();
 	d = (uw16 *)(((uw8 *)(&(reg[code & 7]))) + RWO);
 	if ((c = (code >> 9) & 7) == 0)
 		c = 8;
@@ -1391,6 +1401,7 @@ void rol_w_i(void)
 {
 	register uw16 *d;
 	register short c;
+	CC_FLUSH();
 	d = (uw16 *)(((uw8 *)(&(reg[code & 7]))) + RWO);
 	if ((c = (code >> 9) & 7) == 0)
 		c = 8;
@@ -1405,6 +1416,7 @@ void ror_l_i(void)
 {
 	register uw32 *d;
 	register short c;
+	CC_FLUSH();
 	d = (uw32 *)(&(reg[code & 7]));
 	if ((c = (code >> 9) & 7) == 0)
 		c = 8;
@@ -1418,6 +1430,7 @@ void rol_l_i(void)
 {
 	register uw32 *d;
 	register short c;
+	CC_FLUSH();
 	d = (uw32 *)(&(reg[code & 7]));
 	if ((c = (code >> 9) & 7) == 0)
 		c = 8;
@@ -1432,6 +1445,7 @@ void ror_b_r(void)
 {
 	register uw8 *d;
 	register uw8 c;
+	CC_FLUSH();
 	d = (uw8 *)((Ptr)reg + ((code & 7) << 2) + RBO);
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	if (c == 0)
@@ -1451,6 +1465,7 @@ void rol_b_r(void)
 {
 	register uw8 *d;
 	register uw8 c;
+	CC_FLUSH();
 	d = (uw8 *)((Ptr)reg + ((code & 7) << 2) + RBO);
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	if (c == 0)
@@ -1470,6 +1485,7 @@ void ror_w_r(void)
 {
 	register uw16 *d;
 	register uw8 c;
+	CC_FLUSH();
 	d = (uw16 *)((Ptr)reg + ((code & 7) << 2) + RWO);
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	if (c == 0)
@@ -1489,6 +1505,7 @@ void rol_w_r(void)
 {
 	register uw16 *d;
 	register uw8 c;
+	CC_FLUSH();
 	d = (uw16 *)((Ptr)reg + ((code & 7) << 2) + RWO);
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	if (c == 0)
@@ -1508,6 +1525,7 @@ void ror_l_r(void)
 {
 	register uw32 *d;
 	register uw8 c;
+	CC_FLUSH();
 	d = (uw32 *)(&(reg[code & 7]));
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	if (c == 0)
@@ -1527,6 +1545,7 @@ void rol_l_r(void)
 {
 	register uw32 *d;
 	register uw8 c;
+	CC_FLUSH();
 	d = (uw32 *)(&(reg[code & 7]));
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	if (c == 0)
@@ -1547,6 +1566,7 @@ void roxr_b_i(void)
 	uw8 *d;
 	uw8 temp;
 	short c;
+	CC_FLUSH();
 	d = ((uw8 *)(&(reg[code & 7]))) + RBO;
 	if ((c = (code >> 9) & 7) != 0) {
 		carry = ((*d) & ((uw8)1 << (c - 1))) != 0;
@@ -1571,6 +1591,7 @@ void roxl_b_i(void)
 	uw8 *d;
 	uw8 temp;
 	short c;
+	CC_FLUSH();
 	d = ((uw8 *)(&(reg[code & 7]))) + RBO;
 	if ((c = (code >> 9) & 7) != 0) {
 		carry = ((*d) & ((uw8)128 >> (c - 1))) != 0;
@@ -1595,6 +1616,7 @@ void roxr_w_i(void)
 	uw16 *d;
 	uw16 temp;
 	short c;
+	CC_FLUSH();
 	d = (uw16 *)(((uw8 *)(&(reg[code & 7]))) + RWO);
 	if ((c = (code >> 9) & 7) == 0)
 		c = 8;
@@ -1614,6 +1636,7 @@ void roxl_w_i(void)
 	uw16 *d;
 	uw16 temp;
 	short c;
+	CC_FLUSH();
 	d = (uw16 *)(((uw8 *)(&(reg[code & 7]))) + RWO);
 	if ((c = (code >> 9) & 7) == 0)
 		c = 8;
@@ -1633,6 +1656,7 @@ void roxr_l_i(void)
 	uw32 *d;
 	uw32 temp;
 	short c;
+	CC_FLUSH();
 	d = (uw32 *)(&(reg[code & 7]));
 	if ((c = (code >> 9) & 7) == 0)
 		c = 8;
@@ -1652,6 +1676,7 @@ void roxl_l_i(void)
 	uw32 *d;
 	uw32 temp;
 	short c;
+	CC_FLUSH();
 	d = (uw32 *)(&(reg[code & 7]));
 	if ((c = (code >> 9) & 7) == 0)
 		c = 8;
@@ -1671,6 +1696,7 @@ void roxr_b_r(void)
 	uw8 *d;
 	uw8 temp;
 	short c;
+	CC_FLUSH();
 	d = ((uw8 *)(&(reg[code & 7]))) + RBO;
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	if (c == 0)
@@ -1696,6 +1722,7 @@ void roxl_b_r(void)
 	uw8 *d;
 	uw8 temp;
 	short c;
+	CC_FLUSH();
 	d = ((uw8 *)(&(reg[code & 7]))) + RBO;
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	if (c == 0)
@@ -1721,6 +1748,7 @@ void roxr_w_r(void)
 	uw16 *d;
 	uw16 temp;
 	short c;
+	CC_FLUSH();
 	d = (uw16 *)(((uw8 *)(&(reg[code & 7]))) + RWO);
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	if (c == 0)
@@ -1746,6 +1774,7 @@ void roxl_w_r(void)
 	uw16 *d;
 	uw16 temp;
 	short c;
+	CC_FLUSH();
 	d = (uw16 *)(((uw8 *)(&(reg[code & 7]))) + RWO);
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	if (c == 0)
@@ -1771,6 +1800,7 @@ void roxr_l_r(void)
 	uw32 *d;
 	uw32 temp;
 	short c;
+	CC_FLUSH();
 	d = (uw32 *)(&(reg[code & 7]));
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	if (c == 0)
@@ -1796,6 +1826,7 @@ void roxl_l_r(void)
 	uw32 *d;
 	uw32 temp;
 	short c;
+	CC_FLUSH();
 	d = (uw32 *)(&(reg[code & 7]));
 	c = *((uw8 *)((Ptr)reg + ((code >> 7) & 28) + RBO)) & 63;
 	if (c == 0)
@@ -0,0 +1,115 @@
+/*
+ * io_worker.c
+ *
+ * A single worker thread fed by a bounded FIFO, so jobs for one file run
+ * in the order they were queued.  Started on first use.
+ */
+
+#include <SDL.h>
+#include <stdio.h>
+
+#include "io_worker.h"
+#include "thread_policy.h"
+
+#define IO_QUEUE_LEN	256
+
+typedef struct {
+	io_job_fn fn;
+	void *arg;
+} io_job;
+
+static io_job queue[IO_QUEUE_LEN];
+static int q_head, q_count;
+static bool busy;
+static SDL_mutex *lock;
+static SDL_cond *cond_work, *cond_space, *cond_idle;
+static SDL_Thread *worker;
+static SDL_threadID worker_id;
+static SDL_SpinLock init_lock;
+static bool init_failed;
+
+static int io_worker_thread(void *data)
+{
+	threadPolicyApply(THREAD_WORKER);
+	worker_id = SDL_ThreadID();
+	SDL_LockMutex(lock);
+	for (;;) {
+		io_job job;
+
+		while (q_count == 0)
+			SDL_CondWait(cond_work, lock);
+		job = queue[q_head];
+		q_head = (q_head + 1) % IO_QUEUE_LEN;
+		q_count--;
+		busy = true;
+		SDL_CondSignal(cond_space);
+		SDL_UnlockMutex(lock);
+
+		job.fn(job.arg);
+
+		SDL_LockMutex(lock);
+		busy = false;
+		if (q_count == 0)
+			SDL_CondBroadcast(cond_idle);
+	}
+	return 0;
+}
+
+static bool io_worker_start(void)
+{
+	SDL_AtomicLock(&init_lock);
+	if (!worker && !init_failed) {
+		lock = SDL_CreateMutex();
+		cond_work = SDL_CreateCond();
+		cond_space = SDL_CreateCond();
+		cond_idle = SDL_CreateCond();
+		if (lock && cond_work && cond_space && cond_idle)
+			worker = SDL_CreateThread(io_worker_thread, "sQLux IO", NULL);
+		if (worker) {
+			SDL_DetachThread(worker);
+		} else {
+			fprintf(stderr, "IO worker: thread creation failed, writing synchronously\n");
+			init_failed = true;
+		}
+	}
+	SDL_AtomicUnlock(&init_lock);
+	return !init_failed;
+}
+
+void ioWorkerSubmit(io_job_fn fn, void *arg)
+{
+	if (!io_worker_start()) {
+		fn(arg);
+		return;
+	}
+
+	SDL_LockMutex(lock);
+	while (q_count == IO_QUEUE_LEN)
+		SDL_CondWait(cond_space, lock);
+	queue[(q_head + q_count) % IO_QUEUE_LEN] = (io_job){ fn, arg };
+	q_count++;
+	SDL_CondSignal(cond_work);
+	SDL_UnlockMutex(lock);
+}
+
+void ioWorkerFlush(void)
+{
+	// Nothing to wait for, or called from a job (e.g. a signal landing
+	// on the worker) where waiting would never finish
+	if (!worker || SDL_ThreadID() == worker_id)
+		return;
+
+	SDL_LockMutex(lock);
+	while (q_count || busy)
+		SDL_CondWait(cond_idle, lock);
+	SDL_UnlockMutex(lock);
+}
+
+void ioWorkerForked(void)
+{
+	worker = NULL;
+	worker_id = 0;
+	q_head = q_count = 0;
+	busy = false;
+	init_lock = 0;
+}
@@ -0,0 +1,26 @@
+/*
+ * io_worker.h
+ *
+ * Background thread for screenshot encoding and capture file writes.
+ */
+
+#ifndef IO_WORKER_H
+#define IO_WORKER_H
+
+#include <stdbool.h>
+
+/* A job runs on the worker thread and owns (and frees) arg */
+typedef void (*io_job_fn)(void *arg);
+
+/* Queue a job, waiting while the queue is full; runs it inline if the
+   worker cannot be started */
+void ioWorkerSubmit(io_job_fn fn, void *arg);
+
+/* Wait until every queued job has finished */
+void ioWorkerFlush(void);
+
+/* In the child of a fork, after a flush: the worker didn't come along,
+   the next job starts a new one */
+void ioWorkerForked(void);
+
+#endif /* IO_WORKER_H */
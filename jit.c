@@ -0,0 +1,1523 @@
+/*
+ * jit.c
+ *
+ * Basic-block translator for the 68K dispatch loop, see jit.h.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#if defined(__APPLE__) && defined(__aarch64__)
+#include <pthread.h>
+#endif
+
+#include "QL68000.h"
+#include "cycles.h"
+#include "decode_cache.h"
+#include "fuse.h"
+#include "jit.h"
+#include "version.h"
+
+#if !defined(JIT_X86_64) && !defined(JIT_ARM64)
+#if defined(__x86_64__) || defined(_M_X64)
+#define JIT_X86_64
+#elif defined(__aarch64__)
+#define JIT_ARM64
+#endif
+#endif
+
+#define JIT_BUF_SIZE	(4 * 1024 * 1024)
+#define JIT_BLOCK_BYTES	32768	/* worst case host code for one block */
+#define JIT_BLOCK_TAIL	6	/* after the last opcode: a fused branch and its displacement */
+#define JIT_MAX_BLOCKS	16384
+
+#define JIT_CACHE_SLOTS		65536	/* jit_cache entries, a power of two */
+#define JIT_CACHE_INSNS		(256 * 1024)
+#define JIT_CACHE_MAGIC		"SQLUXJIT"
+#define JIT_CACHE_VERSION	1
+
+extern bool asyncTrace;
+
+struct jit_block {
+	uw32 start, end;		/* opcode words covered, [start, end) */
+	void (*fn)(void);
+	struct jit_block *next;		/* next block starting in the same page */
+};
+
+uw8 jit_code_page[JIT_PAGES];
+Cond jit_recording;
+
+static uw8 *jit_buf;
+static size_t jit_used;
+static struct jit_block jit_blocks[JIT_MAX_BLOCKS];
+static int jit_nblocks;
+static struct jit_block *jit_page_list[JIT_PAGES];
+static struct jit_block *jit_running;
+
+static struct {
+	int n;
+	uw32 next;			/* guest address the next record must have */
+	dcache_entry *head;
+	uw32 addr[JIT_MAX_INSNS];
+	uw16 code[JIT_MAX_INSNS];
+	void (*handler[JIT_MAX_INSNS])(void);
+} rec;
+
+/*
+ * jit_cache: the recordings of the blocks translated, kept across
+ * flushes and runs.  Host code holds the absolute addresses of the
+ * handlers and the CPU state, so the file has the recordings, each with
+ * a hash of the guest pages it covers, and they are translated again as
+ * soon as the guest reaches their start.
+ */
+static struct jit_cached {
+	uw32 start;		/* DCACHE_EMPTY if unused */
+	uw32 at;		/* first instruction in cache_addr/cache_code */
+	uw8 n;			/* 0 once found stale */
+	uw8 loaded;		/* from the file, memory not compared yet */
+	uint64_t hash;		/* of its pages, when loaded */
+} *cache;
+static uw32 *cache_addr;
+static uw16 *cache_code;
+static uw32 cache_used;
+static char *cache_path;
+static bool cache_translating;
+uw8 jit_cache_page[JIT_PAGES];
+static uint64_t page_hash[JIT_PAGES];
+static uw8 page_hashed[JIT_PAGES];
+
+/* Host code emitters */
+
+static uw8 *emit_p;
+static uw8 *fixup[3 * JIT_MAX_INSNS];
+static int nfixup;
+
+static void emit8(uw8 v)
+{
+	*emit_p++ = v;
+}
+
+static void emit16(uw16 v)
+{
+	memcpy(emit_p, &v, 2);
+	emit_p += 2;
+}
+
+static void emit32(uw32 v)
+{
+	memcpy(emit_p, &v, 4);
+	emit_p += 4;
+}
+
+static void emit64(uint64_t v)
+{
+	memcpy(emit_p, &v, 8);
+	emit_p += 8;
+}
+
+/*
+ * Instructions translated to host code instead of a handler call: moveq,
+ * move and movea between registers, add, sub and cmp of a register to a
+ * data register, addq and subq to a register, tst and clr of a data
+ * register, Bcc and DBcc.  They leave the flags as the handlers do, N
+ * and Z in the CPU state and C, V and X pending in cc_op (see CC_LAZY()),
+ * so translated code and handlers mix freely.  Between two translated
+ * instructions the translator knows what is pending, and a branch tests
+ * the host flags of the subtract, compare or add again instead of
+ * working out C and V.
+ */
+enum { OP_ALU, OP_ADDA, OP_MOVEQ, OP_MOVE, OP_MOVEA, OP_TST, OP_CLR, OP_BCC, OP_DBCC };
+
+struct jit_op {
+	int kind;
+	uw32 addr;
+	int size;		/* 1, 2 or 4 */
+	int lazy;		/* OP_ALU: CC_ADD_x, CC_SUB_x or CC_CMP_x */
+	int src, dst;		/* reg[] index, src -1 for imm */
+	w32 imm;
+	int cc;			/* OP_BCC, OP_DBCC */
+	int ext;		/* bytes of displacement after the opcode */
+	intptr_t target;	/* taken branch, offset from memBase */
+};
+
+/* The flags between two translated instructions: not known, cc_op clear
+   with C and V clear, or else the CC_x pending */
+#define FLAGS_UNKNOWN	(-1)
+#define FLAGS_LOGIC	CC_NONE
+
+#define CPU_OFF(f)	((int)((Ptr)&(f) - (Ptr)&cpu))
+#define REG_OFF(n, size) (4 * (n) + ((size) == 1 ? RBO : (size) == 2 ? RWO : 0))
+
+static bool jit_decode(uw32 addr, uw16 c, struct jit_op *o)
+{
+	unsigned mode = (c >> 3) & 7, s = (c >> 6) & 3;
+	w32 d;
+
+	memset(o, 0, sizeof(*o));
+	o->addr = addr;
+	o->size = 1 << s;
+	o->src = c & 7;
+	o->dst = (c >> 9) & 7;
+	switch (c >> 12) {
+	case 0x1: case 0x2: case 0x3:		/* move, movea */
+		o->size = (c & 0x3000) == 0x1000 ? 1 : (c & 0x3000) == 0x3000 ? 2 : 4;
+		if (mode > 1 || (mode == 1 && o->size == 1))
+			return false;
+		o->src += mode << 3;
+		switch ((c >> 6) & 7) {
+		case 0:
+			o->kind = OP_MOVE;
+			return true;
+		case 1:
+			o->kind = OP_MOVEA;
+			o->dst += 8;
+			return o->size != 1;
+		}
+		return false;
+	case 0x4:				/* tst, clr */
+		if ((c & 0xf700) != 0x4200 || s == 3 || mode)
+			return false;
+		o->kind = c & 0x0800 ? OP_TST : OP_CLR;
+		o->dst = c & 7;
+		return true;
+	case 0x5:
+		if (s == 3) {			/* DBcc */
+			if (mode != 1)
+				return false;
+			o->kind = OP_DBCC;
+			o->cc = (c >> 8) & 15;
+			o->dst = c & 7;
+			o->ext = 2;
+			o->target = (intptr_t)addr + 2 + (w16)RW((Ptr)memBase + addr + 2);
+			return !(o->target & 1);
+		}
+		if (mode > 1 || (mode == 1 && s == 0))
+			return false;
+		o->imm = o->dst ? o->dst : 8;
+		o->dst = c & 7;
+		if (mode) {			/* addq, subq to An: no flags */
+			o->kind = OP_ADDA;
+			o->dst += 8;
+			if (c & 0x0100)
+				o->imm = -o->imm;
+			return true;
+		}
+		o->kind = OP_ALU;
+		o->lazy = (c & 0x0100 ? CC_SUB_B : CC_ADD_B) + s;
+		o->src = -1;
+		return true;
+	case 0x6:				/* Bcc, BRA */
+#if defined(DEBUG) || defined(PROFILER)
+		// The handlers check or record every jump
+		return false;
+#else
+		o->kind = OP_BCC;
+		o->cc = (c >> 8) & 15;
+		d = (w8)c;
+		if (o->cc == 1 || d == -1)	/* BSR, Bcc.l */
+			return false;
+		if (d) {
+			o->target = (intptr_t)addr + 2 + d;
+		} else {
+			o->ext = 2;
+			o->target = (addr + 2 + (w16)RW((Ptr)memBase + addr + 2)) & ADDR_MASK;
+		}
+		return !(o->target & 1);
+#endif
+	case 0x7:				/* moveq */
+		o->kind = OP_MOVEQ;
+		o->imm = (w8)c;
+		return !(c & 0x0100);
+	case 0x9: case 0xb: case 0xd:		/* sub, cmp, add <ea>,Dn */
+		if (s == 3 || (c & 0x0100) || mode > 1 || (mode == 1 && s == 0))
+			return false;
+		o->kind = OP_ALU;
+		o->src += mode << 3;
+		o->lazy = ((c >> 12) == 0xd ? CC_ADD_B : (c >> 12) == 0x9 ? CC_SUB_B : CC_CMP_B) + s;
+		return true;
+	}
+	return false;
+}
+
+#if defined(JIT_X86_64)
+
+/*
+ * rbx = &pc, r12 = &cpu, r13 = &code, r14 = reg; rax, rcx and rdx are
+ * scratch.  The 40 bytes below the saved registers keep the stack
+ * aligned and double as the Win64 shadow area.
+ */
+#define X_RAX	0
+#define X_RCX	1
+#define X_RDX	2
+#define X_R12	12
+#define X_R13	13
+#define X_R14	14
+
+#define X_B	0x2	/* condition codes */
+#define X_E	0x4
+#define X_NE	0x5
+#define X_GE	0xd
+
+/* op r, [base + disp8]; an op above 0xff has the 0x0f escape */
+static void x86_mem(int w16, int op, int r, int base, int disp)
+{
+	if (w16)
+		emit8(0x66);
+	if (base >= 8)
+		emit8(0x41);
+	if (op > 0xff)
+		emit8(op >> 8);
+	emit8(op);
+	emit8(0x40 | (r & 7) << 3 | (base & 7));
+	if ((base & 7) == 4)
+		emit8(0x24);			/* SIB for r12 */
+	emit8(disp);
+}
+
+static void emit_exit_jcc(uw8 cc)
+{
+	emit8(0x0f);
+	emit8(cc);
+	fixup[nfixup++] = emit_p;
+	emit32(0);
+}
+
+static uw8 *emit_jcc(int cc)
+{
+	emit8(0x0f);
+	emit8(0x80 | cc);
+	emit32(0);
+	return emit_p - 4;
+}
+
+static uw8 *emit_jmp(void)
+{
+	emit8(0xe9);
+	emit32(0);
+	return emit_p - 4;
+}
+
+static void emit_land(uw8 *j)
+{
+	uw32 rel = (uw32)(emit_p - (j + 4));
+
+	memcpy(j, &rel, 4);
+}
+
+static void emit_call(void (*fn)(void))
+{
+	emit8(0x48); emit8(0xb8); emit64((uintptr_t)fn);
+	emit8(0xff); emit8(0xd0);		/* call rax */
+}
+
+/* r = reg[n], sign extended from size */
+static void emit_load(int r, int size, int n)
+{
+	x86_mem(0, size == 1 ? 0x0fbe : size == 2 ? 0x0fbf : 0x8b, r, X_R14, REG_OFF(n, size));
+}
+
+static void emit_store(int r, int size, int n)
+{
+	x86_mem(size == 2, size == 1 ? 0x88 : 0x89, r, X_R14, REG_OFF(n, size));
+}
+
+static void emit_flag(int off, int v)
+{
+	x86_mem(0, 0xc6, 0, X_R12, off);	/* mov byte [r12 + off], v */
+	emit8(v);
+}
+
+/* N and Z from r */
+static void emit_nz(int r)
+{
+	emit8(0x85); emit8(0xc0 | r << 3 | r);	/* test r, r */
+	x86_mem(0, 0x0f98, 0, X_R12, CPU_OFF(negative));	/* sets */
+	x86_mem(0, 0x0f94, 0, X_R12, CPU_OFF(zero));		/* sete */
+}
+
+static void emit_flush(int flags)
+{
+	uw8 *j;
+
+	if (flags == FLAGS_LOGIC)
+		return;
+	if (flags != FLAGS_UNKNOWN) {
+		emit_call(cc_eval);
+		return;
+	}
+	x86_mem(0, 0x83, 7, X_R12, CPU_OFF(cc_op));	/* cmp dword [cc_op], 0 */
+	emit8(0);
+	j = emit_jcc(X_E);
+	emit_call(cc_eval);
+	emit_land(j);
+}
+
+static void emit_cmp_prep(int flags)
+{
+	uw8 *j, *k;
+
+	if (flags == FLAGS_LOGIC || flags >= CC_CMP_B)
+		return;
+	if (flags != FLAGS_UNKNOWN) {
+		emit_call(cc_eval_x);
+		return;
+	}
+	x86_mem(0, 0x8b, X_RAX, X_R12, CPU_OFF(cc_op));	/* mov eax, [cc_op] */
+	emit8(0x85); emit8(0xc0);		/* test eax, eax */
+	j = emit_jcc(X_E);
+	emit8(0x83); emit8(0xf8); emit8(CC_CMP_B);	/* cmp eax, CC_CMP_B */
+	k = emit_jcc(X_GE);
+	emit_call(cc_eval_x);
+	emit_land(j);
+	emit_land(k);
+}
+
+static void emit_alu(const struct jit_op *o)
+{
+	if (o->src >= 0) {
+		emit_load(X_RAX, o->size, o->src);
+	} else {
+		emit8(0xb8); emit32(o->imm);	/* mov eax, imm */
+	}
+	emit_load(X_RCX, o->size, o->dst);
+	emit8(0x89); emit8(0xca);		/* mov edx, ecx */
+	emit8(o->lazy < CC_SUB_B ? 0x01 : 0x29); emit8(0xc2);	/* add/sub edx, eax */
+	if (o->size < 4) {
+		emit8(0x0f); emit8(o->size == 1 ? 0xbe : 0xbf); emit8(0xd2);	/* movsx edx, dl/dx */
+	}
+	if (o->lazy < CC_CMP_B)
+		emit_store(X_RDX, o->size, o->dst);
+	emit_nz(X_RDX);
+	x86_mem(0, 0xc7, 0, X_R12, CPU_OFF(cc_op));
+	emit32(o->lazy);
+	x86_mem(0, 0x89, X_RAX, X_R12, CPU_OFF(cc_src));
+	x86_mem(0, 0x89, X_RCX, X_R12, CPU_OFF(cc_dst));
+	x86_mem(0, 0x89, X_RDX, X_R12, CPU_OFF(cc_res));
+}
+
+static void emit_adda(int n, w32 imm)
+{
+	x86_mem(0, 0x83, imm < 0 ? 5 : 0, X_R14, REG_OFF(n, 4));	/* add/sub dword, imm8 */
+	emit8(imm < 0 ? -imm : imm);
+}
+
+static void emit_moveq(int n, w32 imm)
+{
+	x86_mem(0, 0xc7, 0, X_R14, REG_OFF(n, 4));
+	emit32(imm);
+	emit_flag(CPU_OFF(negative), imm < 0);
+	emit_flag(CPU_OFF(zero), imm == 0);
+	emit_flag(CPU_OFF(overflow), 0);
+	emit_flag(CPU_OFF(carry), 0);
+}
+
+static void emit_move(const struct jit_op *o)
+{
+	if (o->kind == OP_CLR) {
+		x86_mem(o->size == 2, o->size == 1 ? 0xc6 : 0xc7, 0, X_R14, REG_OFF(o->dst, o->size));
+		if (o->size == 1)
+			emit8(0);
+		else if (o->size == 2)
+			emit16(0);
+		else
+			emit32(0);
+		emit_flag(CPU_OFF(negative), 0);
+		emit_flag(CPU_OFF(zero), 1);
+	} else {
+		emit_load(X_RAX, o->size, o->kind == OP_TST ? o->dst : o->src);
+		if (o->kind == OP_MOVE)
+			emit_store(X_RAX, o->size, o->dst);
+		emit_nz(X_RAX);
+	}
+	emit_flag(CPU_OFF(overflow), 0);
+	emit_flag(CPU_OFF(carry), 0);
+}
+
+static void emit_movea(const struct jit_op *o)
+{
+	emit_load(X_RAX, o->size, o->src);
+	emit_store(X_RAX, 4, o->dst);
+}
+
+static void emit_set_pc(intptr_t target)
+{
+	emit8(0x48); emit8(0xb8); emit64((uintptr_t)((Ptr)memBase + target));
+	emit8(0x48); emit8(0x89); emit8(0x03);	/* mov [rbx], rax */
+}
+
+static void emit_pc_add2(void)
+{
+	emit32(0x02038348);			/* add qword [rbx], 2 */
+}
+
+/* Dn.w--, jumping if it was 0 */
+static uw8 *emit_dec_was_zero(int n)
+{
+	x86_mem(1, 0x83, 5, X_R14, REG_OFF(n, 2));	/* sub word, 1 */
+	emit8(1);
+	return emit_jcc(X_B);
+}
+
+/* 1 if cc holds, -1 if not, else 0 and *skip jumps when it doesn't */
+static int emit_cond(int cc, int flags, uw8 **skip)
+{
+	static const uw8 host_cc[16] = {
+		[2] = 0x7, [3] = 0x6, [4] = 0x3, [5] = 0x2, [6] = 0x5, [7] = 0x4,
+		[8] = 0x1, [9] = 0x0, [10] = 0x9, [11] = 0x8, [12] = 0xd, [13] = 0xc,
+		[14] = 0xf, [15] = 0xe
+	};
+	static const uw8 logic[16] = {		/* C and V clear: on N, Z or both */
+		0, 1, 6, 7, 0, 1, 6, 7, 0, 1, 10, 11, 10, 11, 14, 15
+	};
+	int size;
+
+	if (flags == FLAGS_LOGIC)
+		cc = logic[cc];
+	if (cc == 0 || cc == 1)
+		return cc ? -1 : 1;
+	if (cc == 14 || cc == 15) {
+		if (flags == FLAGS_LOGIC) {
+			x86_mem(0, 0x8a, X_RAX, X_R12, CPU_OFF(zero));		/* mov al */
+			x86_mem(0, 0x0a, X_RAX, X_R12, CPU_OFF(negative));	/* or al */
+			*skip = emit_jcc(cc == 14 ? X_NE : X_E);
+			return 0;
+		}
+	}
+	if (cc == 6 || cc == 7 || cc == 10 || cc == 11) {
+		x86_mem(0, 0x80, 7, X_R12, cc < 10 ? CPU_OFF(zero) : CPU_OFF(negative));
+		emit8(0);				/* cmp byte, 0 */
+		*skip = emit_jcc(cc & 1 ? X_E : X_NE);
+		return 0;
+	}
+	if (flags > FLAGS_LOGIC) {
+		// The subtract, compare or add again, for the host flags
+		size = 1 << ((flags & 3) - 1);
+		x86_mem(0, 0x8b, X_RAX, X_R12, CPU_OFF(cc_dst));
+		x86_mem(0, 0x8b, X_RCX, X_R12, CPU_OFF(cc_src));
+		if (size == 2)
+			emit8(0x66);
+		emit8((flags < CC_SUB_B ? 0x00 : 0x38) | (size > 1));
+		emit8(0xc8);				/* add/cmp eax, ecx */
+		*skip = emit_jcc(host_cc[cc] ^ 1);
+		return 0;
+	}
+	emit_call((void (*)(void))ConditionTrue[cc]);
+	emit8(0x84); emit8(0xc0);		/* test al, al */
+	*skip = emit_jcc(X_E);
+	return 0;
+}
+
+static void emit_prologue(void)
+{
+	emit8(0x53);				/* push rbx */
+	emit8(0x41); emit8(0x54);		/* push r12 */
+	emit8(0x41); emit8(0x55);		/* push r13 */
+	emit8(0x41); emit8(0x56);		/* push r14 */
+	emit32(0x28ec8348);			/* sub rsp, 40 */
+	emit8(0x48); emit8(0xbb); emit64((uintptr_t)&pc);
+	emit8(0x49); emit8(0xbc); emit64((uintptr_t)&cpu);
+	emit8(0x49); emit8(0xbd); emit64((uintptr_t)&code);
+	emit8(0x49); emit8(0xbe); emit64((uintptr_t)reg);
+}
+
+/* What ExecuteLoop does before the handler; budget: leave if it's spent */
+static void emit_step(uw16 c, bool budget)
+{
+	if (budget) {
+		/* if (nInst <= 0) leave; nInst-- */
+		x86_mem(0, 0x83, 7, X_R12, CPU_OFF(nInst));	/* cmp dword, 0 */
+		emit8(0);
+		emit_exit_jcc(0x8e);			/* jle exit */
+		x86_mem(0, 0xff, 1, X_R12, CPU_OFF(nInst));	/* dec dword */
+	}
+	emit8(0x48); emit8(0xb8); emit64((uintptr_t)&cpu_cycles);
+	emit8(0x48); emit8(0x81); emit8(0x00);	/* add qword [rax], imm32 */
+	emit32(cycle_table[c]);
+	x86_mem(1, 0xc7, 0, X_R13, 0);		/* mov word [r13], imm16 */
+	emit16(c);
+	emit_pc_add2();
+}
+
+/* Leave unless pc is at addr */
+static void emit_pc_check(uw32 addr)
+{
+	emit8(0x48); emit8(0xb8); emit64((uintptr_t)((Ptr)memBase + addr));
+	emit8(0x48); emit8(0x39); emit8(0x03);	/* cmp [rbx], rax */
+	emit_exit_jcc(0x85);			/* jne exit */
+}
+
+static void emit_epilogue(void)
+{
+	uw8 *exit = emit_p;
+	int i;
+
+	emit32(0x28c48348);			/* add rsp, 40 */
+	emit8(0x41); emit8(0x5e);		/* pop r14 */
+	emit8(0x41); emit8(0x5d);		/* pop r13 */
+	emit8(0x41); emit8(0x5c);		/* pop r12 */
+	emit8(0x5b);				/* pop rbx */
+	emit8(0xc3);				/* ret */
+
+	for (i = 0; i < nfixup; i++) {
+		uw32 rel = (uw32)(exit - (fixup[i] + 4));
+		memcpy(fixup[i], &rel, 4);
+	}
+}
+
+#elif defined(JIT_ARM64)
+
+/* x19 = &pc, x20 = &cpu, x21 = &code, x22 = reg; x9-x12 and x16 scratch */
+#define A64_COND_EQ	0x0
+#define A64_COND_NE	0x1
+#define A64_COND_GE	0xa
+#define A64_COND_LT	0xb
+
+#define A64_LDR_W	0xb9400000
+#define A64_STR_W	0xb9000000
+#define A64_LDRSH_W	0x79c00000
+#define A64_LDRH	0x79400000
+#define A64_STRH	0x79000000
+#define A64_LDRSB_W	0x39c00000
+#define A64_LDRB	0x39400000
+#define A64_STRB	0x39000000
+#define A64_WZR		31
+
+/* ldr/str rt, [rn, #off], an access of 1 << scale bytes */
+static void a64_mem(uw32 op, int scale, int rt, int rn, int off)
+{
+	emit32(op | (uw32)(off >> scale) << 10 | rn << 5 | rt);
+}
+
+static void emit_mov64(int rd, uint64_t v)
+{
+	int hw;
+
+	emit32(0xd2800000 | ((uw32)(v & 0xffff) << 5) | rd);	/* movz */
+	for (hw = 1; hw < 4; hw++) {
+		uw32 part = (v >> (16 * hw)) & 0xffff;
+
+		if (part)
+			emit32(0xf2800000 | (hw << 21) | (part << 5) | rd); /* movk */
+	}
+}
+
+static void emit_mov32(int rd, uw32 v)
+{
+	emit32(0x52800000 | (v & 0xffff) << 5 | rd);		/* movz w */
+	if (v >> 16)
+		emit32(0x72a00000 | (v >> 16) << 5 | rd);	/* movk w, lsl 16 */
+}
+
+static void emit_exit_bcc(int cond)
+{
+	fixup[nfixup++] = emit_p;
+	emit32(0x54000000 | cond);
+}
+
+static uw8 *emit_branch(uw32 insn)
+{
+	emit32(insn);
+	return emit_p - 4;
+}
+
+static uw8 *emit_jmp(void)
+{
+	return emit_branch(0x14000000);			/* b */
+}
+
+static void emit_land(uw8 *j)
+{
+	uw32 insn, d = (uw32)((emit_p - j) >> 2);
+
+	memcpy(&insn, j, 4);
+	if ((insn & 0xfc000000) == 0x14000000)
+		insn |= d & 0x3ffffff;
+	else
+		insn |= (d & 0x7ffff) << 5;		/* b.cond, cbz, cbnz */
+	memcpy(j, &insn, 4);
+}
+
+static void emit_call(void (*fn)(void))
+{
+	emit_mov64(16, (uintptr_t)fn);
+	emit32(0xd63f0200);			/* blr x16 */
+}
+
+/* wt = reg[n], sign extended from size */
+static void emit_load(int rt, int size, int n)
+{
+	if (size == 1)
+		a64_mem(A64_LDRSB_W, 0, rt, 22, REG_OFF(n, 1));
+	else if (size == 2)
+		a64_mem(A64_LDRSH_W, 1, rt, 22, REG_OFF(n, 2));
+	else
+		a64_mem(A64_LDR_W, 2, rt, 22, REG_OFF(n, 4));
+}
+
+static void emit_store(int rt, int size, int n)
+{
+	if (size == 1)
+		a64_mem(A64_STRB, 0, rt, 22, REG_OFF(n, 1));
+	else if (size == 2)
+		a64_mem(A64_STRH, 1, rt, 22, REG_OFF(n, 2));
+	else
+		a64_mem(A64_STR_W, 2, rt, 22, REG_OFF(n, 4));
+}
+
+static void emit_flag(int off, int v)
+{
+	if (v)
+		emit32(0x5280000c | 1 << 5);	/* mov w12, #1 */
+	a64_mem(A64_STRB, 0, v ? 12 : A64_WZR, 20, off);
+}
+
+/* N and Z from wr */
+static void emit_nz(int r)
+{
+	emit32(0x7100001f | r << 5);		/* cmp wr, #0 */
+	emit32(0x1a9f07ec | (A64_COND_GE << 12));	/* cset w12, lt */
+	a64_mem(A64_STRB, 0, 12, 20, CPU_OFF(negative));
+	emit32(0x1a9f07ec | (A64_COND_NE << 12));	/* cset w12, eq */
+	a64_mem(A64_STRB, 0, 12, 20, CPU_OFF(zero));
+}
+
+static void emit_flush(int flags)
+{
+	uw8 *j;
+
+	if (flags == FLAGS_LOGIC)
+		return;
+	if (flags != FLAGS_UNKNOWN) {
+		emit_call(cc_eval);
+		return;
+	}
+	a64_mem(A64_LDR_W, 2, 9, 20, CPU_OFF(cc_op));
+	j = emit_branch(0x34000009);		/* cbz w9 */
+	emit_call(cc_eval);
+	emit_land(j);
+}
+
+static void emit_cmp_prep(int flags)
+{
+	uw8 *j, *k;
+
+	if (flags == FLAGS_LOGIC || flags >= CC_CMP_B)
+		return;
+	if (flags != FLAGS_UNKNOWN) {
+		emit_call(cc_eval_x);
+		return;
+	}
+	a64_mem(A64_LDR_W, 2, 9, 20, CPU_OFF(cc_op));
+	j = emit_branch(0x34000009);		/* cbz w9 */
+	emit32(0x7100013f | CC_CMP_B << 10);	/* cmp w9, #CC_CMP_B */
+	k = emit_branch(0x54000000 | A64_COND_GE);
+	emit_call(cc_eval_x);
+	emit_land(j);
+	emit_land(k);
+}
+
+static void emit_alu(const struct jit_op *o)
+{
+	if (o->src >= 0)
+		emit_load(9, o->size, o->src);
+	else
+		emit_mov32(9, o->imm);
+	emit_load(10, o->size, o->dst);
+	if (o->lazy < CC_SUB_B)
+		emit32(0x0b09014b);		/* add w11, w10, w9 */
+	else
+		emit32(0x4b09014b);		/* sub w11, w10, w9 */
+	if (o->size == 1)
+		emit32(0x13001d6b);		/* sxtb w11, w11 */
+	else if (o->size == 2)
+		emit32(0x13003d6b);		/* sxth w11, w11 */
+	if (o->lazy < CC_CMP_B)
+		emit_store(11, o->size, o->dst);
+	emit_nz(11);
+	emit_mov32(12, o->lazy);
+	a64_mem(A64_STR_W, 2, 12, 20, CPU_OFF(cc_op));
+	a64_mem(A64_STR_W, 2, 9, 20, CPU_OFF(cc_src));
+	a64_mem(A64_STR_W, 2, 10, 20, CPU_OFF(cc_dst));
+	a64_mem(A64_STR_W, 2, 11, 20, CPU_OFF(cc_res));
+}
+
+static void emit_adda(int n, w32 imm)
+{
+	emit_load(9, 4, n);
+	if (imm < 0)
+		emit32(0x51000129 | (uw32)-imm << 10);	/* sub w9, w9, #imm */
+	else
+		emit32(0x11000129 | (uw32)imm << 10);	/* add w9, w9, #imm */
+	emit_store(9, 4, n);
+}
+
+static void emit_moveq(int n, w32 imm)
+{
+	emit_mov32(9, imm);
+	emit_store(9, 4, n);
+	emit_flag(CPU_OFF(negative), imm < 0);
+	emit_flag(CPU_OFF(zero), imm == 0);
+	emit_flag(CPU_OFF(overflow), 0);
+	emit_flag(CPU_OFF(carry), 0);
+}
+
+static void emit_move(const struct jit_op *o)
+{
+	if (o->kind == OP_CLR) {
+		emit_store(A64_WZR, o->size, o->dst);
+		emit_flag(CPU_OFF(negative), 0);
+		emit_flag(CPU_OFF(zero), 1);
+	} else {
+		emit_load(9, o->size, o->kind == OP_TST ? o->dst : o->src);
+		if (o->kind == OP_MOVE)
+			emit_store(9, o->size, o->dst);
+		emit_nz(9);
+	}
+	emit_flag(CPU_OFF(overflow), 0);
+	emit_flag(CPU_OFF(carry), 0);
+}
+
+static void emit_movea(const struct jit_op *o)
+{
+	emit_load(9, o->size, o->src);
+	emit_store(9, 4, o->dst);
+}
+
+static void emit_set_pc(intptr_t target)
+{
+	emit_mov64(9, (uintptr_t)((Ptr)memBase + target));
+	emit32(0xf9000269);			/* str x9, [x19] */
+}
+
+static void emit_pc_add2(void)
+{
+	emit32(0xf9400269);			/* ldr x9, [x19] */
+	emit32(0x91000929);			/* add x9, x9, #2 */
+	emit32(0xf9000269);			/* str x9, [x19] */
+}
+
+/* Dn.w--, jumping if it was 0 */
+static uw8 *emit_dec_was_zero(int n)
+{
+	a64_mem(A64_LDRH, 1, 9, 22, REG_OFF(n, 2));
+	emit32(0x5100052a);			/* sub w10, w9, #1 */
+	a64_mem(A64_STRH, 1, 10, 22, REG_OFF(n, 2));
+	return emit_branch(0x34000009);		/* cbz w9 */
+}
+
+/* 1 if cc holds, -1 if not, else 0 and *skip jumps when it doesn't */
+static int emit_cond(int cc, int flags, uw8 **skip)
+{
+	// After subs; after adds C is the other way round, so no HI or LS
+	static const signed char host_sub[16] = {
+		-1, -1, 0x8, 0x9, 0x2, 0x3, 0x1, 0x0, 0x7, 0x6, 0x5, 0x4, 0xa, 0xb, 0xc, 0xd
+	};
+	static const signed char host_add[16] = {
+		-1, -1, -1, -1, 0x3, 0x2, 0x1, 0x0, 0x7, 0x6, 0x5, 0x4, 0xa, 0xb, 0xc, 0xd
+	};
+	static const uw8 logic[16] = {		/* C and V clear: on N, Z or both */
+		0, 1, 6, 7, 0, 1, 6, 7, 0, 1, 10, 11, 10, 11, 14, 15
+	};
+	int host;
+
+	if (flags == FLAGS_LOGIC)
+		cc = logic[cc];
+	if (cc == 0 || cc == 1)
+		return cc ? -1 : 1;
+	if (cc == 14 || cc == 15) {
+		if (flags == FLAGS_LOGIC) {
+			a64_mem(A64_LDRB, 0, 9, 20, CPU_OFF(zero));
+			a64_mem(A64_LDRB, 0, 10, 20, CPU_OFF(negative));
+			emit32(0x2a0a0129);		/* orr w9, w9, w10 */
+			*skip = emit_branch(cc == 14 ? 0x35000009 : 0x34000009);	/* cbnz/cbz */
+			return 0;
+		}
+	}
+	if (cc == 6 || cc == 7 || cc == 10 || cc == 11) {
+		a64_mem(A64_LDRB, 0, 9, 20, cc < 10 ? CPU_OFF(zero) : CPU_OFF(negative));
+		*skip = emit_branch(cc & 1 ? 0x34000009 : 0x35000009);
+		return 0;
+	}
+	host = flags < CC_SUB_B ? host_add[cc] : host_sub[cc];
+	if (flags > FLAGS_LOGIC && host >= 0) {
+		// The subtract, compare or add again, for the host flags
+		a64_mem(A64_LDR_W, 2, 9, 20, CPU_OFF(cc_dst));
+		a64_mem(A64_LDR_W, 2, 10, 20, CPU_OFF(cc_src));
+		if ((flags & 3) != 3) {
+			int sh = (flags & 3) == 1 ? 24 : 16;
+
+			/* lsl w9, w9, #sh; lsl w10, w10, #sh */
+			emit32(0x53000129 | (32 - sh) << 16 | (31 - sh) << 10);
+			emit32(0x5300014a | (32 - sh) << 16 | (31 - sh) << 10);
+		}
+		emit32(flags < CC_SUB_B ? 0x2b0a013f : 0x6b0a013f);	/* cmn/cmp w9, w10 */
+		*skip = emit_branch(0x54000000 | (host ^ 1));
+		return 0;
+	}
+	emit_call((void (*)(void))ConditionTrue[cc]);
+	emit32(0x72001c1f);			/* tst w0, #0xff */
+	*skip = emit_branch(0x54000000 | A64_COND_EQ);
+	return 0;
+}
+
+static void emit_prologue(void)
+{
+	emit32(0xa9bd7bfd);			/* stp x29, x30, [sp, #-48]! */
+	emit32(0x910003fd);			/* mov x29, sp */
+	emit32(0xa90153f3);			/* stp x19, x20, [sp, #16] */
+	emit32(0xa9025bf5);			/* stp x21, x22, [sp, #32] */
+	emit_mov64(19, (uintptr_t)&pc);
+	emit_mov64(20, (uintptr_t)&cpu);
+	emit_mov64(21, (uintptr_t)&code);
+	emit_mov64(22, (uintptr_t)reg);
+}
+
+/* What ExecuteLoop does before the handler; budget: leave if it's spent */
+static void emit_step(uw16 c, bool budget)
+{
+	if (budget) {
+		/* if (nInst <= 0) leave; nInst-- */
+		a64_mem(A64_LDR_W, 2, 9, 20, CPU_OFF(nInst));
+		emit32(0x71000529);		/* subs w9, w9, #1 */
+		emit_exit_bcc(A64_COND_LT);
+		a64_mem(A64_STR_W, 2, 9, 20, CPU_OFF(nInst));
+	}
+	emit_mov64(10, (uintptr_t)&cpu_cycles);
+	emit32(0xf9400149);			/* ldr x9, [x10] */
+	emit32(0x91000129 | ((uw32)cycle_table[c] << 10)); /* add x9, x9, #cycles */
+	emit32(0xf9000149);			/* str x9, [x10] */
+	emit32(0x52800009 | ((uw32)c << 5));	/* movz w9, #code */
+	emit32(0x790002a9);			/* strh w9, [x21] */
+	emit_pc_add2();
+}
+
+/* Leave unless pc is at addr */
+static void emit_pc_check(uw32 addr)
+{
+	emit32(0xf9400269);			/* ldr x9, [x19] */
+	emit_mov64(10, (uintptr_t)((Ptr)memBase + addr));
+	emit32(0xeb0a013f);			/* cmp x9, x10 */
+	emit_exit_bcc(A64_COND_NE);
+}
+
+static void emit_epilogue(void)
+{
+	uw8 *exit = emit_p;
+	int i;
+
+	emit32(0xa9425bf5);			/* ldp x21, x22, [sp, #32] */
+	emit32(0xa94153f3);			/* ldp x19, x20, [sp, #16] */
+	emit32(0xa8c37bfd);			/* ldp x29, x30, [sp], #48 */
+	emit32(0xd65f03c0);			/* ret */
+
+	for (i = 0; i < nfixup; i++) {
+		uw32 insn;
+
+		memcpy(&insn, fixup[i], 4);
+		insn |= ((uw32)((exit - fixup[i]) >> 2) & 0x7ffff) << 5;
+		memcpy(fixup[i], &insn, 4);
+	}
+}
+
+#endif
+
+#if defined(JIT_X86_64) || defined(JIT_ARM64)
+
+static void emit_bcc(const struct jit_op *o, int flags)
+{
+	uw8 *skip = NULL, *done;
+	int c = emit_cond(o->cc, flags, &skip);
+
+	if (c < 0) {
+		if (o->ext)
+			emit_pc_add2();
+		return;
+	}
+	emit_set_pc(o->target);
+	if (!skip)
+		return;
+	if (o->ext) {
+		done = emit_jmp();
+		emit_land(skip);
+		emit_pc_add2();
+		emit_land(done);
+	} else {
+		emit_land(skip);
+	}
+}
+
+static void emit_dbcc(const struct jit_op *o, int flags)
+{
+	uw8 *count = NULL, *out = NULL, *ends, *done;
+	int c = emit_cond(o->cc, flags, &count);
+
+	if (c > 0) {
+		emit_pc_add2();
+		return;
+	}
+	if (count) {
+		emit_pc_add2();
+		out = emit_jmp();
+		emit_land(count);
+	}
+	ends = emit_dec_was_zero(o->dst);
+	emit_set_pc(o->target);
+	done = emit_jmp();
+	emit_land(ends);
+	emit_pc_add2();
+	if (out)
+		emit_land(out);
+	emit_land(done);
+}
+
+/* Returns the flags as they are after o */
+static int emit_native(const struct jit_op *o, int flags)
+{
+	switch (o->kind) {
+	case OP_ALU:
+		if (o->lazy >= CC_CMP_B)
+			emit_cmp_prep(flags);
+		emit_alu(o);
+		return o->lazy;
+	case OP_ADDA:
+		emit_adda(o->dst, o->imm);
+		return flags;
+	case OP_MOVEQ:
+		emit_flush(flags);
+		emit_moveq(o->dst, o->imm);
+		return FLAGS_LOGIC;
+	case OP_MOVE:
+	case OP_TST:
+	case OP_CLR:
+		emit_flush(flags);
+		emit_move(o);
+		return FLAGS_LOGIC;
+	case OP_MOVEA:
+		emit_movea(o);
+		return flags;
+	case OP_BCC:
+		emit_bcc(o, flags);
+		return flags;
+	default:
+		emit_dbcc(o, flags);
+		return flags;
+	}
+}
+
+/* Returns the end of the guest words the block depends on */
+static uw32 emit_block(int n)
+{
+	struct jit_op op, pair;
+	uw32 end = 0;
+	int i, flags = FLAGS_UNKNOWN;
+
+	emit_prologue();
+	for (i = 0; i < n; i++) {
+		uw32 a = rec.addr[i], covered;
+		uw16 c = rec.code[i];
+		void (*h)(void) = rec.handler[i];
+		bool native = jit_decode(a, c, &op);
+
+		emit_step(c, i > 0);
+		covered = a + 2;
+		if (native && h == QLUX_HANDLER(c)) {
+			flags = emit_native(&op, flags);
+			covered += op.ext;
+		} else if (native && fuse_pair(h) &&
+			   jit_decode(a + 2, (uw16)RW((Ptr)memBase + a + 2), &pair) &&
+			   (pair.kind == OP_BCC || pair.kind == OP_DBCC)) {
+			// Both of a fused pair, the branch with its own budget check
+			flags = emit_native(&op, flags);
+			emit_step((uw16)RW((Ptr)memBase + a + 2), true);
+			flags = emit_native(&pair, flags);
+			covered += 2 + pair.ext;
+		} else {
+			emit_call(h);
+			flags = FLAGS_UNKNOWN;
+		}
+		if (covered > end)
+			end = covered;
+		if (i < n - 1)
+			emit_pc_check(rec.addr[i + 1]);
+	}
+	emit_epilogue();
+	return end;
+}
+
+#endif
+
+/* Instructions that may leave the straight-line path */
+static int ends_block(uw16 c)
+{
+	if ((c & 0xf000) == 0x6000)		/* Bcc, BRA, BSR */
+		return 1;
+	if ((c & 0xf0f8) == 0x50c8)		/* DBcc */
+		return 1;
+	if ((c & 0xff80) == 0x4e80)		/* JSR, JMP */
+		return 1;
+	if ((c & 0xfff0) == 0x4e40)		/* TRAP */
+		return 1;
+	if ((c & 0xfff8) == 0x4e70)		/* RESET .. RTR */
+		return 1;
+	if ((c & 0xfffe) == 0x4e7a)		/* MOVEC */
+		return 1;
+	if ((c & 0xffc0) == 0x46c0)		/* MOVE to SR */
+		return 1;
+	if (c == 0x007c || c == 0x027c || c == 0x0a7c)	/* ORI/ANDI/EORI to SR */
+		return 1;
+	if ((c & 0xf000) == 0xa000 || (c & 0xf000) == 0xf000)
+		return 1;
+	return 0;
+}
+
+/* FNV-1a over guest page p */
+static uint64_t page_fnv(uw32 p)
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+	uw32 a = p << JIT_PAGE_SHIFT;
+	uw32 end = a + (1u << JIT_PAGE_SHIFT);
+
+	for (; a < end && a < (uw32)RTOP; a++) {
+		h ^= ((uw8 *)memBase)[a];
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+/* Hash of the pages holding [start, end), each hashed once a run unless fresh */
+static uint64_t block_hash(uw32 start, uw32 end, bool fresh)
+{
+	uw32 p = (start & ADDR_MASK) >> JIT_PAGE_SHIFT;
+	uw32 last = ((end - 1) & ADDR_MASK) >> JIT_PAGE_SHIFT;
+	uint64_t h = 0;
+
+	for (; p <= last; p++) {
+		if (fresh || !page_hashed[p]) {
+			page_hash[p] = page_fnv(p);
+			page_hashed[p] = 1;
+		}
+		h = (h * 0x100000001b3ull) ^ page_hash[p];
+	}
+	return h;
+}
+
+static struct jit_cached *cache_slot(uw32 start)
+{
+	uw32 i = (start >> 1) * 0x9e3779b1u;
+	int probe;
+
+	for (probe = 0; probe < JIT_CACHE_SLOTS; probe++) {
+		struct jit_cached *c = &cache[(i + probe) & (JIT_CACHE_SLOTS - 1)];
+
+		if (c->start == start || c->start == DCACHE_EMPTY)
+			return c;
+	}
+	return NULL;
+}
+
+static struct jit_cached *cache_add(uw32 start, int n)
+{
+	struct jit_cached *c = cache_slot(start);
+
+	if (!c || cache_used + n > JIT_CACHE_INSNS)
+		return NULL;
+	c->start = start;
+	c->at = cache_used;
+	c->n = n;
+	c->loaded = 0;
+	cache_used += n;
+	jit_cache_page[(start & ADDR_MASK) >> JIT_PAGE_SHIFT] = 1;
+	return c;
+}
+
+/* Keeps the recording just translated */
+static void cache_store(void)
+{
+	struct jit_cached *c = cache_add(rec.addr[0], rec.n);
+	int i;
+
+	if (!c)
+		return;
+	for (i = 0; i < rec.n; i++) {
+		cache_addr[c->at + i] = rec.addr[i];
+		cache_code[c->at + i] = rec.code[i];
+	}
+}
+
+static void jit_compile(void)
+{
+	struct jit_block *b;
+	uw32 p, last;
+	int i;
+
+	if (rec.n == 0)
+		return;
+
+	/* The head entry or the code may have changed while recording */
+	if (rec.head->addr != rec.addr[0] || rec.head->block)
+		return;
+	for (i = 0; i < rec.n; i++)
+		if ((uw16)RW((Ptr)memBase + rec.addr[i]) != rec.code[i])
+			return;
+
+#if defined(__APPLE__) && defined(__aarch64__)
+	pthread_jit_write_protect_np(0);
+#endif
+	b = &jit_blocks[jit_nblocks++];
+	b->start = rec.addr[0];
+	b->fn = (void (*)(void))(jit_buf + jit_used);
+	emit_p = jit_buf + jit_used;
+	nfixup = 0;
+	/* Extension words are fetched live by the handlers; only opcodes and
+	   the branch words translated matter */
+	b->end = emit_block(rec.n);
+	__builtin___clear_cache((char *)b->fn, (char *)emit_p);
+	jit_used = (emit_p - jit_buf + 15) & ~(size_t)15;
+#if defined(__APPLE__) && defined(__aarch64__)
+	pthread_jit_write_protect_np(1);
+#endif
+
+	p = (b->start & ADDR_MASK) >> JIT_PAGE_SHIFT;
+	b->next = jit_page_list[p];
+	jit_page_list[p] = b;
+	last = ((b->end - 1) & ADDR_MASK) >> JIT_PAGE_SHIFT;
+	for (; p <= last; p++)
+		jit_code_page[p] = 1;
+
+	rec.head->block = b;
+	if (cache && !cache_translating)
+		cache_store();
+}
+
+static void jit_record_close(void)
+{
+	jit_recording = false;
+	jit_compile();
+}
+
+static void cache_reset(void)
+{
+	int i;
+
+	for (i = 0; i < JIT_CACHE_SLOTS; i++)
+		cache[i].start = DCACHE_EMPTY;
+	cache_used = 0;
+	memset(jit_cache_page, 0, sizeof(jit_cache_page));
+}
+
+/* Translated code depends on the handlers, so on the exact build */
+static const char *build_id(void)
+{
+	static char id[256];
+
+	if (!id[0])
+		snprintf(id, sizeof(id), "%s %s %s", release, __DATE__, __TIME__);
+	return id;
+}
+
+static bool cache_read(FILE *f, void *p, size_t n)
+{
+	return fread(p, 1, n, f) == n;
+}
+
+static void cache_load(void)
+{
+	FILE *f = fopen(cache_path, "rb");
+	char magic[8], id[256];
+	uw32 version, len, count, i = 0, start, addr;
+	uint64_t hash;
+	uw16 op;
+	uw8 n;
+	bool ok;
+	int j;
+
+	if (!f)
+		return;		// The first run
+	ok = cache_read(f, magic, 8) && memcmp(magic, JIT_CACHE_MAGIC, 8) == 0 &&
+	     cache_read(f, &version, 4) && version == JIT_CACHE_VERSION &&
+	     cache_read(f, &len, 4) && len < sizeof(id) && cache_read(f, id, len);
+	if (ok) {
+		id[len] = 0;
+		ok = strcmp(id, build_id()) == 0;
+	}
+	if (!ok) {
+		fprintf(stderr, "JIT: %s is from another build, ignored\n", cache_path);
+		fclose(f);
+		return;
+	}
+
+	ok = cache_read(f, &count, 4);
+	for (i = 0; ok && i < count; i++) {
+		struct jit_cached *c;
+
+		ok = cache_read(f, &start, 4) && cache_read(f, &n, 1) &&
+		     cache_read(f, &hash, 8) && n && n <= JIT_MAX_INSNS &&
+		     (c = cache_add(start, n));
+		if (!ok)
+			break;
+		c->loaded = 1;
+		c->hash = hash;
+		for (j = 0; ok && j < n; j++) {
+			ok = cache_read(f, &addr, 4) && cache_read(f, &op, 2);
+			cache_addr[c->at + j] = addr;
+			cache_code[c->at + j] = op;
+		}
+	}
+	fclose(f);
+	if (!ok) {
+		fprintf(stderr, "JIT: %s is damaged, ignored\n", cache_path);
+		cache_reset();
+	}
+}
+
+static void cache_save(void)
+{
+	FILE *f = fopen(cache_path, "wb");
+	const char *id = build_id();
+	uw32 version = JIT_CACHE_VERSION, len = strlen(id), count = 0;
+	int i;
+
+	if (!f) {
+		fprintf(stderr, "JIT: can't write %s\n", cache_path);
+		return;
+	}
+	fwrite(JIT_CACHE_MAGIC, 8, 1, f);
+	fwrite(&version, 4, 1, f);
+	fwrite(&len, 4, 1, f);
+	fwrite(id, len, 1, f);
+	for (i = 0; i < JIT_CACHE_SLOTS; i++)
+		count += cache[i].start != DCACHE_EMPTY && cache[i].n;
+	fwrite(&count, 4, 1, f);
+
+	for (i = 0; i < JIT_CACHE_SLOTS; i++) {
+		struct jit_cached *c = &cache[i];
+		uint64_t hash;
+		int j;
+
+		if (c->start == DCACHE_EMPTY || !c->n)
+			continue;
+		// Not reached this run: keep what the file said
+		hash = c->loaded ? c->hash :
+			block_hash(c->start, cache_addr[c->at + c->n - 1] + JIT_BLOCK_TAIL, true);
+		fwrite(&c->start, 4, 1, f);
+		fwrite(&c->n, 1, 1, f);
+		fwrite(&hash, 8, 1, f);
+		for (j = 0; j < c->n; j++) {
+			fwrite(&cache_addr[c->at + j], 4, 1, f);
+			fwrite(&cache_code[c->at + j], 2, 1, f);
+		}
+	}
+	if (fclose(f) != 0)
+		fprintf(stderr, "JIT: can't write %s\n", cache_path);
+}
+
+void jit_cache_fill(dcache_entry *e)
+{
+	uw32 p = (e->addr & ADDR_MASK) >> JIT_PAGE_SHIFT;
+	struct jit_cached *c;
+	struct jit_block *b;
+	int i;
+
+	if (cache_translating || jit_recording || !jit_buf)
+		return;
+	// Still translated from before the entry was replaced
+	for (b = jit_page_list[p]; b; b = b->next) {
+		if (b->start == e->addr) {
+			e->block = b;
+			return;
+		}
+	}
+	c = cache_slot(e->addr);
+	if (!c || c->start != e->addr || !c->n ||
+	    jit_used + JIT_BLOCK_BYTES > JIT_BUF_SIZE || jit_nblocks == JIT_MAX_BLOCKS)
+		return;
+	if (c->loaded) {
+		if (block_hash(c->start, cache_addr[c->at + c->n - 1] + JIT_BLOCK_TAIL, false) != c->hash) {
+			c->n = 0;
+			return;
+		}
+		c->loaded = 0;
+	}
+
+	cache_translating = true;
+	rec.head = e;
+	rec.n = c->n;
+	for (i = 0; i < rec.n; i++) {
+		rec.addr[i] = cache_addr[c->at + i];
+		rec.code[i] = cache_code[c->at + i];
+		rec.handler[i] = i ? dcache_lookup(rec.addr[i])->handler : e->handler;
+	}
+	jit_compile();
+	cache_translating = false;
+	if (!e->block)
+		c->n = 0;	// The code has changed since
+}
+
+void jit_init(int enable, const char *cache_file)
+{
+	if (!enable)
+		return;
+#if !defined(JIT_X86_64) && !defined(JIT_ARM64)
+	fprintf(stderr, "JIT: no code generator for this host, disabled\n");
+	return;
+#endif
+#ifdef TRACE
+	fprintf(stderr, "JIT: disabled in trace builds\n");
+	return;
+#endif
+
+#ifdef _WIN32
+	jit_buf = VirtualAlloc(NULL, JIT_BUF_SIZE, MEM_COMMIT | MEM_RESERVE,
+			       PAGE_EXECUTE_READWRITE);
+#else
+	{
+		int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+		void *p;
+
+#ifdef MAP_JIT
+		flags |= MAP_JIT;
+#endif
+		p = mmap(NULL, JIT_BUF_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+			 flags, -1, 0);
+		jit_buf = (p == MAP_FAILED) ? NULL : p;
+	}
+#endif
+	if (!jit_buf) {
+		fprintf(stderr, "JIT: cannot map executable memory, disabled\n");
+		return;
+	}
+	jit_flush();
+
+	if (cache_file && *cache_file) {
+		cache = malloc(JIT_CACHE_SLOTS * sizeof(*cache));
+		cache_addr = malloc(JIT_CACHE_INSNS * sizeof(*cache_addr));
+		cache_code = malloc(JIT_CACHE_INSNS * sizeof(*cache_code));
+		if (!cache || !cache_addr || !cache_code) {
+			fprintf(stderr, "JIT: no memory for jit_cache\n");
+			free(cache);
+			free(cache_addr);
+			free(cache_code);
+			cache = NULL;
+			return;
+		}
+		cache_path = strdup(cache_file);
+		cache_reset();
+		cache_load();
+		atexit(cache_save);
+	}
+}
+
+void jit_flush(void)
+{
+	int i;
+
+	jit_recording = false;
+	if (!jit_buf)
+		return;
+
+	for (i = 0; i < DCACHE_SIZE; i++) {
+		dcache[i].hits = 0;
+		dcache[i].block = NULL;
+	}
+	memset(jit_code_page, 0, sizeof(jit_code_page));
+	memset(jit_page_list, 0, sizeof(jit_page_list));
+	jit_nblocks = 0;
+	jit_used = 0;
+
+	/* A handler inside a block flushed us: leave it before the next insn */
+	if (jit_running)
+		nInst = 0;
+}
+
+void jit_invalidate(uw32 addr)
+{
+	uw32 p = (addr & ADDR_MASK) >> JIT_PAGE_SHIFT;
+	uw32 q;
+
+	addr &= ADDR_MASK;
+	/* Blocks are far shorter than a page, so look at this page and the one before */
+	for (q = p ? p - 1 : p; q <= p; q++) {
+		struct jit_block **bp = &jit_page_list[q];
+
+		while (*bp) {
+			struct jit_block *b = *bp;
+			dcache_entry *e;
+
+			if (addr < b->start || addr >= b->end) {
+				bp = &b->next;
+				continue;
+			}
+			*bp = b->next;
+			e = &dcache[(b->start >> 1) & DCACHE_MASK];
+			if (e->block == b) {
+				e->block = NULL;
+				e->hits = 0;
+			}
+			if (b == jit_running)
+				nInst = 0;
+		}
+	}
+}
+
+void jit_run(dcache_entry *e)
+{
+	struct jit_block *b = e->block;
+
+	if (unlikely(jit_recording))
+		jit_record_close();
+	jit_running = b;
+	b->fn();
+	jit_running = NULL;
+}
+
+/* Called before the interpreter executes e while recording or when e went hot */
+void jit_record(dcache_entry *e)
+{
+	if (jit_recording) {
+		if (e->addr != rec.next)
+			jit_record_close();
+		else
+			rec.n++;
+	} else {
+		if (!jit_buf || asyncTrace)
+			return;
+		if (jit_used + JIT_BLOCK_BYTES > JIT_BUF_SIZE ||
+		    jit_nblocks == JIT_MAX_BLOCKS)
+			jit_flush();
+		jit_recording = true;
+		rec.head = e;
+		rec.n = 1;
+	}
+	if (jit_recording) {
+		rec.addr[rec.n - 1] = e->addr;
+		rec.code[rec.n - 1] = e->code;
+		rec.handler[rec.n - 1] = e->handler;
+	}
+}
+
+/* Called after the interpreter executed the last recorded instruction */
+void jit_record_step(void)
+{
+	int i = rec.n - 1;
+	uw32 next = (uw32)((Ptr)pc - (Ptr)memBase);
+
+	if (exception || extraFlag) {
+		/* Keep the block to what ran cleanly before this instruction */
+		rec.n--;
+		rec.next = rec.addr[i];
+		jit_record_close();
+		return;
+	}
+	rec.next = next;
+	if (ends_block(rec.code[i]) || rec.n == JIT_MAX_INSNS ||
+	    next <= rec.addr[i] || next > rec.addr[i] + 10)
+		jit_record_close();
+}
@@ -0,0 +1,53 @@
+/*
+ * jit.h
+ *
+ * Basic-block translator for the 68K dispatch loop (x86-64 and arm64).
+ *
+ * Sits on top of the decode cache.  Each cache entry counts how often the
+ * instruction at its address is dispatched; once an entry goes hot the
+ * interpreter records the straight-line run that follows, up to the next
+ * control-flow instruction, and the run is translated into a host
+ * function.  The host code does what ExecuteLoop does per instruction -
+ * budget check, cycle count, set code and pc, call the opcode's
+ * handler - with every constant folded in, and leaves the block as soon
+ * as pc is not where the next recorded instruction lives.  moveq, moves,
+ * add, sub and cmp between registers, addq, subq, tst, clr, Bcc and
+ * DBcc become host code that keeps the lazy flags the handlers expect;
+ * everything else calls the handler shared with the interpreter, so rare
+ * opcodes, exceptions and MMIO behave exactly the same.
+ *
+ * Stores into a 4K page holding translated code drop the blocks that
+ * cover the written address (see dcache_store()).
+ */
+
+#ifndef JIT_H
+#define JIT_H
+
+#include "QL68000.h"
+
+#define JIT_PAGE_SHIFT	12
+#define JIT_PAGES	((ADDR_MASK + 1) >> JIT_PAGE_SHIFT)
+#define JIT_THRESHOLD	64	/* dispatches before a block is recorded */
+#define JIT_MAX_INSNS	64	/* instructions per block */
+
+struct dcache_entry;
+struct jit_block;
+
+extern uw8 jit_code_page[JIT_PAGES];
+extern uw8 jit_cache_page[JIT_PAGES];
+extern Cond jit_recording;
+
+/* cache_file, if set, keeps the recordings of the blocks translated
+   across runs (see jit.c) */
+void jit_init(int enable, const char *cache_file);
+void jit_flush(void);
+void jit_invalidate(uw32 addr);
+void jit_run(struct dcache_entry *e);
+void jit_record(struct dcache_entry *e);
+void jit_record_step(void);
+
+/* dcache_fill hook for pages with blocks in the jit_cache: translates the
+   block recorded at e->addr without waiting for it to go hot */
+void jit_cache_fill(struct dcache_entry *e);
+
+#endif /* JIT_H */
@@ -0,0 +1,28 @@
+/*
+ * machine_local.h
+ *
+ * Storage class for machine state.  Built with MULTI_INSTANCE the CPU
+ * core, the memory map, the scheduler, the cycle counter and the decode
+ * cache have one copy per thread; the handler table and other read-only
+ * data stay shared.  That is the core only: frameBuffer and the display
+ * state, the UART, the ESP8266, the other peripherals and the p8audio
+ * model (which runs on a thread of its own) are one per process.  So
+ * several cores with their own RAM can run as threads, but not whole
+ * instances such as funcval runs, which all drive the framebuffer and
+ * p8audio.
+ */
+
+#ifndef MACHINE_LOCAL_H
+#define MACHINE_LOCAL_H
+
+#ifdef MULTI_INSTANCE
+#ifdef __cplusplus
+#define MACHINE_LOCAL	thread_local
+#else
+#define MACHINE_LOCAL	_Thread_local
+#endif
+#else
+#define MACHINE_LOCAL
+#endif
+
+#endif /* MACHINE_LOCAL_H */
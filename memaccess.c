@@ -6,10 +6,13 @@
 /* define memory access fns */
 #include "QL68000.h"
 #include "memaccess.h"
+#include "btrace.h"
+#include "gdbstub.h"
 #include "general.h"
 #include "QL_screen.h"
 #include "SDL2screen.h"
 #include "unixstuff.h"
+#include <string.h>
 #include <unistd.h>
 
 #ifdef NEXTP8
@@ -21,17 +24,76 @@
 #include "profiler/profiler_events.h"
 #endif
 
+#ifdef DECODE_CACHE
+#include "decode_cache.h"
+#define DCACHE_STORE(_a_)	dcache_store(_a_)
+#else
+#define DCACHE_STORE(_a_)
+#endif
+
 extern bool asyncTrace;
 extern bool rom_write_protect;
 
+/* asyncTrace output, as text or into the binary trace (see btrace.h) */
+
+static void trace_rd_b(aw32 addr, rw8 v)
+{
+	if (btrace_on)
+		btraceMem(BT_MEM_RD_B, addr, (unsigned)v & 0xff);
+	if (!BTRACE_TEXT())
+		return;
+	if (addr & 1)
+		printf("MEM RD: addr=0x%x data=0xzz%02x\n", addr, (unsigned)v & 0xff);
+	else
+		printf("MEM RD: addr=0x%x data=0x%02xzz\n", addr, (unsigned)v & 0xff);
+}
+
+static void trace_rd_hb(aw32 addr, rw8 v)
+{
+	if (btrace_on)
+		btraceMem(BT_MEM_RD_HB, addr, (unsigned)(((v << 8) | v)) & 0xffff);
+	if (BTRACE_TEXT())
+		printf("MEM RD: addr=0x%x data=0x%x\n", addr, (unsigned)(((v << 8) | v)) & 0xffff);
+}
+
+static void trace_rd_w(aw32 addr, rw16 v)
+{
+	if (btrace_on)
+		btraceMem(BT_MEM_RD_W, addr, (unsigned)v & 0xffff);
+	if (BTRACE_TEXT())
+		printf("MEM RD: addr=0x%x data=0x%x\n", addr, (unsigned)v & 0xffff);
+}
+
+// 68000 is big-endian: high word at addr, low word at addr+2
+static void trace_rd_l(aw32 addr, rw32 v)
+{
+	trace_rd_w(addr, v >> 16);
+	trace_rd_w(addr + 2, v);
+}
+
+static void trace_wr_b(aw32 addr, aw8 d)
+{
+	if (btrace_on)
+		btraceMem(BT_MEM_WR_B, addr, (unsigned)(((d << 8) | d)) & 0xffff);
+	if (BTRACE_TEXT())
+		printf("MEM WR: addr=0x%x data=0x%x\n", addr, (unsigned)(((d << 8) | d)) & 0xffff);
+}
+
+static void trace_wr_w(aw32 addr, aw16 d)
+{
+	if (btrace_on)
+		btraceMem(BT_MEM_WR_W, addr, (unsigned)d & 0xffff);
+	if (BTRACE_TEXT())
+		printf("MEM WR: addr=0x%x data=0x%x\n", addr, (unsigned)d & 0xffff);
+}
+
 static void log_mem_wr_long(aw32 addr, aw32 d)
 {
-	if (!asyncTrace)
+	if (!BTRACE_ANY())
 		return;
 
-	// 68000 is big-endian: high word at addr, low word at addr+2
-	printf("MEM WR: addr=0x%x data=0x%x\n", addr, (unsigned)(d >> 16) & 0xffff);
-	printf("MEM WR: addr=0x%x data=0x%x\n", addr + 2, (unsigned)d & 0xffff);
+	trace_wr_w(addr, d >> 16);
+	trace_wr_w(addr + 2, d);
 }
 
 static int is_hw(uint32_t addr)
@@ -46,197 +108,421 @@ static int is_hw(uint32_t addr)
 	return 0;
 }
 
-rw8 ReadByte(aw32 addr)
+/*
+ * Page descriptors for the 16MB bus.  A page whose every byte is plain
+ * RAM (below RTOP, no hardware, no testbench, writable) maps straight to
+ * its host address; NULL sends the access to the *Slow() functions
+ * below, which only make the checks the page's MEM_* attributes call
+ * for.  Rebuilt by MemoryMapUpdate() whenever RTOP, the ROM protection
+ * or the testbench mode change.
+ */
+#define MEM_PAGE_SHIFT	12
+#define MEM_PAGE_SIZE	(1 << MEM_PAGE_SHIFT)
+#define MEM_PAGE_MASK	(MEM_PAGE_SIZE - 1)
+#define MEM_PAGES	((ADDR_MASK + 1) >> MEM_PAGE_SHIFT)
+
+#define MEM_HW		0x01	/* ReadHW / WriteHW */
+#define MEM_TESTBENCH	0x02	/* funcval testbench */
+#define MEM_TRAP	0x04	/* holds a trap-on-write or console address */
+#define MEM_ROM		0x08	/* writes are dropped */
+#define MEM_VOID	0x10	/* above RTOP and the screen: reads 0, writes dropped */
+#define MEM_TOP		0x20	/* straddles that boundary, check per access */
+#define MEM_CLEAN	0x40	/* not written since MemoryDirtyClear() */
+#define MEM_WATCH	0x80	/* holds a debugger watchpoint */
+
+static MACHINE_LOCAL Ptr mem_read_page[MEM_PAGES];
+static MACHINE_LOCAL Ptr mem_write_page[MEM_PAGES];
+static MACHINE_LOCAL uint8_t mem_page_attr[MEM_PAGES];
+MACHINE_LOCAL uint64_t mem_hw_accesses;
+
+/*
+ * Dirty page tracking: a clean page of plain RAM has no write pointer,
+ * so its first store takes the slow path, which marks it dirty and puts
+ * the pointer back.  RAM pages that are always slow count as dirty.
+ */
+static MACHINE_LOCAL bool dirty_track;
+static MACHINE_LOCAL uint8_t mem_dirty[MEM_PAGES];
+
+/* 1 for watched writes, 2 for reads as well */
+static uint8_t mem_watch[MEM_PAGES];
+
+#define IS_VOID(_attr_, _a_)	(((_attr_) & MEM_VOID) || \
+				 ((_a_) >= RTOP && (_a_) >= qlscreen.qm_hi))
+
+static int page_is_plain_ram(uw32 base)
 {
-	rw8 result;
-	addr &= ADDR_MASK;
+	uw32 last = base + MEM_PAGE_SIZE - 1;
 
-#ifdef PROFILER
-	Profiler_RecordDataRead(addr);
+	if (last >= RTOP)
+		return 0;
+	if (is_hw(base) || is_hw(last))
+		return 0;
+#ifdef NEXTP8
+	if (funcval_mode && (funcval_is_testbench_addr(base) ||
+			     funcval_is_testbench_addr(last)))
+		return 0;
 #endif
+	return 1;
+}
+
+static int page_is_writable(uw32 base)
+{
+	uw32 last = base + MEM_PAGE_SIZE - 1;
+
+	/* debug console and non-writable marker words */
+	if ((0x7ffffe >= base && 0x7ffffe <= last) ||
+	    (0xfffffe >= base && 0xfffffe <= last))
+		return 0;
+	if (rom_write_protect && base < QL_SCREEN_BASE)
+		return 0;
+	return 1;
+}
+
+static uint8_t page_attr(uw32 base)
+{
+	uw32 last = base + MEM_PAGE_SIZE - 1;
+	uw32 top = RTOP > qlscreen.qm_hi ? RTOP : qlscreen.qm_hi;
+	uint8_t attr = 0;
+
+	if (is_hw(base) || is_hw(last))
+		attr |= MEM_HW;
+#ifdef NEXTP8
+	if (funcval_mode && (funcval_is_testbench_addr(base) ||
+			     funcval_is_testbench_addr(last)))
+		attr |= MEM_TESTBENCH;
+#endif
+	if ((0x7ffffe >= base && 0x7fffff <= last) ||
+	    (0xfffffe >= base && 0xffffff <= last) ||
+	    (rom_write_protect && base < 32768))
+		attr |= MEM_TRAP;
+	if (rom_write_protect && base < QL_SCREEN_BASE)
+		attr |= MEM_ROM;
+	if (base >= top)
+		attr |= MEM_VOID;
+	else if (last >= top)
+		attr |= MEM_TOP;
+	if (mem_watch[base >> MEM_PAGE_SHIFT])
+		attr |= MEM_WATCH;
+	return attr;
+}
+
+static void page_written(aw32 addr)
+{
+	uw32 i = (addr & ADDR_MASK) >> MEM_PAGE_SHIFT;
+
+	if (!(mem_page_attr[i] & MEM_CLEAN))
+		return;
+	mem_page_attr[i] &= ~MEM_CLEAN;
+	if (!mem_watch[i])
+		mem_write_page[i] = (Ptr)memBase + (i << MEM_PAGE_SHIFT);
+	mem_dirty[i] = 1;
+}
+
+static void protect_clean(void)
+{
+	uw32 i;
+
+	for (i = 0; i < MEM_PAGES; i++) {
+		uint8_t attr = mem_page_attr[i];
+
+		if ((attr & MEM_CLEAN) || mem_dirty[i])
+			continue;
+		if (mem_write_page[i]) {
+			mem_write_page[i] = NULL;
+			mem_page_attr[i] = attr | MEM_CLEAN;
+		} else if ((i << MEM_PAGE_SHIFT) < (uw32)RTOP &&
+			   !(attr & (MEM_HW | MEM_TESTBENCH | MEM_ROM | MEM_VOID))) {
+			mem_dirty[i] = 1;
+		}
+	}
+}
+
+void MemoryMapUpdate(void)
+{
+	uw32 i, base;
+
+	for (i = 0; i < MEM_PAGES; i++) {
+		base = i << MEM_PAGE_SHIFT;
+		mem_page_attr[i] = page_attr(base);
+		mem_read_page[i] = NULL;
+		mem_write_page[i] = NULL;
+		if (!page_is_plain_ram(base))
+			continue;
+		if (mem_watch[i] < 2)
+			mem_read_page[i] = (Ptr)memBase + base;
+		if (page_is_writable(base) && !mem_watch[i])
+			mem_write_page[i] = (Ptr)memBase + base;
+	}
+	if (dirty_track)
+		protect_clean();
+}
+
+void MemoryWatchClear(void)
+{
+	memset(mem_watch, 0, sizeof(mem_watch));
+}
+
+void MemoryWatchRange(uint32_t addr, uint32_t len, int reads)
+{
+	uw32 p;
+
+	if (!len || addr > ADDR_MASK)
+		return;
+	if (len > ADDR_MASK + 1 - addr)
+		len = ADDR_MASK + 1 - addr;
+	for (p = addr >> MEM_PAGE_SHIFT; p <= (addr + len - 1) >> MEM_PAGE_SHIFT; p++) {
+		if (mem_watch[p] < (reads ? 2 : 1))
+			mem_watch[p] = reads ? 2 : 1;
+	}
+}
+
+void MemoryDirtyTrack(int on)
+{
+	dirty_track = on;
+	memset(mem_dirty, 0, sizeof(mem_dirty));
+	MemoryMapUpdate();
+}
+
+void MemoryDirtyClear(void)
+{
+	memset(mem_dirty, 0, sizeof(mem_dirty));
+	protect_clean();
+}
+
+int MemoryPageDirty(uint32_t page)
+{
+	return mem_dirty[page];
+}
+
+void *MemoryHostRange(uint32_t addr, uint32_t len, int write)
+{
+	uw32 p;
+
+	if (len == 0 || addr > ADDR_MASK || len > ADDR_MASK + 1 - addr)
+		return NULL;
+	for (p = addr >> MEM_PAGE_SHIFT; p <= (addr + len - 1) >> MEM_PAGE_SHIFT; p++) {
+		if (write && (mem_page_attr[p] & MEM_CLEAN))
+			continue;
+		// DMA isn't watched
+		if ((mem_page_attr[p] & MEM_WATCH) && page_is_plain_ram(p << MEM_PAGE_SHIFT) &&
+		    (!write || page_is_writable(p << MEM_PAGE_SHIFT)))
+			continue;
+		if (!(write ? mem_write_page[p] : mem_read_page[p]))
+			return NULL;
+	}
+	// The caller writes to it next
+	if (write && dirty_track) {
+		for (p = addr >> MEM_PAGE_SHIFT; p <= (addr + len - 1) >> MEM_PAGE_SHIFT; p++)
+			page_written(p << MEM_PAGE_SHIFT);
+	}
+	return (Ptr)memBase + addr;
+}
+
+void *MemoryCPURange(uint32_t addr, uint32_t len, int write)
+{
+	uw32 p;
+
+	if (len == 0 || addr > ADDR_MASK || len > ADDR_MASK + 1 - addr)
+		return NULL;
+	for (p = addr >> MEM_PAGE_SHIFT; p <= (addr + len - 1) >> MEM_PAGE_SHIFT; p++) {
+		if (mem_page_attr[p] & MEM_WATCH)
+			return NULL;
+	}
+	return MemoryHostRange(addr, len, write);
+}
+
+void MemoryDMAWritten(uint32_t addr, uint32_t len)
+{
+#ifdef DECODE_CACHE
+	dcache_invalidate_range(addr, len);
+#endif
+	if (dirty_track && len) {
+		uw32 p;
+
+		for (p = addr >> MEM_PAGE_SHIFT; p <= (addr + len - 1) >> MEM_PAGE_SHIFT &&
+		     p < MEM_PAGES; p++) {
+			page_written(p << MEM_PAGE_SHIFT);
+			mem_dirty[p] = 1;
+		}
+	}
+}
+
+static rw8 ReadByteSlow(aw32 addr)
+{
+	int attr = mem_page_attr[addr >> MEM_PAGE_SHIFT];
+	rw8 result;
+
+	if (unlikely(attr & MEM_WATCH))
+		gdbWatchAccess(addr, 1, false);
 
 #ifdef NEXTP8
 	/* Check for FuncVal testbench access (3MB-4MB range) */
-	if (funcval_mode && funcval_is_testbench_addr(addr)) {
+	if ((attr & MEM_TESTBENCH) && funcval_is_testbench_addr(addr)) {
 		result = funcval_read_byte(addr);
-		if (asyncTrace) {
-			if (addr & 1)
-				printf("MEM RD: addr=0x%x data=0xzz%02x\n", addr, (unsigned)result & 0xff);
-			else
-				printf("MEM RD: addr=0x%x data=0x%02xzz\n", addr, (unsigned)result & 0xff);
-		}
+		if (BTRACE_ANY())
+			trace_rd_b(addr, result);
 		return result;
 	}
 #endif
 
-	if (is_hw(addr)) {
+	if ((attr & MEM_HW) && is_hw(addr)) {
+		mem_hw_accesses++;
 		result = ReadHWByte(addr);
-		if (asyncTrace) {
-			printf("MEM RD: addr=0x%x data=0x%x\n", addr, (unsigned)(((result << 8) | result)) & 0xffff);
-		}
+		if (BTRACE_ANY())
+			trace_rd_hb(addr, result);
 		return result;
 	}
 
-	if ((addr >= RTOP) && (addr >=qlscreen.qm_hi)) {
+	if ((attr & (MEM_VOID | MEM_TOP)) && IS_VOID(attr, addr)) {
 		result = 0;
-		if (asyncTrace) {
-			if (addr & 1)
-				printf("MEM RD: addr=0x%x data=0xzz%02x\n", addr, (unsigned)result & 0xff);
-			else
-				printf("MEM RD: addr=0x%x data=0x%02xzz\n", addr, (unsigned)result & 0xff);
-		}
+		if (BTRACE_ANY())
+			trace_rd_b(addr, result);
 		return result;
 	}
 
 	result = *((w8 *)memBase + addr);
-	if (asyncTrace) {
-		if (addr & 1)
-			printf("MEM RD: addr=0x%x data=0xzz%02x\n", addr, (unsigned)result & 0xff);
-		else
-			printf("MEM RD: addr=0x%x data=0x%02xzz\n", addr, (unsigned)result & 0xff);
-	}
+	if (BTRACE_ANY())
+		trace_rd_b(addr, result);
 	return result;
 }
 
-rw16 ReadWord(aw32 addr)
+static rw16 ReadWordSlow(aw32 addr)
 {
+	int attr = mem_page_attr[addr >> MEM_PAGE_SHIFT];
 	rw16 result;
-	addr &= ADDR_MASK;
 
-#ifdef PROFILER
-	Profiler_RecordDataRead(addr);
-#endif
+	if (unlikely(attr & MEM_WATCH))
+		gdbWatchAccess(addr, 2, false);
 
 #ifdef NEXTP8
 	/* Check for FuncVal testbench access (3MB-4MB range) */
-	if (funcval_mode && funcval_is_testbench_addr(addr)) {
+	if ((attr & MEM_TESTBENCH) && funcval_is_testbench_addr(addr)) {
 		result = funcval_read_word(addr);
-		if (asyncTrace) printf("MEM RD: addr=0x%x data=0x%x\n", addr, (unsigned)result & 0xffff);
+		if (BTRACE_ANY()) trace_rd_w(addr, result);
 		return result;
 	}
 #endif
 
-	if (is_hw(addr)) {
+	if ((attr & MEM_HW) && is_hw(addr)) {
+		mem_hw_accesses++;
 		result = (w16)ReadHWWord(addr);
-		if (asyncTrace) printf("MEM RD: addr=0x%x data=0x%x\n", addr, (unsigned)result & 0xffff);
+		if (BTRACE_ANY()) trace_rd_w(addr, result);
 		return result;
 	}
 
-	if ((addr >= RTOP) && (addr >=qlscreen.qm_hi)) {
+	if ((attr & (MEM_VOID | MEM_TOP)) && IS_VOID(attr, addr)) {
 		result = 0;
-		if (asyncTrace) printf("MEM RD: addr=0x%x data=0x%x\n", addr, (unsigned)result & 0xffff);
+		if (BTRACE_ANY()) trace_rd_w(addr, result);
 		return result;
 	}
 
 	result = (w16)RW((w16 *)((Ptr)memBase + addr)); /* make sure it is signed */
-	if (asyncTrace) printf("MEM RD: addr=0x%x data=0x%x\n", addr, (unsigned)result & 0xffff);
+	if (BTRACE_ANY()) trace_rd_w(addr, result);
 	return result;
 }
 
-rw32 ReadLong(aw32 addr)
+static rw32 ReadLongSlow(aw32 addr)
 {
+	int attr = mem_page_attr[addr >> MEM_PAGE_SHIFT];
 	rw32 result;
-	addr &= ADDR_MASK;
 
-#ifdef PROFILER
-	Profiler_RecordDataRead(addr);
-#endif
+	if (unlikely(attr & MEM_WATCH))
+		gdbWatchAccess(addr, 4, false);
 
 #ifdef NEXTP8
 	/* Check for FuncVal testbench access (3MB-4MB range) */
-	if (funcval_mode && funcval_is_testbench_addr(addr)) {
+	if ((attr & MEM_TESTBENCH) && funcval_is_testbench_addr(addr)) {
 		result = funcval_read_long(addr);
-		if (asyncTrace) {
-			printf("MEM RD: addr=0x%x data=0x%x\n", addr, (unsigned)(result >> 16) & 0xffff);
-			printf("MEM RD: addr=0x%x data=0x%x\n", addr + 2, (unsigned)result & 0xffff);
-		}
+		if (BTRACE_ANY())
+			trace_rd_l(addr, result);
 		return result;
 	}
 #endif
 
-	if (is_hw(addr)) {
+	if ((attr & MEM_HW) && is_hw(addr)) {
+		mem_hw_accesses++;
 		result = (w32)ReadHWLong(addr);
-		if (asyncTrace) {
-			printf("MEM RD: addr=0x%x data=0x%x\n", addr, (unsigned)(result >> 16) & 0xffff);
-			printf("MEM RD: addr=0x%x data=0x%x\n", addr + 2, (unsigned)result & 0xffff);
-		}
+		if (BTRACE_ANY())
+			trace_rd_l(addr, result);
 		return result;
 	}
 
-	if ((addr >= RTOP) && (addr >=qlscreen.qm_hi)) {
+	if ((attr & (MEM_VOID | MEM_TOP)) && IS_VOID(attr, addr)) {
 		result = 0;
-		if (asyncTrace) {
-			printf("MEM RD: addr=0x%x data=0x%x\n", addr, (unsigned)(result >> 16) & 0xffff);
-			printf("MEM RD: addr=0x%x data=0x%x\n", addr + 2, (unsigned)result & 0xffff);
-		}
+		if (BTRACE_ANY())
+			trace_rd_l(addr, result);
 		return result;
 	}
 
 	result = (w32)RL((Ptr)memBase + addr); /* make sure is is signed */
-	if (asyncTrace) {
-		printf("MEM RD: addr=0x%x data=0x%x\n", addr, (unsigned)(result >> 16) & 0xffff);
-		printf("MEM RD: addr=0x%x data=0x%x\n", addr + 2, (unsigned)result & 0xffff);
-	}
+	if (BTRACE_ANY())
+		trace_rd_l(addr, result);
 	return result;
 }
 
-void WriteByte(aw32 addr,aw8 d)
+static void WriteByteSlow(aw32 addr,aw8 d)
 {
-	addr &= ADDR_MASK;
+	int attr = mem_page_attr[addr >> MEM_PAGE_SHIFT];
 
-#ifdef PROFILER
-	Profiler_RecordDataWrite(addr);
-#endif
+	if (unlikely(attr & MEM_WATCH))
+		gdbWatchAccess(addr, 1, true);
+
+	if (attr & MEM_CLEAN) {
+		page_written(addr);
+		attr &= ~MEM_CLEAN;
+	}
 
-	if ((addr == 0x7ffffe || addr == 0x7fffff || (addr < 32768 && rom_write_protect))) {
+	if ((attr & MEM_TRAP) &&
+	    (addr == 0x7ffffe || addr == 0x7fffff || (addr < 32768 && rom_write_protect))) {
 		printf("\n*** Write to non-writable address 0x%x (value=0x%02x) ***\n", addr, d & 0xff);
 		DbgInfo();
 		exit(1);
 	}
 
-	if (addr == 0xfffffe) {
-		write(1, &d, 1);
-		if (asyncTrace) printf("MEM WR: addr=0x%x data=0x%x\n", addr, (unsigned)(((d << 8) | d)) & 0xffff);
-		return;
-	} else if (addr == 0xffffff) {
-		write(2, &d, 1);
-		if (asyncTrace) printf("MEM WR: addr=0x%x data=0x%x\n", addr, (unsigned)(((d << 8) | d)) & 0xffff);
+	if ((attr & MEM_TRAP) && (addr == 0xfffffe || addr == 0xffffff)) {
+		write(addr == 0xfffffe ? 1 : 2, &d, 1);
+		if (BTRACE_ANY()) trace_wr_b(addr, d);
 		return;
 	}
 
 #ifdef NEXTP8
 	/* Check for FuncVal testbench access (3MB-4MB range) */
-	if (funcval_mode && funcval_is_testbench_addr(addr)) {
+	if ((attr & MEM_TESTBENCH) && funcval_is_testbench_addr(addr)) {
 		funcval_write_byte(addr, d);
-		if (asyncTrace) printf("MEM WR: addr=0x%x data=0x%x\n", addr, (unsigned)(((d << 8) | d)) & 0xffff);
+		if (BTRACE_ANY()) trace_wr_b(addr, d);
 		return;
 	}
 #endif
 
-	if (is_hw(addr)) {
+	if ((attr & MEM_HW) && is_hw(addr)) {
+		mem_hw_accesses++;
 		WriteHWByte(addr, d);
-		if (asyncTrace) printf("MEM WR: addr=0x%x data=0x%x\n", addr, (unsigned)(((d << 8) | d)) & 0xffff);
+		if (BTRACE_ANY()) trace_wr_b(addr, d);
 		return;
 	}
 
-	if ((addr >= RTOP) && (addr >= qlscreen.qm_hi))
+	if ((attr & MEM_ROM) || ((attr & (MEM_VOID | MEM_TOP)) && IS_VOID(attr, addr)))
 		return;
 
-	if (!rom_write_protect || addr >= QL_SCREEN_BASE) {
-		*((w8 *)memBase + addr) = d;
-		if (asyncTrace) printf("MEM WR: addr=0x%x data=0x%x\n", addr, (unsigned)(((d << 8) | d)) & 0xffff);
-	}
+	*((w8 *)memBase + addr) = d;
+	DCACHE_STORE(addr);
+	if (BTRACE_ANY()) trace_wr_b(addr, d);
 }
 
-void WriteWord(aw32 addr,aw16 d)
+static void WriteWordSlow(aw32 addr,aw16 d)
 {
-	addr &= ADDR_MASK;
+	int attr = mem_page_attr[addr >> MEM_PAGE_SHIFT];
 
-#ifdef PROFILER
-	Profiler_RecordDataWrite(addr);
-#endif
+	if (unlikely(attr & MEM_WATCH))
+		gdbWatchAccess(addr, 2, true);
 
-	if ((addr == 0x7ffffe || addr == 0x7fffff || (addr < 32768 && rom_write_protect))) {
+	if (attr & MEM_CLEAN) {
+		page_written(addr);
+		attr &= ~MEM_CLEAN;
+	}
+
+	if ((attr & MEM_TRAP) &&
+	    (addr == 0x7ffffe || addr == 0x7fffff || (addr < 32768 && rom_write_protect))) {
 		printf("\n*** Write to non-writable address 0x%x (value=0x%04x) ***\n", addr, d & 0xffff);
 		DbgInfo();
 		exit(1);
@@ -244,37 +530,45 @@ void WriteWord(aw32 addr,aw16 d)
 
 #ifdef NEXTP8
 	/* Check for FuncVal testbench access (3MB-4MB range) */
-	if (funcval_mode && funcval_is_testbench_addr(addr)) {
+	if ((attr & MEM_TESTBENCH) && funcval_is_testbench_addr(addr)) {
 		funcval_write_word(addr, d);
-		if (asyncTrace) printf("MEM WR: addr=0x%x data=0x%x\n", addr, (unsigned)d & 0xffff);
+		if (BTRACE_ANY()) trace_wr_w(addr, d);
 		return;
 	}
 #endif
 
-	if (is_hw(addr)) {
+	if ((attr & MEM_HW) && is_hw(addr)) {
+		mem_hw_accesses++;
 		WriteHWWord(addr, d);
-		if (asyncTrace) printf("MEM WR: addr=0x%x data=0x%x\n", addr, (unsigned)d & 0xffff);
+		if (BTRACE_ANY()) trace_wr_w(addr, d);
 		return;
 	}
 
-	if ((addr >= RTOP) && (addr >= qlscreen.qm_hi))
+	if ((attr & MEM_ROM) || ((attr & (MEM_VOID | MEM_TOP)) && IS_VOID(attr, addr)))
 		return;
 
-	if (!rom_write_protect || addr >= QL_SCREEN_BASE) {
-		WW((Ptr)memBase + addr, d);
-		if (asyncTrace) printf("MEM WR: addr=0x%x data=0x%x\n", addr, (unsigned)d & 0xffff);
-	}
+	WW((Ptr)memBase + addr, d);
+	DCACHE_STORE(addr);
+	if (BTRACE_ANY()) trace_wr_w(addr, d);
 }
 
-void WriteLong(aw32 addr,aw32 d)
+static void WriteLongSlow(aw32 addr,aw32 d)
 {
-	addr &= ADDR_MASK;
+	int attr = mem_page_attr[addr >> MEM_PAGE_SHIFT];
 
-#ifdef PROFILER
-	Profiler_RecordDataWrite(addr);
-#endif
+	// Or the page a long store at the end of this one reaches into
+	if (unlikely((attr | mem_page_attr[((addr + 2) & ADDR_MASK) >> MEM_PAGE_SHIFT]) & MEM_WATCH))
+		gdbWatchAccess(addr, 4, true);
 
-	if ((addr == 0x7ffffe || addr == 0x7fffff || (addr < 32768 && rom_write_protect))) {
+	if (attr & MEM_CLEAN) {
+		page_written(addr);
+		attr &= ~MEM_CLEAN;
+	}
+	// A long store at the end of a page reaches into the next one
+	page_written(addr + 2);
+
+	if ((attr & MEM_TRAP) &&
+	    (addr == 0x7ffffe || addr == 0x7fffff || (addr < 32768 && rom_write_protect))) {
 		printf("\n*** Write to non-writable address 0x%x (value=0x%08x) ***\n", addr, d);
 		DbgInfo();
 		exit(1);
@@ -282,27 +576,147 @@ void WriteLong(aw32 addr,aw32 d)
 
 #ifdef NEXTP8
 	/* Check for FuncVal testbench access (3MB-4MB range) */
-	if (funcval_mode && funcval_is_testbench_addr(addr)) {
+	if ((attr & MEM_TESTBENCH) && funcval_is_testbench_addr(addr)) {
 		funcval_write_long(addr, d);
 		log_mem_wr_long(addr, d);
 		return;
 	}
 #endif
 
-	if (is_hw(addr)) {
-		WriteHWWord(addr, d >> 16);
-		WriteHWWord(addr + 2, d);
+	if ((attr & MEM_HW) && is_hw(addr)) {
+		mem_hw_accesses++;
+		WriteHWLong(addr, d);
 		log_mem_wr_long(addr, d);
 		return;
 	}
 
-	if ((addr >= RTOP) && (addr >=qlscreen.qm_hi))
+	if ((attr & MEM_ROM) || ((attr & (MEM_VOID | MEM_TOP)) && IS_VOID(attr, addr)))
 		return;
 
-	if (!rom_write_protect || addr >= QL_SCREEN_BASE) {
-		WL((Ptr)memBase + addr, d);
-		log_mem_wr_long(addr, d);
+	WL((Ptr)memBase + addr, d);
+	DCACHE_STORE(addr);
+	DCACHE_STORE(addr + 2);
+	log_mem_wr_long(addr, d);
+}
+
+rw8 ReadByte(aw32 addr)
+{
+	Ptr p;
+	rw8 result;
+	addr &= ADDR_MASK;
+
+#ifdef PROFILER
+	Profiler_RecordDataRead(addr);
+#endif
+
+	p = mem_read_page[addr >> MEM_PAGE_SHIFT];
+	if (unlikely(p == NULL))
+		return ReadByteSlow(addr);
+
+	result = *((w8 *)p + (addr & MEM_PAGE_MASK));
+	if (BTRACE_ANY())
+		trace_rd_b(addr, result);
+	return result;
+}
+
+rw16 ReadWord(aw32 addr)
+{
+	Ptr p;
+	rw16 result;
+	addr &= ADDR_MASK;
+
+#ifdef PROFILER
+	Profiler_RecordDataRead(addr);
+#endif
+
+	p = mem_read_page[addr >> MEM_PAGE_SHIFT];
+	if (unlikely(p == NULL))
+		return ReadWordSlow(addr);
+
+	result = (w16)RW((w16 *)(p + (addr & MEM_PAGE_MASK)));
+	if (BTRACE_ANY()) trace_rd_w(addr, result);
+	return result;
+}
+
+rw32 ReadLong(aw32 addr)
+{
+	Ptr p;
+	rw32 result;
+	addr &= ADDR_MASK;
+
+#ifdef PROFILER
+	Profiler_RecordDataRead(addr);
+#endif
+
+	p = mem_read_page[addr >> MEM_PAGE_SHIFT];
+	if (unlikely(p == NULL))
+		return ReadLongSlow(addr);
+
+	result = (w32)RL(p + (addr & MEM_PAGE_MASK));
+	if (BTRACE_ANY())
+		trace_rd_l(addr, result);
+	return result;
+}
+
+void WriteByte(aw32 addr,aw8 d)
+{
+	Ptr p;
+	addr &= ADDR_MASK;
+
+#ifdef PROFILER
+	Profiler_RecordDataWrite(addr);
+#endif
+
+	p = mem_write_page[addr >> MEM_PAGE_SHIFT];
+	if (unlikely(p == NULL)) {
+		WriteByteSlow(addr, d);
+		return;
+	}
+
+	*((w8 *)p + (addr & MEM_PAGE_MASK)) = d;
+	DCACHE_STORE(addr);
+	if (BTRACE_ANY()) trace_wr_b(addr, d);
+}
+
+void WriteWord(aw32 addr,aw16 d)
+{
+	Ptr p;
+	addr &= ADDR_MASK;
+
+#ifdef PROFILER
+	Profiler_RecordDataWrite(addr);
+#endif
+
+	p = mem_write_page[addr >> MEM_PAGE_SHIFT];
+	if (unlikely(p == NULL)) {
+		WriteWordSlow(addr, d);
+		return;
 	}
+
+	WW(p + (addr & MEM_PAGE_MASK), d);
+	DCACHE_STORE(addr);
+	if (BTRACE_ANY()) trace_wr_w(addr, d);
+}
+
+void WriteLong(aw32 addr,aw32 d)
+{
+	Ptr p;
+	addr &= ADDR_MASK;
+
+#ifdef PROFILER
+	Profiler_RecordDataWrite(addr);
+#endif
+
+	p = mem_write_page[addr >> MEM_PAGE_SHIFT];
+	if (unlikely(p == NULL || (addr & MEM_PAGE_MASK) > MEM_PAGE_SIZE - 4)) {
+		WriteLongSlow(addr, d);
+		return;
+	}
+
+	WL(p + (addr & MEM_PAGE_MASK), d);
+	DCACHE_STORE(addr);
+	DCACHE_STORE(addr + 2);
+	log_mem_wr_long(addr, d);
 }
 
 /*############################################################*/
@@ -341,12 +755,7 @@ rw8 ModifyAtEA_b(ashort mode,ashort r)
 		break;
 	case 6:
 		displ = (w16)RW_PC(pc++);
-		if ((displ & 2048) != 0)
-			addr = reg[(displ >> 12) & 15] +
-			       aReg[r] + (w32)((w8)displ);
-		else
-			addr = (w32)((w16)(reg[(displ >> 12) & 15])) +
-			       aReg[r] + (w32)((w8)displ);
+		addr = IndexEA(aReg[r], displ);
 		break;
 	case 7:
 		switch (r)
@@ -422,12 +831,7 @@ rw16 ModifyAtEA_w(ashort mode,ashort r)
 		break;
 	case 6:
 		displ = (w16)RW_PC(pc++);
-		if ((displ & 2048) != 0)
-			addr = reg[(displ >> 12) & 15] +
-			       aReg[r] + (w32)((w8)displ);
-		else
-			addr = (w32)((w16)(reg[(displ >> 12) & 15])) +
-			       aReg[r] + (w32)((w8)displ);
+		addr = IndexEA(aReg[r], displ);
 		break;
 	case 7:
 		switch (r)
@@ -490,12 +894,7 @@ rw32 ModifyAtEA_l(ashort mode, ashort r)
 		break;
 	case 6:
 		displ = (w16)RW_PC(pc++);
-		if ((displ & 2048) != 0)
-			addr = reg[(displ >> 12) & 15] +
-			       aReg[r] + (w32)((w8)displ);
-		else
-			addr = (w32)((w16)(reg[(displ >> 12) & 15])) +
-			       aReg[r] + (w32)((w8)displ);
+		addr = IndexEA(aReg[r], displ);
 		break;
 	case 7:
 		switch (r)
@@ -8,6 +8,9 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
+
+#include "machine_local.h"
 
 int8_t ReadByte(int32_t addr);
 int16_t ReadWord(int32_t addr);
@@ -15,6 +18,32 @@ int32_t ReadLong(int32_t addr);
 void WriteByte(int32_t addr,int8_t d);
 void WriteWord(int32_t addr,int16_t d);
 void WriteLong(int32_t addr,int32_t d);
+void MemoryMapUpdate(void);
+
+/* Host address of len bytes of plain RAM at addr, writable if write is
+   set, or NULL; for DMA, which must then report writes as below */
+void *MemoryHostRange(uint32_t addr, uint32_t len, int write);
+/* The same for the CPU's own bulk accesses (movem, DBRA loops), which
+   the debugger must see: NULL if a page holds a watchpoint */
+void *MemoryCPURange(uint32_t addr, uint32_t len, int write);
+/* Anything storing to guest RAM through memBase (DMA, file loads, ROM
+   patches) reports it here, for the decode cache and dirty tracking */
+void MemoryDMAWritten(uint32_t addr, uint32_t len);
+
+/* Tracks the pages of RAM written since MemoryDirtyClear(), for rewind */
+#define MEM_DIRTY_PAGE_SIZE	4096
+void MemoryDirtyTrack(int on);
+void MemoryDirtyClear(void);
+int MemoryPageDirty(uint32_t page);
+
+/* Debugger watchpoints: accesses to the pages holding len bytes at addr,
+   writes only unless reads is set, take the slow path and are passed to
+   gdbWatchAccess().  Applied by the next MemoryMapUpdate() */
+void MemoryWatchClear(void);
+void MemoryWatchRange(uint32_t addr, uint32_t len, int reads);
+
+/* Guest accesses to HW registers, a long one counting once */
+extern MACHINE_LOCAL uint64_t mem_hw_accesses;
 
 int8_t ModifyAtEA_b(int16_t mode, int16_t r);
 int16_t ModifyAtEA_w(int16_t mode, int16_t r);
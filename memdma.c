@@ -0,0 +1,187 @@
+/*
+ * memdma.c
+ *
+ * Memory DMA registers, see memdma.h.  Each range is resolved to host
+ * memory when the transfer completes and moved with one memmove() or
+ * memset() where it can be; DA memory holds host order words, so
+ * transfers to or from it go a byte at a time.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "QL68000.h"
+#include "QL_sound.h"
+#include "general.h"
+#include "memaccess.h"
+#include "memdma.h"
+#include "savestate.h"
+#include "scheduler.h"
+
+#define MEMDMA_REGS	(_MEMDMA_SIZE / 2)
+
+#if __BYTE_ORDER == __BIG_ENDIAN
+#define DA_SWAP		0
+#else
+#define DA_SWAP		1
+#endif
+
+#define R(name)		(regs[MEMDMA_REG_##name >> 1])
+
+/* One end of a transfer: byte n of it is p[(off + n) ^ swap] */
+typedef struct {
+	uint8_t *p;
+	uint32_t off;
+	unsigned swap;
+	bool ram;
+} dma_side;
+
+static bool dma_enabled;
+static int dma_rate;
+static uint16_t regs[MEMDMA_REGS];
+static uint16_t dma_ctrl;		/* of the transfer running */
+static uint16_t dma_status;
+static sched_event dma_event;
+
+static bool dma_resolve(dma_side *s, uint32_t addr, uint32_t len, int write)
+{
+	s->off = 0;
+	s->swap = 0;
+	s->ram = false;
+	if (addr - _DA_MEMORY_BASE < _DA_MEMORY_SIZE) {
+		if (len > _DA_MEMORY_BASE + _DA_MEMORY_SIZE - addr)
+			return false;
+		s->p = (uint8_t *)da_memory;
+		s->off = addr - _DA_MEMORY_BASE;
+		s->swap = DA_SWAP;
+		return true;
+	}
+	s->p = MemoryHostRange(addr, len, write);
+	if (s->p) {
+		s->ram = true;
+		return true;
+	}
+	s->p = HWHostRange(addr, len, write);
+	return s->p != NULL;
+}
+
+static bool dma_transfer(void)
+{
+	bool fill = dma_ctrl & MEMDMA_CTRL_FILL;
+	bool hold_src = dma_ctrl & MEMDMA_CTRL_HOLD_SRC;
+	bool hold_dst = dma_ctrl & MEMDMA_CTRL_HOLD_DST;
+	uint32_t src = (uint32_t)R(SRC_HI) << 16 | R(SRC_LO);
+	uint32_t dst = (uint32_t)R(DST_HI) << 16 | R(DST_LO);
+	uint32_t len = (uint32_t)R(LEN_HI) << 16 | R(LEN_LO);
+	uint32_t dlen = hold_dst ? 1 : len;
+	uint8_t hi = R(FILL) >> 8, lo = R(FILL) & 0xff;
+	dma_side s = { NULL }, d;
+	uint32_t i, di;
+
+	if (len == 0)
+		return true;
+	if (!fill && !dma_resolve(&s, src, hold_src ? 1 : len, 0))
+		return false;
+	if (!dma_resolve(&d, dst, dlen, 1))
+		return false;
+
+	if (!hold_src && !hold_dst && !s.swap && !d.swap && (!fill || hi == lo)) {
+		if (fill)
+			memset(d.p + d.off, hi, len);
+		else
+			memmove(d.p + d.off, s.p + s.off, len);
+	} else {
+		for (i = 0; i < len; i++) {
+			di = hold_dst ? 0 : i;
+			if (fill)
+				d.p[(d.off + di) ^ d.swap] = (dst + di) & 1 ? lo : hi;
+			else
+				d.p[(d.off + di) ^ d.swap] =
+					s.p[(s.off + (hold_src ? 0 : i)) ^ s.swap];
+		}
+	}
+	if (d.ram)
+		MemoryDMAWritten(dst, dlen);
+	return true;
+}
+
+static void memdma_complete(void *arg)
+{
+	dma_status = MEMDMA_STATUS_DONE | (dma_transfer() ? 0 : MEMDMA_STATUS_ERROR);
+	if (dma_ctrl & MEMDMA_CTRL_IRQ)
+		RaiseInterrupt(MEMDMA_IRQ_LEVEL);
+}
+
+void memdma_init(int enable, int rate)
+{
+	dma_enabled = enable;
+	dma_rate = rate > 0 ? rate : 0;
+	dma_status = 0;
+	memset(regs, 0, sizeof(regs));
+	schedInit(&dma_event, "memdma", memdma_complete, NULL);
+}
+
+uint16_t memdma_read(unsigned reg)
+{
+	if (!dma_enabled || reg >= _MEMDMA_SIZE)
+		return 0;
+
+	switch (reg) {
+	case MEMDMA_REG_ID:
+		return MEMDMA_ID;
+	case MEMDMA_REG_CTRL:
+		return dma_status;
+	}
+	return regs[reg >> 1];
+}
+
+void memdma_write(unsigned reg, uint16_t d)
+{
+	uint64_t len;
+
+	if (!dma_enabled || reg >= _MEMDMA_SIZE || (dma_status & MEMDMA_STATUS_BUSY))
+		return;
+
+	switch (reg) {
+	case MEMDMA_REG_ID:
+		break;
+	case MEMDMA_REG_CTRL:
+		if (d & MEMDMA_CTRL_ACK) {
+			dma_status = 0;
+			ClearInterrupt(MEMDMA_IRQ_LEVEL);
+		}
+		if (d & MEMDMA_CTRL_START) {
+			dma_ctrl = d;
+			dma_status = MEMDMA_STATUS_BUSY;
+			len = (uint32_t)R(LEN_HI) << 16 | R(LEN_LO);
+			schedAt(&dma_event, dma_rate ? (len + dma_rate - 1) / dma_rate : 0);
+		}
+		break;
+	default:
+		regs[reg >> 1] = d;
+		break;
+	}
+}
+
+void memdma_save_state(ss_buf *b)
+{
+	int i;
+
+	for (i = 0; i < MEMDMA_REGS; i++)
+		ssPut16(b, regs[i]);
+	ssPut16(b, dma_ctrl);
+	ssPut16(b, dma_status);
+}
+
+int memdma_load_state(ss_buf *b)
+{
+	int i;
+
+	for (i = 0; i < MEMDMA_REGS; i++)
+		regs[i] = ssGet16(b);
+	dma_ctrl = ssGet16(b);
+	dma_status = ssGet16(b);
+	// The completion, if BUSY, comes back with the scheduler's events
+	return b->error ? -1 : 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * memdma.h
+ *
+ * Emulator-only memory DMA registers (--memdma), for the bulk copies
+ * guest code does by hand today: cart loading, map copies and DA sample
+ * streaming.  A transfer moves LEN bytes from SRC to DST, or fills DST
+ * with FILL, between guest RAM (which holds the p8audio SFX and music
+ * data), the frame and overlay buffers, the palettes and DA memory.
+ * Either address can be held instead of incremented.  FILL is a big
+ * endian word: bytes at even addresses take its high byte.  ID reads 0
+ * when disabled.
+ *
+ * A transfer stays BUSY for --memdma_rate bytes an instruction and the
+ * bytes move when it completes, raising MEMDMA_IRQ_LEVEL with CTRL_IRQ
+ * until acknowledged.
+ *
+ * All registers are 16 bits, big endian:
+ *   +0x00 ID          'MD' (0x4d44) when enabled
+ *   +0x02 CTRL        write: bit 0 start, bit 1 fill, bit 2 hold SRC,
+ *                     bit 3 hold DST, bit 4 interrupt when done,
+ *                     bit 15 clear DONE and ERROR
+ *         STATUS      read: bit 0 BUSY, bit 1 DONE, bit 2 ERROR (a range
+ *                     isn't all in one of the areas above)
+ *   +0x04 SRC_HI
+ *   +0x06 SRC_LO
+ *   +0x08 DST_HI
+ *   +0x0a DST_LO
+ *   +0x0c LEN_HI
+ *   +0x0e LEN_LO      bytes
+ *   +0x10 FILL
+ */
+
+#ifndef MEMDMA_H
+#define MEMDMA_H
+
+#include <stdint.h>
+
+#ifndef _MEMDMA_BASE
+#define _MEMDMA_BASE		0x8f0070
+#endif
+#define _MEMDMA_SIZE		0x20
+
+#define MEMDMA_ID		0x4d44
+#define MEMDMA_IRQ_LEVEL	4
+
+#define MEMDMA_CTRL_START	0x0001
+#define MEMDMA_CTRL_FILL	0x0002
+#define MEMDMA_CTRL_HOLD_SRC	0x0004
+#define MEMDMA_CTRL_HOLD_DST	0x0008
+#define MEMDMA_CTRL_IRQ		0x0010
+#define MEMDMA_CTRL_ACK		0x8000
+#define MEMDMA_STATUS_BUSY	0x0001
+#define MEMDMA_STATUS_DONE	0x0002
+#define MEMDMA_STATUS_ERROR	0x0004
+
+#define MEMDMA_REG_ID		0x00
+#define MEMDMA_REG_CTRL		0x02
+#define MEMDMA_REG_SRC_HI	0x04
+#define MEMDMA_REG_SRC_LO	0x06
+#define MEMDMA_REG_DST_HI	0x08
+#define MEMDMA_REG_DST_LO	0x0a
+#define MEMDMA_REG_LEN_HI	0x0c
+#define MEMDMA_REG_LEN_LO	0x0e
+#define MEMDMA_REG_FILL		0x10
+
+struct ss_buf;
+
+/* rate: bytes moved in an instruction's time, 0 to finish at once */
+void memdma_init(int enable, int rate);
+
+/* Word access to the register at offset reg */
+uint16_t memdma_read(unsigned reg);
+void memdma_write(unsigned reg, uint16_t d);
+
+/* Save state: the registers and a transfer in progress */
+void memdma_save_state(struct ss_buf *b);
+int memdma_load_state(struct ss_buf *b);
+
+#endif /* MEMDMA_H */
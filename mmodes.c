@@ -30,12 +30,7 @@ rw32 AREGP GetEA_m6(ashort r)
 	/*w16*/ shindex displ;
 
 	displ = (w16)RW_PC(pc++);
-	if ((displ & 2048) != 0)
-		return *(((w32 *)((Ptr)reg + ((displ >> 10) & 60)))) + aReg[r] +
-		       (w32)((w8)displ);
-	/*        register access */
-	return (w32)(*((w16 *)((Ptr)reg + RWO + ((displ >> 10) & 60)))) +
-	       aReg[r] + (w32)((w8)displ);
+	return IndexEA(aReg[r], displ);
 }
 
 rw32 AREGP GetEA_m7(ashort r)
@@ -53,11 +48,7 @@ rw32 AREGP GetEA_m7(ashort r)
 		return (Ptr)pc - (Ptr)memBase - 2 + displ;
 	case 3:
 		displ = (w16)RW_PC(pc++);
-		if ((displ & 2048) != 0)
-			return reg[(displ >> 12) & 15] + (Ptr)pc - (Ptr)memBase -
-			       2 + (w32)((w8)displ);
-		return (w32)((w16)(reg[(displ >> 12) & 15])) + (Ptr)pc -
-		       (Ptr)memBase - 2 + (w32)((w8)displ);
+		return IndexEA((Ptr)pc - (Ptr)memBase - 2, displ);
 	}
 	exception = 4;
 	extraFlag = true;
@@ -66,16 +57,48 @@ rw32 AREGP GetEA_m7(ashort r)
 	return 0;
 }
 
+/* 68020 full extension word: suppressed base or index, a word or long
+   base displacement and memory indirection, pre- or postindexed */
+rw32 IndexEAFull(w32 base, uw16 ext)
+{
+	w32 x = 0, bd = 0, od = 0;
+
+	if (ext & 0x80)
+		base = 0;
+	if ((ext & 0x40) == 0) {
+		x = reg[(ext >> 12) & 15];
+		if ((ext & 2048) == 0)
+			x = (w16)x;
+		x <<= (ext >> 9) & 3;
+	}
+	switch ((ext >> 4) & 3) {
+	case 2:
+		bd = (w16)RW_PC(pc++);
+		break;
+	case 3:
+		bd = RL_PC((w32 *)pc);
+		pc += 2;
+		break;
+	}
+	if ((ext & 3) == 0)
+		return base + bd + x;
+	if ((ext & 3) == 2) {
+		od = (w16)RW_PC(pc++);
+	} else if ((ext & 3) == 3) {
+		od = RL_PC((w32 *)pc);
+		pc += 2;
+	}
+	if (ext & 4)
+		return ReadLong(base + bd) + x + od;
+	return ReadLong(base + bd + x) + od;
+}
+
 rw32 GetEA_m7_3(void)
 {
 	/*w16*/ shindex displ;
 
 	displ = (w16)RW_PC(pc++);
-	if ((displ & 2048) != 0)
-		return reg[(displ >> 12) & 15] + (Ptr)pc - (Ptr)memBase - 2 +
-		       (w32)((w8)displ);
-	return (w32)((w16)(reg[(displ >> 12) & 15])) + (Ptr)pc - (Ptr)memBase -
-	       2 + (w32)((w8)displ);
+	return IndexEA((Ptr)pc - (Ptr)memBase - 2, displ);
 }
 
 rw8 GetFromEA_b_m2(void)
@@ -222,12 +245,7 @@ rw16 GetFromEA_w_m6()
 {
 	/*w16*/ shindex displ;
 	displ = (w16)RW_PC(pc++);
-	return ReadWord(((displ & 2048) != 0) ?
-				(*((w32 *)((Ptr)reg + ((displ >> 10) & 60))) +
-				 aReg[code & 7] + (w32)((w8)displ)) :
-				(w32) * (((w16 *)((Ptr)reg + RWO +
-						  ((displ >> 10) & 60)))) +
-					aReg[code & 7] + (w32)((w8)displ));
+	return ReadWord(IndexEA(aReg[code & 7], displ));
 }
 
 rw16 GetFromEA_w_m7(void)
@@ -0,0 +1,402 @@
+/*
+ * netplay.c
+ *
+ * Rollback netplay, see netplay.h.  Frame f uses the inputs sampled at
+ * f - delay; frames up to delay use none.  Both sides keep every input
+ * from the oldest one the peer hasn't acknowledged and send them all
+ * each frame, so a lost packet costs nothing but a later rollback.
+ */
+
+#ifdef NEXTP8
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define NETPLAY_UDP
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "SDL2screen.h"
+#include "netplay.h"
+#include "rewind.h"
+#include "savestate.h"
+#include "unixstuff.h"
+
+#define NP_MAGIC	"SQNP"
+#define NP_VERSION	1
+#define NP_HISTORY	128	/* frames of inputs kept, a power of two */
+#define NP_MAX_SEND	40	/* inputs in one packet */
+#define NP_MAX_AHEAD	8	/* frames guessed before waiting for the peer */
+#define NP_MAX_DELAY	16
+#define NP_TIMEOUT_MS	5000
+#define NP_WAIT_MS	20
+#define NP_KEYROWS	32
+
+typedef struct np_input {
+	uint8_t joy;
+	uint8_t keyrow[NP_KEYROWS];
+} np_input;
+
+bool netplay_on;
+
+static int player, delay;
+static np_input local_in[NP_HISTORY];
+static np_input remote_in[NP_HISTORY];
+static np_input used_remote[NP_HISTORY];	/* what each frame assumed */
+static uint64_t local_have, remote_have;	/* inputs known below these */
+static uint64_t remote_acked;		/* the peer has ours below this */
+static uint64_t rollback_from = UINT64_MAX;
+static uint64_t sent_frame;
+static bool resim;
+static bool warned_player;
+
+/* The frame running, in the save state and rewind points */
+static uint64_t frame;
+static np_input cur[2];			/* by player */
+static uint8_t np_joy_latched[2];
+static uint8_t key_latched[NP_KEYROWS];
+
+#define IN(ring, f)	((ring)[(f) & (NP_HISTORY - 1)])
+
+#ifdef NETPLAY_UDP
+static int fd = -1;
+static ss_buf out;
+
+static int udp_open(const char *peer, int port)
+{
+	struct addrinfo hints, *res;
+	const char *colon = strrchr(peer, ':');
+	char host[256];
+	int s, err;
+
+	if (!colon || colon == peer || (size_t)(colon - peer) >= sizeof(host)) {
+		fprintf(stderr, "Netplay: %s is not host:port\n", peer);
+		return -1;
+	}
+	memcpy(host, peer, colon - peer);
+	host[colon - peer] = 0;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	err = getaddrinfo(host, colon + 1, &hints, &res);
+	if (err) {
+		fprintf(stderr, "Netplay: %s: %s\n", peer, gai_strerror(err));
+		return -1;
+	}
+
+	s = socket(res->ai_family, SOCK_DGRAM, 0);
+	if (s < 0) {
+		perror("netplay");
+		freeaddrinfo(res);
+		return -1;
+	}
+	if (res->ai_family == AF_INET6) {
+		struct sockaddr_in6 addr;
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sin6_family = AF_INET6;
+		addr.sin6_addr = in6addr_any;
+		addr.sin6_port = htons(port);
+		err = bind(s, (struct sockaddr *)&addr, sizeof(addr));
+	} else {
+		struct sockaddr_in addr;
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		addr.sin_port = htons(port);
+		err = bind(s, (struct sockaddr *)&addr, sizeof(addr));
+	}
+	if (err < 0 || connect(s, res->ai_addr, res->ai_addrlen) < 0 ||
+	    fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK) < 0) {
+		perror("netplay_port");
+		close(s);
+		s = -1;
+	}
+	freeaddrinfo(res);
+	return s;
+}
+
+static void put_input(ss_buf *b, const np_input *in)
+{
+	ssPut8(b, in->joy);
+	ssPut(b, in->keyrow, NP_KEYROWS);
+}
+
+static void get_input(ss_buf *b, np_input *in)
+{
+	in->joy = ssGet8(b);
+	ssGet(b, in->keyrow, NP_KEYROWS);
+}
+
+/* Every input the peer hasn't acknowledged, and what we have of its */
+static void send_inputs(void)
+{
+	uint64_t f, first = remote_acked;
+	unsigned n;
+
+	if (local_have - first > NP_MAX_SEND)
+		first = local_have - NP_MAX_SEND;
+	n = local_have - first;
+
+	out.len = 0;
+	out.error = false;
+	ssPut(&out, NP_MAGIC, 4);
+	ssPut8(&out, NP_VERSION);
+	ssPut8(&out, player);
+	ssPut32(&out, remote_have);
+	ssPut32(&out, first);
+	ssPut8(&out, n);
+	for (f = first; f < local_have; f++)
+		put_input(&out, &IN(local_in, f));
+	if (!out.error)
+		send(fd, out.data, out.len, 0);
+	sent_frame = frame;
+}
+
+static void receive_packet(uint8_t *data, size_t len)
+{
+	ss_buf b = { data, len };
+	char magic[4];
+	uint64_t f, first, acked;
+	unsigned i, n;
+	int from;
+
+	ssGet(&b, magic, 4);
+	if (memcmp(magic, NP_MAGIC, 4) || ssGet8(&b) != NP_VERSION)
+		return;
+	from = ssGet8(&b);
+	acked = ssGet32(&b);
+	first = ssGet32(&b);
+	n = ssGet8(&b);
+	if (b.error)
+		return;
+	if (from == player) {
+		if (!warned_player)
+			fprintf(stderr, "Netplay: the peer is player %d too\n", player);
+		warned_player = true;
+		return;
+	}
+	if (acked > remote_acked && acked <= local_have)
+		remote_acked = acked;
+
+	for (i = 0; i < n; i++) {
+		np_input in;
+
+		f = first + i;
+		get_input(&b, &in);
+		if (b.error)
+			break;
+		// Only the next one, and not so far ahead that the ring wraps
+		if (f != remote_have || f >= frame + NP_HISTORY / 2)
+			continue;
+		IN(remote_in, f) = in;
+		remote_have = f + 1;
+		if (f <= frame && f < rollback_from &&
+		    memcmp(&in, &IN(used_remote, f), sizeof(in)))
+			rollback_from = f;
+	}
+}
+
+static void receive(void)
+{
+	uint8_t buf[16 + NP_MAX_SEND * (1 + NP_KEYROWS)];
+	ssize_t n;
+
+	while ((n = recv(fd, buf, sizeof(buf), 0)) >= 0)
+		receive_packet(buf, n);
+}
+
+static bool too_far_ahead(void)
+{
+	return frame + 1 >= remote_have + NP_MAX_AHEAD ||
+	       local_have - remote_acked >= NP_HISTORY / 2;
+}
+
+static void wait_for_peer(void)
+{
+	uint32_t start = SDL_GetTicks();
+	struct pollfd p = { fd, POLLIN, 0 };
+
+	while (too_far_ahead()) {
+		if (SDL_GetTicks() - start > NP_TIMEOUT_MS) {
+			fprintf(stderr, "Netplay: nothing from the peer for %d seconds, playing on alone\n",
+				NP_TIMEOUT_MS / 1000);
+			netplay_on = false;
+			close(fd);
+			fd = -1;
+			return;
+		}
+		send_inputs();
+		poll(&p, 1, NP_WAIT_MS);
+		receive();
+	}
+}
+#endif /* NETPLAY_UDP */
+
+/* Back to before the first wrong guess and on to now with the real inputs */
+static void rollback(void)
+{
+	uint64_t to = frame;
+	int64_t back;
+
+	back = rewindToFrame(rollback_from - 1);
+	rollback_from = UINT64_MAX;
+	if (back < 0) {
+		fprintf(stderr, "Netplay: can't roll back that far, out of sync\n");
+		return;
+	}
+	resim = true;
+	QLRunFrames(to - back);
+	resim = false;
+}
+
+bool netplayInit(const char *peer, int port, int p, int d)
+{
+	if (!peer || !*peer)
+		return false;
+#ifdef NETPLAY_UDP
+	if (p != 1 && p != 2) {
+		fprintf(stderr, "Netplay: netplay_player must be 1 or 2\n");
+		return false;
+	}
+	if (d < 0 || d > NP_MAX_DELAY) {
+		fprintf(stderr, "Netplay: netplay_delay must be 0 to %d, using %d\n",
+			NP_MAX_DELAY, d < 0 ? 0 : NP_MAX_DELAY);
+		d = d < 0 ? 0 : NP_MAX_DELAY;
+	}
+	fd = udp_open(peer, port);
+	if (fd < 0)
+		return false;
+	player = p;
+	delay = d;
+	local_have = remote_have = remote_acked = delay + 1;
+	netplay_on = true;
+	printf("Netplay: player %d, peer %s, UDP port %d, %d frames of delay\n",
+	       player, peer, port, delay);
+#else
+	fprintf(stderr, "Netplay: not supported on this platform\n");
+#endif
+	return netplay_on;
+}
+
+void netplayFrame(void)
+{
+	const np_input *remote;
+	np_input prev[2];
+	uint64_t f;
+	int r, s;
+
+	if (!netplay_on)
+		return;
+	frame++;
+
+	f = frame + delay;
+	if (!resim && f >= local_have) {
+		const input_state *in = inputSnapshot();
+		np_input *l = &IN(local_in, f);
+
+		l->joy = in->joy[0];
+		for (r = 0; r < NP_KEYROWS; r++)
+			l->keyrow[r] = in->keyrow[r];
+		local_have = f + 1;
+	}
+
+	// Until it arrives the peer is taken to hold on to its last input
+	remote = frame < remote_have ? &IN(remote_in, frame) : &IN(remote_in, remote_have - 1);
+	IN(used_remote, frame) = *remote;
+
+	memcpy(prev, cur, sizeof(prev));
+	cur[player - 1] = IN(local_in, frame);
+	cur[2 - player] = *remote;
+	for (s = 0; s < 2; s++)
+		np_joy_latched[s] |= cur[s].joy & ~prev[s].joy;
+	for (r = 0; r < NP_KEYROWS; r++)
+		key_latched[r] |= (cur[0].keyrow[r] | cur[1].keyrow[r]) &
+				  ~(prev[0].keyrow[r] | prev[1].keyrow[r]);
+}
+
+void netplayPoll(void)
+{
+	if (!netplay_on || resim)
+		return;
+#ifdef NETPLAY_UDP
+	receive();
+	if (too_far_ahead())
+		wait_for_peer();
+	if (!netplay_on)
+		return;
+	if (rollback_from <= frame)
+		rollback();
+	if (frame != sent_frame)
+		send_inputs();
+#endif
+}
+
+uint8_t netplayJoy(int slot)
+{
+	return cur[slot].joy;
+}
+
+uint8_t netplayJoyLatched(int slot)
+{
+	return np_joy_latched[slot];
+}
+
+void netplayJoyLatchClear(int slot, uint8_t bits)
+{
+	np_joy_latched[slot] &= ~bits;
+}
+
+uint8_t netplayKeyrow(int row)
+{
+	return cur[0].keyrow[row] | cur[1].keyrow[row];
+}
+
+uint8_t netplayKeyrowLatched(int row)
+{
+	return key_latched[row];
+}
+
+void netplayKeyrowLatchClear(int row, uint8_t bits)
+{
+	key_latched[row] &= ~bits;
+}
+
+void netplaySaveState(ss_buf *b)
+{
+	int s;
+
+	ssPut64(b, frame);
+	for (s = 0; s < 2; s++) {
+		ssPut8(b, cur[s].joy);
+		ssPut(b, cur[s].keyrow, NP_KEYROWS);
+		ssPut8(b, np_joy_latched[s]);
+	}
+	ssPut(b, key_latched, NP_KEYROWS);
+}
+
+int netplayLoadState(ss_buf *b)
+{
+	int s;
+
+	frame = ssGet64(b);
+	for (s = 0; s < 2; s++) {
+		cur[s].joy = ssGet8(b);
+		ssGet(b, cur[s].keyrow, NP_KEYROWS);
+		np_joy_latched[s] = ssGet8(b);
+	}
+	ssGet(b, key_latched, NP_KEYROWS);
+	return b->error ? -1 : 0;
+}
+
+#endif /* NEXTP8 */
@@ -0,0 +1,56 @@
+/*
+ * netplay.h
+ *
+ * Rollback netplay for two players (--netplay <host:port>).  Every frame
+ * the local joystick and keyboard levels are sampled, sent to the peer
+ * over UDP and used --netplay_delay frames later on both sides.  Until
+ * the peer's input for a frame arrives its last one is assumed; when the
+ * real one differs, the machine goes back to the rewind point of the
+ * frame before and runs the frames since again with QLRunFrames().  A
+ * side that gets too far ahead of the other waits for it.
+ *
+ * The guest sees player 1's joystick as joystick 0, player 2's as
+ * joystick 1 and the two keyboards merged; latched bits are set for the
+ * levels that went up at a frame.  Both sides must run the same cart
+ * with the same options.  Netplay turns on cycle timing and takes a
+ * rewind point every frame; what else the host decides (the RTC, the
+ * p8audio status, the mouse) is not shared and must not steer the game.
+ *
+ * Packet, little endian: "SQNP", u8 version, u8 player, u32 frame the
+ * sender has the receiver's input below, u32 first frame, u8 count and
+ * count inputs (u8 joystick, 32 keyboard rows).
+ */
+
+#ifndef NETPLAY_H
+#define NETPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+extern bool netplay_on;
+
+/* Options: host:port of the peer, local UDP port, 1 or 2, frames of
+   input delay.  True if netplay is on */
+bool netplayInit(const char *peer, int port, int player, int delay);
+
+/* Emulator thread: a 50Hz frame has started */
+void netplayFrame(void);
+
+/* Emulator thread, between chunks: exchange inputs, roll back on a
+   wrong guess, wait when too far ahead */
+void netplayPoll(void);
+
+/* What the guest reads while netplay_on */
+uint8_t netplayJoy(int slot);
+uint8_t netplayJoyLatched(int slot);
+void netplayJoyLatchClear(int slot, uint8_t bits);
+uint8_t netplayKeyrow(int row);
+uint8_t netplayKeyrowLatched(int row);
+void netplayKeyrowLatchClear(int row, uint8_t bits);
+
+/* The inputs the frame running uses, a save state section */
+struct ss_buf;
+void netplaySaveState(struct ss_buf *b);
+int netplayLoadState(struct ss_buf *b);
+
+#endif /* NETPLAY_H */
@@ -0,0 +1,281 @@
+/*
+ * op_stats.c
+ *
+ * Handler, handler pair and addressing mode counts, see op_stats.h.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "QL68000.h"
+#include "op_stats.h"
+
+#define MAX_HANDLERS	1024
+#define MAX_NAMES	512
+#define SHOW_HANDLERS	40
+#define SHOW_PAIRS	32
+#define EA_BUCKETS	12	/* modes 0-6, then mode 7 registers 0-4 */
+
+enum { EA_GET_B, EA_GET_W, EA_GET_L, EA_PUT_B, EA_PUT_W, EA_PUT_L, EA_ADDR, EA_TABLES };
+
+Cond op_counting;
+
+static struct {
+	void (*f)(void);
+	const char *name;
+} names[MAX_NAMES];
+static int nnames;
+
+static void (*handlers[MAX_HANDLERS])(void);
+static uw16 handler_first[MAX_HANDLERS];	/* lowest opcode using it */
+static int nhandlers;
+static uw16 *op_index;				/* opcode to handler */
+static uint64_t handler_n[MAX_HANDLERS];
+static uint64_t *pair_n;			/* nhandlers squared */
+static uint64_t total;
+static int prev = -1;
+
+static uint64_t ea_n[EA_TABLES][EA_BUCKETS];
+
+static const char *const ea_table_names[EA_TABLES] = {
+	"GetFromEA_b", "GetFromEA_w", "GetFromEA_l",
+	"PutToEA_b", "PutToEA_w", "PutToEA_l", "GetEA",
+};
+
+static const char *const ea_bucket_names[EA_BUCKETS] = {
+	"Dn", "An", "(An)", "(An)+", "-(An)", "d16(An)", "d8(An,Xn)",
+	"abs.w", "abs.l", "d16(PC)", "d8(PC,Xn)", "#imm",
+};
+
+void opStatsName(void (*f)(void), const char *name)
+{
+	int i;
+
+	// Called as SetTable's argument was spelt, maybe with LR in front
+	if (!strncmp(name, "LR ", 3))
+		name += 3;
+	for (i = 0; i < nnames; i++) {
+		if (names[i].f == f)
+			return;
+	}
+	if (nnames < MAX_NAMES) {
+		names[nnames].f = f;
+		names[nnames].name = name;
+		nnames++;
+	}
+}
+
+static const char *handler_name(int h, char *buf, size_t size)
+{
+	int i;
+
+	for (i = 0; i < nnames; i++) {
+		if (names[i].f == handlers[h])
+			return names[i].name;
+	}
+	snprintf(buf, size, "op_%04x", handler_first[h]);
+	return buf;
+}
+
+static int ea_bucket(int mode, int r)
+{
+	return mode < 7 ? mode : 7 + (r < 4 ? r : 4);
+}
+
+/* Counting shims around the EA tables, the originals kept here */
+
+static rw8 (*get_b[8])(void);
+static rw16 (*get_w[8])(void);
+static rw32 (*get_l[8])(void);
+static void (*put_b[8])(ashort, aw8);
+static void (*put_w[8])(ashort, aw16);
+static void (*put_l[8])(ashort, aw32);
+static rw32 (*get_ea[8])(ashort);
+
+#define EA_SHIMS(_m_)							\
+static rw8 get_b_##_m_(void)						\
+{									\
+	ea_n[EA_GET_B][ea_bucket(_m_, code & 7)]++;			\
+	return get_b[_m_]();						\
+}									\
+static rw16 get_w_##_m_(void)						\
+{									\
+	ea_n[EA_GET_W][ea_bucket(_m_, code & 7)]++;			\
+	return get_w[_m_]();						\
+}									\
+static rw32 get_l_##_m_(void)						\
+{									\
+	ea_n[EA_GET_L][ea_bucket(_m_, code & 7)]++;			\
+	return get_l[_m_]();						\
+}									\
+static void put_b_##_m_(ashort r, aw8 d)				\
+{									\
+	ea_n[EA_PUT_B][ea_bucket(_m_, r)]++;				\
+	put_b[_m_](r, d);						\
+}									\
+static void put_w_##_m_(ashort r, aw16 d)				\
+{									\
+	ea_n[EA_PUT_W][ea_bucket(_m_, r)]++;				\
+	put_w[_m_](r, d);						\
+}									\
+static void put_l_##_m_(ashort r, aw32 d)				\
+{									\
+	ea_n[EA_PUT_L][ea_bucket(_m_, r)]++;				\
+	put_l[_m_](r, d);						\
+}									\
+static rw32 get_ea_##_m_(ashort r)					\
+{									\
+	ea_n[EA_ADDR][ea_bucket(_m_, r)]++;				\
+	return get_ea[_m_](r);						\
+}
+
+EA_SHIMS(0)
+EA_SHIMS(1)
+EA_SHIMS(2)
+EA_SHIMS(3)
+EA_SHIMS(4)
+EA_SHIMS(5)
+EA_SHIMS(6)
+EA_SHIMS(7)
+
+#define EA_WRAP(_m_)							\
+	do {								\
+		get_b[_m_] = GetFromEA_b[_m_];				\
+		GetFromEA_b[_m_] = get_b_##_m_;				\
+		get_w[_m_] = GetFromEA_w[_m_];				\
+		GetFromEA_w[_m_] = get_w_##_m_;				\
+		get_l[_m_] = GetFromEA_l[_m_];				\
+		GetFromEA_l[_m_] = get_l_##_m_;				\
+		put_b[_m_] = PutToEA_b[_m_];				\
+		PutToEA_b[_m_] = put_b_##_m_;				\
+		put_w[_m_] = PutToEA_w[_m_];				\
+		PutToEA_w[_m_] = put_w_##_m_;				\
+		put_l[_m_] = PutToEA_l[_m_];				\
+		PutToEA_l[_m_] = put_l_##_m_;				\
+		get_ea[_m_] = GetEA[_m_];				\
+		GetEA[_m_] = get_ea_##_m_;				\
+	} while (0)
+
+void op_count(uw16 c)
+{
+	int h = op_index[c];
+
+	handler_n[h]++;
+	total++;
+	if (prev >= 0)
+		pair_n[prev * nhandlers + h]++;
+	prev = h;
+}
+
+static const uint64_t *sort_base;
+
+static int count_cmp(const void *a, const void *b)
+{
+	uint64_t na = sort_base[*(const int *)a], nb = sort_base[*(const int *)b];
+
+	return na < nb ? 1 : na > nb ? -1 : 0;
+}
+
+static void op_stats_dump(void)
+{
+	static int order[MAX_HANDLERS];
+	char b1[16], b2[16];
+	int *porder;
+	int i, t, n = 0;
+
+	if (!total)
+		return;
+
+	for (i = 0; i < nhandlers; i++) {
+		if (handler_n[i])
+			order[n++] = i;
+	}
+	sort_base = handler_n;
+	qsort(order, n, sizeof(order[0]), count_cmp);
+	printf("Handlers: %" PRIu64 " instructions, %d of %d handlers ran\n",
+	       total, n, nhandlers);
+	for (i = 0; i < n && i < SHOW_HANDLERS; i++)
+		printf("  %-24s %14" PRIu64 " %6.2f%%\n",
+		       handler_name(order[i], b1, sizeof(b1)), handler_n[order[i]],
+		       100.0 * handler_n[order[i]] / total);
+
+	porder = malloc((size_t)nhandlers * nhandlers * sizeof(*porder));
+	if (porder) {
+		n = 0;
+		for (i = 0; i < nhandlers * nhandlers; i++) {
+			if (pair_n[i])
+				porder[n++] = i;
+		}
+		sort_base = pair_n;
+		qsort(porder, n, sizeof(porder[0]), count_cmp);
+		printf("Handler pairs: %d distinct\n", n);
+		for (i = 0; i < n && i < SHOW_PAIRS; i++)
+			printf("  %-24s %-24s %14" PRIu64 " %6.2f%%\n",
+			       handler_name(porder[i] / nhandlers, b1, sizeof(b1)),
+			       handler_name(porder[i] % nhandlers, b2, sizeof(b2)),
+			       pair_n[porder[i]], 100.0 * pair_n[porder[i]] / total);
+		free(porder);
+	}
+
+	printf("EA modes (generic handlers):\n  %-12s", "");
+	for (t = 0; t < EA_TABLES; t++)
+		printf(" %12s", ea_table_names[t]);
+	printf("\n");
+	for (i = 0; i < EA_BUCKETS; i++) {
+		printf("  %-12s", ea_bucket_names[i]);
+		for (t = 0; t < EA_TABLES; t++)
+			printf(" %12" PRIu64, ea_n[t][i]);
+		printf("\n");
+	}
+}
+
+void opStatsInit(bool enable)
+{
+	int c, h;
+
+	op_counting = false;
+	if (!enable)
+		return;
+
+	op_index = malloc(65536 * sizeof(*op_index));
+	if (!op_index)
+		return;
+	for (c = 0; c < 65536; c++) {
+		for (h = 0; h < nhandlers && handlers[h] != QLUX_HANDLER(c); h++)
+			;
+		if (h == nhandlers) {
+			if (nhandlers == MAX_HANDLERS) {
+				fprintf(stderr, "op_stats: more than %d handlers\n", MAX_HANDLERS);
+				free(op_index);
+				op_index = NULL;
+				return;
+			}
+			handlers[h] = QLUX_HANDLER(c);
+			handler_first[h] = c;
+			nhandlers++;
+		}
+		op_index[c] = h;
+	}
+	pair_n = calloc((size_t)nhandlers * nhandlers, sizeof(*pair_n));
+	if (!pair_n) {
+		free(op_index);
+		op_index = NULL;
+		return;
+	}
+
+	EA_WRAP(0);
+	EA_WRAP(1);
+	EA_WRAP(2);
+	EA_WRAP(3);
+	EA_WRAP(4);
+	EA_WRAP(5);
+	EA_WRAP(6);
+	EA_WRAP(7);
+
+	op_counting = true;
+	atexit(op_stats_dump);
+}
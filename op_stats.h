@@ -0,0 +1,33 @@
+/*
+ * op_stats.h
+ *
+ * Handler and addressing mode counts (--op_stats).  Every dispatched
+ * instruction is counted against the handler the opcode table holds for it,
+ * so the 64K opcodes fold into the few hundred functions that actually
+ * run, along with the pair of handlers it follows on from.  The
+ * GetFromEA_x, PutToEA_x and GetEA tables are wrapped with counting
+ * shims, so operand access by the generic handlers is counted by mode
+ * (mode 7 by register); the EA_VARIANTS handlers inline theirs and show
+ * up as handlers instead.  Fusion and the JIT are off while counting.
+ * The most frequent of each are printed at exit.
+ */
+
+#ifndef OP_STATS_H
+#define OP_STATS_H
+
+#include <stdbool.h>
+
+#include "QL68000.h"
+
+extern Cond op_counting;
+
+/* Name f in the report; SetTable() does this for what it installs */
+void opStatsName(void (*f)(void), const char *name);
+
+/* After the opcode table is complete */
+void opStatsInit(bool enable);
+
+/* Dispatch loop: opcode c is about to run */
+void op_count(uw16 c);
+
+#endif /* OP_STATS_H */
@@ -0,0 +1,31 @@
+/*
+ * optable.h
+ *
+ * The 68K opcode table expanded at build time (GENERATED_TABLE), so
+ * start-up doesn't parse the SetTable patterns.  gen_optable writes the
+ * 68000 table as a handler index per opcode and what the 68010 and 68020
+ * change; SetTabEntries() applies those, the EA variants and the names,
+ * and pseudo-ops are installed after as before.
+ */
+
+#ifndef OPTABLE_H
+#define OPTABLE_H
+
+#include <stdint.h>
+
+typedef struct {
+	uint16_t code;
+	uint16_t handler;	/* into optable_handlers */
+} optable_patch;
+
+extern void (*const optable_handlers[])(void);
+extern const char *const optable_names[];
+extern const int optable_nhandlers;
+extern const uint16_t optable_index[65536];
+
+extern const optable_patch optable_68010[];
+extern const int optable_68010_n;
+extern const optable_patch optable_68020[];
+extern const int optable_68020_n;
+
+#endif /* OPTABLE_H */
@@ -3,8 +3,10 @@
 
 #include <stdint.h>
 
+#include "machine_local.h"
+
 typedef int32_t w32;
-extern w32 *memBase;
+extern MACHINE_LOCAL w32 *memBase;
 #define m_memory ((uint8_t *)memBase)
 
 #define MEMORY_MISCFLAGS (0)
@@ -7,7 +7,8 @@
  *   - p8audio_verilated_init  (called from SDL2main.c)
  *   - p8audio_verilated_mmio_write  (called from reworked p8audio.c)
  *
- * Clock scheduling (all driven in the SDL audio callback thread):
+ * Clock scheduling (all driven on the audio producer thread, which runs
+ * up to audio_lookahead samples ahead of the audio mixer callback):
  *
  *   mclk      = 40 MHz
  *   clk_pcm   = 22.05 kHz  (one sample per edge)
@@ -23,18 +24,36 @@
 
 #include "p8audio_verilated.h"
 #include "p8_emu.h"     /* m_memory, memBase */
+#include "emulator_options.h"
+#include "audio_mixer.h"
+#include "audio_stats.h"
+#include "metrics.h"
+
+extern "C" {
+#include "memaccess.h"
+#include "pacer.h"
+#include "scheduler.h"
+}
 
 #include "Vp8audio.h"
 #include "Vp8audio___024root.h"
 #include "verilated.h"
+#include "verilated_save.h"
+#ifdef P8AUDIO_TRACE
+#include "verilated_fst_c.h"
+#endif
 
 #include <SDL.h>
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <cassert>
+#include <atomic>
+#include <mutex>
 #include <pthread.h>
 #include <stdint.h>
+#include <string>
 
 /*==============================================================
  * Clock ratios
@@ -45,54 +64,223 @@ static const int PCM_8X_PER_PCM   = 8;
 #define PCM_WID 12
 
 /* SDL output configuration */
-static const int SAMPLE_RATE_HW   = 22050;  /* matches clk_pcm */
-static const int SDL_BUFFER_SAMPLES = 1024; /* ~46 ms */
+static const int SAMPLE_RATE_HW   = AUDIO_MIXER_RATE;  /* matches clk_pcm */
 
 /*==============================================================
  * MMIO command queue (CPU thread → audio thread)
+ *
+ * Wait-free single-producer/single-consumer ring: only the emulator
+ * thread pushes and only the audio thread pops.  Each entry carries the
+ * emulated time of the write so the audio thread can apply it at the
+ * matching sample rather than all at the start of a buffer.
  *==============================================================*/
 struct mmio_cmd_t {
+    uint64_t emu_ns;
     uint8_t  byte_addr;
     uint16_t data;
 };
 
-static const int QUEUE_CAPACITY = 1024;
+static const uint32_t QUEUE_CAPACITY = 4096;   /* power of two */
 
-static mmio_cmd_t   s_queue_buf[QUEUE_CAPACITY];
-static int          s_queue_head = 0;   /* next slot to read  */
-static int          s_queue_tail = 0;   /* next slot to write */
-static int          s_queue_count = 0;
-static pthread_mutex_t s_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static mmio_cmd_t             s_queue_buf[QUEUE_CAPACITY];
+static std::atomic<uint32_t>  s_queue_head{0};  /* next slot to read, consumer owned  */
+static std::atomic<uint32_t>  s_queue_tail{0};  /* next slot to write, producer owned */
 
-/* Push a write – silently drops if queue is full (shouldn't happen). */
-extern "C" void p8audio_verilated_mmio_write(uint8_t byte_addr, uint16_t data)
+/* Returns false if the queue is full (shouldn't happen). */
+static bool queue_push(uint8_t byte_addr, uint16_t data, uint64_t emu_ns)
 {
-    pthread_mutex_lock(&s_queue_mutex);
-    if (s_queue_count < QUEUE_CAPACITY) {
-        s_queue_buf[s_queue_tail].byte_addr = byte_addr;
-        s_queue_buf[s_queue_tail].data      = data;
-        s_queue_tail = (s_queue_tail + 1) % QUEUE_CAPACITY;
-        s_queue_count++;
-    } else {
-        fprintf(stderr, "[p8audio_verilated] MMIO queue overflow – dropped write addr=0x%02x data=0x%04x\n",
-                byte_addr, data);
-    }
-    pthread_mutex_unlock(&s_queue_mutex);
+    uint32_t tail = s_queue_tail.load(std::memory_order_relaxed);
+    uint32_t head = s_queue_head.load(std::memory_order_acquire);
+
+    if (tail - head >= QUEUE_CAPACITY)
+        return false;
+    mmio_cmd_t &slot = s_queue_buf[tail & (QUEUE_CAPACITY - 1)];
+    slot.emu_ns    = emu_ns;
+    slot.byte_addr = byte_addr;
+    slot.data      = data;
+    s_queue_tail.store(tail + 1, std::memory_order_release);
+    return true;
 }
 
-/* Pop one entry.  Returns false if empty.  Call from audio thread only. */
-static bool queue_pop(mmio_cmd_t *out)
+/* Register byte addresses, as the ADDR_* localparams in p8audio.sv */
+static const uint8_t ADDR_SFX_BASE_HI   = 0x04;
+static const uint8_t ADDR_SFX_BASE_LO   = 0x06;
+static const uint8_t ADDR_MUSIC_BASE_HI = 0x08;
+static const uint8_t ADDR_MUSIC_BASE_LO = 0x0A;
+static const uint8_t ADDR_SFX_CMD       = 0x18;
+static const uint8_t ADDR_MUSIC_CMD     = 0x1C;
+
+/* Not registers: a p8audio_verilated_trace_mark(), and a DMA snapshot
+ * taken (data is its slot), in the queue so they land at their sample
+ * like a write */
+static const uint8_t TRACE_MARK_ADDR = 0xFF;
+static const uint8_t SNAPSHOT_ADDR   = 0xFE;
+
+/* Oldest entry, without removing it.  Returns nullptr if empty.  Call
+ * from audio thread only. */
+static const mmio_cmd_t *queue_peek(void)
 {
-    pthread_mutex_lock(&s_queue_mutex);
-    if (s_queue_count == 0) {
-        pthread_mutex_unlock(&s_queue_mutex);
-        return false;
+    uint32_t head = s_queue_head.load(std::memory_order_relaxed);
+
+    if (head == s_queue_tail.load(std::memory_order_acquire))
+        return nullptr;
+    return &s_queue_buf[head & (QUEUE_CAPACITY - 1)];
+}
+
+static void queue_drop(void)
+{
+    s_queue_head.store(s_queue_head.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_release);
+}
+
+/*==============================================================
+ * DMA snapshots (CPU thread → audio thread)
+ *
+ * The model fetches SFX and music data by DMA on the audio thread, a
+ * buffer or more away from where the emulator is, so reading guest RAM
+ * there races with the CPU writing it.  Instead the emulator thread
+ * copies the SFX and music data, at the bases last written to the
+ * registers, into a slot of a second ring before each SFX or music
+ * command and, if they have changed, on a poll every SNAP_POLL_INSNS,
+ * and queues a SNAPSHOT_ADDR entry naming the slot.  The audio thread
+ * takes the slot into its own copy at that entry's sample and serves
+ * DMA from there.  Words outside both, or a region that isn't plain
+ * RAM, still come from guest RAM.
+ *==============================================================*/
+static const uint32_t SFX_BYTES       = 64 * 68;   /* PICO-8 layout */
+static const uint32_t MUSIC_BYTES     = 64 * 4;
+static const uint32_t SNAP_SLOTS      = 32;        /* power of two */
+static const uint64_t SNAP_POLL_INSNS = 8192;
+
+struct dma_snapshot_t {
+    uint32_t sfx_base;
+    uint32_t music_base;
+    bool     sfx_valid;
+    bool     music_valid;
+    uint8_t  sfx[SFX_BYTES];
+    uint8_t  music[MUSIC_BYTES];
+};
+
+static dma_snapshot_t        s_snap_buf[SNAP_SLOTS];
+static std::atomic<uint32_t> s_snap_head{0};  /* slots taken, consumer owned */
+
+/* Emulator thread only */
+static uint32_t       s_snap_next = 0;     /* slots queued */
+static uint32_t       s_cpu_sfx_base = 0;
+static uint32_t       s_cpu_music_base = 0;
+static dma_snapshot_t s_snap_last;         /* as last queued */
+static bool           s_snap_force = true;
+static sched_event    s_snap_event;
+
+/* Audio thread only */
+static dma_snapshot_t s_dma_view;
+
+static const uint8_t *snap_region(uint32_t base, uint32_t len)
+{
+    return (const uint8_t *)MemoryHostRange(base, len, 0);
+}
+
+static void snap_fill(dma_snapshot_t &d, const uint8_t *sfx, const uint8_t *music)
+{
+    d.sfx_base    = s_cpu_sfx_base;
+    d.music_base  = s_cpu_music_base;
+    d.sfx_valid   = sfx != nullptr;
+    d.music_valid = music != nullptr;
+    if (sfx)
+        memcpy(d.sfx, sfx, SFX_BYTES);
+    if (music)
+        memcpy(d.music, music, MUSIC_BYTES);
+}
+
+/* Queue a snapshot at emu_ns unless nothing has changed since the last */
+static void snapshot_take(uint64_t emu_ns)
+{
+    const uint8_t *sfx = snap_region(s_cpu_sfx_base, SFX_BYTES);
+    const uint8_t *music = snap_region(s_cpu_music_base, MUSIC_BYTES);
+    const dma_snapshot_t &last = s_snap_last;
+
+    if (!s_snap_force &&
+        last.sfx_base == s_cpu_sfx_base && last.music_base == s_cpu_music_base &&
+        last.sfx_valid == (sfx != nullptr) && last.music_valid == (music != nullptr) &&
+        (!sfx || !memcmp(last.sfx, sfx, SFX_BYTES)) &&
+        (!music || !memcmp(last.music, music, MUSIC_BYTES)))
+        return;
+
+    /* Full: try again on the next poll */
+    s_snap_force = true;
+    if (s_snap_next - s_snap_head.load(std::memory_order_acquire) >= SNAP_SLOTS)
+        return;
+    uint32_t idx = s_snap_next & (SNAP_SLOTS - 1);
+    snap_fill(s_snap_buf[idx], sfx, music);
+    if (!queue_push(SNAPSHOT_ADDR, (uint16_t)idx, emu_ns))
+        return;
+    s_snap_next++;
+    s_snap_last = s_snap_buf[idx];
+    s_snap_force = false;
+}
+
+static void snapshot_poll(void *)
+{
+    snapshot_take(pacerEmuNs());
+}
+
+/* Audio thread: a SNAPSHOT_ADDR entry has come due */
+static void snapshot_apply(uint16_t idx)
+{
+    s_dma_view = s_snap_buf[idx & (SNAP_SLOTS - 1)];
+    s_snap_head.store(s_snap_head.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_release);
+}
+
+/* Big-endian word at byte_addr as the DMA sees it */
+static uint16_t dma_read(uint32_t byte_addr)
+{
+    const dma_snapshot_t &v = s_dma_view;
+    const uint8_t *p;
+
+    if (v.sfx_valid && byte_addr - v.sfx_base < SFX_BYTES - 1)
+        p = &v.sfx[byte_addr - v.sfx_base];
+    else if (v.music_valid && byte_addr - v.music_base < MUSIC_BYTES - 1)
+        p = &v.music[byte_addr - v.music_base];
+    else
+        p = &m_memory[byte_addr];   /* memBase is int32_t*, m_memory its bytes */
+    return (uint16_t)(((uint16_t)p[0] << 8) | (uint16_t)p[1]);
+}
+
+extern "C" void p8audio_verilated_dma_init(void)
+{
+    s_snap_force = true;
+    schedInit(&s_snap_event, "p8audio_dma", snapshot_poll, nullptr);
+    schedEvery(&s_snap_event, SNAP_POLL_INSNS);
+}
+
+extern "C" void p8audio_verilated_mmio_write(uint8_t byte_addr, uint16_t data,
+                                             uint64_t emu_ns)
+{
+    switch (byte_addr) {
+    case ADDR_SFX_BASE_HI:
+        s_cpu_sfx_base = (s_cpu_sfx_base & 0xFFFFu) | (uint32_t)data << 16;
+        break;
+    case ADDR_SFX_BASE_LO:
+        s_cpu_sfx_base = (s_cpu_sfx_base & 0xFFFF0000u) | data;
+        break;
+    case ADDR_MUSIC_BASE_HI:
+        s_cpu_music_base = (s_cpu_music_base & 0xFFFFu) | (uint32_t)data << 16;
+        break;
+    case ADDR_MUSIC_BASE_LO:
+        s_cpu_music_base = (s_cpu_music_base & 0xFFFF0000u) | data;
+        break;
+    case ADDR_SFX_CMD:
+    case ADDR_MUSIC_CMD:
+        /* The data as the command would find it */
+        snapshot_take(emu_ns);
+        break;
+    }
+    if (!queue_push(byte_addr, data, emu_ns)) {
+        audioStatsCount(AUDIO_COUNT_P8_QUEUE_OVERFLOW, 1);
+        fprintf(stderr, "[p8audio_verilated] MMIO queue overflow – dropped write addr=0x%02x data=0x%04x\n",
+                byte_addr, data);
     }
-    *out = s_queue_buf[s_queue_head];
-    s_queue_head = (s_queue_head + 1) % QUEUE_CAPACITY;
-    s_queue_count--;
-    pthread_mutex_unlock(&s_queue_mutex);
-    return true;
 }
 
 /*==============================================================
@@ -101,6 +289,26 @@ static bool queue_pop(mmio_cmd_t *out)
 static Vp8audio        *s_model     = nullptr;
 static VerilatedContext *s_vl_ctx   = nullptr;
 
+#ifdef P8AUDIO_TRACE
+/* The FST window being written (see Trace windows below); dumped after
+ * every eval of the main model, half an mclk apart */
+static VerilatedFstC   *s_trace       = nullptr;
+static Vp8audio        *s_trace_model = nullptr;
+static uint64_t         s_trace_ps    = 0;
+static const uint64_t   HALF_MCLK_PS  = 12500;
+#endif
+
+static inline void eval_model(void)
+{
+    s_model->eval();
+#ifdef P8AUDIO_TRACE
+    if (s_trace && s_model == s_trace_model) {
+        s_trace_ps += HALF_MCLK_PS;
+        s_trace->dump(s_trace_ps);
+    }
+#endif
+}
+
 /*==============================================================
  * Stat shadow cache (audio thread writes, CPU thread reads)
  *
@@ -111,14 +319,28 @@ static VerilatedContext *s_vl_ctx   = nullptr;
  *   index 9    : STAT55     music pattern loop count
  *   index 10   : STAT56     music note-tick count
  *   index 11   : STAT57     music playing flag (0 or 1)
+ *
+ * Published through a seqlock: the audio thread bumps s_stat_seq to odd,
+ * stores the registers, then bumps it to even; readers retry if the
+ * sequence was odd or moved under them.  Neither side ever blocks.
  *==============================================================*/
 static const uint8_t k_stat_offsets[12] = {
     0x20, 0x22, 0x24, 0x26,   /* STAT46-49: SFX slot per channel     */
     0x28, 0x2A, 0x2C, 0x2E,   /* STAT50-53: note index per channel   */
     0x30, 0x32, 0x34, 0x36    /* STAT54-57: music pattern/count/tick/playing */
 };
-static uint16_t        s_stat_cache[12];
-static pthread_mutex_t s_stat_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::atomic<uint16_t> s_stat_cache[12];
+static std::atomic<uint32_t> s_stat_seq{0};
+
+/* Audio thread only */
+static uint16_t s_stat_last[12];    /* last published values */
+static bool     s_stat_dirty = true;    /* an MMIO write may have changed them */
+static int      s_stat_age = 0;     /* samples since the last read */
+
+/* The registers only move on note ticks (~180 samples at the fastest
+ * speed) and MMIO writes, so the read mux is sampled every few samples
+ * rather than after every one. */
+static const int STAT_PERIOD_SAMPLES = 16;
 
 /*==============================================================
  * Clock helpers
@@ -128,21 +350,21 @@ static pthread_mutex_t s_stat_mutex = PTHREAD_MUTEX_INITIALIZER;
 static inline void tick_mclk(int level)
 {
     s_model->mclk = level;
-    s_model->eval();
+    eval_model();
 }
 
 /* Single clk_pcm_8x half-cycle. */
 static inline void tick_8x(int level)
 {
     s_model->clk_pcm_8x = level;
-    s_model->eval();
+    eval_model();
 }
 
 /* Single clk_pcm half-cycle. */
 static inline void tick_pcm(int level)
 {
     s_model->clk_pcm = level;
-    s_model->eval();
+    eval_model();
 }
 
 /*==============================================================
@@ -156,11 +378,7 @@ static void service_dma(void)
         return;
 
     /* dma_addr is a 31-bit word address; each word is 16 bits, big-endian. */
-    uint32_t byte_addr = (uint32_t)s_model->dma_addr * 2u;
-
-    /* memBase is int32_t* so m_memory = (uint8_t*)memBase */
-    s_model->dma_rdata = (uint16_t)(((uint16_t)m_memory[byte_addr] << 8) |
-                                     (uint16_t)m_memory[byte_addr + 1u]);
+    s_model->dma_rdata = dma_read((uint32_t)s_model->dma_addr * 2u);
 
     /* Pulse dma_ack for one mclk cycle */
     s_model->dma_ack = 1;
@@ -170,61 +388,117 @@ static void service_dma(void)
 }
 
 /*==============================================================
- * Flush queued MMIO writes into the model via mclk transactions.
- * Called from the audio thread before each sample batch.
+ * Apply one MMIO write to the model via mclk transactions.
  *==============================================================*/
-static void flush_mmio_queue(void)
-{
-    mmio_cmd_t cmd;
-    while (queue_pop(&cmd)) {
-        /* The 7-bit 'address' port is the byte-address shifted right by 1
-         * (word address).  nUDS and nLDS are both active (0) for 16-bit
-         * writes. */
-        s_model->address  = cmd.byte_addr >> 1;
-        s_model->din      = cmd.data;
-        s_model->nUDS     = 0;
-        s_model->nLDS     = 0;
-        s_model->write_en = 1;
-        s_model->read_en  = 0;
-
-        tick_mclk(0);   /* setup on falling edge */
-        tick_mclk(1);   /* latch on rising edge  */
-        service_dma();
-
-        s_model->write_en = 0;
-        s_model->nUDS     = 1;
-        s_model->nLDS     = 1;
+static void apply_mmio_write(const mmio_cmd_t &cmd)
+{
+    /* The 7-bit 'address' port is the byte-address shifted right by 1
+     * (word address).  nUDS and nLDS are both active (0) for 16-bit
+     * writes. */
+    s_model->address  = cmd.byte_addr >> 1;
+    s_model->din      = cmd.data;
+    s_model->nUDS     = 0;
+    s_model->nLDS     = 0;
+    s_model->write_en = 1;
+    s_model->read_en  = 0;
 
-        tick_mclk(0);
-        tick_mclk(1);
-        service_dma();
+    tick_mclk(0);   /* setup on falling edge */
+    tick_mclk(1);   /* latch on rising edge  */
+    service_dma();
+
+    s_model->write_en = 0;
+    s_model->nUDS     = 1;
+    s_model->nLDS     = 1;
+
+    tick_mclk(0);
+    tick_mclk(1);
+    service_dma();
+}
+
+/*==============================================================
+ * Emulated time → sample position.
+ *
+ * s_window_ns is the emulated time of the first sample of the buffer
+ * being generated; each sample advances it by NS_PER_SAMPLE.  The window
+ * runs one buffer behind the emulator so that every write for a buffer
+ * has normally been queued by the time it is rendered.  When the two
+ * drift too far apart (emulator paused, run unthrottled or restarted) the
+ * window is resynchronised to the oldest pending write.
+ *==============================================================*/
+static const uint64_t NS_PER_SAMPLE = 1000000000ull / SAMPLE_RATE_HW;
+
+static uint64_t s_window_ns = 0;
+static bool     s_window_valid = false;
+
+static void window_sync(int samples)
+{
+    const mmio_cmd_t *cmd = queue_peek();
+    uint64_t span = (uint64_t)samples * NS_PER_SAMPLE;
+
+    if (!cmd)
+        return;
+    if (!s_window_valid ||
+        cmd->emu_ns + 2 * span < s_window_ns ||
+        cmd->emu_ns > s_window_ns + 4 * span) {
+        s_window_ns = cmd->emu_ns > span ? cmd->emu_ns - span : 0;
+        s_window_valid = true;
     }
 }
 
 /*==============================================================
  * Snapshot stat registers into the shadow cache.
- * Called from the audio thread after every PCM sample.
+ * Called from the audio thread after every PCM sample; reads the model
+ * only when due (see STAT_PERIOD_SAMPLES).
  * The read mux in p8audio.sv is combinational: setting address +
  * eval() makes dout valid immediately without a clock edge.
  *==============================================================*/
-static void update_stat_cache(void)
+static void publish_stats(const uint16_t v[12])
+{
+    memcpy(s_stat_last, v, sizeof(s_stat_last));
+
+    uint32_t seq = s_stat_seq.load(std::memory_order_relaxed);
+    s_stat_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int i = 0; i < 12; i++)
+        s_stat_cache[i].store(v[i], std::memory_order_relaxed);
+    s_stat_seq.store(seq + 2, std::memory_order_release);
+}
+
+static void read_stats(uint16_t out[12])
 {
-    uint16_t tmp[12];
     s_model->read_en  = 1;
     s_model->write_en = 0;
     for (int i = 0; i < 12; i++) {
         s_model->address = k_stat_offsets[i] >> 1;
         s_model->eval();
-        tmp[i] = s_model->dout;
+        out[i] = s_model->dout;
     }
+    /* read_en is only sampled on a clock edge, so the next tick's eval()
+     * settles it again. */
     s_model->read_en = 0;
-    s_model->eval();
+}
+
+static void update_stat_cache(void)
+{
+    uint16_t tmp[12];
 
-    pthread_mutex_lock(&s_stat_mutex);
-    memcpy(s_stat_cache, tmp, sizeof(tmp));
-    pthread_mutex_unlock(&s_stat_mutex);
+    if (!s_stat_dirty && ++s_stat_age < STAT_PERIOD_SAMPLES)
+        return;
+    s_stat_dirty = false;
+    s_stat_age = 0;
+
+    read_stats(tmp);
+
+    if (!memcmp(tmp, s_stat_last, sizeof(tmp)))
+        return;
+    publish_stats(tmp);
 }
 
+/* Upper bound of mclk cycles spent on DMA per 8x slot, and the number of
+ * cycles without dma_req after which a burst is considered finished. */
+static const int DMA_MAX_BURST  = 200;
+static const int DMA_IDLE_MCLKS = 4;
+
 /*==============================================================
  * Advance model by exactly one PCM sample.
  *
@@ -242,16 +516,30 @@ static void update_stat_cache(void)
  * complete before any mclk edge, so the pulse is always missed and the
  * music sequencer never advances past the first pattern.
  *
+ * exact runs the original fixed 200-cycle DMA burst, for the reference
+ * model of --p8audio_check.
+ *
+ * The schedule stays here rather than in an SV wrapper: eval() runs one
+ * time slot whoever makes the edges, so clocks generated inside the model
+ * (--timing, or regs off one fast clock) cost as many evals, and those
+ * that change no trigger are cheap already.  Fewer evals means merging
+ * edges, which is only safe knowing p8audio.sv has no logic on the edges
+ * merged away; --p8audio_check is the test for that.
+ *
  * Returns the new pcm_out value (signed PCM_WID-bit, sign-extended to int16_t).
  *==============================================================*/
-static int16_t advance_one_sample(void)
+static int16_t advance_model(bool exact)
 {
     for (int slot = 0; slot < PCM_8X_PER_PCM; slot++) {
         tick_8x(1);
         tick_8x(0);
         tick_mclk(1);
         if (s_model->dma_req) {
-            for (int i=0;i<200;++i) {
+            /* Serve words while the model keeps asking, allowing a few
+             * idle mclks between requests of one fetch sequence. */
+            int idle = 0;
+            for (int i = 0; i < DMA_MAX_BURST && (exact || idle < DMA_IDLE_MCLKS); ++i) {
+                idle = s_model->dma_req ? 0 : idle + 1;
                 service_dma();
                 tick_mclk(0);
                 tick_mclk(1);
@@ -265,26 +553,565 @@ static int16_t advance_one_sample(void)
     tick_pcm(0);
     /* Sign-extend PCM_WID-bit pcm_out to int16_t. */
     int16_t s = (int16_t)((s_model->pcm_out ^ (1u << (PCM_WID - 1))) - (1u << (PCM_WID - 1)));
+    return s;
+}
+
+static int16_t advance_one_sample(void)
+{
+    int16_t s = advance_model(false);
     update_stat_cache();
     return s;
 }
 
 /*==============================================================
- * SDL audio callback
+ * Cross-check (--p8audio_check).
+ *
+ * A second model instance is clocked in lockstep with the exact schedule
+ * (every mclk of the DMA burst, no idle skipping, stats read after every
+ * sample) and fed the same writes at the same samples.  The first sample
+ * or stat register where the fast path differs from it is reported, and
+ * checking stops there.
+ *==============================================================*/
+static Vp8audio *s_ref_model = nullptr;
+static uint64_t  s_check_sample = 0;
+
+static void check_write(const mmio_cmd_t &cmd)
+{
+    Vp8audio *m = s_model;
+
+    s_model = s_ref_model;
+    apply_mmio_write(cmd);
+    s_model = m;
+}
+
+static void check_stop(void)
+{
+    s_ref_model->final();
+    delete s_ref_model;
+    s_ref_model = nullptr;
+}
+
+/* fast: the sample the fast path produced; stats_valid: s_stat_last was
+ * read at this sample */
+static void check_sample(int16_t fast, bool stats_valid)
+{
+    Vp8audio *m = s_model;
+    uint16_t ref_stats[12];
+    int16_t ref;
+
+    s_model = s_ref_model;
+    ref = advance_model(true);
+    read_stats(ref_stats);
+    s_model = m;
+
+    uint64_t n = s_check_sample++;
+    if (fast != ref) {
+        fprintf(stderr, "[p8audio_verilated] check: sample %llu differs: fast %d, exact %d\n",
+                (unsigned long long)n, fast, ref);
+        check_stop();
+        return;
+    }
+    if (!stats_valid)
+        return;
+    for (int i = 0; i < 12; i++) {
+        if (s_stat_last[i] != ref_stats[i]) {
+            fprintf(stderr, "[p8audio_verilated] check: sample %llu STAT%d differs: fast 0x%04x, exact 0x%04x\n",
+                    (unsigned long long)n, 46 + i, s_stat_last[i], ref_stats[i]);
+            check_stop();
+            return;
+        }
+    }
+}
+
+/* Apply every write due at or before emulated time t.  Returns true if
+ * there were any. */
+static bool apply_due_writes(uint64_t t)
+{
+    const mmio_cmd_t *cmd;
+    bool any = false;
+
+    while ((cmd = queue_peek()) && cmd->emu_ns <= t) {
+        if (cmd->byte_addr == TRACE_MARK_ADDR) {
+            queue_drop();
+            continue;
+        }
+        if (cmd->byte_addr == SNAPSHOT_ADDR) {
+            snapshot_apply(cmd->data);
+            queue_drop();
+            continue;
+        }
+        apply_mmio_write(*cmd);
+        if (s_ref_model)
+            check_write(*cmd);
+        queue_drop();
+        any = true;
+    }
+    if (any)
+        s_stat_dirty = true;
+    return any;
+}
+
+/*==============================================================
+ * Trace windows (--p8audio_trace, a P8AUDIO_TRACE build).
+ *
+ * The model is only traced within windows, each written to its own FST
+ * file by Verilator's trace thread.  A window is --p8audio_trace_ms long
+ * around an SFX or music command write or a funcval trace mark (starting
+ * as far before it as the model runs behind the emulator), or covers a
+ * range of generated samples.  A trigger before a window ends extends
+ * it.  Writes are scanned as they are queued, ahead of the model.
  *==============================================================*/
-static void audio_callback_verilated(void *userdata, uint8_t *stream, int len)
+#ifdef P8AUDIO_TRACE
+enum {
+    TRACE_ON_SFX     = 1,
+    TRACE_ON_MUSIC   = 2,
+    TRACE_ON_FUNCVAL = 4
+};
+
+static const int     TRACE_MAX_WINDOWS = 32;
+
+static std::string s_trace_path;     /* empty: tracing off */
+static unsigned    s_trace_on     = 0;
+static uint64_t    s_trace_half_ns = 25000000;
+static uint64_t    s_trace_first  = UINT64_MAX;   /* sample range */
+static uint64_t    s_trace_last   = 0;
+static uint64_t    s_trace_sample = 0;     /* samples generated */
+static uint32_t    s_trace_scan   = 0;     /* next queue entry to look at */
+static bool        s_trace_pending = false;
+static uint64_t    s_trace_from_ns, s_trace_to_ns;
+static int         s_trace_windows = 0;
+
+static void trace_parse(const char *spec)
+{
+    const char *p = spec;
+
+    while (*p) {
+        const char *end = strchr(p, ',');
+        unsigned long long first, last;
+        char tail;
+
+        if (!end)
+            end = p + strlen(p);
+        std::string item(p, end - p);
+        if (item == "sfx")
+            s_trace_on |= TRACE_ON_SFX;
+        else if (item == "music")
+            s_trace_on |= TRACE_ON_MUSIC;
+        else if (item == "funcval")
+            s_trace_on |= TRACE_ON_FUNCVAL;
+        else if (sscanf(item.c_str(), "samples=%llu-%llu%c", &first, &last, &tail) == 2 &&
+                 first <= last) {
+            s_trace_first = first;
+            s_trace_last = last;
+        } else
+            fprintf(stderr, "[p8audio_verilated] bad p8audio_trace_on entry %s\n", item.c_str());
+        p = *end ? end + 1 : end;
+    }
+}
+
+static void trace_init(void)
+{
+    const char *path = emulatorOptionString("p8audio_trace");
+    const char *on = emulatorOptionString("p8audio_trace_on");
+    int ms = emulatorOptionInt("p8audio_trace_ms");
+
+    if (!path || !*path)
+        return;
+    s_trace_path = path;
+    trace_parse(on && *on ? on : "sfx,music,funcval");
+    s_trace_half_ns = (uint64_t)(ms > 0 ? ms : 50) * 500000;
+    s_trace_model = s_model;
+}
+
+static void trace_open(void)
 {
-    (void)userdata;
-    int16_t *buf     = (int16_t *)stream;
-    int      samples = len / (int)sizeof(int16_t);
+    std::string name = s_trace_path;
+    size_t dot = name.rfind('.');
+    char num[16];
 
-    flush_mmio_queue();
+    if (dot == std::string::npos || name.find('/', dot) != std::string::npos)
+        dot = name.size();
+    snprintf(num, sizeof(num), "-%04d", s_trace_windows++);
+    name.insert(dot, num);
+
+    s_trace = new VerilatedFstC;
+    s_trace_model->trace(s_trace, 99);
+    s_trace->set_time_unit("1ps");
+    s_trace->set_time_resolution("1ps");
+    s_trace->open(name.c_str());
+    s_trace_ps = s_window_ns * 1000;
+    s_trace->dump(s_trace_ps);
+    printf("[p8audio_verilated] trace: %s from sample %llu\n", name.c_str(),
+           (unsigned long long)s_trace_sample);
+}
+
+static void trace_close(void)
+{
+    s_trace->close();
+    delete s_trace;
+    s_trace = nullptr;
+    if (s_trace_windows == TRACE_MAX_WINDOWS)
+        printf("[p8audio_verilated] trace: %d windows written, tracing no more\n",
+               TRACE_MAX_WINDOWS);
+}
+
+static void trace_trigger(uint64_t emu_ns)
+{
+    if (!s_trace_pending) {
+        s_trace_from_ns = emu_ns > s_trace_half_ns ? emu_ns - s_trace_half_ns : 0;
+        s_trace_pending = true;
+    }
+    s_trace_to_ns = emu_ns + s_trace_half_ns;
+}
+
+/* Queued writes not looked at yet; before apply_due_writes() drops them */
+static void trace_scan(void)
+{
+    uint32_t head = s_queue_head.load(std::memory_order_relaxed);
+    uint32_t tail = s_queue_tail.load(std::memory_order_acquire);
+
+    if ((int32_t)(s_trace_scan - head) < 0)
+        s_trace_scan = head;
+    for (; s_trace_scan != tail; s_trace_scan++) {
+        const mmio_cmd_t &cmd = s_queue_buf[s_trace_scan & (QUEUE_CAPACITY - 1)];
+
+        if ((cmd.byte_addr == ADDR_SFX_CMD && (s_trace_on & TRACE_ON_SFX)) ||
+            (cmd.byte_addr == ADDR_MUSIC_CMD && (s_trace_on & TRACE_ON_MUSIC)) ||
+            (cmd.byte_addr == TRACE_MARK_ADDR && (s_trace_on & TRACE_ON_FUNCVAL)))
+            trace_trigger(cmd.emu_ns);
+    }
+}
+
+/* Before each sample: open or close the window it falls in */
+static void trace_step(void)
+{
+    bool want;
+
+    if (s_trace_path.empty())
+        return;
+    trace_scan();
+    want = s_trace_sample >= s_trace_first && s_trace_sample <= s_trace_last;
+    if (s_trace_pending) {
+        if (s_window_ns >= s_trace_to_ns)
+            s_trace_pending = false;
+        else if (s_window_ns >= s_trace_from_ns)
+            want = true;
+    }
+    if (want && !s_trace && s_trace_windows < TRACE_MAX_WINDOWS)
+        trace_open();
+    else if (!want && s_trace)
+        trace_close();
+    /* Keep the dump on emulated time across idle samples */
+    if (s_trace && s_trace_ps < s_window_ns * 1000)
+        s_trace_ps = s_window_ns * 1000;
+    s_trace_sample++;
+}
+#endif
+
+extern "C" void p8audio_verilated_trace_mark(uint64_t emu_ns)
+{
+#ifdef P8AUDIO_TRACE
+    if (!s_trace_path.empty())
+        p8audio_verilated_mmio_write(TRACE_MARK_ADDR, 0, emu_ns);
+#else
+    (void)emu_ns;
+#endif
+}
+
+/*==============================================================
+ * Idle fast path.
+ *
+ * With no SFX on any channel, music stopped and no DMA pending, nothing
+ * in the model moves until the CPU writes a register, so once the output
+ * has held steady for IDLE_SETTLE_SAMPLES the model is no longer clocked
+ * and the last sample is repeated.  The next applied MMIO write wakes it.
+ *==============================================================*/
+static const int IDLE_SETTLE_SAMPLES = 256;
+
+static bool    s_idle = false;
+static int     s_idle_run = 0;
+static int16_t s_last_pcm = 0;
+
+static void idle_check(int16_t s_pcm)
+{
+    bool quiet = s_stat_last[0] == 0xFFFF && s_stat_last[1] == 0xFFFF &&
+                 s_stat_last[2] == 0xFFFF && s_stat_last[3] == 0xFFFF &&
+                 s_stat_last[11] == 0 && !s_model->dma_req &&
+                 s_pcm == s_last_pcm;
+
+    s_last_pcm = s_pcm;
+    s_idle_run = quiet ? s_idle_run + 1 : 0;
+    s_idle = s_idle_run >= IDLE_SETTLE_SAMPLES;
+}
+
+/*==============================================================
+ * Sample generation and PCM ring (producer thread → SDL callback)
+ *
+ * The model is clocked on its own thread, which keeps the ring filled
+ * to s_lookahead samples in GENERATE_CHUNK steps.  The SDL callback only
+ * copies samples out, so a slow eval() no longer underruns the device;
+ * if the ring does run dry the last sample is held.  Wait-free on both
+ * sides; the semaphore only wakes the producer early.
+ *==============================================================*/
+static const uint32_t PCM_RING_CAPACITY = 16384;   /* power of two */
+static const int      GENERATE_CHUNK    = 256;
+
+static int16_t               s_pcm_ring[PCM_RING_CAPACITY];
+static std::atomic<uint32_t> s_pcm_head{0};    /* consumer owned */
+static std::atomic<uint32_t> s_pcm_tail{0};    /* producer owned */
+static uint32_t              s_lookahead = 2048;
+static SDL_sem              *s_pcm_space = nullptr;
+static pthread_t             s_producer {};
+static std::atomic<bool>     s_producer_stopping{false};
+static bool                  s_producer_running = false;
+static std::atomic<uint32_t> s_underruns{0};
+static bool                  s_offline = false;    /* --audio_offline */
+static int16_t               s_out_last = 0;    /* callback only */
+static std::atomic<bool>     s_paused{false};
+static std::mutex            s_gen_lock;    /* model clocking vs save/restore */
+
+/*==============================================================
+ * Model benchmark (--p8audio_bench).
+ *
+ * Times each clocked sample and files it under the workload the stat
+ * registers showed before it: music playing (stat 57), SFX only (a
+ * channel in stat 46..49) or idle.  Samples from the idle fast path are
+ * only counted.
+ *==============================================================*/
+enum { BENCH_IDLE, BENCH_SFX, BENCH_MUSIC, BENCH_WORKLOADS };
+
+static bool     s_bench = false;
+static uint64_t s_bench_ticks[BENCH_WORKLOADS];
+static uint64_t s_bench_samples[BENCH_WORKLOADS];
+static uint64_t s_bench_skipped = 0;
+
+static int bench_workload(void)
+{
+    if (s_stat_last[11])
+        return BENCH_MUSIC;
+    for (int ch = 0; ch < 4; ch++) {
+        if (s_stat_last[ch] != 0xFFFF)
+            return BENCH_SFX;
+    }
+    return BENCH_IDLE;
+}
+
+static int16_t bench_one_sample(void)
+{
+    int w = bench_workload();
+    uint64_t start = SDL_GetPerformanceCounter();
+    int16_t s = advance_one_sample();
+
+    s_bench_ticks[w] += SDL_GetPerformanceCounter() - start;
+    s_bench_samples[w]++;
+    return s;
+}
+
+static void bench_dump(void)
+{
+    static const char *const names[BENCH_WORKLOADS] = { "idle", "sfx", "music" };
+    double hz = (double)SDL_GetPerformanceFrequency();
+
+    printf("[p8audio_verilated] model benchmark, %llu idle fast path samples not timed\n",
+           (unsigned long long)s_bench_skipped);
+    for (int w = 0; w < BENCH_WORKLOADS; w++) {
+        double sec = s_bench_ticks[w] / hz;
+        double rate = sec > 0 ? s_bench_samples[w] / sec : 0.0;
+
+        if (!s_bench_samples[w])
+            continue;
+        printf("  %-5s %10llu samples %9.0f samples/s %7.2fx realtime\n",
+               names[w], (unsigned long long)s_bench_samples[w], rate,
+               rate / SAMPLE_RATE_HW);
+    }
+}
+
+static void generate_samples(int16_t *buf, int samples)
+{
+    uint64_t start = audio_stats_enabled ? audioStatsNow() : 0;
+    int idle_samples = 0;
+
+    if (audio_stats_enabled)
+        audioStatsAdd(AUDIO_HIST_P8_QUEUE_DEPTH,
+                      s_queue_tail.load(std::memory_order_acquire) -
+                      s_queue_head.load(std::memory_order_relaxed));
+    if (!s_offline)
+        window_sync(samples);
 
     for (int i = 0; i < samples; i++) {
-        int16_t s_pcm = advance_one_sample();
+#ifdef P8AUDIO_TRACE
+        trace_step();
+#endif
+        if (apply_due_writes(s_window_ns)) {
+            s_idle = false;
+            s_idle_run = 0;
+        }
+        s_window_ns += NS_PER_SAMPLE;
+        int16_t s_pcm = s_last_pcm;
+        bool idle = s_idle;
+        if (!idle) {
+            s_pcm = s_bench ? bench_one_sample() : advance_one_sample();
+            idle_check(s_pcm);
+        } else {
+            idle_samples++;
+            s_bench_skipped++;
+        }
+        if (s_ref_model)
+            check_sample(s_pcm, idle || s_stat_age == 0);
         /* Scale signed PCM_WID-bit → signed 16-bit */
         buf[i] = s_pcm << (16 - PCM_WID);
     }
+
+    if (audio_stats_enabled) {
+        audioStatsAdd(AUDIO_HIST_P8_GENERATE_US, audioStatsSinceUs(start));
+        audioStatsAdd(AUDIO_HIST_P8_GENERATE_SAMPLES, samples);
+        audioStatsCount(AUDIO_COUNT_P8_IDLE_SAMPLES, idle_samples);
+    }
+}
+
+static void *producer_thread(void *)
+{
+    int16_t chunk[GENERATE_CHUNK];
+
+#ifdef __linux__
+    /* Found by name for the cart_bench audio CPU time */
+    pthread_setname_np(pthread_self(), "sQLux p8audio");
+#endif
+
+    while (!s_producer_stopping.load(std::memory_order_relaxed)) {
+        uint32_t tail = s_pcm_tail.load(std::memory_order_relaxed);
+        uint32_t fill = tail - s_pcm_head.load(std::memory_order_acquire);
+
+        if (fill + GENERATE_CHUNK > s_lookahead) {
+            SDL_SemWaitTimeout(s_pcm_space, 10);
+            continue;
+        }
+        std::lock_guard<std::mutex> guard(s_gen_lock);
+        generate_samples(chunk, GENERATE_CHUNK);
+        for (int i = 0; i < GENERATE_CHUNK; i++)
+            s_pcm_ring[(tail + i) & (PCM_RING_CAPACITY - 1)] = chunk[i];
+        s_pcm_tail.store(tail + GENERATE_CHUNK, std::memory_order_release);
+    }
+    return nullptr;
+}
+
+/*==============================================================
+ * Mixer source and taps
+ *==============================================================*/
+static const int MAX_TAPS = 2;
+static std::atomic<p8audio_tap_fn> s_taps[MAX_TAPS];
+
+extern "C" void p8audio_verilated_add_tap(p8audio_tap_fn fn)
+{
+    for (int i = 0; i < MAX_TAPS; i++) {
+        p8audio_tap_fn none = nullptr;
+        if (s_taps[i].compare_exchange_strong(none, fn))
+            return;
+    }
+    fprintf(stderr, "[p8audio_verilated] too many audio taps\n");
+}
+
+extern "C" void p8audio_verilated_remove_tap(p8audio_tap_fn fn)
+{
+    for (int i = 0; i < MAX_TAPS; i++) {
+        p8audio_tap_fn f = fn;
+        s_taps[i].compare_exchange_strong(f, nullptr);
+    }
+}
+
+static void run_taps(const int16_t *buf, int samples)
+{
+    for (int i = 0; i < MAX_TAPS; i++) {
+        p8audio_tap_fn tap = s_taps[i].load(std::memory_order_acquire);
+        if (tap)
+            tap(buf, samples);
+    }
+}
+
+static void copy_samples(int16_t *buf, int samples)
+{
+    uint32_t head    = s_pcm_head.load(std::memory_order_relaxed);
+    uint32_t avail   = s_pcm_tail.load(std::memory_order_acquire) - head;
+    int      n       = avail < (uint32_t)samples ? (int)avail : samples;
+
+    audioStatsAdd(AUDIO_HIST_P8_RING_FILL, avail);
+
+    for (int i = 0; i < n; i++)
+        buf[i] = s_pcm_ring[(head + i) & (PCM_RING_CAPACITY - 1)];
+    s_pcm_head.store(head + n, std::memory_order_release);
+    if (n)
+        s_out_last = buf[n - 1];
+    if (n < samples) {
+        for (int i = n; i < samples; i++)
+            buf[i] = s_out_last;
+        s_underruns.fetch_add(1, std::memory_order_relaxed);
+        audioStatsCount(AUDIO_COUNT_P8_UNDERRUN, 1);
+        metricAdd(METRIC_AUDIO_UNDERRUNS, 1);
+    }
+    if (s_pcm_space)
+        SDL_SemPost(s_pcm_space);
+}
+
+/* The p8audio source of the mixer */
+static bool p8audio_source(int16_t *buf, int samples)
+{
+    uint64_t start = audio_stats_enabled || metrics_enabled ? audioStatsNow() : 0;
+
+    if (s_offline || s_paused.load(std::memory_order_relaxed)) {
+        /* Offline samples go to the taps from p8audio_verilated_advance_to() */
+        return false;
+    }
+    if (!s_producer_running) {
+        generate_samples(buf, samples);
+    } else {
+        copy_samples(buf, samples);
+    }
+
+    run_taps(buf, samples);
+
+    if (audio_stats_enabled) {
+        audioStatsAdd(AUDIO_HIST_P8_CALLBACK_US, audioStatsSinceUs(start));
+        audioStatsAdd(AUDIO_HIST_P8_CALLBACK_SAMPLES, samples);
+    }
+    if (metrics_enabled) {
+        metricAdd(METRIC_AUDIO_CALLBACKS, 1);
+        metricHist(METRIC_HIST_AUDIO_US, metricsSinceUs(start));
+    }
+    return true;
+}
+
+/*==============================================================
+ * Offline clock (--audio_offline).
+ *
+ * The model is clocked on the emulator thread from emulated time, as
+ * fast as the emulator runs, and its samples go only to the taps; the
+ * audio device plays silence.  Writes are queued by the same thread
+ * before the time they are stamped with is reached, so the window needs
+ * no lag and never resynchronises.
+ *==============================================================*/
+extern "C" bool p8audio_verilated_offline(void)
+{
+    return s_offline;
+}
+
+extern "C" void p8audio_verilated_advance_to(uint64_t emu_ns)
+{
+    int16_t chunk[GENERATE_CHUNK];
+
+    if (!s_offline || !s_model)
+        return;
+    std::lock_guard<std::mutex> guard(s_gen_lock);
+    if (!s_window_valid) {
+        s_window_ns = emu_ns;
+        s_window_valid = true;
+    }
+    while (emu_ns > s_window_ns + NS_PER_SAMPLE) {
+        uint64_t due = (emu_ns - s_window_ns) / NS_PER_SAMPLE;
+        int n = due < (uint64_t)GENERATE_CHUNK ? (int)due : GENERATE_CHUNK;
+
+        generate_samples(chunk, n);
+        run_taps(chunk, n);
+    }
 }
 
 /*==============================================================
@@ -325,17 +1152,18 @@ static void model_reset(void)
     for (int i = 0; i < 4; i++) { tick_mclk(1); tick_mclk(0); }
 
     /* Populate initial stat cache */
+    s_stat_dirty = true;
     update_stat_cache();
+
+    s_idle = false;
+    s_idle_run = 0;
 }
 
 /*==============================================================
  * Public API (implements p8_audio.h declarations)
  *==============================================================*/
 
-static SDL_AudioSpec s_audio_spec;
 static bool          s_model_init = false;
-static pthread_t     s_thread {};
-static volatile bool s_thread_stopping = false;
 
 void p8audio_verilated_init(void)
 {
@@ -344,64 +1172,87 @@ void p8audio_verilated_init(void)
 
     /* Create Verilated context and model */
     s_vl_ctx = new VerilatedContext;
+#ifdef P8AUDIO_TRACE
+    s_vl_ctx->traceEverOn(true);
+#endif
     s_model  = new Vp8audio(s_vl_ctx, "p8audio");
 
     model_reset();
     s_model_init = true;
+#ifdef P8AUDIO_TRACE
+    trace_init();
+#endif
 
-    /* Open SDL audio */
-    SDL_AudioSpec want;
-    memset(&want, 0, sizeof(want));
-    want.freq     = SAMPLE_RATE_HW;
-    want.format   = AUDIO_S16SYS;
-    want.channels = 1;
-    want.samples  = SDL_BUFFER_SAMPLES;
-    want.callback = audio_callback_verilated;
-    want.userdata = nullptr;
-
-    int ret = SDL_OpenAudio(&want, &s_audio_spec);
-    if (ret != 0) {
-        fprintf(stderr, "[p8audio_verilated] SDL_OpenAudio failed: %s\n",
-                SDL_GetError());
-        int ret = pthread_create(&s_thread,
-            nullptr,
-            [](void*) -> void* {
-                int16_t *buf = new int16_t[SDL_BUFFER_SAMPLES];
-                while (!s_thread_stopping) {
-                    audio_callback_verilated(nullptr, (uint8_t*)buf, sizeof(int16_t) * SDL_BUFFER_SAMPLES);
-                    SDL_Delay(SDL_BUFFER_SAMPLES * 1000 / SAMPLE_RATE_HW);
-                }
-                delete[] buf;
-                return nullptr;
-            }, nullptr);
-        if (ret != 0) {
-            fprintf(stderr, "[p8audio_verilated] Failed to create fallback audio thread: %s\n",
-                    SDL_GetError());
-        }
-        return;
+    if (emulatorOptionFlag("p8audio_check")) {
+        Vp8audio *m = s_model;
+
+        s_ref_model = new Vp8audio(s_vl_ctx, "p8audio_ref");
+        s_model = s_ref_model;
+        model_reset();
+        s_model = m;
+        printf("[p8audio_verilated] checking fast paths against the exact clock schedule\n");
     }
 
-    SDL_PauseAudio(0);
+    s_offline = emulatorOptionFlag("audio_offline");
+    s_bench = emulatorOptionFlag("p8audio_bench");
+
+    /* Start generating ahead of the device */
+    int device_samples = emulatorOptionInt("audio_buffer");
+    int lookahead = emulatorOptionInt("audio_lookahead");
+    if (lookahead < device_samples + GENERATE_CHUNK)
+        lookahead = device_samples + GENERATE_CHUNK;
+    if (lookahead > (int)PCM_RING_CAPACITY)
+        lookahead = PCM_RING_CAPACITY;
+    s_lookahead = lookahead;
+    s_pcm_head.store(0);
+    s_pcm_tail.store(0);
+    s_producer_stopping = false;
+    s_pcm_space = SDL_CreateSemaphore(0);
+    if (!s_offline)
+        s_producer_running = pthread_create(&s_producer, nullptr, producer_thread, nullptr) == 0;
+    if (!s_producer_running && !s_offline)
+        fprintf(stderr, "[p8audio_verilated] Failed to create audio producer thread, generating in the callback\n");
+
+    /* Played through the shared mixer, which runs in real time even
+       without a device */
+    s_paused = false;
+    audioMixerInit(device_samples);
+    audioMixerAdd(p8audio_source);
 }
 
 void audio_resume(void)
 {
-    SDL_PauseAudio(0);
+    s_paused = false;
 }
 
 void audio_pause(void)
 {
-    SDL_PauseAudio(1);
+    s_paused = true;
 }
 
 void audio_close(void)
 {
-    if (s_thread != pthread_t{}) {
-        s_thread_stopping = true;
-        pthread_join(s_thread, nullptr);
-    } else {
-        SDL_CloseAudio();
+    audioMixerClose();
+    if (s_producer_running) {
+        s_producer_stopping = true;
+        SDL_SemPost(s_pcm_space);
+        pthread_join(s_producer, nullptr);
+        s_producer_running = false;
+    }
+    if (s_pcm_space) {
+        SDL_DestroySemaphore(s_pcm_space);
+        s_pcm_space = nullptr;
     }
+    if (s_underruns.load())
+        printf("[p8audio_verilated] %u audio buffer underruns\n", s_underruns.load());
+    if (s_ref_model)
+        check_stop();
+    if (s_bench)
+        bench_dump();
+#ifdef P8AUDIO_TRACE
+    if (s_trace)
+        trace_close();
+#endif
     if (s_model) {
         s_model->final();
         delete s_model;
@@ -422,8 +1273,189 @@ extern "C" uint16_t p8audio_verilated_mmio_read(uint8_t byte_offset)
     if (byte_offset < 0x20 || byte_offset > 0x36 || (byte_offset & 1u))
         return 0;
     int idx = (byte_offset - 0x20) / 2;
-    pthread_mutex_lock(&s_stat_mutex);
-    uint16_t val = s_stat_cache[idx];
-    pthread_mutex_unlock(&s_stat_mutex);
+    uint32_t seq;
+    uint16_t val;
+    do {
+        seq = s_stat_seq.load(std::memory_order_acquire);
+        val = s_stat_cache[idx].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1u) || seq != s_stat_seq.load(std::memory_order_relaxed));
     return val;
 }
+
+/*==============================================================
+ * Save/restore (needs a --savable Verilator build)
+ *
+ * The state holds the Verilated model followed by everything the fast
+ * paths keep outside it: pending MMIO writes, the time window, idle and
+ * stat cache state and the generated but unplayed PCM, so a restore
+ * carries on from exactly the same sample.  Queued DMA snapshots are
+ * left out: the copy is taken again from guest RAM at the restore.  Clocking is held off while
+ * the state is copied; the cross-check model is not saved, so checking
+ * stops at a restore.  It is the P8AU section of a machine snapshot, so
+ * save files, rewind and netplay rollback keep the audio registers the
+ * guest reads in step with the CPU and RAM.
+ *==============================================================*/
+static const uint32_t STATE_MAGIC   = 0x50384155;  /* "P8AU" */
+static const uint32_t STATE_VERSION = 2;
+
+/* Verilated serialisers over memory rather than a file */
+class SnapshotSave final : public VerilatedSerialize {
+public:
+    SnapshotSave(void (*put)(void *ctx, const void *p, size_t n), void *ctx)
+        : m_put(put), m_ctx(ctx) { m_isOpen = true; }
+    ~SnapshotSave() override { SnapshotSave::flush(); }
+    void flush() override
+    {
+        m_put(m_ctx, m_bufp, m_cp - m_bufp);
+        m_cp = m_bufp;
+    }
+private:
+    void (*m_put)(void *ctx, const void *p, size_t n);
+    void *m_ctx;
+};
+
+class SnapshotRestore final : public VerilatedDeserialize {
+public:
+    SnapshotRestore(const void *p, size_t n)
+        : m_src(static_cast<const uint8_t *>(p)), m_left(n)
+    {
+        m_isOpen = true;
+        m_endp = m_bufp;
+    }
+    /* As VerilatedRestore: keeps the unread bytes, tops up and pads with
+       zeroes past the end */
+    void fill() override
+    {
+        size_t kept = m_endp - m_cp;
+        size_t n = std::min(bufferSize() - kept, m_left);
+
+        memmove(m_bufp, m_cp, kept);
+        memcpy(m_bufp + kept, m_src, n);
+        memset(m_bufp + kept + n, 0, bufferSize() - kept - n);
+        m_src += n;
+        m_left -= n;
+        m_cp = m_bufp;
+        m_endp = m_bufp + bufferSize();
+    }
+private:
+    const uint8_t *m_src;
+    size_t m_left;
+};
+
+struct audio_state_t {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t window_ns;
+    uint8_t  window_valid;
+    uint8_t  idle;
+    int32_t  idle_run;
+    int32_t  stat_age;
+    int16_t  last_pcm;
+    int16_t  out_last;
+    uint16_t stat_last[12];
+    uint32_t sfx_base;
+    uint32_t music_base;
+    uint32_t queue_count;
+    uint32_t pcm_count;
+};
+
+extern "C" void p8audio_verilated_save_state(void (*put)(void *ctx, const void *p, size_t n),
+                                             void *ctx)
+{
+    if (!s_model)
+        return;
+
+    std::lock_guard<std::mutex> guard(s_gen_lock);
+    SnapshotSave os(put, ctx);
+
+    audio_state_t st = {};
+    st.magic        = STATE_MAGIC;
+    st.version      = STATE_VERSION;
+    st.window_ns    = s_window_ns;
+    st.window_valid = s_window_valid;
+    st.idle         = s_idle;
+    st.idle_run     = s_idle_run;
+    st.stat_age     = s_stat_age;
+    st.last_pcm     = s_last_pcm;
+    st.sfx_base     = s_cpu_sfx_base;
+    st.music_base   = s_cpu_music_base;
+    memcpy(st.stat_last, s_stat_last, sizeof(st.stat_last));
+
+    audioMixerLock();
+    st.out_last = s_out_last;
+    uint32_t pcm_head = s_pcm_head.load();
+    st.pcm_count = s_pcm_tail.load() - pcm_head;
+    audioMixerUnlock();
+
+    /* Caller is the MMIO producer, so the queue cannot grow meanwhile */
+    uint32_t q_head = s_queue_head.load();
+    uint32_t q_tail = s_queue_tail.load();
+    for (uint32_t i = q_head; i != q_tail; i++) {
+        if (s_queue_buf[i & (QUEUE_CAPACITY - 1)].byte_addr != SNAPSHOT_ADDR)
+            st.queue_count++;
+    }
+
+    os.write(&st, sizeof(st));
+    os << *s_model;
+    for (uint32_t i = q_head; i != q_tail; i++) {
+        const mmio_cmd_t &cmd = s_queue_buf[i & (QUEUE_CAPACITY - 1)];
+        if (cmd.byte_addr != SNAPSHOT_ADDR)
+            os.write(&cmd, sizeof(mmio_cmd_t));
+    }
+    for (uint32_t i = 0; i < st.pcm_count; i++)
+        os.write(&s_pcm_ring[(pcm_head + i) & (PCM_RING_CAPACITY - 1)], sizeof(int16_t));
+}
+
+extern "C" bool p8audio_verilated_load_state(const void *p, size_t n)
+{
+    // A snapshot from a run without the model has nothing to restore
+    if (!s_model || n < sizeof(audio_state_t))
+        return !s_model && !n;
+
+    std::lock_guard<std::mutex> guard(s_gen_lock);
+    SnapshotRestore is(p, n);
+
+    audio_state_t st;
+    is.read(&st, sizeof(st));
+    if (st.magic != STATE_MAGIC || st.version != STATE_VERSION ||
+        st.queue_count > QUEUE_CAPACITY || st.pcm_count > PCM_RING_CAPACITY) {
+        fprintf(stderr, "[p8audio_verilated] not a p8audio state\n");
+        return false;
+    }
+    is >> *s_model;
+
+    s_window_ns    = st.window_ns;
+    s_window_valid = st.window_valid;
+    s_idle         = st.idle;
+    s_stat_dirty   = true;
+    s_idle_run     = st.idle_run;
+    s_stat_age     = st.stat_age;
+    s_last_pcm     = st.last_pcm;
+    publish_stats(st.stat_last);
+
+    for (uint32_t i = 0; i < st.queue_count; i++)
+        is.read(&s_queue_buf[i], sizeof(mmio_cmd_t));
+    s_queue_head.store(0);
+    s_queue_tail.store(st.queue_count);
+
+    s_cpu_sfx_base   = st.sfx_base;
+    s_cpu_music_base = st.music_base;
+    snap_fill(s_dma_view, snap_region(s_cpu_sfx_base, SFX_BYTES),
+              snap_region(s_cpu_music_base, MUSIC_BYTES));
+    s_snap_head.store(0);
+    s_snap_next  = 0;
+    s_snap_force = true;
+
+    audioMixerLock();
+    for (uint32_t i = 0; i < st.pcm_count; i++)
+        is.read(&s_pcm_ring[i], sizeof(int16_t));
+    s_pcm_head.store(0);
+    s_pcm_tail.store(st.pcm_count);
+    s_out_last = st.out_last;
+    audioMixerUnlock();
+
+    if (s_ref_model)
+        check_stop();
+    return true;
+}
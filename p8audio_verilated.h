@@ -13,6 +13,8 @@
 #ifndef P8AUDIO_VERILATED_H
 #define P8AUDIO_VERILATED_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define P8AUDIO_VERSION UINT16_C(0)
@@ -28,12 +30,15 @@ extern "C" {
  *            the ADDR_* localparams in p8audio.sv (e.g. 0x02 for CTRL,
  *            0x18 for SFX_CMD, 0x1C for MUSIC_CMD).
  * data:      16-bit write data.
+ * emu_ns:    emulated time of the write (pacerEmuNs()), used to apply it
+ *            at the matching sample position.
  *
- * Thread-safe: may be called from any thread.  The write is queued and
- * applied in the SDL audio callback thread before the next batch of
- * samples is generated.
+ * Emulator thread only: the queue is single-producer and never blocks.
+ * The write is applied in the SDL audio callback thread while the
+ * samples around its timestamp are generated.
  */
-void p8audio_verilated_mmio_write(uint8_t byte_addr, uint16_t data);
+void p8audio_verilated_mmio_write(uint8_t byte_addr, uint16_t data,
+                                  uint64_t emu_ns);
 
 /*
  * Read a stat register from the Verilated p8audio model's shadow cache.
@@ -43,11 +48,52 @@ void p8audio_verilated_mmio_write(uint8_t byte_addr, uint16_t data);
  *              p8audio.sv (i.e. the value of addr - _P8AUDIO_BASE).
  * Returns:     16-bit register value; 0 if the offset is out of range.
  *
- * Thread-safe: reads from a shadow cache updated each sample by the SDL
- * audio thread.  Stale by at most ~45 µs (one sample period).
+ * Thread-safe and lock-free: reads from a shadow cache published by the
+ * SDL audio thread after MMIO writes and every 16 samples.  Stale by at
+ * most ~0.7 ms.
  */
 uint16_t p8audio_verilated_mmio_read(uint8_t byte_offset);
 
+/*
+ * Observe generated audio: fn is called with each buffer of 22050Hz mono
+ * samples after it is produced, on the audio thread (or the emulator
+ * thread in offline mode).  At most two taps.
+ */
+typedef void (*p8audio_tap_fn)(const int16_t *samples, int n);
+void p8audio_verilated_add_tap(p8audio_tap_fn fn);
+void p8audio_verilated_remove_tap(p8audio_tap_fn fn);
+
+/*
+ * Offline mode (--audio_offline): audio is generated from emulated time
+ * rather than by the device.  Emulator thread: generate every sample up
+ * to emulated time emu_ns (pacerEmuNs()) and pass it to the taps.
+ */
+bool p8audio_verilated_offline(void);
+void p8audio_verilated_advance_to(uint64_t emu_ns);
+
+/*
+ * Save or restore the model and every queued write and generated sample,
+ * so audio resumes at exactly the same sample.  Save passes the state to
+ * put in pieces, nothing without a model; restore reads it from the n
+ * bytes at p and returns false if they don't hold one.  Emulator thread
+ * only; needs a --savable Verilator build.
+ */
+void p8audio_verilated_save_state(void (*put)(void *ctx, const void *p, size_t n), void *ctx);
+bool p8audio_verilated_load_state(const void *p, size_t n);
+
+/*
+ * Trace the model around emulated time emu_ns (pacerEmuNs()) when
+ * --p8audio_trace_on has funcval; nothing without a P8AUDIO_TRACE build.
+ * Emulator thread only, as for p8audio_verilated_mmio_write.
+ */
+void p8audio_verilated_trace_mark(uint64_t emu_ns);
+
+/*
+ * Emulator thread, at start-up: start the poll that gives the model's
+ * DMA fresh copies of the SFX and music data when the guest changes it.
+ */
+void p8audio_verilated_dma_init(void);
+
 /* SDL audio lifecycle — implemented in p8audio_verilated.cpp */
 void p8audio_verilated_init(void);
 
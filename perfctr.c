@@ -0,0 +1,181 @@
+/*
+ * perfctr.c
+ *
+ * Performance counter registers, see perfctr.h.  A counter holds what it
+ * counted up to its last stop and, while running, adds what its source
+ * has counted since the start.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "btrace.h"
+#include "cycles.h"
+#include "memaccess.h"
+#include "perfctr.h"
+#include "savestate.h"
+
+#ifdef PROFILER
+#include "profiler/profiler_events.h"
+#endif
+
+static unsigned running;
+static uint64_t counted[PERFCTR_COUNTERS];	/* up to the last stop */
+static uint64_t start[PERFCTR_COUNTERS];	/* source at the start */
+static uint16_t latched[PERFCTR_COUNTERS];	/* LO, latched by reading HI */
+static uint16_t mark_hi;
+
+static uint64_t source(int c)
+{
+	switch (c) {
+	case PERFCTR_CYCLES:
+		return cpu_cycles;
+	case PERFCTR_INSNS:
+		return cpu_insns;
+	default:
+		return mem_hw_accesses;
+	}
+}
+
+static uint32_t value(int c)
+{
+	uint64_t v = counted[c];
+
+	if (running & (1u << c))
+		v += source(c) - start[c];
+	return (uint32_t)v;
+}
+
+static void set_running(unsigned run, unsigned clear)
+{
+	int c;
+
+	for (c = 0; c < PERFCTR_COUNTERS; c++) {
+		unsigned bit = 1u << c;
+
+		if ((running & bit) && !(run & bit))
+			counted[c] += source(c) - start[c];
+		if (clear & bit)
+			counted[c] = 0;
+		if ((run & bit) && (!(running & bit) || (clear & bit)))
+			start[c] = source(c);
+	}
+	running = run;
+	// Only ExecuteLoopCounted counts instructions
+	if (insn_counting != !!(running & (1u << PERFCTR_INSNS))) {
+		insn_counting = !insn_counting;
+		ExecuteLoopReselect();
+	}
+}
+
+/* The name at addr, cut at PERFCTR_MARK_MAX characters or where RAM ends */
+static void mark(uint32_t addr)
+{
+	char name[PERFCTR_MARK_MAX + 1];
+	int n;
+
+	for (n = 0; n < PERFCTR_MARK_MAX; n++) {
+		const char *p = MemoryHostRange(addr + n, 1, 0);
+
+		if (!p || !*p)
+			break;
+		name[n] = *p;
+	}
+	name[n] = 0;
+
+#ifdef PROFILER
+	{
+		int i;
+
+		// The name follows two characters to a value marker
+		Profiler_RecordMarker(PROFILER_MARKER_GUEST, n);
+		for (i = 0; i < n; i += 2)
+			Profiler_RecordMarker(PROFILER_MARKER_VALUE,
+					      (uint8_t)name[i] << 8 |
+					      (i + 1 < n ? (uint8_t)name[i + 1] : 0));
+	}
+#endif
+	if (btrace_on)
+		btraceMark(addr, name);
+	if (BTRACE_TEXT())
+		printf("MARK: %s\n", name);
+}
+
+uint16_t perfctr_read(unsigned reg)
+{
+	int c;
+
+	switch (reg) {
+	case PERFCTR_REG_ID:
+		return PERFCTR_ID;
+	case PERFCTR_REG_CTRL:
+		return running;
+	case PERFCTR_REG_CYCLES_HI:
+	case PERFCTR_REG_INSNS_HI:
+	case PERFCTR_REG_HW_HI: {
+		uint32_t v;
+
+		c = (reg - PERFCTR_REG_CYCLES_HI) / 4;
+		v = value(c);
+		latched[c] = v & 0xffff;
+		return v >> 16;
+	}
+	case PERFCTR_REG_CYCLES_LO:
+	case PERFCTR_REG_INSNS_LO:
+	case PERFCTR_REG_HW_LO:
+		return latched[(reg - PERFCTR_REG_CYCLES_LO) / 4];
+	case PERFCTR_REG_MARK_HI:
+		return mark_hi;
+	}
+	return 0;
+}
+
+void perfctr_write(unsigned reg, uint16_t d)
+{
+	unsigned all = (1u << PERFCTR_COUNTERS) - 1;
+
+	switch (reg) {
+	case PERFCTR_REG_CTRL:
+		set_running(d & all, (d >> PERFCTR_CTRL_ZERO_SHIFT) & all);
+		break;
+	case PERFCTR_REG_MARK_HI:
+		mark_hi = d;
+		break;
+	case PERFCTR_REG_MARK_LO:
+		mark((uint32_t)mark_hi << 16 | d);
+		break;
+	}
+}
+
+void perfctr_save_state(ss_buf *b)
+{
+	int c;
+
+	ssPut8(b, running);
+	ssPut64(b, cpu_insns);
+	ssPut64(b, mem_hw_accesses);
+	for (c = 0; c < PERFCTR_COUNTERS; c++) {
+		ssPut64(b, counted[c]);
+		ssPut64(b, start[c]);
+		ssPut16(b, latched[c]);
+	}
+	ssPut16(b, mark_hi);
+}
+
+int perfctr_load_state(ss_buf *b)
+{
+	int c;
+
+	running = ssGet8(b);
+	insn_counting = running & (1u << PERFCTR_INSNS);
+	cpu_insns = ssGet64(b);
+	mem_hw_accesses = ssGet64(b);
+	for (c = 0; c < PERFCTR_COUNTERS; c++) {
+		counted[c] = ssGet64(b);
+		start[c] = ssGet64(b);
+		latched[c] = ssGet16(b);
+	}
+	mark_hi = ssGet16(b);
+	return b->error ? -1 : 0;
+}
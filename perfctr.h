@@ -0,0 +1,72 @@
+/*
+ * perfctr.h
+ *
+ * Emulator-only performance counter registers, so a guest can time its
+ * own code without estimating from the 1MHz user timer.  Three 32-bit
+ * counters can each be started and stopped: emulated CPU cycles (see
+ * cycles.h), instructions retired and guest accesses to HW registers, a
+ * long access counting once.  Reading a counter's HI word latches its LO
+ * word, so a long read is consistent.  Counting instructions runs
+ * without the JIT's compiled blocks.
+ *
+ * Writing MARK_LO takes MARK_HI:MARK_LO as the guest address of a NUL
+ * terminated name and puts a marker with it into the profiler timeline
+ * and the execution trace (--trace_file, the flight recorder or the
+ * asyncTrace text).
+ *
+ * All registers are 16 bits, big endian:
+ *   +0x00 ID         'PF' (0x5046)
+ *   +0x02 CTRL       read: counters running; write: bits 0-2 the counters
+ *                    to run (cycles, instructions, HW accesses), bits
+ *                    8-10 zero these counters
+ *   +0x04 CYCLES_HI
+ *   +0x06 CYCLES_LO
+ *   +0x08 INSNS_HI
+ *   +0x0a INSNS_LO
+ *   +0x0c HW_HI
+ *   +0x0e HW_LO
+ *   +0x10 MARK_HI
+ *   +0x12 MARK_LO
+ */
+
+#ifndef PERFCTR_H
+#define PERFCTR_H
+
+#include <stdint.h>
+
+#ifndef _PERFCTR_BASE
+#define _PERFCTR_BASE		0x8f0010
+#endif
+#define _PERFCTR_SIZE		0x20
+
+#define PERFCTR_ID		0x5046
+#define PERFCTR_CYCLES		0
+#define PERFCTR_INSNS		1
+#define PERFCTR_HW		2
+#define PERFCTR_COUNTERS	3
+#define PERFCTR_CTRL_ZERO_SHIFT	8
+
+#define PERFCTR_REG_ID		0x00
+#define PERFCTR_REG_CTRL	0x02
+#define PERFCTR_REG_CYCLES_HI	0x04
+#define PERFCTR_REG_CYCLES_LO	0x06
+#define PERFCTR_REG_INSNS_HI	0x08
+#define PERFCTR_REG_INSNS_LO	0x0a
+#define PERFCTR_REG_HW_HI	0x0c
+#define PERFCTR_REG_HW_LO	0x0e
+#define PERFCTR_REG_MARK_HI	0x10
+#define PERFCTR_REG_MARK_LO	0x12
+
+#define PERFCTR_MARK_MAX	31	/* characters of a marker name */
+
+struct ss_buf;
+
+/* Word access to the register at offset reg */
+uint16_t perfctr_read(unsigned reg);
+void perfctr_write(unsigned reg, uint16_t d);
+
+/* Save state: the counters and what they count from */
+void perfctr_save_state(struct ss_buf *b);
+int perfctr_load_state(struct ss_buf *b);
+
+#endif /* PERFCTR_H */
@@ -3,13 +3,102 @@
 #include "profiler_thread.h"
 #include "profiler_client.h"
 
+#include <string>
+#include <vector>
+
 extern "C" {
 
+static Profiler::ProfilerConfig g_api_config;
+
+// Regions named before the profiler is started
+struct PendingRegion {
+    std::string name;
+    uint32_t base, size;
+};
+static std::vector<PendingRegion> g_pending_regions;
+
+void Profiler_Configure(unsigned buffer_size, unsigned buffer_count, int drop_on_overflow) {
+    if (buffer_size)
+        g_api_config.buffer_size = buffer_size;
+    if (buffer_count)
+        g_api_config.buffer_count = buffer_count;
+    g_api_config.drop_on_overflow = drop_on_overflow != 0;
+    Profiler::ConfigureProfiler(g_api_config);
+}
+
+void Profiler_SetTraceFile(const char* filename) {
+    g_api_config.trace_filename = filename ? filename : "";
+    Profiler::ConfigureProfiler(g_api_config);
+}
+
+void Profiler_SetSampleInterval(unsigned interval) {
+    g_api_config.sample_interval = interval;
+    Profiler::ConfigureProfiler(g_api_config);
+}
+
+void Profiler_SetTimeline(const char* filename, unsigned max_depth) {
+    g_api_config.timeline_filename = filename ? filename : "";
+    if (max_depth)
+        g_api_config.timeline_depth = max_depth;
+    Profiler::ConfigureProfiler(g_api_config);
+}
+
+void Profiler_SetHeatmapFile(const char* filename) {
+    g_api_config.heatmap_filename = filename ? filename : "";
+    Profiler::ConfigureProfiler(g_api_config);
+}
+
+void Profiler_SetFoldedFile(const char* filename, const char* weight) {
+    g_api_config.folded_filename = filename ? filename : "";
+    g_api_config.folded_weight = weight && weight[0] ? weight : "instructions";
+    Profiler::ConfigureProfiler(g_api_config);
+}
+
+void Profiler_SetLiveView(int port, unsigned frames) {
+    g_api_config.live_port = port;
+    if (frames)
+        g_api_config.live_frames = frames;
+    Profiler::ConfigureProfiler(g_api_config);
+}
+
+void Profiler_SetLoopReport(const char* filename) {
+    g_api_config.loops_filename = filename ? filename : "";
+    Profiler::ConfigureProfiler(g_api_config);
+}
+
+void Profiler_SetMemoryModel(const char* spec) {
+    g_api_config.memory_spec = spec ? spec : "";
+    Profiler::ConfigureProfiler(g_api_config);
+}
+
+void Profiler_AddSymbolFile(const char* filename) {
+    if (filename && filename[0])
+        g_api_config.symbol_files.push_back(filename);
+    Profiler::ConfigureProfiler(g_api_config);
+}
+
+void Profiler_AddMemoryRegion(const char* name, uint32_t base, uint32_t size) {
+    if (Profiler::GetProfiler())
+        Profiler::GetProfiler()->AddMemoryRegion(name, base, size);
+    else
+        g_pending_regions.push_back({name, base, size});
+}
+
 void Profiler_Initialize(void) {
     Profiler::InitializeProfiler();
+    for (const PendingRegion& region : g_pending_regions)
+        Profiler::GetProfiler()->AddMemoryRegion(region.name, region.base, region.size);
+    g_pending_regions.clear();
     Profiler::InitializeClient();
 }
 
+void Profiler_Flush(void) {
+    if (!Profiler::GetProfiler())
+        return;
+    Profiler::GetClientBufferManager()->Submit();
+    Profiler::GetProfiler()->Flush();
+}
+
 void Profiler_Shutdown(void) {
     Profiler::CleanupClient();
     Profiler::ShutdownProfiler();
@@ -3,13 +3,69 @@
 #ifndef PROFILER_API_H
 #define PROFILER_API_H
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Set the event buffer size, the number of buffers and whether events are
+// dropped instead of stalling the emulator when all buffers are full.
+// Call before Profiler_Initialize; 0 keeps the default size or count.
+void Profiler_Configure(unsigned buffer_size, unsigned buffer_count, int drop_on_overflow);
+
+// Record the raw events to a trace file for profiler_replay instead of
+// building the profile live.  Call before Profiler_Initialize.
+void Profiler_SetTraceFile(const char* filename);
+
+// Take a sample every interval instructions instead of recording every
+// event (0, the default, records everything).  Call before
+// Profiler_Initialize.
+void Profiler_SetSampleInterval(unsigned interval);
+
+// Also write a Chrome trace timeline of calls, frames and audio writes,
+// see profiler_timeline.h; calls deeper than max_depth (0 for the
+// default) are left out.  Call before Profiler_Initialize.
+void Profiler_SetTimeline(const char* filename, unsigned max_depth);
+
+// Write a data access heatmap report to filename at each flush, see
+// profiler_heatmap.h.  Call before Profiler_Initialize.
+void Profiler_SetHeatmapFile(const char* filename);
+
+// Write folded call stacks for flamegraphs to filename at each flush,
+// weighted by cycles, instructions, reads or writes (NULL or "" for
+// instructions), see profiler_folded.h.  Call before Profiler_Initialize.
+void Profiler_SetFoldedFile(const char* filename, const char* weight);
+
+// Serve a live view of the hottest functions over the last second and
+// the last frames displayed (0 for the default) on port of 127.0.0.1, 0
+// for none; see profiler_live.h.  Call before Profiler_Initialize.
+void Profiler_SetLiveView(int port, unsigned frames);
+
+// Write the hottest loops with their trip counts to filename at each
+// flush, see profiler_loops.h.  Call before Profiler_Initialize.
+void Profiler_SetLoopReport(const char* filename);
+
+// Charge memory stall cycles from a model of the nextp8 memory system
+// given as a spec (see MemoryConfig in profiler_cost_model.h); NULL or ""
+// for none.  Call before Profiler_Initialize.
+void Profiler_SetMemoryModel(const char* spec);
+
+// Name functions and give source lines in the profile from the symbols
+// and DWARF line table of an ELF file (the cart or the BSP).  Call before
+// Profiler_Initialize, once per file.
+void Profiler_AddSymbolFile(const char* filename);
+
+// Name an address range in the heatmap report
+void Profiler_AddMemoryRegion(const char* name, uint32_t base, uint32_t size);
+
 // Initialize the profiler system
 void Profiler_Initialize(void);
 
+// Hand the events recorded so far to the profiler thread and have it
+// write the output files
+void Profiler_Flush(void);
+
 // Shutdown the profiler system
 void Profiler_Shutdown(void);
 
@@ -1,166 +1,291 @@
 // Callgrind file format serializer implementation
 
 #include "profiler_callgrind.h"
-#include "profiler_grouped.h"
 #include "profiler_cost_model.h"
-#include <cassert>
-#include <iomanip>
+#include <charconv>
+#include <cstdio>
 #include <iostream>
 
 namespace Profiler {
 
-CallgrindSerializer::CallgrindSerializer() {
+// Numbers go straight into the output buffer, without stream formatting
+static void AppendDec(std::string& out, uint64_t value) {
+    char buf[24];
+    out.append(buf, std::to_chars(buf, buf + sizeof(buf), value).ptr);
 }
 
-CallgrindSerializer::~CallgrindSerializer() {
+static void AppendHex(std::string& out, uint32_t value) {
+    char buf[16];
+    out += "0x";
+    out.append(buf, std::to_chars(buf, buf + sizeof(buf), value, 16).ptr);
 }
 
-bool CallgrindSerializer::WriteToFile(const std::string& filename, const GroupedProfilerData& data) {
-    std::ofstream out(filename);
-    if (!out.is_open()) {
-        std::cerr << "Failed to open callgrind output file: " << filename << std::endl;
-        return false;
-    }
-
-    WriteHeader(out, data);
-    WriteBody(out, data);
+// Cycles Instructions DataReads DataWrites Stalls; cycles include the stalls
+static void AppendCosts(std::string& out, uint64_t instructions, uint64_t instr_fetches,
+                        uint64_t data_reads, uint64_t data_writes, uint64_t stall_cycles) {
+    // Use cost model for cycle calculation
+    uint64_t cycles = Profiler_CalculateCycles(instructions, instr_fetches, data_reads, data_writes) +
+                      stall_cycles;
+    out += ' ';
+    AppendDec(out, cycles);
+    out += ' ';
+    AppendDec(out, instructions);
+    out += ' ';
+    AppendDec(out, data_reads);
+    out += ' ';
+    AppendDec(out, data_writes);
+    out += ' ';
+    AppendDec(out, stall_cycles);
+    out += '\n';
+}
 
-    out.close();
-    return true;
+// Source line of an address, 0 if unknown; file is left alone then
+static unsigned LineOf(const SymbolTable* symbols, uint32_t address, const std::string*& file) {
+    unsigned line;
+    return symbols->FindLine(address, file, line) ? line : 0;
 }
 
-void CallgrindSerializer::WriteHeader(std::ofstream& out, const GroupedProfilerData& data) {
-    // Format marker
-    out << "# callgrind format\n";
-    out << "version: 1\n";
-    out << "creator: sqlux-profiler\n";
-    out << "cmd: sqlux\n";
-    out << "\n";
+CallgrindSerializer::CallgrindSerializer() {
+}
 
-    // Position specification - we only track instruction addresses
-    out << "positions: instr\n";
+CallgrindSerializer::~CallgrindSerializer() {
+}
 
-    // Event types - Cycles, Instructions, DataReads, DataWrites
-    out << "events: Cycles Instructions DataReads DataWrites\n";
+bool CallgrindSerializer::WriteToFile(const std::string& filename, const GroupedProfilerData& data,
+                                      const SymbolTable* symbols) {
+    std::string header, body;
+    EventCounters totals;
 
     // Calculate totals across all functions
-    uint64_t total_instructions = 0;
-    uint64_t total_instr_fetches = 0;
-    uint64_t total_data_reads = 0;
-    uint64_t total_data_writes = 0;
-
     for (const auto& func_entry : data.GetFunctions()) {
         const GroupedFunction& func = func_entry.second;
-        total_instructions += func.total_self_instructions;
-        total_instr_fetches += func.total_self_instr_fetches;
-        total_data_reads += func.total_self_data_reads;
-        total_data_writes += func.total_self_data_writes;
+        totals.instructions += func.total_self_instructions;
+        totals.instr_fetches += func.total_self_instr_fetches;
+        totals.data_reads += func.total_self_data_reads;
+        totals.data_writes += func.total_self_data_writes;
+        totals.stall_cycles += func.total_self_stall_cycles;
+        FormatFunction(body, func, symbols);
     }
+    FormatHeader(header, totals, symbols != nullptr);
 
-    // Use cost model for total cycle calculation
-    uint64_t total_cycles = Profiler_CalculateCycles(
-        total_instructions, total_instr_fetches, total_data_reads, total_data_writes);
+    return WriteParts(filename, {&header, &body});
+}
+
+void CallgrindSerializer::FormatHeader(std::string& out, const EventCounters& totals, bool lines) {
+    // Format marker
+    out += "# callgrind format\n";
+    out += "version: 1\n";
+    out += "creator: sqlux-profiler\n";
+    out += "cmd: sqlux\n";
+    out += "\n";
+
+    // Position specification - instruction addresses, and source lines
+    // when there are symbols
+    out += lines ? "positions: instr line\n" : "positions: instr\n";
+
+    // Event types - Cycles, Instructions, DataReads, DataWrites, Stalls
+    out += "events: Cycles Instructions DataReads DataWrites Stalls\n";
 
     // Summary
-    out << "summary: " << total_cycles << " " << total_instructions << " "
-        << total_data_reads << " " << total_data_writes << "\n";
-    out << "\n";
+    out += "summary:";
+    AppendCosts(out, totals.instructions, totals.instr_fetches, totals.data_reads, totals.data_writes,
+                totals.stall_cycles);
+    out += "\n";
 }
 
-void CallgrindSerializer::WriteBody(std::ofstream& out, const GroupedProfilerData& data) {
-    const auto& functions = data.GetFunctions();
+void CallgrindSerializer::FormatFunction(std::string& out, const GroupedFunction& func,
+                                         const SymbolTable* symbols) {
+    static const std::string unknown_file("???");
+    uint32_t last_address = 0;
+    const std::string* file = &unknown_file;
 
-    if (functions.empty()) {
-        return;
+    // Write function header
+    if (symbols) {
+        LineOf(symbols, func.entry_address, file);
+        out += "fl=";
+        out += *file;
+        out += "\nfn=";
+        out += symbols->FunctionName(func.entry_address);
+    } else {
+        out += "fn=";
+        AppendHex(out, func.entry_address);
     }
+    out += '\n';
 
-    // Write each function's costs
-    for (const auto& func_entry : functions) {
-        uint32_t func_addr = func_entry.first;
-        const GroupedFunction& func = func_entry.second;
+    // Build a map of caller addresses to calls for this function
+    std::map<uint32_t, std::vector<const FunctionCall*>> calls_by_address;
+    for (const auto& call : func.calls) {
+        calls_by_address[call.caller_address].push_back(&call);
+    }
 
-        // Write function header
-        out << "fn=0x" << std::hex << func_addr << std::dec << "\n";
+    // Write costs for all instructions in this function
+    for (const auto& instr : func.instructions) {
+        uint32_t address = instr.address;
+        const InstructionCost& cost = instr.cost;
+        unsigned line = 0;
 
-        uint32_t last_address = 0;
+        // Code inlined from another file
+        if (symbols) {
+            const std::string* instr_file = file;
+            line = LineOf(symbols, address, instr_file);
+            if (instr_file != file) {
+                file = instr_file;
+                out += "fi=";
+                out += *file;
+                out += '\n';
+            }
+        }
 
-        // Build a map of caller addresses to calls for this function
-        std::map<uint32_t, std::vector<const FunctionCall*>> calls_by_address;
-        for (const auto& call : func.calls) {
-            calls_by_address[call.caller_address].push_back(&call);
+        // Write self-cost line with address (absolute or relative)
+        if (last_address == 0) {
+            // First address - write absolute
+            AppendHex(out, address);
+        } else {
+            // Use relative addressing if close enough
+            int64_t diff = static_cast<int64_t>(address) - static_cast<int64_t>(last_address);
+            if (diff > 0 && diff <= 1000) {
+                out += '+';
+                AppendDec(out, diff);
+            } else if (diff < 0 && diff >= -1000) {
+                out += '-';
+                AppendDec(out, -diff);
+            } else if (diff == 0) {
+                out += '*';
+            } else {
+                // Large jump - use absolute
+                AppendHex(out, address);
+            }
+        }
+        if (symbols) {
+            out += ' ';
+            AppendDec(out, line);
         }
+        AppendCosts(out, cost.self_cost, cost.instr_fetches, cost.data_reads, cost.data_writes,
+                    cost.stall_cycles);
 
-        // Write costs for all instructions in this function
-        for (const auto& instr : func.instructions) {
-            uint32_t address = instr.address;
-            const InstructionCost& cost = instr.cost;
+        last_address = address;
 
-            // Write self-cost line with address (absolute or relative)
-            if (last_address == 0) {
-                // First address - write absolute
-                out << "0x" << std::hex << address << std::dec;
-            } else {
-                // Use relative addressing if close enough
-                int64_t diff = static_cast<int64_t>(address) - static_cast<int64_t>(last_address);
-                if (diff > 0 && diff <= 1000) {
-                    out << "+" << diff;
-                } else if (diff < 0 && diff >= -1000) {
-                    out << diff;
-                } else if (diff == 0) {
-                    out << "*";
+        // Write any calls from this instruction
+        auto calls_it = calls_by_address.find(address);
+        if (calls_it != calls_by_address.end()) {
+            for (const FunctionCall* call : calls_it->second) {
+                const std::string* target_file = &unknown_file;
+                unsigned target_line = symbols ? LineOf(symbols, call->target_function, target_file) : 0;
+
+                // cfn= line (called function)
+                if (symbols) {
+                    out += "cfi=";
+                    out += *target_file;
+                    out += "\ncfn=";
+                    out += symbols->FunctionName(call->target_function);
                 } else {
-                    // Large jump - use absolute
-                    out << "0x" << std::hex << address << std::dec;
+                    out += "cfn=";
+                    AppendHex(out, call->target_function);
                 }
-            }
+                out += '\n';
 
-            // Write self cost values: Cycles Instructions DataReads DataWrites
-            // Use cost model for cycle calculation
-            uint64_t cycles = Profiler_CalculateCycles(
-                cost.self_cost, cost.instr_fetches, cost.data_reads, cost.data_writes);
-            out << " " << cycles
-                << " " << cost.self_cost
-                << " " << cost.data_reads
-                << " " << cost.data_writes
-                << "\n";
-
-            last_address = address;
-
-            // Write any calls from this instruction
-            auto calls_it = calls_by_address.find(address);
-            if (calls_it != calls_by_address.end()) {
-                for (const FunctionCall* call : calls_it->second) {
-                    // cfn= line (called function)
-                    out << "cfn=0x" << std::hex << call->target_function << std::dec << "\n";
-
-                    // calls= line (count and target position)
-                    out << "calls=" << call->call_count
-                        << " 0x" << std::hex << call->target_function << std::dec
-                        << "\n";
-
-                    // Cost line for the call (source position and inclusive costs)
-                    // The position must be the caller address
-                    // Use cost model for inclusive cycle calculation
-                    uint64_t incl_cycles = Profiler_CalculateCycles(
-                        call->inclusive_instructions,
-                        call->inclusive_instr_fetches,
-                        call->inclusive_data_reads,
-                        call->inclusive_data_writes);
-                    out << "0x" << std::hex << call->caller_address << std::dec
-                        << " " << incl_cycles
-                        << " " << call->inclusive_instructions
-                        << " " << call->inclusive_data_reads
-                        << " " << call->inclusive_data_writes
-                        << "\n";
-
-                    // Update last_address since we just wrote the caller address
-                    last_address = call->caller_address;
+                // calls= line (count and target position)
+                out += "calls=";
+                AppendDec(out, call->call_count);
+                out += ' ';
+                AppendHex(out, call->target_function);
+                if (symbols) {
+                    out += ' ';
+                    AppendDec(out, target_line);
                 }
+                out += '\n';
+
+                // Cost line for the call (source position and inclusive costs)
+                // The position must be the caller address
+                AppendHex(out, call->caller_address);
+                if (symbols) {
+                    out += ' ';
+                    AppendDec(out, line);
+                }
+                AppendCosts(out, call->inclusive_instructions, call->inclusive_instr_fetches,
+                            call->inclusive_data_reads, call->inclusive_data_writes,
+                            call->inclusive_stall_cycles);
+
+                // Update last_address since we just wrote the caller address
+                last_address = call->caller_address;
             }
         }
+    }
+
+    out += '\n';
+}
+
+bool CallgrindSerializer::WriteParts(const std::string& filename,
+                                     const std::vector<const std::string*>& parts) {
+    std::string temp = filename + ".tmp";
+    FILE* out = std::fopen(temp.c_str(), "wb");
+    bool ok = out != nullptr;
+
+    if (!ok) {
+        std::cerr << "Failed to open profiler output file: " << temp << std::endl;
+        return false;
+    }
+    for (const std::string* part : parts)
+        ok &= std::fwrite(part->data(), 1, part->size(), out) == part->size();
+    ok &= std::fclose(out) == 0;
+#ifdef _WIN32
+    // rename() doesn't replace an existing file here
+    std::remove(filename.c_str());
+#endif
+    if (!ok || std::rename(temp.c_str(), filename.c_str()) != 0) {
+        std::cerr << "Failed to write profiler output file: " << filename << std::endl;
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+void CallgrindWriter::Update(const ProfilerData& data) {
+    std::set<uint32_t> dirty;
+    grouping_.Update(data, data.GetChangedAddresses(), data.GetAddedAddresses(), dirty);
+
+    // Reformat what changed, keeping the totals in step
+    for (uint32_t entry : dirty) {
+        auto it = functions_.find(entry);
+        GroupedFunction func;
+
+        if (it != functions_.end()) {
+            totals_.instructions -= it->second.self.instructions;
+            totals_.instr_fetches -= it->second.self.instr_fetches;
+            totals_.data_reads -= it->second.self.data_reads;
+            totals_.data_writes -= it->second.self.data_writes;
+            totals_.stall_cycles -= it->second.self.stall_cycles;
+        }
+        if (!grouping_.Build(data, entry, func)) {
+            if (it != functions_.end())
+                functions_.erase(it);
+            continue;
+        }
 
-        out << "\n";
+        FormattedFunction& formatted = functions_[entry];
+        formatted.text.clear();
+        CallgrindSerializer::FormatFunction(formatted.text, func, symbols_);
+        formatted.self.instructions = func.total_self_instructions;
+        formatted.self.instr_fetches = func.total_self_instr_fetches;
+        formatted.self.data_reads = func.total_self_data_reads;
+        formatted.self.data_writes = func.total_self_data_writes;
+        formatted.self.stall_cycles = func.total_self_stall_cycles;
+        totals_.instructions += formatted.self.instructions;
+        totals_.instr_fetches += formatted.self.instr_fetches;
+        totals_.data_reads += formatted.self.data_reads;
+        totals_.data_writes += formatted.self.data_writes;
+        totals_.stall_cycles += formatted.self.stall_cycles;
     }
 }
 
+bool CallgrindWriter::WriteToFile(const std::string& filename) const {
+    std::string header;
+    std::vector<const std::string*> parts;
+    CallgrindSerializer::FormatHeader(header, totals_, symbols_ != nullptr);
+    parts.push_back(&header);
+    for (const auto& entry : functions_)
+        parts.push_back(&entry.second.text);
+    return CallgrindSerializer::WriteParts(filename, parts);
+}
+
 } // namespace Profiler
@@ -3,13 +3,15 @@
 #ifndef PROFILER_CALLGRIND_H
 #define PROFILER_CALLGRIND_H
 
+#include "profiler_data.h"
+#include "profiler_grouped.h"
+#include "profiler_symbols.h"
+#include <map>
 #include <string>
-#include <fstream>
+#include <vector>
 
 namespace Profiler {
 
-class GroupedProfilerData;
-
 // Serialize profiler data to callgrind format
 class CallgrindSerializer {
 public:
@@ -18,11 +20,48 @@ public:
 
     // Write profiler data to a file in callgrind format
     // Returns true on success
-    bool WriteToFile(const std::string& filename, const GroupedProfilerData& data);
+    bool WriteToFile(const std::string& filename, const GroupedProfilerData& data,
+                     const SymbolTable* symbols = nullptr);
+
+    // Format the header and one function's body; with symbols, functions
+    // are named and positions carry source lines
+    static void FormatHeader(std::string& out, const EventCounters& totals, bool lines = false);
+    static void FormatFunction(std::string& out, const GroupedFunction& func,
+                               const SymbolTable* symbols = nullptr);
+
+    // Write parts to a temporary file renamed over filename, so readers
+    // never see a partial profile
+    static bool WriteParts(const std::string& filename, const std::vector<const std::string*>& parts);
+};
+
+// Incremental callgrind output: the grouping and the formatted text of
+// each function are kept between writes, so a periodic flush only
+// regroups and formats the functions whose costs changed
+class CallgrindWriter {
+public:
+    // Names and lines for the output; set before the first write
+    void SetSymbols(const SymbolTable* symbols) {
+        symbols_ = symbols;
+    }
+
+    // Regroup and reformat what data's last Finalize() changed; every
+    // Finalize() must be followed by an update for the changes to be
+    // picked up
+    void Update(const ProfilerData& data);
+
+    // Write the profile as of the last update
+    bool WriteToFile(const std::string& filename) const;
 
 private:
-    void WriteHeader(std::ofstream& out, const GroupedProfilerData& data);
-    void WriteBody(std::ofstream& out, const GroupedProfilerData& data);
+    struct FormattedFunction {
+        std::string text;
+        EventCounters self;
+    };
+
+    FunctionGrouping grouping_;
+    std::map<uint32_t, FormattedFunction> functions_;
+    EventCounters totals_;
+    const SymbolTable* symbols_ = nullptr;
 };
 
 } // namespace Profiler
@@ -2,6 +2,7 @@
 
 #include "profiler_client.h"
 #include "profiler_data.h"
+#include <iostream>
 
 // Forward declarations of global buffer pointers (defined at end of file)
 extern "C" {
@@ -12,10 +13,15 @@ extern "C" {
 namespace Profiler {
 
 ClientBufferManager::ClientBufferManager()
-    : current_buffer_(nullptr) {
+    : current_buffer_(nullptr), sampling_(false), dropped_events_(0), dropped_buffers_(0) {
     // Get the first empty buffer from the profiler
     ProfilerThread* profiler = GetProfiler();
     if (profiler) {
+        // Sampling: the instrumentation writes into a small scratch buffer
+        // that is never looked at, and only samples go to the profiler
+        sampling_ = profiler->GetSampleInterval() != 0;
+        if (sampling_)
+            scratch_.reset(new EventBuffer(1024));
         current_buffer_ = profiler->GetEmptyBuffer();
         UpdateGlobalPointers();
     }
@@ -24,7 +30,8 @@ ClientBufferManager::ClientBufferManager()
 ClientBufferManager::~ClientBufferManager() {
     // Update count based on how much of buffer was used
     if (current_buffer_) {
-        current_buffer_->count = ::profiler_current_buffer_ptr - current_buffer_->events;
+        if (!sampling_)
+            current_buffer_->count = ::profiler_current_buffer_ptr - current_buffer_->events.get();
 
         // Push any remaining data
         if (current_buffer_->count > 0) {
@@ -34,6 +41,11 @@ ClientBufferManager::~ClientBufferManager() {
             }
         }
     }
+
+    if (dropped_buffers_) {
+        std::cerr << "Profiler: dropped " << dropped_events_ << " events in "
+                  << dropped_buffers_ << " full buffers\n";
+    }
 }
 
 EventBuffer* ClientBufferManager::GetCurrentBuffer() {
@@ -46,21 +58,76 @@ void ClientBufferManager::SwitchBuffer() {
         return;
     }
 
+    if (sampling_) {
+        UpdateGlobalPointers();
+        return;
+    }
+
     // Update count based on how much of buffer was used
     if (current_buffer_) {
-        current_buffer_->count = ::profiler_current_buffer_ptr - current_buffer_->events;
+        current_buffer_->count = ::profiler_current_buffer_ptr - current_buffer_->events.get();
+        PassOn(profiler);
+        UpdateGlobalPointers();
+        return;
+    }
+
+    // Get a new empty buffer
+    current_buffer_ = profiler->GetEmptyBuffer();
+    UpdateGlobalPointers();
+}
+
+// Hand the full current buffer over and take a fresh one, or drop its
+// events if there is none and that is the policy
+void ClientBufferManager::PassOn(ProfilerThread* profiler) {
+    if (profiler->DropsOnOverflow()) {
+        // Keep the full buffer and overwrite it if there is no other
+        EventBuffer* next = profiler->GetEmptyBuffer();
+        if (!next) {
+            dropped_events_ += current_buffer_->count;
+            dropped_buffers_++;
+            current_buffer_->Clear();
+            return;
+        }
         profiler->PushFilledBuffer(current_buffer_);
+        current_buffer_ = next;
+        return;
     }
+    profiler->PushFilledBuffer(current_buffer_);
 
     // Get a new empty buffer
     current_buffer_ = profiler->GetEmptyBuffer();
+}
+
+void ClientBufferManager::AddSampleEvent(uint32_t event) {
+    ProfilerThread* profiler = GetProfiler();
+
+    if (!profiler || !current_buffer_)
+        return;
+    current_buffer_->AddEvent(event);
+    if (current_buffer_->IsFull())
+        PassOn(profiler);
+}
+
+void ClientBufferManager::Submit() {
+    ProfilerThread* profiler = GetProfiler();
+
+    if (!profiler || !current_buffer_)
+        return;
+    if (!sampling_)
+        current_buffer_->count = ::profiler_current_buffer_ptr - current_buffer_->events.get();
+    if (current_buffer_->count == 0)
+        return;
+    PassOn(profiler);
     UpdateGlobalPointers();
 }
 
 void ClientBufferManager::UpdateGlobalPointers() {
-    if (current_buffer_) {
-        ::profiler_current_buffer_ptr = current_buffer_->events;
-        ::profiler_buffer_end_ptr = current_buffer_->events + BUFFER_SIZE;
+    if (sampling_) {
+        ::profiler_current_buffer_ptr = scratch_->events.get();
+        ::profiler_buffer_end_ptr = scratch_->events.get() + scratch_->capacity;
+    } else if (current_buffer_) {
+        ::profiler_current_buffer_ptr = current_buffer_->events.get();
+        ::profiler_buffer_end_ptr = current_buffer_->events.get() + current_buffer_->capacity;
     } else {
         ::profiler_current_buffer_ptr = nullptr;
         ::profiler_buffer_end_ptr = nullptr;
@@ -102,3 +169,10 @@ extern "C" void Profiler_SwitchBuffer(void) {
         mgr->SwitchBuffer();
     }
 }
+
+extern "C" void Profiler_RecordSampleEvent(uint32_t event) {
+    Profiler::ClientBufferManager* mgr = Profiler::GetClientBufferManager();
+    if (mgr) {
+        mgr->AddSampleEvent(event);
+    }
+}
@@ -14,6 +14,9 @@ extern "C" {
 // C-linkage function for switching buffers
 void Profiler_SwitchBuffer(void);
 
+// Append one event of a sample (sampling mode)
+void Profiler_RecordSampleEvent(uint32_t event);
+
 #ifdef __cplusplus
 }
 
@@ -35,8 +38,20 @@ public:
     // Update the global buffer pointers after switching buffers
     void UpdateGlobalPointers();
 
+    // Append an event of a sample to the current buffer
+    void AddSampleEvent(uint32_t event);
+
+    // Hand the events so far to the profiler thread (recording stops)
+    void Submit();
+
 private:
+    void PassOn(ProfilerThread* profiler);
+
     EventBuffer* current_buffer_;
+    std::unique_ptr<EventBuffer> scratch_;  // Instrumentation sink when sampling
+    bool sampling_;
+    uint64_t dropped_events_;   // Lost to the drop on overflow policy
+    uint64_t dropped_buffers_;
 };
 
 // Global client buffer manager
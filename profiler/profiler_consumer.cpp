@@ -1,14 +1,69 @@
 // Profiler buffer consumer implementation
 
 #include "profiler_consumer.h"
+#include "thread_policy.h"
 
 namespace Profiler {
 
-BufferConsumer::BufferConsumer(ProfilerData& data)
-    : data_(data) {
+BufferConsumer::BufferConsumer(ProfilerData& data, ReleaseFunc release, WakeFunc wake)
+    : data_(data), release_(release), wake_(wake) {
 }
 
 BufferConsumer::~BufferConsumer() {
+    StopWorkers();
+}
+
+void BufferConsumer::StartWorkers(unsigned count, size_t buffers) {
+    StopWorkers();
+    data_.SetShardCount(count ? count : 1);
+    if (count == 0)
+        return;
+    for (unsigned i = 0; i < count; ++i) {
+        workers_.emplace_back(new Worker());
+        workers_.back()->released.Reset(buffers);
+        workers_.back()->thread = std::thread(&BufferConsumer::WorkerFunc, this,
+                                              workers_.back().get(), &data_.GetShard(i));
+    }
+}
+
+void BufferConsumer::StopWorkers() {
+    for (auto& worker : workers_) {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->stop = true;
+        }
+        worker->cv.notify_all();
+        worker->thread.join();
+    }
+    Collect();
+    workers_.clear();
+}
+
+void BufferConsumer::WorkerFunc(Worker* worker, CostShard* shard) {
+    threadPolicyApply(THREAD_PROFILER);
+    std::unique_lock<std::mutex> lock(worker->mutex);
+
+    for (;;) {
+        worker->cv.wait(lock, [worker] { return !worker->queue.empty() || worker->stop; });
+        // Queued buffers are finished even when stopping
+        if (worker->queue.empty())
+            return;
+        EventBuffer* buffer = worker->queue.front();
+        worker->queue.pop_front();
+        worker->busy = true;
+        lock.unlock();
+
+        shard->ProcessEvents(buffer->events.get(), buffer->count);
+        // The ring has room for every buffer in the pool
+        if (buffer->pending.fetch_sub(1) == 1) {
+            worker->released.Push(buffer);
+            wake_();
+        }
+
+        lock.lock();
+        worker->busy = false;
+        worker->cv.notify_all();
+    }
 }
 
 void BufferConsumer::ProcessBuffer(EventBuffer* buffer) {
@@ -16,13 +71,49 @@ void BufferConsumer::ProcessBuffer(EventBuffer* buffer) {
         return;
     }
 
+    buffer->pending.store(workers_.size() + 1);
+    for (auto& worker : workers_) {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        worker->queue.push_back(buffer);
+        worker->cv.notify_all();
+    }
+
     // Process all events in the buffer
     for (size_t i = 0; i < buffer->count; ++i) {
         data_.ProcessEvent(buffer->events[i]);
     }
 
-    // Clear the buffer after processing
-    buffer->Clear();
+    // Clear the buffer after processing, unless a worker still reads it
+    if (buffer->pending.fetch_sub(1) == 1) {
+        buffer->Clear();
+        release_(buffer);
+    }
+    Collect();
+}
+
+void BufferConsumer::Collect() {
+    for (auto& worker : workers_) {
+        while (EventBuffer* buffer = worker->released.Pop()) {
+            buffer->Clear();
+            release_(buffer);
+        }
+    }
+}
+
+bool BufferConsumer::HasReleased() const {
+    for (auto& worker : workers_) {
+        if (!worker->released.Empty())
+            return true;
+    }
+    return false;
+}
+
+void BufferConsumer::Drain() {
+    for (auto& worker : workers_) {
+        std::unique_lock<std::mutex> lock(worker->mutex);
+        worker->cv.wait(lock, [&worker] { return worker->queue.empty() && !worker->busy; });
+    }
+    Collect();
 }
 
 } // namespace Profiler
@@ -4,46 +4,96 @@
 #define PROFILER_CONSUMER_H
 
 #include "profiler_data.h"
+#include "profiler_ring.h"
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace Profiler {
 
 // Buffer of profile events
-constexpr size_t BUFFER_SIZE = 8192;  // 8K events per buffer
+constexpr size_t DEFAULT_BUFFER_SIZE = 8192;  // 8K events per buffer
 
 struct EventBuffer {
-    uint32_t events[BUFFER_SIZE];
+    std::unique_ptr<uint32_t[]> events;
+    size_t capacity;
     size_t count;  // Number of valid events in buffer
+    std::atomic<unsigned> pending;  // Consumers still reading the buffer
 
-    EventBuffer() : count(0) {}
+    explicit EventBuffer(size_t size = DEFAULT_BUFFER_SIZE)
+        : events(new uint32_t[size]), capacity(size), count(0), pending(0) {}
 
     void Clear() {
         count = 0;
     }
 
     bool IsFull() const {
-        return count >= BUFFER_SIZE;
+        return count >= capacity;
     }
 
     void AddEvent(uint32_t event) {
-        if (count < BUFFER_SIZE) {
+        if (count < capacity) {
             events[count++] = event;
         }
     }
 };
 
-// Consumer processes buffers and adds events to ProfilerData
+// Consumer processes buffers and adds events to ProfilerData.  With
+// workers, each buffer is also handed to one thread per cost shard while
+// the calling thread follows the call stack.  The last of them to finish
+// with a buffer releases it; a worker does so by returning it on its own
+// ring and calling wake, and the calling thread passes it on to release
+// at its next Collect, so that release is only ever called from there.
 class BufferConsumer {
 public:
-    BufferConsumer(ProfilerData& data);
+    using ReleaseFunc = std::function<void(EventBuffer*)>;
+    using WakeFunc = std::function<void()>;
+
+    BufferConsumer(ProfilerData& data, ReleaseFunc release, WakeFunc wake);
     ~BufferConsumer();
 
+    // Start count shard workers (0 processes everything inline), with
+    // room to return up to buffers buffers each
+    void StartWorkers(unsigned count, size_t buffers);
+    void StopWorkers();
+
     // Process all events in a buffer
     void ProcessBuffer(EventBuffer* buffer);
 
+    // Release the buffers the workers have finished
+    void Collect();
+
+    // Whether Collect has anything to release
+    bool HasReleased() const;
+
+    // Wait until the workers have finished every buffer handed to them,
+    // and release them all
+    void Drain();
+
 private:
+    struct Worker {
+        std::thread thread;
+        std::deque<EventBuffer*> queue;
+        std::mutex mutex;
+        std::condition_variable cv;
+        SpscRing<EventBuffer> released;  // producer: worker, consumer: Collect
+        bool busy = false;
+        bool stop = false;
+    };
+
+    void WorkerFunc(Worker* worker, CostShard* shard);
+
     ProfilerData& data_;
+    ReleaseFunc release_;
+    WakeFunc wake_;
+    std::vector<std::unique_ptr<Worker>> workers_;
 };
 
 } // namespace Profiler
@@ -0,0 +1,84 @@
+// Runtime control of the profiler, see profiler_control.h
+
+#include <stdio.h>
+
+#include <SDL.h>
+
+#include "QL68000.h"
+#ifdef DECODE_CACHE
+#include "decode_cache.h"
+#include "fuse.h"
+#endif
+#include "profiler_api.h"
+#include "profiler_control.h"
+#include "profiler_events.h"
+
+int profiler_recording;
+
+static SDL_atomic_t toggles;
+static unsigned window;
+static unsigned frames;
+static int initialized;
+#ifdef DECODE_CACHE
+static Cond fuse_saved;
+#endif
+
+static void set_recording(int on)
+{
+	if (on) {
+		/* The thread, buffers and signal handlers only when needed */
+		if (!initialized) {
+			Profiler_Initialize();
+			initialized = 1;
+		}
+		frames = 0;
+#ifdef DECODE_CACHE
+		/* Entries are refilled with the plain handlers */
+		fuse_saved = fuse_enabled;
+		fuse_enabled = false;
+		dcache_flush();
+#endif
+		profiler_recording = 1;
+		if (window)
+			printf("Profiler: recording for %u frames\n", window);
+		else
+			printf("Profiler: recording\n");
+		return;
+	}
+
+	profiler_recording = 0;
+#ifdef DECODE_CACHE
+	fuse_enabled = fuse_saved;
+	dcache_flush();
+#endif
+	Profiler_Flush();
+	printf("Profiler: stopped after %u frames\n", frames);
+}
+
+void Profiler_ControlInit(int start, unsigned frames_max)
+{
+	window = frames_max;
+	if (start)
+		set_recording(1);
+}
+
+void Profiler_Toggle(void)
+{
+	SDL_AtomicAdd(&toggles, 1);
+}
+
+void Profiler_Poll(void)
+{
+	/* The dispatch loop picks its variant from profiler_recording at the
+	   start of each chunk */
+	if (SDL_AtomicSet(&toggles, 0) & 1)
+		set_recording(!profiler_recording);
+	else if (profiler_recording && window && frames >= window)
+		set_recording(0);
+}
+
+void Profiler_Frame(void)
+{
+	if (profiler_recording)
+		frames++;
+}
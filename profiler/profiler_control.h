@@ -0,0 +1,38 @@
+// Runtime control of the profiler
+//
+// The profiler is part of the normal binary and records nothing until it
+// is started: at boot with --profiler, or by SIGPROF or Ctrl+F12 at any
+// time, and then until it is toggled off again or for --profiler_window
+// frames.  The profiler thread is only set up at the first start, so a
+// run that never profiles writes no output files.  While recording the
+// dispatch loop runs its profiled variant with fusion off and JIT blocks
+// bypassed, so every instruction passes the hooks; off, the hooks outside
+// the loop cost one test of profiler_recording.  Stopping hands the
+// events so far to the profiler thread and flushes the output files; the
+// next start adds to the same profile.
+
+#ifndef PROFILER_CONTROL_H
+#define PROFILER_CONTROL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Start now if start is set; recordings stop after window frames
+// (0: only when toggled off or at exit)
+void Profiler_ControlInit(int start, unsigned window);
+
+// Start or stop at the next poll; safe from any thread or a signal handler
+void Profiler_Toggle(void);
+
+// Emulator thread, between chunks: act on toggles and the window
+void Profiler_Poll(void);
+
+// Emulator thread, each 50Hz tick
+void Profiler_Frame(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PROFILER_CONTROL_H
@@ -0,0 +1,180 @@
+// Cycle costs and memory system model, see profiler_cost_model.h
+
+#include "profiler_cost_model.h"
+#include "profiler_data.h"
+#include <cstdlib>
+
+extern "C" {
+uint64_t profiler_cycle_count = 0;
+}
+
+namespace Profiler {
+
+static bool ParseNumber(const std::string& text, int base, uint32_t& value) {
+    char* end;
+
+    if (text.empty())
+        return false;
+    value = std::strtoul(text.c_str(), &end, base);
+    return *end == '\0';
+}
+
+static bool PowerOfTwo(uint32_t value) {
+    return value && !(value & (value - 1));
+}
+
+// S/W/L: size, ways and line size in bytes
+static bool ParseCache(const std::string& text, MemoryConfig::Cache& cache) {
+    size_t first = text.find('/');
+    size_t second = first == std::string::npos ? first : text.find('/', first + 1);
+
+    if (second == std::string::npos ||
+        !ParseNumber(text.substr(0, first), 0, cache.size) ||
+        !ParseNumber(text.substr(first + 1, second - first - 1), 0, cache.ways) ||
+        !ParseNumber(text.substr(second + 1), 0, cache.line))
+        return false;
+    if (!cache.size)
+        return true;
+    // Whole sets, a power of two of them, and lines of whole bus words
+    return cache.ways && cache.line >= 2 && PowerOfTwo(cache.line) &&
+           cache.size % (cache.ways * cache.line) == 0 &&
+           PowerOfTwo(cache.size / (cache.ways * cache.line));
+}
+
+// A-B:N, addresses in hex
+static bool ParseRegion(const std::string& text, MemoryConfig::Region& region) {
+    size_t dash = text.find('-');
+    size_t colon = text.find(':');
+
+    return dash != std::string::npos && colon != std::string::npos && dash < colon &&
+           ParseNumber(text.substr(0, dash), 16, region.base) &&
+           ParseNumber(text.substr(dash + 1, colon - dash - 1), 16, region.end) &&
+           ParseNumber(text.substr(colon + 1), 0, region.wait) &&
+           region.base <= region.end;
+}
+
+bool MemoryConfig::Parse(const std::string& spec, std::string& error) {
+    size_t start = 0;
+
+    while (start < spec.size()) {
+        size_t comma = spec.find(',', start);
+        std::string item = spec.substr(start, comma == std::string::npos ? comma : comma - start);
+        start = comma == std::string::npos ? spec.size() : comma + 1;
+        if (item.empty())
+            continue;
+
+        size_t equals = item.find('=');
+        std::string key = item.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : item.substr(equals + 1);
+        uint32_t number;
+        bool ok;
+
+        if (key == "sdram" || key == "burst" || key == "write" || key == "io") {
+            ok = ParseNumber(value, 0, number);
+            if (key == "sdram")
+                sdram = number;
+            else if (key == "burst")
+                burst = number;
+            else if (key == "write")
+                write = number;
+            else
+                io = number;
+        } else if (key == "icache") {
+            ok = ParseCache(value, icache);
+        } else if (key == "dcache") {
+            ok = ParseCache(value, dcache);
+        } else if (key == "mmio") {
+            Region region;
+            ok = ParseRegion(value, region);
+            if (ok)
+                mmio.push_back(region);
+        } else {
+            error = "unknown setting " + key;
+            return false;
+        }
+        if (!ok) {
+            error = "bad value in " + item;
+            return false;
+        }
+    }
+    return true;
+}
+
+MemoryModel::Cache::Cache(const MemoryConfig::Cache& config)
+    : ways_(config.ways ? config.ways : 1), line_shift_(0), set_mask_(0) {
+    while ((2u << line_shift_) <= config.line)
+        line_shift_++;
+    if (config.size) {
+        uint32_t sets = config.size / (ways_ << line_shift_);
+        set_mask_ = sets - 1;
+        tags_.assign(sets * ways_, 0);
+    }
+}
+
+bool MemoryModel::Cache::Access(uint32_t address, bool allocate) {
+    uint32_t line = address >> line_shift_;
+    uint32_t* set = &tags_[(line & set_mask_) * ways_];
+    unsigned i = 0;
+
+    while (i < ways_ && set[i] != line + 1)
+        i++;
+    bool hit = i < ways_;
+    if (!hit) {
+        if (!allocate)
+            return false;
+        i = ways_ - 1;
+    }
+    for (; i > 0; --i)
+        set[i] = set[i - 1];
+    set[0] = line + 1;
+    return hit;
+}
+
+MemoryModel::MemoryModel(const MemoryConfig& config)
+    : config_(config), icache_(config.icache), dcache_(config.dcache),
+      write_(config.write < 0 ? config.sdram : config.write) {
+}
+
+// The first word of the line, then the others a 16-bit bus word at a time
+unsigned MemoryModel::Fill(const Cache& cache) const {
+    return config_.sdram + (cache.Line() / 2 - 1) * config_.burst;
+}
+
+int MemoryModel::IoWait(uint32_t address) const {
+    for (const MemoryConfig::Region& region : config_.mmio) {
+        if (address >= region.base && address <= region.end)
+            return region.wait;
+    }
+    return address >= IO_BASE ? static_cast<int>(config_.io) : -1;
+}
+
+unsigned MemoryModel::Stall(uint32_t event) {
+    EventType type = GetEventType(event);
+    uint32_t address = GetEventAddress(event);
+
+    if (type != EventType::INSTR_READ && type != EventType::DATA_READ &&
+        type != EventType::DATA_WRITE)
+        return 0;
+
+    int wait = IoWait(address);
+    if (wait >= 0)
+        return wait;
+
+    switch (type) {
+        case EventType::INSTR_READ:
+            if (!icache_.Enabled())
+                return config_.sdram;
+            return icache_.Access(address, true) ? 0 : Fill(icache_);
+        case EventType::DATA_READ:
+            if (!dcache_.Enabled())
+                return config_.sdram;
+            return dcache_.Access(address, true) ? 0 : Fill(dcache_);
+        default:
+            // Written through; a line the cache holds stays in it
+            if (dcache_.Enabled())
+                dcache_.Access(address, false);
+            return write_;
+    }
+}
+
+} // namespace Profiler
@@ -0,0 +1,149 @@
+// Cycle costs for the profile
+//
+// The profile's cycles are its counted events at fixed 68000 costs: some
+// internal work per instruction and a bus cycle per word fetched, read or
+// written.  The emulator keeps a running count of them for
+// Profiler_GetCycleCount().  On top of that a MemoryModel of the nextp8
+// memory system (--profiler_memory) works out the cycles each access
+// stalls for in SDRAM, the caches and MMIO wait states, which the
+// callgrind output charges to functions as the Stalls event.
+// This header is C-compatible; the memory model is C++ only.
+
+#ifndef PROFILER_COST_MODEL_H
+#define PROFILER_COST_MODEL_H
+
+#include <stdint.h>
+
+// Clock the cycles are turned into time at, --cpu_mhz's default
+#define PROFILER_CPU_MHZ            28
+
+#define PROFILER_INSTRUCTION_CYCLES 2   // Internal work, on average
+#define PROFILER_BUS_CYCLES         4   // One word fetched, read or written
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Cycles of the profile's events on the emulator thread so far
+extern uint64_t profiler_cycle_count;
+
+static inline uint64_t Profiler_CalculateCycles(uint64_t instructions, uint64_t instr_fetches,
+                                                uint64_t data_reads, uint64_t data_writes) {
+    return instructions * PROFILER_INSTRUCTION_CYCLES +
+           (instr_fetches + data_reads + data_writes) * PROFILER_BUS_CYCLES;
+}
+
+static inline double Profiler_CyclesToMicroseconds(uint64_t cycles) {
+    return cycles / (double)PROFILER_CPU_MHZ;
+}
+
+static inline uint64_t Profiler_GetCycleCount(void) {
+    return profiler_cycle_count;
+}
+
+static inline void Profiler_RecordInstructionCycles(void) {
+    profiler_cycle_count += PROFILER_INSTRUCTION_CYCLES;
+}
+
+static inline void Profiler_RecordDataReadCycles(void) {
+    profiler_cycle_count += PROFILER_BUS_CYCLES;
+}
+
+static inline void Profiler_RecordDataWriteCycles(void) {
+    profiler_cycle_count += PROFILER_BUS_CYCLES;
+}
+
+static inline void Profiler_RecordInstrReadCycles(void) {
+    profiler_cycle_count += PROFILER_BUS_CYCLES;
+}
+
+#ifdef __cplusplus
+}
+
+#include <string>
+#include <vector>
+
+namespace Profiler {
+
+// nextp8 memory system settings, from a comma separated spec:
+//   sdram=N       cycles an SDRAM access waits for its first word
+//   burst=N       and for each further word of a cache line fill
+//   write=N       cycles a write to SDRAM waits (default: sdram)
+//   icache=S/W/L  instruction cache of S bytes in W ways of L byte lines
+//   dcache=S/W/L  data cache, the same; writes go through without
+//                 allocating a line
+//   io=N          wait states of an access at 0x800000 and above
+//   mmio=A-B:N    wait states of an access from A to B (hex), instead of
+//                 io; may be given for several regions
+// Everything below 0x800000 is SDRAM, and nothing else is cached.
+struct MemoryConfig {
+    struct Cache {
+        uint32_t size = 0;      // Bytes, 0 for no cache
+        uint32_t ways = 1;
+        uint32_t line = 16;
+    };
+    struct Region {
+        uint32_t base, end;     // Inclusive
+        unsigned wait;
+    };
+
+    unsigned sdram = 0;
+    unsigned burst = 0;
+    int write = -1;             // -1 for sdram
+    unsigned io = 0;
+    Cache icache, dcache;
+    std::vector<Region> mmio;
+
+    // False with a message in error if spec doesn't parse
+    bool Parse(const std::string& spec, std::string& error);
+};
+
+// Stall cycles of the accesses in an event stream.  Follows the caches,
+// so it has to see every event in order.
+class MemoryModel {
+public:
+    explicit MemoryModel(const MemoryConfig& config);
+
+    // Cycles the access of event stalls for, 0 for other events
+    unsigned Stall(uint32_t event);
+
+private:
+    static const uint32_t IO_BASE = 0x800000;
+
+    // Set associative, least recently used way replaced; each set keeps
+    // its lines most recently used first
+    class Cache {
+    public:
+        explicit Cache(const MemoryConfig::Cache& config);
+
+        bool Enabled() const {
+            return !tags_.empty();
+        }
+        uint32_t Line() const {
+            return 1u << line_shift_;
+        }
+
+        // True on a hit; a miss takes a line when allocate
+        bool Access(uint32_t address, bool allocate);
+
+    private:
+        unsigned ways_;
+        unsigned line_shift_;
+        uint32_t set_mask_;
+        std::vector<uint32_t> tags_;    // Line number + 1, 0 when empty
+    };
+
+    MemoryConfig config_;
+    Cache icache_, dcache_;
+    unsigned write_;
+
+    unsigned Fill(const Cache& cache) const;
+    // Wait states of an uncached I/O access, or -1 for SDRAM
+    int IoWait(uint32_t address) const;
+};
+
+} // namespace Profiler
+
+#endif // __cplusplus
+
+#endif // PROFILER_COST_MODEL_H
@@ -0,0 +1,112 @@
+// Guest code coverage output implementation
+
+#include "profiler_coverage.h"
+#include "profiler_callgrind.h"
+#include "profiler_symbols.h"
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Profiler {
+
+static const uint32_t ADDRESS_LIMIT = 0x01000000;
+
+// Instruction addresses in [start, end) that ran
+static unsigned RanIn(const uint8_t* bits, uint32_t start, uint32_t end) {
+    unsigned n = 0;
+
+    end = std::min(end, ADDRESS_LIMIT);
+    for (uint32_t a = start & ~1u; a < end; a += 2)
+        n += (bits[a >> 4] >> ((a >> 1) & 7)) & 1;
+    return n;
+}
+
+struct CoverageFile {
+    std::map<unsigned, bool> lines;                     // Hit, by line
+    std::vector<std::pair<unsigned, std::string>> functions;
+    std::map<std::string, bool> function_hit;
+};
+
+static int WriteCoverage(const char* filename, const uint8_t* bits,
+                         const char* const* elf_files, int n) {
+    SymbolTable symbols;
+    std::map<std::string, CoverageFile> files;
+    uint64_t ran = 0, ran_lined = 0;
+    unsigned lines = 0, lines_hit = 0, funcs = 0, funcs_hit = 0;
+
+    for (int i = 0; i < n; ++i)
+        symbols.Load(elf_files[i]);
+
+    ran = RanIn(bits, 0, ADDRESS_LIMIT);
+    symbols.ForEachLine([&](uint32_t start, uint32_t end, const std::string& file, unsigned line) {
+        unsigned hit = RanIn(bits, start, end);
+        bool& l = files[file].lines[line];
+
+        ran_lined += hit;
+        l = l || hit;
+    });
+    symbols.ForEachFunction([&](uint32_t start, uint32_t end, const std::string& name) {
+        const std::string* file;
+        unsigned line;
+
+        if (!symbols.FindLine(start, file, line))
+            return;
+        CoverageFile& f = files[*file];
+        auto hit = f.function_hit.emplace(name, false);
+        if (hit.second)
+            f.functions.emplace_back(line, name);
+        hit.first->second = hit.first->second || RanIn(bits, start, std::max(end, start + 2));
+    });
+
+    std::string out;
+    char buf[64];
+    for (const auto& file : files) {
+        const CoverageFile& f = file.second;
+        unsigned fh = 0, lh = 0;
+
+        out += "SF:" + file.first + "\n";
+        for (const auto& func : f.functions) {
+            std::snprintf(buf, sizeof(buf), "FN:%u,", func.first);
+            out += buf + func.second + "\n";
+        }
+        for (const auto& func : f.functions) {
+            bool hit = f.function_hit.at(func.second);
+            fh += hit;
+            out += (hit ? "FNDA:1," : "FNDA:0,") + func.second + "\n";
+        }
+        std::snprintf(buf, sizeof(buf), "FNF:%zu\nFNH:%u\n", f.functions.size(), fh);
+        out += buf;
+        for (const auto& line : f.lines) {
+            lh += line.second;
+            std::snprintf(buf, sizeof(buf), "DA:%u,%d\n", line.first, line.second ? 1 : 0);
+            out += buf;
+        }
+        std::snprintf(buf, sizeof(buf), "LF:%zu\nLH:%u\n", f.lines.size(), lh);
+        out += buf;
+        out += "end_of_record\n";
+        funcs += f.functions.size();
+        funcs_hit += fh;
+        lines += f.lines.size();
+        lines_hit += lh;
+    }
+
+    if (!CallgrindSerializer::WriteParts(filename, {&out})) {
+        std::fprintf(stderr, "Coverage: can't write %s\n", filename);
+        return -1;
+    }
+    std::printf("Coverage: %u of %u functions, %u of %u lines in %zu files, "
+                "%llu instruction addresses run (%llu without lines) to %s\n",
+                funcs_hit, funcs, lines_hit, lines, files.size(),
+                static_cast<unsigned long long>(ran),
+                static_cast<unsigned long long>(ran - std::min(ran, ran_lined)), filename);
+    return 0;
+}
+
+} // namespace Profiler
+
+extern "C" int Profiler_WriteCoverage(const char* filename, const uint8_t* bits,
+                                      const char* const* elf_files, int n) {
+    return Profiler::WriteCoverage(filename, bits, elf_files, n);
+}
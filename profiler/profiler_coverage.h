@@ -0,0 +1,27 @@
+// Guest code coverage as an lcov tracefile
+//
+// Turns the "has run" bits of coverage.h into lcov's FN/FNDA and DA
+// records, one SF record per source file of the DWARF line tables.  A
+// line is hit if any instruction of it ran, a function if any of its
+// instructions did; counts are 0 or 1.  Code without line information is
+// only counted in the summary printed to stdout.
+
+#ifndef PROFILER_COVERAGE_H
+#define PROFILER_COVERAGE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Write filename from bits (one per 68K instruction address, see
+// coverage.h) with the symbols and lines of n ELF files; 0 on success
+int Profiler_WriteCoverage(const char* filename, const uint8_t* bits,
+                           const char* const* elf_files, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PROFILER_COVERAGE_H
@@ -1,25 +1,262 @@
 // Profiler data structures implementation
 
 #include "profiler_data.h"
+#include "profiler_events.h"
+#include "profiler_folded.h"
+#include "profiler_heatmap.h"
+#include "profiler_loops.h"
 #include <algorithm>
 
 namespace Profiler {
 
+CostShard::CostShard(unsigned index, unsigned count)
+    : index_(index), count_(count), current_pc_(0), sample_weight_(1), pages_(NUM_PAGES) {
+}
+
+void CostShard::Clear() {
+    for (auto& page : pages_)
+        page.reset();
+    current_pc_ = 0;
+}
+
+CostShard::SlotCost* CostShard::Slot(uint32_t address) {
+    uint32_t slot = (address & 0x00FFFFFF) >> 1;
+    uint32_t p = slot >> PAGE_BITS;
+    auto& page = pages_[p];
+
+    if (p % count_ != index_)
+        return nullptr;
+    if (!page)
+        page.reset(new CostPage());
+    page->dirty = true;
+    slot &= PAGE_SLOTS - 1;
+    page->used[slot / 64] |= 1ull << (slot % 64);
+    return &page->slots[slot];
+}
+
+unsigned CostShard::ProcessEvent(uint32_t event) {
+    uint32_t address = GetEventAddress(event);
+    unsigned stall = memory_ ? memory_->Stall(event) : 0;
+    SlotCost* slot;
+
+    switch (GetEventType(event)) {
+        case EventType::INSTR_EXECUTE:
+            current_pc_ = address;
+            if ((slot = Slot(address)))
+                slot->self_cost++;
+            break;
+        case EventType::JUMP:
+        case EventType::CALL:
+        case EventType::RETURN:
+            current_pc_ = address;
+            break;
+        case EventType::DATA_READ:
+            if (current_pc_ != 0 && (slot = Slot(current_pc_))) {
+                slot->data_reads++;
+                slot->stall_cycles += stall;
+            }
+            break;
+        case EventType::DATA_WRITE:
+            if (current_pc_ != 0 && (slot = Slot(current_pc_))) {
+                slot->data_writes++;
+                slot->stall_cycles += stall;
+            }
+            break;
+        case EventType::INSTR_READ:
+            if (current_pc_ != 0 && (slot = Slot(current_pc_))) {
+                slot->instr_fetches++;
+                slot->stall_cycles += stall;
+            }
+            break;
+        case EventType::SAMPLE_PC:
+            if ((slot = Slot(address)))
+                slot->self_cost += sample_weight_;
+            break;
+        case EventType::SAMPLE_ENTRY:
+        case EventType::SAMPLE_CALLER:
+        case EventType::MARKER:
+            break;
+    }
+    return stall;
+}
+
+void CostShard::ProcessEvents(const uint32_t* events, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+        ProcessEvent(events[i]);
+}
+
+void CostShard::MergeInto(std::map<uint32_t, InstructionCost>& costs,
+                          std::vector<uint32_t>& changed, std::vector<uint32_t>& added) {
+    for (size_t p = index_; p < pages_.size(); p += count_) {
+        if (!pages_[p] || !pages_[p]->dirty)
+            continue;
+        pages_[p]->dirty = false;
+        for (unsigned i = 0; i < PAGE_SLOTS; ++i) {
+            if (!(pages_[p]->used[i / 64] & (1ull << (i % 64))))
+                continue;
+            const SlotCost& slot = pages_[p]->slots[i];
+            uint32_t address = ((p << PAGE_BITS) + i) << 1;
+            auto result = costs.try_emplace(address);
+            InstructionCost& cost = result.first->second;
+            changed.push_back(address);
+            if (result.second)
+                added.push_back(address);
+            cost.self_cost = slot.self_cost;
+            cost.instr_fetches = slot.instr_fetches;
+            cost.data_reads = slot.data_reads;
+            cost.data_writes = slot.data_writes;
+            cost.stall_cycles = slot.stall_cycles;
+        }
+    }
+}
+
 ProfilerData::ProfilerData()
-    : current_pc_(0), total_instructions_(0) {
+    : edge_table_(1024, 0), current_pc_(0), frames_(0), heatmap_(nullptr), folded_(nullptr),
+      loops_(nullptr), sample_weight_(1), sample_callee_(0), sample_site_(0) {
+    shards_.emplace_back(0, 1);
 }
 
 ProfilerData::~ProfilerData() {
 }
 
+void ProfilerData::SetShardCount(unsigned count) {
+    shards_.clear();
+    for (unsigned i = 0; i < std::max(count, 1u); ++i) {
+        shards_.emplace_back(i, std::max(count, 1u));
+        shards_.back().SetSampleWeight(sample_weight_);
+        if (memory_config_)
+            shards_.back().SetMemoryModel(*memory_config_);
+    }
+    memory_.reset();
+    if (memory_config_ && shards_.size() > 1)
+        memory_.reset(new MemoryModel(*memory_config_));
+}
+
+void ProfilerData::SetMemoryModel(const MemoryConfig& config) {
+    memory_config_.reset(new MemoryConfig(config));
+    SetShardCount(shards_.size());
+}
+
+void ProfilerData::SetSampleWeight(uint64_t weight) {
+    sample_weight_ = weight;
+    for (auto& shard : shards_)
+        shard.SetSampleWeight(weight);
+}
+
 void ProfilerData::Clear() {
+    for (auto& shard : shards_)
+        shard.Clear();
+    edges_.clear();
+    std::fill(edge_table_.begin(), edge_table_.end(), 0);
+    dirty_edges_.clear();
     instruction_costs_.clear();
+    changed_addresses_.clear();
+    added_addresses_.clear();
     call_stack_.clear();
     current_pc_ = 0;
-    total_instructions_ = 0;
+    totals_ = EventCounters();
+    frames_ = 0;
+    sample_callee_ = 0;
+    sample_site_ = 0;
+    sample_functions_.clear();
+}
+
+static uint32_t EdgeHash(uint32_t source, uint32_t target, bool jump) {
+    uint64_t key = (static_cast<uint64_t>(source) << 25) ^ (static_cast<uint64_t>(target) << 1) ^ jump;
+    return static_cast<uint32_t>((key * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+// Index of the edge, created on first use
+uint32_t ProfilerData::FindEdge(uint32_t source, uint32_t target, bool jump) {
+    size_t mask = edge_table_.size() - 1;
+
+    for (size_t i = EdgeHash(source, target, jump) & mask;; i = (i + 1) & mask) {
+        uint32_t e = edge_table_[i];
+        if (e == 0) {
+            edges_.push_back(Edge{source, target, jump, false, InstructionCost::CallInfo()});
+            edge_table_[i] = edges_.size();
+            if (edges_.size() * 2 > edge_table_.size())
+                GrowEdgeTable();
+            return edges_.size() - 1;
+        }
+        const Edge& edge = edges_[e - 1];
+        if (edge.source == source && edge.target == target && edge.jump == jump)
+            return e - 1;
+    }
+}
+
+// An edge's counters, for changing: Finalize() picks the edge up
+InstructionCost::CallInfo& ProfilerData::EdgeInfo(uint32_t edge) {
+    if (!edges_[edge].dirty) {
+        edges_[edge].dirty = true;
+        dirty_edges_.push_back(edge);
+    }
+    return edges_[edge].info;
+}
+
+void ProfilerData::GrowEdgeTable() {
+    std::vector<uint32_t> table(edge_table_.size() * 2, 0);
+    size_t mask = table.size() - 1;
+
+    for (size_t e = 0; e < edges_.size(); ++e) {
+        size_t i = EdgeHash(edges_[e].source, edges_[e].target, edges_[e].jump) & mask;
+        while (table[i])
+            i = (i + 1) & mask;
+        table[i] = e + 1;
+    }
+    edge_table_.swap(table);
+}
+
+static void AddSince(InstructionCost::CallInfo& info, const EventCounters& start,
+                     const EventCounters& now) {
+    info.inclusive_instructions += now.instructions - start.instructions;
+    info.inclusive_instr_fetches += now.instr_fetches - start.instr_fetches;
+    info.inclusive_data_reads += now.data_reads - start.data_reads;
+    info.inclusive_data_writes += now.data_writes - start.data_writes;
+    info.inclusive_stall_cycles += now.stall_cycles - start.stall_cycles;
+}
+
+// Charge everything since the frame (and its jumps) started, then restart
+void ProfilerData::SettleFrame(CallFrame& frame) {
+    AddSince(EdgeInfo(frame.call_edge), frame.start, totals_);
+    frame.start = totals_;
+    for (auto& jump_entry : frame.jump_refs) {
+        AddSince(EdgeInfo(jump_entry.second.edge), jump_entry.second.start, totals_);
+        jump_entry.second.start = totals_;
+    }
+}
+
+void ProfilerData::PopFrame() {
+    SettleFrame(call_stack_.back());
+    call_stack_.pop_back();
+    if (loops_)
+        loops_->Leave(call_stack_.size(), totals_);
+}
+
+void ProfilerData::PushFrame(uint32_t address, uint32_t caller, uint32_t return_address,
+                             uint32_t edge) {
+    uint32_t parent = call_stack_.empty() ? FoldedStacks::ROOT : call_stack_.back().path;
+
+    call_stack_.emplace_back(address, caller, return_address, edge, totals_);
+    if (folded_)
+        call_stack_.back().path = folded_->Child(parent, address);
+}
+
+// Per path costs of the current frame, or nullptr
+EventCounters* ProfilerData::FrameSelf() {
+    if (!folded_ || call_stack_.empty())
+        return nullptr;
+    return &folded_->Self(call_stack_.back().path);
 }
 
 void ProfilerData::ProcessEvent(uint32_t event) {
+    unsigned stall = 0;
+
+    if (shards_.size() == 1)
+        stall = shards_[0].ProcessEvent(event);
+    else if (memory_)
+        stall = memory_->Stall(event);
+
     EventType type = GetEventType(event);
     uint32_t address = GetEventAddress(event);
 
@@ -45,42 +282,108 @@ void ProfilerData::ProcessEvent(uint32_t event) {
         case EventType::INSTR_READ:
             ProcessInstrRead(address);
             break;
+        case EventType::SAMPLE_PC:
+            // Self cost is counted by the shards
+            totals_.instructions += sample_weight_;
+            sample_callee_ = 0;
+            sample_site_ = 0;
+            sample_functions_.clear();
+            break;
+        case EventType::SAMPLE_ENTRY:
+            ProcessSampleEntry(address);
+            break;
+        case EventType::SAMPLE_CALLER:
+            ProcessSampleCaller(address);
+            break;
+        case EventType::MARKER:
+            if ((address >> 16) == PROFILER_MARKER_VBLANK) {
+                frames_++;
+                if (loops_)
+                    loops_->Frame();
+            }
+            break;
+    }
+
+    // Charged to the frame that made the access
+    if (stall) {
+        totals_.stall_cycles += stall;
+        if (EventCounters* self = FrameSelf())
+            self->stall_cycles += stall;
     }
 }
 
+// A sample charges its weight to every call edge on the unwound stack, as
+// if the sampled instructions had run inside those calls
+void ProfilerData::ProcessSampleEntry(uint32_t address) {
+    if (sample_site_) {
+        auto& info = EdgeInfo(FindEdge(sample_site_, sample_callee_, false));
+        info.call_count++;
+        info.inclusive_instructions += sample_weight_;
+        sample_site_ = 0;
+    }
+    sample_callee_ = address;
+    if (folded_)
+        sample_functions_.push_back(address);
+}
+
+void ProfilerData::ProcessSampleCaller(uint32_t address) {
+    if (address) {
+        // The call instruction ends just before the return address
+        sample_site_ = address - 2;
+        return;
+    }
+
+    // End of the sample: the outermost function hangs off the root
+    if (sample_callee_) {
+        auto& info = EdgeInfo(FindEdge(0, sample_callee_, false));
+        info.call_count++;
+        info.inclusive_instructions += sample_weight_;
+    }
+    if (folded_ && !sample_functions_.empty()) {
+        uint32_t path = FoldedStacks::ROOT;
+        for (size_t i = sample_functions_.size(); i > 0; --i)
+            path = folded_->Child(path, sample_functions_[i - 1]);
+        folded_->Self(path).instructions += sample_weight_;
+    }
+    sample_callee_ = 0;
+    sample_site_ = 0;
+    sample_functions_.clear();
+}
+
 void ProfilerData::ProcessInstructionExecute(uint32_t address) {
     current_pc_ = address;
-    instruction_costs_[address].self_cost++;
-    total_instructions_++;
 
     // Create top-level call frame if stack is empty
     if (call_stack_.empty()) {
         // Push a top-level frame with no caller or return address
         // Use a dummy CallInfo for top-level frames
-        auto& dummy_call_info = instruction_costs_[0].calls[address];
-        dummy_call_info.call_count++;
-        call_stack_.emplace_back(address, 0, 0, dummy_call_info);
+        uint32_t dummy_edge = FindEdge(0, address, false);
+        EdgeInfo(dummy_edge).call_count++;
+        PushFrame(address, 0, 0, dummy_edge);
     }
+    if (loops_)
+        loops_->Execute(address, call_stack_.size(), totals_);
 
-    // Increment inclusive costs for ALL frames in the stack
-    for (auto& frame : call_stack_) {
-        frame.call_info.inclusive_instructions++;
-        // Also increment for all active jumps in this frame
-        for (auto& jump_entry : frame.jump_refs) {
-            jump_entry.second.get().inclusive_instructions++;
-        }
-    }
+    // Frames on the stack are charged when they are left
+    totals_.instructions++;
+    if (EventCounters* self = FrameSelf())
+        self->instructions++;
 }
 
 void ProfilerData::ProcessJump(uint32_t address) {
     // Record the jump from current_pc_ to address and get reference to CallInfo
-    auto& jump_info = instruction_costs_[current_pc_].jumps[address];
-    jump_info.call_count++;
+    uint32_t jump_edge = FindEdge(current_pc_, address, true);
+    EdgeInfo(jump_edge).call_count++;
 
     // Add jump reference ONLY to the current (top) frame, not all frames
     // This ensures jump costs only accumulate while in the function where the jump occurred
     if (!call_stack_.empty()) {
-        call_stack_.back().jump_refs.insert_or_assign(std::make_pair(current_pc_, address), std::ref(jump_info));
+        // A jump already active in the frame keeps accumulating from its first use
+        call_stack_.back().jump_refs.emplace(std::make_pair(current_pc_, address),
+                                             JumpRef(jump_edge, totals_));
+        if (loops_)
+            loops_->Jump(current_pc_, address, call_stack_.back().address, call_stack_.size(),
+                         totals_);
     }
 
     // Jumps don't change the call stack
@@ -89,14 +392,14 @@ void ProfilerData::ProcessJump(uint32_t address) {
 
 void ProfilerData::ProcessCall(uint32_t address, uint32_t return_offset) {
     // Record the call from current_pc_ to address
-    auto& call_info = instruction_costs_[current_pc_].calls[address];
+    uint32_t call_edge = FindEdge(current_pc_, address, false);
     if (current_pc_ != 0)
-        call_info.call_count++;
+        EdgeInfo(call_edge).call_count++;
 
     // Push a new call frame with expected return address and reference to CallInfo
     // Return address is the PC after the call instruction (current_pc_ + 2)
     // caller_pc is the call instruction itself (current_pc_)
-    call_stack_.emplace_back(address, current_pc_, current_pc_ + 2 + return_offset, call_info);
+    PushFrame(address, current_pc_, current_pc_ + 2 + return_offset, call_edge);
 
     current_pc_ = address;
 }
@@ -111,8 +414,7 @@ void ProfilerData::ProcessReturn(uint32_t address) {
     // Normal return: address matches the expected return address of top frame
     if (call_stack_.back().return_address == address) {
         // Normal return - pop one frame
-        CallFrame frame = call_stack_.back();
-        call_stack_.pop_back();
+        PopFrame();
     } else {
         printf("DEBUG: returning to %x (expected %x) from %x\n", address, call_stack_.back().return_address, current_pc_);
         printf("LONGJMP DETECTED\n");
@@ -131,15 +433,13 @@ void ProfilerData::ProcessReturn(uint32_t address) {
 
         if (found) {
             // Unwind multiple frames (longjmp)
-            for (size_t i = 0; i < frames_to_pop; ++i) {
-                CallFrame frame = call_stack_.back();
-                call_stack_.pop_back();
-            }
+            for (size_t i = 0; i < frames_to_pop; ++i)
+                PopFrame();
         } else {
             // Return address not found in stack - corrupted or bottom of stack
             // Pop all frames
             while (!call_stack_.empty())
-                call_stack_.pop_back();
+                PopFrame();
         }
     }
 
@@ -147,47 +447,63 @@ void ProfilerData::ProcessReturn(uint32_t address) {
 }
 
 void ProfilerData::ProcessDataRead(uint32_t address) {
-    if (current_pc_ != 0) {
-        instruction_costs_[current_pc_].data_reads++;
-    }
-    for (auto& frame : call_stack_) {
-        frame.call_info.inclusive_data_reads++;
-        // Also increment for all active jumps in this frame
-        for (auto& jump_entry : frame.jump_refs) {
-            jump_entry.second.get().inclusive_data_reads++;
-        }
-    }
+    totals_.data_reads++;
+    if (EventCounters* self = FrameSelf())
+        self->data_reads++;
+    if (heatmap_)
+        heatmap_->Record(address, false, call_stack_.empty() ? 0 : call_stack_.back().address);
 }
 
 void ProfilerData::ProcessDataWrite(uint32_t address) {
-    if (current_pc_ != 0) {
-        instruction_costs_[current_pc_].data_writes++;
-    }
-
-    for (auto& frame : call_stack_) {
-        frame.call_info.inclusive_data_writes++;
-        // Also increment for all active jumps in this frame
-        for (auto& jump_entry : frame.jump_refs) {
-            jump_entry.second.get().inclusive_data_writes++;
-        }
-    }
+    totals_.data_writes++;
+    if (EventCounters* self = FrameSelf())
+        self->data_writes++;
+    if (heatmap_)
+        heatmap_->Record(address, true, call_stack_.empty() ? 0 : call_stack_.back().address);
 }
 
 void ProfilerData::ProcessInstrRead(uint32_t address) {
-    if (current_pc_ != 0) {
-        instruction_costs_[current_pc_].instr_fetches++;
-    }
+    totals_.instr_fetches++;
+    if (EventCounters* self = FrameSelf())
+        self->instr_fetches++;
+}
+
+void ProfilerData::Finalize() {
+    for (auto& frame : call_stack_)
+        SettleFrame(frame);
+    if (loops_)
+        loops_->Settle(totals_);
 
-    for (auto& frame : call_stack_) {
-        frame.call_info.inclusive_instr_fetches++;
-        // Also increment for all active jumps in this frame
-        for (auto& jump_entry : frame.jump_refs) {
-            jump_entry.second.get().inclusive_instr_fetches++;
+    // Update the sorted view the exporters walk
+    changed_addresses_.clear();
+    added_addresses_.clear();
+    for (auto& shard : shards_)
+        shard.MergeInto(instruction_costs_, changed_addresses_, added_addresses_);
+    for (uint32_t e : dirty_edges_) {
+        Edge& edge = edges_[e];
+        (edge.jump ? CostAt(edge.source).jumps : CostAt(edge.source).calls)[edge.target] = edge.info;
+        // A sampled callee's entry need not have been hit itself
+        if (!edge.jump && instruction_costs_.try_emplace(edge.target & 0x00FFFFFE).second) {
+            changed_addresses_.push_back(edge.target & 0x00FFFFFE);
+            added_addresses_.push_back(edge.target & 0x00FFFFFE);
         }
+        edge.dirty = false;
     }
+    dirty_edges_.clear();
+
+    // An address with several changed edges is listed once
+    std::sort(changed_addresses_.begin(), changed_addresses_.end());
+    changed_addresses_.erase(std::unique(changed_addresses_.begin(), changed_addresses_.end()),
+                             changed_addresses_.end());
 }
 
-void ProfilerData::Finalize() {
+// Cost map entry for address, noting it as changed
+InstructionCost& ProfilerData::CostAt(uint32_t address) {
+    auto result = instruction_costs_.try_emplace(address & 0x00FFFFFE);
+    changed_addresses_.push_back(address & 0x00FFFFFE);
+    if (result.second)
+        added_addresses_.push_back(address & 0x00FFFFFE);
+    return result.first->second;
 }
 
 } // namespace Profiler
@@ -9,6 +9,9 @@
 #include <string>
 #include <set>
 #include <functional>
+#include <memory>
+
+#include "profiler_cost_model.h"
 
 namespace Profiler {
 
@@ -20,7 +23,16 @@ enum class EventType : uint8_t {
     RETURN = 0x03,
     DATA_READ = 0x04,
     DATA_WRITE = 0x05,
-    INSTR_READ = 0x06
+    INSTR_READ = 0x06,
+    // Sampling mode, see profiler_sampler.h: SAMPLE_PC starts a sample,
+    // then SAMPLE_ENTRY gives the function the PC is in and each
+    // SAMPLE_CALLER/SAMPLE_ENTRY pair a return address and the function it
+    // returns into, innermost first.  SAMPLE_CALLER 0 ends the sample.
+    SAMPLE_PC = 0x07,
+    SAMPLE_ENTRY = 0x08,
+    SAMPLE_CALLER = 0x09,
+    // Timeline marker, see profiler_events.h
+    MARKER = 0x0A
 };
 
 // Extract event type from 32-bit event
@@ -49,6 +61,7 @@ struct InstructionCost {
     uint64_t instr_fetches;       // Instruction fetches
     uint64_t data_reads;          // Data reads
     uint64_t data_writes;         // Data writes
+    uint64_t stall_cycles;        // Memory stalls, see MemoryModel
 
     // Calls from this instruction
     struct CallInfo {
@@ -57,32 +70,127 @@ struct InstructionCost {
         uint64_t inclusive_instr_fetches;
         uint64_t inclusive_data_reads;
         uint64_t inclusive_data_writes;
+        uint64_t inclusive_stall_cycles;
 
         CallInfo() : call_count(0),
                      inclusive_instructions(0), inclusive_instr_fetches(0),
-                     inclusive_data_reads(0), inclusive_data_writes(0) {}
+                     inclusive_data_reads(0), inclusive_data_writes(0),
+                     inclusive_stall_cycles(0) {}
     };
 
     std::map<uint32_t, CallInfo> calls;  // target_address -> CallInfo
     std::map<uint32_t, CallInfo> jumps;  // target_address -> CallInfo for jumps
 
-    InstructionCost() : self_cost(0), instr_fetches(0), data_reads(0), data_writes(0) {}
+    InstructionCost() : self_cost(0), instr_fetches(0), data_reads(0), data_writes(0),
+                        stall_cycles(0) {}
 };
 
 
+// Running event totals; frames record them on entry and charge the
+// difference when they are left, so inclusive costs are O(1) per event
+struct EventCounters {
+    uint64_t instructions;
+    uint64_t instr_fetches;
+    uint64_t data_reads;
+    uint64_t data_writes;
+    uint64_t stall_cycles;
+
+    EventCounters() : instructions(0), instr_fetches(0), data_reads(0), data_writes(0),
+                      stall_cycles(0) {}
+};
+
+// An active jump and the totals when it was first taken in this frame
+struct JumpRef {
+    uint32_t edge;                         // Jump edge index in ProfilerData
+    EventCounters start;
+
+    JumpRef(uint32_t e, const EventCounters& now) : edge(e), start(now) {}
+};
+
 // Call context (stack frame)
 struct CallFrame {
     uint32_t address;                      // Function entry address
     uint32_t caller_pc;                    // PC of call instruction (call site)
     uint32_t return_address;               // Expected return address
-    InstructionCost::CallInfo& call_info;  // Reference to CallInfo in ProfilerData
-    std::map<std::pair<uint32_t, uint32_t>, std::reference_wrapper<InstructionCost::CallInfo>> jump_refs;  // (source, target) -> CallInfo ref for active jumps
+    uint32_t call_edge;                    // Call edge index in ProfilerData
+    EventCounters start;                   // Totals when the frame was entered
+    uint32_t path;                         // FoldedStacks node, when folding
+    std::map<std::pair<uint32_t, uint32_t>, JumpRef> jump_refs;  // (source, target) -> active jump
 
-    CallFrame(uint32_t addr, uint32_t caller, uint32_t ret_addr, InstructionCost::CallInfo& ci)
-        : address(addr), caller_pc(caller), return_address(ret_addr), call_info(ci) {}
+    CallFrame(uint32_t addr, uint32_t caller, uint32_t ret_addr, uint32_t edge,
+              const EventCounters& now)
+        : address(addr), caller_pc(caller), return_address(ret_addr), call_edge(edge), start(now),
+          path(0) {}
 };
 
 
+// Self and data access costs for the instructions in one share of the
+// address space.  Counters live in pages indexed by address >> 1 (68000
+// code is word aligned), allocated as code is first seen; page p belongs
+// to shard p % count.  Every shard sees the whole event stream so that it
+// can follow the PC, but only counts for its own pages.
+class CostShard {
+public:
+    CostShard(unsigned index, unsigned count);
+
+    // Returns the cycles the event's access stalls for
+    unsigned ProcessEvent(uint32_t event);
+    void ProcessEvents(const uint32_t* events, size_t count);
+
+    // Instructions each SAMPLE_PC stands for
+    void SetSampleWeight(uint64_t weight) {
+        sample_weight_ = weight;
+    }
+
+    // Charge memory stalls as well; each shard follows the whole stream
+    // with a model of its own
+    void SetMemoryModel(const MemoryConfig& config) {
+        memory_.reset(new MemoryModel(config));
+    }
+
+    void Clear();
+
+    // Copy the instructions on pages touched since the last merge into a
+    // cost map, listing their addresses in changed and those new to the
+    // map in added
+    void MergeInto(std::map<uint32_t, InstructionCost>& costs,
+                   std::vector<uint32_t>& changed, std::vector<uint32_t>& added);
+
+private:
+    static const unsigned PAGE_BITS = 10;
+    static const unsigned PAGE_SLOTS = 1u << PAGE_BITS;
+    static const unsigned NUM_PAGES = (1u << 23) >> PAGE_BITS;
+
+    struct SlotCost {
+        uint64_t self_cost;
+        uint64_t instr_fetches;
+        uint64_t data_reads;
+        uint64_t data_writes;
+        uint64_t stall_cycles;
+    };
+
+    struct CostPage {
+        SlotCost slots[PAGE_SLOTS];
+        uint64_t used[PAGE_SLOTS / 64];
+        bool dirty;
+    };
+
+    unsigned index_;
+    unsigned count_;
+    uint32_t current_pc_;
+    uint64_t sample_weight_;
+    std::vector<std::unique_ptr<CostPage>> pages_;
+    std::unique_ptr<MemoryModel> memory_;
+
+    // Slot for address, or nullptr if another shard owns it
+    SlotCost* Slot(uint32_t address);
+};
+
+
+class FoldedStacks;
+class LoopProfile;
+class MemoryHeatmap;
+
 // Main profiler data structure
 class ProfilerData {
 public:
@@ -92,27 +200,120 @@ public:
     // Process a single event
     void ProcessEvent(uint32_t event);
 
+    // Split the self costs into count shards that the caller feeds from
+    // other threads with the same events; ProcessEvent then only follows
+    // the call stack.  1 (the default) keeps everything in ProcessEvent.
+    void SetShardCount(unsigned count);
+    unsigned GetShardCount() const {
+        return shards_.size();
+    }
+    CostShard& GetShard(unsigned index) {
+        return shards_[index];
+    }
+
+    // Instructions each sample stands for; set before any sample arrives
+    void SetSampleWeight(uint64_t weight);
+
+    // Also count data accesses by address, see profiler_heatmap.h
+    void SetHeatmap(MemoryHeatmap* heatmap) {
+        heatmap_ = heatmap;
+    }
+
+    // Also count costs per call path, see profiler_folded.h; set before
+    // the first event
+    void SetFoldedStacks(FoldedStacks* folded) {
+        folded_ = folded;
+    }
+
+    // Also find hot loops, see profiler_loops.h; set before the first
+    // event
+    void SetLoopProfile(LoopProfile* loops) {
+        loops_ = loops;
+    }
+
+    // Also count memory stall cycles, see profiler_cost_model.h; set
+    // before the first event
+    void SetMemoryModel(const MemoryConfig& config);
+
     // Clear all data
     void Clear();
 
-    // Get the instruction cost map
+    // Get the instruction cost map, as of the last Finalize()
     const std::map<uint32_t, InstructionCost>& GetInstructionCosts() const {
         return instruction_costs_;
     }
 
+    // Addresses whose costs or edges the last Finalize() changed, and
+    // those of them it added to the cost map
+    const std::vector<uint32_t>& GetChangedAddresses() const {
+        return changed_addresses_;
+    }
+    const std::vector<uint32_t>& GetAddedAddresses() const {
+        return added_addresses_;
+    }
+
     // Get total instruction count
     uint64_t GetTotalInstructions() const {
-        return total_instructions_;
+        return totals_.instructions;
+    }
+
+    // Displayed frames so far, from the VBLANK markers
+    uint64_t GetFrames() const {
+        return frames_;
+    }
+
+    // Everything counted on the call stack so far
+    const EventCounters& GetTotals() const {
+        return totals_;
     }
 
-    // Finalize profiling data
+    // Finalize profiling data: charge frames still on the stack and bring
+    // the cost map up to date with what changed since the last call.
+    // Shards must be idle.
     void Finalize();
 
 private:
-    std::map<uint32_t, InstructionCost> instruction_costs_;
+    // Call and jump edges, found through an open addressing hash
+    struct Edge {
+        uint32_t source;
+        uint32_t target;
+        bool jump;
+        bool dirty;                       // On dirty_edges_
+        InstructionCost::CallInfo info;
+    };
+
+    std::vector<CostShard> shards_;
+    std::vector<Edge> edges_;
+    std::vector<uint32_t> edge_table_;    // edge index + 1, 0 when free
+    std::vector<uint32_t> dirty_edges_;   // Changed since the last Finalize()
+
+    std::map<uint32_t, InstructionCost> instruction_costs_;  // Built by Finalize()
+    std::vector<uint32_t> changed_addresses_;
+    std::vector<uint32_t> added_addresses_;
     std::vector<CallFrame> call_stack_;
     uint32_t current_pc_;      // Current instruction address
-    uint64_t total_instructions_;
+    EventCounters totals_;
+    uint64_t frames_;
+    MemoryHeatmap* heatmap_;
+    FoldedStacks* folded_;
+    LoopProfile* loops_;
+    std::unique_ptr<MemoryConfig> memory_config_;
+    std::unique_ptr<MemoryModel> memory_;   // When the shards don't say
+
+    // Sample being taken apart
+    uint64_t sample_weight_;
+    uint32_t sample_callee_;   // Entry of the function the last frame is in
+    uint32_t sample_site_;     // Call site returned to, 0 for none yet
+    std::vector<uint32_t> sample_functions_;  // Its functions, innermost first, when folding
+
+    uint32_t FindEdge(uint32_t source, uint32_t target, bool jump);
+    InstructionCost::CallInfo& EdgeInfo(uint32_t edge);
+    InstructionCost& CostAt(uint32_t address);
+    void GrowEdgeTable();
+    void SettleFrame(CallFrame& frame);
+    void PopFrame();
+    void PushFrame(uint32_t address, uint32_t caller, uint32_t return_address, uint32_t edge);
+    EventCounters* FrameSelf();
 
     void ProcessInstructionExecute(uint32_t address);
     void ProcessJump(uint32_t address);
@@ -121,6 +322,8 @@ private:
     void ProcessDataRead(uint32_t address);
     void ProcessDataWrite(uint32_t address);
     void ProcessInstrRead(uint32_t address);
+    void ProcessSampleEntry(uint32_t address);
+    void ProcessSampleCaller(uint32_t address);
 };
 
 } // namespace Profiler
@@ -0,0 +1,401 @@
+// Compare two profiles function by function
+//
+// Usage: profiler_diff [options] <base> <new>
+//
+//   -e elf       symbols for naming the functions of raw traces
+//   -s interval  sample interval of sampled traces
+//   -t percent   exit with 1 if the total, or the inclusive instructions of
+//                any function, grow by more than this
+//   -m count     leave out functions under count instructions in both
+//                profiles (default 1000)
+//   -n rows      rows in each table (default 30)
+//
+// Each profile is a callgrind file or a raw --profiler_trace capture.
+// Functions are matched by name, so profiles named from symbols compare
+// across builds whose code has moved; unnamed ones match by address.
+// Self and inclusive instructions, reads and writes are reported, sorted
+// by absolute and by relative change in inclusive instructions.  Exits
+// with 2 when a profile can't be read.
+
+#include "profiler_data.h"
+#include "profiler_grouped.h"
+#include "profiler_symbols.h"
+#include "profiler_trace.h"
+#include <algorithm>
+#include <cctype>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+enum { INSTRUCTIONS, READS, WRITES, COST_COUNT };
+
+struct FunctionCosts {
+    uint64_t self[COST_COUNT] = {};
+    uint64_t inclusive[COST_COUNT] = {};
+};
+
+typedef std::map<std::string, FunctionCosts> Summary;
+
+// A profile with the names of its functions by entry, for callgrind
+// files that name them
+struct Profile {
+    Profiler::GroupedProfilerData data;
+    std::map<uint32_t, std::string> names;
+};
+
+std::string HexName(uint32_t address) {
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "0x%x", address);
+    return buf;
+}
+
+// One callgrind position: absolute, or relative to the last one
+uint32_t ParsePosition(const std::string& field, uint32_t last) {
+    if (field == "*")
+        return last;
+    if (field[0] == '+')
+        return last + std::strtoul(field.c_str() + 1, nullptr, 10);
+    if (field[0] == '-')
+        return last - std::strtoul(field.c_str() + 1, nullptr, 10);
+    return std::strtoul(field.c_str(), nullptr, 0);
+}
+
+// Function names may be compressed to "(id) name" once and "(id)" after
+std::string ParseName(const std::string& text, std::map<std::string, std::string>& compressed) {
+    if (text.empty() || text[0] != '(')
+        return text;
+    size_t close = text.find(')');
+    if (close == std::string::npos)
+        return text;
+    std::string id = text.substr(0, close + 1);
+    std::string name = text.substr(close + 1);
+    name.erase(0, name.find_first_not_of(' '));
+    if (name.empty())
+        return compressed[id];
+    compressed[id] = name;
+    return name;
+}
+
+bool LoadCallgrind(const std::string& filename, Profile& profile) {
+    std::ifstream in(filename);
+    if (!in) {
+        std::cerr << "Can't open " << filename << std::endl;
+        return false;
+    }
+
+    struct Building {
+        Profiler::GroupedFunction func;
+        bool have_entry;
+    };
+    std::map<std::string, Building> functions;
+    std::map<std::string, std::string> compressed;
+    int event_index[COST_COUNT] = {-1, -1, -1};
+    unsigned positions = 1;
+    Building* current = nullptr;
+    bool in_call = false;
+    Profiler::FunctionCall call = {};
+    uint32_t last = 0;
+    std::string line;
+
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        if (line.compare(0, 7, "events:") == 0) {
+            std::istringstream words(line.substr(7));
+            std::string word;
+            for (int i = 0; words >> word; ++i) {
+                if (word == "Instructions" || word == "Ir")
+                    event_index[INSTRUCTIONS] = i;
+                else if (word == "DataReads" || word == "Dr")
+                    event_index[READS] = i;
+                else if (word == "DataWrites" || word == "Dw")
+                    event_index[WRITES] = i;
+            }
+        } else if (line.compare(0, 10, "positions:") == 0) {
+            std::istringstream words(line.substr(10));
+            std::string word;
+            for (positions = 0; words >> word; ++positions)
+                ;
+        } else if (line.compare(0, 3, "fn=") == 0) {
+            std::string name = ParseName(line.substr(3), compressed);
+            current = &functions[name];
+            if (!current->have_entry && name.compare(0, 2, "0x") == 0) {
+                current->func.entry_address = std::strtoul(name.c_str(), nullptr, 16);
+                current->have_entry = true;
+            }
+            in_call = false;
+        } else if (line.compare(0, 6, "calls=") == 0) {
+            std::istringstream words(line.substr(6));
+            std::string count, target;
+            words >> count >> target;
+            call = Profiler::FunctionCall();
+            call.call_count = std::strtoull(count.c_str(), nullptr, 10);
+            call.target_function = target.empty() ? 0 : ParsePosition(target, last);
+            in_call = true;
+        } else if (current && (std::isdigit(static_cast<unsigned char>(line[0])) ||
+                               line[0] == '+' || line[0] == '-' || line[0] == '*')) {
+            std::istringstream words(line);
+            std::string field;
+            std::vector<uint64_t> costs;
+
+            words >> field;
+            uint32_t address = ParsePosition(field, last);
+            last = address;
+            for (unsigned i = 1; i < positions && words >> field; ++i)
+                ;
+            while (words >> field)
+                costs.push_back(std::strtoull(field.c_str(), nullptr, 10));
+            uint64_t value[COST_COUNT];
+            for (int i = 0; i < COST_COUNT; ++i) {
+                int index = event_index[i];
+                value[i] = index >= 0 && static_cast<size_t>(index) < costs.size() ? costs[index] : 0;
+            }
+
+            if (in_call) {
+                call.caller_address = address;
+                call.inclusive_instructions = value[INSTRUCTIONS];
+                call.inclusive_data_reads = value[READS];
+                call.inclusive_data_writes = value[WRITES];
+                current->func.calls.push_back(call);
+                in_call = false;
+            } else {
+                Profiler::InstructionCost cost;
+                cost.self_cost = value[INSTRUCTIONS];
+                cost.data_reads = value[READS];
+                cost.data_writes = value[WRITES];
+                current->func.instructions.push_back(Profiler::GroupedInstruction{address, cost});
+                if (!current->have_entry) {
+                    current->func.entry_address = address;
+                    current->have_entry = true;
+                }
+            }
+        }
+    }
+
+    uint64_t total = 0;
+    for (auto& entry : functions) {
+        Profiler::GroupedFunction& func = entry.second.func;
+        func.total_self_instructions = func.total_self_instr_fetches = 0;
+        func.total_self_data_reads = func.total_self_data_writes = 0;
+        for (const auto& instr : func.instructions) {
+            func.total_self_instructions += instr.cost.self_cost;
+            func.total_self_data_reads += instr.cost.data_reads;
+            func.total_self_data_writes += instr.cost.data_writes;
+        }
+        total += func.total_self_instructions;
+        profile.names[func.entry_address] = entry.first;
+        profile.data.AddFunction(func.entry_address, std::move(func));
+    }
+    profile.data.SetTotalInstructions(total);
+    return true;
+}
+
+bool LoadTrace(const std::string& filename, unsigned sample_interval,
+               const Profiler::SymbolTable& symbols, Profile& profile) {
+    Profiler::TraceReader reader;
+    if (!reader.Open(filename))
+        return false;
+
+    Profiler::ProfilerData data;
+    std::vector<uint32_t> events;
+    if (sample_interval)
+        data.SetSampleWeight(sample_interval);
+    while (reader.ReadBlock(events)) {
+        for (uint32_t event : events)
+            data.ProcessEvent(event);
+    }
+    data.Finalize();
+
+    profile.data = Profiler::ConvertToGroupedData(data);
+    if (!symbols.Empty()) {
+        for (const auto& entry : profile.data.GetFunctions())
+            profile.names[entry.first] = symbols.FunctionName(entry.first);
+    }
+    return true;
+}
+
+bool LoadProfile(const std::string& filename, unsigned sample_interval,
+                 const Profiler::SymbolTable& symbols, Profile& profile) {
+    std::ifstream in(filename);
+    std::string first;
+
+    if (!in || !std::getline(in, first)) {
+        std::cerr << "Can't read " << filename << std::endl;
+        return false;
+    }
+    if (first.compare(0, 11, "# callgrind") == 0 || first.compare(0, 8, "version:") == 0 ||
+        first.compare(0, 7, "events:") == 0)
+        return LoadCallgrind(filename, profile);
+    return LoadTrace(filename, sample_interval, symbols, profile);
+}
+
+// Self and inclusive costs by function name
+void Summarize(const Profile& profile, Summary& summary) {
+    for (const auto& entry : profile.data.GetFunctions()) {
+        const Profiler::GroupedFunction& func = entry.second;
+        auto name = profile.names.find(entry.first);
+        FunctionCosts& costs = summary[name != profile.names.end() ? name->second : HexName(entry.first)];
+
+        costs.self[INSTRUCTIONS] += func.total_self_instructions;
+        costs.self[READS] += func.total_self_data_reads;
+        costs.self[WRITES] += func.total_self_data_writes;
+        costs.inclusive[INSTRUCTIONS] += func.total_self_instructions;
+        costs.inclusive[READS] += func.total_self_data_reads;
+        costs.inclusive[WRITES] += func.total_self_data_writes;
+        for (const Profiler::FunctionCall& call : func.calls) {
+            // Recursive calls are already in the caller's own costs
+            if (call.target_function == func.entry_address)
+                continue;
+            costs.inclusive[INSTRUCTIONS] += call.inclusive_instructions;
+            costs.inclusive[READS] += call.inclusive_data_reads;
+            costs.inclusive[WRITES] += call.inclusive_data_writes;
+        }
+    }
+}
+
+struct Row {
+    std::string name;
+    FunctionCosts base;
+    FunctionCosts changed;
+
+    int64_t SelfDelta(int cost) const {
+        return static_cast<int64_t>(changed.self[cost] - base.self[cost]);
+    }
+
+    int64_t InclusiveDelta(int cost) const {
+        return static_cast<int64_t>(changed.inclusive[cost] - base.inclusive[cost]);
+    }
+
+    // Relative change in inclusive instructions; infinite for new functions
+    double Relative() const {
+        if (!base.inclusive[INSTRUCTIONS])
+            return changed.inclusive[INSTRUCTIONS] ? INFINITY : 0.0;
+        return 100.0 * InclusiveDelta(INSTRUCTIONS) / base.inclusive[INSTRUCTIONS];
+    }
+};
+
+void PrintTable(const char* title, const std::vector<const Row*>& rows, size_t count) {
+    std::printf("\n%s\n", title);
+    std::printf("%12s %12s %12s %10s %10s %10s %10s %9s  %s\n", "incl instr", "self instr", "incl delta",
+                "self rd", "incl rd", "self wr", "incl wr", "change", "function");
+    for (size_t i = 0; i < rows.size() && i < count; ++i) {
+        const Row& row = *rows[i];
+        double relative = row.Relative();
+        char change[16];
+
+        if (std::isinf(relative))
+            std::snprintf(change, sizeof(change), "new");
+        else if (!row.changed.inclusive[INSTRUCTIONS])
+            std::snprintf(change, sizeof(change), "gone");
+        else
+            std::snprintf(change, sizeof(change), "%+.1f%%", relative);
+        std::printf("%12" PRIu64 " %+12" PRId64 " %+12" PRId64 " %+10" PRId64 " %+10" PRId64
+                    " %+10" PRId64 " %+10" PRId64 " %9s  %s\n",
+                    row.changed.inclusive[INSTRUCTIONS], row.SelfDelta(INSTRUCTIONS),
+                    row.InclusiveDelta(INSTRUCTIONS), row.SelfDelta(READS), row.InclusiveDelta(READS),
+                    row.SelfDelta(WRITES), row.InclusiveDelta(WRITES), change, row.name.c_str());
+    }
+}
+
+void Usage(const char* program) {
+    std::cerr << "Usage: " << program
+              << " [-e elf]... [-s interval] [-t percent] [-m count] [-n rows] <base> <new>\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Profiler::SymbolTable symbols;
+    std::vector<const char*> files;
+    unsigned sample_interval = 0;
+    double threshold = -1;
+    uint64_t min_instructions = 1000;
+    size_t rows = 30;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (arg[0] == '-' && arg[1] && !arg[2] && i + 1 < argc) {
+            const char* value = argv[++i];
+            switch (arg[1]) {
+                case 'e':
+                    if (!symbols.Load(value))
+                        return 2;
+                    continue;
+                case 's': sample_interval = std::strtoul(value, nullptr, 0); continue;
+                case 't': threshold = std::strtod(value, nullptr); continue;
+                case 'm': min_instructions = std::strtoull(value, nullptr, 0); continue;
+                case 'n': rows = std::strtoul(value, nullptr, 0); continue;
+            }
+            Usage(argv[0]);
+            return 2;
+        }
+        files.push_back(arg);
+    }
+    if (files.size() != 2) {
+        Usage(argv[0]);
+        return 2;
+    }
+
+    Profile base_profile, new_profile;
+    Summary base, changed;
+    if (!LoadProfile(files[0], sample_interval, symbols, base_profile) ||
+        !LoadProfile(files[1], sample_interval, symbols, new_profile))
+        return 2;
+    Summarize(base_profile, base);
+    Summarize(new_profile, changed);
+
+    std::vector<Row> all;
+    for (const auto& entry : base)
+        all.push_back(Row{entry.first, entry.second, changed[entry.first]});
+    for (const auto& entry : changed) {
+        if (!base.count(entry.first))
+            all.push_back(Row{entry.first, FunctionCosts(), entry.second});
+    }
+
+    std::vector<const Row*> shown;
+    for (const Row& row : all) {
+        if (row.base.inclusive[INSTRUCTIONS] >= min_instructions ||
+            row.changed.inclusive[INSTRUCTIONS] >= min_instructions)
+            shown.push_back(&row);
+    }
+
+    uint64_t base_total = base_profile.data.GetTotalInstructions();
+    uint64_t new_total = new_profile.data.GetTotalInstructions();
+    double total_change = base_total ? 100.0 * (static_cast<double>(new_total) - base_total) / base_total : 0.0;
+    std::printf("Total instructions: %" PRIu64 " -> %" PRIu64 " (%+.2f%%)\n", base_total, new_total, total_change);
+
+    std::sort(shown.begin(), shown.end(), [](const Row* a, const Row* b) {
+        return std::llabs(a->InclusiveDelta(INSTRUCTIONS)) > std::llabs(b->InclusiveDelta(INSTRUCTIONS));
+    });
+    PrintTable("By absolute change:", shown, rows);
+    std::sort(shown.begin(), shown.end(), [](const Row* a, const Row* b) {
+        return std::fabs(a->Relative()) > std::fabs(b->Relative());
+    });
+    PrintTable("By relative change:", shown, rows);
+
+    if (threshold < 0)
+        return 0;
+
+    bool regressed = total_change > threshold;
+    if (regressed)
+        std::printf("\nRegression: total instructions %+.2f%%\n", total_change);
+    for (const Row* row : shown) {
+        double relative = row->Relative();
+        if (relative > threshold && row->base.inclusive[INSTRUCTIONS]) {
+            std::printf("%sRegression: %s %+.1f%%\n", regressed ? "" : "\n", row->name.c_str(), relative);
+            regressed = true;
+        }
+    }
+    return regressed ? 1 : 0;
+}
@@ -21,37 +21,57 @@ extern "C" {
 extern uint32_t* profiler_current_buffer_ptr;
 extern uint32_t* profiler_buffer_end_ptr;
 
+// Non-zero while events are recorded, see profiler_control.h; every
+// function below does nothing otherwise
+extern int profiler_recording;
+
 // Function to switch to a new buffer when current is full
 void Profiler_SwitchBuffer(void);
 
+// Sampling mode: append one event to the real buffer, see profiler_sampler.h
+void Profiler_RecordSampleEvent(uint32_t event);
+
 // Inline event recording functions - direct pointer manipulation for maximum speed
 // Each event is encoded as: (type << 24) | (address & 0xffffff)
 
 static inline void Profiler_RecordInstructionExecute(uint32_t address) {
+    if (!profiler_recording)
+        return;
     *profiler_current_buffer_ptr++ = (address & 0xffffff) | 0x00000000;
     if (profiler_current_buffer_ptr == profiler_buffer_end_ptr)
         Profiler_SwitchBuffer();
+#ifdef PROFILER
+    Profiler_RecordInstructionCycles();
+#endif
 }
 
 static inline void Profiler_RecordJump(uint32_t address) {
+    if (!profiler_recording)
+        return;
     *profiler_current_buffer_ptr++ = (address & 0xffffff) | 0x10000000;
     if (profiler_current_buffer_ptr == profiler_buffer_end_ptr)
         Profiler_SwitchBuffer();
 }
 
 static inline void Profiler_RecordCall(uint32_t address, uint32_t return_offset) {
+    if (!profiler_recording)
+        return;
     *profiler_current_buffer_ptr++ = (address & 0xffffff) | 0x20000000 | (return_offset << 24);
     if (profiler_current_buffer_ptr == profiler_buffer_end_ptr)
         Profiler_SwitchBuffer();
 }
 
 static inline void Profiler_RecordReturn(uint32_t address) {
+    if (!profiler_recording)
+        return;
     *profiler_current_buffer_ptr++ = (address & 0xffffff) | 0x30000000;
     if (profiler_current_buffer_ptr == profiler_buffer_end_ptr)
         Profiler_SwitchBuffer();
 }
 
 static inline void Profiler_RecordDataRead(uint32_t address) {
+    if (!profiler_recording)
+        return;
     *profiler_current_buffer_ptr++ = (address & 0xffffff) | 0x40000000;
     if (profiler_current_buffer_ptr == profiler_buffer_end_ptr)
         Profiler_SwitchBuffer();
@@ -61,6 +81,8 @@ static inline void Profiler_RecordDataRead(uint32_t address) {
 }
 
 static inline void Profiler_RecordDataWrite(uint32_t address) {
+    if (!profiler_recording)
+        return;
     *profiler_current_buffer_ptr++ = (address & 0xffffff) | 0x50000000;
     if (profiler_current_buffer_ptr == profiler_buffer_end_ptr) {
         Profiler_SwitchBuffer();
@@ -71,6 +93,8 @@ static inline void Profiler_RecordDataWrite(uint32_t address) {
 }
 
 static inline void Profiler_RecordInstrRead(uint32_t address) {
+    if (!profiler_recording)
+        return;
     *profiler_current_buffer_ptr++ = (address & 0xffffff) | 0x60000000;
     if (profiler_current_buffer_ptr == profiler_buffer_end_ptr)
         Profiler_SwitchBuffer();
@@ -79,6 +103,23 @@ static inline void Profiler_RecordInstrRead(uint32_t address) {
 #endif
 }
 
+// Timeline markers, see profiler_timeline.h.  A marker is (kind << 16) |
+// data; a VALUE marker carries the value written by the AUDIO marker
+// before it, or two characters of the name of the GUEST marker before it.
+#define PROFILER_MARKER_VBLANK  1       // End of a displayed frame
+#define PROFILER_MARKER_FLIP    2       // VFRONTREQ write, data = buffer
+#define PROFILER_MARKER_AUDIO   3       // p8audio register write, data = offset
+#define PROFILER_MARKER_VALUE   4
+#define PROFILER_MARKER_GUEST   5       // perfctr MARK write, data = name length
+
+static inline void Profiler_RecordMarker(uint32_t kind, uint32_t data) {
+    if (!profiler_recording)
+        return;
+    *profiler_current_buffer_ptr++ = (kind << 16) | (data & 0xffff) | 0xa0000000;
+    if (profiler_current_buffer_ptr == profiler_buffer_end_ptr)
+        Profiler_SwitchBuffer();
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,101 @@
+// Folded stack output implementation
+
+#include "profiler_folded.h"
+#include "profiler_callgrind.h"
+#include "profiler_cost_model.h"
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+
+namespace Profiler {
+
+FoldedStacks::FoldedStacks() {
+    Clear();
+}
+
+void FoldedStacks::Clear() {
+    nodes_.assign(1, Node{ROOT, 0, EventCounters()});
+    children_.clear();
+}
+
+bool FoldedStacks::ParseWeight(const std::string& name, Weight& weight) {
+    if (name == "cycles")
+        weight = Weight::CYCLES;
+    else if (name == "instructions")
+        weight = Weight::INSTRUCTIONS;
+    else if (name == "reads")
+        weight = Weight::DATA_READS;
+    else if (name == "writes")
+        weight = Weight::DATA_WRITES;
+    else if (name == "stalls")
+        weight = Weight::STALL_CYCLES;
+    else
+        return false;
+    return true;
+}
+
+uint32_t FoldedStacks::Child(uint32_t parent, uint32_t function) {
+    uint64_t key = (static_cast<uint64_t>(parent) << 24) | (function & 0x00FFFFFF);
+    auto result = children_.try_emplace(key, nodes_.size());
+
+    if (result.second)
+        nodes_.push_back(Node{parent, function & 0x00FFFFFF, EventCounters()});
+    return result.first->second;
+}
+
+static uint64_t WeightOf(const EventCounters& c, FoldedStacks::Weight weight) {
+    switch (weight) {
+        case FoldedStacks::Weight::CYCLES:
+            return Profiler_CalculateCycles(c.instructions, c.instr_fetches,
+                                            c.data_reads, c.data_writes) + c.stall_cycles;
+        case FoldedStacks::Weight::INSTRUCTIONS:
+            return c.instructions;
+        case FoldedStacks::Weight::DATA_READS:
+            return c.data_reads;
+        case FoldedStacks::Weight::DATA_WRITES:
+            return c.data_writes;
+        case FoldedStacks::Weight::STALL_CYCLES:
+            return c.stall_cycles;
+    }
+    return 0;
+}
+
+bool FoldedStacks::WriteToFile(const std::string& filename, Weight weight,
+                               const SymbolTable* symbols) const {
+    std::vector<std::string> names(nodes_.size());
+    std::vector<uint32_t> path;
+    std::string out;
+
+    for (uint32_t node = 1; node < nodes_.size(); ++node) {
+        uint64_t count = WeightOf(nodes_[node].self, weight);
+        if (!count)
+            continue;
+
+        path.clear();
+        for (uint32_t n = node; n != ROOT; n = nodes_[n].parent)
+            path.push_back(n);
+        for (size_t i = path.size(); i > 0; --i) {
+            std::string& name = names[path[i - 1]];
+            if (name.empty()) {
+                uint32_t function = nodes_[path[i - 1]].function;
+                if (symbols) {
+                    name = symbols->FunctionName(function);
+                } else {
+                    char buf[16];
+                    std::snprintf(buf, sizeof(buf), "0x%06x", function);
+                    name = buf;
+                }
+                // ';' separates frames
+                std::replace(name.begin(), name.end(), ';', ':');
+            }
+            out += name;
+            out += i > 1 ? ';' : ' ';
+        }
+        char buf[24];
+        out.append(buf, std::to_chars(buf, buf + sizeof(buf), count).ptr);
+        out += '\n';
+    }
+    return CallgrindSerializer::WriteParts(filename, {&out});
+}
+
+} // namespace Profiler
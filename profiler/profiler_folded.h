@@ -0,0 +1,58 @@
+// Folded stack output for flamegraphs
+//
+// Costs per full call path rather than per caller->callee edge: each frame
+// ProfilerData pushes gets a node in a tree of paths from the root, and
+// events are counted on the node of the frame they happen in.  The output
+// has one "outer;...;inner count" line per path, as flamegraph.pl,
+// inferno and speedscope read, weighted by one event type.
+
+#ifndef PROFILER_FOLDED_H
+#define PROFILER_FOLDED_H
+
+#include "profiler_data.h"
+#include "profiler_symbols.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Profiler {
+
+class FoldedStacks {
+public:
+    enum class Weight { CYCLES, INSTRUCTIONS, DATA_READS, DATA_WRITES, STALL_CYCLES };
+
+    FoldedStacks();
+
+    // Weight from its name: cycles, instructions, reads, writes or
+    // stalls; false if unknown
+    static bool ParseWeight(const std::string& name, Weight& weight);
+
+    // Path node for function entry called on path parent, ROOT for none
+    static const uint32_t ROOT = 0;
+    uint32_t Child(uint32_t parent, uint32_t function);
+
+    // Costs of the frame on path
+    EventCounters& Self(uint32_t path) {
+        return nodes_[path].self;
+    }
+
+    bool WriteToFile(const std::string& filename, Weight weight,
+                     const SymbolTable* symbols = nullptr) const;
+
+    void Clear();
+
+private:
+    struct Node {
+        uint32_t parent;
+        uint32_t function;
+        EventCounters self;
+    };
+
+    std::vector<Node> nodes_;                         // nodes_[ROOT] is the root
+    std::unordered_map<uint64_t, uint32_t> children_; // (parent, function) -> node
+};
+
+} // namespace Profiler
+
+#endif // PROFILER_FOLDED_H
@@ -1,6 +1,9 @@
 // Grouped profiler data implementation
 
 #include "profiler_grouped.h"
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
 #include <set>
 
 namespace Profiler {
@@ -20,158 +23,208 @@ void GroupedProfilerData::SetTotalInstructions(uint64_t total) {
     total_instructions_ = total;
 }
 
-GroupedProfilerData ConvertToGroupedData(const ProfilerData& data) {
-    GroupedProfilerData grouped;
-    grouped.SetTotalInstructions(data.GetTotalInstructions());
+bool FunctionGrouping::Crosses(const Jump& jump) const {
+    uint32_t min_addr = std::min(jump.first, jump.second);
+    uint32_t max_addr = std::max(jump.first, jump.second);
 
-    const auto& costs = data.GetInstructionCosts();
-
-    if (costs.empty()) {
-        return grouped;
-    }
+    // Any function entry between source and target (exclusive)?
+    return entries_.upper_bound(min_addr) != entries_.lower_bound(max_addr);
+}
 
-    // Collect all function entry points:
-    // 1. Call targets (functions called by other code)
-    // 2. Jump targets that cross existing function call targets
-    std::set<uint32_t> function_entries;
+void FunctionGrouping::Update(const ProfilerData& data, const std::vector<uint32_t>& changed,
+                              const std::vector<uint32_t>& added, std::set<uint32_t>& dirty) {
+    const auto& costs = data.GetInstructionCosts();
+    std::vector<uint32_t> new_entries;
+    std::vector<Jump> new_jumps;
+    std::vector<uint32_t> crossed;
 
-    // Add call targets
-    for (const auto& entry : costs) {
-        const InstructionCost& cost = entry.second;
+    // New call targets become entries
+    for (uint32_t address : changed) {
+        const InstructionCost& cost = costs.at(address);
         for (const auto& call_entry : cost.calls) {
-            function_entries.insert(call_entry.first);
+            callers_[call_entry.first].insert(address);
+            if (entries_.insert(call_entry.first).second)
+                new_entries.push_back(call_entry.first);
+        }
+        for (const auto& jump_entry : cost.jumps) {
+            Jump jump(address, jump_entry.first);
+            if (!crossing_jumps_.count(jump) && other_jumps_.insert(jump).second)
+                new_jumps.push_back(jump);
         }
     }
 
-    // Add jump targets that cross function call targets
-    // If a jump from A to C crosses a function entry B (where B is between A and C),
-    // then C should also be a function entry point
-    // Track which jumps crossed function boundaries for later synthesis
-    std::set<std::pair<uint32_t, uint32_t>> cross_boundary_jumps;  // (source, target) pairs
-
-    for (const auto& entry : costs) {
-        uint32_t source_addr = entry.first;
-        const InstructionCost& cost = entry.second;
-
-        for (const auto& jump_entry : cost.jumps) {
-            uint32_t target_addr = jump_entry.first;
-            // Check if this jump crosses any function entries
-            uint32_t min_addr = std::min(source_addr, target_addr);
-            uint32_t max_addr = std::max(source_addr, target_addr);
-
-            // Find if there's any function entry between source and target (exclusive)
-            auto lower = function_entries.upper_bound(min_addr);
-            auto upper = function_entries.lower_bound(max_addr);
-
-            if (lower != upper) {
-                // There's at least one function entry between source and target
-                // Mark the jump target as a function entry point
-                function_entries.insert(target_addr);
-                // Track this jump for call synthesis
-                cross_boundary_jumps.insert(std::make_pair(source_addr, target_addr));
+    // A jump across an entry makes its target an entry, which other
+    // jumps may then cross in turn
+    auto cross = [&](const Jump& jump) {
+        crossing_jumps_.insert(jump);
+        callers_[jump.second].insert(jump.first);
+        crossed.push_back(jump.first);
+        if (entries_.insert(jump.second).second)
+            new_entries.push_back(jump.second);
+    };
+    for (const Jump& jump : new_jumps) {
+        if (Crosses(jump)) {
+            other_jumps_.erase(jump);
+            cross(jump);
+        }
+    }
+    for (size_t scanned = 0; scanned < new_entries.size();) {
+        scanned = new_entries.size();
+        for (auto it = other_jumps_.begin(); it != other_jumps_.end();) {
+            if (Crosses(*it)) {
+                cross(*it);
+                it = other_jumps_.erase(it);
+            } else {
+                ++it;
             }
         }
     }
 
-    // Build a map from each instruction to its function (nearest entry point <= address)
-    std::map<uint32_t, uint32_t> instruction_to_function;
-    for (const auto& entry : costs) {
-        uint32_t address = entry.first;
+    for (uint32_t address : changed)
+        dirty.insert(FunctionOf(address));
+    for (uint32_t address : crossed)
+        dirty.insert(FunctionOf(address));
+
+    // Calls to a target only show once it is in the cost map
+    for (uint32_t address : added) {
+        auto it = callers_.find(address);
+        if (it == callers_.end())
+            continue;
+        for (uint32_t caller : it->second)
+            dirty.insert(FunctionOf(caller));
+    }
+
+    for (uint32_t entry : new_entries) {
+        auto it = entries_.find(entry);
+        auto next = std::next(it);
+        uint32_t end = next == entries_.end() ? UINT32_MAX : *next;
 
-        // Find the largest function entry <= this address
-        auto it = function_entries.upper_bound(address);
-        if (it != function_entries.begin()) {
-            --it;
-            instruction_to_function[address] = *it;
+        // The entry splits the function below it, or takes in the lone
+        // instructions up to the next entry
+        dirty.insert(entry);
+        if (it != entries_.begin()) {
+            dirty.insert(*std::prev(it));
         } else {
-            // No function entry before this address - treat as its own function
-            instruction_to_function[address] = address;
+            for (auto c = costs.lower_bound(entry); c != costs.end() && c->first < end; ++c)
+                dirty.insert(c->first);
         }
-    }
 
-    // Group instructions by function
-    std::map<uint32_t, std::vector<std::pair<uint32_t, InstructionCost>>> temp_functions;
-    for (const auto& entry : costs) {
-        uint32_t address = entry.first;
-        uint32_t func_addr = instruction_to_function[address];
-        temp_functions[func_addr].push_back({address, entry.second});
+        // Calls into the range now go to this function
+        for (auto c = callers_.lower_bound(entry); c != callers_.end() && c->first < end; ++c) {
+            for (uint32_t caller : c->second)
+                dirty.insert(FunctionOf(caller));
+        }
     }
+}
 
-    // Build GroupedFunction objects
-    for (const auto& func_entry : temp_functions) {
-        uint32_t func_addr = func_entry.first;
-        const auto& instructions = func_entry.second;
+uint32_t FunctionGrouping::FunctionOf(uint32_t address) const {
+    // Find the largest function entry <= this address
+    auto it = entries_.upper_bound(address);
+    if (it == entries_.begin()) {
+        // No function entry before this address - treat as its own function
+        return address;
+    }
+    return *std::prev(it);
+}
 
-        GroupedFunction func;
-        func.entry_address = func_addr;
-        func.total_self_instructions = 0;
-        func.total_self_instr_fetches = 0;
-        func.total_self_data_reads = 0;
-        func.total_self_data_writes = 0;
-
-        // Add all instructions and accumulate costs
-        for (const auto& instr : instructions) {
-            uint32_t addr = instr.first;
-            const InstructionCost& cost = instr.second;
-
-            func.instructions.push_back({addr, cost});
-            func.total_self_instructions += cost.self_cost;
-            func.total_self_instr_fetches += cost.instr_fetches;
-            func.total_self_data_reads += cost.data_reads;
-            func.total_self_data_writes += cost.data_writes;
-
-            // Process calls from this instruction
-            for (const auto& call_entry : cost.calls) {
-                uint32_t target_addr = call_entry.first;
-                const auto& call_info = call_entry.second;
-
-                // Find which function the target belongs to
-                auto it = instruction_to_function.find(target_addr);
-                if (it != instruction_to_function.end()) {
-                    uint32_t target_func = it->second;
-
-                    FunctionCall fc;
-                    fc.caller_address = addr;
-                    fc.target_function = target_func;
-                    fc.call_count = call_info.call_count;
-                    fc.inclusive_instructions = call_info.inclusive_instructions;
-                    fc.inclusive_instr_fetches = call_info.inclusive_instr_fetches;
-                    fc.inclusive_data_reads = call_info.inclusive_data_reads;
-                    fc.inclusive_data_writes = call_info.inclusive_data_writes;
-                    func.calls.push_back(std::move(fc));
-                }
-            }
+bool FunctionGrouping::Build(const ProfilerData& data, uint32_t entry, GroupedFunction& func) const {
+    const auto& costs = data.GetInstructionCosts();
+    auto begin = costs.lower_bound(entry);
+    auto end = begin;
+
+    if (FunctionOf(entry) != entry)
+        return false;
+    if (entries_.count(entry)) {
+        auto next = entries_.upper_bound(entry);
+        end = next == entries_.end() ? costs.end() : costs.lower_bound(*next);
+    } else if (begin != costs.end() && begin->first == entry) {
+        ++end;
+    }
+    if (begin == end)
+        return false;
+
+    func.entry_address = entry;
+    func.instructions.clear();
+    func.calls.clear();
+    func.total_self_instructions = 0;
+    func.total_self_instr_fetches = 0;
+    func.total_self_data_reads = 0;
+    func.total_self_data_writes = 0;
+    func.total_self_stall_cycles = 0;
+
+    // Add all instructions and accumulate costs
+    for (auto it = begin; it != end; ++it) {
+        uint32_t addr = it->first;
+        const InstructionCost& cost = it->second;
+
+        func.instructions.push_back({addr, cost});
+        func.total_self_instructions += cost.self_cost;
+        func.total_self_instr_fetches += cost.instr_fetches;
+        func.total_self_data_reads += cost.data_reads;
+        func.total_self_data_writes += cost.data_writes;
+        func.total_self_stall_cycles += cost.stall_cycles;
+
+        // Process calls from this instruction
+        for (const auto& call_entry : cost.calls) {
+            uint32_t target_addr = call_entry.first;
+            const auto& call_info = call_entry.second;
+
+            // The target must have run for it to belong to a function
+            if (!costs.count(target_addr))
+                continue;
+
+            FunctionCall fc;
+            fc.caller_address = addr;
+            fc.target_function = FunctionOf(target_addr);
+            fc.call_count = call_info.call_count;
+            fc.inclusive_instructions = call_info.inclusive_instructions;
+            fc.inclusive_instr_fetches = call_info.inclusive_instr_fetches;
+            fc.inclusive_data_reads = call_info.inclusive_data_reads;
+            fc.inclusive_data_writes = call_info.inclusive_data_writes;
+            fc.inclusive_stall_cycles = call_info.inclusive_stall_cycles;
+            func.calls.push_back(std::move(fc));
+        }
 
-            // Process jumps from this instruction - synthesize calls for cross-boundary jumps
-            // Only for jumps that were identified as crossing function call targets
-            for (const auto& jump_entry : cost.jumps) {
-                uint32_t target_addr = jump_entry.first;
-                const auto& jump_info = jump_entry.second;
-
-                // Check if this specific jump (source, target) crossed a boundary
-                if (cross_boundary_jumps.count(std::make_pair(addr, target_addr)) == 0) {
-                    continue;  // Skip jumps that didn't cross function call targets
-                }
-
-                // Find which function the target belongs to
-                auto it = instruction_to_function.find(target_addr);
-                if (it != instruction_to_function.end()) {
-                    uint32_t target_func = it->second;
-
-                    FunctionCall fc;
-                    fc.caller_address = addr;
-                    fc.target_function = target_func;
-                    fc.call_count = jump_info.call_count;
-                    fc.inclusive_instructions = jump_info.inclusive_instructions;
-                    fc.inclusive_instr_fetches = jump_info.inclusive_instr_fetches;
-                    fc.inclusive_data_reads = jump_info.inclusive_data_reads;
-                    fc.inclusive_data_writes = jump_info.inclusive_data_writes;
-                    func.calls.push_back(std::move(fc));
-                }
-            }
+        // Synthesize calls for jumps that cross function entries
+        for (const auto& jump_entry : cost.jumps) {
+            uint32_t target_addr = jump_entry.first;
+            const auto& jump_info = jump_entry.second;
+
+            if (!crossing_jumps_.count(Jump(addr, target_addr)) || !costs.count(target_addr))
+                continue;
+
+            FunctionCall fc;
+            fc.caller_address = addr;
+            fc.target_function = FunctionOf(target_addr);
+            fc.call_count = jump_info.call_count;
+            fc.inclusive_instructions = jump_info.inclusive_instructions;
+            fc.inclusive_instr_fetches = jump_info.inclusive_instr_fetches;
+            fc.inclusive_data_reads = jump_info.inclusive_data_reads;
+            fc.inclusive_data_writes = jump_info.inclusive_data_writes;
+            fc.inclusive_stall_cycles = jump_info.inclusive_stall_cycles;
+            func.calls.push_back(std::move(fc));
         }
+    }
+    return true;
+}
+
+GroupedProfilerData ConvertToGroupedData(const ProfilerData& data) {
+    GroupedProfilerData grouped;
+    grouped.SetTotalInstructions(data.GetTotalInstructions());
+
+    const auto& costs = data.GetInstructionCosts();
+    std::vector<uint32_t> addresses;
+    for (const auto& entry : costs)
+        addresses.push_back(entry.first);
 
-        grouped.AddFunction(func_addr, std::move(func));
+    FunctionGrouping grouping;
+    std::set<uint32_t> functions;
+    grouping.Update(data, addresses, addresses, functions);
+
+    for (uint32_t entry : functions) {
+        GroupedFunction func;
+        if (grouping.Build(data, entry, func))
+            grouped.AddFunction(entry, std::move(func));
     }
 
     return grouped;
@@ -20,6 +20,7 @@ struct FunctionCall {
     uint64_t inclusive_instr_fetches;
     uint64_t inclusive_data_reads;
     uint64_t inclusive_data_writes;
+    uint64_t inclusive_stall_cycles;
 };
 
 // A single instruction within a function
@@ -39,6 +40,7 @@ struct GroupedFunction {
     uint64_t total_self_instr_fetches;
     uint64_t total_self_data_reads;
     uint64_t total_self_data_writes;
+    uint64_t total_self_stall_cycles;
 };
 
 // Container for all grouped functions
@@ -70,6 +72,33 @@ private:
     uint64_t total_instructions_;
 };
 
+// Function boundaries, kept up to date as the profile grows.  Call
+// targets are function entries, and so is the target of any jump that
+// crosses one; an instruction belongs to the nearest entry at or below it,
+// or is a function of its own when there is none.
+class FunctionGrouping {
+public:
+    // Take in the changed and newly added addresses of data's cost map,
+    // adding the entries of functions whose grouping may differ to dirty
+    void Update(const ProfilerData& data, const std::vector<uint32_t>& changed,
+                const std::vector<uint32_t>& added, std::set<uint32_t>& dirty);
+
+    uint32_t FunctionOf(uint32_t address) const;
+
+    // Group the function at entry; false if there is none
+    bool Build(const ProfilerData& data, uint32_t entry, GroupedFunction& func) const;
+
+private:
+    typedef std::pair<uint32_t, uint32_t> Jump;    // (source, target)
+
+    std::set<uint32_t> entries_;
+    std::set<Jump> crossing_jumps_;                // Synthesized into calls
+    std::set<Jump> other_jumps_;                   // Not crossing an entry yet
+    std::map<uint32_t, std::set<uint32_t>> callers_;  // Call target -> call sites
+
+    bool Crosses(const Jump& jump) const;
+};
+
 // Convert raw ProfilerData to grouped format
 GroupedProfilerData ConvertToGroupedData(const ProfilerData& data);
 
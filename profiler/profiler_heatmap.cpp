@@ -0,0 +1,158 @@
+// Data access heatmap implementation
+
+#include "profiler_heatmap.h"
+#include "profiler_callgrind.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace Profiler {
+
+MemoryHeatmap::MemoryHeatmap() : pages_(NUM_PAGES) {
+}
+
+void MemoryHeatmap::AddRegion(const std::string& name, uint32_t base, uint32_t size) {
+    regions_.push_back(Region{name, base, size});
+}
+
+void MemoryHeatmap::Clear() {
+    for (auto& page : pages_)
+        page.reset();
+    accessors_.clear();
+}
+
+void MemoryHeatmap::Record(uint32_t address, bool write, uint32_t function) {
+    uint32_t line = (address & 0x00FFFFFF) >> LINE_BITS;
+    auto& page = pages_[line >> PAGE_BITS];
+
+    if (!page)
+        page.reset(new Page());
+    LineCount& count = page->lines[line & (PAGE_LINES - 1)];
+    if (write)
+        count.writes++;
+    else
+        count.reads++;
+
+    // The function's slot, else an empty one, else the least counted
+    auto& slots = accessors_[line];
+    Accessor* least = &slots[0];
+    for (Accessor& slot : slots) {
+        if (slot.count && slot.function == function) {
+            slot.count++;
+            return;
+        }
+        if (slot.count < least->count)
+            least = &slot;
+    }
+    least->function = function;
+    least->count++;
+}
+
+const MemoryHeatmap::Region* MemoryHeatmap::FindRegion(uint32_t address) const {
+    for (const Region& region : regions_) {
+        if (address - region.base < region.size)
+            return &region;
+    }
+    return nullptr;
+}
+
+bool MemoryHeatmap::WriteReport(const std::string& filename) const {
+    struct Line {
+        uint32_t address;
+        LineCount count;
+    };
+    struct Summary {
+        uint64_t reads = 0;
+        uint64_t writes = 0;
+        uint64_t lines = 0;
+    };
+
+    std::vector<Line> lines;
+    std::vector<Summary> summaries(regions_.size() + 1);    // Last for unnamed
+    char buf[256];
+    std::string out;
+
+    for (size_t p = 0; p < pages_.size(); ++p) {
+        if (!pages_[p])
+            continue;
+        for (unsigned i = 0; i < PAGE_LINES; ++i) {
+            const LineCount& count = pages_[p]->lines[i];
+            if (!count.reads && !count.writes)
+                continue;
+            uint32_t address = ((p << PAGE_BITS) + i) << LINE_BITS;
+            const Region* region = FindRegion(address);
+            Summary& summary = summaries[region ? region - regions_.data() : regions_.size()];
+            summary.reads += count.reads;
+            summary.writes += count.writes;
+            summary.lines++;
+            lines.push_back(Line{address, count});
+        }
+    }
+
+    std::snprintf(buf, sizeof(buf), "# Data access heatmap, %u byte lines\n\n", 1u << LINE_BITS);
+    out += buf;
+    out += "[regions]\n";
+    std::snprintf(buf, sizeof(buf), "%-24s %10s %10s %14s %14s %9s\n",
+                  "region", "base", "size", "reads", "writes", "lines");
+    out += buf;
+    for (size_t i = 0; i < summaries.size(); ++i) {
+        const Summary& summary = summaries[i];
+        if (i < regions_.size()) {
+            std::snprintf(buf, sizeof(buf), "%-24s 0x%08x 0x%08x", regions_[i].name.c_str(),
+                          regions_[i].base, regions_[i].size);
+        } else if (summary.lines) {
+            std::snprintf(buf, sizeof(buf), "%-24s %10s %10s", "(unnamed)", "", "");
+        } else {
+            continue;
+        }
+        out += buf;
+        std::snprintf(buf, sizeof(buf), " %14llu %14llu %9llu\n",
+                      (unsigned long long)summary.reads, (unsigned long long)summary.writes,
+                      (unsigned long long)summary.lines);
+        out += buf;
+    }
+
+    // Hottest lines first
+    std::vector<Line> top(lines);
+    size_t n = std::min(top.size(), TOP_LINES);
+    std::partial_sort(top.begin(), top.begin() + n, top.end(), [](const Line& a, const Line& b) {
+        return a.count.reads + a.count.writes > b.count.reads + b.count.writes;
+    });
+    std::snprintf(buf, sizeof(buf), "\n[top %zu lines]\n%-10s %14s %14s  %-24s %s\n", n,
+                  "line", "reads", "writes", "region", "functions (approximate)");
+    out += buf;
+    for (size_t i = 0; i < n; ++i) {
+        const Region* region = FindRegion(top[i].address);
+        std::snprintf(buf, sizeof(buf), "0x%06x   %14llu %14llu  %-24s", top[i].address,
+                      (unsigned long long)top[i].count.reads,
+                      (unsigned long long)top[i].count.writes,
+                      region ? region->name.c_str() : "(unnamed)");
+        out += buf;
+
+        auto it = accessors_.find(top[i].address >> LINE_BITS);
+        if (it != accessors_.end()) {
+            std::array<Accessor, ACCESSORS> slots = it->second;
+            std::sort(slots.begin(), slots.end(), [](const Accessor& a, const Accessor& b) {
+                return a.count > b.count;
+            });
+            for (const Accessor& slot : slots) {
+                if (!slot.count)
+                    break;
+                std::snprintf(buf, sizeof(buf), " 0x%x:%llu", slot.function,
+                              (unsigned long long)slot.count);
+                out += buf;
+            }
+        }
+        out += '\n';
+    }
+
+    out += "\n[lines]\n";
+    for (const Line& line : lines) {
+        std::snprintf(buf, sizeof(buf), "0x%06x %llu %llu\n", line.address,
+                      (unsigned long long)line.count.reads, (unsigned long long)line.count.writes);
+        out += buf;
+    }
+
+    return CallgrindSerializer::WriteParts(filename, {&out});
+}
+
+} // namespace Profiler
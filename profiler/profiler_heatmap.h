@@ -0,0 +1,74 @@
+// Data access heatmap
+//
+// Counts data reads and writes per 16 byte line of the 24-bit address
+// space, with the functions making them.  The report gives a summary per
+// named region (RAM, framebuffers, palettes, MMIO, ...), the hottest lines
+// with their top accessing functions, then every line touched.  Accessors
+// are tracked per line in a few slots that the least counted one gives up
+// to a newcomer, so their counts are approximate.
+
+#ifndef PROFILER_HEATMAP_H
+#define PROFILER_HEATMAP_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Profiler {
+
+class MemoryHeatmap {
+public:
+    static const unsigned LINE_BITS = 4;
+
+    MemoryHeatmap();
+
+    // Name [base, base + size) in the report; the first match wins
+    void AddRegion(const std::string& name, uint32_t base, uint32_t size);
+
+    // A data access by function (entry address)
+    void Record(uint32_t address, bool write, uint32_t function);
+
+    bool WriteReport(const std::string& filename) const;
+
+    void Clear();
+
+private:
+    static const unsigned PAGE_BITS = 12;
+    static const unsigned PAGE_LINES = 1u << PAGE_BITS;
+    static const unsigned NUM_PAGES = (1u << 24) >> (LINE_BITS + PAGE_BITS);
+    static const unsigned ACCESSORS = 4;
+    static const size_t TOP_LINES = 50;
+
+    struct LineCount {
+        uint64_t reads;
+        uint64_t writes;
+    };
+
+    struct Page {
+        LineCount lines[PAGE_LINES];
+    };
+
+    struct Accessor {
+        uint32_t function;
+        uint64_t count;
+    };
+
+    struct Region {
+        std::string name;
+        uint32_t base;
+        uint32_t size;
+    };
+
+    std::vector<std::unique_ptr<Page>> pages_;
+    std::unordered_map<uint32_t, std::array<Accessor, ACCESSORS>> accessors_;  // By line
+    std::vector<Region> regions_;
+
+    const Region* FindRegion(uint32_t address) const;
+};
+
+} // namespace Profiler
+
+#endif // PROFILER_HEATMAP_H
@@ -0,0 +1,239 @@
+// Live profile over a local socket, see profiler_live.h
+
+#include "profiler_live.h"
+#include "profiler_cost_model.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <set>
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define PROFILER_LIVE_TCP
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace Profiler {
+
+LiveView::LiveView() : frames_window_(50), listen_fd_(-1) {
+}
+
+LiveView::~LiveView() {
+    Close();
+}
+
+bool LiveView::Open(int port, unsigned frames) {
+#ifdef PROFILER_LIVE_TCP
+    struct sockaddr_in addr;
+    int one = 1;
+
+    frames_window_ = std::max(frames, 1u);
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd_ < 0) {
+        perror("profiler_live_port");
+        return false;
+    }
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listen_fd_, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd_, 4) < 0 ||
+        fcntl(listen_fd_, F_SETFL, O_NONBLOCK) < 0) {
+        perror("profiler_live_port");
+        close(listen_fd_);
+        listen_fd_ = -1;
+        return false;
+    }
+    std::cout << "Profiler: live view on 127.0.0.1:" << port << ", see profiler_top\n";
+    return true;
+#else
+    (void)port;
+    (void)frames;
+    std::cerr << "Profiler: profiler_live_port is not supported on this platform\n";
+    return false;
+#endif
+}
+
+void LiveView::Close() {
+#ifdef PROFILER_LIVE_TCP
+    for (int fd : clients_)
+        close(fd);
+    if (listen_fd_ >= 0)
+        close(listen_fd_);
+#endif
+    clients_.clear();
+    listen_fd_ = -1;
+}
+
+void LiveView::Update(const ProfilerData& data) {
+    std::set<uint32_t> dirty;
+    grouping_.Update(data, data.GetChangedAddresses(), data.GetAddedAddresses(), dirty);
+
+    for (uint32_t entry : dirty) {
+        GroupedFunction func;
+
+        if (!grouping_.Build(data, entry, func)) {
+            self_.erase(entry);
+            continue;
+        }
+
+        EventCounters& self = self_[entry];
+        self.instructions = func.total_self_instructions;
+        self.instr_fetches = func.total_self_instr_fetches;
+        self.data_reads = func.total_self_data_reads;
+        self.data_writes = func.total_self_data_writes;
+        self.stall_cycles = func.total_self_stall_cycles;
+    }
+}
+
+void LiveView::Accept() {
+#ifdef PROFILER_LIVE_TCP
+    int fd;
+
+    while ((fd = accept(listen_fd_, nullptr, nullptr)) >= 0)
+        clients_.push_back(fd);
+#endif
+}
+
+// A client that can't take a whole report at once is dropped
+void LiveView::Send(const std::string& report) {
+#ifdef PROFILER_LIVE_TCP
+    auto gone = [&report](int fd) {
+        if (send(fd, report.data(), report.size(), MSG_DONTWAIT | MSG_NOSIGNAL) ==
+            static_cast<ssize_t>(report.size()))
+            return false;
+        close(fd);
+        return true;
+    };
+    clients_.erase(std::remove_if(clients_.begin(), clients_.end(), gone), clients_.end());
+#else
+    (void)report;
+#endif
+}
+
+static uint64_t CyclesOf(const EventCounters& c) {
+    return Profiler_CalculateCycles(c.instructions, c.instr_fetches, c.data_reads, c.data_writes) +
+           c.stall_cycles;
+}
+
+static uint64_t Since(uint64_t now, uint64_t then) {
+    // A function can lose instructions when a new entry splits it
+    return now > then ? now - then : 0;
+}
+
+void LiveView::FormatWindow(std::string& out, const char* title, const Snapshot& now,
+                            const Snapshot& since, const SymbolTable* symbols) const {
+    std::vector<std::pair<uint32_t, EventCounters>> deltas;
+    EventCounters total;
+    char buf[256];
+
+    // Both are sorted by entry
+    auto then = since.functions.begin();
+    for (const auto& function : now.functions) {
+        EventCounters delta = function.second;
+
+        while (then != since.functions.end() && then->first < function.first)
+            ++then;
+        if (then != since.functions.end() && then->first == function.first) {
+            delta.instructions = Since(delta.instructions, then->second.instructions);
+            delta.instr_fetches = Since(delta.instr_fetches, then->second.instr_fetches);
+            delta.data_reads = Since(delta.data_reads, then->second.data_reads);
+            delta.data_writes = Since(delta.data_writes, then->second.data_writes);
+            delta.stall_cycles = Since(delta.stall_cycles, then->second.stall_cycles);
+        }
+        if (!delta.instructions && !delta.stall_cycles)
+            continue;
+        total.instructions += delta.instructions;
+        total.instr_fetches += delta.instr_fetches;
+        total.data_reads += delta.data_reads;
+        total.data_writes += delta.data_writes;
+        total.stall_cycles += delta.stall_cycles;
+        deltas.emplace_back(function.first, delta);
+    }
+
+    size_t n = std::min(deltas.size(), TOP_FUNCTIONS);
+    std::partial_sort(deltas.begin(), deltas.begin() + n, deltas.end(),
+                      [](const std::pair<uint32_t, EventCounters>& a,
+                         const std::pair<uint32_t, EventCounters>& b) {
+                          return CyclesOf(a.second) > CyclesOf(b.second);
+                      });
+
+    double seconds = std::chrono::duration<double>(now.time - since.time).count();
+    uint64_t frames = now.frames - since.frames;
+    uint64_t cycles = CyclesOf(total);
+
+    std::snprintf(buf, sizeof(buf), "== %s: %.2f s, %llu frames, %llu cycles, %.0f per frame ==\n",
+                  title, seconds, (unsigned long long)frames, (unsigned long long)cycles,
+                  frames ? static_cast<double>(cycles) / frames : 0.0);
+    out += buf;
+    std::snprintf(buf, sizeof(buf), "%7s %12s %12s %10s  %s\n", "share", "cycles", "instructions",
+                  "stalls", "function");
+    out += buf;
+    for (size_t i = 0; i < n; ++i) {
+        const EventCounters& cost = deltas[i].second;
+        uint64_t function_cycles = CyclesOf(cost);
+
+        std::snprintf(buf, sizeof(buf), "%6.2f%% %12llu %12llu %10llu  ",
+                      cycles ? 100.0 * function_cycles / cycles : 0.0,
+                      (unsigned long long)function_cycles, (unsigned long long)cost.instructions,
+                      (unsigned long long)cost.stall_cycles);
+        out += buf;
+        if (symbols) {
+            out += symbols->FunctionName(deltas[i].first);
+        } else {
+            std::snprintf(buf, sizeof(buf), "0x%x", deltas[i].first);
+            out += buf;
+        }
+        out += '\n';
+    }
+}
+
+void LiveView::Publish(const ProfilerData& data, const SymbolTable* symbols) {
+    Snapshot now;
+    now.time = Clock::now();
+    now.frames = data.GetFrames();
+    now.functions.assign(self_.begin(), self_.end());
+
+    // Drop what neither window reaches back to any more
+    Clock::time_point second_ago = now.time - std::chrono::seconds(1);
+    while (history_.size() > 1 && history_[1].time <= second_ago &&
+           history_[1].frames + frames_window_ <= now.frames)
+        history_.pop_front();
+    if (history_.size() >= MAX_HISTORY)
+        history_.pop_front();
+
+    Accept();
+    if (!clients_.empty()) {
+        const Snapshot* by_time = history_.empty() ? &now : &history_.front();
+        const Snapshot* by_frames = by_time;
+        std::string report;
+        char title[64];
+
+        // The latest snapshot at or beyond each window's start
+        for (const Snapshot& snapshot : history_) {
+            if (snapshot.time <= second_ago)
+                by_time = &snapshot;
+            if (snapshot.frames + frames_window_ <= now.frames)
+                by_frames = &snapshot;
+        }
+        FormatWindow(report, "Last second", now, *by_time, symbols);
+        report += '\n';
+        std::snprintf(title, sizeof(title), "Last %u frames", frames_window_);
+        FormatWindow(report, title, now, *by_frames, symbols);
+        report += '\f';
+        Send(report);
+    }
+
+    history_.push_back(std::move(now));
+}
+
+} // namespace Profiler
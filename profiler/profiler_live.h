@@ -0,0 +1,77 @@
+// Live profile over a local socket
+//
+// With --profiler_live_port the profiler thread regroups the profile a few
+// times a second and sends each client connected to 127.0.0.1:port the
+// functions with the most self cycles over the last second and over the
+// last N displayed frames.  A report is plain text ending in a form feed;
+// profiler_top shows them as a live view, and nc does too, less tidily.
+// Nothing is written to the callgrind output for it.
+
+#ifndef PROFILER_LIVE_H
+#define PROFILER_LIVE_H
+
+#include "profiler_data.h"
+#include "profiler_grouped.h"
+#include "profiler_symbols.h"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Profiler {
+
+class LiveView {
+public:
+    // Between reports
+    static const unsigned INTERVAL_MS = 250;
+
+    LiveView();
+    ~LiveView();
+
+    // Listen on port of the loopback interface; frames is the length of
+    // the frame window.  False if the socket can't be opened.
+    bool Open(int port, unsigned frames);
+    void Close();
+
+    bool IsOpen() const {
+        return listen_fd_ >= 0;
+    }
+
+    // Regroup what data's last Finalize() changed; once open, every
+    // Finalize() must be followed by an update, as for CallgrindWriter
+    void Update(const ProfilerData& data);
+
+    // Take in new clients and send them all a report as of the last update
+    void Publish(const ProfilerData& data, const SymbolTable* symbols = nullptr);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    typedef std::vector<std::pair<uint32_t, EventCounters>> Costs;  // By function entry
+
+    struct Snapshot {
+        Clock::time_point time;
+        uint64_t frames;
+        Costs functions;          // Self costs so far
+    };
+
+    static const size_t TOP_FUNCTIONS = 30;
+    static const size_t MAX_HISTORY = 240;     // A minute, when frames stop
+
+    FunctionGrouping grouping_;
+    std::map<uint32_t, EventCounters> self_;   // Self costs so far by function
+    std::deque<Snapshot> history_;             // Oldest first
+    unsigned frames_window_;
+    int listen_fd_;
+    std::vector<int> clients_;
+
+    void Accept();
+    void Send(const std::string& report);
+    void FormatWindow(std::string& out, const char* title, const Snapshot& now,
+                      const Snapshot& since, const SymbolTable* symbols) const;
+};
+
+} // namespace Profiler
+
+#endif // PROFILER_LIVE_H
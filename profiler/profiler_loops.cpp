@@ -0,0 +1,129 @@
+// Hot loop report implementation
+
+#include "profiler_loops.h"
+#include "profiler_callgrind.h"
+#include "profiler_cost_model.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace Profiler {
+
+LoopProfile::LoopProfile() : frames_(0) {
+}
+
+void LoopProfile::Clear() {
+    loops_.clear();
+    by_header_.clear();
+    active_.clear();
+    frames_ = 0;
+}
+
+static void AddSince(EventCounters& cost, const EventCounters& start, const EventCounters& now) {
+    cost.instructions += now.instructions - start.instructions;
+    cost.instr_fetches += now.instr_fetches - start.instr_fetches;
+    cost.data_reads += now.data_reads - start.data_reads;
+    cost.data_writes += now.data_writes - start.data_writes;
+    cost.stall_cycles += now.stall_cycles - start.stall_cycles;
+}
+
+static uint64_t CyclesOf(const EventCounters& c) {
+    return Profiler_CalculateCycles(c.instructions, c.instr_fetches, c.data_reads, c.data_writes) +
+           c.stall_cycles;
+}
+
+void LoopProfile::Charge(Active& active, const EventCounters& now) {
+    AddSince(loops_[active.loop].cost, active.start, now);
+    active.start = now;
+}
+
+// Leave the innermost running loop
+void LoopProfile::Close(const EventCounters& now) {
+    Charge(active_.back(), now);
+    loops_[active_.back().loop].active = false;
+    active_.pop_back();
+}
+
+void LoopProfile::Jump(uint32_t source, uint32_t target, uint32_t function, size_t depth,
+                       const EventCounters& now) {
+    if (target > source)
+        return;
+
+    auto result = by_header_.try_emplace(target, loops_.size());
+    if (result.second)
+        loops_.push_back(Loop{target, source, function, 0, 0, EventCounters(), false});
+    uint32_t index = result.first->second;
+    Loop& loop = loops_[index];
+
+    loop.end = std::max(loop.end, source);
+    loop.iterations++;
+    // A recursive call running the same loop stays in the outer entry
+    if (!loop.active) {
+        loop.active = true;
+        loop.entries++;
+        active_.push_back(Active{index, depth, now});
+    }
+}
+
+void LoopProfile::Execute(uint32_t address, size_t depth, const EventCounters& now) {
+    while (!active_.empty() && active_.back().depth == depth) {
+        const Loop& loop = loops_[active_.back().loop];
+        if (address >= loop.header && address <= loop.end)
+            break;
+        Close(now);
+    }
+}
+
+void LoopProfile::Leave(size_t depth, const EventCounters& now) {
+    while (!active_.empty() && active_.back().depth > depth)
+        Close(now);
+}
+
+void LoopProfile::Settle(const EventCounters& now) {
+    for (Active& active : active_)
+        Charge(active, now);
+}
+
+bool LoopProfile::WriteReport(const std::string& filename, const EventCounters& totals,
+                              const SymbolTable* symbols) const {
+    std::vector<const Loop*> order;
+    uint64_t total_cycles = CyclesOf(totals);
+    char buf[256];
+    std::string out;
+
+    for (const Loop& loop : loops_)
+        order.push_back(&loop);
+    size_t n = std::min(order.size(), TOP_LOOPS);
+    std::partial_sort(order.begin(), order.begin() + n, order.end(),
+                      [](const Loop* a, const Loop* b) { return CyclesOf(a->cost) > CyclesOf(b->cost); });
+
+    std::snprintf(buf, sizeof(buf), "# Hot loops, %zu of %zu, over %llu frames\n\n", n,
+                  order.size(), (unsigned long long)frames_);
+    out += buf;
+    std::snprintf(buf, sizeof(buf), "%7s %14s %12s %10s %9s %10s  %-17s %s\n", "share", "cycles",
+                  "iterations", "per frame", "trips", "insns/iter", "loop", "function");
+    out += buf;
+    for (size_t i = 0; i < n; ++i) {
+        const Loop& loop = *order[i];
+        uint64_t cycles = CyclesOf(loop.cost);
+
+        std::snprintf(buf, sizeof(buf), "%6.2f%% %14llu %12llu %10.1f %9.1f %10.1f  0x%06x-0x%06x ",
+                      total_cycles ? 100.0 * cycles / total_cycles : 0.0,
+                      (unsigned long long)cycles, (unsigned long long)loop.iterations,
+                      frames_ ? static_cast<double>(loop.iterations) / frames_ : 0.0,
+                      loop.entries ? static_cast<double>(loop.iterations) / loop.entries : 0.0,
+                      loop.iterations ? static_cast<double>(loop.cost.instructions) / loop.iterations : 0.0,
+                      loop.header, loop.end);
+        out += buf;
+        if (symbols) {
+            out += symbols->FunctionName(loop.function);
+        } else {
+            std::snprintf(buf, sizeof(buf), "0x%x", loop.function);
+            out += buf;
+        }
+        out += '\n';
+    }
+
+    return CallgrindSerializer::WriteParts(filename, {&out});
+}
+
+} // namespace Profiler
@@ -0,0 +1,83 @@
+// Hot loop report
+//
+// A backward jump is taken as the back edge of a natural loop: its target
+// is the loop header, and the loop spans from there to the furthest back
+// edge seen to it.  A loop is entered at its first back edge in a frame
+// and left when that frame runs an instruction outside the span or
+// returns; the events in between, calls included, are its cost.  The
+// report lists the loops by cycles with their share of the run, the
+// iterations (back edges taken) in all and per displayed frame, the
+// average trip count of an entry and the instructions per iteration.
+// Nested loops include their inner loops.
+
+#ifndef PROFILER_LOOPS_H
+#define PROFILER_LOOPS_H
+
+#include "profiler_data.h"
+#include "profiler_symbols.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Profiler {
+
+class LoopProfile {
+public:
+    LoopProfile();
+
+    // A jump from source to target in the frame of function, depth frames
+    // down the call stack
+    void Jump(uint32_t source, uint32_t target, uint32_t function, size_t depth,
+              const EventCounters& now);
+
+    // An instruction at address is about to run depth frames down
+    void Execute(uint32_t address, size_t depth, const EventCounters& now);
+
+    // The frames below depth have been left
+    void Leave(size_t depth, const EventCounters& now);
+
+    // End of a displayed frame
+    void Frame() {
+        frames_++;
+    }
+
+    // Charge the loops still running, for a report
+    void Settle(const EventCounters& now);
+
+    bool WriteReport(const std::string& filename, const EventCounters& totals,
+                     const SymbolTable* symbols = nullptr) const;
+
+    void Clear();
+
+private:
+    static const size_t TOP_LOOPS = 100;
+
+    struct Loop {
+        uint32_t header;
+        uint32_t end;              // Furthest back edge
+        uint32_t function;
+        uint64_t iterations;
+        uint64_t entries;
+        EventCounters cost;
+        bool active;
+    };
+
+    struct Active {
+        uint32_t loop;             // Index into loops_
+        size_t depth;
+        EventCounters start;       // Totals when entered or last charged
+    };
+
+    std::vector<Loop> loops_;
+    std::unordered_map<uint32_t, uint32_t> by_header_;
+    std::vector<Active> active_;   // Innermost last
+    uint64_t frames_;
+
+    void Charge(Active& active, const EventCounters& now);
+    void Close(const EventCounters& now);
+};
+
+} // namespace Profiler
+
+#endif // PROFILER_LOOPS_H
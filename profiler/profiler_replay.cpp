@@ -0,0 +1,107 @@
+// Offline replay of a profiler trace into callgrind output
+//
+// Usage: profiler_replay [-e elf]... [-f folded [-w weight]] [-l loops]
+//                        [-m memory]
+//                        <trace> [callgrind.out [sample interval]]
+//
+// A trace taken with --profiler_sample needs the same interval given here
+// for its costs to come out in instructions rather than samples.  Each -e
+// names an ELF file whose symbols and lines go into the output.  -f also
+// writes folded stacks weighted by cycles, instructions, reads, writes or
+// stalls.  -l writes a report of the hottest loops.  -m charges memory stalls from a memory system spec as for
+// --profiler_memory, so one trace can be tried against several.
+
+#include "profiler_callgrind.h"
+#include "profiler_data.h"
+#include "profiler_folded.h"
+#include "profiler_grouped.h"
+#include "profiler_loops.h"
+#include "profiler_symbols.h"
+#include "profiler_trace.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+int main(int argc, char** argv) {
+    Profiler::SymbolTable symbols;
+    Profiler::FoldedStacks folded;
+    Profiler::FoldedStacks::Weight weight = Profiler::FoldedStacks::Weight::INSTRUCTIONS;
+    Profiler::LoopProfile loops;
+    const char* folded_output = nullptr;
+    const char* loops_output = nullptr;
+    const char* memory_spec = nullptr;
+    std::vector<const char*> args;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!std::strcmp(argv[i], "-e") && i + 1 < argc) {
+            if (!symbols.Load(argv[++i]))
+                return 1;
+        } else if (!std::strcmp(argv[i], "-f") && i + 1 < argc) {
+            folded_output = argv[++i];
+        } else if (!std::strcmp(argv[i], "-l") && i + 1 < argc) {
+            loops_output = argv[++i];
+        } else if (!std::strcmp(argv[i], "-m") && i + 1 < argc) {
+            memory_spec = argv[++i];
+        } else if (!std::strcmp(argv[i], "-w") && i + 1 < argc) {
+            if (!Profiler::FoldedStacks::ParseWeight(argv[++i], weight)) {
+                std::cerr << "Unknown weight " << argv[i] << "\n";
+                return 2;
+            }
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (args.size() < 1 || args.size() > 3) {
+        std::cerr << "Usage: " << argv[0] << " [-e elf]... [-f folded [-w weight]] [-l loops]"
+                  << " [-m memory]"
+                  << " <trace> [callgrind.out [sample interval]]\n";
+        return 2;
+    }
+
+    Profiler::TraceReader reader;
+    if (!reader.Open(args[0]))
+        return 1;
+
+    Profiler::ProfilerData data;
+    if (args.size() > 2)
+        data.SetSampleWeight(std::strtoul(args[2], nullptr, 0));
+    if (folded_output)
+        data.SetFoldedStacks(&folded);
+    if (loops_output)
+        data.SetLoopProfile(&loops);
+    if (memory_spec) {
+        Profiler::MemoryConfig memory;
+        std::string error;
+        if (!memory.Parse(memory_spec, error)) {
+            std::cerr << error << "\n";
+            return 2;
+        }
+        data.SetMemoryModel(memory);
+    }
+    std::vector<uint32_t> events;
+    uint64_t total = 0;
+
+    while (reader.ReadBlock(events)) {
+        for (uint32_t event : events)
+            data.ProcessEvent(event);
+        total += events.size();
+    }
+    data.Finalize();
+
+    Profiler::GroupedProfilerData grouped = Profiler::ConvertToGroupedData(data);
+    Profiler::CallgrindSerializer serializer;
+    std::string output = args.size() > 1 ? args[1] : "callgrind.out";
+
+    if (!serializer.WriteToFile(output, grouped, symbols.Empty() ? nullptr : &symbols))
+        return 1;
+    if (folded_output &&
+        !folded.WriteToFile(folded_output, weight, symbols.Empty() ? nullptr : &symbols))
+        return 1;
+    if (loops_output &&
+        !loops.WriteReport(loops_output, data.GetTotals(), symbols.Empty() ? nullptr : &symbols))
+        return 1;
+    std::cout << total << " events, " << data.GetTotalInstructions()
+              << " instructions -> " << output << "\n";
+    return 0;
+}
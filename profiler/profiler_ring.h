@@ -0,0 +1,66 @@
+// Single producer, single consumer ring of pointers
+
+#ifndef PROFILER_RING_H
+#define PROFILER_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace Profiler {
+
+// Lock-free as long as exactly one thread pushes and one thread pops
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity = 0) {
+        Reset(capacity);
+    }
+
+    // Not thread safe: empties the ring and sizes it for capacity entries
+    void Reset(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity + 1)
+            size <<= 1;
+        slots_.assign(size, nullptr);
+        mask_ = size - 1;
+        head_.store(0, std::memory_order_relaxed);
+        tail_.store(0, std::memory_order_relaxed);
+    }
+
+    // Producer side; false if the ring is full
+    bool Push(T* item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) > mask_)
+            return false;
+        slots_[tail & mask_] = item;
+        // seq_cst so a consumer about to sleep either sees the item or is
+        // seen as sleeping
+        tail_.store(tail + 1, std::memory_order_seq_cst);
+        return true;
+    }
+
+    // Consumer side; nullptr if the ring is empty
+    T* Pop() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire))
+            return nullptr;
+        T* item = slots_[head & mask_];
+        head_.store(head + 1, std::memory_order_release);
+        return item;
+    }
+
+    bool Empty() const {
+        return head_.load(std::memory_order_seq_cst) == tail_.load(std::memory_order_seq_cst);
+    }
+
+private:
+    std::vector<T*> slots_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> head_;
+    alignas(64) std::atomic<size_t> tail_;
+};
+
+} // namespace Profiler
+
+#endif // PROFILER_RING_H
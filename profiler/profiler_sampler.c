@@ -0,0 +1,87 @@
+// Statistical sampling for the profiler, see profiler_sampler.h
+
+#include <stdint.h>
+
+#include "QL68000.h"
+#include "scheduler.h"
+#include "profiler_events.h"
+#include "profiler_sampler.h"
+
+#define SAMPLE_DEPTH		16
+#define ENTRY_SCAN_BYTES	0x4000
+#define ENTRY_CACHE_SIZE	4096	/* power of two */
+#define OP_LINK_A6		0x4e56
+
+#define SAMPLE_PC		0x70000000
+#define SAMPLE_ENTRY		0x80000000
+#define SAMPLE_CALLER		0x90000000
+
+static sched_event sample_event;
+
+static struct {
+	uint32_t addr;
+	uint32_t entry;
+} entry_cache[ENTRY_CACHE_SIZE];
+
+static int sample_addr_ok(uint32_t addr)
+{
+	return addr && !(addr & 1) && addr < (uint32_t)RTOP - 4;
+}
+
+// Entry of the function containing addr: the nearest LINK A6 at or before it
+static uint32_t function_entry(uint32_t addr)
+{
+	unsigned i = (addr >> 1) & (ENTRY_CACHE_SIZE - 1);
+	uint32_t a, lo;
+
+	if (entry_cache[i].addr == addr)
+		return entry_cache[i].entry;
+
+	lo = addr > ENTRY_SCAN_BYTES ? addr - ENTRY_SCAN_BYTES : 0;
+	for (a = addr; a > lo; a -= 2) {
+		if (RW((Ptr)memBase + a) == OP_LINK_A6)
+			break;
+	}
+	/* No prologue in range: keep the sample on its own */
+	if (a == lo)
+		a = addr;
+
+	entry_cache[i].addr = addr;
+	entry_cache[i].entry = a;
+	return a;
+}
+
+static void sample_tick(void *arg)
+{
+	uint32_t at = (uint32_t)((Ptr)pc - (Ptr)memBase);
+	uint32_t fp = aReg[6];
+	int depth;
+
+	if (!profiler_recording || !sample_addr_ok(at))
+		return;
+
+	Profiler_RecordSampleEvent(SAMPLE_PC | at);
+	Profiler_RecordSampleEvent(SAMPLE_ENTRY | function_entry(at));
+
+	for (depth = 0; depth < SAMPLE_DEPTH && sample_addr_ok(fp); depth++) {
+		uint32_t ret = RL((Ptr)memBase + fp + 4);
+
+		if (!sample_addr_ok(ret))
+			break;
+		Profiler_RecordSampleEvent(SAMPLE_CALLER | ret);
+		Profiler_RecordSampleEvent(SAMPLE_ENTRY | function_entry(ret));
+		/* Frames live further up the stack; anything else is not a chain */
+		if (RL((Ptr)memBase + fp) <= fp)
+			break;
+		fp = RL((Ptr)memBase + fp);
+	}
+	Profiler_RecordSampleEvent(SAMPLE_CALLER);
+}
+
+void Profiler_SamplerStart(unsigned interval)
+{
+	if (!interval)
+		return;
+	schedInit(&sample_event, "profiler_sample", sample_tick, NULL);
+	schedEvery(&sample_event, interval);
+}
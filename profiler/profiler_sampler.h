@@ -0,0 +1,25 @@
+// Statistical sampling for the profiler
+//
+// Every interval instructions the sampler records the PC and the return
+// addresses on the A6 frame chain, each with the entry of the function it
+// lies in (found by scanning back for the LINK A6 of its prologue, so the
+// code needs frame pointers).  The profiler charges each sample's weight
+// as self cost at the PC and as inclusive cost to the calls on the stack,
+// and writes the usual callgrind output; call counts there are sample
+// counts.  The per-event instrumentation is sent to a scratch buffer.
+
+#ifndef PROFILER_SAMPLER_H
+#define PROFILER_SAMPLER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Start sampling every interval instructions; 0 does nothing
+void Profiler_SamplerStart(unsigned interval);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PROFILER_SAMPLER_H
@@ -0,0 +1,521 @@
+// ELF symbol and line lookup implementation
+
+#include "profiler_symbols.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#ifdef __GNUC__
+#include <cxxabi.h>
+#include <cstdlib>
+#endif
+
+namespace Profiler {
+
+static const uint32_t ADDRESS_MASK = 0x00FFFFFF;
+static const uint32_t NO_FILE = UINT32_MAX;
+
+// Bounds-checked reads from an ELF or DWARF section; running off the end
+// returns zeros and clears ok
+class Reader {
+public:
+    Reader(const uint8_t* data, size_t size, bool big_endian)
+        : begin_(data), p_(data), end_(data + size), big_endian_(big_endian), ok_(true) {}
+
+    uint64_t U(unsigned n) {
+        uint64_t v = 0;
+        if (static_cast<size_t>(end_ - p_) < n) {
+            Fail();
+            return 0;
+        }
+        for (unsigned i = 0; i < n; ++i) {
+            if (big_endian_)
+                v = (v << 8) | p_[i];
+            else
+                v |= static_cast<uint64_t>(p_[i]) << (8 * i);
+        }
+        p_ += n;
+        return v;
+    }
+
+    uint64_t Uleb() {
+        uint64_t v = 0;
+        for (unsigned shift = 0; p_ < end_; shift += 7) {
+            uint8_t b = *p_++;
+            if (shift < 64)
+                v |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                return v;
+        }
+        Fail();
+        return v;
+    }
+
+    int64_t Sleb() {
+        int64_t v = 0;
+        unsigned shift = 0;
+        uint8_t b = 0x80;
+        while (p_ < end_ && (b & 0x80)) {
+            b = *p_++;
+            if (shift < 64)
+                v |= static_cast<int64_t>(b & 0x7f) << shift;
+            shift += 7;
+        }
+        if (b & 0x80)
+            Fail();
+        else if (shift < 64 && (b & 0x40))
+            v |= -(static_cast<int64_t>(1) << shift);
+        return v;
+    }
+
+    std::string Str() {
+        const uint8_t* s = p_;
+        while (p_ < end_ && *p_)
+            ++p_;
+        if (p_ == end_) {
+            Fail();
+            return std::string();
+        }
+        return std::string(reinterpret_cast<const char*>(s), p_++ - s);
+    }
+
+    void Skip(uint64_t n) {
+        if (static_cast<uint64_t>(end_ - p_) < n)
+            Fail();
+        else
+            p_ += n;
+    }
+
+    void Seek(size_t offset) {
+        if (offset > static_cast<size_t>(end_ - begin_))
+            Fail();
+        else
+            p_ = begin_ + offset;
+    }
+
+    size_t Offset() const {
+        return p_ - begin_;
+    }
+
+    bool Ok() const {
+        return ok_;
+    }
+
+private:
+    const uint8_t* begin_;
+    const uint8_t* p_;
+    const uint8_t* end_;
+    bool big_endian_;
+    bool ok_;
+
+    void Fail() {
+        ok_ = false;
+        p_ = end_;
+    }
+};
+
+static std::string CString(const uint8_t* data, size_t size, uint64_t offset) {
+    if (offset >= size)
+        return std::string();
+    const char* s = reinterpret_cast<const char*>(data + offset);
+    return std::string(s, strnlen(s, size - offset));
+}
+
+static std::string Demangle(const std::string& name) {
+#ifdef __GNUC__
+    if (name.compare(0, 2, "_Z") == 0) {
+        int status;
+        char* demangled = abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status);
+        if (demangled) {
+            std::string result(demangled);
+            std::free(demangled);
+            return result;
+        }
+    }
+#endif
+    return name;
+}
+
+uint32_t SymbolTable::AddFile(const std::string& name) {
+    auto it = file_index_.find(name);
+    if (it != file_index_.end())
+        return it->second;
+    files_.push_back(name);
+    file_index_.emplace(name, files_.size() - 1);
+    return files_.size() - 1;
+}
+
+bool SymbolTable::Load(const std::string& filename) {
+    struct Section {
+        uint32_t type;
+        uint64_t flags;
+        uint64_t addr;
+        uint64_t offset;
+        uint64_t size;
+        uint32_t link;
+        std::string name;
+    };
+    struct Candidate {
+        uint32_t start;
+        uint32_t end;           // 0 when the symbol has no size
+        uint32_t section_end;
+        int rank;               // Functions before labels, globals before locals
+        std::string name;
+    };
+
+    FILE* f = std::fopen(filename.c_str(), "rb");
+    if (!f) {
+        std::cerr << "Profiler: can't open " << filename << std::endl;
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t chunk[65536];
+    size_t n;
+    while ((n = std::fread(chunk, 1, sizeof(chunk), f)) > 0)
+        data.insert(data.end(), chunk, chunk + n);
+    std::fclose(f);
+
+    if (data.size() < 64 || data[0] != 0x7f || data[1] != 'E' || data[2] != 'L' || data[3] != 'F' ||
+        (data[4] != 1 && data[4] != 2)) {
+        std::cerr << "Profiler: " << filename << " is not an ELF file" << std::endl;
+        return false;
+    }
+    bool elf64 = data[4] == 2;
+    bool big_endian = data[5] == 2;
+    unsigned word = elf64 ? 8 : 4;
+
+    // Section headers
+    Reader r(data.data(), data.size(), big_endian);
+    r.Seek(elf64 ? 0x28 : 0x20);
+    uint64_t shoff = r.U(word);
+    r.Seek(elf64 ? 0x3a : 0x2e);
+    unsigned shentsize = r.U(2);
+    unsigned shnum = r.U(2);
+    unsigned shstrndx = r.U(2);
+
+    std::vector<Section> sections(shnum);
+    for (unsigned i = 0; i < shnum && r.Ok(); ++i) {
+        Section& s = sections[i];
+        r.Seek(shoff + static_cast<uint64_t>(i) * shentsize);
+        uint32_t name = r.U(4);
+        s.type = r.U(4);
+        s.flags = r.U(word);
+        s.addr = r.U(word);
+        s.offset = r.U(word);
+        s.size = r.U(word);
+        s.link = r.U(4);
+        s.name = std::to_string(name);      // Resolved below
+        if (s.offset > data.size() || s.size > data.size() - s.offset)
+            s.size = 0;
+    }
+    if (!r.Ok() || shstrndx >= shnum) {
+        std::cerr << "Profiler: bad section table in " << filename << std::endl;
+        return false;
+    }
+    const Section& shstr = sections[shstrndx];
+    for (Section& s : sections)
+        s.name = CString(data.data() + shstr.offset, shstr.size, std::stoul(s.name));
+
+    auto find = [&](const char* name) -> const Section* {
+        for (const Section& s : sections) {
+            if (s.name == name && s.size)
+                return &s;
+        }
+        return nullptr;
+    };
+
+    // Function symbols, and labels in code for hand-written assembly
+    std::vector<Candidate> candidates;
+    for (const Section& symtab : sections) {
+        if (symtab.type != 2 || symtab.link >= shnum)    // SHT_SYMTAB
+            continue;
+        const Section& strtab = sections[symtab.link];
+        unsigned entsize = elf64 ? 24 : 16;
+        Reader s(data.data() + symtab.offset, symtab.size, big_endian);
+
+        for (uint64_t i = 1; i < symtab.size / entsize; ++i) {
+            uint64_t value, size;
+            uint32_t name;
+            uint8_t info;
+            uint16_t shndx;
+
+            s.Seek(i * entsize);
+            name = s.U(4);
+            if (elf64) {
+                info = s.U(1);
+                s.U(1);
+                shndx = s.U(2);
+                value = s.U(8);
+                size = s.U(8);
+            } else {
+                value = s.U(4);
+                size = s.U(4);
+                info = s.U(1);
+                s.U(1);
+                shndx = s.U(2);
+            }
+
+            unsigned type = info & 0xf;
+            bool global = (info >> 4) != 0;
+            if (shndx == 0 || shndx >= shnum || !(sections[shndx].flags & 0x4))   // SHF_EXECINSTR
+                continue;
+            if (type != 2 && type != 0)     // STT_FUNC, STT_NOTYPE
+                continue;
+            std::string symbol = CString(data.data() + strtab.offset, strtab.size, name);
+            if (symbol.empty() || symbol[0] == '$' || symbol.compare(0, 2, ".L") == 0)
+                continue;
+
+            const Section& code = sections[shndx];
+            uint32_t start = value & ADDRESS_MASK;
+            candidates.push_back(Candidate{start,
+                                           size ? static_cast<uint32_t>(start + size) : 0,
+                                           static_cast<uint32_t>((code.addr + code.size) & ADDRESS_MASK),
+                                           (type == 2 ? 2 : 0) + (global ? 1 : 0),
+                                           Demangle(symbol)});
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return a.start != b.start ? a.start < b.start : a.rank > b.rank;
+    });
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        const Candidate& c = candidates[i];
+        if (i && candidates[i - 1].start == c.start)
+            continue;
+        uint32_t end = c.end;
+        if (!end) {
+            // Up to the next symbol, within the section
+            end = c.section_end;
+            for (size_t j = i + 1; j < candidates.size(); ++j) {
+                if (candidates[j].start != c.start) {
+                    end = std::min(end, candidates[j].start);
+                    break;
+                }
+            }
+        }
+        functions_.emplace(c.start, Function{end, c.name});
+    }
+
+    const Section* debug_line = find(".debug_line");
+    const Section* line_str = find(".debug_line_str");
+    const Section* str = find(".debug_str");
+    if (debug_line) {
+        LoadLines(data.data() + debug_line->offset, debug_line->size, big_endian,
+                  line_str ? data.data() + line_str->offset : nullptr, line_str ? line_str->size : 0,
+                  str ? data.data() + str->offset : nullptr, str ? str->size : 0);
+    }
+
+    std::cout << "Profiler: " << candidates.size() << " symbols from " << filename << "\n";
+    return true;
+}
+
+void SymbolTable::LoadLines(const uint8_t* data, size_t size, bool big_endian,
+                            const uint8_t* line_str, size_t line_str_size,
+                            const uint8_t* str, size_t str_size) {
+    Reader r(data, size, big_endian);
+
+    while (r.Ok() && r.Offset() < size) {
+        uint64_t length = r.U(4);
+        unsigned offset_size = 4;
+        if (length == 0xffffffff) {
+            length = r.U(8);
+            offset_size = 8;
+        }
+        size_t unit_end = r.Offset() + length;
+        if (!r.Ok() || unit_end > size)
+            break;
+
+        unsigned version = r.U(2);
+        if (version < 2 || version > 5) {
+            r.Seek(unit_end);
+            continue;
+        }
+        if (version >= 5)
+            r.Skip(2);                      // address_size, segment_selector_size
+        uint64_t header_length = r.U(offset_size);
+        size_t program = r.Offset() + header_length;
+        unsigned min_inst_length = r.U(1);
+        if (version >= 4)
+            r.U(1);                         // maximum_operations_per_instruction
+        r.U(1);                             // default_is_stmt
+        int line_base = static_cast<int8_t>(r.U(1));
+        unsigned line_range = r.U(1);
+        unsigned opcode_base = r.U(1);
+        std::vector<unsigned> opcode_lengths(opcode_base);
+        for (unsigned i = 1; i < opcode_base; ++i)
+            opcode_lengths[i] = r.U(1);
+        if (!line_range) {
+            r.Seek(unit_end);
+            continue;
+        }
+
+        // Directory and file tables; file numbers index files directly
+        std::vector<std::string> dirs;
+        std::vector<uint32_t> files;
+        auto add_file = [&](const std::string& name, uint64_t dir) {
+            std::string path = name;
+            if (!name.empty() && name[0] != '/' && dir < dirs.size() && !dirs[dir].empty())
+                path = dirs[dir] + "/" + name;
+            files.push_back(AddFile(path));
+        };
+
+        if (version < 5) {
+            dirs.push_back(std::string());  // The compilation directory
+            for (std::string dir = r.Str(); r.Ok() && !dir.empty(); dir = r.Str())
+                dirs.push_back(dir);
+            files.push_back(NO_FILE);
+            for (std::string name = r.Str(); r.Ok() && !name.empty(); name = r.Str()) {
+                uint64_t dir = r.Uleb();
+                r.Uleb();
+                r.Uleb();
+                add_file(name, dir);
+            }
+        } else {
+            bool ok = true;
+            for (int table = 0; table < 2 && ok; ++table) {
+                std::vector<std::pair<uint64_t, uint64_t>> formats(r.U(1));
+                for (auto& format : formats) {
+                    format.first = r.Uleb();
+                    format.second = r.Uleb();
+                }
+                uint64_t count = r.Uleb();
+                for (uint64_t i = 0; i < count && ok && r.Ok(); ++i) {
+                    std::string path;
+                    uint64_t dir = 0;
+                    for (const auto& format : formats) {
+                        std::string s;
+                        uint64_t v = 0;
+                        switch (format.second) {
+                            case 0x08: s = r.Str(); break;                          // string
+                            case 0x1f: s = CString(line_str, line_str_size, r.U(offset_size)); break;
+                            case 0x0e: s = CString(str, str_size, r.U(offset_size)); break;
+                            case 0x0b: v = r.U(1); break;                           // data1
+                            case 0x05: v = r.U(2); break;                           // data2
+                            case 0x06: v = r.U(4); break;                           // data4
+                            case 0x07: v = r.U(8); break;                           // data8
+                            case 0x0f: v = r.Uleb(); break;                         // udata
+                            case 0x1e: r.Skip(16); break;                           // data16
+                            case 0x09: r.Skip(r.Uleb()); break;                     // block
+                            default: ok = false; break;
+                        }
+                        if (format.first == 1)          // DW_LNCT_path
+                            path = s;
+                        else if (format.first == 2)     // DW_LNCT_directory_index
+                            dir = v;
+                    }
+                    if (table == 0)
+                        dirs.push_back(path);
+                    else
+                        add_file(path, dir);
+                }
+            }
+            if (!ok) {
+                r.Seek(unit_end);
+                continue;
+            }
+        }
+
+        // Run the line number program
+        r.Seek(program);
+        uint32_t address = 0;
+        uint64_t file = 1;
+        int64_t line = 1;
+        auto emit = [&](bool end_sequence) {
+            uint32_t a = address & ADDRESS_MASK;
+            if (end_sequence) {
+                lines_.emplace(a, LineRow{NO_FILE, 0});
+                return;
+            }
+            LineRow row{file < files.size() ? files[file] : NO_FILE, static_cast<unsigned>(line)};
+            if (row.file == NO_FILE)
+                return;
+            // The last row at an address wins, as with addr2line
+            lines_[a] = row;
+        };
+
+        while (r.Ok() && r.Offset() < unit_end) {
+            unsigned opcode = r.U(1);
+            if (opcode >= opcode_base) {
+                unsigned adjusted = opcode - opcode_base;
+                address += (adjusted / line_range) * min_inst_length;
+                line += line_base + static_cast<int>(adjusted % line_range);
+                emit(false);
+                continue;
+            }
+            switch (opcode) {
+                case 0: {       // Extended opcode
+                    uint64_t len = r.Uleb();
+                    size_t next = r.Offset() + len;
+                    unsigned sub = len ? r.U(1) : 0;
+                    if (sub == 1) {                 // DW_LNE_end_sequence
+                        emit(true);
+                        address = 0;
+                        file = 1;
+                        line = 1;
+                    } else if (sub == 2 && len > 1) {   // DW_LNE_set_address
+                        address = r.U(std::min<uint64_t>(len - 1, 8));
+                    }
+                    r.Seek(next);
+                    break;
+                }
+                case 1:         // DW_LNS_copy
+                    emit(false);
+                    break;
+                case 2:         // DW_LNS_advance_pc
+                    address += r.Uleb() * min_inst_length;
+                    break;
+                case 3:         // DW_LNS_advance_line
+                    line += r.Sleb();
+                    break;
+                case 4:         // DW_LNS_set_file
+                    file = r.Uleb();
+                    break;
+                case 8:         // DW_LNS_const_add_pc
+                    address += ((255 - opcode_base) / line_range) * min_inst_length;
+                    break;
+                case 9:         // DW_LNS_fixed_advance_pc
+                    address += r.U(2);
+                    break;
+                default:
+                    // Skip the operands of anything else
+                    for (unsigned i = 0; i < opcode_lengths[opcode]; ++i)
+                        r.Uleb();
+                    break;
+            }
+        }
+        r.Seek(unit_end);
+    }
+}
+
+std::string SymbolTable::FunctionName(uint32_t address) const {
+    char buf[32];
+    auto it = functions_.upper_bound(address);
+
+    if (it != functions_.begin()) {
+        --it;
+        if (address < it->second.end) {
+            if (address == it->first)
+                return it->second.name;
+            std::snprintf(buf, sizeof(buf), "+0x%x", address - it->first);
+            return it->second.name + buf;
+        }
+    }
+    std::snprintf(buf, sizeof(buf), "0x%x", address);
+    return buf;
+}
+
+bool SymbolTable::FindLine(uint32_t address, const std::string*& file, unsigned& line) const {
+    auto it = lines_.upper_bound(address);
+
+    if (it == lines_.begin())
+        return false;
+    --it;
+    if (it->second.file == NO_FILE)
+        return false;
+    file = &files_[it->second.file];
+    line = it->second.line;
+    return true;
+}
+
+} // namespace Profiler
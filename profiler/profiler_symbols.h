@@ -0,0 +1,77 @@
+// ELF symbol and line lookup for profiler output
+//
+// Loads the function symbols and the DWARF line table (.debug_line,
+// versions 2 to 5) of the cart and BSP ELF files, so the callgrind output
+// can name functions and give file:line positions without a separate
+// pass over the finished profile.
+
+#ifndef PROFILER_SYMBOLS_H
+#define PROFILER_SYMBOLS_H
+
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Profiler {
+
+class SymbolTable {
+public:
+    // Add the symbols and lines of one ELF file; false if it can't be read
+    bool Load(const std::string& filename);
+
+    bool Empty() const {
+        return functions_.empty() && lines_.empty();
+    }
+
+    // Name for a function entry: its symbol, "symbol+0xoffset" inside
+    // one, or the address in hex
+    std::string FunctionName(uint32_t address) const;
+
+    // Source position of an instruction; false if unknown
+    bool FindLine(uint32_t address, const std::string*& file, unsigned& line) const;
+
+    // f(start, end, name) for each function, by address
+    template <typename F>
+    void ForEachFunction(F f) const {
+        for (const auto& it : functions_)
+            f(it.first, it.second.end, it.second.name);
+    }
+
+    // f(start, end, file, line) for each run of addresses with one
+    // source line, by address
+    template <typename F>
+    void ForEachLine(F f) const {
+        for (auto it = lines_.begin(); it != lines_.end(); ++it) {
+            auto next = std::next(it);
+            if (it->second.file != UINT32_MAX && next != lines_.end())
+                f(it->first, next->first, files_[it->second.file], it->second.line);
+        }
+    }
+
+private:
+    struct Function {
+        uint32_t end;
+        std::string name;
+    };
+
+    struct LineRow {
+        uint32_t file;          // Index into files_, UINT32_MAX past a sequence
+        unsigned line;
+    };
+
+    std::map<uint32_t, Function> functions_;    // By start address
+    std::map<uint32_t, LineRow> lines_;         // Rows by address
+    std::vector<std::string> files_;
+    std::map<std::string, uint32_t> file_index_;
+
+    uint32_t AddFile(const std::string& name);
+    void LoadLines(const uint8_t* data, size_t size, bool big_endian,
+                   const uint8_t* line_str, size_t line_str_size,
+                   const uint8_t* str, size_t str_size);
+};
+
+} // namespace Profiler
+
+#endif // PROFILER_SYMBOLS_H
@@ -2,9 +2,10 @@
 
 #include "profiler_thread.h"
 #include "profiler_invariants.h"
-#include "profiler_grouped.h"
+#include "thread_policy.h"
 #include <iostream>
 #include <csignal>
+#include <algorithm>
 #include <chrono>
 
 namespace Profiler {
@@ -12,11 +13,53 @@ namespace Profiler {
 // Static instance for signal handling
 ProfilerThread* ProfilerThread::instance_ = nullptr;
 
-ProfilerThread::ProfilerThread()
+ProfilerThread::ProfilerThread(const ProfilerConfig& config)
     : running_(false),
       should_flush_(false),
-      consumer_(data_),
+      config_(config),
+      consumer_sleeping_(false),
+      consumer_(data_, [this](EventBuffer* buffer) {
+          // Return buffer to empty queue; it has room for the whole pool
+          empty_buffers_.Push(buffer);
+      }, [this] {
+          // A worker finished the last buffer reader; the emulator may be
+          // waiting for it
+          if (consumer_sleeping_.load()) {
+              std::lock_guard<std::mutex> lock(filled_mutex_);
+              filled_cv_.notify_one();
+          }
+      }),
       output_filename_("callgrind.out") {
+    config_.buffer_size = std::max<size_t>(config_.buffer_size, 64);
+    config_.buffer_count = std::max<size_t>(config_.buffer_count, 2);
+    for (size_t i = 0; i < config_.buffer_count; ++i)
+        buffer_pool_.emplace_back(new EventBuffer(config_.buffer_size));
+    filled_buffers_.Reset(config_.buffer_count);
+    empty_buffers_.Reset(config_.buffer_count);
+    if (config_.sample_interval)
+        data_.SetSampleWeight(config_.sample_interval);
+    if (!config_.heatmap_filename.empty())
+        data_.SetHeatmap(&heatmap_);
+    if (!config_.folded_filename.empty()) {
+        if (!FoldedStacks::ParseWeight(config_.folded_weight, folded_weight_))
+            std::cerr << "Profiler: unknown folded stack weight " << config_.folded_weight
+                      << ", counting instructions" << std::endl;
+        data_.SetFoldedStacks(&folded_);
+    }
+    if (!config_.loops_filename.empty())
+        data_.SetLoopProfile(&loops_);
+    if (!config_.memory_spec.empty()) {
+        MemoryConfig memory;
+        std::string error;
+        if (memory.Parse(config_.memory_spec, error))
+            data_.SetMemoryModel(memory);
+        else
+            std::cerr << "Profiler: " << error << ", no memory stalls" << std::endl;
+    }
+    for (const std::string& file : config_.symbol_files)
+        symbols_.Load(file);
+    if (!symbols_.Empty())
+        writer_.SetSymbols(&symbols_);
     instance_ = this;
 }
 
@@ -36,6 +79,24 @@ void ProfilerThread::Start() {
     // Initialize empty buffers
     InitializeEmptyBuffers();
 
+    if (!config_.trace_filename.empty() && trace_.Open(config_.trace_filename)) {
+        std::cout << "Profiler: recording events to " << config_.trace_filename << "\n";
+    } else {
+        // Self costs are sharded over the cores left after the emulator and
+        // this thread
+        unsigned cores = std::thread::hardware_concurrency();
+        if (!config_.sample_interval)
+            consumer_.StartWorkers(cores > 2 ? std::min(cores - 2, MAX_SHARD_WORKERS) : 0,
+                                   buffer_pool_.size());
+    }
+
+    if (!trace_.IsOpen() && config_.live_port > 0)
+        live_.Open(config_.live_port, config_.live_frames);
+
+    if (!config_.timeline_filename.empty() &&
+        timeline_.Open(config_.timeline_filename, config_.timeline_depth))
+        std::cout << "Profiler: writing timeline to " << config_.timeline_filename << "\n";
+
     // Start the profiler thread
     thread_ = std::thread(&ProfilerThread::ThreadFunc, this);
 
@@ -52,8 +113,10 @@ void ProfilerThread::Stop() {
     running_.store(false);
 
     // Wake up the thread if it's waiting
-    filled_cv_.notify_all();
-    empty_cv_.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(filled_mutex_);
+        filled_cv_.notify_all();
+    }
 
     // Wait for thread to finish
     if (thread_.joinable()) {
@@ -61,36 +124,35 @@ void ProfilerThread::Stop() {
     }
 
     // Final flush
+    timeline_.Close();
     FlushToFile();
+    live_.Close();
 }
 
 void ProfilerThread::PushFilledBuffer(EventBuffer* buffer) {
-    std::lock_guard<std::mutex> lock(filled_mutex_);
-    filled_buffers_.push_back(buffer);
-    filled_cv_.notify_one();
+    // Every buffer comes from the pool, so there is always room
+    filled_buffers_.Push(buffer);
+    if (consumer_sleeping_.load()) {
+        std::lock_guard<std::mutex> lock(filled_mutex_);
+        filled_cv_.notify_one();
+    }
 }
 
 EventBuffer* ProfilerThread::GetEmptyBuffer() {
-    std::unique_lock<std::mutex> lock(empty_mutex_);
-
-    // Wait for an empty buffer to become available
-    while (empty_buffers_.empty() && running_.load()) {
-        // Print warning if we're blocking
-        static bool warned = false;
-        if (!warned) {
-            std::cerr << "WARNING: Profiler main thread blocked waiting for empty buffer. "
-                      << "Profiler thread may be falling behind.\n";
-            warned = true;
-        }
-        empty_cv_.wait(lock);
-    }
+    EventBuffer* buffer = empty_buffers_.Pop();
 
-    if (empty_buffers_.empty()) {
-        return nullptr;
-    }
+    if (buffer || config_.drop_on_overflow)
+        return buffer;
 
-    EventBuffer* buffer = empty_buffers_.front();
-    empty_buffers_.pop_front();
+    // Print warning if we're blocking
+    static bool warned = false;
+    if (!warned) {
+        std::cerr << "WARNING: Profiler main thread blocked waiting for empty buffer. "
+                  << "Profiler thread may be falling behind.\n";
+        warned = true;
+    }
+    while (!(buffer = empty_buffers_.Pop()) && running_.load())
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
     return buffer;
 }
 
@@ -99,83 +161,145 @@ void ProfilerThread::SetOutputFilename(const std::string& filename) {
     output_filename_ = filename;
 }
 
+void ProfilerThread::AddMemoryRegion(const std::string& name, uint32_t base, uint32_t size) {
+    std::lock_guard<std::mutex> lock(output_mutex_);
+    heatmap_.AddRegion(name, base, size);
+}
+
 void ProfilerThread::Flush() {
     should_flush_.store(true);
+    std::lock_guard<std::mutex> lock(filled_mutex_);
     filled_cv_.notify_one();
 }
 
 void ProfilerThread::ThreadFunc() {
+    threadPolicyApply(THREAD_PROFILER);
     auto last_flush_time = std::chrono::steady_clock::now();
+    auto last_live_time = last_flush_time;
     const auto flush_interval = std::chrono::seconds(30);  // Flush every 30 seconds
+    const auto live_interval = std::chrono::milliseconds(LiveView::INTERVAL_MS);
+    const auto wait = live_.IsOpen() ? live_interval : std::chrono::milliseconds(1000);
 
     while (running_.load()) {
-        EventBuffer* buffer = nullptr;
+        EventBuffer* buffer = filled_buffers_.Pop();
 
-        {
+        if (!buffer) {
             std::unique_lock<std::mutex> lock(filled_mutex_);
 
-            // Wait for a filled buffer or timeout
-            filled_cv_.wait_for(lock, std::chrono::seconds(1), [this] {
-                return !filled_buffers_.empty() || !running_.load() || should_flush_.load();
+            // Wait for a filled buffer, a released one or timeout.  The
+            // producers only notify when they see consumer_sleeping_, and
+            // check it after publishing the buffer, so one of the two sides
+            // sees the other.
+            consumer_sleeping_.store(true);
+            filled_cv_.wait_for(lock, wait, [this] {
+                return !filled_buffers_.Empty() || consumer_.HasReleased() ||
+                       !running_.load() || should_flush_.load();
             });
-
-            if (!filled_buffers_.empty()) {
-                buffer = filled_buffers_.front();
-                filled_buffers_.pop_front();
-            }
+            consumer_sleeping_.store(false);
+            buffer = filled_buffers_.Pop();
         }
 
-        // Process the buffer if we got one
+        // Process the buffer if we got one; it goes back to the empty
+        // queue when the shard workers are done with it too
         if (buffer) {
-            consumer_.ProcessBuffer(buffer);
-
-            // Return buffer to empty queue
-            {
-                std::lock_guard<std::mutex> lock(empty_mutex_);
-                empty_buffers_.push_back(buffer);
-                empty_cv_.notify_one();
-            }
+            HandleBuffer(buffer);
+        } else {
+            consumer_.Collect();
         }
 
         // Check if it's time to flush
         auto now = std::chrono::steady_clock::now();
-        if (should_flush_.load() || (now - last_flush_time) >= flush_interval) {
+        // A requested flush waits for the buffers pushed before it
+        if ((should_flush_.load() && filled_buffers_.Empty()) ||
+            (now - last_flush_time) >= flush_interval) {
             FlushToFile();
             last_flush_time = now;
             should_flush_.store(false);
         }
+        if (live_.IsOpen() && now - last_live_time >= live_interval) {
+            PublishLive();
+            last_live_time = now;
+        }
+    }
+
+    // Pick up what the emulator pushed before stopping
+    while (EventBuffer* buffer = filled_buffers_.Pop())
+        HandleBuffer(buffer);
+}
+
+void ProfilerThread::HandleBuffer(EventBuffer* buffer) {
+    if (timeline_.IsOpen())
+        timeline_.ProcessEvents(buffer->events.get(), buffer->count);
+
+    if (!trace_.IsOpen()) {
+        consumer_.ProcessBuffer(buffer);
+        return;
     }
+
+    // Recording only: the events go to the trace unprocessed
+    trace_.Write(buffer->events.get(), buffer->count);
+    buffer->Clear();
+    empty_buffers_.Push(buffer);
 }
 
 void ProfilerThread::InitializeEmptyBuffers() {
-    std::lock_guard<std::mutex> lock(empty_mutex_);
-    empty_buffers_.clear();
+    // Only called before the threads start
+    filled_buffers_.Reset(buffer_pool_.size());
+    empty_buffers_.Reset(buffer_pool_.size());
 
     // Add all buffers from the pool to the empty queue
-    for (size_t i = 0; i < BUFFER_POOL_SIZE; ++i) {
-        buffer_pool_[i].Clear();
-        empty_buffers_.push_back(&buffer_pool_[i]);
+    for (auto& buffer : buffer_pool_) {
+        buffer->Clear();
+        empty_buffers_.Push(buffer.get());
     }
 }
 
 void ProfilerThread::FlushToFile() {
     std::lock_guard<std::mutex> lock(output_mutex_);
 
-    // Finalize the data before writing (creates synthetic root)
-    data_.Finalize();
+    // A trace is analysed offline, see profiler_replay
+    if (trace_.IsOpen()) {
+        if (!running_.load())
+            trace_.Close();
+        return;
+    }
 
-    // Convert to grouped format
-    GroupedProfilerData grouped = ConvertToGroupedData(data_);
+    // Finalize the data before writing (creates synthetic root); the
+    // writer then regroups and formats only what changed since last time
+    consumer_.Drain();
+    data_.Finalize();
 
-    // Check invariants on both raw and grouped data
+    // Check invariants on raw data
     //CheckProfilerInvariants(data_);
-    //CheckGroupedInvariants(grouped);
 
-    if (!serializer_.WriteToFile(output_filename_, grouped)) {
+    writer_.Update(data_);
+    if (live_.IsOpen())
+        live_.Update(data_);
+    if (!writer_.WriteToFile(output_filename_)) {
         std::cerr << "Failed to write profiler data to " << output_filename_ << std::endl;
     } else {
         //std::cout << "Profiler data flushed to " << output_filename_ << std::endl;
     }
+    if (!config_.heatmap_filename.empty())
+        heatmap_.WriteReport(config_.heatmap_filename);
+    if (!config_.folded_filename.empty())
+        folded_.WriteToFile(config_.folded_filename, folded_weight_,
+                            symbols_.Empty() ? nullptr : &symbols_);
+    if (!config_.loops_filename.empty())
+        loops_.WriteReport(config_.loops_filename, data_.GetTotals(),
+                           symbols_.Empty() ? nullptr : &symbols_);
+}
+
+// Regrouping for the live view keeps the callgrind writer in step too,
+// so that its next flush has less to do
+void ProfilerThread::PublishLive() {
+    std::lock_guard<std::mutex> lock(output_mutex_);
+
+    consumer_.Drain();
+    data_.Finalize();
+    writer_.Update(data_);
+    live_.Update(data_);
+    live_.Publish(data_, symbols_.Empty() ? nullptr : &symbols_);
 }
 
 void ProfilerThread::HandleSignal(int signal) {
@@ -195,10 +319,15 @@ void ProfilerThread::SignalHandler(int signal) {
 
 // Global instance management
 static ProfilerThread* g_profiler = nullptr;
+static ProfilerConfig g_config;
+
+void ConfigureProfiler(const ProfilerConfig& config) {
+    g_config = config;
+}
 
 void InitializeProfiler() {
     if (!g_profiler) {
-        g_profiler = new ProfilerThread();
+        g_profiler = new ProfilerThread(g_config);
         g_profiler->Start();
     }
 }
@@ -4,21 +4,49 @@
 #define PROFILER_THREAD_H
 
 #include "profiler_data.h"
+#include "profiler_heatmap.h"
+#include "profiler_symbols.h"
 #include "profiler_consumer.h"
 #include "profiler_callgrind.h"
+#include "profiler_folded.h"
+#include "profiler_live.h"
+#include "profiler_loops.h"
+#include "profiler_ring.h"
+#include "profiler_timeline.h"
+#include "profiler_trace.h"
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-#include <deque>
 #include <atomic>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace Profiler {
 
+// Buffer sizing and what to do when the emulator runs out of buffers
+struct ProfilerConfig {
+    size_t buffer_size = DEFAULT_BUFFER_SIZE;   // events per buffer
+    size_t buffer_count = 16;                   // buffers in the pool
+    bool drop_on_overflow = false;              // discard events rather than wait
+    std::string trace_filename;                 // record raw events here instead
+    unsigned sample_interval = 0;               // instructions per sample, 0 = instrumented
+    std::string timeline_filename;              // also write a Chrome trace timeline
+    unsigned timeline_depth = 16;               // deepest call on the timeline
+    std::string heatmap_filename;               // data access report, empty for none
+    std::string folded_filename;                // folded stacks, empty for none
+    std::string folded_weight = "instructions"; // their event type, see FoldedStacks
+    int live_port = 0;                          // live view port, 0 for none
+    unsigned live_frames = 50;                  // its frame window
+    std::string loops_filename;                 // hot loop report, empty for none
+    std::string memory_spec;                    // MemoryConfig for stalls, empty for none
+    std::vector<std::string> symbol_files;      // ELF files naming functions and lines
+};
+
 // Main profiler thread manager
 class ProfilerThread {
 public:
-    ProfilerThread();
+    explicit ProfilerThread(const ProfilerConfig& config = ProfilerConfig());
     ~ProfilerThread();
 
     // Start the profiler thread
@@ -30,12 +58,28 @@ public:
     // Push a filled buffer to the processing queue
     void PushFilledBuffer(EventBuffer* buffer);
 
-    // Get an empty buffer (blocks if none available)
+    // Get an empty buffer; blocks if none is available, unless overflow
+    // drops events, when it returns nullptr
     EventBuffer* GetEmptyBuffer();
 
+    bool DropsOnOverflow() const {
+        return config_.drop_on_overflow;
+    }
+
+    size_t GetBufferSize() const {
+        return config_.buffer_size;
+    }
+
+    unsigned GetSampleInterval() const {
+        return config_.sample_interval;
+    }
+
     // Set output filename
     void SetOutputFilename(const std::string& filename);
 
+    // Name an address range in the heatmap report
+    void AddMemoryRegion(const std::string& name, uint32_t base, uint32_t size);
+
     // Flush current data to file
     void Flush();
 
@@ -43,6 +87,8 @@ private:
     void ThreadFunc();
     void InitializeEmptyBuffers();
     void FlushToFile();
+    void PublishLive();
+    void HandleBuffer(EventBuffer* buffer);
     void HandleSignal(int signal);
 
     static void SignalHandler(int signal);
@@ -52,29 +98,41 @@ private:
     std::atomic<bool> running_;
     std::atomic<bool> should_flush_;
 
-    // Filled buffers queue (producer: main thread, consumer: profiler thread)
-    std::deque<EventBuffer*> filled_buffers_;
+    ProfilerConfig config_;
+
+    // Filled buffers queue (producer: main thread, consumer: profiler thread).
+    // The mutex and condition variable are only used to put the profiler
+    // thread to sleep when the queue is empty.
+    SpscRing<EventBuffer> filled_buffers_;
+    std::atomic<bool> consumer_sleeping_;
     std::mutex filled_mutex_;
     std::condition_variable filled_cv_;
 
     // Empty buffers queue (producer: profiler thread, consumer: main thread)
-    std::deque<EventBuffer*> empty_buffers_;
-    std::mutex empty_mutex_;
-    std::condition_variable empty_cv_;
+    SpscRing<EventBuffer> empty_buffers_;
 
     ProfilerData data_;
     BufferConsumer consumer_;
-    CallgrindSerializer serializer_;
+    CallgrindWriter writer_;
+    TraceWriter trace_;
+    TimelineWriter timeline_;
+    MemoryHeatmap heatmap_;
+    FoldedStacks folded_;
+    FoldedStacks::Weight folded_weight_ = FoldedStacks::Weight::INSTRUCTIONS;
+    LoopProfile loops_;
+    LiveView live_;
+    SymbolTable symbols_;
 
     std::string output_filename_;
     std::mutex output_mutex_;
 
     // Pool of buffer objects
-    static constexpr size_t BUFFER_POOL_SIZE = 16;
-    EventBuffer buffer_pool_[BUFFER_POOL_SIZE];
+    static constexpr unsigned MAX_SHARD_WORKERS = 8;
+    std::vector<std::unique_ptr<EventBuffer>> buffer_pool_;
 };
 
 // Global profiler instance management
+void ConfigureProfiler(const ProfilerConfig& config);
 void InitializeProfiler();
 void ShutdownProfiler();
 ProfilerThread* GetProfiler();
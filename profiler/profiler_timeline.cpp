@@ -0,0 +1,223 @@
+// Chrome trace timeline implementation
+
+#include "profiler_timeline.h"
+#include "profiler_cost_model.h"
+#include "profiler_events.h"
+#include <cstdarg>
+#include <iostream>
+
+namespace Profiler {
+
+static const int PID = 1;
+static const int TID_CPU = 1;
+static const int TID_FRAMES = 2;
+static const int TID_AUDIO = 3;
+static const int TID_GUEST = 4;
+
+static const double SLOW_FRAME_US = 20000.0;   // 50Hz
+static const size_t FLUSH_BYTES = 1 << 20;
+
+TimelineWriter::TimelineWriter()
+    : file_(nullptr), first_event_(true), max_depth_(0), us_per_cycle_(0),
+      current_pc_(0), frame_number_(0), frame_start_(0), in_frame_(false),
+      audio_register_(0), value_for_guest_(false), guest_left_(0) {
+}
+
+TimelineWriter::~TimelineWriter() {
+    Close();
+}
+
+bool TimelineWriter::Open(const std::string& filename, unsigned max_depth) {
+    Close();
+    file_ = std::fopen(filename.c_str(), "wb");
+    if (!file_) {
+        std::cerr << "Failed to open profiler timeline " << filename << std::endl;
+        return false;
+    }
+
+    max_depth_ = max_depth;
+    us_per_cycle_ = Profiler_CyclesToMicroseconds(1000000000ull) / 1e9;
+    totals_ = EventCounters();
+    current_pc_ = 0;
+    calls_.clear();
+    frame_number_ = 0;
+    in_frame_ = false;
+    value_for_guest_ = false;
+    first_event_ = true;
+
+    out_ = "[\n";
+    Emit("\"M\",\"name\":\"process_name\",\"pid\":%d,\"args\":{\"name\":\"nextp8\"}", PID);
+    Emit("\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"CPU\"}",
+         PID, TID_CPU);
+    Emit("\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"frames\"}",
+         PID, TID_FRAMES);
+    Emit("\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"audio\"}",
+         PID, TID_AUDIO);
+    Emit("\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"guest\"}",
+         PID, TID_GUEST);
+    return true;
+}
+
+void TimelineWriter::Close() {
+    if (!file_)
+        return;
+    while (!calls_.empty())
+        PopCall();
+    EndFrame();
+    out_ += "\n]\n";
+    std::fwrite(out_.data(), 1, out_.size(), file_);
+    std::fclose(file_);
+    file_ = nullptr;
+    out_.clear();
+}
+
+void TimelineWriter::Emit(const char* fields, ...) {
+    char buf[256];
+    va_list ap;
+
+    va_start(ap, fields);
+    std::vsnprintf(buf, sizeof(buf), fields, ap);
+    va_end(ap);
+
+    out_ += first_event_ ? "{\"ph\":" : ",\n{\"ph\":";
+    out_ += buf;
+    out_ += '}';
+    first_event_ = false;
+
+    if (out_.size() >= FLUSH_BYTES) {
+        std::fwrite(out_.data(), 1, out_.size(), file_);
+        out_.clear();
+    }
+}
+
+double TimelineWriter::Now() const {
+    return Profiler_CalculateCycles(totals_.instructions, totals_.instr_fetches,
+                                    totals_.data_reads, totals_.data_writes) * us_per_cycle_;
+}
+
+void TimelineWriter::ProcessEvents(const uint32_t* events, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+        ProcessEvent(events[i]);
+}
+
+void TimelineWriter::ProcessEvent(uint32_t event) {
+    uint32_t address = GetEventAddress(event);
+
+    switch (GetEventType(event)) {
+        case EventType::INSTR_EXECUTE:
+            totals_.instructions++;
+            current_pc_ = address;
+            break;
+        case EventType::JUMP:
+            current_pc_ = address;
+            break;
+        case EventType::CALL:
+            // Return address as ProfilerData works it out
+            calls_.push_back(Call{address, current_pc_ + 2 + GetReturnOffset(event), Now()});
+            current_pc_ = address;
+            break;
+        case EventType::RETURN: {
+            // Unwind to the matching frame, everything for a stray return
+            size_t keep = 0;
+            for (size_t i = calls_.size(); i > 0; --i) {
+                if (calls_[i - 1].return_address == address) {
+                    keep = i - 1;
+                    break;
+                }
+            }
+            while (calls_.size() > keep)
+                PopCall();
+            current_pc_ = address;
+            break;
+        }
+        case EventType::DATA_READ:
+            totals_.data_reads++;
+            break;
+        case EventType::DATA_WRITE:
+            totals_.data_writes++;
+            break;
+        case EventType::INSTR_READ:
+            totals_.instr_fetches++;
+            break;
+        case EventType::MARKER:
+            ProcessMarker(address);
+            break;
+        default:
+            break;
+    }
+}
+
+void TimelineWriter::PopCall() {
+    const Call& call = calls_.back();
+
+    if (calls_.size() <= max_depth_) {
+        Emit("\"X\",\"name\":\"0x%x\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+             call.entry, PID, TID_CPU, call.start, Now() - call.start);
+    }
+    calls_.pop_back();
+}
+
+void TimelineWriter::EndFrame() {
+    if (!in_frame_)
+        return;
+
+    double duration = Now() - frame_start_;
+    Emit("\"X\",\"name\":\"frame %u\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f%s,"
+         "\"args\":{\"ms\":%.3f}",
+         frame_number_, PID, TID_FRAMES, frame_start_, duration,
+         duration > SLOW_FRAME_US ? ",\"cname\":\"terrible\"" : "", duration / 1000.0);
+    frame_number_++;
+    in_frame_ = false;
+}
+
+void TimelineWriter::EmitGuestMark() {
+    Emit("\"i\",\"name\":\"%s\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f",
+         guest_name_.c_str(), PID, TID_GUEST, Now());
+    value_for_guest_ = false;
+}
+
+void TimelineWriter::ProcessMarker(uint32_t marker) {
+    uint32_t data = marker & 0xffff;
+
+    switch (marker >> 16) {
+        case PROFILER_MARKER_VBLANK:
+            Emit("\"i\",\"name\":\"VBLANK\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f",
+                 PID, TID_FRAMES, Now());
+            break;
+        case PROFILER_MARKER_FLIP:
+            // A frame runs from one flip to the next
+            EndFrame();
+            frame_start_ = Now();
+            in_frame_ = true;
+            break;
+        case PROFILER_MARKER_AUDIO:
+            audio_register_ = data;
+            value_for_guest_ = false;
+            break;
+        case PROFILER_MARKER_GUEST:
+            guest_name_.clear();
+            guest_left_ = data;
+            value_for_guest_ = true;
+            if (!guest_left_)
+                EmitGuestMark();
+            break;
+        case PROFILER_MARKER_VALUE:
+            if (value_for_guest_) {
+                for (int shift = 8; shift >= 0 && guest_left_; shift -= 8, guest_left_--) {
+                    char c = (data >> shift) & 0xff;
+
+                    // Kept to what needs no escaping in JSON
+                    guest_name_ += c >= 0x20 && c < 0x7f && c != '"' && c != '\\' ? c : '?';
+                }
+                if (!guest_left_)
+                    EmitGuestMark();
+                break;
+            }
+            Emit("\"i\",\"name\":\"audio 0x%02x\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,"
+                 "\"args\":{\"value\":%u}",
+                 audio_register_, PID, TID_AUDIO, Now(), data);
+            break;
+    }
+}
+
+} // namespace Profiler
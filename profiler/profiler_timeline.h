@@ -0,0 +1,78 @@
+// Frame-sliced timeline in Chrome trace format
+//
+// Follows the event stream with a cycle clock rebuilt from the cost model
+// (the one behind Profiler_GetCycleCount()) and writes a JSON array of
+// trace events for ui.perfetto.dev or chrome://tracing:
+//   CPU     a slice per call, down to a depth limit
+//   frames  a slice from each VFRONTREQ flip to the next, coloured when
+//           it took longer than 20ms (below 50Hz), and a mark per VBLANK
+//   audio   a mark per p8audio register write
+//   guest   a mark per perfctr MARK write, with the guest's name for it
+// Slices are named by function entry address.
+
+#ifndef PROFILER_TIMELINE_H
+#define PROFILER_TIMELINE_H
+
+#include "profiler_data.h"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace Profiler {
+
+class TimelineWriter {
+public:
+    TimelineWriter();
+    ~TimelineWriter();
+
+    // Calls nested deeper than max_depth are left out
+    bool Open(const std::string& filename, unsigned max_depth);
+    bool IsOpen() const {
+        return file_ != nullptr;
+    }
+
+    void ProcessEvents(const uint32_t* events, size_t count);
+
+    // End the calls and frame still open and close the file
+    void Close();
+
+private:
+    struct Call {
+        uint32_t entry;
+        uint32_t return_address;
+        double start;
+    };
+
+    FILE* file_;
+    std::string out_;
+    bool first_event_;
+    unsigned max_depth_;
+    double us_per_cycle_;
+
+    EventCounters totals_;
+    uint32_t current_pc_;
+    std::vector<Call> calls_;
+
+    uint32_t frame_number_;
+    double frame_start_;
+    bool in_frame_;
+    uint32_t audio_register_;
+    bool value_for_guest_;          // the next VALUE markers are a name
+    size_t guest_left_;             // characters of the name still to come
+    std::string guest_name_;
+
+    double Now() const;
+    void ProcessEvent(uint32_t event);
+    void ProcessMarker(uint32_t marker);
+    void PopCall();
+    void EndFrame();
+    void EmitGuestMark();
+
+    // Append one trace event, given its fields after "ph"
+    void Emit(const char* fields, ...);
+};
+
+} // namespace Profiler
+
+#endif // PROFILER_TIMELINE_H
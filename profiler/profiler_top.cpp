@@ -0,0 +1,73 @@
+// Live view of a running profile, see profiler_live.h
+//
+// Usage: profiler_top <port>
+//
+// Connects to the --profiler_live_port of an emulator on this machine and
+// redraws each report it sends, cut to the height of the terminal, until
+// the emulator stops profiling or the view is interrupted.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+static void Draw(const std::string& report) {
+    struct winsize size;
+    unsigned rows = 0;
+    std::string screen = "\033[H\033[2J";
+
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0)
+        rows = size.ws_row;
+    // The last row is kept free so the view doesn't scroll
+    for (size_t start = 0, line = 1; start < report.size() && (!rows || line < rows); ++line) {
+        size_t end = report.find('\n', start);
+        if (end == std::string::npos)
+            end = report.size() - 1;
+        screen.append(report, start, end + 1 - start);
+        start = end + 1;
+    }
+    std::fwrite(screen.data(), 1, screen.size(), stdout);
+    std::fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    struct sockaddr_in addr;
+    std::string report;
+    char buf[4096];
+    ssize_t n;
+
+    if (argc != 2 || !std::atoi(argv[1])) {
+        std::fprintf(stderr, "Usage: %s <port>\n", argv[0]);
+        return 2;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(std::atoi(argv[1]));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("profiler_top");
+        return 1;
+    }
+
+    // Reports end in a form feed
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; ++i) {
+            if (buf[i] != '\f') {
+                report += buf[i];
+                continue;
+            }
+            Draw(report);
+            report.clear();
+        }
+    }
+    close(fd);
+    std::printf("Profiler stopped\n");
+    return 0;
+}
@@ -0,0 +1,212 @@
+// Raw event trace files implementation
+
+#include "profiler_trace.h"
+#include <cstring>
+#include <iostream>
+
+#ifdef PROFILER_ZSTD
+#include <zstd.h>
+#endif
+
+namespace Profiler {
+
+static const char TRACE_MAGIC[8] = {'P', '8', 'T', 'R', 'A', 'C', 'E', '1'};
+static const uint32_t TRACE_ZSTD = 1;
+
+static void PutLE32(uint8_t* p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t GetLE32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// Addresses are 24 bits; deltas wrap the same way
+static uint32_t ZigZag(uint32_t delta) {
+    int32_t d = static_cast<int32_t>(delta << 8) >> 8;
+    return (static_cast<uint32_t>(d) << 1) ^ static_cast<uint32_t>(d >> 31);
+}
+
+static uint32_t UnZigZag(uint32_t v) {
+    return (v >> 1) ^ (0u - (v & 1));
+}
+
+TraceWriter::TraceWriter()
+    : file_(nullptr), flags_(0), last_address_(0), block_events_(0) {
+}
+
+TraceWriter::~TraceWriter() {
+    Close();
+}
+
+bool TraceWriter::Open(const std::string& filename) {
+    uint8_t header[12];
+
+    Close();
+    file_ = fopen(filename.c_str(), "wb");
+    if (!file_) {
+        std::cerr << "Failed to open profiler trace file: " << filename << std::endl;
+        return false;
+    }
+#ifdef PROFILER_ZSTD
+    flags_ = TRACE_ZSTD;
+#endif
+    memcpy(header, TRACE_MAGIC, 8);
+    PutLE32(header + 8, flags_);
+    fwrite(header, sizeof(header), 1, file_);
+    encoded_.reserve(BLOCK_EVENTS * 5);
+    return true;
+}
+
+void TraceWriter::Write(const uint32_t* events, size_t count) {
+    if (!file_)
+        return;
+
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t address = events[i] & 0x00FFFFFF;
+        uint64_t v = (static_cast<uint64_t>(ZigZag(address - last_address_)) << 8) | (events[i] >> 24);
+
+        last_address_ = address;
+        while (v >= 0x80) {
+            encoded_.push_back(static_cast<uint8_t>(v) | 0x80);
+            v >>= 7;
+        }
+        encoded_.push_back(static_cast<uint8_t>(v));
+        if (++block_events_ == BLOCK_EVENTS)
+            WriteBlock();
+    }
+}
+
+void TraceWriter::WriteBlock() {
+    uint8_t header[12];
+    const uint8_t* data = encoded_.data();
+    size_t stored = encoded_.size();
+
+    if (!block_events_)
+        return;
+
+#ifdef PROFILER_ZSTD
+    stored_.resize(ZSTD_compressBound(encoded_.size()));
+    size_t n = ZSTD_compress(stored_.data(), stored_.size(), encoded_.data(), encoded_.size(), 1);
+    if (ZSTD_isError(n)) {
+        std::cerr << "Profiler trace: " << ZSTD_getErrorName(n) << std::endl;
+        n = 0;
+    }
+    data = stored_.data();
+    stored = n;
+#endif
+
+    PutLE32(header, block_events_);
+    PutLE32(header + 4, encoded_.size());
+    PutLE32(header + 8, stored);
+    fwrite(header, sizeof(header), 1, file_);
+    fwrite(data, 1, stored, file_);
+
+    encoded_.clear();
+    block_events_ = 0;
+    last_address_ = 0;
+}
+
+void TraceWriter::Close() {
+    if (!file_)
+        return;
+    WriteBlock();
+    fclose(file_);
+    file_ = nullptr;
+}
+
+TraceReader::TraceReader()
+    : file_(nullptr), flags_(0) {
+}
+
+TraceReader::~TraceReader() {
+    if (file_)
+        fclose(file_);
+}
+
+bool TraceReader::Open(const std::string& filename) {
+    uint8_t header[12];
+
+    file_ = fopen(filename.c_str(), "rb");
+    if (!file_) {
+        std::cerr << "Failed to open profiler trace file: " << filename << std::endl;
+        return false;
+    }
+    if (fread(header, sizeof(header), 1, file_) != 1 || memcmp(header, TRACE_MAGIC, 8)) {
+        std::cerr << filename << ": not a profiler trace" << std::endl;
+        return false;
+    }
+    flags_ = GetLE32(header + 8);
+#ifndef PROFILER_ZSTD
+    if (flags_ & TRACE_ZSTD) {
+        std::cerr << filename << ": zstd compressed, rebuild with zstd to read it" << std::endl;
+        return false;
+    }
+#endif
+    return true;
+}
+
+bool TraceReader::ReadBlock(std::vector<uint32_t>& events) {
+    uint8_t header[12];
+
+    events.clear();
+    if (!file_ || fread(header, sizeof(header), 1, file_) != 1)
+        return false;
+
+    uint32_t count = GetLE32(header);
+    uint32_t raw = GetLE32(header + 4);
+    uint32_t stored = GetLE32(header + 8);
+
+    stored_.resize(stored);
+    if (fread(stored_.data(), 1, stored, file_) != stored) {
+        std::cerr << "Profiler trace: truncated block" << std::endl;
+        return false;
+    }
+
+    const uint8_t* p = stored_.data();
+#ifdef PROFILER_ZSTD
+    if (flags_ & TRACE_ZSTD) {
+        encoded_.resize(raw);
+        size_t n = ZSTD_decompress(encoded_.data(), raw, stored_.data(), stored);
+        if (ZSTD_isError(n) || n != raw) {
+            std::cerr << "Profiler trace: corrupt block" << std::endl;
+            return false;
+        }
+        p = encoded_.data();
+    }
+#endif
+    if (!(flags_ & TRACE_ZSTD) && raw != stored) {
+        std::cerr << "Profiler trace: corrupt block" << std::endl;
+        return false;
+    }
+
+    const uint8_t* end = p + raw;
+    uint32_t address = 0;
+
+    events.reserve(count);
+    while (events.size() < count && p < end) {
+        uint64_t v = 0;
+        unsigned shift = 0;
+
+        while (p < end && (*p & 0x80) && shift < 35) {
+            v |= static_cast<uint64_t>(*p++ & 0x7F) << shift;
+            shift += 7;
+        }
+        if (p == end)
+            break;
+        v |= static_cast<uint64_t>(*p++) << shift;
+
+        address = (address + UnZigZag(static_cast<uint32_t>(v >> 8))) & 0x00FFFFFF;
+        events.push_back((static_cast<uint32_t>(v & 0xFF) << 24) | address);
+    }
+    if (events.size() != count) {
+        std::cerr << "Profiler trace: corrupt block" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace Profiler
@@ -0,0 +1,71 @@
+// Raw event trace files
+//
+// A trace holds the 32-bit profiler events exactly as the emulator
+// produced them, so one capture can be replayed through ProfilerData as
+// often as needed.  After an 8 byte magic and a u32 flags word come
+// blocks of <u32 events, u32 raw bytes, u32 stored bytes, data>, all
+// little endian.  Within a block each event is a varint of
+// (zigzag(address - previous address) << 8 | event >> 24), the previous
+// address starting at 0, which brings straight-line code to one or two
+// bytes an event.  With zstd available the encoded bytes are compressed
+// block by block.
+
+#ifndef PROFILER_TRACE_H
+#define PROFILER_TRACE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace Profiler {
+
+class TraceWriter {
+public:
+    TraceWriter();
+    ~TraceWriter();
+
+    bool Open(const std::string& filename);
+    bool IsOpen() const {
+        return file_ != nullptr;
+    }
+
+    // Append events; they are written out a block at a time
+    void Write(const uint32_t* events, size_t count);
+
+    // Write the last block and close the file
+    void Close();
+
+private:
+    static constexpr size_t BLOCK_EVENTS = 1 << 18;
+
+    void WriteBlock();
+
+    FILE* file_;
+    uint32_t flags_;
+    uint32_t last_address_;
+    size_t block_events_;
+    std::vector<uint8_t> encoded_;
+    std::vector<uint8_t> stored_;
+};
+
+class TraceReader {
+public:
+    TraceReader();
+    ~TraceReader();
+
+    bool Open(const std::string& filename);
+
+    // Decode the next block into events; false at the end or on error
+    bool ReadBlock(std::vector<uint32_t>& events);
+
+private:
+    FILE* file_;
+    uint32_t flags_;
+    std::vector<uint8_t> stored_;
+    std::vector<uint8_t> encoded_;
+};
+
+} // namespace Profiler
+
+#endif // PROFILER_TRACE_H
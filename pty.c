@@ -185,9 +185,6 @@ int pty_open(int id, void **priv)
 	p->hshake=-1;
 	p->xlate=pty_par[1].i;
 	p->baud=115200;
-#ifdef NO_FIONREAD
-	p->bfc_valid=0;
-#endif
 	p->killed=0;
 	p->w=NULL;
 	p->teof=0;
@@ -204,6 +201,7 @@ int pty_open(int id, void **priv)
 		else pty_list=p->w;
 		p->w->sd=p;
 		p->w->job_control=pty_par[0].i;
+		ser_watch(p);
 		return 0;
 	}
 
@@ -223,6 +221,7 @@ void pty_close(int id,void *priv)
   /*printf("pty_close\n");*/
 
   ser_write(p,&fb,0);   /* attempt to generate a EOF/EOT */
+  ser_unwatch(p);
 
   fake_tty_close(p->w);
 
@@ -13,17 +13,13 @@ int tracetrap=0;
 
 void QMExecuteLoop(uw16 *oldPC)  /* fetch and dispatch loop */
 {
-  register void           (**tab)(void);
-
-        tab=qlux_table;
-
 	/*printf("enter QME \n");*/
 
 rep:
         while(likely(--nInst>=0 && oldPC!=pc) /* && oldPC!=pc+1 && oldPC!=pc+2 */)
 	  {
 	    /*printf("PC=%x\n",(Ptr)pc-(Ptr)memBase); */
-	    tab[code=RW_PC(pc++)&0xffff]();
+	    QLUX_HANDLER(code=RW_PC(pc++)&0xffff)();
 	  }
 
         if(extraFlag)
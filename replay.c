@@ -0,0 +1,164 @@
+/*
+ * replay.c
+ *
+ * Input recording and replay, see replay.h.
+ */
+
+#ifdef NEXTP8
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cycles.h"
+#include "replay.h"
+
+#define RP_MAGIC	"SQLUXRP"
+#define RP_BUFFER	(1 << 20)
+
+int replay_mode = REPLAY_OFF;
+
+static FILE *rp_file;
+static uint64_t rp_last;	/* cycle of the previous entry */
+static uint64_t rp_entries;
+
+static const char *const source_names[REPLAY_SOURCES] = {
+	"utimer", "rtc", "kbd", "joy", "mouse", "esp", "audio"
+};
+
+static void put_varint(uint64_t v)
+{
+	while (v >= 0x80) {
+		putc((int)(v & 0x7f) | 0x80, rp_file);
+		v >>= 7;
+	}
+	putc((int)v, rp_file);
+}
+
+static bool get_varint(uint64_t *v)
+{
+	int shift = 0, c;
+
+	*v = 0;
+	do {
+		c = getc(rp_file);
+		if (c == EOF || shift > 63)
+			return false;
+		*v |= (uint64_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	return true;
+}
+
+static void stop_replay(void)
+{
+	fclose(rp_file);
+	rp_file = NULL;
+	replay_mode = REPLAY_OFF;
+}
+
+bool replayInit(const char *record, const char *replay)
+{
+	char magic[8] = { 0 };
+	uint32_t version = 0;
+	int c;
+
+	rp_last = 0;
+	rp_entries = 0;
+	if (record && *record && replay && *replay) {
+		fprintf(stderr, "Replay: record_inputs and replay_inputs can't be used together\n");
+		return false;
+	}
+	if (record && *record) {
+		rp_file = fopen(record, "wb");
+		if (!rp_file) {
+			perror(record);
+			return false;
+		}
+		setvbuf(rp_file, NULL, _IOFBF, RP_BUFFER);
+		fwrite(RP_MAGIC, 1, sizeof(magic), rp_file);
+		for (version = REPLAY_VERSION, c = 0; c < 4; c++, version >>= 8)
+			putc(version & 0xff, rp_file);
+		replay_mode = REPLAY_RECORD;
+		atexit(replayClose);
+		printf("Replay: recording inputs to %s\n", record);
+		return true;
+	}
+	if (replay && *replay) {
+		rp_file = fopen(replay, "rb");
+		if (!rp_file) {
+			perror(replay);
+			return false;
+		}
+		setvbuf(rp_file, NULL, _IOFBF, RP_BUFFER);
+		if (fread(magic, 1, sizeof(magic), rp_file) == sizeof(magic)) {
+			for (c = 0; c < 4; c++)
+				version |= (uint32_t)(getc(rp_file) & 0xff) << (8 * c);
+		}
+		if (memcmp(magic, RP_MAGIC, sizeof(magic)) || version != REPLAY_VERSION) {
+			fprintf(stderr, "Replay: %s is not a version %d recording\n",
+				replay, REPLAY_VERSION);
+			fclose(rp_file);
+			rp_file = NULL;
+			return false;
+		}
+		replay_mode = REPLAY_PLAY;
+		printf("Replay: replaying inputs from %s\n", replay);
+		return true;
+	}
+	return false;
+}
+
+void replayClose(void)
+{
+	if (replay_mode == REPLAY_RECORD) {
+		fclose(rp_file);
+		rp_file = NULL;
+		replay_mode = REPLAY_OFF;
+		printf("Replay: %llu inputs recorded\n", (unsigned long long)rp_entries);
+	} else if (replay_mode == REPLAY_PLAY) {
+		stop_replay();
+	}
+}
+
+uint64_t replayLog(int source, uint64_t value)
+{
+	uint64_t now = cpu_cycles, delta, v;
+	int c;
+
+	if (replay_mode == REPLAY_RECORD) {
+		putc(source, rp_file);
+		put_varint(now - rp_last);
+		put_varint(value);
+		rp_last = now;
+		rp_entries++;
+		return value;
+	}
+
+	c = getc(rp_file);
+	if (c == EOF) {
+		printf("Replay: recording ends at cycle %llu after %llu inputs, running live\n",
+		       (unsigned long long)now, (unsigned long long)rp_entries);
+		stop_replay();
+		return value;
+	}
+	if (!get_varint(&delta) || !get_varint(&v)) {
+		printf("Replay: recording truncated after %llu inputs, running live\n",
+		       (unsigned long long)rp_entries);
+		stop_replay();
+		return value;
+	}
+	if (c != source || rp_last + delta != now) {
+		printf("Replay: diverged at cycle %llu reading %s, recorded %s at cycle %llu, running live\n",
+		       (unsigned long long)now, source_names[source],
+		       c < REPLAY_SOURCES ? source_names[c] : "?",
+		       (unsigned long long)(rp_last + delta));
+		stop_replay();
+		return value;
+	}
+	rp_last = now;
+	rp_entries++;
+	return v;
+}
+
+#endif /* NEXTP8 */
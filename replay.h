@@ -0,0 +1,65 @@
+/*
+ * replay.h
+ *
+ * Input recording and replay (--record_inputs, --replay_inputs).  Every
+ * value the guest reads from a source the host decides (the user timer,
+ * the RTC's host time, the keyboard, joystick and mouse registers, ESP8266
+ * data and status, p8audio status) goes through replayValue().  Recording
+ * logs it with the emulated cycle it was read at; replaying returns the
+ * logged value instead of the host's, so a run can be repeated bit for
+ * bit, e.g. under the profiler.  Both modes turn on cycle timing so that
+ * the 50Hz tick comes from emulated time too.  A replay that reads a
+ * different source or at a different cycle than the recording has
+ * diverged: it says so and carries on live.
+ *
+ * File format: "SQLUXRP\0", u32 version, then one entry per read: u8
+ * source, the cycles since the previous entry and the value, both as
+ * LEB128.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "QL68000.h"
+
+#define REPLAY_VERSION	2
+
+enum {
+	REPLAY_UTIMER,
+	REPLAY_RTC,
+	REPLAY_KBD,
+	REPLAY_JOY,
+	REPLAY_MOUSE,
+	REPLAY_ESP,
+	REPLAY_AUDIO,
+	REPLAY_SOURCES
+};
+
+enum {
+	REPLAY_OFF,
+	REPLAY_RECORD,
+	REPLAY_PLAY
+};
+
+extern int replay_mode;
+
+/* Options: file to record to, file to replay from.  True if either is on */
+bool replayInit(const char *record, const char *replay);
+
+/* Flushes the recording */
+void replayClose(void);
+
+uint64_t replayLog(int source, uint64_t value);
+
+/* The value the guest sees for a host value read from source */
+static inline uint64_t replayValue(int source, uint64_t value)
+{
+	if (likely(replay_mode == REPLAY_OFF))
+		return value;
+	return replayLog(source, value);
+}
+
+#endif /* REPLAY_H */
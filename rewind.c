@@ -0,0 +1,284 @@
+/*
+ * rewind.c
+ *
+ * Rewind points, see rewind.h.  Point k holds the devices at k and, for
+ * every page written before point k + 1, its contents at k.  Going back
+ * from now to k copies the pages written since the newest point back
+ * from the shadow copy, then the pages of each older point down to k;
+ * the shadow gets them too, so it is RAM at k again.
+ */
+
+#ifdef NEXTP8
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "QL68000.h"
+#include "memaccess.h"
+#include "rewind.h"
+#include "savestate.h"
+
+#define RW_PAGE		MEM_DIRTY_PAGE_SIZE
+#define RW_POINTS	1024
+#define RW_DEFAULT_MB	64
+
+typedef struct rw_point {
+	ss_buf devices;		/* save state sections but the RAM */
+	uint32_t npages;
+	uint32_t *page;		/* page numbers */
+	uint8_t *data;		/* their contents at this point */
+	uint64_t frame;
+} rw_point;
+
+static rw_point points[RW_POINTS];
+static int first, count;	/* the ring, oldest first */
+static size_t bytes, max_bytes;
+static int interval;
+static uint64_t frames;
+static SDL_atomic_t requested;
+
+static uint8_t *shadow;		/* RAM at the newest point */
+static uint32_t shadow_pages;
+static uint32_t *changed;	/* scratch, shadow_pages entries */
+
+static rw_point *point(int i)
+{
+	return &points[(first + i) % RW_POINTS];
+}
+
+static void free_pages(rw_point *p)
+{
+	bytes -= (size_t)p->npages * (RW_PAGE + sizeof(*p->page));
+	free(p->page);
+	free(p->data);
+	p->page = NULL;
+	p->data = NULL;
+	p->npages = 0;
+}
+
+static void free_point(rw_point *p)
+{
+	free_pages(p);
+	bytes -= p->devices.len;
+	free(p->devices.data);
+	memset(&p->devices, 0, sizeof(p->devices));
+}
+
+static void drop_oldest(void)
+{
+	free_point(point(0));
+	first = (first + 1) % RW_POINTS;
+	count--;
+}
+
+static void drop_all(void)
+{
+	while (count)
+		drop_oldest();
+	free(shadow);
+	free(changed);
+	shadow = NULL;
+	changed = NULL;
+}
+
+static bool open_shadow(void)
+{
+	if (RTOP % RW_PAGE) {
+		fprintf(stderr, "Rewind: ramsize isn't a multiple of %d bytes, off\n", RW_PAGE);
+		MemoryDirtyTrack(0);
+		interval = 0;
+		return false;
+	}
+	shadow_pages = RTOP / RW_PAGE;
+	shadow = malloc(RTOP);
+	changed = malloc(shadow_pages * sizeof(*changed));
+	if (!shadow || !changed) {
+		fprintf(stderr, "Rewind: out of memory, off\n");
+		drop_all();
+		MemoryDirtyTrack(0);
+		interval = 0;
+		return false;
+	}
+	memcpy(shadow, memBase, RTOP);
+	return true;
+}
+
+/* The pages written since p was taken, as they were then, go into p */
+static bool close_point(rw_point *p)
+{
+	uint32_t i, n = 0;
+
+	for (i = 0; i < shadow_pages; i++) {
+		if (MemoryPageDirty(i) &&
+		    memcmp(shadow + i * RW_PAGE, (Ptr)memBase + i * RW_PAGE, RW_PAGE))
+			changed[n++] = i;
+	}
+	if (!n)
+		return true;
+	p->page = malloc(n * sizeof(*p->page));
+	p->data = malloc((size_t)n * RW_PAGE);
+	if (!p->page || !p->data) {
+		free(p->page);
+		free(p->data);
+		p->page = NULL;
+		p->data = NULL;
+		return false;
+	}
+	for (i = 0; i < n; i++) {
+		uint8_t *s = shadow + changed[i] * RW_PAGE;
+
+		memcpy(p->data + (size_t)i * RW_PAGE, s, RW_PAGE);
+		memcpy(s, (Ptr)memBase + changed[i] * RW_PAGE, RW_PAGE);
+	}
+	memcpy(p->page, changed, n * sizeof(*p->page));
+	p->npages = n;
+	bytes += (size_t)n * (RW_PAGE + sizeof(*p->page));
+	return true;
+}
+
+static void take_point(void)
+{
+	rw_point *p;
+
+	if (shadow && shadow_pages != RTOP / RW_PAGE)
+		drop_all();
+	if (!shadow) {
+		if (!open_shadow())
+			return;
+	} else if (!close_point(point(count - 1))) {
+		fprintf(stderr, "Rewind: out of memory, starting again\n");
+		drop_all();
+		return;
+	}
+	MemoryDirtyClear();
+
+	if (count == RW_POINTS)
+		drop_oldest();
+	p = point(count);
+	savestateSaveDevices(&p->devices);
+	if (p->devices.error) {
+		fprintf(stderr, "Rewind: out of memory, starting again\n");
+		free(p->devices.data);
+		memset(&p->devices, 0, sizeof(p->devices));
+		drop_all();
+		return;
+	}
+	p->frame = frames;
+	bytes += p->devices.len;
+	count++;
+	while (bytes > max_bytes && count > 1)
+		drop_oldest();
+}
+
+static void restore_page(uint32_t page, const uint8_t *src)
+{
+	Ptr ram = (Ptr)memBase + page * RW_PAGE;
+
+	if (memcmp(ram, src, RW_PAGE)) {
+		memcpy(ram, src, RW_PAGE);
+		MemoryDMAWritten(page * RW_PAGE, RW_PAGE);
+	}
+}
+
+/* Back to point target, which becomes the newest */
+static void go_back(int target)
+{
+	int i;
+	uint32_t k;
+
+	for (k = 0; k < shadow_pages; k++) {
+		if (MemoryPageDirty(k))
+			restore_page(k, shadow + k * RW_PAGE);
+	}
+	for (i = count - 2; i >= target; i--) {
+		rw_point *p = point(i);
+
+		for (k = 0; k < p->npages; k++) {
+			const uint8_t *src = p->data + (size_t)k * RW_PAGE;
+
+			memcpy(shadow + p->page[k] * RW_PAGE, src, RW_PAGE);
+			restore_page(p->page[k], src);
+		}
+		free_pages(p);
+	}
+	while (count > target + 1)
+		free_point(point(--count));
+
+	if (savestateLoadDevices(&point(target)->devices) < 0)
+		fprintf(stderr, "Rewind: no CPU section\n");
+	frames = point(target)->frame;
+	MemoryDirtyClear();
+}
+
+int rewindTo(int steps)
+{
+	int target, gone;
+
+	if (!count || steps <= 0)
+		return 0;
+	target = count - steps;
+	// A point only just taken doesn't count as a step back
+	if (frames - point(count - 1)->frame < (uint64_t)(interval + 1) / 2)
+		target--;
+	if (target < 0)
+		target = 0;
+	gone = count - target;
+	go_back(target);
+	return gone;
+}
+
+int64_t rewindToFrame(uint64_t frame)
+{
+	int i;
+
+	for (i = count - 1; i >= 0; i--) {
+		if (point(i)->frame <= frame) {
+			go_back(i);
+			return (int64_t)frames;
+		}
+	}
+	return -1;
+}
+
+void rewindInit(int frames_per_point, int mb)
+{
+	if (frames_per_point <= 0)
+		return;
+	interval = frames_per_point;
+	max_bytes = (size_t)(mb > 0 ? mb : RW_DEFAULT_MB) << 20;
+	MemoryDirtyTrack(1);
+}
+
+bool rewindEnabled(void)
+{
+	return interval > 0;
+}
+
+void rewindFrame(void)
+{
+	frames++;
+}
+
+void rewindRequest(int steps)
+{
+	SDL_AtomicAdd(&requested, steps);
+}
+
+void rewindPoll(void)
+{
+	int steps;
+
+	if (!interval)
+		return;
+	steps = SDL_AtomicSet(&requested, 0);
+	if (steps > 0) {
+		rewindTo(steps);
+		return;
+	}
+	if (!count || frames - point(count - 1)->frame >= (uint64_t)interval)
+		take_point();
+}
+
+#endif /* NEXTP8 */
@@ -0,0 +1,42 @@
+/*
+ * rewind.h
+ *
+ * Rewind (--rewind <frames>).  Every that many frames a rewind point is
+ * taken: the device sections of a save state and, for the point before
+ * it, the old contents of the RAM pages written in between, found by
+ * dirty page tracking (see MemoryDirtyTrack()).  A copy of RAM as it was
+ * at the newest point supplies those contents.  Points are kept in a
+ * ring of at most --rewind_mb megabytes, the oldest dropped first.  As
+ * with save states the UART, the ESP8266 and p8audio are not rewound,
+ * nor is the SD card image.
+ */
+
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+void rewindInit(int frames, int mb);
+bool rewindEnabled(void);
+
+/* Emulator thread: a 50Hz frame has passed */
+void rewindFrame(void);
+
+/* Any thread: go back steps points at the next rewindPoll() */
+void rewindRequest(int steps);
+
+/* Emulator thread, between chunks: take a point or rewind when due */
+void rewindPoll(void);
+
+/* Emulator thread, between chunks: go back steps points, the first one
+   to the newest point unless it was only just taken.  Returns the
+   points gone back, 0 if there were none */
+int rewindTo(int steps);
+
+/* Emulator thread, between chunks: back to the newest point taken in
+   or before frame (counted in rewindFrame() calls).  Returns the frame
+   of that point, -1 if there is none */
+int64_t rewindToFrame(uint64_t frame);
+
+#endif /* REWIND_H */
@@ -0,0 +1,668 @@
+/*
+ * savestate.c
+ *
+ * Machine snapshots, see savestate.h.
+ */
+
+#ifdef NEXTP8
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef SAVESTATE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "QL68000.h"
+#include "QL_screen.h"
+#include "cycles.h"
+#ifdef DECODE_CACHE
+#include "decode_cache.h"
+#endif
+#include "general.h"
+#include "i2c_rtc.h"
+#include "memaccess.h"
+#include "netplay.h"
+#include "p8audio_verilated.h"
+#include "pacer.h"
+#include "perfctr.h"
+#include "savestate.h"
+#include "scheduler.h"
+#include "sd_dma.h"
+#include "blitter.h"
+#include "memdma.h"
+#include "fixmath.h"
+#include "dastream.h"
+#include "sd_image.h"
+#include "semihost.h"
+
+#define SS_MAGIC	"SQLUXSS"
+#define SS_HEADER	24
+#define SS_PAGE		4096
+
+static char *save_path;
+static int save_post = -1;
+static bool save_pending;
+static char *load_path;
+
+uw32 boot_snapshot_pc = 0xffffffff;
+static char *boot_path;
+static int boot_post = -1;
+static bool boot_pending;
+static bool boot_restore;
+static int boot_arg_post = -1;
+static uw32 boot_arg_pc = 0xffffffff;
+static void (*boot_reload)(void);
+
+/* Serialized sections of the last capture or file read */
+static ss_buf snapshot;
+
+void ssPut(ss_buf *b, const void *p, size_t n)
+{
+	if (b->len + n > b->cap) {
+		size_t cap = b->cap ? b->cap : 4096;
+		uint8_t *d;
+
+		while (cap < b->len + n)
+			cap *= 2;
+		d = realloc(b->data, cap);
+		if (!d) {
+			b->error = true;
+			return;
+		}
+		b->data = d;
+		b->cap = cap;
+	}
+	memcpy(b->data + b->len, p, n);
+	b->len += n;
+}
+
+void ssPut8(ss_buf *b, uint8_t v)
+{
+	ssPut(b, &v, 1);
+}
+
+void ssPut16(ss_buf *b, uint16_t v)
+{
+	uint8_t d[2] = { v, v >> 8 };
+
+	ssPut(b, d, 2);
+}
+
+void ssPut32(ss_buf *b, uint32_t v)
+{
+	ssPut16(b, v);
+	ssPut16(b, v >> 16);
+}
+
+void ssPut64(ss_buf *b, uint64_t v)
+{
+	ssPut32(b, v);
+	ssPut32(b, v >> 32);
+}
+
+void ssGet(ss_buf *b, void *p, size_t n)
+{
+	if (b->pos + n > b->len) {
+		memset(p, 0, n);
+		b->pos = b->len;
+		b->error = true;
+		return;
+	}
+	memcpy(p, b->data + b->pos, n);
+	b->pos += n;
+}
+
+uint8_t ssGet8(ss_buf *b)
+{
+	uint8_t v;
+
+	ssGet(b, &v, 1);
+	return v;
+}
+
+uint16_t ssGet16(ss_buf *b)
+{
+	uint8_t d[2];
+
+	ssGet(b, d, 2);
+	return d[0] | d[1] << 8;
+}
+
+uint32_t ssGet32(ss_buf *b)
+{
+	uint32_t lo = ssGet16(b);
+
+	return lo | (uint32_t)ssGet16(b) << 16;
+}
+
+uint64_t ssGet64(ss_buf *b)
+{
+	uint64_t lo = ssGet32(b);
+
+	return lo | (uint64_t)ssGet32(b) << 32;
+}
+
+static void cpu_save(ss_buf *b)
+{
+	int i;
+
+	CC_FLUSH();
+	for (i = 0; i < 16; i++)
+		ssPut32(b, reg[i]);
+	ssPut32(b, usp);
+	ssPut32(b, ssp);
+	ssPut32(b, (Ptr)pc - (Ptr)memBase);
+	ssPut32(b, vbr);
+	ssPut8(b, trace);
+	ssPut8(b, supervisor);
+	ssPut8(b, xflag);
+	ssPut8(b, negative);
+	ssPut8(b, zero);
+	ssPut8(b, overflow);
+	ssPut8(b, carry);
+	ssPut8(b, iMask);
+	ssPut8(b, stopped);
+	ssPut8(b, SDL_AtomicGet(&irqPending));
+	ssPut8(b, intReg);
+	ssPut8(b, theInt);
+	ssPut64(b, cpu_cycles);
+}
+
+static int cpu_load(ss_buf *b)
+{
+	int i, mask;
+
+	for (i = 0; i < 16; i++)
+		reg[i] = ssGet32(b);
+	usp = ssGet32(b);
+	ssp = ssGet32(b);
+	pc = (uw16 *)((Ptr)memBase + (ssGet32(b) & ADDR_MASK));
+	vbr = ssGet32(b);
+	trace = ssGet8(b);
+	supervisor = ssGet8(b);
+	xflag = ssGet8(b);
+	negative = ssGet8(b);
+	zero = ssGet8(b);
+	overflow = ssGet8(b);
+	carry = ssGet8(b);
+	cc_op = CC_NONE;
+	iMask = ssGet8(b);
+	stopped = ssGet8(b);
+	mask = ssGet8(b);
+	SDL_AtomicSet(&irqPending, mask & 0xfe);
+	intReg = ssGet8(b);
+	theInt = ssGet8(b);
+	cpu_cycles = ssGet64(b);
+	exception = 0;
+	extraFlag = (mask & 0xfe) != 0;
+	return b->error ? -1 : 0;
+}
+
+static void ram_save(ss_buf *b)
+{
+	ssPut32(b, RTOP);
+	ssPut(b, memBase, RTOP);
+}
+
+static int ram_load(ss_buf *b)
+{
+	const uint8_t *src;
+	uint32_t addr;
+
+	if (ssGet32(b) != (uint32_t)RTOP || b->len - b->pos < (size_t)RTOP)
+		return -1;
+	src = b->data + b->pos;
+	// Only pages that changed, so the decode cache keeps the rest
+	for (addr = 0; addr < (uint32_t)RTOP; addr += SS_PAGE) {
+		uint32_t n = RTOP - addr < SS_PAGE ? RTOP - addr : SS_PAGE;
+
+		if (memcmp((Ptr)memBase + addr, src + addr, n)) {
+			memcpy((Ptr)memBase + addr, src + addr, n);
+			MemoryDMAWritten(addr, n);
+		}
+	}
+	b->pos += RTOP;
+	return 0;
+}
+
+static void screen_save(ss_buf *b)
+{
+	ssPut(b, frameBuffer, sizeof(frameBuffer));
+	ssPut(b, overlayBuffer, sizeof(overlayBuffer));
+	ssPut(b, screenPalette, sizeof(screenPalette));
+	ssPut(b, secondaryPalette, sizeof(secondaryPalette));
+	ssPut(b, highColourBitfield, sizeof(highColourBitfield));
+	ssPut8(b, vfront);
+	ssPut8(b, vfrontreq);
+	ssPut8(b, overlay_control);
+	ssPut8(b, vblank_intr_enable);
+	ssPut8(b, screen_transform);
+	ssPut8(b, high_colour_mode);
+}
+
+static int screen_load(ss_buf *b)
+{
+	ssGet(b, frameBuffer, sizeof(frameBuffer));
+	ssGet(b, overlayBuffer, sizeof(overlayBuffer));
+	ssGet(b, screenPalette, sizeof(screenPalette));
+	ssGet(b, secondaryPalette, sizeof(secondaryPalette));
+	ssGet(b, highColourBitfield, sizeof(highColourBitfield));
+	vfront = ssGet8(b) & 1;
+	vfrontreq = ssGet8(b) & 1;
+	overlay_control = ssGet8(b);
+	vblank_intr_enable = ssGet8(b);
+	screen_transform = ssGet8(b);
+	high_colour_mode = ssGet8(b);
+	screenRedrawAll = 1;
+	return b->error ? -1 : 0;
+}
+
+static void p8audio_put(void *b, const void *p, size_t n)
+{
+	ssPut(b, p, n);
+}
+
+static void p8audio_save(ss_buf *b)
+{
+	p8audio_verilated_save_state(p8audio_put, b);
+}
+
+static int p8audio_load(ss_buf *b)
+{
+	return p8audio_verilated_load_state(b->data + b->pos, b->len - b->pos) ? 0 : -1;
+}
+
+/* In load order: the scheduler before the peripherals that re-arm events */
+static const struct {
+	char tag[5];
+	void (*save)(ss_buf *b);
+	int (*load)(ss_buf *b);
+} sections[] = {
+	{ "RAM ", ram_save, ram_load },
+	{ "CPU ", cpu_save, cpu_load },
+	{ "SCRN", screen_save, screen_load },
+	{ "SCHD", schedSaveState, schedLoadState },
+	{ "HWRG", HWSaveState, HWLoadState },
+	{ "RTC ", i2c_rtc_save_state, i2c_rtc_load_state },
+	{ "SDMA", sd_dma_save_state, sd_dma_load_state },
+	{ "PACE", pacerSaveState, pacerLoadState },
+	{ "NETP", netplaySaveState, netplayLoadState },
+	{ "PERF", perfctr_save_state, perfctr_load_state },
+	{ "SEMI", semihost_save_state, semihost_load_state },
+	{ "BLIT", blitter_save_state, blitter_load_state },
+	{ "MDMA", memdma_save_state, memdma_load_state },
+	{ "FXMA", fixmath_save_state, fixmath_load_state },
+	{ "DAST", dastream_save_state, dastream_load_state },
+	{ "P8AU", p8audio_save, p8audio_load },
+};
+
+#define NSECTIONS	(sizeof(sections) / sizeof(sections[0]))
+
+static void put_sections(ss_buf *out, size_t first)
+{
+	size_t i;
+
+	for (i = first; i < NSECTIONS; i++) {
+		ss_buf b = { 0 };
+
+		sections[i].save(&b);
+		ssPut(out, sections[i].tag, 4);
+		ssPut32(out, b.len);
+		ssPut(out, b.data, b.len);
+		out->error |= b.error;
+		free(b.data);
+	}
+}
+
+int savestateCapture(void)
+{
+	ss_buf out = { 0 };
+
+	sdImageFlush();
+	put_sections(&out, 0);
+	if (out.error) {
+		free(out.data);
+		fprintf(stderr, "Save state: out of memory\n");
+		return -1;
+	}
+	free(snapshot.data);
+	snapshot = out;
+	return 0;
+}
+
+/* Where section i starts in the sections in s, its length in *len */
+static uint8_t *find_section(const ss_buf *s, size_t i, uint32_t *len)
+{
+	size_t pos = 0;
+
+	while (pos + 8 <= s->len) {
+		ss_buf h = { s->data + pos, 8 };
+		char tag[4];
+
+		ssGet(&h, tag, 4);
+		*len = ssGet32(&h);
+		if (pos + 8 + *len > s->len)
+			break;
+		if (!memcmp(tag, sections[i].tag, 4))
+			return s->data + pos + 8;
+		pos += 8 + *len;
+	}
+	return NULL;
+}
+
+static void load_section(size_t i, uint8_t *data, uint32_t len)
+{
+	ss_buf b = { data, len };
+
+	if (data && sections[i].load(&b) < 0)
+		fprintf(stderr, "Save state: %.4s section not restored\n", sections[i].tag);
+}
+
+int savestateRestore(void)
+{
+	uint8_t *data[NSECTIONS];
+	uint32_t len[NSECTIONS];
+	size_t i;
+
+	for (i = 0; i < NSECTIONS; i++) {
+		data[i] = find_section(&snapshot, i, &len[i]);
+		// The same machine: without these two nothing is restored
+		if (!data[i] && i < 2) {
+			fprintf(stderr, "Save state: no %.4s section\n", sections[i].tag);
+			return -1;
+		}
+	}
+	if (len[0] != 4 + (uint32_t)RTOP) {
+		fprintf(stderr, "Save state: RAM size differs from ramsize\n");
+		return -1;
+	}
+
+	for (i = 0; i < NSECTIONS; i++)
+		load_section(i, data[i], len[i]);
+	return 0;
+}
+
+void savestateSaveDevices(ss_buf *out)
+{
+	put_sections(out, 1);
+}
+
+int savestateLoadDevices(const ss_buf *s)
+{
+	uint8_t *data[NSECTIONS];
+	uint32_t len[NSECTIONS];
+	size_t i;
+
+	for (i = 1; i < NSECTIONS; i++)
+		data[i] = find_section(s, i, &len[i]);
+	if (!data[1])
+		return -1;
+	for (i = 1; i < NSECTIONS; i++)
+		load_section(i, data[i], len[i]);
+	return 0;
+}
+
+int savestateWrite(const char *path)
+{
+	ss_buf h = { 0 };
+	void *payload;
+	size_t n;
+	uint32_t flags = 0;
+	FILE *f;
+	int ret = 0;
+
+	if (savestateCapture() < 0)
+		return -1;
+	payload = snapshot.data;
+	n = snapshot.len;
+#ifdef SAVESTATE_ZSTD
+	{
+		size_t bound = ZSTD_compressBound(n);
+		void *z = malloc(bound);
+
+		if (z) {
+			size_t zn = ZSTD_compress(z, bound, payload, n, 3);
+
+			if (!ZSTD_isError(zn)) {
+				payload = z;
+				n = zn;
+				flags |= 1;
+			} else {
+				free(z);
+			}
+		}
+	}
+#endif
+
+	f = fopen(path, "wb");
+	if (!f) {
+		perror(path);
+		ret = -1;
+		goto out;
+	}
+	ssPut(&h, SS_MAGIC, 8);
+	ssPut32(&h, SAVESTATE_VERSION);
+	ssPut32(&h, flags);
+	ssPut64(&h, snapshot.len);
+	if (h.error || fwrite(h.data, 1, h.len, f) != h.len ||
+	    fwrite(payload, 1, n, f) != n) {
+		fprintf(stderr, "Save state: can't write %s\n", path);
+		ret = -1;
+	}
+	if (fclose(f))
+		ret = -1;
+	if (!ret)
+		printf("Saved state to %s\n", path);
+out:
+	free(h.data);
+	if (payload != snapshot.data)
+		free(payload);
+	return ret;
+}
+
+int savestateRead(const char *path)
+{
+	uint8_t hdr[SS_HEADER];
+	ss_buf h = { hdr, SS_HEADER };
+	uint32_t version, flags;
+	long size;
+	uint8_t *data;
+	FILE *f = fopen(path, "rb");
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f) - SS_HEADER;
+	fseek(f, 0, SEEK_SET);
+	if (size < 0 || fread(hdr, 1, SS_HEADER, f) != SS_HEADER ||
+	    memcmp(hdr, SS_MAGIC, 8)) {
+		fprintf(stderr, "Save state: %s is not a save state\n", path);
+		fclose(f);
+		return -1;
+	}
+	h.pos = 8;
+	version = ssGet32(&h);
+	flags = ssGet32(&h);
+	if (version > SAVESTATE_VERSION) {
+		fprintf(stderr, "Save state: %s is version %u, this build reads up to %u\n",
+			path, version, SAVESTATE_VERSION);
+		fclose(f);
+		return -1;
+	}
+
+	data = malloc(size ? size : 1);
+	if (!data || fread(data, 1, size, f) != (size_t)size) {
+		fprintf(stderr, "Save state: can't read %s\n", path);
+		free(data);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	if (flags & 1) {
+#ifdef SAVESTATE_ZSTD
+		uint64_t raw = ssGet64(&h);
+		uint8_t *d = malloc(raw ? raw : 1);
+		size_t n = d ? ZSTD_decompress(d, raw, data, size) : 0;
+
+		free(data);
+		if (!d || ZSTD_isError(n) || n != raw) {
+			fprintf(stderr, "Save state: %s is corrupt\n", path);
+			free(d);
+			return -1;
+		}
+		data = d;
+		size = raw;
+#else
+		fprintf(stderr, "Save state: %s is compressed, this build has no zstd\n", path);
+		free(data);
+		return -1;
+#endif
+	}
+
+	free(snapshot.data);
+	snapshot = (ss_buf){ data, size, size };
+	if (savestateRestore() < 0)
+		return -1;
+	printf("Restored state from %s\n", path);
+	return 0;
+}
+
+void savestateInit(const char *save, int post, const char *load)
+{
+	save_path = save && *save ? strdup(save) : NULL;
+	save_post = save_path ? post : -1;
+	load_path = load && *load ? strdup(load) : NULL;
+	if (save_path && save_post < 0)
+		fprintf(stderr, "Save state: save_state needs save_state_post\n");
+}
+
+/* Saves at the first of the handover POST code and PC */
+static void boot_arm(void)
+{
+	boot_post = boot_arg_post;
+	boot_snapshot_pc = boot_arg_pc;
+	printf("Boot snapshot: saving %s at the handover\n", boot_path);
+}
+
+void savestateBootInit(const char *dir, uint64_t key, int post, const char *pc,
+		       void (*reload)(void))
+{
+	char path[4096];
+	FILE *f;
+
+	if (!dir || !*dir)
+		return;
+	// An explicit load_state wins
+	if (load_path) {
+		fprintf(stderr, "Boot snapshot: not used with load_state\n");
+		return;
+	}
+	snprintf(path, sizeof(path), "%s/boot-%016llx.ss", dir,
+		 (unsigned long long)key);
+	boot_path = strdup(path);
+	boot_reload = reload;
+	if (pc && *pc) {
+#ifdef DECODE_CACHE
+		boot_arg_pc = strtoul(pc, NULL, 0) & ADDR_MASK_E;
+#else
+		fprintf(stderr, "Boot snapshot: boot_snapshot_pc needs DECODE_CACHE\n");
+#endif
+	}
+	boot_arg_post = post;
+	if (post < 0 && boot_arg_pc == 0xffffffff) {
+		fprintf(stderr, "Boot snapshot: no boot_snapshot_post or boot_snapshot_pc\n");
+		return;
+	}
+
+	f = fopen(boot_path, "rb");
+	if (f) {
+		fclose(f);
+		boot_restore = true;
+	} else {
+		boot_arm();
+	}
+}
+
+void savestateBreak(void)
+{
+#ifdef DECODE_CACHE
+	uw32 addr = boot_snapshot_pc;
+
+	// Not run yet: restored runs start with this instruction
+	pc--;
+	cpu_cycles -= cycle_table[code];
+	nInst = 0;
+	boot_snapshot_pc = 0xffffffff;
+	dcache_invalidate_range(addr, 2);
+	boot_pending = true;
+#endif
+}
+
+void savestatePost(unsigned d)
+{
+	// Once, the first time the loader gets there
+	if ((int)d == save_post) {
+		save_pending = true;
+		save_post = -1;
+	}
+	if ((int)d == boot_post) {
+		boot_pending = true;
+		boot_post = -1;
+	}
+}
+
+/* Written under another name first, so a killed run leaves no half file */
+static void boot_save(void)
+{
+	char tmp[4096 + 16];
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp%d", boot_path, (int)getpid());
+	if (savestateWrite(tmp) < 0 || rename(tmp, boot_path)) {
+		fprintf(stderr, "Boot snapshot: can't save %s\n", boot_path);
+		remove(tmp);
+	}
+#ifdef DECODE_CACHE
+	// Stop at the PC as well only the first time
+	if (boot_snapshot_pc != 0xffffffff) {
+		uw32 addr = boot_snapshot_pc;
+
+		boot_snapshot_pc = 0xffffffff;
+		dcache_invalidate_range(addr, 2);
+	}
+#endif
+	boot_post = -1;
+}
+
+void savestatePoll(void)
+{
+	if (load_path) {
+		if (savestateRead(load_path) < 0)
+			fprintf(stderr, "Save state: booting normally\n");
+		free(load_path);
+		load_path = NULL;
+	}
+	if (boot_restore) {
+		boot_restore = false;
+		if (savestateRead(boot_path) < 0) {
+			fprintf(stderr, "Boot snapshot: booting normally\n");
+			boot_arm();
+		} else if (boot_reload)
+			boot_reload();
+	}
+	if (boot_pending) {
+		boot_pending = false;
+		boot_save();
+	}
+	if (save_pending) {
+		save_pending = false;
+		savestateWrite(save_path);
+	}
+}
+
+#endif /* NEXTP8 */
@@ -0,0 +1,88 @@
+/*
+ * savestate.h
+ *
+ * Machine snapshots (--save_state, --save_state_post, --load_state).  A
+ * snapshot holds the CPU, RAM, the display buffers and registers, the
+ * scheduler queue, the HW registers of general.c, the I2C RTC and the
+ * SD DMA block, and the p8audio model with its queued writes and
+ * unplayed samples; it is always taken between two chunks, on the
+ * emulator thread.  The SD card cache is flushed to the image at every
+ * save.  The UART and the ESP8266 are not saved and keep running from
+ * wherever they are on a restore.
+ *
+ * File format, little endian:
+ *   "SQLUXSS\0", u32 version, u32 flags (bit 0: zstd), u64 payload length
+ *   payload (zstd compressed when flagged): sections, each a four
+ *   character tag, u32 length and that many bytes.  Sections the reader
+ *   doesn't know are skipped.
+ */
+
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "QL68000.h"
+
+#define SAVESTATE_VERSION	1
+
+/* Growable buffer a section is written to or read from */
+typedef struct ss_buf {
+	uint8_t *data;
+	size_t len;		/* bytes written, or bytes in the section */
+	size_t cap;
+	size_t pos;		/* read position */
+	bool error;		/* allocation failure or read past the end */
+} ss_buf;
+
+void ssPut(ss_buf *b, const void *p, size_t n);
+void ssPut8(ss_buf *b, uint8_t v);
+void ssPut16(ss_buf *b, uint16_t v);
+void ssPut32(ss_buf *b, uint32_t v);
+void ssPut64(ss_buf *b, uint64_t v);
+
+/* Reads past the end return zeroes and set error */
+void ssGet(ss_buf *b, void *p, size_t n);
+uint8_t ssGet8(ss_buf *b);
+uint16_t ssGet16(ss_buf *b);
+uint32_t ssGet32(ss_buf *b);
+uint64_t ssGet64(ss_buf *b);
+
+/* Options: file saved when the guest writes POST code post (-1: never),
+   file restored before the first instruction */
+void savestateInit(const char *save, int post, const char *load);
+
+/* The guest wrote POST code d */
+void savestatePost(unsigned d);
+
+/* Emulator thread, between chunks: do what is pending */
+void savestatePoll(void);
+
+/* Options of the boot snapshot, key hashing what it depends on; reload
+   puts the cart back after a restore */
+void savestateBootInit(const char *dir, uint64_t key, int post, const char *pc,
+		       void (*reload)(void));
+
+/* Guest address of the boot snapshot, 0xffffffff for none */
+extern uw32 boot_snapshot_pc;
+
+/* Decode cache handler for the instruction at boot_snapshot_pc */
+void savestateBreak(void);
+
+int savestateWrite(const char *path);
+int savestateRead(const char *path);
+
+/*
+ * In-memory snapshot for restoring many times, e.g. once per test case.
+ * Restoring copies back only the RAM pages that have changed since.
+ */
+int savestateCapture(void);
+int savestateRestore(void);
+
+/* Every section but the RAM, for rewind (see rewind.h) */
+void savestateSaveDevices(ss_buf *out);
+int savestateLoadDevices(const ss_buf *s);
+
+#endif /* SAVESTATE_H */
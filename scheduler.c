@@ -0,0 +1,241 @@
+/*
+ * scheduler.c
+ *
+ * A binary min-heap of armed events ordered by deadline.  Emulator thread
+ * only: events are armed from the CPU loop and MMIO handlers and fire
+ * between instruction chunks.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cycles.h"
+#include "savestate.h"
+#include "scheduler.h"
+
+#define SCHED_MAX	32
+#define BUDGET_CYCLES	16	/* per instruction, so chunks seldom run past a deadline */
+
+MACHINE_LOCAL uint64_t sched_now = 0;
+
+static MACHINE_LOCAL sched_event *heap[SCHED_MAX];
+static MACHINE_LOCAL int heap_len = 0;
+
+/* Every event ever initialised, for restoring a save state */
+static MACHINE_LOCAL sched_event *known[SCHED_MAX];
+static MACHINE_LOCAL int known_len = 0;
+
+static void heap_set(int i, sched_event *ev)
+{
+	heap[i] = ev;
+	ev->slot = i + 1;
+}
+
+static void sift_up(int i)
+{
+	sched_event *ev = heap[i];
+
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+
+		if (heap[parent]->when <= ev->when)
+			break;
+		heap_set(i, heap[parent]);
+		i = parent;
+	}
+	heap_set(i, ev);
+}
+
+static void sift_down(int i)
+{
+	sched_event *ev = heap[i];
+
+	for (;;) {
+		int child = 2 * i + 1;
+
+		if (child >= heap_len)
+			break;
+		if (child + 1 < heap_len && heap[child + 1]->when < heap[child]->when)
+			child++;
+		if (ev->when <= heap[child]->when)
+			break;
+		heap_set(i, heap[child]);
+		i = child;
+	}
+	heap_set(i, ev);
+}
+
+static void heap_remove(sched_event *ev)
+{
+	int i = ev->slot - 1;
+
+	ev->slot = 0;
+	if (--heap_len == i)
+		return;
+	heap_set(i, heap[heap_len]);
+	sift_down(i);
+	sift_up(heap[i]->slot - 1);
+}
+
+static void heap_insert(sched_event *ev)
+{
+	if (heap_len == SCHED_MAX) {
+		fprintf(stderr, "Scheduler: no room for event %s\n", ev->name);
+		return;
+	}
+	heap[heap_len] = ev;
+	sift_up(heap_len++);
+}
+
+void schedInit(sched_event *ev, const char *name, sched_fn fn, void *arg)
+{
+	if (ev->slot)
+		heap_remove(ev);
+	ev->when = 0;
+	ev->period = 0;
+	ev->fn = fn;
+	ev->arg = arg;
+	ev->name = name;
+	for (int i = 0; i < known_len; i++) {
+		if (known[i] == ev)
+			return;
+	}
+	if (known_len < SCHED_MAX)
+		known[known_len++] = ev;
+}
+
+static void sched_arm(sched_event *ev, uint64_t delay, uint64_t period)
+{
+	if (ev->slot)
+		heap_remove(ev);
+	if (cycle_timing) {
+		delay *= CYCLES_PER_INSN;
+		period *= CYCLES_PER_INSN;
+	}
+	ev->when = sched_now + delay;
+	ev->period = period;
+	heap_insert(ev);
+}
+
+void schedAt(sched_event *ev, uint64_t delay)
+{
+	// Re-arming an event already due sooner would only push it back
+	if (ev->slot && !ev->period &&
+	    ev->when <= sched_now + delay * (cycle_timing ? CYCLES_PER_INSN : 1))
+		return;
+	sched_arm(ev, delay, 0);
+}
+
+void schedEvery(sched_event *ev, uint64_t period)
+{
+	sched_arm(ev, period, period ? period : 1);
+}
+
+void schedCancel(sched_event *ev)
+{
+	if (ev->slot)
+		heap_remove(ev);
+}
+
+long schedBudget(long max)
+{
+	uint64_t when, left;
+
+	if (!heap_len)
+		return max;
+	when = heap[0]->when;
+	if (when <= sched_now)
+		return 1;
+	left = when - sched_now;
+	if (cycle_timing)
+		left = left / BUDGET_CYCLES + 1;
+	if (left < (uint64_t)max)
+		return (long)left;
+	return max;
+}
+
+uint64_t schedUntilNext(uint64_t max)
+{
+	uint64_t when;
+
+	if (!heap_len)
+		return max;
+	when = heap[0]->when;
+	if (when <= sched_now)
+		return 0;
+	return when - sched_now < max ? when - sched_now : max;
+}
+
+void schedAdvance(long n)
+{
+	sched_now += n;
+
+	while (heap_len && heap[0]->when <= sched_now) {
+		sched_event *ev = heap[0];
+
+		if (ev->period) {
+			// Keep the phase, but don't replay periods missed in a long chunk
+			ev->when += ev->period;
+			if (ev->when <= sched_now)
+				ev->when = sched_now + ev->period;
+			sift_down(0);
+		} else {
+			heap_remove(ev);
+		}
+		ev->fn(ev->arg);
+	}
+}
+
+void schedSaveState(ss_buf *b)
+{
+	int i;
+
+	ssPut8(b, cycle_timing);
+	ssPut64(b, sched_now);
+	ssPut32(b, heap_len);
+	for (i = 0; i < heap_len; i++) {
+		size_t n = strlen(heap[i]->name);
+
+		ssPut8(b, n);
+		ssPut(b, heap[i]->name, n);
+		ssPut64(b, heap[i]->when - sched_now);
+		ssPut64(b, heap[i]->period);
+	}
+}
+
+int schedLoadState(ss_buf *b)
+{
+	uint32_t i, n;
+	int j;
+
+	// Deadlines are in the time base of the saving run
+	if (ssGet8(b) != cycle_timing)
+		return -1;
+	sched_now = ssGet64(b);
+	while (heap_len)
+		heap_remove(heap[0]);
+
+	n = ssGet32(b);
+	for (i = 0; i < n && !b->error; i++) {
+		char name[256];
+		uint8_t len = ssGet8(b);
+		uint64_t left, period;
+
+		ssGet(b, name, len);
+		name[len] = 0;
+		left = ssGet64(b);
+		period = ssGet64(b);
+		for (j = 0; j < known_len; j++) {
+			if (!strcmp(known[j]->name, name))
+				break;
+		}
+		if (j == known_len) {
+			fprintf(stderr, "Scheduler: save state has unknown event %s\n", name);
+			continue;
+		}
+		known[j]->when = sched_now + left;
+		known[j]->period = period;
+		heap_insert(known[j]);
+	}
+	return b->error ? -1 : 0;
+}
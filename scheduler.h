@@ -0,0 +1,65 @@
+/*
+ * scheduler.h
+ *
+ * Deadlines for timed peripherals, in emulated time.  The time base is
+ * instructions executed on the emulator thread, or CPU cycles with
+ * --cycle_timing (see cycles.h); the CPU loop runs up to the next
+ * deadline and then dispatches whatever is due.  Delays are always given
+ * in instructions and stand for CYCLES_PER_INSN cycles each under cycle
+ * timing.
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "machine_local.h"
+
+struct ss_buf;
+
+typedef void (*sched_fn)(void *arg);
+
+/* Owned by the peripheral; zero or schedInit before first use */
+typedef struct {
+	uint64_t when;		/* deadline in time base units */
+	uint64_t period;	/* re-armed by this much after firing, 0 for one-shot */
+	sched_fn fn;
+	void *arg;
+	const char *name;
+	int slot;		/* heap index + 1, 0 when not armed */
+} sched_event;
+
+/* Emulated time so far, in instructions or cycles */
+extern MACHINE_LOCAL uint64_t sched_now;
+
+void schedInit(sched_event *ev, const char *name, sched_fn fn, void *arg);
+
+/* Fire once, delay instructions from now (0: at the end of this chunk) */
+void schedAt(sched_event *ev, uint64_t delay);
+
+/* Fire every period instructions, the first period from now */
+void schedEvery(sched_event *ev, uint64_t period);
+
+void schedCancel(sched_event *ev);
+
+static inline bool schedArmed(const sched_event *ev)
+{
+	return ev->slot != 0;
+}
+
+/* Instructions to run before the next deadline, at most max */
+long schedBudget(long max);
+
+/* Units of time until the next deadline (0 if one is due), at most max */
+uint64_t schedUntilNext(uint64_t max);
+
+/* Account for n units of time run and dispatch every event now due */
+void schedAdvance(long n);
+
+/* Save state: the clock and the armed events, found again by name */
+void schedSaveState(struct ss_buf *b);
+int schedLoadState(struct ss_buf *b);
+
+#endif /* SCHED_H */
@@ -0,0 +1,137 @@
+/*
+ * sd_dma.c
+ *
+ * SD block DMA registers, see sd_dma.h.  A transfer stays BUSY for a
+ * time proportional to its length, as a card would, and the sectors move
+ * when it completes.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "memaccess.h"
+#include "savestate.h"
+#include "scheduler.h"
+#include "sd_dma.h"
+#include "sd_image.h"
+
+#define SD_DMA_INSNS_PER_SECTOR	64
+
+static bool dma_enabled;
+static uint16_t dma_status;
+static uint16_t dma_lba_hi, dma_lba_lo;
+static uint16_t dma_addr_hi, dma_addr_lo;
+static uint16_t dma_count;
+static bool dma_to_card;
+static sched_event dma_event;
+
+static void sd_dma_complete(void *arg)
+{
+	uint32_t lba = (uint32_t)dma_lba_hi << 16 | dma_lba_lo;
+	uint32_t addr = (uint32_t)dma_addr_hi << 16 | dma_addr_lo;
+	uint32_t len = (uint32_t)dma_count * SD_SECTOR_SIZE;
+	void *p = MemoryHostRange(addr, len, !dma_to_card);
+	int ret = -1;
+
+	if (p && dma_to_card) {
+		ret = sdImageWrite(lba, p, dma_count);
+	} else if (p) {
+		ret = sdImageRead(lba, p, dma_count);
+		if (ret == 0)
+			MemoryDMAWritten(addr, len);
+	}
+	if (ret < 0)
+		printf("SD DMA: %s of %u sectors at LBA %u, address 0x%x failed\n",
+		       dma_to_card ? "write" : "read", dma_count, lba, addr);
+
+	dma_status = SD_DMA_STATUS_DONE | (ret < 0 ? SD_DMA_STATUS_ERROR : 0);
+}
+
+void sd_dma_init(int enable)
+{
+	dma_enabled = enable;
+	dma_status = 0;
+	schedInit(&dma_event, "sd_dma", sd_dma_complete, NULL);
+}
+
+uint16_t sd_dma_read(unsigned reg)
+{
+	if (!dma_enabled)
+		return 0;
+
+	switch (reg) {
+	case SD_DMA_REG_ID:
+		return SD_DMA_ID;
+	case SD_DMA_REG_CTRL:
+		return dma_status;
+	case SD_DMA_REG_LBA_HI:
+		return dma_lba_hi;
+	case SD_DMA_REG_LBA_LO:
+		return dma_lba_lo;
+	case SD_DMA_REG_ADDR_HI:
+		return dma_addr_hi;
+	case SD_DMA_REG_ADDR_LO:
+		return dma_addr_lo;
+	case SD_DMA_REG_COUNT:
+		return dma_count;
+	}
+	return 0;
+}
+
+void sd_dma_write(unsigned reg, uint16_t d)
+{
+	if (!dma_enabled || (dma_status & SD_DMA_STATUS_BUSY))
+		return;
+
+	switch (reg) {
+	case SD_DMA_REG_CTRL:
+		if (d & SD_DMA_CTRL_ACK)
+			dma_status = 0;
+		if (d & (SD_DMA_CTRL_READ | SD_DMA_CTRL_WRITE)) {
+			dma_to_card = d & SD_DMA_CTRL_WRITE;
+			dma_status = SD_DMA_STATUS_BUSY;
+			schedAt(&dma_event, (uint64_t)dma_count * SD_DMA_INSNS_PER_SECTOR);
+		}
+		break;
+	case SD_DMA_REG_LBA_HI:
+		dma_lba_hi = d;
+		break;
+	case SD_DMA_REG_LBA_LO:
+		dma_lba_lo = d;
+		break;
+	case SD_DMA_REG_ADDR_HI:
+		dma_addr_hi = d;
+		break;
+	case SD_DMA_REG_ADDR_LO:
+		dma_addr_lo = d;
+		break;
+	case SD_DMA_REG_COUNT:
+		dma_count = d;
+		break;
+	}
+}
+
+void sd_dma_save_state(ss_buf *b)
+{
+	ssPut16(b, dma_status);
+	ssPut16(b, dma_lba_hi);
+	ssPut16(b, dma_lba_lo);
+	ssPut16(b, dma_addr_hi);
+	ssPut16(b, dma_addr_lo);
+	ssPut16(b, dma_count);
+	ssPut8(b, dma_to_card);
+}
+
+int sd_dma_load_state(ss_buf *b)
+{
+	dma_status = ssGet16(b);
+	dma_lba_hi = ssGet16(b);
+	dma_lba_lo = ssGet16(b);
+	dma_addr_hi = ssGet16(b);
+	dma_addr_lo = ssGet16(b);
+	dma_count = ssGet16(b);
+	dma_to_card = ssGet8(b);
+	// The completion, if BUSY, comes back with the scheduler's events
+	return b->error ? -1 : 0;
+}
@@ -0,0 +1,61 @@
+/*
+ * sd_dma.h
+ *
+ * Emulator-only SD block DMA registers (--sd_dma).  The guest sets LBA,
+ * guest address and sector count, starts a transfer through CTRL and
+ * polls STATUS until DONE; sectors are copied between the SD card image
+ * and RAM without going through the bit-serial SPI model, which stays
+ * available for conformance testing.  ID reads 0 when disabled, so a BSP
+ * can probe for the block and fall back to SPI.
+ *
+ * All registers are 16 bits, big endian:
+ *   +0x00 ID       'SD' (0x5344) when enabled
+ *   +0x02 CTRL     write: bit 0 read card to RAM, bit 1 write RAM to card,
+ *                  bit 15 clear DONE and ERROR
+ *         STATUS   read: bit 0 BUSY, bit 1 DONE, bit 2 ERROR
+ *   +0x04 LBA_HI
+ *   +0x06 LBA_LO
+ *   +0x08 ADDR_HI  guest address, must be plain RAM
+ *   +0x0a ADDR_LO
+ *   +0x0c COUNT    sectors
+ */
+
+#ifndef SD_DMA_H
+#define SD_DMA_H
+
+#include <stdint.h>
+
+#ifndef _SD_DMA_BASE
+#define _SD_DMA_BASE		0x8f0000
+#endif
+#define _SD_DMA_SIZE		0x10
+
+#define SD_DMA_ID		0x5344
+#define SD_DMA_CTRL_READ	0x0001
+#define SD_DMA_CTRL_WRITE	0x0002
+#define SD_DMA_CTRL_ACK		0x8000
+#define SD_DMA_STATUS_BUSY	0x0001
+#define SD_DMA_STATUS_DONE	0x0002
+#define SD_DMA_STATUS_ERROR	0x0004
+
+#define SD_DMA_REG_ID		0x00
+#define SD_DMA_REG_CTRL		0x02
+#define SD_DMA_REG_LBA_HI	0x04
+#define SD_DMA_REG_LBA_LO	0x06
+#define SD_DMA_REG_ADDR_HI	0x08
+#define SD_DMA_REG_ADDR_LO	0x0a
+#define SD_DMA_REG_COUNT	0x0c
+
+struct ss_buf;
+
+void sd_dma_init(int enable);
+
+/* Word access to the register at offset reg */
+uint16_t sd_dma_read(unsigned reg);
+void sd_dma_write(unsigned reg, uint16_t d);
+
+/* Save state: the registers and a transfer in progress */
+void sd_dma_save_state(struct ss_buf *b);
+int sd_dma_load_state(struct ss_buf *b);
+
+#endif /* SD_DMA_H */
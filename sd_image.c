@@ -0,0 +1,798 @@
+/*
+ * sd_image.c
+ *
+ * SD card image access.  On POSIX hosts the whole image is mapped shared
+ * and read/written with memcpy; the written range is msync'd every so
+ * often and at exit.  Elsewhere (Windows, WASM) 4KiB blocks are read
+ * through an LRU cache with dirty tracking and written back on eviction,
+ * on the same timer and at exit.
+ *
+ * Under Emscripten the image can also be an http(s) URL.  It is then
+ * fetched lazily in 64KiB chunks with range requests, each kept as a file
+ * under /local so IDBFS persists it to IndexedDB; a later visit only
+ * fetches what it hasn't got.  Guest writes land in the local chunks and
+ * never go back to the server.  A background thread fetches the rest in
+ * order, so the guest can boot from the first chunks straight away.
+ *
+ * With an overlay (--sdcard_overlay) the image is only read, so parallel
+ * instances can share it.  Written 4KiB blocks live in memory or in a
+ * sparse delta file, at their own offset in it, with the map of which
+ * blocks it holds after the last one.  A mapped image is mapped private,
+ * so its pages are copied as they are written and the delta file is
+ * brought up to date on the flush timer; an "mem" overlay is just that.
+ * A delta file whose map matches the image's size is carried on from.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define SD_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __EMSCRIPTEN__
+#define SD_LAZY
+#include <pthread.h>
+#include <sys/stat.h>
+#include "wasm_support.h"
+#endif
+
+#include "async_io.h"
+#include "metrics.h"
+#include "scheduler.h"
+#include "sd_image.h"
+#include "startup_timing.h"
+
+#define SD_FLUSH_INSNS		20000000	/* a second or so of emulation */
+#define SD_BLOCK_SECTORS	8
+#define SD_BLOCK_SIZE		(SD_BLOCK_SECTORS * SD_SECTOR_SIZE)
+#define SD_CACHE_BLOCKS		1024		/* 4MiB */
+#define SD_HASH_SIZE		2048		/* power of two */
+#define SD_CHUNK_BLOCKS		16		/* per range request and local file */
+#define SD_CHUNK_SIZE		(SD_CHUNK_BLOCKS * SD_BLOCK_SIZE)
+
+static uint32_t sd_sectors;
+static bool sd_open;
+static bool sd_read_only;
+static bool sd_dirty;
+static sched_event sd_flush_event;
+
+#define OV_MAGIC		"SDOVL1\n"	/* 8 bytes with the NUL */
+
+static char *ov_path;			/* delta file, NULL for none */
+static bool ov_mem;			/* overlay in memory only */
+static bool ov_discard;			/* remove the delta file at exit */
+static bool ov_unlinked;
+static FILE *ov_file;
+static uint8_t *ov_bits;		/* blocks the overlay holds */
+static uint32_t ov_blocks;
+static uint64_t ov_tail;		/* delta file offset of the map */
+#ifdef SD_MMAP
+static uint8_t *ov_dirty;		/* blocks written since the last flush */
+#else
+static uint8_t **ov_data;		/* ov_mem blocks */
+#endif
+
+static bool ov_on(void)
+{
+	return ov_mem || ov_path;
+}
+
+static bool ov_has(uint32_t block)
+{
+	return ov_bits[block >> 3] & (1 << (block & 7));
+}
+
+static void ov_set(uint8_t *bits, uint32_t block)
+{
+	bits[block >> 3] |= 1 << (block & 7);
+}
+
+/* Through async_io.h, so the flush timer's writes land in the
+   background; ov_file's own buffer is never used */
+static int ov_file_io(uint64_t off, void *buf, size_t n, bool write)
+{
+	if (write)
+		return asyncIoWrite(fileno(ov_file), buf, n, off);
+	return asyncIoRead(fileno(ov_file), buf, n, off) == (long)n ? 0 : -1;
+}
+
+/* The map after the blocks, so a later run can carry on */
+static void ov_write_map(void)
+{
+	char magic[8] = OV_MAGIC;
+	uint64_t size = (uint64_t)sd_sectors * SD_SECTOR_SIZE;
+
+	if (ov_file_io(ov_tail, magic, sizeof(magic), true) < 0 ||
+	    ov_file_io(ov_tail + 8, &size, sizeof(size), true) < 0 ||
+	    ov_file_io(ov_tail + 16, ov_bits, (ov_blocks + 7) / 8, true) < 0)
+		fprintf(stderr, "SD image: write of overlay %s failed\n", ov_path);
+}
+
+/* The delta file's map if it has one for an image this size, else a
+   fresh one */
+static int ov_open(uint64_t size)
+{
+	char magic[8];
+	uint64_t had = 0;
+
+	ov_blocks = (size + SD_BLOCK_SIZE - 1) / SD_BLOCK_SIZE;
+	ov_tail = (uint64_t)ov_blocks * SD_BLOCK_SIZE;
+	ov_bits = calloc((ov_blocks + 7) / 8, 1);
+#ifdef SD_MMAP
+	ov_dirty = calloc((ov_blocks + 7) / 8, 1);
+	if (!ov_dirty)
+		return -1;
+#else
+	if (ov_mem && !(ov_data = calloc(ov_blocks, sizeof(*ov_data))))
+		return -1;
+#endif
+	if (!ov_bits)
+		return -1;
+	if (!ov_path)
+		return 0;
+
+	ov_file = fopen(ov_path, "r+b");
+	if (ov_file && (ov_file_io(ov_tail, magic, sizeof(magic), false) < 0 ||
+			memcmp(magic, OV_MAGIC, sizeof(magic)) ||
+			ov_file_io(ov_tail + 8, &had, sizeof(had), false) < 0 || had != size ||
+			ov_file_io(ov_tail + 16, ov_bits, (ov_blocks + 7) / 8, false) < 0)) {
+		memset(ov_bits, 0, (ov_blocks + 7) / 8);
+		asyncIoForget(fileno(ov_file));
+		fclose(ov_file);
+		ov_file = NULL;
+	}
+	if (!ov_file) {
+		ov_file = fopen(ov_path, "w+b");
+		if (!ov_file) {
+			fprintf(stderr, "SD image: can't create overlay %s\n", ov_path);
+			return -1;
+		}
+		ov_write_map();
+	}
+#ifndef _WIN32
+	// Gone even if the emulator is killed
+	if (ov_discard && !unlink(ov_path))
+		ov_unlinked = true;
+#endif
+	printf("SD image: writes go to %s%s\n", ov_path, had ? ", carried on" : "");
+	return 0;
+}
+
+static void ov_close(void)
+{
+	if (ov_file) {
+		if (asyncIoForget(fileno(ov_file)) < 0)
+			fprintf(stderr, "SD image: write of overlay %s failed\n", ov_path);
+		fclose(ov_file);
+		if (ov_discard && !ov_unlinked)
+			remove(ov_path);
+	}
+	ov_file = NULL;
+	ov_unlinked = false;
+	free(ov_bits);
+	ov_bits = NULL;
+#ifdef SD_MMAP
+	free(ov_dirty);
+	ov_dirty = NULL;
+#else
+	if (ov_data) {
+		for (uint32_t i = 0; i < ov_blocks; i++)
+			free(ov_data[i]);
+		free(ov_data);
+		ov_data = NULL;
+	}
+#endif
+}
+
+void sdImageSetOverlay(const char *overlay, bool discard)
+{
+	free(ov_path);
+	ov_path = NULL;
+	ov_mem = overlay && !strcmp(overlay, "mem");
+	if (overlay && *overlay && !ov_mem)
+		ov_path = strdup(overlay);
+	ov_discard = discard;
+}
+
+#ifdef SD_MMAP
+
+static int sd_fd = -1;
+static uint8_t *sd_map;
+static size_t sd_map_len;
+static uint32_t sd_dirty_lo, sd_dirty_hi;	/* sectors written since the last flush */
+
+#else
+
+typedef struct {
+	uint32_t block;
+	bool valid;
+	bool dirty;
+	int hash_next;			/* chain, -1 terminated */
+	int prev, next;			/* LRU list, most recent at lru_head */
+	uint8_t *data;
+} sd_cache_block;
+
+static FILE *sd_file;
+static sd_cache_block sd_cache[SD_CACHE_BLOCKS];
+static uint8_t *sd_cache_data;
+static int sd_hash[SD_HASH_SIZE];
+static int lru_head = -1, lru_tail = -1;
+
+#ifdef SD_LAZY
+
+static char *sd_url;
+static uint64_t sd_url_size;
+static char sd_chunk_dir[32];
+static uint32_t sd_chunks;
+static pthread_mutex_t sd_chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *sd_chunk_file;		/* the chunk last accessed */
+static uint32_t sd_chunk_open = UINT32_MAX;
+static bool sd_fetched;			/* chunks not yet synced to IndexedDB */
+static pthread_t sd_prefetch;
+static bool sd_prefetching;
+static volatile bool sd_prefetch_quit;
+
+static size_t chunk_len(uint32_t c)
+{
+	uint64_t left = sd_url_size - (uint64_t)c * SD_CHUNK_SIZE;
+
+	return left < SD_CHUNK_SIZE ? (size_t)left : SD_CHUNK_SIZE;
+}
+
+static void chunk_path(char *path, size_t size, uint32_t c)
+{
+	snprintf(path, size, "%s/%u", sd_chunk_dir, c);
+}
+
+/* Make sure chunk c is stored locally; from either thread, unlocked */
+static int chunk_fetch(uint32_t c)
+{
+	char path[48];
+	struct stat st;
+	size_t len = chunk_len(c);
+	uint8_t *buf;
+	FILE *f;
+	bool have;
+	int ret = 0;
+
+	chunk_path(path, sizeof(path), c);
+	pthread_mutex_lock(&sd_chunk_lock);
+	have = !stat(path, &st);
+	pthread_mutex_unlock(&sd_chunk_lock);
+	if (have)
+		return 0;
+
+	// Fetched unlocked; if both threads want it, the first to store wins
+	buf = malloc(len);
+	if (!buf)
+		return -1;
+	if (wasm_http_range(sd_url, (double)c * SD_CHUNK_SIZE, len, buf) != (int)len) {
+		free(buf);
+		return -1;
+	}
+	pthread_mutex_lock(&sd_chunk_lock);
+	if (stat(path, &st)) {
+		f = fopen(path, "wb");
+		if (!f || fwrite(buf, 1, len, f) != len)
+			ret = -1;
+		if (f)
+			fclose(f);
+		if (ret < 0)
+			remove(path);
+		else
+			sd_fetched = true;
+	}
+	pthread_mutex_unlock(&sd_chunk_lock);
+	free(buf);
+	return ret;
+}
+
+static int lazy_io(uint32_t block, void *buf, bool write)
+{
+	uint32_t c = block / SD_CHUNK_BLOCKS;
+	size_t off = (size_t)(block % SD_CHUNK_BLOCKS) * SD_BLOCK_SIZE;
+	size_t len = chunk_len(c) - off;
+	size_t n = len < SD_BLOCK_SIZE ? len : SD_BLOCK_SIZE;
+	bool ok;
+
+	if (chunk_fetch(c) < 0) {
+		fprintf(stderr, "SD image: fetch of chunk %u failed\n", c);
+		return -1;
+	}
+	pthread_mutex_lock(&sd_chunk_lock);
+	if (c != sd_chunk_open) {
+		char path[48];
+
+		if (sd_chunk_file)
+			fclose(sd_chunk_file);
+		chunk_path(path, sizeof(path), c);
+		sd_chunk_file = fopen(path, "r+b");
+		sd_chunk_open = sd_chunk_file ? c : UINT32_MAX;
+	}
+	ok = sd_chunk_file && !fseek(sd_chunk_file, off, SEEK_SET) &&
+	     (write ? fwrite(buf, 1, n, sd_chunk_file) : fread(buf, 1, n, sd_chunk_file)) == n;
+	pthread_mutex_unlock(&sd_chunk_lock);
+	if (!ok)
+		return -1;
+	if (!write)
+		memset((uint8_t *)buf + n, 0, SD_BLOCK_SIZE - n);
+	return 0;
+}
+
+static void *prefetch_main(void *arg)
+{
+	for (uint32_t c = 0; c < sd_chunks && !sd_prefetch_quit; c++) {
+		if (chunk_fetch(c) < 0) {
+			fprintf(stderr, "SD image: background fetch stopped at chunk %u\n", c);
+			break;
+		}
+	}
+	return NULL;
+}
+
+/* Local chunks live in a directory named for the URL and size */
+static int lazy_open(const char *url, uint64_t *size)
+{
+	double len = wasm_http_size(url);
+	uint32_t h = 2166136261u;
+
+	if (len < SD_SECTOR_SIZE) {
+		fprintf(stderr, "SD image: can't fetch %s\n", url);
+		return -1;
+	}
+	sd_url = strdup(url);
+	sd_url_size = (uint64_t)len;
+	for (const char *p = url; *p; p++)
+		h = (h ^ (uint8_t)*p) * 16777619u;
+	h = (h ^ (uint32_t)sd_url_size ^ (uint32_t)(sd_url_size >> 32)) * 16777619u;
+	snprintf(sd_chunk_dir, sizeof(sd_chunk_dir), "/local/sd-%08x", h);
+	mkdir(sd_chunk_dir, 0777);
+	sd_chunks = (sd_url_size + SD_CHUNK_SIZE - 1) / SD_CHUNK_SIZE;
+	sd_chunk_open = UINT32_MAX;
+	sd_fetched = false;
+	sd_prefetch_quit = false;
+	sd_prefetching = !pthread_create(&sd_prefetch, NULL, prefetch_main, NULL);
+	printf("SD image: streaming %s (%llu KiB) into %s\n", url,
+	       (unsigned long long)(sd_url_size >> 10), sd_chunk_dir);
+	*size = sd_url_size;
+	return 0;
+}
+
+static void lazy_close(void)
+{
+	if (sd_prefetching) {
+		sd_prefetch_quit = true;
+		pthread_join(sd_prefetch, NULL);
+		sd_prefetching = false;
+	}
+	if (sd_chunk_file)
+		fclose(sd_chunk_file);
+	sd_chunk_file = NULL;
+	sd_chunk_open = UINT32_MAX;
+	wasm_sync_storage();
+	free(sd_url);
+	sd_url = NULL;
+}
+
+#endif /* SD_LAZY */
+
+/* A block to or from the overlay; reads it doesn't hold go to the image */
+static int ov_io(uint32_t block, void *buf, bool write)
+{
+	if (write) {
+		ov_set(ov_bits, block);
+		if (ov_file)
+			return ov_file_io((uint64_t)block * SD_BLOCK_SIZE, buf, SD_BLOCK_SIZE, true);
+		if (!ov_data[block] && !(ov_data[block] = malloc(SD_BLOCK_SIZE)))
+			return -1;
+		memcpy(ov_data[block], buf, SD_BLOCK_SIZE);
+		return 0;
+	}
+	if (ov_file)
+		return ov_file_io((uint64_t)block * SD_BLOCK_SIZE, buf, SD_BLOCK_SIZE, false);
+	memcpy(buf, ov_data[block], SD_BLOCK_SIZE);
+	return 0;
+}
+
+static int sd_file_io(uint32_t block, void *buf, bool write)
+{
+	uint64_t off = (uint64_t)block * SD_BLOCK_SIZE;
+	uint64_t len = ((uint64_t)sd_sectors * SD_SECTOR_SIZE) - off;
+	size_t n = len < SD_BLOCK_SIZE ? (size_t)len : SD_BLOCK_SIZE;
+
+	if (ov_on() && (write || ov_has(block)))
+		return ov_io(block, buf, write);
+
+#ifdef SD_LAZY
+	if (sd_url)
+		return lazy_io(block, buf, write);
+#endif
+#ifdef _WIN32
+	if (_fseeki64(sd_file, off, SEEK_SET))
+		return -1;
+#else
+	if (fseeko(sd_file, off, SEEK_SET))
+		return -1;
+#endif
+	if (write)
+		return fwrite(buf, 1, n, sd_file) == n ? 0 : -1;
+	if (fread(buf, 1, n, sd_file) != n)
+		return -1;
+	memset((uint8_t *)buf + n, 0, SD_BLOCK_SIZE - n);
+	return 0;
+}
+
+static void lru_unlink(int i)
+{
+	sd_cache_block *b = &sd_cache[i];
+
+	if (b->prev >= 0)
+		sd_cache[b->prev].next = b->next;
+	else
+		lru_head = b->next;
+	if (b->next >= 0)
+		sd_cache[b->next].prev = b->prev;
+	else
+		lru_tail = b->prev;
+}
+
+static void lru_push(int i)
+{
+	sd_cache[i].prev = -1;
+	sd_cache[i].next = lru_head;
+	if (lru_head >= 0)
+		sd_cache[lru_head].prev = i;
+	lru_head = i;
+	if (lru_tail < 0)
+		lru_tail = i;
+}
+
+static void hash_remove(int i)
+{
+	int *p = &sd_hash[sd_cache[i].block & (SD_HASH_SIZE - 1)];
+
+	while (*p != i)
+		p = &sd_cache[*p].hash_next;
+	*p = sd_cache[i].hash_next;
+}
+
+static void block_write_back(sd_cache_block *b)
+{
+	if (b->dirty && sd_file_io(b->block, b->data, true) < 0)
+		fprintf(stderr, "SD image: write of block %u failed\n", b->block);
+	b->dirty = false;
+}
+
+/* The cached copy of block, loading it over the least recent one */
+static sd_cache_block *cache_get(uint32_t block, bool whole)
+{
+	int i;
+
+	for (i = sd_hash[block & (SD_HASH_SIZE - 1)]; i >= 0; i = sd_cache[i].hash_next) {
+		if (sd_cache[i].block == block) {
+			metricAdd(METRIC_SD_CACHE_HITS, 1);
+			if (i != lru_head) {
+				lru_unlink(i);
+				lru_push(i);
+			}
+			return &sd_cache[i];
+		}
+	}
+
+	metricAdd(METRIC_SD_CACHE_MISSES, 1);
+	i = lru_tail;
+	if (sd_cache[i].valid) {
+		block_write_back(&sd_cache[i]);
+		hash_remove(i);
+	}
+	sd_cache[i].valid = false;
+	// A write covering the whole block needn't read it first
+	if (!whole && sd_file_io(block, sd_cache[i].data, false) < 0)
+		return NULL;
+	sd_cache[i].block = block;
+	sd_cache[i].valid = true;
+	sd_cache[i].hash_next = sd_hash[block & (SD_HASH_SIZE - 1)];
+	sd_hash[block & (SD_HASH_SIZE - 1)] = i;
+	lru_unlink(i);
+	lru_push(i);
+	return &sd_cache[i];
+}
+
+static int cache_io(uint32_t lba, uint8_t *buf, uint32_t count, bool write)
+{
+	while (count) {
+		uint32_t first = lba % SD_BLOCK_SECTORS;
+		uint32_t n = SD_BLOCK_SECTORS - first;
+		sd_cache_block *b;
+
+		if (n > count)
+			n = count;
+		b = cache_get(lba / SD_BLOCK_SECTORS, write && n == SD_BLOCK_SECTORS);
+		if (!b)
+			return -1;
+		if (write) {
+			memcpy(b->data + first * SD_SECTOR_SIZE, buf, n * SD_SECTOR_SIZE);
+			b->dirty = true;
+		} else {
+			memcpy(buf, b->data + first * SD_SECTOR_SIZE, n * SD_SECTOR_SIZE);
+		}
+		lba += n;
+		buf += n * SD_SECTOR_SIZE;
+		count -= n;
+	}
+	return 0;
+}
+
+#endif /* SD_MMAP */
+
+static void sd_flush_tick(void *arg)
+{
+	if (sd_dirty)
+		sdImageFlush();
+#ifdef SD_LAZY
+	if (sd_fetched) {
+		sd_fetched = false;
+		wasm_sync_storage();
+	}
+#endif
+}
+
+int sdImageOpen(const char *path)
+{
+	uint64_t size;
+
+	if (sd_open)
+		sdImageClose();
+
+#ifdef SD_MMAP
+	struct stat st;
+
+	sd_fd = ov_on() ? -1 : open(path, O_RDWR);
+	if (sd_fd < 0) {
+		sd_fd = open(path, O_RDONLY);
+		sd_read_only = true;
+	}
+	if (sd_fd < 0 || fstat(sd_fd, &st) < 0 || st.st_size < SD_SECTOR_SIZE) {
+		fprintf(stderr, "SD image: can't open %s\n", path);
+		if (sd_fd >= 0)
+			close(sd_fd);
+		sd_fd = -1;
+		return -1;
+	}
+	size = st.st_size;
+	// An overlay's writes stay in the mapping's private copies
+	if (ov_on())
+		sd_map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, sd_fd, 0);
+	else
+		sd_map = mmap(NULL, size, sd_read_only ? PROT_READ : PROT_READ | PROT_WRITE,
+			      MAP_SHARED, sd_fd, 0);
+	if (sd_map == MAP_FAILED) {
+		fprintf(stderr, "SD image: can't map %s\n", path);
+		close(sd_fd);
+		sd_fd = -1;
+		sd_map = NULL;
+		return -1;
+	}
+	sd_map_len = size;
+	sd_dirty_lo = UINT32_MAX;
+	sd_dirty_hi = 0;
+	if (ov_on() && ov_open(size) < 0) {
+		ov_close();
+		munmap(sd_map, sd_map_len);
+		close(sd_fd);
+		sd_fd = -1;
+		sd_map = NULL;
+		return -1;
+	}
+	// What the delta file has over the image
+	for (uint32_t b = 0; ov_file && b < ov_blocks; b++) {
+		uint64_t off = (uint64_t)b * SD_BLOCK_SIZE;
+		size_t n = size - off < SD_BLOCK_SIZE ? (size_t)(size - off) : SD_BLOCK_SIZE;
+
+		if (ov_has(b) && ov_file_io(off, sd_map + off, n, false) < 0)
+			fprintf(stderr, "SD image: read of overlay block %u failed\n", b);
+	}
+	sd_read_only = sd_read_only && !ov_on();
+#else
+#ifdef SD_LAZY
+	if (!strncmp(path, "http://", 7) || !strncmp(path, "https://", 8)) {
+		if (lazy_open(path, &size) < 0)
+			return -1;
+	} else
+#endif
+	{
+		sd_file = ov_on() ? NULL : fopen(path, "r+b");
+		if (!sd_file) {
+			sd_file = fopen(path, "rb");
+			sd_read_only = true;
+		}
+		if (!sd_file) {
+			fprintf(stderr, "SD image: can't open %s\n", path);
+			return -1;
+		}
+#ifdef _WIN32
+		_fseeki64(sd_file, 0, SEEK_END);
+		size = _ftelli64(sd_file);
+#else
+		fseeko(sd_file, 0, SEEK_END);
+		size = ftello(sd_file);
+#endif
+	}
+	if (!sd_cache_data)
+		sd_cache_data = malloc((size_t)SD_CACHE_BLOCKS * SD_BLOCK_SIZE);
+	if (!sd_cache_data || size < SD_SECTOR_SIZE || (ov_on() && ov_open(size) < 0)) {
+		fprintf(stderr, "SD image: can't open %s\n", path);
+		ov_close();
+#ifdef SD_LAZY
+		if (sd_url)
+			lazy_close();
+#endif
+		if (sd_file)
+			fclose(sd_file);
+		sd_file = NULL;
+		return -1;
+	}
+	memset(sd_hash, -1, sizeof(sd_hash));
+	lru_head = lru_tail = -1;
+	for (int i = 0; i < SD_CACHE_BLOCKS; i++) {
+		sd_cache[i].valid = false;
+		sd_cache[i].dirty = false;
+		sd_cache[i].data = sd_cache_data + (size_t)i * SD_BLOCK_SIZE;
+		lru_push(i);
+	}
+	sd_read_only = sd_read_only && !ov_on();
+#endif
+
+	sd_sectors = size / SD_SECTOR_SIZE;
+	sd_open = true;
+	sd_dirty = false;
+
+	if (!sd_read_only) {
+		static bool registered;
+
+		schedInit(&sd_flush_event, "sd_image", sd_flush_tick, NULL);
+		schedEvery(&sd_flush_event, SD_FLUSH_INSNS);
+		if (!registered)
+			atexit(sdImageClose);
+		registered = true;
+	}
+	return 0;
+}
+
+bool sdImageIsOpen(void)
+{
+	return sd_open;
+}
+
+uint32_t sdImageSectors(void)
+{
+	return sd_sectors;
+}
+
+int sdImageRead(uint32_t lba, void *buf, uint32_t count)
+{
+	if (!sd_open || lba >= sd_sectors || count > sd_sectors - lba)
+		return -1;
+	startupMark(STARTUP_FIRST_SD_READ);
+	metricAdd(METRIC_SD_SECTORS_READ, count);
+#ifdef SD_MMAP
+	memcpy(buf, sd_map + (uint64_t)lba * SD_SECTOR_SIZE, (size_t)count * SD_SECTOR_SIZE);
+	return 0;
+#else
+	return cache_io(lba, buf, count, false);
+#endif
+}
+
+int sdImageWrite(uint32_t lba, const void *buf, uint32_t count)
+{
+	if (!sd_open || sd_read_only || lba >= sd_sectors || count > sd_sectors - lba)
+		return -1;
+	sd_dirty = true;
+	metricAdd(METRIC_SD_SECTORS_WRITTEN, count);
+#ifdef SD_MMAP
+	memcpy(sd_map + (uint64_t)lba * SD_SECTOR_SIZE, buf, (size_t)count * SD_SECTOR_SIZE);
+	if (ov_file) {
+		for (uint32_t b = lba / SD_BLOCK_SECTORS; b <= (lba + count - 1) / SD_BLOCK_SECTORS; b++)
+			ov_set(ov_dirty, b);
+	}
+	if (lba < sd_dirty_lo)
+		sd_dirty_lo = lba;
+	if (lba + count > sd_dirty_hi)
+		sd_dirty_hi = lba + count;
+	return 0;
+#else
+	return cache_io(lba, (uint8_t *)buf, count, true);
+#endif
+}
+
+void sdImageFlush(void)
+{
+	if (!sd_open || !sd_dirty)
+		return;
+#ifdef SD_MMAP
+	if (ov_file) {
+		// Blocks written since last time, then the map
+		for (uint32_t b = 0; b < ov_blocks; b++) {
+			uint64_t off = (uint64_t)b * SD_BLOCK_SIZE;
+			size_t n = sd_map_len - off < SD_BLOCK_SIZE ? (size_t)(sd_map_len - off) : SD_BLOCK_SIZE;
+
+			if (!ov_dirty[b >> 3]) {
+				b |= 7;
+				continue;
+			}
+			if (!(ov_dirty[b >> 3] & (1 << (b & 7))))
+				continue;
+			ov_set(ov_bits, b);
+			if (ov_file_io(off, sd_map + off, n, true) < 0)
+				fprintf(stderr, "SD image: write of overlay block %u failed\n", b);
+		}
+		memset(ov_dirty, 0, (ov_blocks + 7) / 8);
+		ov_write_map();
+	} else if (!ov_mem) {
+		// msync wants a page aligned start
+		uint64_t page = sysconf(_SC_PAGESIZE);
+		uint64_t lo = (uint64_t)sd_dirty_lo * SD_SECTOR_SIZE / page * page;
+		uint64_t hi = (uint64_t)sd_dirty_hi * SD_SECTOR_SIZE;
+
+		if (msync(sd_map + lo, hi - lo, MS_ASYNC) < 0)
+			perror("SD image: msync");
+		sd_dirty_lo = UINT32_MAX;
+		sd_dirty_hi = 0;
+	}
+#else
+	for (int i = 0; i < SD_CACHE_BLOCKS; i++) {
+		if (sd_cache[i].valid)
+			block_write_back(&sd_cache[i]);
+	}
+	if (ov_file) {
+		ov_write_map();
+	} else if (ov_mem) {
+		// Nothing leaves memory
+	}
+#ifdef SD_LAZY
+	else if (sd_url) {
+		pthread_mutex_lock(&sd_chunk_lock);
+		if (sd_chunk_file)
+			fflush(sd_chunk_file);
+		pthread_mutex_unlock(&sd_chunk_lock);
+		sd_fetched = false;
+		wasm_sync_storage();
+	}
+#endif
+	else {
+		fflush(sd_file);
+	}
+#endif
+	sd_dirty = false;
+}
+
+void sdImageClose(void)
+{
+	if (!sd_open)
+		return;
+	sdImageFlush();
+	schedCancel(&sd_flush_event);
+#ifdef SD_MMAP
+	munmap(sd_map, sd_map_len);
+	close(sd_fd);
+	sd_map = NULL;
+	sd_fd = -1;
+#else
+#ifdef SD_LAZY
+	if (sd_url)
+		lazy_close();
+	else
+#endif
+		fclose(sd_file);
+	sd_file = NULL;
+#endif
+	ov_close();
+	sd_open = false;
+	sd_read_only = false;
+}
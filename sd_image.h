@@ -0,0 +1,40 @@
+/*
+ * sd_image.h
+ *
+ * Sector access to the SD card image.  The image is memory mapped where
+ * the host allows it, otherwise read through an LRU block cache; either
+ * way sector transfers are memcpy and writes reach the file on a timer
+ * and at exit, or an overlay that leaves the image untouched.
+ */
+
+#ifndef SD_IMAGE_H
+#define SD_IMAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SD_SECTOR_SIZE	512
+
+/* Before sdImageOpen: keep the image as it is, with writes in memory
+   ("mem") or in the delta file overlay, removed at exit with discard;
+   NULL or "" for none */
+void sdImageSetOverlay(const char *overlay, bool discard);
+
+/* Open the image; 0 on success */
+int sdImageOpen(const char *path);
+
+bool sdImageIsOpen(void);
+
+/* Image size in sectors */
+uint32_t sdImageSectors(void);
+
+/* Copy count sectors from lba on; 0 on success, -1 past the end */
+int sdImageRead(uint32_t lba, void *buf, uint32_t count);
+int sdImageWrite(uint32_t lba, const void *buf, uint32_t count);
+
+/* Push written sectors out to the file */
+void sdImageFlush(void);
+
+void sdImageClose(void);
+
+#endif /* SD_IMAGE_H */
@@ -0,0 +1,233 @@
+/*
+ * semihost.c
+ *
+ * Semihosting registers, see semihost.h.  Guest handles index a small
+ * table of host file descriptors; 1 and 2 are the host's own.
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memaccess.h"
+#include "savestate.h"
+#include "semihost.h"
+
+#ifndef O_BINARY
+#define O_BINARY	0
+#endif
+
+#define SH_FILES	16	/* guest handles 3 up */
+#define SH_PATH_MAX	256
+#define SH_FAIL		0xffffffffu
+
+static char *root;
+static int files[SH_FILES];
+static uint16_t sh_fd;
+static uint16_t sh_addr_hi, sh_addr_lo;
+static uint16_t sh_len_hi, sh_len_lo;
+static uint32_t sh_result = SH_FAIL;
+
+void semihost_init(const char *dir)
+{
+	int i;
+
+	free(root);
+	root = dir && *dir ? strdup(dir) : NULL;
+	for (i = 0; i < SH_FILES; i++)
+		files[i] = -1;
+	if (root)
+		printf("Semihosting: guest files in %s\n", root);
+}
+
+static int host_fd(unsigned fd)
+{
+	if (fd == 1 || fd == 2)
+		return fd;
+	if (fd >= 3 && fd < 3 + SH_FILES)
+		return files[fd - 3];
+	return -1;
+}
+
+/* Relative, without ".." and no longer than fits */
+static bool path_ok(const char *p)
+{
+	const char *c;
+
+	if (!*p || *p == '/' || *p == '\\' || strchr(p, ':'))
+		return false;
+	for (c = p; *c; c++) {
+		if (c[0] == '.' && c[1] == '.' && (c == p || c[-1] == '/' || c[-1] == '\\') &&
+		    (c[2] == 0 || c[2] == '/' || c[2] == '\\'))
+			return false;
+	}
+	return true;
+}
+
+static uint32_t sh_open(uint32_t addr, uint32_t mode)
+{
+	static const int flags[] = {
+		O_RDONLY,
+		O_WRONLY | O_CREAT | O_TRUNC,
+		O_WRONLY | O_CREAT | O_APPEND,
+	};
+	char path[SH_PATH_MAX], full[2 * SH_PATH_MAX];
+	int i, n, fd;
+
+	for (n = 0; n < SH_PATH_MAX; n++) {
+		const char *p = MemoryHostRange(addr + n, 1, 0);
+
+		if (!p)
+			return SH_FAIL;
+		path[n] = *p;
+		if (!*p)
+			break;
+	}
+	if (n == SH_PATH_MAX || mode > 2 || !path_ok(path))
+		return SH_FAIL;
+	for (i = 0; i < SH_FILES && files[i] >= 0; i++)
+		;
+	if (i == SH_FILES)
+		return SH_FAIL;
+
+	snprintf(full, sizeof(full), "%s/%s", root, path);
+	fd = open(full, flags[mode] | O_BINARY, 0644);
+	if (fd < 0)
+		return SH_FAIL;
+	files[i] = fd;
+	return i + 3;
+}
+
+static uint32_t sh_close(unsigned fd)
+{
+	if (fd < 3 || fd >= 3 + SH_FILES || files[fd - 3] < 0)
+		return SH_FAIL;
+	close(files[fd - 3]);
+	files[fd - 3] = -1;
+	return 0;
+}
+
+static uint32_t sh_transfer(unsigned fd, uint32_t addr, uint32_t len, bool to_guest)
+{
+	int hfd = host_fd(fd);
+	void *p;
+	ssize_t n;
+
+	if (hfd < 0 || (to_guest && hfd < 3))
+		return SH_FAIL;
+	if (!len)
+		return 0;
+	p = MemoryHostRange(addr, len, to_guest);
+	if (!p)
+		return SH_FAIL;
+	if (to_guest) {
+		n = read(hfd, p, len);
+		if (n > 0)
+			MemoryDMAWritten(addr, n);
+	} else {
+		n = write(hfd, p, len);
+	}
+	return n < 0 ? SH_FAIL : (uint32_t)n;
+}
+
+static void command(uint16_t cmd)
+{
+	uint32_t addr = (uint32_t)sh_addr_hi << 16 | sh_addr_lo;
+	uint32_t len = (uint32_t)sh_len_hi << 16 | sh_len_lo;
+
+	switch (cmd) {
+	case SEMIHOST_CMD_WRITE:
+		sh_result = sh_transfer(sh_fd, addr, len, false);
+		break;
+	case SEMIHOST_CMD_OPEN:
+		sh_result = sh_open(addr, len);
+		break;
+	case SEMIHOST_CMD_READ:
+		sh_result = sh_transfer(sh_fd, addr, len, true);
+		break;
+	case SEMIHOST_CMD_CLOSE:
+		sh_result = sh_close(sh_fd);
+		break;
+	default:
+		sh_result = SH_FAIL;
+		break;
+	}
+}
+
+uint16_t semihost_read(unsigned reg)
+{
+	if (!root)
+		return 0;
+
+	switch (reg) {
+	case SEMIHOST_REG_ID:
+		return SEMIHOST_ID;
+	case SEMIHOST_REG_FD:
+		return sh_fd;
+	case SEMIHOST_REG_ADDR_HI:
+		return sh_addr_hi;
+	case SEMIHOST_REG_ADDR_LO:
+		return sh_addr_lo;
+	case SEMIHOST_REG_LEN_HI:
+		return sh_len_hi;
+	case SEMIHOST_REG_LEN_LO:
+		return sh_len_lo;
+	case SEMIHOST_REG_RESULT_HI:
+		return sh_result >> 16;
+	case SEMIHOST_REG_RESULT_LO:
+		return sh_result & 0xffff;
+	}
+	return 0;
+}
+
+void semihost_write(unsigned reg, uint16_t d)
+{
+	if (!root)
+		return;
+
+	switch (reg) {
+	case SEMIHOST_REG_CMD:
+		command(d);
+		break;
+	case SEMIHOST_REG_FD:
+		sh_fd = d;
+		break;
+	case SEMIHOST_REG_ADDR_HI:
+		sh_addr_hi = d;
+		break;
+	case SEMIHOST_REG_ADDR_LO:
+		sh_addr_lo = d;
+		break;
+	case SEMIHOST_REG_LEN_HI:
+		sh_len_hi = d;
+		break;
+	case SEMIHOST_REG_LEN_LO:
+		sh_len_lo = d;
+		break;
+	}
+}
+
+void semihost_save_state(ss_buf *b)
+{
+	ssPut16(b, sh_fd);
+	ssPut16(b, sh_addr_hi);
+	ssPut16(b, sh_addr_lo);
+	ssPut16(b, sh_len_hi);
+	ssPut16(b, sh_len_lo);
+	ssPut32(b, sh_result);
+}
+
+int semihost_load_state(ss_buf *b)
+{
+	sh_fd = ssGet16(b);
+	sh_addr_hi = ssGet16(b);
+	sh_addr_lo = ssGet16(b);
+	sh_len_hi = ssGet16(b);
+	sh_len_lo = ssGet16(b);
+	sh_result = ssGet32(b);
+	return b->error ? -1 : 0;
+}
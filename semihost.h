@@ -0,0 +1,66 @@
+/*
+ * semihost.h
+ *
+ * Emulator-only semihosting registers (--semihost <dir>).  The guest
+ * fills in the arguments and writes CMD; the host does the whole request
+ * with one system call before the write returns, so debug output costs
+ * no UART bit timing and test data needs no SD card image.  ID reads 0
+ * when disabled.
+ *
+ * Handles 1 and 2 are stdout and stderr.  OPEN takes the NUL terminated
+ * path at ADDR, relative to <dir> and without "..", and LEN as the mode:
+ * 0 read, 1 write (created or truncated), 2 append.  Guest buffers must
+ * be plain RAM.
+ *
+ * All registers are 16 bits, big endian:
+ *   +0x00 ID         'SH' (0x5348) when enabled
+ *   +0x02 CMD        write: 1 WRITE, 2 OPEN, 3 READ, 4 CLOSE
+ *   +0x04 FD         handle for WRITE, READ and CLOSE
+ *   +0x06 ADDR_HI    guest buffer, or path for OPEN
+ *   +0x08 ADDR_LO
+ *   +0x0a LEN_HI     bytes, or mode for OPEN
+ *   +0x0c LEN_LO
+ *   +0x0e RESULT_HI  bytes moved, the handle OPEN gives, 0 for CLOSE;
+ *   +0x10 RESULT_LO  0xffffffff on failure
+ */
+
+#ifndef SEMIHOST_H
+#define SEMIHOST_H
+
+#include <stdint.h>
+
+#ifndef _SEMIHOST_BASE
+#define _SEMIHOST_BASE		0x8f0030
+#endif
+#define _SEMIHOST_SIZE		0x20
+
+#define SEMIHOST_ID		0x5348
+#define SEMIHOST_CMD_WRITE	1
+#define SEMIHOST_CMD_OPEN	2
+#define SEMIHOST_CMD_READ	3
+#define SEMIHOST_CMD_CLOSE	4
+
+#define SEMIHOST_REG_ID		0x00
+#define SEMIHOST_REG_CMD	0x02
+#define SEMIHOST_REG_FD		0x04
+#define SEMIHOST_REG_ADDR_HI	0x06
+#define SEMIHOST_REG_ADDR_LO	0x08
+#define SEMIHOST_REG_LEN_HI	0x0a
+#define SEMIHOST_REG_LEN_LO	0x0c
+#define SEMIHOST_REG_RESULT_HI	0x0e
+#define SEMIHOST_REG_RESULT_LO	0x10
+
+struct ss_buf;
+
+/* Option: directory guest paths are in, NULL or "" for disabled */
+void semihost_init(const char *dir);
+
+/* Word access to the register at offset reg */
+uint16_t semihost_read(unsigned reg);
+void semihost_write(unsigned reg, uint16_t d);
+
+/* Save state: the registers, not the host files open */
+void semihost_save_state(struct ss_buf *b);
+int semihost_load_state(struct ss_buf *b);
+
+#endif /* SEMIHOST_H */
@@ -13,12 +13,19 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "async_io.h"
 #include "emulator_options.h"
+#include "memaccess.h"
+#include "sqlux_bdi.h"
 
 static int bdi_files[8];
 static uint32_t bdi_address;
 static int bdi_ctr;
 static int bdi_unit;
+static uint32_t bdi_dma_addr;
+static uint16_t bdi_dma_count;
+static uint8_t bdi_dma_error;
+static int bdi_dirty;
 uint8_t bdi_buffer[512];
 
 #ifdef DEBUG
@@ -29,6 +36,63 @@ uint8_t bdi_buffer[512];
 	} while (0)
 #endif
 
+/*
+ * Writes land in the background (see async_io.h) and reach the disk
+ * here, or in the background after every one with bdi_fsync.  A write
+ * that failed on the way shows as a DMA error from here.
+ */
+static void bdi_sync(void)
+{
+	int fd = bdi_files[bdi_unit - 1];
+
+	if (fd && (bdi_dirty ? asyncIoSync(fd, true) : asyncIoFlush(fd)) < 0)
+		bdi_dma_error = 1;
+	bdi_dirty = 0;
+}
+
+static void bdi_written(void)
+{
+	bdi_dirty = 1;
+	if (emulatorOptionFlag("bdi_fsync") &&
+	    asyncIoSync(bdi_files[bdi_unit - 1], false) < 0)
+		bdi_dma_error = 1;
+}
+
+/* Move bdi_dma_count blocks from bdi_address to or from guest memory;
+   a read starts reading the same again after it */
+static void bdi_dma(int write)
+{
+	int fd = bdi_files[bdi_unit - 1];
+	size_t len = (size_t)bdi_dma_count * 512;
+	int64_t off = (int64_t)bdi_address * 512;
+	void *p = MemoryHostRange(bdi_dma_addr, len, !write);
+	long res;
+
+	bdi_dma_error = 0;
+	if (!fd || !p) {
+		printf("BDI: DMA of %u blocks at 0x%x rejected\n", bdi_dma_count,
+		       bdi_dma_addr);
+		bdi_dma_error = 1;
+		return;
+	}
+	if (write) {
+		res = asyncIoWrite(fd, p, len, off);
+		bdi_written();
+	} else {
+		res = asyncIoRead(fd, p, len, off);
+		// Past the end of the file reads as zeroes
+		if (res >= 0 && (size_t)res < len)
+			memset((uint8_t *)p + res, 0, len - res);
+		else if (res >= 0)
+			asyncIoReadAhead(fd, len, off + len);
+		MemoryDMAWritten(bdi_dma_addr, len);
+	}
+	if (res < 0) {
+		perror(write ? "BDI DMA Write" : "BDI DMA Read");
+		bdi_dma_error = 1;
+	}
+}
+
 void SQLUXBDISelect(uint8_t d)
 {
 	int bdi_file;
@@ -49,6 +113,8 @@ void SQLUXBDISelect(uint8_t d)
 	}
 
 	if (d == 0) {
+		bdi_sync();
+		asyncIoForget(bdi_files[bdi_unit - 1]);
 		close(bdi_files[bdi_unit - 1]);
 		bdi_files[bdi_unit - 1] = 0;
 	}
@@ -69,6 +135,18 @@ void SQLUXBDICommand(uint8_t command)
 		bdi_debug("BDI: Write Command\n");
 		bdi_ctr = 0;
 		break;
+	case BDI_CMD_DMA_READ:
+		bdi_debug("BDI: DMA Read Command\n");
+		bdi_dma(0);
+		break;
+	case BDI_CMD_DMA_WRITE:
+		bdi_debug("BDI: DMA Write Command\n");
+		bdi_dma(1);
+		break;
+	case BDI_CMD_SYNC:
+		bdi_debug("BDI: Sync Command\n");
+		bdi_sync();
+		break;
 	default:
 		bdi_debug("BDI: Uknown Command 0x%2x\n", command);
 	}
@@ -81,7 +159,7 @@ uint8_t SQLUXBDIStatus()
 		return 1;
 	}
 
-	return 0;
+	return bdi_dma_error ? BDI_STATUS_DMA_ERROR : 0;
 }
 
 uint8_t SQLUXBDIDataRead()
@@ -93,9 +171,9 @@ uint8_t SQLUXBDIDataRead()
 		return 0;
 	}
 	if (bdi_ctr == 0) {
-		bdi_debug("BDI: seeking to 0x%8x\n", bdi_address * 512);
-		lseek(bdi_files[bdi_unit - 1], bdi_address * 512, SEEK_SET);
-		res = read(bdi_files[bdi_unit - 1], bdi_buffer, 512);
+		bdi_debug("BDI: reading at 0x%8x\n", bdi_address * 512);
+		res = asyncIoRead(bdi_files[bdi_unit - 1], bdi_buffer, 512,
+				  (int64_t)bdi_address * 512);
 		if (res < 0)
 			perror("BDI Read\n");
 	}
@@ -116,23 +194,18 @@ void SQLUXBDIDataWrite(uint8_t d)
 		bdi_debug("BDI: ERROR File Not Open\n");
 		return;
 	}
-	if (bdi_ctr == 0) {
-		bdi_debug("BDI: seeking to 0x%8x\n", bdi_address * 512);
-		lseek(bdi_files[bdi_unit - 1], bdi_address * 512, SEEK_SET);
-	}
-
-	printf("BDI: Write %d\n", bdi_ctr);
+	bdi_debug("BDI: Write %d\n", bdi_ctr);
 
 	if (bdi_ctr < 512)
 		bdi_buffer[bdi_ctr++] = d;
 
 	if (bdi_ctr == 512) {
-		 res = write(bdi_files[bdi_unit - 1], bdi_buffer, 512);
-		 if (res < 0 )
-			 perror("BDI Write\n");
-#ifndef __WIN32__
-		fsync(bdi_files[bdi_unit - 1]);
-#endif
+		bdi_debug("BDI: writing at 0x%8x\n", bdi_address * 512);
+		res = asyncIoWrite(bdi_files[bdi_unit - 1], bdi_buffer, 512,
+				   (int64_t)bdi_address * 512);
+		if (res < 0)
+			perror("BDI Write\n");
+		bdi_written();
 	}
 }
 
@@ -148,6 +221,21 @@ void SQLUXBDIAddressLow(uint16_t bdi_addr)
 	bdi_address = (bdi_address & 0xFFFF0000) | ((uint32_t)bdi_addr);
 }
 
+void SQLUXBDIDMAAddressHigh(uint16_t addr)
+{
+	bdi_dma_addr = (bdi_dma_addr & 0x0000FFFF) | ((uint32_t)addr << 16);
+}
+
+void SQLUXBDIDMAAddressLow(uint16_t addr)
+{
+	bdi_dma_addr = (bdi_dma_addr & 0xFFFF0000) | addr;
+}
+
+void SQLUXBDIDMACount(uint16_t count)
+{
+	bdi_dma_count = count;
+}
+
 uint16_t SQLUXBDISizeHigh()
 {
 	struct stat bdi_stat;
@@ -159,6 +247,7 @@ uint16_t SQLUXBDISizeHigh()
 
 	bdi_debug("BDI: SizeHigh\n");
 
+	asyncIoFlush(bdi_files[bdi_unit - 1]);
 	fstat(bdi_files[bdi_unit - 1], &bdi_stat);
 
 	return (uint16_t)(bdi_stat.st_size / 512) >> 16;
@@ -175,6 +264,7 @@ uint16_t SQLUXBDISizeLow()
 
 	bdi_debug("BDI: SizeLow\n");
 
+	asyncIoFlush(bdi_files[bdi_unit - 1]);
 	fstat(bdi_files[bdi_unit - 1], &bdi_stat);
 
 	return (uint16_t)(bdi_stat.st_size / 512) & 0xFFFF;
@@ -10,6 +10,17 @@
 
 #include <stdint.h>
 
+/*
+ * Block DMA: set the block address, the guest memory pointer (0x1810C
+ * high, 0x1810E low) and the block count (0x18110), then issue a DMA
+ * command.  The transfer is done when the command write returns.
+ */
+#define BDI_CMD_DMA_READ	4
+#define BDI_CMD_DMA_WRITE	5
+#define BDI_CMD_SYNC		6	/* fsync the writes so far */
+
+#define BDI_STATUS_DMA_ERROR	2
+
 void SQLUXBDISelect(uint8_t d);
 void SQLUXBDICommand(uint8_t command);
 uint8_t SQLUXBDIStatus();
@@ -17,6 +28,9 @@ uint8_t SQLUXBDIDataRead();
 void SQLUXBDIDataWrite(uint8_t d);
 void SQLUXBDIAddressHigh(uint16_t bdi_addr);
 void SQLUXBDIAddressLow(uint16_t bdi_addr);
+void SQLUXBDIDMAAddressHigh(uint16_t addr);
+void SQLUXBDIDMAAddressLow(uint16_t addr);
+void SQLUXBDIDMACount(uint16_t count);
 uint16_t SQLUXBDISizeHigh();
 uint16_t SQLUXBDISizeLow();
 #endif /* SQLUX_BDI_H */
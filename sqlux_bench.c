@@ -0,0 +1,1138 @@
+/*
+ * sqlux_bench.c
+ *
+ * CPU core micro-benchmarks.  Links the 68000 core and the nextp8 memory
+ * map without SDL, the display, sound or p8audio, assembles synthetic
+ * kernels into RAM and runs each one through ExecuteChunk for a fixed
+ * number of instructions.  Prints one JSON document: MIPS and ns per instruction
+ * for each kernel (ALU loop, memory copy, movem, branches, framebuffer
+ * MMIO writes, dbra, ALU over many opcode words), then for single
+ * opcodes, each repeated eight times in a loop closed by a bra.s.
+ *
+ * --check runs random programs instead, as a test of the fast paths:
+ * lazy flags, fused Bcc/DBcc, the DBRA copy and fill loops and movem to
+ * RAM against the plain interpreter, and the 68020 mull, divl and bit
+ * field handlers against models.  Exits non-zero on a mismatch.
+ * --jit, in JIT builds, runs both with translated blocks; the check then
+ * repeats each program until its code has been translated.
+ *
+ * Usage: sqlux_bench [--jit] [--insns N] [--kernel NAME]
+ *        sqlux_bench [--jit] --check [--cases N] [--seed N]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "QL68000.h"
+#include "QL.h"
+#include "QL_config.h"
+#include "cycles.h"
+#include "gdbstub.h"
+#include "general.h"
+#include "fuse.h"
+#include "memaccess.h"
+#ifdef JIT
+#include "jit.h"
+#endif
+
+#define BENCH_RAM	0x200000
+#define BENCH_SSP	0x8000
+#define BENCH_CODE	0x10000
+#define BENCH_SRC	0x20000
+#define BENCH_DST	0x28000
+#define BENCH_CHUNK	3000
+
+void InitialSetup(void);
+
+/* ---- What the core links against outside itself ---- */
+
+#include "QL_screen.h"
+#include "QL_sound.h"
+#include "SDL2screen.h"
+#include "logger.h"
+#include "metrics.h"
+#include "netplay.h"
+#include "savestate.h"
+#include "startup_timing.h"
+
+int verbose;
+int tracetrap;
+int funcval_mode;
+uint8_t patch_version;
+SDL_atomic_t doPoll;
+screen_specs qlscreen;
+
+uint8_t frameBuffer[2][8192];
+uint8_t frameLineDirty[2][128];
+uint8_t overlayBuffer[2][8192];
+uint8_t overlayLineDirty[2][128];
+uint8_t screenPalette[2][16];
+uint8_t secondaryPalette[2][16];
+uint8_t highColourBitfield[2][16];
+uint8_t high_colour_mode, overlay_control, screen_transform, screenRedrawAll;
+uint8_t vblank_intr_enable;
+int vfront, vfrontreq;
+
+SDL_atomic_t sdl_keyrow_latched[32], sdl_mouse_buttons_latched, joy_latched[2];
+static input_state input;
+
+int16_t da_memory[DA_SAMPLES];
+bool da_mono;
+uint16_t da_period;
+bool da_start;
+
+bool btrace_on, btrace_flight;
+bool metrics_enabled;
+uint64_t metric_values[METRIC_COUNT];
+uint64_t metric_hw_reads[METRIC_REGIONS], metric_hw_writes[METRIC_REGIONS];
+uw32 fork_pc = 0xffffffff;
+uw32 boot_snapshot_pc = 0xffffffff;
+
+int SDL_AtomicGet(SDL_atomic_t *a) { return a->value; }
+int SDL_AtomicSet(SDL_atomic_t *a, int v) { int o = a->value; a->value = v; return o; }
+SDL_bool SDL_AtomicCAS(SDL_atomic_t *a, int o, int n)
+{
+	if (a->value != o)
+		return SDL_FALSE;
+	a->value = n;
+	return SDL_TRUE;
+}
+void dosignal(void) {}
+const input_state *inputSnapshot(void) { return &input; }
+void inputLatchClear(SDL_atomic_t *latch, unsigned int bits) { latch->value &= ~bits; }
+void cleanup(int err) { exit(err); }
+void DbgInfo(void) {}
+void debug2(char *msg, long n) {}
+void prep_rtc_emu(void) {}
+void GetDateTime(int32_t *t) { *t = 0; }
+void trap0(void) {}
+void trap1(void) {}
+void trap2(void) {}
+void trap3(void) {}
+void idlePoll(uint32_t addr, uint32_t value, bool timer) {}
+uint64_t pacerEmuNs(void) { return 0; }
+uint64_t pacerNowNs(void) { return 0; }
+int emulatorOptionInt(const char *name) { return 0; }
+unsigned daReadAddress(void) { return 0; }
+
+void forkServerBreak(void) {}
+int gdb_breaks;
+bool gdbBreakAt(uw32 addr) { return false; }
+void gdbBreak(void) {}
+int hle_count;
+bool hleAt(uw32 addr) { return false; }
+void hleCall(void) {}
+void gdbWatchAccess(uw32 addr, int len, bool write) {}
+void forkServerPost(unsigned d) {}
+uint8_t *coverage_bits;
+bool fuzz_running;
+uint8_t *fuzz_map;
+uint32_t fuzz_prev;
+void fuzzPost(unsigned d) {}
+void fuzzException(int vector) {}
+void savestateBreak(void) {}
+void savestatePost(unsigned d) {}
+void startupPost(unsigned d) {}
+uint64_t startupNow(void) { return 0; }
+void startupAdd(enum startup_phase p, uint64_t since) {}
+void startupAddUs(enum startup_phase p, uint64_t us) {}
+bool netplay_on;
+uint8_t netplayJoy(int slot) { return 0; }
+uint8_t netplayJoyLatched(int slot) { return 0; }
+void netplayJoyLatchClear(int slot, uint8_t bits) {}
+uint8_t netplayKeyrow(int row) { return 0; }
+uint8_t netplayKeyrowLatched(int row) { return 0; }
+void netplayKeyrowLatchClear(int row, uint8_t bits) {}
+uint8_t log_levels[LOG_MODULES];
+void logWrite(log_site *site, int module, int level, const char *fmt, ...) {}
+void ssPut(ss_buf *b, const void *p, size_t n) {}
+void ssPut8(ss_buf *b, uint8_t v) {}
+void ssPut16(ss_buf *b, uint16_t v) {}
+void ssPut32(ss_buf *b, uint32_t v) {}
+void ssPut64(ss_buf *b, uint64_t v) {}
+void ssGet(ss_buf *b, void *p, size_t n) {}
+uint8_t ssGet8(ss_buf *b) { return 0; }
+uint16_t ssGet16(ss_buf *b) { return 0; }
+uint32_t ssGet32(ss_buf *b) { return 0; }
+uint64_t ssGet64(ss_buf *b) { return 0; }
+void btraceInsn(uint32_t old_pc, uint32_t new_pc, uint16_t opcode,
+		const uint32_t *old_reg) {}
+void btraceMem(int type, uint32_t addr, uint32_t data) {}
+void btracePost(unsigned d) {}
+void btracePublish(void) {}
+void btraceResetReq(void) {}
+void btraceTrigger(const char *why) {}
+void btraceVector(int vector) {}
+
+int funcval_is_testbench_addr(aw32 addr) { return 0; }
+rw8 funcval_read_byte(aw32 addr) { return 0xff; }
+rw16 funcval_read_word(aw32 addr) { return 0xffff; }
+rw32 funcval_read_long(aw32 addr) { return 0xffffffff; }
+void funcval_write_byte(aw32 addr, aw8 data) {}
+void funcval_write_word(aw32 addr, aw16 data) {}
+void funcval_write_long(aw32 addr, aw32 data) {}
+
+void i2c_rtc_write_data(uint8_t value) {}
+uint8_t i2c_rtc_read_data(void) { return 0xff; }
+void i2c_rtc_write_ctrl(uint8_t value) {}
+uint8_t i2c_rtc_read_status(void) { return 0; }
+uint16_t sd_dma_read(unsigned reg) { return 0; }
+void sd_dma_write(unsigned reg, uint16_t d) {}
+uint16_t perfctr_read(unsigned reg) { return 0; }
+void perfctr_write(unsigned reg, uint16_t d) {}
+uint16_t semihost_read(unsigned reg) { return 0; }
+void semihost_write(unsigned reg, uint16_t d) {}
+uint16_t blitter_read(unsigned reg) { return 0; }
+void blitter_write(unsigned reg, uint16_t d) {}
+uint16_t memdma_read(unsigned reg) { return 0; }
+void memdma_write(unsigned reg, uint16_t d) {}
+uint16_t fixmath_read(unsigned reg) { return 0; }
+void fixmath_write(unsigned reg, uint16_t d) {}
+uint16_t dastream_read(unsigned reg) { return 0; }
+void dastream_write(unsigned reg, uint16_t d) {}
+void dastream_sync(void) {}
+void dastream_changed(void) {}
+void p8audio_verilated_mmio_write(uint8_t byte_addr, uint16_t data,
+				  bool upper, bool lower) {}
+uint16_t p8audio_verilated_mmio_read(uint8_t byte_offset) { return 0; }
+
+/* ---- Kernel assembly ---- */
+
+static uw32 here;
+
+static void put16(uw16 w)
+{
+	WW((Ptr)memBase + here, w);
+	here += 2;
+}
+
+static void put32(uw32 l)
+{
+	put16(l >> 16);
+	put16(l);
+}
+
+/* bra.s back to target */
+static void bra(uw32 target)
+{
+	put16(0x6000 | ((target - (here + 2)) & 0xff));
+}
+
+/* dbra d0 back to target */
+static void dbra_d0(uw32 target)
+{
+	put16(0x51c8);
+	put16(target - here);
+}
+
+static void k_alu(void)
+{
+	uw32 loop = here;
+
+	put16(0xd081);	/* add.l d1,d0 */
+	put16(0x9682);	/* sub.l d2,d3 */
+	put16(0xca84);	/* and.l d4,d5 */
+	put16(0xbd87);	/* eor.l d6,d7 */
+	put16(0x8481);	/* or.l d1,d2 */
+	put16(0xe388);	/* lsl.l #1,d0 */
+	put16(0x5283);	/* addq.l #1,d3 */
+	bra(loop);
+}
+
+static void k_memcpy(void)
+{
+	uw32 outer = here, loop;
+
+	put16(0x41f9); put32(BENCH_SRC);	/* lea src,a0 */
+	put16(0x43f9); put32(BENCH_DST);	/* lea dst,a1 */
+	put16(0x303c); put16(255);		/* move.w #255,d0 */
+	loop = here;
+	put16(0x22d8);			/* move.l (a0)+,(a1)+ */
+	dbra_d0(loop);
+	bra(outer);
+}
+
+static void k_movem(void)
+{
+	uw32 loop;
+
+	put16(0x41f9); put32(BENCH_DST);	/* lea dst,a0 */
+	loop = here;
+	put16(0x48d0); put16(0x7eff);	/* movem.l d0-d7/a1-a6,(a0) */
+	put16(0x4cd0); put16(0x7eff);	/* movem.l (a0),d0-d7/a1-a6 */
+	bra(loop);
+}
+
+static void k_branch(void)
+{
+	uw32 loop = here;
+
+	put16(0x5282);			/* addq.l #1,d2 */
+	put16(0x0802); put16(0);		/* btst #0,d2 */
+	put16(0x6702);			/* beq.s over the addq */
+	put16(0x5283);			/* addq.l #1,d3 */
+	put16(0xb682);			/* cmp.l d2,d3 */
+	put16(0x6602);			/* bne.s +2 */
+	put16(0x4e71);			/* nop */
+	bra(loop);
+}
+
+static void k_mmio_fb(void)
+{
+	uw32 outer = here, loop;
+
+	put16(0x41f9); put32(_BACK_BUFFER_BASE);	/* lea back buffer,a0 */
+	put16(0x303c); put16(_FRAME_BUFFER_SIZE / 4 - 1);	/* move.w #n,d0 */
+	loop = here;
+	put16(0x20c1);			/* move.l d1,(a0)+ */
+	dbra_d0(loop);
+	bra(outer);
+}
+
+/* Register ALU ops and moves over 1024 distinct opcode words, so
+   dispatch reaches across the opcode table as real code does */
+static void k_spread(void)
+{
+	static const uw16 ops[] = {
+		0xd080, 0x9080, 0xc080, 0x8080, 0xb180, 0xb080, 0x2000, 0xd040,
+		0x9040, 0xc040, 0x8040, 0xb040, 0x3000, 0xd000, 0x9000, 0x1000
+	};
+	uw32 loop = here;
+	int i, r;
+
+	for (i = 0; i < 16; i++)
+		for (r = 0; r < 64; r++)
+			put16(ops[i] | (r & 7) << 9 | r >> 3);
+	put16(0x6000);			/* bra.w */
+	put16(loop - here);
+}
+
+static void k_dbra(void)
+{
+	uw32 outer = here, loop;
+
+	put16(0x303c); put16(0x7fff);	/* move.w #$7fff,d0 */
+	loop = here;
+	dbra_d0(loop);
+	bra(outer);
+}
+
+typedef struct {
+	const char *name;
+	void (*build)(void);
+} kernel;
+
+static const kernel kernels[] = {
+	{ "alu", k_alu },
+	{ "memcpy", k_memcpy },
+	{ "movem", k_movem },
+	{ "branch", k_branch },
+	{ "mmio_fb", k_mmio_fb },
+	{ "dbra", k_dbra },
+	{ "spread", k_spread },
+};
+
+/* One opcode eight times, then bra.s back */
+typedef struct {
+	const char *name;
+	uw16 words[3];
+	int n;
+} opcode;
+
+static const opcode opcodes[] = {
+	{ "nop", { 0x4e71 }, 1 },
+	{ "moveq #1,d0", { 0x7001 }, 1 },
+	{ "move.l d0,d1", { 0x2200 }, 1 },
+	{ "move.w (a0),d0", { 0x3010 }, 1 },
+	{ "move.l d0,(a0)", { 0x2080 }, 1 },
+	{ "move.l 4(a0),d0", { 0x2028, 0x0004 }, 2 },
+	{ "add.l d1,d0", { 0xd081 }, 1 },
+	{ "addq.l #1,d0", { 0x5280 }, 1 },
+	{ "cmp.l d1,d0", { 0xb081 }, 1 },
+	{ "tst.l d0", { 0x4a80 }, 1 },
+	{ "clr.l d0", { 0x4280 }, 1 },
+	{ "lsl.l #1,d0", { 0xe388 }, 1 },
+	{ "swap d0", { 0x4840 }, 1 },
+	{ "ext.l d0", { 0x48c0 }, 1 },
+	{ "lea 4(a0),a1", { 0x43e8, 0x0004 }, 2 },
+	{ "mulu.w d1,d0", { 0xc0c1 }, 1 },
+	{ "divu.w d1,d0", { 0x80c1 }, 1 },
+	{ "add.l #1,d0", { 0xd0bc, 0x0000, 0x0001 }, 3 },
+};
+
+#define NKERNELS	(sizeof(kernels) / sizeof(kernels[0]))
+#define NOPCODES	(sizeof(opcodes) / sizeof(opcodes[0]))
+
+static const opcode *cur_opcode;
+static bool failed;
+
+static void k_opcode(void)
+{
+	uw32 loop = here;
+	int i, j;
+
+	for (i = 0; i < 8; i++)
+		for (j = 0; j < cur_opcode->n; j++)
+			put16(cur_opcode->words[j]);
+	bra(loop);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Builds the kernel at BENCH_CODE, resets into it and times insns instructions */
+static double run(const char *name, void (*build)(void), long insns)
+{
+	uint64_t start, ns;
+	long left;
+	uw32 at;
+	int i;
+
+	memset(memBase, 0, BENCH_RAM);
+	here = BENCH_CODE;
+	build();
+	WL(&memBase[0], BENCH_SSP);
+	WL(&memBase[1], BENCH_CODE);
+	InitialSetup();
+	for (i = 0; i < 8; i++)
+		reg[i] = i + 1;
+	for (i = 0; i < 7; i++)
+		aReg[i] = BENCH_SRC + 0x100 * i;
+
+	start = now_ns();
+	for (left = insns; left > 0; left -= BENCH_CHUNK)
+		ExecuteChunk(left < BENCH_CHUNK ? left : BENCH_CHUNK);
+	ns = now_ns() - start;
+
+	// An exception would have taken it out of the loop
+	at = (Ptr)pc - (Ptr)memBase;
+	if (at < BENCH_CODE || at >= here) {
+		fprintf(stderr, "sqlux_bench: %s left its loop, pc=0x%x\n", name, at);
+		failed = true;
+	}
+	return (double)ns / insns;
+}
+
+static void print_result(const char *name, double ns, bool last)
+{
+	printf("    {\"name\":\"%s\",\"mips\":%.2f,\"ns_per_insn\":%.3f}%s\n",
+	       name, 1000.0 / ns, ns, last ? "" : ",");
+}
+
+/* ---- --check: the fast paths against the plain interpreter ---- */
+
+/*
+ * Random programs run twice from the same state.  The first run is the
+ * way the emulator runs them.  The second runs one instruction per chunk
+ * with the flags made eager after each (GetSR() evaluates the pending
+ * C/V/X), without fusion, and with every RAM page watched so that movem
+ * and the DBRA loops go element by element.  Registers, SR, pc, cycles,
+ * the stack and the scratch RAM must come out the same.  The 68020 mull,
+ * divl and bit field handlers are checked against models of their own,
+ * as nothing else in the core computes them.
+ */
+
+#define CHECK_SSP	0xf000		/* above the write protected 32K */
+#define CHECK_STACK	0xe000		/* compared up to BENCH_CODE */
+#define CHECK_END	0x30000		/* scratch compared from BENCH_SRC */
+#define CHECK_SCRATCH	(CHECK_END - BENCH_SRC)
+#define CHECK_STEPS	4000000
+#define CHECK_COUNT	0xd000		/* --jit: word counting the repeats */
+
+typedef struct {
+	w32 reg[16];
+	uw32 pc;
+	uw16 sr;
+	uint64_t cycles;
+} check_state;
+
+static uint64_t rng;
+static bool check_jit;
+static uint8_t check_ram[BENCH_CODE];
+static uint8_t check_mem[2][CHECK_SCRATCH];
+static uint8_t check_stack[2][BENCH_CODE - CHECK_STACK];
+
+static uw32 rnd(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return rng >> 32;
+}
+
+static uw32 rnd_n(uw32 n)
+{
+	return rnd() % n;
+}
+
+/* Register values, with the ones at the flag edges often */
+static w32 rnd_val(void)
+{
+	static const uw32 edges[] = {
+		0, 1, 0xffffffff, 0x7f, 0x80, 0xff, 0x7fff, 0x8000, 0xffff,
+		0x7fffffff, 0x80000000, 0x00010000, 0xffff8000, 0xffffff80
+	};
+
+	if (rnd_n(3) == 0)
+		return edges[rnd_n(sizeof(edges) / sizeof(edges[0]))];
+	return rnd_n(2) ? (w32)rnd() : (w32)rnd_n(512) - 256;
+}
+
+/* Sizes of move.x as bits 13-12, and in bytes */
+static const uw16 move_bits[3] = { 0x1000, 0x3000, 0x2000 };
+static const unsigned move_bytes[3] = { 1, 2, 4 };
+
+/* One word that works only on d0-d5 */
+static uw16 gen_alu(void)
+{
+	unsigned s = rnd_n(3), n = rnd_n(6), m = rnd_n(6);
+
+	switch (rnd_n(25)) {
+	case 0:  return 0xd000 | m << 9 | s << 6 | n;		/* add.x dn,dm */
+	case 1:  return 0x9000 | m << 9 | s << 6 | n;		/* sub */
+	case 2:  return 0xb000 | m << 9 | s << 6 | n;		/* cmp */
+	case 3:  return 0x5000 | rnd_n(8) << 9 | s << 6 | n;	/* addq */
+	case 4:  return 0x5100 | rnd_n(8) << 9 | s << 6 | n;	/* subq */
+	case 5:  return 0xd100 | m << 9 | s << 6 | n;		/* addx */
+	case 6:  return 0x9100 | m << 9 | s << 6 | n;		/* subx */
+	case 7:  return 0x4000 | s << 6 | n;			/* negx */
+	case 8:  return 0x4400 | s << 6 | n;			/* neg */
+	case 9:  return 0xe010 | rnd_n(8) << 9 | rnd_n(2) << 8 | s << 6 | n;	/* roxl/roxr #k */
+	case 10: return 0xe000 | rnd_n(8) << 9 | rnd_n(2) << 8 | s << 6 |
+			rnd_n(4) << 3 | n;			/* shifts, rotates #k */
+	case 11: return 0xe020 | m << 9 | rnd_n(2) << 8 | s << 6 |
+			rnd_n(4) << 3 | n;			/* by dm */
+	case 12: return 0x50c0 | rnd_n(16) << 8 | n;		/* scc */
+	case 13: return 0x40c0 | n;				/* move sr,dn */
+	case 14: return 0x44c0 | n;				/* move dn,ccr */
+	case 15: return 0x4a00 | s << 6 | n;			/* tst */
+	case 16: return 0x7000 | m << 9 | (rnd() & 0xff);	/* moveq */
+	case 17: return 0xc000 | m << 9 | s << 6 | n;		/* and */
+	case 18: return 0xb100 | n << 9 | s << 6 | m;		/* eor */
+	case 19: return 0xb1c0 | (4 + rnd_n(3)) << 9 | n;	/* cmpa.l dn,an */
+	case 20: return (rnd_n(2) ? 0xc100 : 0x8100) | m << 9 | n;	/* abcd, sbcd */
+	case 21: return move_bits[s] | m << 9 | n;		/* move.x dn,dm */
+	case 22: return 0x4200 | s << 6 | n;			/* clr */
+	case 23: return 0x4600 | s << 6 | n;			/* not */
+	default: return 0x4800 | n;				/* nbcd */
+	}
+}
+
+/* #imm,dn forms of addi, subi, cmpi, ori, andi and eori */
+static void gen_imm(void)
+{
+	static const uw16 ops[] = { 0x0600, 0x0400, 0x0c00, 0x0000, 0x0200, 0x0a00 };
+	unsigned s = rnd_n(3);
+
+	put16(ops[rnd_n(6)] | s << 6 | rnd_n(6));
+	if (s == 2)
+		put32(rnd_val());
+	else
+		put16(s ? rnd_val() : rnd_val() & 0xff);
+}
+
+static void gen_item(void)
+{
+	unsigned s = rnd_n(3), op;
+	uw32 loop, src, dst;
+	uw16 ext;
+
+	switch (rnd_n(16)) {
+	default:
+		put16(gen_alu());
+		break;
+	case 3:
+		gen_imm();
+		break;
+	case 4:						/* bcc.s over one */
+		put16(gen_alu());
+		put16(0x6002 | (2 + rnd_n(14)) << 8);
+		put16(gen_alu());
+		break;
+	case 5:						/* bcc.w over one */
+		put16(gen_alu());
+		put16(0x6000 | (2 + rnd_n(14)) << 8);
+		put16(4);
+		put16(gen_alu());
+		break;
+	case 6:						/* dbcc d7 round one */
+		put16(0x7e00 | rnd_n(24));		/* moveq #n,d7 */
+		loop = here;
+		put16(gen_alu());
+		put16(0x50cf | (rnd_n(3) ? 1 : rnd_n(16)) << 8);
+		put16(loop - here);
+		break;
+	case 7:						/* cmpm, then bcc */
+		src = BENCH_SRC + (rnd_n(0x4000) & ~1);
+		put16(0x41f9); put32(src);		/* lea src,a0 */
+		put16(0x43f9); put32(rnd_n(2) ? src : src + 2);	/* lea,a1 */
+		put16(0xb308 | s << 6);			/* cmpm.x (a0)+,(a1)+ */
+		put16(0x6002 | (2 + rnd_n(14)) << 8);
+		put16(gen_alu());
+		break;
+	case 8:						/* dbra copy loop */
+		src = BENCH_SRC + 64 + rnd_n(0x4000);
+		dst = rnd_n(2) ? src + rnd_n(64) - 32 : BENCH_DST + rnd_n(0x4000);
+		if (s) {
+			src &= ~1;
+			dst &= ~1;
+		}
+		put16(0x41f9); put32(src);
+		put16(0x43f9); put32(dst);
+		put16(0x3c3c); put16(rnd_n(300));	/* move.w #n,d6 */
+		loop = here;
+		put16(move_bits[s] | 0x02d8);		/* move.x (a0)+,(a1)+ */
+		put16(0x51ce);				/* dbra d6 */
+		put16(loop - here);
+		break;
+	case 9:						/* dbra fill loop */
+		dst = BENCH_DST + rnd_n(0x4000);
+		if (s)
+			dst &= ~1;
+		put16(0x43f9); put32(dst);
+		put16(0x3c3c); put16(rnd_n(300));
+		loop = here;
+		if (rnd_n(2))
+			put16(move_bits[s] | 0x02c0 | rnd_n(7));	/* move.x dm,(a1)+ */
+		else
+			put16(0x4219 | s << 6);		/* clr.x (a1)+ */
+		put16(0x51ce);
+		put16(loop - here);
+		break;
+	case 10:					/* movem */
+		op = rnd_n(2) << 6;			/* .w or .l */
+		put16(0x45f9); put32(BENCH_SRC + 0x100 + (rnd_n(0x2000) & ~1));	/* lea,a2 */
+		switch (rnd_n(5)) {
+		case 0: put16(0x4892 | op); put16(rnd() & 0x7fff); break;	/* regs,(a2) */
+		case 1: put16(0x48a2 | op); put16(rnd() & 0xfffe); break;	/* regs,-(a2) */
+		case 2: put16(0x4c9a | op); put16(rnd() & 0x7fff); break;	/* (a2)+,regs */
+		case 3: put16(0x4c92 | op); put16(rnd() & 0x7fff); break;	/* (a2),regs */
+		default:
+			put16(0x48a7 | op); put16(rnd() & 0xfffe);	/* regs,-(a7) */
+			put16(gen_alu());
+			put16(0x4c9f | op); put16(rnd() & 0x7fff);	/* (a7)+,regs */
+			break;
+		}
+		break;
+	case 11:					/* bit field */
+		op = rnd_n(8) << 8;
+		if (rnd_n(2)) {
+			put16(0xe8c0 | op | rnd_n(6));
+			ext = rnd_n(6) << 12 | rnd_n(2) << 11 | rnd_n(32) << 6 |
+			      rnd_n(2) << 5 | rnd_n(6);
+			// A register offset or width is taken from d0-d5
+			if (ext & 0x0800)
+				ext = (ext & ~(7 << 6)) | rnd_n(6) << 6;
+			put16(ext);
+		} else {
+			put16(0x47f9); put32(BENCH_SRC + 0x2000 + rnd_n(0x1000));	/* lea,a3 */
+			put16(0xe8d3 | op);		/* (a3) */
+			put16(rnd_n(6) << 12 | rnd_n(32) << 6 | rnd_n(32));
+		}
+		break;
+	case 12:					/* mull dn, or divl #imm */
+		ext = rnd_n(6) << 12 | rnd_n(2) << 11 | rnd_n(2) << 10 | rnd_n(6);
+		if (rnd_n(2)) {
+			put16(0x4c00 | rnd_n(6));
+			put16(ext);
+		} else {
+			put16(0x4c7c);
+			put16(ext);
+			put32(rnd_val() | (rnd_n(2) ? 1 : 0x100));
+		}
+		break;
+	case 13:					/* with a4, word or long */
+		s = 1 + rnd_n(2);
+		op = rnd_n(6);
+		switch (rnd_n(4)) {
+		case 0: put16(0x500c | rnd_n(16) << 8 | s << 6); break;	/* addq, subq #k,a4 */
+		case 1: put16(move_bits[s] | 0x0840 | op); break;	/* movea.x dn,a4 */
+		case 2: put16(move_bits[s] | op << 9 | 0x000c); break;	/* move.x a4,dn */
+		default:
+			put16((rnd_n(2) ? 0xd000 : rnd_n(2) ? 0x9000 : 0xb000) |
+			      op << 9 | s << 6 | 0x000c);		/* add, sub, cmp a4,dn */
+			break;
+		}
+		break;
+	}
+}
+
+static void check_start(const w32 *regs, uw16 ccr, bool fast)
+{
+	int i;
+
+	memcpy(memBase, check_ram, BENCH_CODE);
+	memcpy((Ptr)memBase + BENCH_SRC, check_mem[0], CHECK_SCRATCH);
+	fuse_enabled = fast;
+	MemoryWatchClear();
+	if (!fast)
+		MemoryWatchRange(0, BENCH_RAM, 1);
+	InitialSetup();
+	for (i = 0; i < 15; i++)
+		reg[i] = regs[i];
+	cc_op = CC_NONE;
+	xflag = (ccr >> 4) & 1;
+	negative = (ccr >> 3) & 1;
+	zero = (ccr >> 2) & 1;
+	overflow = (ccr >> 1) & 1;
+	carry = ccr & 1;
+	cpu_cycles = 0;
+	// Counting instructions keeps the interpreter out of translated blocks
+	insn_counting = !fast;
+}
+
+static void check_end(check_state *s, int run)
+{
+	memcpy(s->reg, reg, sizeof(s->reg));
+	s->pc = (Ptr)pc - (Ptr)memBase;
+	s->sr = GetSR();
+	s->cycles = cpu_cycles;
+	memcpy(check_mem[run], (Ptr)memBase + BENCH_SRC, CHECK_SCRATCH);
+	memcpy(check_stack[run], (Ptr)memBase + CHECK_STACK, BENCH_CODE - CHECK_STACK);
+}
+
+static void check_dump(uw32 end)
+{
+	uw32 a;
+
+	fprintf(stderr, "  program at 0x%x:", BENCH_CODE);
+	for (a = BENCH_CODE; a <= end; a += 2)
+		fprintf(stderr, "%s%04x", (a - BENCH_CODE) % 32 ? " " : "\n    ",
+			(uw16)RW((Ptr)memBase + a));
+	fprintf(stderr, "\n");
+}
+
+/* Where the two runs differ, NULL if nowhere */
+static const char *check_diff(const check_state *f, const check_state *r)
+{
+	static char what[64];
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		if (f->reg[i] != r->reg[i]) {
+			snprintf(what, sizeof(what), "%c%d %08x, interpreted %08x",
+				 i < 8 ? 'd' : 'a', i & 7, (uw32)f->reg[i], (uw32)r->reg[i]);
+			return what;
+		}
+	}
+	if (f->sr != r->sr) {
+		snprintf(what, sizeof(what), "sr %04x, interpreted %04x", f->sr, r->sr);
+		return what;
+	}
+	if (f->pc != r->pc)
+		return "pc";
+	if (f->cycles != r->cycles) {
+		snprintf(what, sizeof(what), "cycles %llu, interpreted %llu",
+			 (unsigned long long)f->cycles, (unsigned long long)r->cycles);
+		return what;
+	}
+	if (memcmp(check_mem[0], check_mem[1], CHECK_SCRATCH))
+		return "scratch RAM";
+	if (memcmp(check_stack[0], check_stack[1], BENCH_CODE - CHECK_STACK))
+		return "stack";
+	return NULL;
+}
+
+static bool check_program(long n)
+{
+	check_state f, r;
+	w32 regs[15];
+	uw16 ccr;
+	uw32 end;
+	long steps;
+	const char *what;
+	int i, items;
+
+	memset(check_ram, 0, sizeof(check_ram));
+	for (i = 0; i < CHECK_SCRATCH; i++)
+		check_mem[0][i] = rnd();
+	memset((Ptr)memBase + BENCH_CODE, 0, BENCH_SRC - BENCH_CODE);
+	here = BENCH_CODE;
+	for (items = 1 + rnd_n(40); items; items--)
+		gen_item();
+#ifdef JIT
+	if (check_jit) {
+		put16(0x5179); put32(CHECK_COUNT);	/* subq.w #8,CHECK_COUNT */
+		put16(0x6600); put16(BENCH_CODE - here);	/* bne.w to the start */
+		WW(check_ram + CHECK_COUNT, 8 * (JIT_THRESHOLD / 8 + 2));
+	}
+#endif
+	end = here;
+	put16(0x60fe);					/* bra.s * */
+	WL(check_ram, CHECK_SSP);
+	WL(check_ram + 4, BENCH_CODE);
+	for (i = 0; i < 15; i++)
+		regs[i] = rnd_val();
+	ccr = rnd() & 0x1f;
+
+	check_start(regs, ccr, false);
+	for (steps = 0; (Ptr)pc - (Ptr)memBase != end && steps < CHECK_STEPS; steps++) {
+		ExecuteChunk(0);
+		GetSR();
+	}
+	check_end(&r, 1);
+	if (steps == CHECK_STEPS) {
+		fprintf(stderr, "sqlux_bench: check %ld didn't reach the end, pc=0x%x\n", n, r.pc);
+		check_dump(end);
+		return false;
+	}
+
+	check_start(regs, ccr, true);
+	if (steps)
+		ExecuteChunk(steps - 1);
+	check_end(&f, 0);
+	MemoryWatchClear();
+
+	what = check_diff(&f, &r);
+	if (what) {
+		fprintf(stderr, "sqlux_bench: check %ld, %ld instructions: %s\n", n, steps, what);
+		check_dump(end);
+		return false;
+	}
+	return true;
+}
+
+/* ---- 68020 models ---- */
+
+static void model_mull(w32 *r, uw16 *ccr, uw16 ext, w32 src)
+{
+	int dl = (ext >> 12) & 7, dh = ext & 7;
+	bool sgn = ext & 0x0800, neg = false;
+	uw32 a = r[dl], b = src, hi, lo;
+	uint64_t p;
+
+	if (sgn) {
+		neg = ((w32)a < 0) != ((w32)b < 0);
+		a = (w32)a < 0 ? -a : a;
+		b = (w32)b < 0 ? -b : b;
+	}
+	// Long multiplication on 16-bit halves
+	p = (uint64_t)(a & 0xffff) * (b & 0xffff) +
+	    (((uint64_t)(a >> 16) * (b & 0xffff) + (uint64_t)(a & 0xffff) * (b >> 16)) << 16) +
+	    ((uint64_t)(a >> 16) * (b >> 16) << 32);
+	if (neg)
+		p = -p;
+	hi = p >> 32;
+	lo = p;
+	*ccr &= 0x10;
+	if (ext & 0x0400) {
+		r[dh] = hi;
+		r[dl] = lo;
+		*ccr |= (hi >> 31) << 3 | (p == 0) << 2;
+	} else {
+		r[dl] = lo;
+		*ccr |= (lo >> 31) << 3 | (lo == 0) << 2;
+		if (sgn ? hi != ((w32)lo < 0 ? 0xffffffff : 0) : hi != 0)
+			*ccr |= 2;
+	}
+}
+
+/* Returns the CCR bits left undefined */
+static uw16 model_divl(w32 *r, uw16 *ccr, uw16 ext, w32 src)
+{
+	int dq = (ext >> 12) & 7, dr = ext & 7, i;
+	bool sgn = ext & 0x0800, nneg = false, dneg = false;
+	uint64_t n, q = 0, rem = 0, limit;
+	uw32 d = src;
+
+	if (ext & 0x0400)
+		n = (uint64_t)(uw32)r[dr] << 32 | (uw32)r[dq];
+	else
+		n = sgn ? (uint64_t)(int64_t)r[dq] : (uw32)r[dq];
+	if (sgn) {
+		nneg = (int64_t)n < 0;
+		dneg = (w32)d < 0;
+		if (nneg)
+			n = -n;
+		if (dneg)
+			d = -d;
+	}
+	// Restoring division, a bit at a time
+	for (i = 63; i >= 0; i--) {
+		rem = rem << 1 | ((n >> i) & 1);
+		q <<= 1;
+		if (rem >= d) {
+			rem -= d;
+			q |= 1;
+		}
+	}
+	limit = !sgn ? 0xffffffff : nneg != dneg ? 0x80000000 : 0x7fffffff;
+	*ccr &= 0x1c;
+	if (q > limit) {
+		*ccr |= 2;
+		return 0x0c;
+	}
+	if (nneg != dneg)
+		q = -q;
+	if (nneg)
+		rem = -rem;
+	*ccr &= 0x10;
+	r[dr] = rem;
+	r[dq] = q;
+	*ccr |= ((uw32)q >> 31) << 3 | ((uw32)q == 0) << 2;
+	return 0;
+}
+
+/* Bit i of the field, counting from its top; reg is the Dn of a
+   register field, NULL for one in mem */
+static int bf_bit(const w32 *reg_v, const uint8_t *mem, w32 offset, int i)
+{
+	w32 k = offset + i;
+
+	if (reg_v)
+		return ((uw32)*reg_v >> (31 - (k & 31))) & 1;
+	return (mem[k >> 3] >> (7 - (k & 7))) & 1;
+}
+
+static void bf_set(w32 *reg_v, uint8_t *mem, w32 offset, int i, int v)
+{
+	w32 k = offset + i;
+
+	if (reg_v) {
+		uw32 m = 1u << (31 - (k & 31));
+		*reg_v = v ? *reg_v | m : *reg_v & ~m;
+	} else {
+		uint8_t m = 1 << (7 - (k & 7));
+		mem[k >> 3] = v ? mem[k >> 3] | m : mem[k >> 3] & ~m;
+	}
+}
+
+/* code's EA is dn, or mem for (a3) */
+static void model_bitfield(w32 *r, uw16 *ccr, uw16 code_w, uw16 ext, uint8_t *mem)
+{
+	int op = (code_w >> 8) & 7, width, i;
+	w32 offset = (ext & 0x0800) ? r[(ext >> 6) & 7] : (ext >> 6) & 31;
+	w32 *rv = (code_w & 0x38) ? NULL : &r[code_w & 7];
+	uw32 field = 0, ins = 0;
+	int dn = (ext >> 12) & 7;
+
+	width = (ext & 0x0020) ? r[ext & 7] : ext;
+	width = ((width - 1) & 31) + 1;
+	for (i = 0; i < width; i++)
+		field = field << 1 | bf_bit(rv, mem, offset, i);
+	*ccr &= 0x10;
+	*ccr |= ((field >> (width - 1)) & 1) << 3 | (field == 0) << 2;
+
+	switch (op) {
+	case 0:						/* bftst */
+		return;
+	case 1:						/* bfextu */
+		r[dn] = field;
+		return;
+	case 3:						/* bfexts */
+		r[dn] = (field >> (width - 1)) & 1 ? field | ~(0xffffffffu >> (32 - width)) : field;
+		return;
+	case 5:						/* bfffo */
+		for (i = 0; i < width && !bf_bit(rv, mem, offset, i); i++)
+			;
+		r[dn] = offset + i;
+		return;
+	case 7:						/* bfins */
+		ins = r[dn];
+		*ccr &= 0x10;
+		*ccr |= ((ins >> (width - 1)) & 1) << 3 |
+			((ins & (0xffffffffu >> (32 - width))) == 0) << 2;
+		break;
+	}
+	for (i = 0; i < width; i++) {
+		int b = (field >> (width - 1 - i)) & 1;
+
+		switch (op) {
+		case 2: b = !b; break;				/* bfchg */
+		case 4: b = 0; break;				/* bfclr */
+		case 6: b = 1; break;				/* bfset */
+		case 7: b = (ins >> (width - 1 - i)) & 1; break;	/* bfins */
+		}
+		bf_set(rv, mem, offset, i, b);
+	}
+}
+
+static bool check_68020(long n)
+{
+	w32 regs[15], exp[16];
+	uw16 ccr, exp_ccr, undef = 0, c, ext;
+	uw32 a3 = BENCH_SRC + 0x2000 + rnd_n(0x1000);
+	uint8_t *mem = check_mem[1] + (a3 - BENCH_SRC);
+	w32 src;
+	int i;
+
+	memset(check_ram, 0, sizeof(check_ram));
+	for (i = 0; i < CHECK_SCRATCH; i++)
+		check_mem[0][i] = rnd();
+	memcpy(check_mem[1], check_mem[0], CHECK_SCRATCH);
+	WL(check_ram, CHECK_SSP);
+	WL(check_ram + 4, BENCH_CODE);
+	for (i = 0; i < 15; i++)
+		regs[i] = rnd_val();
+	regs[11] = a3;
+	ccr = rnd() & 0x1f;
+	memcpy(exp, regs, sizeof(regs));
+	exp[15] = CHECK_SSP;
+	exp_ccr = ccr;
+
+	here = BENCH_CODE;
+	switch (rnd_n(3)) {
+	case 0:
+		ext = rnd_n(8) << 12 | rnd_n(2) << 11 | rnd_n(2) << 10 | rnd_n(8);
+		if ((ext & 0x0400) && ((ext >> 12) & 7) == (ext & 7))
+			ext ^= 1;
+		c = 0x4c00 | rnd_n(8);
+		put16(c);
+		put16(ext);
+		model_mull(exp, &exp_ccr, ext, regs[c & 7]);
+		break;
+	case 1:
+		ext = rnd_n(8) << 12 | rnd_n(2) << 11 | rnd_n(2) << 10 | rnd_n(8);
+		src = rnd_n(4) ? rnd_val() : (w32)rnd_n(16) - 8;
+		if (!src)
+			src = 3;
+		put16(0x4c7c);
+		put16(ext);
+		put32(src);
+		undef = model_divl(exp, &exp_ccr, ext, src);
+		break;
+	default:
+		ext = rnd_n(8) << 12 | rnd_n(2) << 11 | rnd_n(32) << 6 | rnd_n(2) << 5 | rnd_n(8);
+		if (rnd_n(2)) {
+			c = 0xe8c0 | rnd_n(8) << 8 | rnd_n(8);
+		} else {
+			// Memory fields within a few bytes of a3
+			c = 0xe8d3 | rnd_n(8) << 8;
+			if (ext & 0x0800) {
+				int o = (ext >> 6) & 7;
+
+				exp[o] = regs[o] = (w32)rnd_n(256) - 128;
+				if (o == 3)
+					ext &= ~0x0800;
+			}
+		}
+		put16(c);
+		put16(ext);
+		model_bitfield(exp, &exp_ccr, c, ext, mem);
+		break;
+	}
+	put16(0x60fe);
+
+	check_start(regs, ccr, true);
+	ExecuteChunk(0);
+	for (i = 0; i < 16; i++) {
+		if (reg[i] != exp[i]) {
+			fprintf(stderr, "sqlux_bench: 68020 check %ld: %c%d %08x, model %08x\n", n,
+				i < 8 ? 'd' : 'a', i & 7, (uw32)reg[i], (uw32)exp[i]);
+			check_dump(here - 2);
+			return false;
+		}
+	}
+	if ((GetSR() & 0x1f & ~undef) != (exp_ccr & ~undef)) {
+		fprintf(stderr, "sqlux_bench: 68020 check %ld: ccr %02x, model %02x\n", n,
+			GetSR() & 0x1f, exp_ccr);
+		check_dump(here - 2);
+		return false;
+	}
+	if (memcmp((Ptr)memBase + BENCH_SRC, check_mem[1], CHECK_SCRATCH)) {
+		fprintf(stderr, "sqlux_bench: 68020 check %ld: memory differs from model\n", n);
+		check_dump(here - 2);
+		return false;
+	}
+	return true;
+}
+
+static int check(long cases, uint64_t seed)
+{
+	long n, bad = 0;
+
+	rng = seed ? seed : 1;
+	for (n = 0; n < cases && bad < 10; n++)
+		bad += !check_program(n);
+	for (n = 0; n < 10 * cases && bad < 10; n++)
+		bad += !check_68020(n);
+	printf("sqlux_bench: %ld programs and %ld 68020 cases, seed %llu: %s\n",
+	       cases, 10 * cases, (unsigned long long)seed, bad ? "FAILED" : "all match");
+	return bad != 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *only = NULL;
+	long insns = 50000000, cases = 2000;
+	uint64_t seed = 1;
+	bool checking = false, jit = false;
+	size_t i, n;
+
+	for (i = 1; i < (size_t)argc; i++) {
+		if (!strcmp(argv[i], "--insns") && i + 1 < (size_t)argc) {
+			insns = strtol(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--kernel") && i + 1 < (size_t)argc) {
+			only = argv[++i];
+		} else if (!strcmp(argv[i], "--jit")) {
+			jit = true;
+		} else if (!strcmp(argv[i], "--check")) {
+			checking = true;
+		} else if (!strcmp(argv[i], "--cases") && i + 1 < (size_t)argc) {
+			cases = strtol(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--seed") && i + 1 < (size_t)argc) {
+			seed = strtoull(argv[++i], NULL, 0);
+		} else {
+			fprintf(stderr, "Usage: %s [--jit] [--insns N] [--kernel NAME]\n"
+				"       %s [--jit] --check [--cases N] [--seed N]\n", argv[0], argv[0]);
+			return 2;
+		}
+	}
+	if (insns <= 0)
+		insns = 1;
+
+	RTOP = BENCH_RAM;
+	memBase = calloc(1, BENCH_RAM);
+	if (!memBase) {
+		fprintf(stderr, "sqlux_bench: no memory\n");
+		return 1;
+	}
+	// The check needs the 68020 opcodes in the table
+	if (checking)
+		cpu68010 = cpu68020 = 1;
+	cyclesInit(checking ? 68020 : 68000, false, 28);
+	if (EmulatorTable()) {
+		fprintf(stderr, "sqlux_bench: failed to allocate instruction table\n");
+		return 1;
+	}
+	HWRegionsInit();
+#ifdef JIT
+	jit_init(jit, NULL);
+#else
+	if (jit) {
+		fprintf(stderr, "sqlux_bench: --jit needs a JIT build\n");
+		return 2;
+	}
+#endif
+	check_jit = jit;
+	if (checking)
+		return check(cases, seed);
+
+	printf("{\n  \"insns\":%ld,\n  \"jit\":%s,\n  \"kernels\":[\n", insns,
+	       jit ? "true" : "false");
+	for (i = 0, n = 0; i < NKERNELS; i++)
+		n += !only || !strcmp(only, kernels[i].name);
+	for (i = 0; i < NKERNELS; i++) {
+		if (only && strcmp(only, kernels[i].name))
+			continue;
+		print_result(kernels[i].name, run(kernels[i].name, kernels[i].build, insns), !--n);
+	}
+	printf("  ],\n  \"opcodes\":[\n");
+	for (i = 0, n = 0; i < NOPCODES; i++)
+		n += !only || !strcmp(only, opcodes[i].name);
+	for (i = 0; i < NOPCODES; i++) {
+		if (only && strcmp(only, opcodes[i].name))
+			continue;
+		cur_opcode = &opcodes[i];
+		print_result(opcodes[i].name, run(opcodes[i].name, k_opcode, insns), !--n);
+	}
+	printf("  ]\n}\n");
+	return failed;
+}
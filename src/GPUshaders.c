@@ -10,9 +10,14 @@
 #include <time.h>
 #include <sys/stat.h>
 #include <SDL_gpu.h>
+#include <SDL_opengl.h>
 #include "SDL2screen.h"
 #include "QL_screen.h"
 #include "debug.h"
+#include "thread_policy.h"
+#ifdef NEXTP8
+#include "nextp8.h"
+#endif
 
 /* Structure used in mouse pointer calculation */
 typedef struct {
@@ -32,21 +37,127 @@ static double pixel_ratio = 1.0;	// Ratio of x to y pixels
 
 static Uint32 shader;
 static GPU_ShaderBlock shader_block;
-static int res_texture_size;
-static int res_screen_size;
+static int res_texture_size = -1;
+static int res_screen_size = -1;
 static bool curve = false;
+static bool want_curve = false;
 static float curve_x;
 static float curve_y;
 
+#ifdef NEXTP8
+/*
+ * nextp8 frames are decoded on the GPU when possible: the raw 4bpp front
+ * framebuffer and overlay go up as one 64x256 luminance texture, the
+ * resolved palette as a 32x1 texture, and a built-in shader applies
+ * screen_transform and the overlay while rendering into a 128x128 image
+ * that the user shader then displays.  High-colour modes still use the
+ * CPU renderer.
+ */
+static GPU_Image* index_image = NULL;
+static GPU_Image* palette_image = NULL;
+static GPU_Image* decoded_image = NULL;
+static Uint32 decode_shader;
+static GPU_ShaderBlock decode_block;
+static int decode_palette;
+static int decode_transform;
+static int decode_overlay;
+static int decode_transparent;
+
+static const char decode_source[] =
+"#if __VERSION__ >= 130\n"
+"#define ATTRIBUTE in\n"
+"#define SHADER_IN in\n"
+"#define SHADER_OUT out\n"
+"#if defined(FRAGMENT)\n"
+"#define TEXTURE_2D texture\n"
+"out vec4 fragColor;\n"
+"#endif\n"
+"#else\n"
+"#define ATTRIBUTE attribute\n"
+"#define SHADER_IN varying\n"
+"#define SHADER_OUT varying\n"
+"#if defined(FRAGMENT)\n"
+"#define TEXTURE_2D texture2D\n"
+"#define fragColor gl_FragColor\n"
+"#endif\n"
+"#endif\n"
+"#if defined(VERTEX)\n"
+"uniform mat4 MVPMatrix;\n"
+"ATTRIBUTE vec3 VertexCoord;\n"
+"ATTRIBUTE vec2 TexCoord;\n"
+"SHADER_OUT vec2 TEX0;\n"
+"void main()\n"
+"{\n"
+"	TEX0 = TexCoord;\n"
+"	gl_Position = MVPMatrix * vec4(VertexCoord, 1.0);\n"
+"}\n"
+"#elif defined(FRAGMENT)\n"
+"uniform sampler2D tex;\n"
+"uniform sampler2D palette;\n"
+"uniform float transform;\n"
+"uniform float overlay;\n"
+"uniform float transparent;\n"
+"SHADER_IN vec2 TEX0;\n"
+"float nibble(float x, float y)\n"
+"{\n"
+"	float b = floor(TEXTURE_2D(tex, vec2((floor(x / 2.0) + 0.5) / 64.0, (y + 0.5) / 256.0)).r * 255.0 + 0.5);\n"
+"	return mod(x, 2.0) >= 1.0 ? floor(b / 16.0) : mod(b, 16.0);\n"
+"}\n"
+"void main()\n"
+"{\n"
+"	float ox = min(floor(TEX0.x * 128.0), 127.0);\n"
+"	float oy = min(floor(TEX0.y * 128.0), 127.0);\n"
+"	float sx = ox;\n"
+"	float sy = oy;\n"
+"	if (transform == 1.0 || transform == 3.0)\n"
+"		sx = floor(ox / 2.0);\n"
+"	if (transform == 2.0 || transform == 3.0)\n"
+"		sy = floor(oy / 2.0);\n"
+"	if ((transform == 5.0 || transform == 7.0) && ox >= 64.0)\n"
+"		sx = 127.0 - ox;\n"
+"	if ((transform == 6.0 || transform == 7.0) && oy >= 64.0)\n"
+"		sy = 127.0 - oy;\n"
+"	if (transform == 129.0 || transform == 131.0 || transform == 134.0)\n"
+"		sx = 127.0 - ox;\n"
+"	if (transform == 130.0 || transform == 131.0 || transform == 134.0)\n"
+"		sy = 127.0 - oy;\n"
+"	if (transform == 133.0) {\n"
+"		sx = 127.0 - oy;\n"
+"		sy = ox;\n"
+"	}\n"
+"	if (transform == 135.0) {\n"
+"		sx = oy;\n"
+"		sy = 127.0 - ox;\n"
+"	}\n"
+"	vec4 c = TEXTURE_2D(palette, vec2((nibble(sx, sy) + 0.5) / 32.0, 0.5));\n"
+"	if (overlay > 0.5) {\n"
+"		float o = nibble(ox, oy + 128.0);\n"
+"		if (o != transparent)\n"
+"			c = TEXTURE_2D(palette, vec2((o + 16.5) / 32.0, 0.5));\n"
+"	}\n"
+"	fragColor = c;\n"
+"}\n"
+"#endif\n";
+
+static void CreateDecoder(void);
+static bool DecodeFrame(bool* changed);
+#endif
+
 static void UpdateDisplay(GPU_Target* screen);
 static void setViewPort(int w, int h);
 static void CreateImage(void);
 static void CreatePalette(void);
 
+static char* ShaderSource(GPU_ShaderEnum shader_type, const char* data,
+			 int data_size, const char* prepend);
 static Uint32 LoadShader(GPU_ShaderEnum shader_type, const char* data,
         		int data_size, const char* prepend);
-static bool LoadShaderProgram(GPU_ShaderBlock* shader, Uint32* p, const char* shader_file,
-                              	const char* prepend, bool curve, float* curve_x, float* curve_y);
+static bool StartShaderProgram(SDL_Window* window, const char* shader_file,
+			       const char* prepend);
+static bool PollShaderProgram(void);
+static void StopShaderBuild(void);
+static bool LinkShaderProgram(GPU_ShaderBlock* shader, Uint32* p, const char* name,
+			      const char* source, int size, const char* prepend);
 static void UpdateShader(float x, float y, float a, float b);
 static void FreeShader(Uint32 p);
 static void Distort(float* x, float* y);
@@ -73,23 +184,21 @@ bool QLGPUCreateDisplay(int w , int h, int ly, uint32_t* id,
 		QLSDLCreateIcon(window);
 		CreateImage();
 		CreatePalette();
+#ifdef NEXTP8
+		CreateDecoder();
+#endif
 
 		// Configure the shaders
 		char* prepend = NULL;
 
 		if (shader_type == 2) {
 			prepend = "#define CURVATURE\n";
-			curve = true;
+			want_curve = true;
 		}
 
-		ret = LoadShaderProgram(&shader_block, &shader,
-					shader_path, prepend,
-					curve, &curve_x, &curve_y);
+		// Until the user shader is built frames use the plain blit
+		ret = StartShaderProgram(window, shader_path, prepend);
 
-		if (ret) {
-			res_texture_size = GPU_GetUniformLocation(shader, "TextureSize");
-			res_screen_size = GPU_GetUniformLocation(shader, "u_resolution");
-		}
 		// Set initial image size
 		setViewPort(w, h);
 	}
@@ -99,30 +208,65 @@ bool QLGPUCreateDisplay(int w , int h, int ly, uint32_t* id,
 /* Tidy up the memory and resources at shut down */
 void QLGPUClean(void) {
 
+	StopShaderBuild();
 	if (image)
 	        GPU_FreeImage(image);
+#ifdef NEXTP8
+	if (index_image)
+		GPU_FreeImage(index_image);
+	if (palette_image)
+		GPU_FreeImage(palette_image);
+	if (decoded_image)
+		GPU_FreeImage(decoded_image);
+#endif
 
 	free(screen_buffer);
 	GPU_Quit();
 }
 
-/* Update the display using sdl_gpu */
-void QLGPUUpdateDisplay(void)
+/*
+   Update the display using sdl_gpu. Unchanged frames are not presented
+   again unless force is set
+*/
+bool QLGPUUpdateDisplay(bool force)
 {
-	// Update the display memory
-	QLSDLWritePixels(screen_buffer);
+	static GPU_Image* last_source = NULL;
+	GPU_Image* source = image;
+	bool changed = true;
+
+	if (!shader && PollShaderProgram())
+		force = true;
+#ifdef NEXTP8
+	if (DecodeFrame(&changed))
+		source = decoded_image;
+	else
+#endif
+	{
+		// Update the display memory
+		changed = QLSDLWritePixels(screen_buffer);
 
-	// Update the image using the updated memory buffer
-	GPU_UpdateImageBytes(image, NULL, (unsigned char*)screen_buffer, qlscreen.xres * 4);
+		// Update the image using the updated memory buffer
+		if (changed)
+			GPU_UpdateImageBytes(image, NULL, (unsigned char*)screen_buffer, qlscreen.xres * 4);
+	}
+
+	if (source != last_source)
+		changed = true;
+	last_source = source;
+	if (!changed && !force)
+		return false;
 
 	// Render to screen, using the active shader
 	GPU_Clear(screen);
-	GPU_ActivateShaderProgram(shader, &shader_block);
-	UpdateShader((float)qlscreen.xres, (float)qlscreen.yres,
-		(float)frect.w, (float)frect.h);
-	GPU_BlitRect(image, NULL, screen, &frect);
+	if (shader) {
+		GPU_ActivateShaderProgram(shader, &shader_block);
+		UpdateShader((float)qlscreen.xres, (float)qlscreen.yres,
+			(float)frect.w, (float)frect.h);
+	}
+	GPU_BlitRect(source, NULL, screen, &frect);
 	GPU_ActivateShaderProgram(0, NULL);
 	GPU_Flip(screen);
+	return changed;
 }
 
 /* sdl_gpu requires the window resolution set after a change in window size */
@@ -197,6 +341,91 @@ static void CreatePalette(void)
 	SDL_FreeFormat(format);
 }
 
+#ifdef NEXTP8
+/* Set up the GPU frame decoder; on any failure frames use the CPU path */
+static void CreateDecoder(void)
+{
+	decode_shader = 0;
+	if (!LinkShaderProgram(&decode_block, &decode_shader, "nextp8 decoder",
+			       decode_source, (int)strlen(decode_source), NULL)) {
+		decode_shader = 0;
+		return;
+	}
+	GPU_ActivateShaderProgram(0, NULL);
+
+	decode_palette = GPU_GetUniformLocation(decode_shader, "palette");
+	decode_transform = GPU_GetUniformLocation(decode_shader, "transform");
+	decode_overlay = GPU_GetUniformLocation(decode_shader, "overlay");
+	decode_transparent = GPU_GetUniformLocation(decode_shader, "transparent");
+
+	index_image = GPU_CreateImage(64, 256, GPU_FORMAT_LUMINANCE);
+	palette_image = GPU_CreateImage(32, 1, GPU_FORMAT_RGBA);
+	decoded_image = GPU_CreateImage(128, 128, GPU_FORMAT_RGBA);
+	if (!index_image || !palette_image || !decoded_image ||
+	    !GPU_LoadTarget(decoded_image)) {
+		GPU_LogError("GPU frame decoder unavailable\n");
+		FreeShader(decode_shader);
+		decode_shader = 0;
+		return;
+	}
+	GPU_SetImageFilter(index_image, GPU_FILTER_NEAREST);
+	GPU_SetImageFilter(palette_image, GPU_FILTER_NEAREST);
+	GPU_SetBlending(index_image, false);
+	if (V2)
+		printf("GPU frame decoder enabled\n");
+}
+
+/*
+   Render the newest frame into decoded_image; false if the CPU must do it.
+   changed is cleared when decoded_image already held the same picture
+*/
+static bool DecodeFrame(bool* changed)
+{
+	static uint32_t last_seq;
+	static uint64_t last_hash;
+	const nextp8_frame* f;
+	uint32_t pal[32];
+	GPU_Rect rect = { 0, 0, 128, 128 };
+
+	if (!decode_shader)
+		return false;
+
+	f = QLSDLFrameAcquire();
+	if (f && f->high_colour != 0) {
+		QLSDLFrameRelease();
+		last_seq = 0;
+		return false;
+	}
+	if (!f || f->seq == last_seq || (last_seq && f->hash == last_hash)) {
+		// Nothing new, decoded_image still holds the last frame
+		if (f)
+			last_seq = f->seq;
+		QLSDLFrameRelease();
+		*changed = false;
+		return true;
+	}
+
+	// fb and ov are adjacent, giving the 64x256 index layout
+	GPU_UpdateImageBytes(index_image, NULL, f->fb, 64);
+	QLSDLResolvePalette(f, pal);
+	GPU_UpdateImageBytes(palette_image, NULL, (unsigned char*)pal, sizeof(pal));
+
+	GPU_ActivateShaderProgram(decode_shader, &decode_block);
+	GPU_SetShaderImage(palette_image, decode_palette, 1);
+	GPU_SetUniformf(decode_transform, (float)f->transform);
+	GPU_SetUniformf(decode_overlay, (f->overlay_control & _OVERLAY_ENABLE_BIT) ? 1.0f : 0.0f);
+	GPU_SetUniformf(decode_transparent, (float)(f->overlay_control & 0xf));
+	GPU_BlitRect(index_image, NULL, decoded_image->target, &rect);
+	GPU_ActivateShaderProgram(0, NULL);
+
+	last_seq = f->seq;
+	last_hash = f->hash;
+	QLSDLFrameRelease();
+	*changed = true;
+	return true;
+}
+#endif
+
 /* Ensure that the screen aspect ratio is preserved */
 static void setViewPort(int w, int h)
 {
@@ -289,14 +518,13 @@ static void Distort(float* x, float* y)
 }
 
 /*
-   Loads a shader and prepends version/compatibility info before compiling it.
-   This function also prepends version specific information to the shader file.
-   This is needed as some shader compilers (older AMD) do not do this correctly
+   Prepends version/compatibility info and the stage define to a shader.
+   The version specific information is needed as some shader compilers
+   (older AMD) do not do this correctly
 */
-static Uint32 LoadShader(GPU_ShaderEnum shader_type, const char* data,
-			int data_size, const char* prepend)
+static char* ShaderSource(GPU_ShaderEnum shader_type, const char* data,
+			 int data_size, const char* prepend)
 {
-	Uint32 shader;
 	char* source;
 	int header_size, directive_size;
 	int prepend_size = 0;
@@ -351,7 +579,7 @@ static Uint32 LoadShader(GPU_ShaderEnum shader_type, const char* data,
 
 	if (source == NULL) {
 		GPU_LogError("malloc failed\n");
-		return 0;
+		return NULL;
 	}
 
 	// Prepend header
@@ -364,6 +592,18 @@ static Uint32 LoadShader(GPU_ShaderEnum shader_type, const char* data,
 	// Copy the file contents
 	memcpy(source + pre_source_size, data, data_size);
 	source[pre_source_size + data_size] = '\0';
+	return source;
+}
+
+/* Loads a shader with ShaderSource's header and compiles it */
+static Uint32 LoadShader(GPU_ShaderEnum shader_type, const char* data,
+			int data_size, const char* prepend)
+{
+	Uint32 shader;
+	char* source = ShaderSource(shader_type, data, data_size, prepend);
+
+	if (source == NULL)
+		return 0;
 
 	// Compile the shader
 	shader = GPU_CompileShader(shader_type, source);
@@ -415,15 +655,301 @@ static void ReadCurve(char* data, float* x, float* y) {
 }
 
 /*
-   Loads shader, compiles once with vertex and once with fragment defines.
-   Links results and optionally extracts and returns curvature defines
+   Compiles source once with vertex and once with fragment defines and
+   links the results
 */
-static bool LoadShaderProgram(GPU_ShaderBlock* shader, Uint32* p, const char* shader_file,
-                              const char* prepend, bool curve, float* curve_x, float* curve_y)
+static bool LinkShaderProgram(GPU_ShaderBlock* shader, Uint32* p, const char* name,
+			      const char* source, int size, const char* prepend)
 {
-	bool ret = false;
 	Uint32 v, f;
+
+	v = LoadShader(GPU_VERTEX_SHADER, source, size, prepend);
+
+	if (!v) {
+		GPU_LogError("Failed to load vertex shader (%s): %s\n", name, GPU_GetShaderMessage());
+		return false;
+	}
+
+	f = LoadShader(GPU_FRAGMENT_SHADER, source, size, prepend);
+
+	if (!f) {
+		GPU_LogError("Failed to load fragment shader (%s): %s\n", name, GPU_GetShaderMessage());
+		return false;
+	}
+
+	*p = GPU_LinkShaders(v, f);
+
+	if (!*p) {
+		GPU_LogError("Failed to link shader program (%s): %s\n", name, GPU_GetShaderMessage());
+		return false;
+	}
+
+	*shader = GPU_LoadShaderBlock(*p, "VertexCoord", "TexCoord", "gl_Color", "MVPMatrix");
+	GPU_ActivateShaderProgram(*p, shader);
+	return true;
+}
+
+/*
+ * The user shader is built on a thread with its own GL context sharing
+ * objects with sdl-gpu's, so a slow compile does not hold up the boot;
+ * until it is ready frames use the plain blit.  Linked programs are kept
+ * as GL program binaries under the SDL pref path, keyed by a hash of the
+ * sources and the GL vendor, renderer and version strings.
+ */
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+static struct {
+	GLuint (APIENTRY *CreateShader)(GLenum);
+	void (APIENTRY *ShaderSource)(GLuint, GLsizei, const GLchar* const*, const GLint*);
+	void (APIENTRY *CompileShader)(GLuint);
+	void (APIENTRY *GetShaderiv)(GLuint, GLenum, GLint*);
+	void (APIENTRY *GetShaderInfoLog)(GLuint, GLsizei, GLsizei*, GLchar*);
+	void (APIENTRY *DeleteShader)(GLuint);
+	GLuint (APIENTRY *CreateProgram)(void);
+	void (APIENTRY *AttachShader)(GLuint, GLuint);
+	void (APIENTRY *LinkProgram)(GLuint);
+	void (APIENTRY *GetProgramiv)(GLuint, GLenum, GLint*);
+	void (APIENTRY *GetProgramInfoLog)(GLuint, GLsizei, GLsizei*, GLchar*);
+	void (APIENTRY *DeleteProgram)(GLuint);
+	void (APIENTRY *GetIntegerv)(GLenum, GLint*);
+	const GLubyte* (APIENTRY *GetString)(GLenum);
+	void (APIENTRY *Finish)(void);
+	/* optional: GL 4.1, ARB_get_program_binary, GLES 3 or OES */
+	void (APIENTRY *ProgramParameteri)(GLuint, GLenum, GLint);
+	void (APIENTRY *GetProgramBinary)(GLuint, GLsizei, GLsizei*, GLenum*, void*);
+	void (APIENTRY *ProgramBinary)(GLuint, GLenum, const void*, GLsizei);
+} gl;
+
+static struct {
+	char* source[2];	/* vertex, fragment */
+	char* cache_file;
+	SDL_Window* window;
+	SDL_GLContext context;
+	SDL_Thread* thread;
+	SDL_atomic_t done;
+	GLuint program;
+} build;
+
+static void* GetGLProc(const char* name, const char* alt)
+{
+	void* f = SDL_GL_GetProcAddress(name);
+
+	if (!f && alt)
+		f = SDL_GL_GetProcAddress(alt);
+	return f;
+}
+
+static bool LoadGLProcs(void)
+{
+	gl.CreateShader = GetGLProc("glCreateShader", NULL);
+	gl.ShaderSource = GetGLProc("glShaderSource", NULL);
+	gl.CompileShader = GetGLProc("glCompileShader", NULL);
+	gl.GetShaderiv = GetGLProc("glGetShaderiv", NULL);
+	gl.GetShaderInfoLog = GetGLProc("glGetShaderInfoLog", NULL);
+	gl.DeleteShader = GetGLProc("glDeleteShader", NULL);
+	gl.CreateProgram = GetGLProc("glCreateProgram", NULL);
+	gl.AttachShader = GetGLProc("glAttachShader", NULL);
+	gl.LinkProgram = GetGLProc("glLinkProgram", NULL);
+	gl.GetProgramiv = GetGLProc("glGetProgramiv", NULL);
+	gl.GetProgramInfoLog = GetGLProc("glGetProgramInfoLog", NULL);
+	gl.DeleteProgram = GetGLProc("glDeleteProgram", NULL);
+	gl.GetIntegerv = GetGLProc("glGetIntegerv", NULL);
+	gl.GetString = GetGLProc("glGetString", NULL);
+	gl.Finish = GetGLProc("glFinish", NULL);
+	gl.ProgramParameteri = GetGLProc("glProgramParameteri", NULL);
+	gl.GetProgramBinary = GetGLProc("glGetProgramBinary", "glGetProgramBinaryOES");
+	gl.ProgramBinary = GetGLProc("glProgramBinary", "glProgramBinaryOES");
+
+	return gl.CreateShader && gl.ShaderSource && gl.CompileShader &&
+	       gl.GetShaderiv && gl.GetShaderInfoLog && gl.DeleteShader &&
+	       gl.CreateProgram && gl.AttachShader && gl.LinkProgram &&
+	       gl.GetProgramiv && gl.GetProgramInfoLog && gl.DeleteProgram &&
+	       gl.GetIntegerv && gl.GetString && gl.Finish;
+}
+
+/* FNV-1a */
+static uint64_t HashBytes(uint64_t h, const void* data, size_t len)
+{
+	const uint8_t* p = data;
+
+	while (len--)
+		h = (h ^ *p++) * 0x100000001b3ULL;
+	return h;
+}
+
+/* Path of the cached binary for the pending sources; NULL when not cacheable */
+static char* CacheFile(void)
+{
+	static const GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	uint64_t h = 0xcbf29ce484222325ULL;
+	GLint formats = 0;
+	char* dir;
+	char* file;
+
+	if (!gl.GetProgramBinary || !gl.ProgramBinary)
+		return NULL;
+	gl.GetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if (formats <= 0)
+		return NULL;
+	for (int i = 0; i < 3; i++) {
+		const char* str = (const char*)gl.GetString(strings[i]);
+
+		if (str)
+			h = HashBytes(h, str, strlen(str) + 1);
+	}
+	for (int i = 0; i < 2; i++)
+		h = HashBytes(h, build.source[i], strlen(build.source[i]) + 1);
+
+	dir = SDL_GetPrefPath("sQLux", "shader_cache");
+	if (!dir)
+		return NULL;
+	file = malloc(strlen(dir) + 24);
+	if (file)
+		sprintf(file, "%s%016llx.bin", dir, (unsigned long long)h);
+	SDL_free(dir);
+	return file;
+}
+
+/* Cache file layout: binary format, length, program binary */
+static GLuint CacheLoad(void)
+{
+	SDL_RWops* rw = SDL_RWFromFile(build.cache_file, "rb");
+	Uint32 format, len;
+	GLint status = 0;
+	GLuint p = 0;
+	void* data;
+
+	if (!rw)
+		return 0;
+	format = SDL_ReadLE32(rw);
+	len = SDL_ReadLE32(rw);
+	data = len ? malloc(len) : NULL;
+	if (data && SDL_RWread(rw, data, 1, len) == len) {
+		p = gl.CreateProgram();
+		gl.ProgramBinary(p, format, data, (GLsizei)len);
+		gl.GetProgramiv(p, GL_LINK_STATUS, &status);
+		if (!status) {
+			// Stale for this driver, rebuilt from source
+			gl.DeleteProgram(p);
+			p = 0;
+		}
+	}
+	free(data);
+	SDL_RWclose(rw);
+	return p;
+}
+
+static void CacheSave(GLuint p)
+{
+	GLint len = 0;
+	GLsizei got = 0;
+	GLenum format = 0;
+	SDL_RWops* rw;
+	void* data;
+
+	gl.GetProgramiv(p, GL_PROGRAM_BINARY_LENGTH, &len);
+	if (len <= 0 || !(data = malloc(len)))
+		return;
+	gl.GetProgramBinary(p, len, &got, &format, data);
+	if (got > 0 && (rw = SDL_RWFromFile(build.cache_file, "wb"))) {
+		SDL_WriteLE32(rw, format);
+		SDL_WriteLE32(rw, (Uint32)got);
+		if (SDL_RWwrite(rw, data, 1, got) != (size_t)got)
+			GPU_LogError("Cannot write shader cache %s\n", build.cache_file);
+		SDL_RWclose(rw);
+	}
+	free(data);
+}
+
+static GLuint CompileStage(GLenum type, const char* source)
+{
+	GLuint s = gl.CreateShader(type);
+	GLint status = 0;
+	char log[512];
+
+	gl.ShaderSource(s, 1, &source, NULL);
+	gl.CompileShader(s);
+	gl.GetShaderiv(s, GL_COMPILE_STATUS, &status);
+	if (!status) {
+		gl.GetShaderInfoLog(s, sizeof(log), NULL, log);
+		GPU_LogError("Failed to compile %s shader: %s\n",
+			     type == GL_VERTEX_SHADER ? "vertex" : "fragment", log);
+		gl.DeleteShader(s);
+		return 0;
+	}
+	return s;
+}
+
+/* Needs a current context sharing objects with sdl-gpu's */
+static GLuint BuildProgram(void)
+{
+	GLuint p, v, f;
+	GLint status = 0;
+	char log[512];
+
+	if (build.cache_file && (p = CacheLoad()))
+		return p;
+
+	v = CompileStage(GL_VERTEX_SHADER, build.source[0]);
+	f = v ? CompileStage(GL_FRAGMENT_SHADER, build.source[1]) : 0;
+	if (!f) {
+		if (v)
+			gl.DeleteShader(v);
+		return 0;
+	}
+	p = gl.CreateProgram();
+	gl.AttachShader(p, v);
+	gl.AttachShader(p, f);
+	if (build.cache_file && gl.ProgramParameteri)
+		gl.ProgramParameteri(p, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	gl.LinkProgram(p);
+	gl.DeleteShader(v);
+	gl.DeleteShader(f);
+	gl.GetProgramiv(p, GL_LINK_STATUS, &status);
+	if (!status) {
+		gl.GetProgramInfoLog(p, sizeof(log), NULL, log);
+		GPU_LogError("Failed to link shader program: %s\n", log);
+		gl.DeleteProgram(p);
+		return 0;
+	}
+	if (build.cache_file)
+		CacheSave(p);
+	return p;
+}
+
+static int BuildThread(void* arg)
+{
+	threadPolicyApply(THREAD_WORKER);
+	if (SDL_GL_MakeCurrent(build.window, build.context) == 0) {
+		build.program = BuildProgram();
+		// The program must be complete before the other context uses it
+		gl.Finish();
+		SDL_GL_MakeCurrent(build.window, NULL);
+	}
+	SDL_AtomicSet(&build.done, 1);
+	return 0;
+}
+
+/*
+   Reads the shader file and starts building its program, on a thread
+   when a shared context can be made, otherwise right away
+*/
+static bool StartShaderProgram(SDL_Window* window, const char* shader_file,
+			       const char* prepend)
+{
 	SDL_RWops* rwops;
+	SDL_GLContext current;
 	char* source;
 	int file_size;
 
@@ -443,45 +969,83 @@ static bool LoadShaderProgram(GPU_ShaderBlock* shader, Uint32* p, const char* sh
 
 	if (source == NULL) {
 		GPU_LogError("malloc failed\n");
+		SDL_RWclose(rwops);
 		return false;
 	}
 
 	// Read in source code
 	SDL_RWread(rwops, source, 1, file_size);
+	SDL_RWclose(rwops);
 	source[file_size] = '\0';
 
-	v = LoadShader(GPU_VERTEX_SHADER, source, file_size, prepend);
-
-	if (!v) {
-		GPU_LogError("Failed to load vertex shader (%s): %s\n", shader_file, GPU_GetShaderMessage());
-		free(source);
-		return false;
-	}
+	build.source[0] = ShaderSource(GPU_VERTEX_SHADER, source, file_size, prepend);
+	build.source[1] = ShaderSource(GPU_FRAGMENT_SHADER, source, file_size, prepend);
 
-	f = LoadShader(GPU_FRAGMENT_SHADER, source, file_size, prepend);
+	// Read the curvature variables
+	if (want_curve)
+		ReadCurve(source, &curve_x, &curve_y);
+	free(source);
 
-	if (!f) {
-		GPU_LogError("Failed to load fragment shader (%s): %s\n", shader_file, GPU_GetShaderMessage());
-		free(source);
+	if (!build.source[0] || !build.source[1] || !LoadGLProcs()) {
+		GPU_LogError("Cannot build shader program %s\n", shader_file);
 		return false;
 	}
+	build.cache_file = CacheFile();
+	build.window = window;
+	SDL_AtomicSet(&build.done, 0);
+
+#ifndef __EMSCRIPTEN__
+	current = SDL_GL_GetCurrentContext();
+	SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+	build.context = SDL_GL_CreateContext(window);
+	SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+	SDL_GL_MakeCurrent(window, current);
+	if (build.context) {
+		build.thread = SDL_CreateThread(BuildThread, "sQLux Shaders", NULL);
+		if (build.thread)
+			return true;
+		SDL_GL_DeleteContext(build.context);
+		build.context = NULL;
+	}
+#endif
+	build.program = BuildProgram();
+	SDL_AtomicSet(&build.done, 1);
+	return true;
+}
 
-	*p = GPU_LinkShaders(v, f);
+static void StopShaderBuild(void)
+{
+	if (build.thread) {
+		SDL_WaitThread(build.thread, NULL);
+		SDL_GL_DeleteContext(build.context);
+		build.thread = NULL;
+	}
+}
 
-	if (!*p) {
-		GPU_LogError("Failed to link shader program (%s): %s\n", shader_file, GPU_GetShaderMessage());
-		free(source);
+/* Switches to the user shader once built; true when that happens */
+static bool PollShaderProgram(void)
+{
+	if (!build.source[0] || !SDL_AtomicGet(&build.done))
 		return false;
+	StopShaderBuild();
+	for (int i = 0; i < 2; i++) {
+		free(build.source[i]);
+		build.source[i] = NULL;
 	}
-
-	// Read the curvature variables
-	if (curve && curve_x && curve_y) {
-		ReadCurve(source, curve_x, curve_y);
+	free(build.cache_file);
+	build.cache_file = NULL;
+	if (!build.program) {
+		GPU_LogError("Shader program unavailable, using the plain renderer\n");
+		return false;
 	}
 
-	*shader = GPU_LoadShaderBlock(*p, "VertexCoord", "TexCoord", "gl_Color", "MVPMatrix");
-	GPU_ActivateShaderProgram(*p, shader);
-	free(source);
+	shader = build.program;
+	shader_block = GPU_LoadShaderBlock(shader, "VertexCoord", "TexCoord", "gl_Color", "MVPMatrix");
+	res_texture_size = GPU_GetUniformLocation(shader, "TextureSize");
+	res_screen_size = GPU_GetUniformLocation(shader, "u_resolution");
+	curve = want_curve;
+	if (V2)
+		printf("Shader program ready\n");
 	return true;
 }
 
@@ -570,7 +1134,7 @@ bool QLGPUCreateDisplay(int w , int h, int ly, uint32_t* id,
 			int shader_type, const char* shader_path) {
 	return true;
 }
-void QLGPUUpdateDisplay(void) {}
+bool QLGPUUpdateDisplay(bool force) { return false; }
 void QLGPUSetFullscreen(void) {}
 void QLGPUSetSize(int w, int h) {}
 void QLGPUProcessMouse(int* qlx, int* qly, int x, int y) {}
@@ -4,13 +4,20 @@
 #include <sys/signal.h>
 #include <unistd.h>
 
+#include "btrace.h"
+#include "cart_bench.h"
 #include "debug.h"
 #include "emudisk.h"
 #include "emulator_init.h"
 #include "emulator_options.h"
+#include "funcval_batch.h"
+#include "logger.h"
+#include "metrics.h"
 #include "p8audio_verilated.h"
 #include "QL_sound.h"
 #include "SDL2screen.h"
+#include "startup_timing.h"
+#include "thread_policy.h"
 #include "unixstuff.h"
 #include "Xscreen.h"
 
@@ -20,6 +27,8 @@
 
 #ifdef PROFILER
 #include "profiler/profiler_api.h"
+#include "profiler/profiler_control.h"
+#include "profiler/profiler_sampler.h"
 #endif
 
 #if __EMSCRIPTEN__
@@ -78,6 +87,8 @@ void emu_shutdown()
     SDL_WaitThread(emuThread, NULL);
 
     QLSDLExit();
+    metricsClose();
+    logClose();
 
     CleanRAMDev();
 
@@ -89,6 +100,7 @@ void emu_shutdown()
 void emu_loop() {
     static int init_done = 0;
     int boot_file_ready = 1;
+    uint64_t t;
 
 #if __EMSCRIPTEN__
     if(!init_done) {
@@ -97,13 +109,54 @@ void emu_loop() {
 #endif
     if(boot_file_ready && !init_done) {
 #ifdef PROFILER
-        Profiler_Initialize();
+        Profiler_Configure(emulatorOptionInt("profiler_buffer"),
+                           emulatorOptionInt("profiler_buffers"),
+                           emulatorOptionFlag("profiler_drop"));
+        Profiler_SetTraceFile(emulatorOptionString("profiler_trace"));
+        Profiler_SetSampleInterval(emulatorOptionInt("profiler_sample"));
+        Profiler_SetHeatmapFile(emulatorOptionString("profiler_heatmap"));
+        Profiler_SetFoldedFile(emulatorOptionString("profiler_folded"),
+                               emulatorOptionString("profiler_folded_weight"));
+        Profiler_SetLiveView(emulatorOptionInt("profiler_live_port"),
+                             emulatorOptionInt("profiler_live_frames"));
+        Profiler_SetLoopReport(emulatorOptionString("profiler_loops"));
+        Profiler_SetMemoryModel(emulatorOptionString("profiler_memory"));
+        Profiler_SetTimeline(emulatorOptionString("profiler_timeline"),
+                             emulatorOptionInt("profiler_timeline_depth"));
+        Profiler_AddSymbolFile(emulatorOptionString("cart_elf"));
+        Profiler_AddSymbolFile(emulatorOptionString("rom1_elf"));
 #endif
+        t = startupNow();
         emulatorInit();
+        startupAdd(STARTUP_EMULATOR_INIT, t);
+        cartBenchInit(emulatorOptionInt("cart_bench"),
+                      emulatorOptionString("cart_bench_file"));
+        metricsInit();
+#ifdef PROFILER
+        Profiler_SamplerStart(emulatorOptionInt("profiler_sample"));
+        Profiler_ControlInit(emulatorOptionFlag("profiler"),
+                             emulatorOptionInt("profiler_window"));
+#endif
+        // ROM and RAM are ready: start the CPU, then open the window and
+        // audio while it boots.  The p8audio MMIO queue holds register
+        // writes until the model is up, except offline where the
+        // emulator thread runs the model itself.
+        QLSDLInit();
+        if (emulatorOptionFlag("audio_offline")) {
+            t = startupNow();
+            p8audio_verilated_init();
+            startupAdd(STARTUP_VERILATOR, t);
+        }
+        emuThread = SDL_CreateThread(QLRun, "sQLux Emulator", NULL);
+        t = startupNow();
         QLSDLScreen();
+        startupAdd(STARTUP_SCREEN, t);
+        t = startupNow();
         initSound(emulatorOptionInt("sound"));
+        startupAdd(STARTUP_AUDIO, t);
+        t = startupNow();
         p8audio_verilated_init();
-        emuThread = SDL_CreateThread(QLRun, "sQLux Emulator", NULL);
+        startupAdd(STARTUP_VERILATOR, t);
         init_done = 1;
     }
     if(init_done) {
@@ -131,6 +184,7 @@ static void sighandler(int signo)
     printf("DumpState\n");
     fflush(stdout);
     DumpState();
+    metricsRequestDump();
 }
 
 static void sighandler2(int signo)
@@ -141,8 +195,16 @@ static void sighandler2(int signo)
     asyncTrace = true;
 }
 
+#ifdef PROFILER
+static void sighandler_prof(int signo)
+{
+    Profiler_Toggle();
+}
+#endif
+
 int main(int argc, char *argv[])
 {
+    startupTimingStart();
 #if __EMSCRIPTEN__
     wasm_init_storage();
 #endif
@@ -159,7 +221,24 @@ int main(int argc, char *argv[])
     // set the homedir for the OS first
     SetHome();
 
+    uint64_t t = startupNow();
     emulatorOptionParse(argc, argv);
+    startupAdd(STARTUP_OPTIONS, t);
+#ifdef NEXTP8
+    startupTimingInit(emulatorOptionString("startup_json"),
+                      emulatorOptionInt("startup_post"));
+#else
+    startupTimingInit(emulatorOptionString("startup_json"), -1);
+#endif
+    threadPolicyInit(emulatorOptionString("thread_cpus"),
+                     emulatorOptionString("thread_priority"));
+    logInit(emulatorOptionString("log"));
+#ifdef NEXTP8
+    // Only returns in a test's own process, with its options parsed
+    funcvalBatch(argc, argv);
+    if (emulatorOptionInt("render_bench") > 0)
+        return QLSDLRenderBench(emulatorOptionInt("render_bench"));
+#endif
 
     // Set some things that used to be set as side effects
     const char *resString = emulatorOptionString("resolution");
@@ -203,6 +282,8 @@ int main(int argc, char *argv[])
         asyncTrace = true;
         fprintf(stderr, "AsyncTrace enabled at startup\n");
     }
+    btraceFlightInit();
+    btraceInit(emulatorOptionString("trace_file"));
 #endif
 
     // setup the boot_cmd if needed
@@ -231,6 +312,13 @@ int main(int argc, char *argv[])
     ret = sigaction(SIGUSR2, &act, NULL);
     if (ret != 0)
         perror("sigaction");
+#ifdef PROFILER
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = sighandler_prof;
+    ret = sigaction(SIGPROF, &act, NULL);
+    if (ret != 0)
+        perror("sigaction");
+#endif
 
 #if __EMSCRIPTEN__
     emscripten_set_main_loop(emu_loop, -1, 1);
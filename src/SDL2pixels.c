@@ -0,0 +1,285 @@
+/*
+ * SDL2pixels.c
+ *
+ * 4bpp framebuffer row to 32-bit pixel expansion for the nextp8 renderer.
+ *
+ * The SIMD kernels split the 16-entry palette into four byte planes and
+ * look every nibble up in all four with a byte shuffle, then interleave
+ * the planes back into pixels.  Overlay pixels go through the same lookup
+ * and are merged under a transparency compare mask.  x86 picks SSSE3 at
+ * run time; NEON and wasm SIMD are chosen at compile time.
+ */
+
+#include <string.h>
+
+#include "SDL2pixels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define PIXELS_SSSE3
+#include <tmmintrin.h>
+#elif defined(__ARM_NEON)
+#define PIXELS_NEON
+#include <arm_neon.h>
+#elif defined(__wasm_simd128__)
+#define PIXELS_WASM
+#include <wasm_simd128.h>
+#endif
+
+static void expand_row_scalar(uint32_t *dst, const uint8_t *src,
+			      const uint8_t *ov, uint8_t transparent,
+			      const uint32_t pal[16], const uint32_t ovpal[16])
+{
+	int x;
+
+	for (x = 0; x < 64; x++) {
+		dst[2 * x] = pal[src[x] & 0xf];
+		dst[2 * x + 1] = pal[src[x] >> 4];
+	}
+	if (ov == NULL)
+		return;
+	for (x = 0; x < 64; x++) {
+		uint8_t lo = ov[x] & 0xf, hi = ov[x] >> 4;
+
+		if (lo != transparent)
+			dst[2 * x] = ovpal[lo];
+		if (hi != transparent)
+			dst[2 * x + 1] = ovpal[hi];
+	}
+}
+
+#if defined(PIXELS_SSSE3) || defined(PIXELS_NEON) || defined(PIXELS_WASM)
+/* planes[k][i] is byte k (in memory order) of pal[i] */
+static void palette_planes(uint8_t planes[4][16], const uint32_t pal[16])
+{
+	int i, k;
+
+	for (i = 0; i < 16; i++)
+		for (k = 0; k < 4; k++)
+			planes[k][i] = ((const uint8_t *)&pal[i])[k];
+}
+#endif
+
+#ifdef PIXELS_SSSE3
+__attribute__((target("ssse3")))
+static void expand_row_ssse3(uint32_t *dst, const uint8_t *src,
+			     const uint8_t *ov, uint8_t transparent,
+			     const uint32_t pal[16], const uint32_t ovpal[16])
+{
+	uint8_t planes[4][16], ovplanes[4][16];
+	__m128i p[4], q[4];
+	const __m128i nib = _mm_set1_epi8(0x0f);
+	const __m128i tr = _mm_set1_epi8(transparent);
+	int x, h, k;
+
+	palette_planes(planes, pal);
+	palette_planes(ovplanes, ovpal);
+	for (k = 0; k < 4; k++) {
+		p[k] = _mm_loadu_si128((const __m128i *)planes[k]);
+		q[k] = _mm_loadu_si128((const __m128i *)ovplanes[k]);
+	}
+
+	for (x = 0; x < 64; x += 16) {
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + x));
+		__m128i lo = _mm_and_si128(s, nib);
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(s, 4), nib);
+		__m128i idx[2] = { _mm_unpacklo_epi8(lo, hi), _mm_unpackhi_epi8(lo, hi) };
+		__m128i oidx[2];
+
+		if (ov) {
+			s = _mm_loadu_si128((const __m128i *)(ov + x));
+			lo = _mm_and_si128(s, nib);
+			hi = _mm_and_si128(_mm_srli_epi16(s, 4), nib);
+			oidx[0] = _mm_unpacklo_epi8(lo, hi);
+			oidx[1] = _mm_unpackhi_epi8(lo, hi);
+		}
+
+		for (h = 0; h < 2; h++) {
+			__m128i b[4], t0, t1, t2, t3;
+			__m128i *d = (__m128i *)(dst + 2 * x + 16 * h);
+
+			for (k = 0; k < 4; k++)
+				b[k] = _mm_shuffle_epi8(p[k], idx[h]);
+			if (ov) {
+				__m128i keep = _mm_cmpeq_epi8(oidx[h], tr);
+
+				for (k = 0; k < 4; k++)
+					b[k] = _mm_or_si128(_mm_and_si128(keep, b[k]),
+							    _mm_andnot_si128(keep, _mm_shuffle_epi8(q[k], oidx[h])));
+			}
+			t0 = _mm_unpacklo_epi8(b[0], b[1]);
+			t1 = _mm_unpacklo_epi8(b[2], b[3]);
+			t2 = _mm_unpackhi_epi8(b[0], b[1]);
+			t3 = _mm_unpackhi_epi8(b[2], b[3]);
+			_mm_storeu_si128(d + 0, _mm_unpacklo_epi16(t0, t1));
+			_mm_storeu_si128(d + 1, _mm_unpackhi_epi16(t0, t1));
+			_mm_storeu_si128(d + 2, _mm_unpacklo_epi16(t2, t3));
+			_mm_storeu_si128(d + 3, _mm_unpackhi_epi16(t2, t3));
+		}
+	}
+}
+#endif
+
+#ifdef PIXELS_NEON
+static void expand_row_neon(uint32_t *dst, const uint8_t *src,
+			    const uint8_t *ov, uint8_t transparent,
+			    const uint32_t pal[16], const uint32_t ovpal[16])
+{
+	uint8_t planes[4][16], ovplanes[4][16];
+	const uint8x16_t nib = vdupq_n_u8(0x0f);
+	const uint8x16_t tr = vdupq_n_u8(transparent);
+	int x, h, k;
+
+	palette_planes(planes, pal);
+	palette_planes(ovplanes, ovpal);
+
+#ifdef __aarch64__
+	uint8x16_t p[4], q[4];
+
+	for (k = 0; k < 4; k++) {
+		p[k] = vld1q_u8(planes[k]);
+		q[k] = vld1q_u8(ovplanes[k]);
+	}
+#else
+	uint8x8x2_t p[4], q[4];
+
+	for (k = 0; k < 4; k++) {
+		p[k].val[0] = vld1_u8(planes[k]);
+		p[k].val[1] = vld1_u8(planes[k] + 8);
+		q[k].val[0] = vld1_u8(ovplanes[k]);
+		q[k].val[1] = vld1_u8(ovplanes[k] + 8);
+	}
+#endif
+
+	for (x = 0; x < 64; x += 16) {
+		uint8x16_t s = vld1q_u8(src + x);
+		uint8x16x2_t idx = vzipq_u8(vandq_u8(s, nib), vshrq_n_u8(s, 4));
+		uint8x16x2_t oidx;
+
+		if (ov) {
+			s = vld1q_u8(ov + x);
+			oidx = vzipq_u8(vandq_u8(s, nib), vshrq_n_u8(s, 4));
+		}
+
+		for (h = 0; h < 2; h++) {
+#ifdef __aarch64__
+			uint8x16x4_t c;
+
+			for (k = 0; k < 4; k++)
+				c.val[k] = vqtbl1q_u8(p[k], idx.val[h]);
+			if (ov) {
+				uint8x16_t keep = vceqq_u8(oidx.val[h], tr);
+
+				for (k = 0; k < 4; k++)
+					c.val[k] = vbslq_u8(keep, c.val[k],
+							    vqtbl1q_u8(q[k], oidx.val[h]));
+			}
+			vst4q_u8((uint8_t *)(dst + 2 * x + 16 * h), c);
+#else
+			int half;
+
+			for (half = 0; half < 2; half++) {
+				uint8x8_t i8 = half ? vget_high_u8(idx.val[h]) : vget_low_u8(idx.val[h]);
+				uint8x8x4_t c;
+
+				for (k = 0; k < 4; k++)
+					c.val[k] = vtbl2_u8(p[k], i8);
+				if (ov) {
+					uint8x8_t o8 = half ? vget_high_u8(oidx.val[h]) : vget_low_u8(oidx.val[h]);
+					uint8x8_t keep = vceq_u8(o8, vget_low_u8(tr));
+
+					for (k = 0; k < 4; k++)
+						c.val[k] = vbsl_u8(keep, c.val[k], vtbl2_u8(q[k], o8));
+				}
+				vst4_u8((uint8_t *)(dst + 2 * x + 16 * h + 8 * half), c);
+			}
+#endif
+		}
+	}
+}
+#endif
+
+#ifdef PIXELS_WASM
+static void expand_row_wasm(uint32_t *dst, const uint8_t *src,
+			    const uint8_t *ov, uint8_t transparent,
+			    const uint32_t pal[16], const uint32_t ovpal[16])
+{
+	uint8_t planes[4][16], ovplanes[4][16];
+	v128_t p[4], q[4];
+	const v128_t nib = wasm_i8x16_splat(0x0f);
+	const v128_t tr = wasm_i8x16_splat(transparent);
+	int x, h, k;
+
+	palette_planes(planes, pal);
+	palette_planes(ovplanes, ovpal);
+	for (k = 0; k < 4; k++) {
+		p[k] = wasm_v128_load(planes[k]);
+		q[k] = wasm_v128_load(ovplanes[k]);
+	}
+
+#define ZIPLO8(a, b)	wasm_i8x16_shuffle(a, b, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23)
+#define ZIPHI8(a, b)	wasm_i8x16_shuffle(a, b, 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31)
+#define ZIPLO16(a, b)	wasm_i16x8_shuffle(a, b, 0, 8, 1, 9, 2, 10, 3, 11)
+#define ZIPHI16(a, b)	wasm_i16x8_shuffle(a, b, 4, 12, 5, 13, 6, 14, 7, 15)
+
+	for (x = 0; x < 64; x += 16) {
+		v128_t s = wasm_v128_load(src + x);
+		v128_t lo = wasm_v128_and(s, nib);
+		v128_t hi = wasm_u8x16_shr(s, 4);
+		v128_t idx[2] = { ZIPLO8(lo, hi), ZIPHI8(lo, hi) };
+		v128_t oidx[2];
+
+		if (ov) {
+			s = wasm_v128_load(ov + x);
+			lo = wasm_v128_and(s, nib);
+			hi = wasm_u8x16_shr(s, 4);
+			oidx[0] = ZIPLO8(lo, hi);
+			oidx[1] = ZIPHI8(lo, hi);
+		}
+
+		for (h = 0; h < 2; h++) {
+			v128_t b[4], t0, t1, t2, t3;
+			uint32_t *d = dst + 2 * x + 16 * h;
+
+			for (k = 0; k < 4; k++)
+				b[k] = wasm_i8x16_swizzle(p[k], idx[h]);
+			if (ov) {
+				v128_t keep = wasm_i8x16_eq(oidx[h], tr);
+
+				for (k = 0; k < 4; k++)
+					b[k] = wasm_v128_bitselect(b[k], wasm_i8x16_swizzle(q[k], oidx[h]), keep);
+			}
+			t0 = ZIPLO8(b[0], b[1]);
+			t1 = ZIPLO8(b[2], b[3]);
+			t2 = ZIPHI8(b[0], b[1]);
+			t3 = ZIPHI8(b[2], b[3]);
+			wasm_v128_store(d + 0, ZIPLO16(t0, t1));
+			wasm_v128_store(d + 4, ZIPHI16(t0, t1));
+			wasm_v128_store(d + 8, ZIPLO16(t2, t3));
+			wasm_v128_store(d + 12, ZIPHI16(t2, t3));
+		}
+	}
+
+#undef ZIPLO8
+#undef ZIPHI8
+#undef ZIPLO16
+#undef ZIPHI16
+}
+#endif
+
+static void expand_row_select(uint32_t *dst, const uint8_t *src,
+			      const uint8_t *ov, uint8_t transparent,
+			      const uint32_t pal[16], const uint32_t ovpal[16])
+{
+	pixelExpandRow = expand_row_scalar;
+#if defined(PIXELS_SSSE3)
+	if (__builtin_cpu_supports("ssse3"))
+		pixelExpandRow = expand_row_ssse3;
+#elif defined(PIXELS_NEON)
+	pixelExpandRow = expand_row_neon;
+#elif defined(PIXELS_WASM)
+	pixelExpandRow = expand_row_wasm;
+#endif
+	pixelExpandRow(dst, src, ov, transparent, pal, ovpal);
+}
+
+pixel_expand_row_fn pixelExpandRow = expand_row_select;
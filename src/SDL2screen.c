@@ -7,6 +7,7 @@
 #include "GPUshaders.h" // Needs to be before math.h
 #include <inttypes.h>
 #include <math.h>
+#include <stddef.h>
 #include <SDL.h>
 #include <SDL_image.h>
 #include <string.h>
@@ -18,12 +19,28 @@
 #include "QL_hardware.h"
 #include "QL68000.h"
 #include "SDL2screen.h"
+#include "SDL2pixels.h"
+#include "frame_stats.h"
+#include "cart_bench.h"
+#include "startup_timing.h"
+#include "pacer.h"
+#include "io_worker.h"
+#include "video_capture.h"
+#include "frame_stream.h"
+#include "audio_mixer.h"
+#include "audio_stats.h"
+#include "metrics.h"
 #include "qlkeys.h"
 #include "qlmouse.h"
 #include "QL_screen.h"
 #include "unixstuff.h"
 #include "QL_sound.h"
 #include "funcval_testbench.h"
+#include "netplay.h"
+#include "rewind.h"
+#ifdef PROFILER
+#include "profiler/profiler_control.h"
+#endif
 
 #define SWAP_SHIFT 0x100
 #define SWAP_CNTRL 0x200
@@ -32,11 +49,9 @@
 
 static SDL_Window *ql_window = NULL;
 static uint32_t ql_windowid = 0;
-static SDL_Surface *ql_screen = NULL;
 static SDL_Renderer *ql_renderer = NULL;
 static SDL_Texture *ql_texture = NULL;
 static SDL_Rect dest_rect;
-static SDL_TimerID fiftyhz_timer;
 static bool renderer_idle = true;
 static const char *sdl_video_driver;
 static char sdl_win_name[128];
@@ -45,6 +60,7 @@ double ql_screen_ratio = 1.0;
 
 SDL_atomic_t doPoll;
 bool shaders_selected = false;
+bool ql_headless = false;
 
 SDL_sem *sem50Hz = NULL;
 
@@ -355,21 +371,63 @@ static joy_data joy[2] = { { NULL, -1, 0, 1 }, { NULL, -1, 0, 1 } };
 
 #ifdef NEXTP8
 uint8_t joy_state[2] = { 0, 0 };
-uint8_t joy_latched[2] = { 0, 0 };
+SDL_atomic_t joy_latched[2];
 #endif
 
 static bool QLSDLCreateDisplay(int w, int h, int ly, uint32_t *id,
 			       const char *name, uint32_t sdl_window_mode);
-static void QLSDLUpdateScreen();
-static void QLSDLUpdatePixelBuffer();
+static void QLSDLUpdateScreen(bool force);
+static bool QLSDLUpdatePixelBuffer();
 
 static void QLSDLInitJoystick(void);
 static void QLSDLOpenJoystick(int index, int which);
 static void QLProcessJoystickAxis(Sint32 which, Uint8 axis, Sint16 value);
+static void QLSDLFastForward(bool on);
 static void QLProcessJoystickButton(Sint32 which, Sint16 button,
 				    Sint16 pressed);
 static int QLConvertWhichToIndex(Sint32 which);
 
+// What the emulator thread needs: SDL, the 50Hz semaphore and the pacer.
+// The window comes later from QLSDLScreen, while the CPU is already running.
+void QLSDLInit(void)
+{
+	Uint32 flags;
+
+	ql_headless = emulatorOptionFlag("headless");
+	audioStatsInit(emulatorOptionFlag("audio_stats"));
+#ifdef NEXTP8
+	videoCaptureInit();
+	frameStreamInit();
+#endif
+	if (ql_headless) {
+		// No window or renderer; audio callbacks run on SDL's dummy
+		// driver so the shim/WAV capture path still works
+		SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+		flags = SDL_INIT_TIMER | SDL_INIT_EVENTS;
+	} else {
+		// Joysticks are set up on first use, see QLSDLProcessEvents
+		flags = SDL_INIT_VIDEO | SDL_INIT_TIMER;
+	}
+	if (SDL_Init(flags) < 0) {
+		printf("SDL_Init Error: %s\n", SDL_GetError());
+		exit(-1);
+	}
+
+	if (ql_headless) {
+		// Colours for funcval screenshots and readback
+		SDL_PixelFormat *format = SDL_AllocFormat(SDL_PIXELFORMAT_RGBA32);
+		QLSDLCreatePalette(format);
+		SDL_FreeFormat(format);
+	}
+
+	frameStatsInit(!ql_headless && emulatorOptionFlag("frame_stats"));
+	SDL_AtomicSet(&doPoll, 0);
+	sem50Hz = SDL_CreateSemaphore(0);
+	pacerInit();
+	if (emulatorOptionFlag("turbo"))
+		QLSDLFastForward(true);
+}
+
 void QLSDLScreen(void)
 {
 	SDL_DisplayMode sdl_mode;
@@ -383,16 +441,10 @@ void QLSDLScreen(void)
 #endif
 	const char *win_size, *shader_str;
 
-	snprintf(sdl_win_name, 128, "sQLux - %s, %dK", sysrom, RTOP / 1024);
+	if (ql_headless)
+		return;
 
-	Uint32 flags = SDL_INIT_VIDEO | SDL_INIT_TIMER;
-#ifndef SDL_JOYSTICK_DISABLED
-	flags |= SDL_INIT_JOYSTICK;
-#endif
-	if (SDL_Init(flags) < 0) {
-		printf("SDL_Init Error: %s\n", SDL_GetError());
-		exit(-1);
-	}
+	snprintf(sdl_win_name, 128, "sQLux - %s, %dK", sysrom, RTOP / 1024);
 
 	sdl_video_driver = SDL_GetCurrentVideoDriver();
 	SDL_GetCurrentDisplayMode(0, &sdl_mode);
@@ -480,17 +532,13 @@ void QLSDLScreen(void)
 
 	SDL_SetHint(SDL_HINT_GRAB_KEYBOARD, "1");
 	SDL_SetHint(SDL_HINT_VIDEO_MINIMIZE_ON_FOCUS_LOSS, "0");
-
-	QLSDLInitJoystick();
-
-	SDL_AtomicSet(&doPoll, 0);
-	sem50Hz = SDL_CreateSemaphore(0);
-	fiftyhz_timer = SDL_AddTimer(20, QLSDL50Hz, NULL);
 }
 
 static bool QLSDLCreateDisplay(int w, int h, int ly, uint32_t *id,
 			       const char *name, uint32_t sdl_window_mode)
 {
+	SDL_PixelFormat *format;
+
 	ql_window =
 		SDL_CreateWindow(name, SDL_WINDOWPOS_CENTERED,
 				 SDL_WINDOWPOS_CENTERED, w, h, sdl_window_mode);
@@ -516,24 +564,23 @@ static bool QLSDLCreateDisplay(int w, int h, int ly, uint32_t *id,
 	if (emulatorOptionInt("filter"))
 		SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1");
 
-	ql_screen = SDL_CreateRGBSurfaceWithFormat(
-		0, qlscreen.xres, qlscreen.yres, 32, SDL_PIXELFORMAT_RGBA32);
-
-	if (ql_screen == NULL) {
-		printf("Error Creating Surface\n");
-		return false;
-	}
-
-	printf("w: %d h :%d\n", ql_screen->w, ql_screen->h);
+	printf("w: %d h :%d\n", qlscreen.xres, qlscreen.yres);
+	/* Frames are rendered straight into the locked texture */
 	ql_texture = SDL_CreateTexture(ql_renderer, SDL_PIXELFORMAT_RGBA32,
 				       SDL_TEXTUREACCESS_STREAMING,
-				       ql_screen->w, ql_screen->h);
+				       qlscreen.xres, qlscreen.yres);
 
 	if (ql_texture == NULL) {
 		printf("Error Creating texture\n");
 		return false;
 	}
-	QLSDLCreatePalette(ql_screen->format);
+	format = SDL_AllocFormat(SDL_PIXELFORMAT_RGBA32);
+	if (format == NULL) {
+		printf("Error Creating pixel format\n");
+		return false;
+	}
+	QLSDLCreatePalette(format);
+	SDL_FreeFormat(format);
 	return true;
 }
 
@@ -648,234 +695,651 @@ static inline void screen_transform_pixel(uint8_t mode, int ox, int oy, int *sx,
     }
 }
 
-// Resolve the 8-bit extended color for a pixel, considering high-color mode.
-// pix_index: raw 4-bit framebuffer pixel, sx/sy: source coordinates.
-static inline uint8_t high_color_resolve(uint8_t pix_index, int sx, int sy)
+// Final colours for each source line of a frame in its high colour mode,
+// so the renderers do one table load per pixel.  pal is the resolved
+// frame palette; the 5-bitplane mode (0x20) also picks sec per pixel.
+typedef struct {
+	uint32_t sec[16];		// secondary palette
+	uint32_t grad[16][16];		// gradient fill, per section
+	const uint32_t *line[128];	// palette of each source line
+} high_colour_lut;
+
+static void high_colour_lines(const nextp8_frame *f, const uint32_t *pal,
+			      high_colour_lut *lut)
 {
-	uint8_t hc = high_colour_mode;
-	if (hc == 0x10) {
-		// Per-line palette swap via bitfield
-		uint8_t bf = highColourBitfield[vfront][sy >> 3];
-		if (bf & (1 << (sy & 7)))
-			return secondaryPalette[vfront][pix_index];
-		return screenPalette[vfront][pix_index];
-	}
-	if (hc == 0x20) {
-		// 5-bitplane mode: if hidden right-half pixel is non-zero, use secondary
-		int hidden_byte_offset = ((sx + 64) >> 1) + sy * 64;
-		if (hidden_byte_offset >= 0 && hidden_byte_offset < _FRAME_BUFFER_SIZE) {
-			uint8_t hidden_byte = ((uint8_t *)&frameBuffer[vfront])[hidden_byte_offset];
-			uint8_t hidden_pix = ((sx + 64) & 1) ? (hidden_byte >> 4) : (hidden_byte & 0xf);
-			if (hidden_pix != 0)
-				return secondaryPalette[vfront][pix_index];
-		}
-		return screenPalette[vfront][pix_index];
-	}
+	uint8_t hc = f->high_colour;
+
+	for (int i = 0; i < 16; i++)
+		lut->sec[i] = SDLcolors[color_index(f->secondary[i])];
 	if ((hc & 0xf0) == 0x30) {
 		// Gradient fill: replace color n with per-section secondary palette color
 		uint8_t replace_color = hc & 0x0f;
-		uint8_t screen_color = screenPalette[vfront][pix_index];
-		if ((screen_color & 0x0f) == replace_color) {
-			int section = sy >> 3;
-			uint8_t bf = highColourBitfield[vfront][sy >> 3];
-			if (bf & (1 << (sy & 7)))
-				section = (section + 1) & 0x0f;
-			return secondaryPalette[vfront][section];
+
+		for (int section = 0; section < 16; section++) {
+			uint32_t c = SDLcolors[color_index(f->secondary[section])];
+
+			for (int i = 0; i < 16; i++)
+				lut->grad[section][i] =
+					(f->palette[i] & 0x0f) == replace_color ? c : pal[i];
 		}
-		return screen_color;
 	}
-	return screenPalette[vfront][pix_index];
+	for (int sy = 0; sy < 128; sy++) {
+		bool bit = f->bitfield[sy >> 3] & (1 << (sy & 7));
+
+		if (hc == 0x10)		// per-line palette swap via bitfield
+			lut->line[sy] = bit ? lut->sec : pal;
+		else if ((hc & 0xf0) == 0x30)
+			lut->line[sy] = lut->grad[((sy >> 3) + bit) & 0x0f];
+		else
+			lut->line[sy] = pal;
+	}
 }
 #endif
 
-static void emulatorUpdatePixelBufferQL(uint32_t *pixelPtr32,
-					uint8_t *emulatorScreenPtr,
-					uint8_t *emulatorScreenPtrEnd)
+#ifdef NEXTP8
+// Work out which output lines of the persistent pixel buffer need
+// rendering again, from the line dirty bits set by the HW write paths,
+// and clear the bits for the next frame.
+static void nextp8_dirty_rows(nextp8_frame *f)
+{
+	static int last_vfront = -1;
+	static uint8_t last_transform, last_high_colour, last_overlay;
+	bool full = screenRedrawAll || vfront != last_vfront ||
+		    screen_transform != last_transform ||
+		    high_colour_mode != last_high_colour ||
+		    overlay_control != last_overlay;
+
+	if (!full) {
+		bool any = false;
+
+		for (int oy = 0; oy < 128; oy++) {
+			int sx, sy;
+			screen_transform_pixel(screen_transform, 0, oy, &sx, &sy);
+			f->rows[oy] = frameLineDirty[vfront][sy] | overlayLineDirty[vfront][oy];
+			any |= frameLineDirty[vfront][oy];
+		}
+		// Rotations read a source column per output line
+		if (any && (screen_transform == 133 || screen_transform == 135))
+			full = true;
+	}
+
+	memset(frameLineDirty[vfront], 0, sizeof(frameLineDirty[vfront]));
+	memset(overlayLineDirty[vfront], 0, sizeof(overlayLineDirty[vfront]));
+	screenRedrawAll = 0;
+	last_vfront = vfront;
+	last_transform = screen_transform;
+	last_high_colour = high_colour_mode;
+	last_overlay = overlay_control;
+
+	f->full = full;
+}
+
+// Copy the displayed state out of the live registers and buffers
+static void nextp8_frame_capture(nextp8_frame *f)
+{
+	memcpy(f->fb, frameBuffer[vfront], sizeof(f->fb));
+	memcpy(f->ov, overlayBuffer[vfront], sizeof(f->ov));
+	memcpy(f->palette, screenPalette[vfront], sizeof(f->palette));
+	memcpy(f->secondary, secondaryPalette[vfront], sizeof(f->secondary));
+	memcpy(f->bitfield, highColourBitfield[vfront], sizeof(f->bitfield));
+	f->transform = screen_transform;
+	f->high_colour = high_colour_mode;
+	f->overlay_control = overlay_control;
+}
+
+// Hash of the frame contents, so repeated identical frames can be skipped
+static uint64_t nextp8_frame_hash(const nextp8_frame *f)
 {
-	int curpix = 0;
-	uint32_t flashbg = 0;
-	int flashon = 0;
+	const uint8_t *p = (const uint8_t *)f;
+	size_t len = offsetof(nextp8_frame, hash);
+	uint64_t h = 0x9e3779b97f4a7c15ULL;
+	size_t i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		uint64_t w;
+
+		memcpy(&w, p + i, 8);
+		h = (h ^ w) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 32;
+	}
+	for (; i < len; i++)
+		h = (h ^ p[i]) * 0x100000001b3ULL;
+	return h;
+}
+#endif
 
-	while (emulatorScreenPtr < emulatorScreenPtrEnd) {
 #ifdef NEXTP8
-		int byte_offset = emulatorScreenPtr - (uint8_t *)&frameBuffer[vfront];
-		int ox_base = (byte_offset % 64) * 2;
-		int oy = byte_offset / 64;
+// Source pixel (sy * 128 + sx) for every output pixel, one table per
+// screen_transform mode, built on first use and never changed after, so
+// frames can be converted on more than one thread.
+static uint16_t *transform_src[256];
+static uint16_t transform_identity[128 * 128];
+static SDL_SpinLock transform_lock;
+
+static const uint16_t *transform_table(uint8_t mode)
+{
+	uint16_t *t;
+
+	SDL_AtomicLock(&transform_lock);
+	t = transform_src[mode];
+	if (!t) {
+		t = malloc(128 * 128 * sizeof(*t));
+		if (!t)
+			t = transform_identity;
+		for (int oy = 0; oy < 128; oy++) {
+			for (int ox = 0; ox < 128; ox++) {
+				int sx, sy;
+				if (t == transform_identity) {
+					sx = ox; sy = oy;
+				} else {
+					screen_transform_pixel(mode, ox, oy, &sx, &sy);
+				}
+				t[oy * 128 + ox] = sy * 128 + sx;
+			}
+		}
+		transform_src[mode] = t;
+	}
+	SDL_AtomicUnlock(&transform_lock);
+	return t;
+}
+
+// stride: pixels per output line; rows: lines to render, NULL for all
+static void nextp8UpdatePixelBuffer(uint32_t *pixelPtr32, int stride,
+				    const nextp8_frame *f, const uint8_t *rows)
+{
+	const uint8_t *fb = f->fb;
+	const uint8_t *ov = f->ov;
+	int overlay = f->overlay_control & _OVERLAY_ENABLE_BIT;
+	uint8_t transparent_index = f->overlay_control & 0xf;
+	uint32_t pal[32];
+	const uint32_t *ovpal = pal + 16;
+
+	high_colour_lut lut;
+	int hidden = f->high_colour == 0x20;
+
+	QLSDLResolvePalette(f, pal);
+	if (f->high_colour)
+		high_colour_lines(f, pal, &lut);
+
+	// Untransformed, one palette per line: a whole row per kernel call
+	if (f->transform == 0 && !hidden) {
+		for (int oy = 0; oy < 128; oy++) {
+			if (rows && !rows[oy])
+				continue;
+			pixelExpandRow(pixelPtr32 + oy * stride, fb + oy * 64,
+				       overlay ? ov + oy * 64 : NULL, transparent_index,
+				       f->high_colour ? lut.line[oy] : pal, ovpal);
+		}
+		return;
+	}
 
-		emulatorScreenPtr++;
+	const uint16_t *table = transform_table(f->transform);
 
-		for (int sub = 0; sub < 2; sub++) {
-			int ox = ox_base + sub;
-			int sx, sy;
-			screen_transform_pixel(screen_transform, ox, oy, &sx, &sy);
+	for (int oy = 0; oy < 128; oy++) {
+		const uint16_t *map = table + oy * 128;
+		uint32_t *dst = pixelPtr32 + oy * stride;
 
-			int src_byte_offset = (sx >> 1) + sy * 64;
-			uint8_t src_byte = ((uint8_t *)&frameBuffer[vfront])[src_byte_offset];
+		if (rows && !rows[oy])
+			continue;
+		for (int ox = 0; ox < 128; ox++) {
+			int sx = map[ox] & 127;
+			int sy = map[ox] >> 7;
+			uint8_t src_byte = fb[map[ox] >> 1];
 			uint8_t pix_index = (sx & 1) ? (src_byte >> 4) : (src_byte & 0xf);
-			uint8_t pal_val;
-			if (high_colour_mode != 0)
-				pal_val = high_color_resolve(pix_index, sx, sy);
-			else
-				pal_val = screenPalette[vfront][pix_index];
-			uint32_t colour = SDLcolors[color_index(pal_val)];
-
-			if (overlay_control & _OVERLAY_ENABLE_BIT) {
-				int overlay_byte_offset = (ox >> 1) + oy * 64;
-				if (overlay_byte_offset >= 0 && overlay_byte_offset < _FRAME_BUFFER_SIZE) {
-					uint8_t overlay_byte = overlayBuffer[vfront][overlay_byte_offset];
-					uint8_t overlay_index = (ox & 1) ? (overlay_byte >> 4) : (overlay_byte & 0xf);
-					uint8_t transparent_index = overlay_control & 0xf;
-					if (overlay_index != transparent_index)
-						colour = SDLcolors[color_index(overlay_index)];
+			const uint32_t *line = f->high_colour ? lut.line[sy] : pal;
+			uint32_t colour;
+
+			if (hidden) {
+				// 5-bitplane mode: if hidden right-half pixel is non-zero, use secondary
+				int hidden_byte_offset = ((sx + 64) >> 1) + sy * 64;
+
+				if (hidden_byte_offset < _FRAME_BUFFER_SIZE) {
+					uint8_t hidden_byte = fb[hidden_byte_offset];
+					uint8_t hidden_pix = ((sx + 64) & 1) ? (hidden_byte >> 4) : (hidden_byte & 0xf);
+
+					if (hidden_pix != 0)
+						line = lut.sec;
 				}
 			}
+			colour = line[pix_index];
+
+			if (overlay) {
+				uint8_t overlay_byte = ov[(ox >> 1) + oy * 64];
+				uint8_t overlay_index = (ox & 1) ? (overlay_byte >> 4) : (overlay_byte & 0xf);
+				if (overlay_index != transparent_index)
+					colour = ovpal[overlay_index];
+			}
 
-			pixelPtr32[ox + oy * 128] = colour;
+			dst[ox] = colour;
 		}
-#else
-		uint8_t t1 = *emulatorScreenPtr++;
-		uint8_t t2 = *emulatorScreenPtr++;
+	}
+}
+#endif
 
-		switch (display_mode) {
-		case 8:
-			for (int i = 6; i > -2; i -= 2) {
-				uint8_t p1 = (t1 >> i) & 0x03;
-				uint8_t p2 = (t2 >> i) & 0x03;
+#ifndef NEXTP8
+// Palette indices of the pixels of each (t1, t2) screen word pair, built
+// once: mode 4 packs eight 3 bit indices as four pixel pairs a * 8 + b,
+// mode 8 four 3 bit indices in bits 0-11 and their flash bits in 12-15.
+static uint8_t ql_mode4_lut[65536][4];
+static uint16_t ql_mode8_lut[65536];
+static bool ql_luts_built;
+
+static void ql_build_luts(void)
+{
+	for (int w = 0; w < 65536; w++) {
+		uint8_t t1 = w >> 8, t2 = w;
+		uint16_t m8 = 0;
 
-				int color = ((p1 & 2) << 1) + ((p2 & 3));
-				int flashbit = (p1 & 1);
+		for (int k = 0; k < 8; k++) {
+			int i = 7 - k;
+			int p1 = (t1 >> i) & 1, p2 = (t2 >> i) & 1;
+			int color = (p1 << 2) + (p2 << 1) + (p1 & p2);
 
-				uint32_t x = SDLcolors[color];
+			if (k & 1)
+				ql_mode4_lut[w][k >> 1] |= color;
+			else
+				ql_mode4_lut[w][k >> 1] = color << 3;
+		}
+		for (int k = 0; k < 4; k++) {
+			int i = 6 - 2 * k;
+			int p1 = (t1 >> i) & 3, p2 = (t2 >> i) & 3;
 
-				if ((curframe & BIT(5)) && flashon) {
-					x = flashbg;
-				}
+			m8 |= (((p1 & 2) << 1) + (p2 & 3)) << (3 * k);
+			m8 |= (p1 & 1) << (12 + k);
+		}
+		ql_mode8_lut[w] = m8;
+	}
+	ql_luts_built = true;
+}
 
-				*pixelPtr32++ = x;
-				*pixelPtr32++ = x;
+// Two pixels in memory order, for one 64 bit store
+static inline uint64_t ql_pixel_pair(uint32_t first, uint32_t second)
+{
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+	return (uint64_t)first << 32 | second;
+#else
+	return (uint64_t)second << 32 | first;
+#endif
+}
 
-				// flash happens after the pixel
-				if (flashbit) {
-					if (flashon == 0) {
-						flashbg = x;
-						flashon = 1;
-					} else {
-						flashon = 0;
-					}
-				}
+// Mode 8 flash state, running over the screen like the ULA: a set flash
+// bit latches the pixel's colour as the background until the next one,
+// and the state is cleared every 256 pixels
+typedef struct {
+	bool on;
+	uint32_t bg;
+	int pixels;
+} ql_flash;
+
+// Paint the flashing pixels of one line already drawn without flash
+static void ql_flash_line(uint32_t *dst, const uint8_t *src, int pairs,
+			  ql_flash *fl)
+{
+	for (int n = 0; n < pairs; n++, src += 2) {
+		uint16_t e = ql_mode8_lut[src[0] << 8 | src[1]];
+
+		for (int k = 0; k < 4; k++, dst += 2) {
+			if (fl->on)
+				dst[0] = dst[1] = fl->bg;
+			if (e & (1 << (12 + k))) {
+				if (!fl->on)
+					fl->bg = SDLcolors[(e >> (3 * k)) & 7];
+				fl->on = !fl->on;
+			}
+			if (++fl->pixels == 256) {
+				fl->pixels = 0;
+				fl->on = false;
+				fl->bg = 0;
+			}
+		}
+	}
+}
 
-				// Handle flash end of line
-				// stride is fixed at 256 because mode 8
-				// is fixed at that size on QL and Q68
-				curpix++;
-				curpix %= 256;
-				if (curpix == 0) {
-					flashbg = 0;
-					flashon = 0;
-				}
+// stride: pixels per output line
+static void emulatorUpdatePixelBufferQL(uint32_t *pixelPtr32, int stride,
+					uint8_t *emulatorScreenPtr,
+					uint8_t *emulatorScreenPtrEnd)
+{
+	uint64_t pair[64], dbl[8];
+	int row_pairs = qlscreen.xres / 8;
+	bool visible = curframe & BIT(5);
+	ql_flash fl = { false, 0, 0 };
+
+	if (!ql_luts_built)
+		ql_build_luts();
+	for (int a = 0; a < 8; a++) {
+		dbl[a] = ql_pixel_pair(SDLcolors[a], SDLcolors[a]);
+		for (int b = 0; b < 8; b++)
+			pair[a * 8 + b] = ql_pixel_pair(SDLcolors[a], SDLcolors[b]);
+	}
+
+	while (emulatorScreenPtr + 1 < emulatorScreenPtrEnd) {
+		const uint8_t *src = emulatorScreenPtr;
+		int pairs = (emulatorScreenPtrEnd - emulatorScreenPtr) / 2;
+		uint32_t *dst = pixelPtr32;
+		uint16_t flash = 0;
+
+		if (pairs > row_pairs)
+			pairs = row_pairs;
+		switch (display_mode) {
+		case 8:
+			for (int n = 0; n < pairs; n++, src += 2, dst += 8) {
+				uint16_t e = ql_mode8_lut[src[0] << 8 | src[1]];
+
+				flash |= e;
+				memcpy(dst, &dbl[e & 7], 8);
+				memcpy(dst + 2, &dbl[(e >> 3) & 7], 8);
+				memcpy(dst + 4, &dbl[(e >> 6) & 7], 8);
+				memcpy(dst + 6, &dbl[(e >> 9) & 7], 8);
 			}
+			// Flash only shows in half the frames, and only lines
+			// with a flash bit or flash carried into them change
+			if (!visible)
+				break;
+			if ((flash & 0xf000) || fl.on)
+				ql_flash_line(pixelPtr32, emulatorScreenPtr, pairs, &fl);
+			else
+				fl.pixels = (fl.pixels + 4 * pairs) & 255;
 			break;
 		case 1:
 		case 4:
-			for (int i = 7; i > -1; i--) {
-				uint8_t p1 = (t1 >> i) & 0x01;
-				uint8_t p2 = (t2 >> i) & 0x01;
-
-				int color = ((p1 & 1) << 2) + ((p2 & 1) << 1) +
-					    ((p1 & 1) & (p2 & 1));
+			for (int n = 0; n < pairs; n++, src += 2, dst += 8) {
+				const uint8_t *e = ql_mode4_lut[src[0] << 8 | src[1]];
 
-				uint32_t x = SDLcolors[color];
-
-				*pixelPtr32++ = x;
+				memcpy(dst, &pair[e[0]], 8);
+				memcpy(dst + 2, &pair[e[1]], 8);
+				memcpy(dst + 4, &pair[e[2]], 8);
+				memcpy(dst + 6, &pair[e[3]], 8);
 			}
 			break;
 		}
-#endif
+		emulatorScreenPtr += 2 * pairs;
+		pixelPtr32 += stride;
 	}
 
 	// frame counter for flash
 	curframe++;
 	curframe %= 64;
 }
-
-static void QLSDLUpdatePixelBuffer()
-{
-	if (SDL_MUSTLOCK(ql_screen)) {
-		SDL_LockSurface(ql_screen);
-	}
-
-#ifdef NEXTP8
-	uint8_t *emulatorScreenPtr = (uint8_t *)&frameBuffer[vfront];
-#else
-	uint8_t *emulatorScreenPtr = (uint8_t *)memBase + qlscreen.qm_lo;
 #endif
-	uint8_t *emulatorScreenPtrEnd = emulatorScreenPtr + qlscreen.qm_len;
-
-	emulatorUpdatePixelBufferQL(ql_screen->pixels, emulatorScreenPtr,
-				    emulatorScreenPtrEnd);
 
 #ifdef NEXTP8
+/*
+ * Frame snapshots.  At every 50Hz tick the emulator thread copies the
+ * displayed state into one of two frames and raises VBLANK; the SDL thread
+ * converts and presents the newest complete frame while emulation carries
+ * on.  A frame being converted is never overwritten: if the renderer is
+ * still busy with the slot due for reuse, that tick's snapshot is dropped.
+ */
+static nextp8_frame frames[2];
+static int frame_latest = -1;		/* newest complete frame */
+static int frame_reading = -1;		/* frame held by the renderer */
+static uint32_t frame_seq;
+static uint64_t frame_acquired_vblank;	/* vblank_time of the held frame */
+static SDL_SpinLock frame_lock;
+
+// End of a displayed frame: latch the requested front buffer and raise
+// the VBLANK interrupt
+static void QLSDLFrameDone(void)
+{
 	static bool debug_next;
 	if (vfront != vfrontreq || debug_next) {
 		//printf("VFRONT: %d VFRONTREQ: %d\n", vfront, vfrontreq);
 		debug_next = vfront != vfrontreq;
 	}
 	vfront = vfrontreq;
+#ifdef PROFILER
+	Profiler_RecordMarker(PROFILER_MARKER_VBLANK, 0);
+#endif
 	/* Trigger VBLANK interrupt if enabled */
-	if (vblank_intr_enable) {
-		pendingInterrupt = 2;  /* Level 2 interrupt */
-		extraFlag = true;
+	if (vblank_intr_enable)
+		RaiseInterrupt(2);
+}
+
+// Convert a whole frame to RGBA32 pixels; safe on any thread
+void QLSDLFramePixels(uint32_t *pixelPtr32, const nextp8_frame *f)
+{
+	nextp8UpdatePixelBuffer(pixelPtr32, 128, f, NULL);
+}
+
+// Time full-frame conversion of a random frame for each screen transform,
+// high colour mode and overlay setting, one JSON line per combination
+int QLSDLRenderBench(int frames)
+{
+	static const uint8_t transforms[] = {
+		0, 1, 2, 3, 5, 6, 7, 129, 130, 131, 133, 134, 135
+	};
+	static const uint8_t high_colours[] = { 0x00, 0x10, 0x20, 0x37 };
+	SDL_PixelFormat *format = SDL_AllocFormat(SDL_PIXELFORMAT_ARGB8888);
+	uint64_t hz = SDL_GetPerformanceFrequency();
+	static nextp8_frame f;
+	static uint32_t pixels[128 * 128];
+	uint32_t seed = 0x12345678, check = 0;
+
+	if (!format) {
+		fprintf(stderr, "Render bench: %s\n", SDL_GetError());
+		return 1;
+	}
+	QLSDLCreatePalette(format);
+	SDL_FreeFormat(format);
+
+	for (size_t i = 0; i < sizeof(f.fb) + sizeof(f.ov) + 48; i++) {
+		seed = seed * 1664525 + 1013904223;
+		// fb, ov, palette, secondary and bitfield are contiguous
+		((uint8_t *)&f)[i] = seed >> 24;
+	}
+
+	for (size_t t = 0; t < sizeof(transforms); t++) {
+		for (size_t h = 0; h < sizeof(high_colours); h++) {
+			for (int ov = 0; ov < 2; ov++) {
+				uint64_t start, ticks;
+				double s;
+
+				f.transform = transforms[t];
+				f.high_colour = high_colours[h];
+				f.overlay_control = ov ? _OVERLAY_ENABLE_BIT : 0;
+				nextp8UpdatePixelBuffer(pixels, 128, &f, NULL);
+
+				start = SDL_GetPerformanceCounter();
+				for (int i = 0; i < frames; i++) {
+					nextp8UpdatePixelBuffer(pixels, 128, &f, NULL);
+					check += pixels[i & 0x3fff];
+				}
+				ticks = SDL_GetPerformanceCounter() - start;
+				s = (double)ticks / hz;
+				printf("{\"transform\":%u,\"high_colour\":\"0x%02x\",\"overlay\":%d,"
+				       "\"frames\":%d,\"ns_per_pixel\":%.3f,\"mpixels_per_s\":%.1f}\n",
+				       f.transform, f.high_colour, ov, frames,
+				       s * 1e9 / ((double)frames * 128 * 128),
+				       s > 0 ? (double)frames * 128 * 128 / s / 1e6 : 0.0);
+			}
+		}
 	}
-#endif
+	// Keeps the conversions from being optimised away
+	if (V3)
+		printf("Render bench: checksum %08x\n", check);
+	return 0;
+}
+
+// Called on the emulator thread at each 50Hz tick
+void QLSDLVblank(void)
+{
+	static nextp8_frame capture;
+	int slot;
+	bool busy;
+
+	cartBenchFrame();
+	startupMark(STARTUP_FIRST_VBLANK);
+
+	SDL_AtomicLock(&frame_lock);
+	slot = frame_latest < 0 ? 0 : frame_latest ^ 1;
+	busy = frame_reading == slot;
+	SDL_AtomicUnlock(&frame_lock);
+
+	if (!busy) {
+		nextp8_frame *f = &frames[slot];
+
+		nextp8_frame_capture(f);
+		f->hash = nextp8_frame_hash(f);
+		nextp8_dirty_rows(f);
+		f->seq = ++frame_seq;
+		f->vblank_time = 0;
+		if (frame_stats_enabled) {
+			f->vblank_time = frameStatsNow();
+			frameStatsVblank(f->vblank_time);
+		}
+
+		if (video_capture_enabled)
+			videoCaptureFrame(f);
+		frameStreamFrame(f);
+
+		SDL_AtomicLock(&frame_lock);
+		frame_latest = slot;
+		SDL_AtomicUnlock(&frame_lock);
+	} else if (video_capture_enabled) {
+		// The recording must not drop frames the display skips
+		nextp8_frame_capture(&capture);
+		capture.hash = nextp8_frame_hash(&capture);
+		videoCaptureFrame(&capture);
+	}
+
+	QLSDLFrameDone();
+}
+
+// Newest complete frame, held until QLSDLFrameRelease(); NULL before the
+// first vblank
+const nextp8_frame *QLSDLFrameAcquire(void)
+{
+	int slot;
+
+	SDL_AtomicLock(&frame_lock);
+	slot = frame_reading = frame_latest;
+	SDL_AtomicUnlock(&frame_lock);
+
+	if (slot < 0)
+		return NULL;
+	frame_acquired_vblank = frames[slot].vblank_time;
+	return &frames[slot];
+}
+
+void QLSDLFrameRelease(void)
+{
+	SDL_AtomicLock(&frame_lock);
+	frame_reading = -1;
+	SDL_AtomicUnlock(&frame_lock);
+}
 
-	if (SDL_MUSTLOCK(ql_screen)) {
-		SDL_UnlockSurface(ql_screen);
+// Displayed colours of the frame palette (0-15) and of the overlay
+// indices (16-31), for renderers that resolve pixels themselves
+void QLSDLResolvePalette(const nextp8_frame *f, uint32_t pal[32])
+{
+	for (int i = 0; i < 16; i++) {
+		pal[i] = SDLcolors[color_index(f->palette[i])];
+		pal[16 + i] = SDLcolors[color_index(i)];
 	}
 }
 
-// Needed for the shader code
-void QLSDLWritePixels(uint32_t *pixelPtr32)
+// Convert the newest frame into the persistent pixel buffer, touching only
+// the lines that changed when no frame was missed since the last call.
+// With no buffer the frame goes straight into the streaming texture; its
+// locked pixels are write-only, so that is always a whole frame.
+// Returns false when the buffer already shows the same picture.
+static bool nextp8_render_latest(uint32_t *pixelPtr32)
+{
+	static uint32_t last_seq;
+	static uint64_t last_hash;
+	static bool drawn;
+	const nextp8_frame *f = QLSDLFrameAcquire();
+	bool changed = false;
+
+	if (f && f->seq != last_seq) {
+		bool incremental = !f->full && f->seq == last_seq + 1;
+
+		if (!drawn || f->hash != last_hash) {
+			void *pixels;
+			int pitch;
+
+			if (pixelPtr32) {
+				nextp8UpdatePixelBuffer(pixelPtr32, 128, f,
+							incremental ? f->rows : NULL);
+				changed = true;
+			} else if (SDL_LockTexture(ql_texture, NULL, &pixels,
+						   &pitch) == 0) {
+				nextp8UpdatePixelBuffer(pixels, pitch / 4, f, NULL);
+				SDL_UnlockTexture(ql_texture);
+				changed = true;
+			}
+			if (changed) {
+				last_hash = f->hash;
+				drawn = true;
+			}
+		}
+		last_seq = f->seq;
+	}
+	QLSDLFrameRelease();
+	return changed;
+}
+#endif
+
+// Render into the streaming texture; returns false when it did not change
+static bool QLSDLUpdatePixelBuffer()
 {
 #ifdef NEXTP8
-	uint8_t *emulatorScreenPtr = (uint8_t *)&frameBuffer[vfront];
+	return nextp8_render_latest(NULL);
 #else
 	uint8_t *emulatorScreenPtr = (uint8_t *)memBase + qlscreen.qm_lo;
-#endif
 	uint8_t *emulatorScreenPtrEnd = emulatorScreenPtr + qlscreen.qm_len;
+	void *pixels;
+	int pitch;
 
-	emulatorUpdatePixelBufferQL(pixelPtr32, emulatorScreenPtr,
+	if (SDL_LockTexture(ql_texture, NULL, &pixels, &pitch) != 0)
+		return false;
+	emulatorUpdatePixelBufferQL(pixels, pitch / 4, emulatorScreenPtr,
 				    emulatorScreenPtrEnd);
+	SDL_UnlockTexture(ql_texture);
+	return true;
+#endif
+}
 
+// Needed for the shader code; returns false when the pixels did not change
+bool QLSDLWritePixels(uint32_t *pixelPtr32)
+{
 #ifdef NEXTP8
-	static bool debug_next;
-	if (vfront != vfrontreq || debug_next) {
-		//printf("VFRONT: %d VFRONTREQ: %d\n", vfront, vfrontreq);
-		debug_next = vfront != vfrontreq;
-	}
-	vfront = vfrontreq;
-	/* Trigger VBLANK interrupt if enabled */
-	if (vblank_intr_enable) {
-		pendingInterrupt = 2;  /* Level 2 interrupt */
-		extraFlag = true;
-	}
+	return nextp8_render_latest(pixelPtr32);
+#else
+	uint8_t *emulatorScreenPtr = (uint8_t *)memBase + qlscreen.qm_lo;
+	uint8_t *emulatorScreenPtrEnd = emulatorScreenPtr + qlscreen.qm_len;
+
+	emulatorUpdatePixelBufferQL(pixelPtr32, qlscreen.xres, emulatorScreenPtr,
+				    emulatorScreenPtrEnd);
+	return true;
 #endif
 }
 
 void QLSDLRenderScreen(void)
 {
-	void *texture_buffer;
-	int pitch;
-	int w, h;
-	SDL_PixelFormat pixelformat;
-
-	SDL_UpdateTexture(ql_texture, NULL, ql_screen->pixels,
-			  ql_screen->pitch);
 	SDL_RenderClear(ql_renderer);
 	SDL_RenderCopyEx(ql_renderer, ql_texture, NULL, &dest_rect, 0, NULL,
 			 SDL_FLIP_NONE);
 	SDL_RenderPresent(ql_renderer);
 }
 
+// Unthrottled with audio muted; guest frames stay at 50Hz emulated
+static void QLSDLFastForward(bool on)
+{
+	SDL_DisplayMode mode;
+	int display = ql_window ? SDL_GetWindowDisplayIndex(ql_window) : 0;
+
+	if (ql_headless)
+		return;
+	if (display < 0 || SDL_GetCurrentDisplayMode(display, &mode) < 0)
+		mode.refresh_rate = 0;
+	pacerSetTurbo(on, mode.refresh_rate);
+	audioMixerMute(on);
+	if (V1)
+		printf("Fast forward %s\n", on ? "on" : "off");
+}
+
 void SDLQLFullScreen(void)
 {
 	int w, h;
@@ -891,14 +1355,40 @@ void SDLQLFullScreen(void)
 	}
 }
 
-static void QLSDLUpdateScreen()
+// force: present even if the frame is unchanged (window exposed/resized)
+static void QLSDLUpdateScreen(bool force)
 {
+	uint64_t render_start = 0, render_end = 0;
+	uint64_t vblank = 0;
+	bool changed;
+
+	if (ql_headless)
+		return;
+
 	renderer_idle = false;
+	if (frame_stats_enabled || metrics_enabled)
+		render_start = frameStatsNow();
 	if (shaders_selected) {
-		QLGPUUpdateDisplay();
+		changed = QLGPUUpdateDisplay(force);
 	} else {
-		QLSDLUpdatePixelBuffer();
-		QLSDLRenderScreen();
+		changed = QLSDLUpdatePixelBuffer();
+		if (frame_stats_enabled)
+			render_end = frameStatsNow();
+		if (changed || force)
+			QLSDLRenderScreen();
+	}
+	if (frame_stats_enabled) {
+		uint64_t present = frameStatsNow();
+
+#ifdef NEXTP8
+		vblank = frame_acquired_vblank;
+#endif
+		frameStatsFrame(vblank, render_start,
+				render_end ? render_end : present, present, changed);
+	}
+	if (metrics_enabled) {
+		metricAdd(changed || force ? METRIC_FRAMES_RENDERED : METRIC_FRAMES_SKIPPED, 1);
+		metricHist(METRIC_HIST_RENDER_US, metricsSinceUs(render_start));
 	}
 	renderer_idle = true;
 }
@@ -906,6 +1396,14 @@ static void QLSDLUpdateScreen()
 static void QLSDLInitJoystick(void)
 {
 #ifndef SDL_JOYSTICK_DISABLED
+	static bool done;
+
+	if (done || ql_headless)
+		return;
+	done = true;
+	if ((emulatorOptionInt("joy1") <= 0 && emulatorOptionInt("joy2") <= 0) ||
+	    SDL_InitSubSystem(SDL_INIT_JOYSTICK) < 0)
+		return;
 	// Open joystick 1 and 2, if defined
 	QLSDLOpenJoystick(0, emulatorOptionInt("joy1"));
 	QLSDLOpenJoystick(1, emulatorOptionInt("joy2"));
@@ -964,10 +1462,7 @@ unsigned int sdl_keyrow[32] = { 0, 0, 0, 0, 0, 0, 0, 0,
 							    0, 0, 0, 0, 0, 0, 0, 0,
 							    0, 0, 0, 0, 0, 0, 0, 0,
 							    0, 0, 0, 0, 0, 0, 0, 0 };
-unsigned int sdl_keyrow_latched[32] = { 0, 0, 0, 0, 0, 0, 0, 0,
-										0, 0, 0, 0, 0, 0, 0, 0,
-										0, 0, 0, 0, 0, 0, 0, 0,
-										0, 0, 0, 0, 0, 0, 0, 0 };
+SDL_atomic_t sdl_keyrow_latched[32];
 #else
 unsigned int sdl_keyrow[] = { 0, 0, 0, 0, 0, 0, 0, 0 };
 #endif
@@ -981,7 +1476,118 @@ int16_t sdl_mouse_z_accum = 0;  // 16-bit scroll accumulator
 int sdl_mouse_x_prev_scaled = 0;  // Where app thinks cursor is (1/4 pixel units)
 int sdl_mouse_y_prev_scaled = 0;  // Where app thinks cursor is (1/4 pixel units)
 unsigned int sdl_mouse_buttons = 0;
-unsigned int sdl_mouse_buttons_latched = 0;
+SDL_atomic_t sdl_mouse_buttons_latched;
+
+/*
+ * The guest reads a copy of the levels published under a sequence count
+ * (odd while the UI thread is writing).  Latch changes are collected per
+ * batch as bits to clear then set, and applied after the levels so that
+ * a latched bit is never seen ahead of its level.
+ */
+typedef struct {
+	unsigned int clear, set;
+} latch_change;
+
+static input_state input_shared, input_seen;
+static SDL_atomic_t input_seq;
+static int input_seen_seq;
+static SDL_SpinLock input_lock;
+static bool input_dirty;
+static uint64_t input_first;
+static latch_change keyrow_change[32], joy_change[2], mouse_change;
+
+static void inputChanged(void)
+{
+	if (!input_dirty) {
+		input_dirty = true;
+		input_first = metricsNow();
+	}
+}
+
+static void latchChange(latch_change *c, unsigned int clear, unsigned int set)
+{
+	c->clear |= clear;
+	c->set = (c->set & ~clear) | set;
+	inputChanged();
+}
+
+static void latchApply(SDL_atomic_t *latch, latch_change *c)
+{
+	int v;
+
+	if (!c->clear && !c->set)
+		return;
+	do
+		v = SDL_AtomicGet(latch);
+	while (!SDL_AtomicCAS(latch, v, (v & ~c->clear) | c->set));
+	c->clear = c->set = 0;
+}
+
+void inputPublish(void)
+{
+	if (!input_dirty)
+		return;
+	SDL_AtomicLock(&input_lock);
+	SDL_AtomicAdd(&input_seq, 1);
+	memcpy(input_shared.keyrow, sdl_keyrow, sizeof(input_shared.keyrow));
+	memcpy(input_shared.joy, joy_state, sizeof(input_shared.joy));
+	input_shared.mouse_buttons = sdl_mouse_buttons;
+	input_shared.mouse_x = sdl_mouse_x_accum;
+	input_shared.mouse_y = sdl_mouse_y_accum;
+	input_shared.mouse_z = sdl_mouse_z_accum;
+	input_shared.time = input_first;
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicAdd(&input_seq, 1);
+	for (int i = 0; i < 32; i++)
+		latchApply(&sdl_keyrow_latched[i], &keyrow_change[i]);
+	latchApply(&joy_latched[0], &joy_change[0]);
+	latchApply(&joy_latched[1], &joy_change[1]);
+	latchApply(&sdl_mouse_buttons_latched, &mouse_change);
+	input_dirty = false;
+	SDL_AtomicUnlock(&input_lock);
+}
+
+const input_state *inputSnapshot(void)
+{
+	int seq = SDL_AtomicGet(&input_seq);
+
+	if (likely(seq == input_seen_seq))
+		return &input_seen;
+	for (;;) {
+		if (!(seq & 1)) {
+			memcpy(&input_seen, &input_shared, sizeof(input_seen));
+			SDL_MemoryBarrierAcquire();
+			if (SDL_AtomicGet(&input_seq) == seq)
+				break;
+		}
+		seq = SDL_AtomicGet(&input_seq);
+	}
+	input_seen_seq = seq;
+	metricHist(METRIC_HIST_INPUT_US, metricsSinceUs(input_seen.time));
+	return &input_seen;
+}
+
+void inputLatchSet(SDL_atomic_t *latch, unsigned int bits)
+{
+	latch_change *c;
+
+	if (latch == &sdl_mouse_buttons_latched)
+		c = &mouse_change;
+	else if (latch == &joy_latched[0] || latch == &joy_latched[1])
+		c = &joy_change[latch - joy_latched];
+	else
+		c = &keyrow_change[latch - sdl_keyrow_latched];
+	latchChange(c, 0, bits);
+}
+
+void inputLatchClear(SDL_atomic_t *latch, unsigned int bits)
+{
+	int v;
+
+	do
+		v = SDL_AtomicGet(latch);
+	while (!SDL_AtomicCAS(latch, v, v & ~bits));
+}
 #endif
 
 void SDLQLKeyrowChg(int code, int press)
@@ -997,12 +1603,15 @@ void SDLQLKeyrowChg(int code, int press)
 	if (press) {
 #ifdef NEXTP8
 		if (!(sdl_keyrow[row] & col))
-			sdl_keyrow_latched[row] |= col;
+			latchChange(&keyrow_change[row], 0, col);
 #endif
 		sdl_keyrow[row] |= col;
 	} else {
 		sdl_keyrow[row] &= ~col;
 	}
+#ifdef NEXTP8
+	inputChanged();
+#endif
 }
 
 // Adjust for Windows and X11 generating different scan codes for dead keys
@@ -1447,8 +2056,30 @@ static struct SDLQLMap sdlqlmap_default[] = { { SDLK_LEFT, QL_LEFT },
 #endif
 
 /* Save screenshot to PNG file with unique filename */
+typedef struct {
+	char filename[256];
+	SDL_Surface *surface;
+} png_job;
+
+/* IO worker: encode and save a screenshot */
+static void SDL2WriteScreenshot(void *arg)
+{
+	png_job *job = arg;
+
+	if (IMG_SavePNG(job->surface, job->filename) == 0) {
+		printf("Screenshot saved: %s\n", job->filename);
+	} else {
+		fprintf(stderr, "Screenshot: failed to save %s: %s\n", job->filename, IMG_GetError());
+	}
+	SDL_FreeSurface(job->surface);
+	free(job);
+}
+
 static void SDL2SaveScreenshot(void)
 {
+	static time_t last_now;
+	static int last_counter;
+
 	if (!ql_renderer || !ql_window) {
 		fprintf(stderr, "Screenshot: renderer not initialized\n");
 		return;
@@ -1458,7 +2089,8 @@ static void SDL2SaveScreenshot(void)
 	time_t now = time(NULL);
 	struct tm *t = localtime(&now);
 	char filename[256];
-	int counter = 0;
+	/* Earlier shots this second may not be on disk yet */
+	int counter = now == last_now ? last_counter + 1 : 0;
 
 	/* Find unique filename */
 	do {
@@ -1486,6 +2118,8 @@ static void SDL2SaveScreenshot(void)
 		fprintf(stderr, "Screenshot: too many files with same timestamp\n");
 		return;
 	}
+	last_now = now;
+	last_counter = counter - 1;
 
 	/* Get window surface dimensions */
 	int width, height;
@@ -1507,36 +2141,29 @@ static void SDL2SaveScreenshot(void)
 		return;
 	}
 
-	/* Save to PNG */
-	if (IMG_SavePNG(screenshot, filename) == 0) {
-		printf("Screenshot saved: %s\n", filename);
-	} else {
-		fprintf(stderr, "Screenshot: failed to save %s: %s\n", filename, IMG_GetError());
+	/* Encode and save to PNG in the background */
+	png_job *job = malloc(sizeof(*job));
+	if (!job) {
+		SDL_FreeSurface(screenshot);
+		return;
 	}
-
-	/* Clean up */
-	SDL_FreeSurface(screenshot);
+	snprintf(job->filename, sizeof(job->filename), "%s", filename);
+	job->surface = screenshot;
+	ioWorkerSubmit(SDL2WriteScreenshot, job);
 }
 
-/* FuncVal testbench screenshot - saves to specific filename */
-void QLSDLSaveFuncvalScreenshot(const char *filename)
-{
 #ifdef NEXTP8
-	/* Get native framebuffer data */
-	uint8_t *emulatorScreenPtr = (uint8_t *)&frameBuffer[vfront];
-	uint8_t *emulatorScreenPtrEnd = emulatorScreenPtr + qlscreen.qm_len;
+typedef struct {
+	char filename[256];
+	uint32_t pixels[128 * 128];
+} ppm_job;
 
-	/* Create native resolution pixel buffer (128x128) */
+/* IO worker: write a native resolution frame as a 6x scaled PPM */
+static void QLSDLWriteFuncvalScreenshot(void *arg)
+{
+	ppm_job *job = arg;
 	const int native_width = 128;
 	const int native_height = 128;
-	uint32_t *native_pixels = malloc(native_width * native_height * sizeof(uint32_t));
-	if (!native_pixels) {
-		fprintf(stderr, "FuncVal screenshot: failed to allocate native buffer\n");
-		return;
-	}
-
-	/* Convert framebuffer to 32-bit RGBA pixels */
-	emulatorUpdatePixelBufferQL(native_pixels, emulatorScreenPtr, emulatorScreenPtrEnd);
 
 	/* Scale up 6x to 768x768 */
 	const int scale = 6;
@@ -1544,10 +2171,10 @@ void QLSDLSaveFuncvalScreenshot(const char *filename)
 	const int output_height = native_height * scale;
 
 	/* Save to PPM (P3 ASCII format) */
-	FILE *f = fopen(filename, "w");
+	FILE *f = fopen(job->filename, "w");
 	if (!f) {
-		fprintf(stderr, "FuncVal screenshot: failed to open %s\n", filename);
-		free(native_pixels);
+		fprintf(stderr, "FuncVal screenshot: failed to open %s\n", job->filename);
+		free(job);
 		return;
 	}
 
@@ -1559,7 +2186,7 @@ void QLSDLSaveFuncvalScreenshot(const char *filename)
 		int native_y = y / scale;
 		for (int x = 0; x < output_width; x++) {
 			int native_x = x / scale;
-			uint32_t rgba = native_pixels[native_y * native_width + native_x];
+			uint32_t rgba = job->pixels[native_y * native_width + native_x];
 
 			/* Extract BGR from RGBA8888 (stored as BGRA in memory) and swap to RGB for PPM */
 			uint8_t b = (rgba >> 16) & 0xFF;
@@ -1572,8 +2199,60 @@ void QLSDLSaveFuncvalScreenshot(const char *filename)
 	}
 
 	fclose(f);
-	free(native_pixels);
-	printf("Screenshot saved: %s\n", filename);
+	printf("Screenshot saved: %s\n", job->filename);
+	free(job);
+}
+#endif
+
+/* FuncVal testbench screenshot - saves to specific filename */
+void QLSDLSaveFuncvalScreenshot(const char *filename)
+{
+#ifdef NEXTP8
+	/* Snapshot of the live display state */
+	static nextp8_frame live;
+	nextp8_frame_capture(&live);
+
+	ppm_job *job = malloc(sizeof(*job));
+	if (!job) {
+		fprintf(stderr, "FuncVal screenshot: failed to allocate native buffer\n");
+		return;
+	}
+	snprintf(job->filename, sizeof(job->filename), "%s", filename);
+
+	/* Convert framebuffer to 32-bit RGBA pixels; scaling and file
+	   output happen on the IO worker */
+	nextp8UpdatePixelBuffer(job->pixels, 128, &live, NULL);
+	ioWorkerSubmit(QLSDLWriteFuncvalScreenshot, job);
+#endif
+}
+
+#ifdef NEXTP8
+/* RGBA8888 to 0RGB (12-bit) */
+static uint16_t rgbaTo0RGB(uint32_t rgba)
+{
+	uint8_t b = (rgba >> 16) & 0xFF;
+	uint8_t g = (rgba >> 8) & 0xFF;
+	uint8_t r = rgba & 0xFF;
+
+	return ((r >> 4) << 8) | ((g >> 4) << 4) | (b >> 4);
+}
+#endif
+
+/* The rendered 128x128 frame in 0RGB format, for the FuncVal frame capture */
+int QLSDLCaptureFramebuffer(uint16_t *pixels)
+{
+#ifdef NEXTP8
+	static nextp8_frame live;
+	static uint32_t native_pixels[128 * 128];
+	int i;
+
+	nextp8_frame_capture(&live);
+	nextp8UpdatePixelBuffer(native_pixels, 128, &live, NULL);
+	for (i = 0; i < 128 * 128; i++)
+		pixels[i] = rgbaTo0RGB(native_pixels[i]);
+	return 0;
+#else
+	return -1;
 #endif
 }
 
@@ -1582,11 +2261,12 @@ void QLSDLSaveFuncvalScreenshot(const char *filename)
 int QLSDLReadFramebufferPixel(int x, int y, uint16_t *pixel)
 {
 #ifdef NEXTP8
-	printf("Read framebuffer pixel at (%d, %d)\n", x, y);
+	if (V3)
+		printf("Read framebuffer pixel at (%d, %d)\n", x, y);
 
-	/* Get native framebuffer data */
-	uint8_t *emulatorScreenPtr = (uint8_t *)&frameBuffer[vfront];
-	uint8_t *emulatorScreenPtrEnd = emulatorScreenPtr + qlscreen.qm_len;
+	/* Snapshot of the live display state */
+	static nextp8_frame live;
+	nextp8_frame_capture(&live);
 
 	/* Create native resolution pixel buffer (128x128) */
 	const int native_width = 128;
@@ -1611,24 +2291,15 @@ int QLSDLReadFramebufferPixel(int x, int y, uint16_t *pixel)
 	}
 
 	/* Convert framebuffer to 32-bit RGBA pixels */
-	emulatorUpdatePixelBufferQL(native_pixels, emulatorScreenPtr, emulatorScreenPtrEnd);
+	nextp8UpdatePixelBuffer(native_pixels, 128, &live, NULL);
 
 	/* Get pixel at native coordinates */
 	uint32_t rgba = native_pixels[native_y * native_width + native_x];
 
-	/* Convert from RGBA8888 to 0RGB (12-bit) */
-	uint8_t b = (rgba >> 16) & 0xFF;
-	uint8_t g = (rgba >> 8) & 0xFF;
-	uint8_t r = rgba & 0xFF;
-
-	/* Convert 8-bit to 4-bit per channel */
-	r = r >> 4;
-	g = g >> 4;
-	b = b >> 4;
-		/* Pack as 0RGB */
-	*pixel = ((r & 0xF) << 8) | ((g & 0xF) << 4) | (b & 0xF);
+	*pixel = rgbaTo0RGB(rgba);
 
-	printf("Read pixel RGBA: %08x -> 0RGB: %03X\n", rgba, *pixel);
+	if (V3)
+		printf("Read pixel RGBA: %08x -> 0RGB: %03X\n", rgba, *pixel);
 
 	free(native_pixels);
 	return 0;
@@ -1934,10 +2605,34 @@ void QLSDProcessKey(SDL_Keysym *keysym, int pressed)
 			}
 		}
 		return;
+#ifdef NEXTP8
+	case SDLK_F9:
+		// Left to the guest when rewind is off, netplay's own
+		if (rewindEnabled() && !netplay_on) {
+			if (pressed)
+				rewindRequest(1);
+			return;
+		}
+		break;
+#endif
+	case SDLK_F10:
+		if (pressed)
+			QLSDLFastForward(!pacerTurbo());
+		return;
 	case SDLK_F11:
 		if (pressed)
 			SDLQLFullScreen();
 		return;
+#ifdef PROFILER
+	case SDLK_F12:
+		// Plain F12 is the guest's
+		if (sdl_controlstate) {
+			if (pressed)
+				Profiler_Toggle();
+			return;
+		}
+		break;
+#endif
 	}
 
 	// Reset the search
@@ -1963,6 +2658,16 @@ void QLSDProcessKey(SDL_Keysym *keysym, int pressed)
 	}
 }
 
+#ifdef NEXTP8
+int QLSDLKeyCode(SDL_Keycode key)
+{
+	for (int i = 0; sdlqlmap_default[i].sdl_kc != 0; i++)
+		if (sdlqlmap_default[i].sdl_kc == key)
+			return sdlqlmap_default[i].code;
+	return -1;
+}
+#endif
+
 static void setKeyboardLayout(void)
 {
 	const char *kbd_string = emulatorOptionString("kbd");
@@ -2085,10 +2790,10 @@ static void QLProcessJoystickAxis(Sint32 which, Uint8 axis, Sint16 value)
 #ifdef NEXTP8
 				if (offset == 2) {
 					joy_state[index] = (joy_state[index] & ~0x03) | 0x01; // Up
-					joy_latched[index] = (joy_latched[index] & ~0x03) | 0x01;
+					latchChange(&joy_change[index], 0x03, 0x01);
 				} else {
 					joy_state[index] = (joy_state[index] & ~0x0c) | 0x04; // Left
-					joy_latched[index] = (joy_latched[index] & ~0x0c) | 0x04;
+					latchChange(&joy_change[index], 0x0c, 0x04);
 				}
 #else
 				queueKey(0, joy_char[index][offset], 0);
@@ -2099,10 +2804,10 @@ static void QLProcessJoystickAxis(Sint32 which, Uint8 axis, Sint16 value)
 #ifdef NEXTP8
 				if (offset == 2) {
 					joy_state[index] = (joy_state[index] & ~0x03) | 0x02; // Down
-					joy_latched[index] = (joy_latched[index] & ~0x03) | 0x02;
+					latchChange(&joy_change[index], 0x03, 0x02);
 				} else {
 					joy_state[index] = (joy_state[index] & ~0x0c) | 0x08; // Right
-					joy_latched[index] = (joy_latched[index] & ~0x0c) | 0x08;
+					latchChange(&joy_change[index], 0x0c, 0x08);
 				}
 #else
 				queueKey(0, joy_char[index][offset + 1], 0);
@@ -2113,10 +2818,10 @@ static void QLProcessJoystickAxis(Sint32 which, Uint8 axis, Sint16 value)
 #ifdef NEXTP8
 				if (offset == 2) {
 					joy_state[index] = (joy_state[index] & ~0x03); // Center vertical
-					joy_latched[index] = (joy_latched[index] & ~0x03);
+					latchChange(&joy_change[index], 0x03, 0);
 				} else {
 					joy_state[index] = (joy_state[index] & ~0x0c); // Center horizontal
-					joy_latched[index] = (joy_latched[index] & ~0x0c);
+					latchChange(&joy_change[index], 0x0c, 0);
 				}
 #else
 				SDLQLKeyrowChg(joy_char[index][offset], 0);
@@ -2134,7 +2839,7 @@ static void QLProcessJoystickButton(Sint32 which, Sint16 button, Sint16 pressed)
 	if (index > -1) {
 #ifdef NEXTP8
 		joy_state[index] = (joy_state[index] & ~(1 << (4 + button))) | ((pressed ? 1 : 0) << (4 + button));
-		joy_latched[index] = (joy_latched[index] & ~(1 << (4 + button))) | ((pressed ? 1 : 0) << (4 + button));
+		latchChange(&joy_change[index], 1 << (4 + button), (pressed ? 1 : 0) << (4 + button));
 #else
 		// Allow any button to represent fire
 		if (pressed)
@@ -2144,64 +2849,56 @@ static void QLProcessJoystickButton(Sint32 which, Sint16 button, Sint16 pressed)
 	}
 }
 
-void QLSDLProcessEvents(void)
+// False when the emulator should exit
+static bool QLSDLHandleEvent(SDL_Event *event)
 {
-	SDL_Event event;
-	int keypressed;
-	int w, h;
-
-#if __EMSCRIPTEN__
-	if (!SDL_PollEvent(&event)) {
-		return;
-	}
-#else
-	while (1) {
-		if (!SDL_PollEvent(&event)) {
-			continue;
-		}
-#endif
-	switch (event.type) {
+	switch (event->type) {
 	case SDL_KEYDOWN:
-		QLSDProcessKey(&event.key.keysym, 1);
+		frameStatsInput();
+		QLSDProcessKey(&event->key.keysym, 1);
 		break;
 	case SDL_KEYUP:
-		QLSDProcessKey(&event.key.keysym, 0);
+		frameStatsInput();
+		QLSDProcessKey(&event->key.keysym, 0);
 		break;
 #ifndef SDL_JOYSTICK_DISABLED
 	case SDL_JOYAXISMOTION:
-		QLProcessJoystickAxis(event.jaxis.which, event.jaxis.axis,
-				      event.jaxis.value);
+		frameStatsInput();
+		QLProcessJoystickAxis(event->jaxis.which, event->jaxis.axis,
+				      event->jaxis.value);
 
 		break;
 	case SDL_JOYBUTTONDOWN:
-		QLProcessJoystickButton(event.jbutton.which,
-					event.jbutton.button, 1);
+		frameStatsInput();
+		QLProcessJoystickButton(event->jbutton.which,
+					event->jbutton.button, 1);
 		break;
 	case SDL_JOYBUTTONUP:
-		QLProcessJoystickButton(event.jbutton.which,
-					event.jbutton.button, 0);
+		frameStatsInput();
+		QLProcessJoystickButton(event->jbutton.which,
+					event->jbutton.button, 0);
 		break;
 #endif
 	case SDL_QUIT:
-		return;
+		return false;
 		break;
 	case SDL_MOUSEMOTION:
-		QLProcessMouse(event.motion.x, event.motion.y);
+		QLProcessMouse(event->motion.x, event->motion.y);
 #ifdef NEXTP8
 		// Handle mouse motion with 1/4 pixel precision
 		int mouse_xrel_scaled, mouse_yrel_scaled;
 		// Check if cursor is within the window bounds
-		if (event.motion.x >= dest_rect.x && event.motion.x <= (dest_rect.w + dest_rect.x) &&
-		    event.motion.y >= dest_rect.y && event.motion.y <= (dest_rect.h + dest_rect.y)) {
+		if (event->motion.x >= dest_rect.x && event->motion.x <= (dest_rect.w + dest_rect.x) &&
+		    event->motion.y >= dest_rect.y && event->motion.y <= (dest_rect.h + dest_rect.y)) {
 			// Inside window: use absolute position
-			int mouse_x_scaled = (event.motion.x - dest_rect.x) * 4 * 128 / dest_rect.w;
-			int mouse_y_scaled = (event.motion.y - dest_rect.y) * 4 * 128 / dest_rect.h;
+			int mouse_x_scaled = (event->motion.x - dest_rect.x) * 4 * 128 / dest_rect.w;
+			int mouse_y_scaled = (event->motion.y - dest_rect.y) * 4 * 128 / dest_rect.h;
 			mouse_xrel_scaled = mouse_x_scaled - sdl_mouse_x_prev_scaled;
 			mouse_yrel_scaled = mouse_y_scaled - sdl_mouse_y_prev_scaled;
 		} else {
 			// Outside window: use relative movement
-			mouse_xrel_scaled = event.motion.xrel * 4 * 128 / dest_rect.w;
-			mouse_yrel_scaled = event.motion.yrel * 4 * 128 / dest_rect.h;
+			mouse_xrel_scaled = event->motion.xrel * 4 * 128 / dest_rect.w;
+			mouse_yrel_scaled = event->motion.yrel * 4 * 128 / dest_rect.h;
 		}
 		sdl_mouse_x_accum += mouse_xrel_scaled;
 		sdl_mouse_y_accum += mouse_yrel_scaled;
@@ -2212,40 +2909,41 @@ void QLSDLProcessEvents(void)
 		if (sdl_mouse_x_prev_scaled >= 128 * 4) sdl_mouse_x_prev_scaled = 128 * 4 - 1;
 		if (sdl_mouse_y_prev_scaled < 0) sdl_mouse_y_prev_scaled = 0;
 		if (sdl_mouse_y_prev_scaled >= 128 * 4) sdl_mouse_y_prev_scaled = 128 * 4 - 1;
+		inputChanged();
 #endif
 		//inside=1;
 		break;
 	case SDL_MOUSEBUTTONDOWN:
-		QLButton(event.button.button, 1);
+		QLButton(event->button.button, 1);
 #ifdef NEXTP8
-		switch (event.button.button) {
+		switch (event->button.button) {
 		case SDL_BUTTON_LEFT:
 			sdl_mouse_buttons |= 0x01;
-			sdl_mouse_buttons_latched |= 0x01;
+			latchChange(&mouse_change, 0, 0x01);
 			break;
 		case SDL_BUTTON_RIGHT:
 			sdl_mouse_buttons |= 0x02;
-			sdl_mouse_buttons_latched |= 0x02;
+			latchChange(&mouse_change, 0, 0x02);
 			break;
 		case SDL_BUTTON_MIDDLE:
 			sdl_mouse_buttons |= 0x04;
-			sdl_mouse_buttons_latched |= 0x04;
+			latchChange(&mouse_change, 0, 0x04);
 			break;
 		case SDL_BUTTON_X1:
 			sdl_mouse_buttons |= 0x08;
-			sdl_mouse_buttons_latched |= 0x08;
+			latchChange(&mouse_change, 0, 0x08);
 			break;
 		case SDL_BUTTON_X2:
 			sdl_mouse_buttons |= 0x10;
-			sdl_mouse_buttons_latched |= 0x10;
+			latchChange(&mouse_change, 0, 0x10);
 			break;
 		}
 #endif
 		break;
 	case SDL_MOUSEBUTTONUP:
-		QLButton(event.button.button, 0);
+		QLButton(event->button.button, 0);
 #ifdef NEXTP8
-		switch (event.button.button) {
+		switch (event->button.button) {
 		case SDL_BUTTON_LEFT:
 			sdl_mouse_buttons &= ~0x01;
 			break;
@@ -2262,17 +2960,19 @@ void QLSDLProcessEvents(void)
 			sdl_mouse_buttons &= ~0x10;
 			break;
 		}
+		inputChanged();
 #endif
 		break;
 #ifdef NEXTP8
 	case SDL_MOUSEWHEEL:
 		// Accumulate scroll wheel into z position
-		sdl_mouse_z_accum += event.wheel.y;
+		sdl_mouse_z_accum += event->wheel.y;
+		inputChanged();
 		break;
 #endif
 	case SDL_WINDOWEVENT:
-		if (event.window.windowID == ql_windowid) {
-			switch (event.window.event) {
+		if (event->window.windowID == ql_windowid) {
+			switch (event->window.event) {
 			case SDL_WINDOWEVENT_ENTER:
 				SDL_ShowCursor(SDL_DISABLE);
 				break;
@@ -2281,32 +2981,65 @@ void QLSDLProcessEvents(void)
 				break;
 			case SDL_WINDOWEVENT_RESIZED:
 				if (shaders_selected)
-					QLGPUSetSize(event.window.data1,
-						     event.window.data2);
-				QLSDLUpdateScreen();
+					QLGPUSetSize(event->window.data1,
+						     event->window.data2);
+				QLSDLUpdateScreen(true);
 				break;
 			case SDL_WINDOWEVENT_SIZE_CHANGED:
 				break;
 			case SDL_WINDOWEVENT_EXPOSED:
-				QLSDLUpdateScreen();
+				QLSDLUpdateScreen(true);
 				break;
 			}
 		}
 		break;
 	case SDL_USEREVENT:
-		switch (event.user.code) {
+		switch (event->user.code) {
 		case USER_CODE_SCREENREFRESH:
-			QLSDLUpdateScreen();
+			// vsync pacing needs every present to block on the display
+			QLSDLUpdateScreen(pacer_vsync);
+			if (pacer_vsync)
+				pacerPresented();
 			break;
 		case USER_CODE_EMUEXIT:
-			return;
+			return false;
 		}
 		break;
 	default:
 		break;
 	}
-#if !__EMSCRIPTEN__
+	return true;
 }
+
+/*
+ * Handles everything queued, then publishes the input once for the whole
+ * batch.  The guest sees input as often as events arrive, not per frame.
+ */
+void QLSDLProcessEvents(void)
+{
+	SDL_Event event;
+	bool running = true;
+
+	// Left until the emulator is running, device discovery is slow
+	QLSDLInitJoystick();
+#if __EMSCRIPTEN__
+	while (running && SDL_PollEvent(&event))
+		running = QLSDLHandleEvent(&event);
+#ifdef NEXTP8
+	inputPublish();
+#endif
+#else
+	while (running) {
+		if (ql_headless ? !SDL_WaitEvent(&event) : !SDL_PollEvent(&event)) {
+			continue;
+		}
+		do
+			running = QLSDLHandleEvent(&event);
+		while (running && SDL_PollEvent(&event));
+#ifdef NEXTP8
+		inputPublish();
+#endif
+	}
 #endif
 }
 
@@ -2321,10 +3054,19 @@ void QLSDLExit(void)
 	}
 #endif
 
-	SDL_RemoveTimer(fiftyhz_timer);
+	pacerStop();
+#ifdef NEXTP8
+	videoCaptureStop();
+	frameStreamStop();
+#endif
+	ioWorkerFlush();
 	if (shaders_selected) {
 		QLGPUClean();
 	}
+	frameStatsDump();
+	audioStatsDump();
+	cartBenchDump();
+	startupTimingDump();
 }
 
 Uint32 QLSDL50Hz(Uint32 interval, void *param)
@@ -2338,7 +3080,7 @@ Uint32 QLSDL50Hz(Uint32 interval, void *param)
 		SDL_SemPost(sem50Hz);
 	}
 
-	if (renderer_idle) {
+	if (renderer_idle && !ql_headless && (!pacerTurbo() || pacerTurboFrame())) {
 		event.user.type = SDL_USEREVENT;
 		event.user.code = USER_CODE_SCREENREFRESH;
 		event.user.data1 = NULL;
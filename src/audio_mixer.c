@@ -0,0 +1,258 @@
+/*
+ * audio_mixer.c
+ *
+ * The shared audio device, see audio_mixer.h.  Each source renders into
+ * its own scratch buffer, the buffers are summed into 32 bits and
+ * clamped back to 16; both loops are plain enough for the compiler to
+ * vectorise.  Sources are only ever added, so the callback reads the
+ * table without a lock.
+ */
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_mixer.h"
+#include "thread_policy.h"
+#ifdef AUDIO_WORKLET
+#include "wasm_support.h"
+#endif
+
+#define MAX_SOURCES	4
+#define MIX_CHUNK	1024	/* samples mixed at a time */
+
+static audio_source_fn sources[MAX_SOURCES];
+static SDL_atomic_t source_count;
+static SDL_atomic_t muted;
+
+static SDL_AudioDeviceID mixer_dev;
+static SDL_AudioSpec mixer_have;
+static bool mixer_open;
+
+/* No device: the callback is run from a thread instead */
+static SDL_Thread *mixer_thread;
+static SDL_atomic_t mixer_stopping;
+static SDL_mutex *mixer_lock;
+
+static void mixChunk(int16_t *out, int n)
+{
+	int16_t buf[MIX_CHUNK];
+	int32_t acc[MIX_CHUNK];
+	int count = SDL_AtomicGet(&source_count);
+	bool any = false;
+
+	for (int s = 0; s < count; s++) {
+		if (!sources[s](buf, n))
+			continue;
+		if (!any) {
+			for (int i = 0; i < n; i++)
+				acc[i] = buf[i];
+			any = true;
+		} else {
+			for (int i = 0; i < n; i++)
+				acc[i] += buf[i];
+		}
+	}
+	if (!any || SDL_AtomicGet(&muted)) {
+		memset(out, 0, n * sizeof(*out));
+		return;
+	}
+	for (int i = 0; i < n; i++) {
+		int32_t v = acc[i];
+
+		out[i] = v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+	}
+}
+
+static void mixerCallback(void *userdata, Uint8 *stream, int len)
+{
+	static SDL_threadID placed;
+	int16_t *out = (int16_t *)stream;
+	int samples = len / (int)sizeof(int16_t);
+
+	(void)userdata;
+	/* SDL's device thread is its own; each one running this is set up once */
+	if (placed != SDL_ThreadID()) {
+		placed = SDL_ThreadID();
+		threadPolicyApply(THREAD_AUDIO);
+	}
+	while (samples > 0) {
+		int n = samples < MIX_CHUNK ? samples : MIX_CHUNK;
+
+		mixChunk(out, n);
+		out += n;
+		samples -= n;
+	}
+}
+
+static int mixerThread(void *arg)
+{
+	int samples = mixer_have.samples;
+	int16_t *buf = malloc(samples * sizeof(*buf));
+	uint64_t start = SDL_GetPerformanceCounter(), done = 0;
+	uint64_t freq = SDL_GetPerformanceFrequency();
+
+	(void)arg;
+	if (!buf)
+		return 0;
+	while (!SDL_AtomicGet(&mixer_stopping)) {
+		uint64_t due = (SDL_GetPerformanceCounter() - start) *
+			       mixer_have.freq / freq;
+
+		if (done >= due) {
+			SDL_Delay(samples * 1000 / mixer_have.freq / 2 + 1);
+			continue;
+		}
+		SDL_LockMutex(mixer_lock);
+		mixerCallback(NULL, (Uint8 *)buf, samples * sizeof(*buf));
+		SDL_UnlockMutex(mixer_lock);
+		done += samples;
+	}
+	free(buf);
+	return 0;
+}
+
+#ifdef AUDIO_WORKLET
+/* Browser: the mixer thread keeps a ring filled that an AudioWorklet
+   plays, so a busy main thread no longer starves the audio */
+#define WORKLET_RING	8192	/* samples, power of two */
+
+static int16_t worklet_ring[WORKLET_RING];
+static SDL_atomic_t worklet_pos[2];	/* read by the worklet, written here */
+
+static int mixerWorkletThread(void *arg)
+{
+	int samples = mixer_have.samples;
+	unsigned ahead = samples * 4 < WORKLET_RING ? samples * 4 : WORKLET_RING;
+	int16_t *buf = malloc(samples * sizeof(*buf));
+
+	(void)arg;
+	if (!buf)
+		return 0;
+	while (!SDL_AtomicGet(&mixer_stopping)) {
+		unsigned head = (unsigned)SDL_AtomicGet(&worklet_pos[0]);
+		unsigned tail = (unsigned)SDL_AtomicGet(&worklet_pos[1]);
+
+		if (tail - head + samples > ahead) {
+			SDL_Delay(samples * 1000 / mixer_have.freq / 2 + 1);
+			continue;
+		}
+		SDL_LockMutex(mixer_lock);
+		mixerCallback(NULL, (Uint8 *)buf, samples * sizeof(*buf));
+		SDL_UnlockMutex(mixer_lock);
+		for (int i = 0; i < samples; i++)
+			worklet_ring[(tail + i) & (WORKLET_RING - 1)] = buf[i];
+		SDL_AtomicSet(&worklet_pos[1], (int)(tail + samples));
+	}
+	free(buf);
+	return 0;
+}
+#endif
+
+void audioMixerInit(int samples)
+{
+	SDL_AudioSpec want;
+
+	if (mixer_open)
+		return;
+	mixer_open = true;
+
+	SDL_zero(want);
+	want.freq = AUDIO_MIXER_RATE;
+	want.format = AUDIO_S16SYS;
+	want.channels = 1;
+	want.samples = samples > 0 ? samples : 1024;
+	want.callback = mixerCallback;
+
+#ifdef AUDIO_WORKLET
+	if (wasm_audio_start(worklet_ring, worklet_pos, WORKLET_RING,
+			     AUDIO_MIXER_RATE) == 0) {
+		mixer_have = want;
+		mixer_lock = SDL_CreateMutex();
+		SDL_AtomicSet(&mixer_stopping, 0);
+		mixer_thread = SDL_CreateThread(mixerWorkletThread, "sQLux Audio", NULL);
+		if (mixer_thread)
+			return;
+		fprintf(stderr, "Audio: mixer thread creation failed: %s\n", SDL_GetError());
+		wasm_audio_stop();
+	} else {
+		fprintf(stderr, "Audio: no AudioWorklet with shared memory, using SDL audio\n");
+	}
+#endif
+	if (SDL_InitSubSystem(SDL_INIT_AUDIO) == 0)
+		// SDL converts if need be: p8audio is generated at this rate
+		mixer_dev = SDL_OpenAudioDevice(NULL, 0, &want, &mixer_have, 0);
+	if (mixer_dev) {
+		SDL_PauseAudioDevice(mixer_dev, 0);
+		return;
+	}
+
+	fprintf(stderr, "Audio: no device (%s), mixing without output\n", SDL_GetError());
+	mixer_have = want;
+	mixer_lock = SDL_CreateMutex();
+	SDL_AtomicSet(&mixer_stopping, 0);
+	mixer_thread = SDL_CreateThread(mixerThread, "sQLux Audio", NULL);
+	if (!mixer_thread)
+		fprintf(stderr, "Audio: mixer thread creation failed: %s\n", SDL_GetError());
+}
+
+void audioMixerAdd(audio_source_fn fn)
+{
+	int n = SDL_AtomicGet(&source_count);
+
+	if (n == MAX_SOURCES) {
+		fprintf(stderr, "Audio: too many sources\n");
+		return;
+	}
+	sources[n] = fn;
+	SDL_AtomicSet(&source_count, n + 1);
+}
+
+int audioMixerRate(void)
+{
+	return mixer_have.freq ? mixer_have.freq : AUDIO_MIXER_RATE;
+}
+
+void audioMixerMute(bool on)
+{
+	SDL_AtomicSet(&muted, on);
+}
+
+void audioMixerLock(void)
+{
+	if (mixer_dev)
+		SDL_LockAudioDevice(mixer_dev);
+	else if (mixer_lock)
+		SDL_LockMutex(mixer_lock);
+}
+
+void audioMixerUnlock(void)
+{
+	if (mixer_dev)
+		SDL_UnlockAudioDevice(mixer_dev);
+	else if (mixer_lock)
+		SDL_UnlockMutex(mixer_lock);
+}
+
+void audioMixerClose(void)
+{
+	if (mixer_dev) {
+		SDL_CloseAudioDevice(mixer_dev);
+		mixer_dev = 0;
+	}
+	if (mixer_thread) {
+		SDL_AtomicSet(&mixer_stopping, 1);
+		SDL_WaitThread(mixer_thread, NULL);
+		mixer_thread = NULL;
+	}
+#ifdef AUDIO_WORKLET
+	wasm_audio_stop();
+#endif
+	if (mixer_lock) {
+		SDL_DestroyMutex(mixer_lock);
+		mixer_lock = NULL;
+	}
+	SDL_AtomicSet(&source_count, 0);
+	mixer_open = false;
+}
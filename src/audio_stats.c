@@ -0,0 +1,131 @@
+/*
+ * audio_stats.c
+ *
+ * Histograms of audio callback cost and buffer levels, plus underrun and
+ * overflow counters.  Histograms use power of two buckets (0, 1, 2-3,
+ * 4-7, ...) so one layout serves microseconds, sample counts and queue
+ * depths.  Each histogram is written by one thread only (the callback or
+ * producer that owns it), counters are atomic.
+ */
+
+#include <SDL.h>
+#include <stdio.h>
+
+#include "audio_stats.h"
+
+#define HIST_BUCKETS	33
+
+typedef struct {
+	const char *name;
+	uint64_t bucket[HIST_BUCKETS];
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+} audio_hist;
+
+static audio_hist hists[AUDIO_HIST_COUNT] = {
+	{ "p8audio callback (us)" },
+	{ "p8audio callback samples" },
+	{ "p8audio generate (us)" },
+	{ "p8audio generate samples" },
+	{ "p8audio MMIO queue depth" },
+	{ "p8audio PCM ring fill" },
+	{ "DA callback (us)" },
+	{ "DA callback samples" },
+};
+
+static const char *counter_names[AUDIO_COUNT_COUNT] = {
+	"p8audio underruns",
+	"p8audio MMIO queue overflows",
+	"p8audio idle samples",
+	"DA buffer wraps",
+};
+
+static SDL_atomic_t counters[AUDIO_COUNT_COUNT];
+
+bool audio_stats_enabled = false;
+
+static uint64_t ticks_per_us;
+
+void audioStatsInit(bool enable)
+{
+	audio_stats_enabled = enable;
+	ticks_per_us = SDL_GetPerformanceFrequency() / 1000000;
+	if (!ticks_per_us)
+		ticks_per_us = 1;
+}
+
+uint64_t audioStatsNow(void)
+{
+	return SDL_GetPerformanceCounter();
+}
+
+uint64_t audioStatsSinceUs(uint64_t start)
+{
+	uint64_t now = SDL_GetPerformanceCounter();
+
+	return now > start ? (now - start) / ticks_per_us : 0;
+}
+
+void audioStatsAdd(int hist, uint64_t value)
+{
+	audio_hist *h = &hists[hist];
+	int b = 0;
+
+	if (!audio_stats_enabled)
+		return;
+	while (b < HIST_BUCKETS - 1 && (value >> b))
+		b++;
+	h->bucket[b]++;
+	h->count++;
+	h->sum += value;
+	if (value > h->max)
+		h->max = value;
+}
+
+void audioStatsCount(int counter, uint64_t n)
+{
+	if (audio_stats_enabled)
+		SDL_AtomicAdd(&counters[counter], (int)n);
+}
+
+static uint64_t hist_percentile(const audio_hist *h, double p)
+{
+	uint64_t want = (uint64_t)(p * (double)h->count);
+	uint64_t seen = 0;
+
+	for (int b = 0; b < HIST_BUCKETS; b++) {
+		seen += h->bucket[b];
+		if (seen > want) {
+			uint64_t upper = b ? (1ULL << b) - 1 : 0;
+			return upper < h->max ? upper : h->max;
+		}
+	}
+	return h->max;
+}
+
+void audioStatsDump(void)
+{
+	if (!audio_stats_enabled)
+		return;
+
+	printf("Audio stats (percentiles are power of two bucket bounds)\n");
+	printf("%-28s %10s %10s %8s %8s %8s %8s\n", "", "count", "mean", "p50",
+	       "p95", "p99", "max");
+	for (int i = 0; i < AUDIO_HIST_COUNT; i++) {
+		const audio_hist *h = &hists[i];
+
+		if (!h->count) {
+			printf("%-28s %10d\n", h->name, 0);
+			continue;
+		}
+		printf("%-28s %10llu %10.1f %8llu %8llu %8llu %8llu\n", h->name,
+		       (unsigned long long)h->count, (double)h->sum / h->count,
+		       (unsigned long long)hist_percentile(h, 0.50),
+		       (unsigned long long)hist_percentile(h, 0.95),
+		       (unsigned long long)hist_percentile(h, 0.99),
+		       (unsigned long long)h->max);
+	}
+	for (int i = 0; i < AUDIO_COUNT_COUNT; i++)
+		printf("%-28s %10d\n", counter_names[i], SDL_AtomicGet(&counters[i]));
+}
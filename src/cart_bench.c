@@ -0,0 +1,207 @@
+/*
+ * cart_bench.c
+ *
+ * End-to-end cart benchmark, see cart_bench.h.  Frame times are SDL
+ * performance counter deltas between vblanks, kept exactly so the
+ * percentiles aren't bucketed.  Audio CPU time is read from the threads'
+ * /proc entries at exit and is only there on Linux.
+ */
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+#ifdef __linux__
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+#include "cart_bench.h"
+#include "unixstuff.h"
+
+bool cart_bench_enabled = false;
+uint64_t cart_bench_insns;
+
+static int bench_frames;
+static char *bench_file;
+static double *frame_ms;
+static int frame_count;
+static uint64_t first_vblank, last_vblank;
+static uint64_t insns_at_start;
+static double emu_cpu_s = -1.0;
+static double ticks_per_ms;
+
+void cartBenchInit(int frames, const char *file)
+{
+	if (frames <= 0)
+		return;
+	frame_ms = malloc(frames * sizeof(*frame_ms));
+	if (!frame_ms) {
+		fprintf(stderr, "Cart bench: no memory for %d frames\n", frames);
+		return;
+	}
+	bench_frames = frames;
+	bench_file = file && *file ? strdup(file) : NULL;
+	ticks_per_ms = (double)SDL_GetPerformanceFrequency() / 1000.0;
+	cart_bench_enabled = true;
+}
+
+static double thread_cpu_s(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+
+	if (!clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+		return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+	return -1.0;
+}
+
+void cartBenchFrame(void)
+{
+	uint64_t now;
+
+	if (!cart_bench_enabled || frame_count >= bench_frames)
+		return;
+	now = SDL_GetPerformanceCounter();
+	// Timing starts at the first vblank, after the setup
+	if (!first_vblank) {
+		first_vblank = last_vblank = now;
+		insns_at_start = cart_bench_insns;
+		return;
+	}
+	frame_ms[frame_count++] = (double)(now - last_vblank) / ticks_per_ms;
+	last_vblank = now;
+	if (frame_count == bench_frames) {
+		emu_cpu_s = thread_cpu_s();
+		cleanup(0);
+	}
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest rank of the sorted frame times */
+static double percentile(double p)
+{
+	int i = (int)(p * frame_count + 0.999999) - 1;
+
+	if (i < 0)
+		i = 0;
+	if (i >= frame_count)
+		i = frame_count - 1;
+	return frame_ms[i];
+}
+
+/* CPU seconds of the audio device, mixer and p8audio producer threads */
+static double audio_cpu_s(void)
+{
+#ifdef __linux__
+	static const char *const names[] = { "SDLAudio", "sQLux Audio", "sQLux p8audio" };
+	long hz = sysconf(_SC_CLK_TCK);
+	unsigned long long ticks = 0;
+	struct dirent *d;
+	DIR *dir = opendir("/proc/self/task");
+
+	if (!dir || hz <= 0)
+		return -1.0;
+	while ((d = readdir(dir))) {
+		char path[64], comm[32] = "", stat[1024], *p;
+		unsigned long long utime, stime;
+		size_t i, n;
+		FILE *f;
+
+		if (d->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "/proc/self/task/%s/comm", d->d_name);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		if (!fgets(comm, sizeof(comm), f))
+			*comm = 0;
+		fclose(f);
+		for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+			if (!strncmp(comm, names[i], strlen(names[i])))
+				break;
+		}
+		if (i == sizeof(names) / sizeof(names[0]))
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/self/task/%s/stat", d->d_name);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		n = fread(stat, 1, sizeof(stat) - 1, f);
+		fclose(f);
+		stat[n] = 0;
+		// Fields 14 and 15, counted after the parenthesised name
+		p = strrchr(stat, ')');
+		if (p && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+				&utime, &stime) == 2)
+			ticks += utime + stime;
+	}
+	closedir(dir);
+	return (double)ticks / hz;
+#else
+	return -1.0;
+#endif
+}
+
+static long peak_rss_kb(void)
+{
+#ifndef _WIN32
+	struct rusage ru;
+
+	if (!getrusage(RUSAGE_SELF, &ru))
+#ifdef __APPLE__
+		return ru.ru_maxrss / 1024;
+#else
+		return ru.ru_maxrss;
+#endif
+#endif
+	return -1;
+}
+
+void cartBenchDump(void)
+{
+	double wall_s, sum = 0.0;
+	FILE *f = stdout;
+	int i;
+
+	if (!cart_bench_enabled)
+		return;
+	if (!frame_count) {
+		fprintf(stderr, "Cart bench: no frames ran\n");
+		return;
+	}
+	wall_s = (double)(last_vblank - first_vblank) / ticks_per_ms / 1000.0;
+	for (i = 0; i < frame_count; i++)
+		sum += frame_ms[i];
+	qsort(frame_ms, frame_count, sizeof(*frame_ms), cmp_double);
+
+	if (bench_file) {
+		f = fopen(bench_file, "w");
+		if (!f) {
+			perror(bench_file);
+			f = stdout;
+		}
+	}
+	fprintf(f, "{\"frames\":%d,\"wall_s\":%.3f,"
+		"\"frame_ms\":{\"mean\":%.3f,\"p50\":%.3f,\"p95\":%.3f,\"p99\":%.3f,\"max\":%.3f},"
+		"\"emulated_mips\":%.2f,\"emu_cpu_s\":%.3f,\"audio_cpu_s\":%.3f,"
+		"\"peak_rss_kb\":%ld}\n",
+		frame_count, wall_s, sum / frame_count, percentile(0.50),
+		percentile(0.95), percentile(0.99), frame_ms[frame_count - 1],
+		wall_s > 0.0 ? (cart_bench_insns - insns_at_start) / wall_s / 1e6 : 0.0,
+		emu_cpu_s, audio_cpu_s(), peak_rss_kb());
+	if (f != stdout)
+		fclose(f);
+}
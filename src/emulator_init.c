@@ -8,22 +8,62 @@
 #include <time.h>
 #include <unistd.h>
 
+/* Guest memory is mapped, so ROM images can be mapped into it */
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define GUEST_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define HUGE_PAGE	(2 * 1024 * 1024)
+
 #include "debug.h"
 #include "emulator_options.h"
 #include "memaccess.h"
 #include "QInstAddr.h"
 #include "QL68000.h"
+#include "general.h"
 #include "QLtraps.h"
 #include "QL_config.h"
 #include "QL_cconv.h"
 #include "QL_hardware.h"
 #include "QL_screen.h"
+#include "coverage.h"
+#include "cycles.h"
+#include "idle.h"
 #ifdef NEXTP8
 #include "sdspi.h"
+#include "sd_image.h"
+#include "sd_dma.h"
+#include "semihost.h"
+#include "blitter.h"
+#include "memdma.h"
+#include "fixmath.h"
+#include "dastream.h"
 #include "i2c_rtc.h"
 #include "funcval_testbench.h"
+#include "netplay.h"
+#include "p8audio_verilated.h"
+#include "rewind.h"
+#include "savestate.h"
+#include "replay.h"
+#include "input_script.h"
+#include "forkserver.h"
+#include "fuzz.h"
 #endif
+#include "gdbstub.h"
+#include "hle.h"
 #include "sds.h"
+#include "startup_timing.h"
+#include "op_stats.h"
+#ifdef DECODE_CACHE
+#include "fuse.h"
+#endif
+#ifdef JIT
+#include "jit.h"
+#endif
 #include "unixstuff.h"
 #include "version.h"
 #include "xcodes.h"
@@ -32,7 +72,118 @@
 // TODO: fixup iexl_general.h to not break stuff
 void InitialSetup(void);
 
-int emulatorLoadRom(const char *romDir, const char *romName, uint32_t addr, size_t size)
+static bool guest_mapped;
+#ifdef _WIN32
+static bool guest_large;
+#endif
+
+/*
+ * Guest memory on huge pages where the host has them, so the CPU core's
+ * and DMA's scattered accesses miss the TLB far less.  On Linux the
+ * mapping is 2MB aligned and advised for transparent huge pages, which
+ * still allows ROM images to be mapped over 4K pages of it; Windows
+ * needs the lock pages privilege for large pages.
+ */
+static void *guestMemAlloc(size_t len)
+{
+#ifdef GUEST_MMAP
+	size_t span = len + HUGE_PAGE;
+	char *p = mmap(NULL, span, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (p != MAP_FAILED) {
+		char *start = (char *)(((uintptr_t)p + HUGE_PAGE - 1) & ~(uintptr_t)(HUGE_PAGE - 1));
+
+		// Trim to an aligned len
+		if (start > p)
+			munmap(p, start - p);
+		if (p + span > start + len)
+			munmap(start + len, p + span - (start + len));
+#ifdef MADV_HUGEPAGE
+		madvise(start, len, MADV_HUGEPAGE);
+#endif
+		guest_mapped = true;
+		return start;
+	}
+#endif
+#ifdef _WIN32
+	SIZE_T large = GetLargePageMinimum();
+
+	if (large) {
+		void *p = VirtualAlloc(NULL, (len + large - 1) & ~(large - 1),
+				       MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+				       PAGE_READWRITE);
+
+		if (p) {
+			guest_large = true;
+			return p;
+		}
+	}
+#endif
+	return calloc(1, len);
+}
+
+static void guestMemFree(void *p, size_t len)
+{
+#ifdef GUEST_MMAP
+	if (guest_mapped) {
+		munmap(p, len);
+		return;
+	}
+#endif
+#ifdef _WIN32
+	if (guest_large) {
+		VirtualFree(p, 0, MEM_RELEASE);
+		return;
+	}
+#endif
+	free(p);
+}
+
+/*
+ * Maps len bytes of the image over guest memory at addr, copy on write,
+ * so instances running the same image share its pages until one writes
+ * them.  The rest of the last page reads as zero, like unloaded memory.
+ * -1 if addr isn't page aligned or the mapping doesn't fit.
+ */
+static int mapRom(int fd, uint32_t addr, size_t len)
+{
+#ifdef GUEST_MMAP
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	char *dst = (char *)memBase + addr;
+	size_t map_len = (len + page - 1) & ~(page - 1);
+
+	if (!guest_mapped || !len || ((uintptr_t)dst & (page - 1)) ||
+	    addr + map_len > RTOP)
+		return -1;
+	if (mmap(dst, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+		 fd, 0) == MAP_FAILED)
+		return -1;
+	return (int)len;
+#else
+	return -1;
+#endif
+}
+
+static int readRom(int fd, uint32_t addr, size_t len)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t n = read(fd, (char *)memBase + addr + done, len - done);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			break;
+		done += n;
+	}
+	return (int)done;
+}
+
+static int loadRom(const char *romDir, const char *romName, uint32_t addr, size_t size)
 {
 	struct stat romStat;
 	int ret, romFile;
@@ -62,33 +213,136 @@ int emulatorLoadRom(const char *romDir, const char *romName, uint32_t addr, size
 		return -1;
 	}
 
+	/* Nothing may land past the end of guest memory */
+	if (addr >= RTOP || (uint64_t)romStat.st_size > RTOP - addr) {
+		fprintf(stderr, "FUNC: %s ERR: Rom beyond memory VAL: %s 0x%x+%jd > 0x%x\n",
+			__func__, romPath, addr, (intmax_t)romStat.st_size, RTOP);
+		sdsfree(romPath);
+		return -1;
+	}
+
 	romFile = open(romPath, O_RDONLY);
 	if (romFile < 0) {
 		fprintf(stderr, "FUNC: %s ERR: %s VAL: %s\n",
 			__func__, strerror(errno), romPath);
+		sdsfree(romPath);
 		return -1;
 	}
-	ret = read(romFile, (char *)memBase + addr, romStat.st_size);
+	ret = mapRom(romFile, addr, romStat.st_size);
+	if (ret < 0)
+		ret = readRom(romFile, addr, romStat.st_size);
 	if (ret < 0) {
 		fprintf(stderr, "FUNC: %s ERR: %s VAL: %s\n",
 			__func__, strerror(errno), romPath);
-	}
-	if (ret != romStat.st_size) {
+	} else if (ret != romStat.st_size) {
 		fprintf(stderr, "FUNC: %s ERR: %s VAL: %s\n",
 			__func__, "partial read", romPath);
 	}
+	close(romFile);
 
 	sdsfree(romPath);
 
 	return ret;
 }
 
+int emulatorLoadRom(const char *romDir, const char *romName, uint32_t addr, size_t size)
+{
+	uint64_t t = startupNow();
+	int ret = loadRom(romDir, romName, addr, size);
+
+	// Read straight into memBase, behind the decode cache
+	if (ret > 0)
+		MemoryDMAWritten(addr, ret);
+	startupAdd(STARTUP_ROM_LOAD, t);
+	return ret;
+}
+
+#ifdef NEXTP8
+/* FNV-1a */
+static uint64_t bootHash(uint64_t h, const void *p, size_t n)
+{
+	const uint8_t *b = p;
+
+	while (n--)
+		h = (h ^ *b++) * 0x100000001b3ULL;
+	return h;
+}
+
+static uint64_t bootHashStr(uint64_t h, const char *s)
+{
+	return bootHash(h, s ? s : "", s ? strlen(s) + 1 : 1);
+}
+
+static uint64_t bootHashInt(uint64_t h, int64_t v)
+{
+	return bootHash(h, &v, sizeof(v));
+}
+
+/*
+ * What the boot snapshot depends on: the ROMs as loaded, the SD image and
+ * any overlay delta file by name, size and modification time, and the
+ * options the loader sees.
+ * Not the cart, which is loaded again after the restore.
+ */
+static uint64_t bootSnapshotKey(const char *sdcard)
+{
+	static const char *const strs[] = {
+		"cpu", "utimer", "app_args", "boot_snapshot_pc", "sdcard_overlay"
+	};
+	static const char *const ints[] = {
+		"ramsize", "ramtop", "cpu_mhz", "exit_action", "boot_snapshot_post"
+	};
+	static const char *const flags[] = {
+		"cycle_timing", "sd_dma", "funcval", "blitter", "memdma", "fixmath",
+		"dastream"
+	};
+	const char *ov = emulatorOptionString("sdcard_overlay");
+	uint64_t h = 0xcbf29ce484222325ULL;
+	struct stat st;
+	size_t i;
+
+	h = bootHashInt(h, SAVESTATE_VERSION);
+	h = bootHash(h, memBase, 256 * 1024);
+	h = bootHash(h, (Ptr)memBase + 512 * 1024, 256 * 1024);
+	h = bootHashStr(h, sdcard);
+	if (sdcard && *sdcard && !stat(sdcard, &st)) {
+		h = bootHashInt(h, st.st_size);
+		h = bootHashInt(h, st.st_mtime);
+	}
+	if (ov && *ov && !stat(ov, &st)) {
+		h = bootHashInt(h, st.st_size);
+		h = bootHashInt(h, st.st_mtime);
+	}
+	for (i = 0; i < sizeof(strs) / sizeof(strs[0]); i++)
+		h = bootHashStr(h, emulatorOptionString(strs[i]));
+	for (i = 0; i < sizeof(ints) / sizeof(ints[0]); i++)
+		h = bootHashInt(h, emulatorOptionInt(ints[i]));
+	for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++)
+		h = bootHashInt(h, emulatorOptionFlag(flags[i]));
+	return h;
+}
+
+/* After a boot snapshot restore: the cart as it is now */
+static void reloadCart(void)
+{
+	const char *cart = emulatorOptionString("cart");
+
+	if (!strlen(cart))
+		return;
+	memset((Ptr)memBase + CART_BASE, 0, CART_SIZE);
+	if (emulatorLoadRom(emulatorOptionString("romdir"), cart, CART_BASE, CART_SIZE) < 0)
+		fprintf(stderr, "Error Loading cart %s\n", cart);
+	MemoryDMAWritten(CART_BASE, CART_SIZE);
+}
+#endif
+
 void emulatorInit()
 {
 	char *rf;
 	int rl = 0;
 	void *tbuff;
 	int ret;
+	uint64_t t;
 
 	if (V1)
 		printf("*** sQLux release %s\n\n", release);
@@ -112,7 +366,7 @@ void emulatorInit()
 	}
 #endif
 
-	memBase = (int32_t *)malloc(RTOP);
+	memBase = (int32_t *)guestMemAlloc(RTOP);
 	if (memBase == NULL) {
 		fprintf(stderr, "sorry, not enough memory for a %dK QL\n",RTOP/1024);
 		exit(1);
@@ -121,14 +375,40 @@ void emulatorInit()
 	/* Initialise CPU model before building instruction table */
 	{
 		const char *cpu_model = emulatorOptionString("cpu");
+		bool timing = emulatorOptionFlag("cycle_timing");
+
 		cpu68010 = cpu_model && strcmp(cpu_model, "68010") != 0;
+		cpu68020 = cpu_model && strcmp(cpu_model, "68020") == 0;
 		if (V1)
-			printf("CPU model: %s\n", cpu68010 ? "68010" : "68000");
+			printf("CPU model: %s\n", cpu68020 ? "68020" : cpu68010 ? "68010" : "68000");
+#ifdef NEXTP8
+		// Replays need the tick in emulated time as well
+		if (replayInit(emulatorOptionString("record_inputs"),
+			       emulatorOptionString("replay_inputs")))
+			timing = true;
+		if (inputScriptInit(emulatorOptionString("input_script")))
+			timing = true;
+		// So would rollbacks, and they need a rewind point every frame
+		if (netplayInit(emulatorOptionString("netplay"),
+				emulatorOptionInt("netplay_port"),
+				emulatorOptionInt("netplay_player"),
+				emulatorOptionInt("netplay_delay")))
+			timing = true;
+#endif
+		cyclesInit(cpu68020 ? 68020 : cpu68010 ? 68010 : 68000, timing,
+			   emulatorOptionInt("cpu_mhz"));
+#ifdef NEXTP8
+		utimerInit(emulatorOptionString("utimer"));
+#endif
 	}
+	idleInit(emulatorOptionFlag("idle_skip"));
 
-	if (EmulatorTable()) {
+	t = startupNow();
+	ret = EmulatorTable();
+	startupAdd(STARTUP_OPTABLE, t);
+	if (ret) {
 		fprintf(stderr, "Failed to allocate instruction table\n");
-		free(memBase);
+		guestMemFree(memBase, RTOP);
 		exit(1);
 	}
 
@@ -172,7 +452,17 @@ void emulatorInit()
 	// Initialize SD card emulation
 	if (strlen(sdcard)) {
 		SDSPI_Init(sdcard);
+		sdImageSetOverlay(emulatorOptionString("sdcard_overlay"),
+				  emulatorOptionFlag("sdcard_overlay_discard"));
+		sdImageOpen(sdcard);
 	}
+	sd_dma_init(emulatorOptionFlag("sd_dma"));
+	semihost_init(emulatorOptionString("semihost"));
+	blitter_init(emulatorOptionFlag("blitter"), emulatorOptionInt("blitter_rate"));
+	memdma_init(emulatorOptionFlag("memdma"), emulatorOptionInt("memdma_rate"));
+	fixmath_init(emulatorOptionFlag("fixmath"));
+	dastream_init(emulatorOptionFlag("dastream"));
+	p8audio_verilated_dma_init();
 
 	// Initialize I2C RTC emulation
 	i2c_rtc_init();
@@ -265,13 +555,45 @@ void emulatorInit()
 	qlscreen.qm_len = 0x2000;
 	qlscreen.qm_hi = qlscreen.qm_lo + qlscreen.qm_len;
 
+	HWRegionsInit();
+#ifdef PROFILER
+	HWRegionsProfile();
+#endif
 	WriteConfigPage();
 
 	/* Initialize FuncVal testbench if in funcval mode */
 	if (emulatorOptionFlag("funcval")) {
 		funcval_init();
 	}
+
+	savestateInit(emulatorOptionString("save_state"),
+		      emulatorOptionInt("save_state_post"),
+		      emulatorOptionString("load_state"));
+	rewindInit(netplay_on ? 1 : emulatorOptionInt("rewind"),
+		   emulatorOptionInt("rewind_mb"));
+	savestateBootInit(emulatorOptionString("boot_snapshot"),
+			  bootSnapshotKey(sdcard),
+			  emulatorOptionInt("boot_snapshot_post"),
+			  emulatorOptionString("boot_snapshot_pc"),
+			  reloadCart);
+	fuzzInit(emulatorOptionFlag("fuzz"), emulatorOptionString("fuzz_input"),
+		 emulatorOptionString("fuzz_addr"), emulatorOptionInt("fuzz_lba"),
+		 emulatorOptionInt("fuzz_max"), emulatorOptionInt("fuzz_done_post"),
+		 emulatorOptionString("sdcard_overlay"));
+	forkServerInit(emulatorOptionString("fork_server"),
+		       emulatorOptionInt("fork_server_post"),
+		       emulatorOptionString("fork_server_pc"),
+		       emulatorOptionFlag("headless"));
+#endif
+#ifdef DECODE_CACHE
+	hleInit(emulatorOptionString("hle"), emulatorOptionFlag("hle_check"),
+		emulatorOptionString("cart_elf"), emulatorOptionString("rom1_elf"));
+#endif
+#ifdef PROFILER
+	coverageInit(emulatorOptionString("coverage"), emulatorOptionString("cart_elf"),
+		     emulatorOptionString("rom1_elf"));
 #endif
+	gdbInit(emulatorOptionInt("gdb_port"));
 
 	if (V1 && (atof(emulatorOptionString("speed")) > 0.0))
 		printf("Emulation Speed: %s\n", emulatorOptionString("speed"));
@@ -282,41 +604,53 @@ void emulatorInit()
 		printf("sound enabled, volume %i.\n", emulatorOptionInt("sound"));
 
 	if (!isMinerva) {
-		qlux_table[IPC_CMD_CODE] = UseIPC; /* install pseudoops */
-		qlux_table[IPCR_CMD_CODE] = ReadIPC;
-		qlux_table[IPCW_CMD_CODE] = WriteIPC;
-		qlux_table[KEYTRANS_CMD_CODE] = QL_KeyTrans;
+		SetOpcodeHandler(IPC_CMD_CODE, UseIPC); /* install pseudoops */
+		SetOpcodeHandler(IPCR_CMD_CODE, ReadIPC);
+		SetOpcodeHandler(IPCW_CMD_CODE, WriteIPC);
+		SetOpcodeHandler(KEYTRANS_CMD_CODE, QL_KeyTrans);
 
-		qlux_table[FSTART_CMD_CODE] = FastStartup;
+		SetOpcodeHandler(FSTART_CMD_CODE, FastStartup);
 	}
-	qlux_table[ROMINIT_CMD_CODE] = InitROM;
-	qlux_table[MDVIO_CMD_CODE] = MdvIO;
-	qlux_table[MDVO_CMD_CODE] = MdvOpen;
-	qlux_table[MDVC_CMD_CODE] = MdvClose;
-	qlux_table[MDVSL_CMD_CODE] = MdvSlaving;
-	qlux_table[MDVFO_CMD_CODE] = MdvFormat;
-	qlux_table[POLL_CMD_CODE] = PollCmd;
+	SetOpcodeHandler(ROMINIT_CMD_CODE, InitROM);
+	SetOpcodeHandler(MDVIO_CMD_CODE, MdvIO);
+	SetOpcodeHandler(MDVO_CMD_CODE, MdvOpen);
+	SetOpcodeHandler(MDVC_CMD_CODE, MdvClose);
+	SetOpcodeHandler(MDVSL_CMD_CODE, MdvSlaving);
+	SetOpcodeHandler(MDVFO_CMD_CODE, MdvFormat);
+	SetOpcodeHandler(POLL_CMD_CODE, PollCmd);
 
 #ifdef SERIAL
 #ifndef NEWSERIAL
-	qlux_table[OSERIO_CMD_CODE] = SerIO;
-	qlux_table[OSERO_CMD_CODE] = SerOpen;
-	qlux_table[OSERC_CMD_CODE] = SerClose;
+	SetOpcodeHandler(OSERIO_CMD_CODE, SerIO);
+	SetOpcodeHandler(OSERO_CMD_CODE, SerOpen);
+	SetOpcodeHandler(OSERC_CMD_CODE, SerClose);
 #endif
 #endif
 
-	qlux_table[SCHEDULER_CMD_CODE] = SchedulerCmd;
+	SetOpcodeHandler(SCHEDULER_CMD_CODE, SchedulerCmd);
 	if (isMinerva) {
-		qlux_table[MIPC_CMD_CODE] = KbdCmd;
-		qlux_table[KBENC_CMD_CODE] = KBencCmd;
+		SetOpcodeHandler(MIPC_CMD_CODE, KbdCmd);
+		SetOpcodeHandler(KBENC_CMD_CODE, KBencCmd);
 	}
-	qlux_table[BASEXT_CMD_CODE] = BASEXTCmd;
+	SetOpcodeHandler(BASEXT_CMD_CODE, BASEXTCmd);
 
 #ifndef NEXTP8
 	if (emulatorOptionInt("skip_boot"))
-		qlux_table[0x4e43] = btrap3;
+		SetOpcodeHandler(0x4e43, btrap3);
 #endif
 
+	// Counting needs every instruction to go round the dispatch loop
+	opStatsInit(emulatorOptionFlag("op_stats"));
+#ifdef DECODE_CACHE
+	fuseInit(emulatorOptionInt("fuse") && !op_counting,
+		 emulatorOptionFlag("fuse_stats"));
+#endif
+#ifdef JIT
+	// Compiled blocks would run straight over the fork server's trap
+	// and gdb's breakpoints
+	jit_init(emulatorOptionInt("jit") && fork_pc == 0xffffffff && !gdbEnabled() &&
+		 !op_counting, emulatorOptionString("jit_cache"));
+#endif
 	InitialSetup();
 
 	if (isMinerva) {
@@ -51,57 +51,197 @@ struct emuOpts {
 struct emuOpts emuOptions[] = {
 #ifdef NEXTP8
 {"app_args", "", "command line arguments to pass to the application", EMU_OPT_CHAR, 0, NULL},
+{"audio_buffer", "", "samples per audio device callback, where DA and p8audio are mixed; larger buffers need the guest to stream DA further ahead of da_address", EMU_OPT_INT, 256, NULL},
+{"audio_lookahead", "", "p8audio samples generated ahead of the audio device (min audio_buffer + 256)", EMU_OPT_INT, 2048, NULL},
+{"audio_offline", "", "generate p8audio from emulated time, as fast as emulation runs, for capture only (device plays silence)", EMU_OPT_FLAG, 0, NULL},
+{"audio_stats", "", "record audio callback cost, buffer level and underrun statistics, print them on exit", EMU_OPT_FLAG, 0, NULL},
 {"asynctrace", "", "enable async trace output at startup", EMU_OPT_FLAG, 0, NULL},
+{"blitter", "", "expose the emulator's prototype 2D blitter registers", EMU_OPT_FLAG, 0, NULL},
+{"blitter_rate", "", "pixels the blitter draws in an instruction's time, 0 = blits finish at once", EMU_OPT_INT, 4, NULL},
+{"boot_snapshot", "", "directory for a snapshot taken as the loader hands over to the cart (boot_snapshot_post or boot_snapshot_pc) and restored instead of booting when the ROMs, SD image and options match", EMU_OPT_CHAR, 0, NULL},
+{"boot_snapshot_pc", "", "guest address at which boot_snapshot is taken", EMU_OPT_CHAR, 0, NULL},
+{"boot_snapshot_post", "", "POST code at which boot_snapshot is taken", EMU_OPT_INT, -1, NULL},
 {"check_calling_convention", "", "check M68000 calling convention (preserve a2-a7, d2-d7)", EMU_OPT_FLAG, 0, NULL},
 {"exit_on_cpu_disable", "", "exit emulator when CPU is disabled (RESET_REQ = 0xff), default 1", EMU_OPT_INT, 1, NULL},
+{"p8audio_bench", "", "time the p8audio model per sample while idle, playing SFX only and playing music, print samples/s and the multiple of realtime on exit", EMU_OPT_FLAG, 0, NULL},
+{"p8audio_check", "", "run a second p8audio model on the exact clock schedule and report where the fast paths differ", EMU_OPT_FLAG, 0, NULL},
+#ifdef P8AUDIO_TRACE
+{"p8audio_trace", "", "FST file for windows of p8audio model tracing, numbered one file per window", EMU_OPT_CHAR, 0, NULL},
+{"p8audio_trace_ms", "", "length of a p8audio_trace window around its trigger in ms", EMU_OPT_INT, 50, NULL},
+{"p8audio_trace_on", "", "what opens a p8audio_trace window: sfx and music command writes, funcval trace marks and samples=first-last (default sfx,music,funcval)", EMU_OPT_CHAR, 0, NULL},
+#endif
+{"render_bench", "", "convert this many random frames per screen transform, high colour mode and overlay setting, print pixels/s as JSON and exit", EMU_OPT_INT, 0, NULL},
 {"rom_write_protect", "", "trap writes to ROM area (addr < 32768), default 1", EMU_OPT_INT, 1, NULL},
 #endif
 #ifndef NEXTP8
 {"bdi1", "", "file exposed by the BDI interface", EMU_OPT_CHAR, 0 , NULL},
+{"bdi_fsync", "", "fsync the BDI file after every write instead of on the sync command and deselect", EMU_OPT_FLAG, 0, NULL},
 {"boot_cmd", "b", "command to run on boot (executed in basic)", EMU_OPT_CHAR, 0, NULL},
 {"boot_device", "d", "device to load BOOT file from", EMU_OPT_CHAR, 0, "mdv1"},
 #endif
 {"cart", "", "p8 cart", EMU_OPT_CHAR, 0, NULL},
-{"cpu", "", "CPU model: 68000 or 68010 (default: 68000)", EMU_OPT_CHAR, 0, "68000"},
+{"cart_bench", "", "run this many emulated frames, then exit and report frame time percentiles, emulated MIPS, thread CPU and peak RSS as JSON (use with headless and speed 0.0)", EMU_OPT_INT, 0, NULL},
+{"cart_bench_file", "", "file for the cart_bench report, default stdout", EMU_OPT_CHAR, 0, NULL},
+#if defined(PROFILER) || defined(DECODE_CACHE)
+{"cart_elf", "", "ELF file of the cart, for function names and source lines in the profile and the hle routines", EMU_OPT_CHAR, 0, NULL},
+#endif
+#ifdef PROFILER
+{"coverage", "", "write the guest code that ran to this lcov file at exit, with the functions and source lines of cart_elf and rom1_elf", EMU_OPT_CHAR, 0, NULL},
+#endif
+{"cpu", "", "CPU model: 68000, 68010 or 68020, a subset with 32-bit multiply and divide, EXTB.L, scaled index and full format addressing, bit fields and 32-bit branches (default: 68000)", EMU_OPT_CHAR, 0, "68000"},
+{"cpu_mhz", "", "emulated CPU clock in MHz for cycle_timing", EMU_OPT_INT, 28, NULL},
+{"cycle_timing", "", "run the scheduler, the 50Hz tick and the 1MHz timer off emulated CPU cycles instead of instructions and the host clock", EMU_OPT_FLAG, 0, NULL},
 #ifdef NEXTP8
+{"dastream", "", "expose the emulator's DA streaming registers: the DA position in emulated time, samples free and half-buffer and wrap interrupts", EMU_OPT_FLAG, 0, NULL},
+{"esp_keepalive", "", "seconds to hold a closed ESP8266 TCP/SSL link open for reuse by a CIPSTART to the same host, 0 = off", EMU_OPT_INT, 0, NULL},
+{"esp_links", "", "ESP8266 links for CIPSTART and CIPSERVER, 1-32; the real module has 5, more is for guests written to use them", EMU_OPT_INT, 5, NULL},
 {"exit_action", "", "0 = restart on exit, 1 = shutdown on exit", EMU_OPT_INT, 0, NULL},
 #else
 {"cpu_hog", "", "1 = use all cpu, 0 = sleep when idle", EMU_OPT_INT, 1, NULL},
 {"device", "", "QDOS_name,path,flags (may be used multiple times", EMU_OPT_DEV, 0, NULL},
 {"fast_startup", "", "1 = skip ram test (does not affect Minerva)", EMU_OPT_INT, 0, NULL},
 #endif
+#ifdef NEXTP8
+{"fb_stream_addr", "", "address fb_stream_port listens on; 0.0.0.0 for every interface", EMU_OPT_CHAR, 0, "127.0.0.1"},
+{"fb_stream_port", "", "stream the native display as 4bpp line deltas on this port, with a browser viewer at http://fb_stream_addr:port/", EMU_OPT_INT, 0, NULL},
+#endif
 {"filter", "", "enable bilinear filter when zooming", EMU_OPT_INT, 0, NULL},
 #ifdef NEXTP8
+{"fixmath", "", "expose the emulator's fixed point math unit registers", EMU_OPT_FLAG, 0, NULL},
+{"flight_dumps", "", "times the flight recorder dumps, the first to flight_file and later ones to flight_file.N", EMU_OPT_INT, 1, NULL},
+{"flight_file", "", "file the flight recorder dumps its trace to, for btrace_dump", EMU_OPT_CHAR, 0, "flight.bt"},
+{"flight_pc", "", "dump the flight recorder when the instruction at this address runs", EMU_OPT_CHAR, 0, NULL},
+{"flight_post", "", "dump the flight recorder when the guest writes this POST code", EMU_OPT_INT, -1, NULL},
+{"flight_recorder", "", "always keep about the last N million instructions in a circular binary trace, dumped on a flight_* trigger or calling convention violation", EMU_OPT_INT, 0, NULL},
+{"flight_reset", "", "dump the flight recorder when the guest writes RESET_REQ", EMU_OPT_FLAG, 0, NULL},
+{"flight_vector", "", "dump the flight recorder when the CPU takes this exception vector", EMU_OPT_INT, -1, NULL},
+{"flight_write", "", "dump the flight recorder on a write to this address or lo-hi range", EMU_OPT_CHAR, 0, NULL},
+{"fork_server", "", "boot headless to fork_server_post or fork_server_pc, then fork a copy of the machine for each test that connects to this Unix socket", EMU_OPT_CHAR, 0, NULL},
+{"fork_server_pc", "", "guest address at which fork_server starts serving", EMU_OPT_CHAR, 0, NULL},
+{"fork_server_post", "", "POST code at which fork_server starts serving", EMU_OPT_INT, -1, NULL},
+#endif
+{"frame_stats", "", "record frame pacing and input latency histograms, print them on exit", EMU_OPT_FLAG, 0, NULL},
+#ifdef NEXTP8
 {"funcval", "", "enable FuncVal testbench mode (redirect 3MB-4MB to testbench peripherals)", EMU_OPT_FLAG, 0, NULL},
+{"funcval_audio_align", "", "samples either way funcval_audio_golden searches for the best alignment", EMU_OPT_INT, 0, NULL},
+{"funcval_audio_golden", "", "reference WAV for the FuncVal audio compare register, 22050 Hz PCM", EMU_OPT_CHAR, 0, NULL},
+{"funcval_audio_peak", "", "peak sample difference allowed by funcval_audio_golden", EMU_OPT_INT, 0, NULL},
+{"funcval_audio_rms", "", "RMS sample difference allowed by funcval_audio_golden", EMU_OPT_INT, 0, NULL},
+{"funcval_batch", "", "run the FuncVal tests listed in this manifest, one headless machine per test on all host cores", EMU_OPT_CHAR, 0, NULL},
+{"funcval_golden", "", "reference PPM for the FuncVal golden image compare register, 128x128 or a whole multiple", EMU_OPT_CHAR, 0, NULL},
+{"funcval_golden_mask", "", "PPM mask for funcval_golden, black pixels are not compared", EMU_OPT_CHAR, 0, NULL},
+{"funcval_golden_tolerance", "", "difference allowed per 4-bit channel by funcval_golden", EMU_OPT_INT, 0, NULL},
+{"funcval_jobs", "", "tests run at once by funcval_batch, 0 = one per host core", EMU_OPT_INT, 0, NULL},
+{"funcval_outdir", "", "directory for FuncVal screenshots and WAV recordings", EMU_OPT_CHAR, 0, NULL},
+{"funcval_results", "", "results file written by funcval_batch", EMU_OPT_CHAR, 0, "funcval_results.txt"},
 {"funcval_type", "", "FuncVal type: auto or manual (default auto)", EMU_OPT_CHAR, 0, ""},
 #endif
+#ifdef DECODE_CACHE
+{"fuse", "", "1 = run an instruction and the Bcc or DBRA after it as one fused handler, 0 = dispatch every instruction", EMU_OPT_INT, 1, NULL},
+{"fuse_stats", "", "count executed opcode pairs and print the most frequent on exit (turns fusion off)", EMU_OPT_FLAG, 0, NULL},
+#endif
+#ifdef NEXTP8
+{"fuzz", "", "serve afl-fuzz from the fork_server_post or fork_server_pc point: each input runs in a forked child with edge coverage (needs headless)", EMU_OPT_FLAG, 0, NULL},
+{"fuzz_addr", "", "guest RAM address the fuzz input is put at, as a big-endian 32-bit length and then the bytes", EMU_OPT_CHAR, 0, NULL},
+{"fuzz_done_post", "", "POST code at which a fuzz test has finished", EMU_OPT_INT, -1, NULL},
+{"fuzz_input", "", "file afl-fuzz writes each input to (its @@), default stdin", EMU_OPT_CHAR, 0, NULL},
+{"fuzz_lba", "", "SD card sector the fuzz input is written at (needs sdcard_overlay mem)", EMU_OPT_INT, -1, NULL},
+{"fuzz_max", "", "largest fuzz input in bytes, the space reserved at fuzz_addr or fuzz_lba", EMU_OPT_INT, 4096, NULL},
+#endif
+{"gdb_port", "", "wait for gdb on this 127.0.0.1 TCP port before the first instruction and serve it while running", EMU_OPT_INT, 0, NULL},
+{"headless", "", "no window, audio device or 50Hz timer; frames are counted in instructions", EMU_OPT_FLAG, 0, NULL},
+{"headless_tick", "", "instructions per 50Hz frame when headless or fast forwarding and no speed is set", EMU_OPT_INT, 80000, NULL},
+#ifdef DECODE_CACHE
+{"hle", "", "run these routines of cart_elf and rom1_elf natively: a comma separated list of memcpy, memmove, memset, strlen, __mulsi3, __divsi3, __udivsi3, __modsi3, __umodsi3 or all", EMU_OPT_CHAR, 0, NULL},
+{"hle_check", "", "run the hle routines' guest code and report where its results differ from the native ones", EMU_OPT_FLAG, 0, NULL},
+#endif
+{"idle_skip", "", "skip emulated time while the guest is stopped or polls a status register in a tight loop, sleeping the host", EMU_OPT_FLAG, 0, NULL},
+#ifdef NEXTP8
+{"input_script", "", "feed the key, joystick and mouse events in this file to the guest at the emulated frames or cycles given (turns on cycle_timing)", EMU_OPT_CHAR, 0, NULL},
+#endif
 #ifndef NEXTP8
 {"fixaspect", "", "0 = 1:1 pixel mapping, 1 = 2:3 non square pixels, 2 = BBQL aspect non square pixels", EMU_OPT_INT, 0, NULL},
 {"iorom1", "", "rom in 1st IO area (Minerva only 0x10000 address)", EMU_OPT_CHAR, 0, NULL},
 {"iorom2", "", "rom in 2nd IO area (Minerva only 0x14000 address)", EMU_OPT_CHAR, 0, NULL},
 #endif
+#ifdef JIT
+{"jit", "", "1 = translate hot 68K code to host code, 0 = interpret only", EMU_OPT_INT, 1, NULL},
+{"jit_cache", "", "file that keeps the translated blocks between runs, so that they are translated as soon as they are reached", EMU_OPT_CHAR, 0, NULL},
+#endif
 {"joy1", "", "1-8 SDL2 joystick index", EMU_OPT_INT, 0, NULL},
 {"joy2", "", "1-8 SDL2 joystick index", EMU_OPT_INT, 0, NULL},
 {"kbd", "", "keyboard language DE, GB, ES, IT, US", EMU_OPT_CHAR, 0, "US"},
+#ifdef NEXTP8
+{"load_state", "", "restore the machine from this save state before the first instruction", EMU_OPT_CHAR, 0, NULL},
+#endif
+{"log", "", "log level error, warn, info or debug, or module=level,... for emu, hw, audio", EMU_OPT_CHAR, 0, NULL},
+#ifdef NEXTP8
+{"memdma", "", "expose the emulator's memory DMA registers", EMU_OPT_FLAG, 0, NULL},
+{"memdma_rate", "", "bytes the memory DMA moves in an instruction's time, 0 = transfers finish at once", EMU_OPT_INT, 0, NULL},
+#endif
+{"metrics", "", "keep runtime counters and histograms, dumped on SIGUSR1", EMU_OPT_FLAG, 0, NULL},
+{"metrics_interval", "", "print the runtime counters every this many seconds (implies metrics)", EMU_OPT_INT, 0, NULL},
+{"metrics_port", "", "serve the runtime counters in Prometheus text format on this 127.0.0.1 port (implies metrics)", EMU_OPT_INT, 0, NULL},
+#ifdef NEXTP8
+{"netplay", "", "rollback netplay with the peer at host:port (turns on cycle_timing and a rewind point every frame)", EMU_OPT_CHAR, 0, NULL},
+{"netplay_delay", "", "frames between sampling the local input and using it", EMU_OPT_INT, 2, NULL},
+{"netplay_player", "", "1 or 2: whose joystick the local one is, the peer is the other", EMU_OPT_INT, 1, NULL},
+{"netplay_port", "", "local UDP port for netplay", EMU_OPT_INT, 7000, NULL},
+#endif
 #ifndef NEXTP8
 {"no_patch", "n", "disable patching the rom", EMU_OPT_INT, 1, NULL},
 {"palette", "", "0 = Full colour, 1 = Unsaturated colours (slightly more CRT like), 2 =  Enable grayscale display", EMU_OPT_INT, 0, NULL},
 {"print", "", "command to use for print jobs", EMU_OPT_CHAR, 0, "lpr"},
 #endif
+{"op_stats", "", "count executions per opcode handler, handler pairs and EA modes and print the most frequent on exit (turns fusion and the JIT off)", EMU_OPT_FLAG, 0, NULL},
+{"pacer", "", "timer = 50Hz ticks from a monotonic clock, vsync = tick on each display refresh", EMU_OPT_CHAR, 0, "timer"},
+#ifdef PROFILER
+{"profiler", "", "start profiling at boot; SIGPROF or Ctrl+F12 start and stop it at any time", EMU_OPT_FLAG, 0, NULL},
+{"profiler_buffer", "", "profiler events per buffer", EMU_OPT_INT, 8192, NULL},
+{"profiler_buffers", "", "number of profiler event buffers", EMU_OPT_INT, 16, NULL},
+{"profiler_drop", "", "drop profiler events when all buffers are full instead of stalling emulation", EMU_OPT_FLAG, 0, NULL},
+{"profiler_folded", "", "also write folded call stacks for flamegraph.pl or speedscope to this file", EMU_OPT_CHAR, 0, NULL},
+{"profiler_folded_weight", "", "event counted in the profiler_folded stacks: cycles, instructions, reads, writes or stalls", EMU_OPT_CHAR, 0, "instructions"},
+{"profiler_heatmap", "", "write a data access heatmap report to this file", EMU_OPT_CHAR, 0, NULL},
+{"profiler_live_frames", "", "frames in the profiler_live_port view's frame window", EMU_OPT_INT, 50, NULL},
+{"profiler_live_port", "", "serve a live view of the hottest functions to profiler_top on this port of 127.0.0.1", EMU_OPT_INT, 0, NULL},
+{"profiler_loops", "", "write the hottest loops with their trip counts to this file", EMU_OPT_CHAR, 0, NULL},
+{"profiler_memory", "", "charge memory stalls from this nextp8 memory system, e.g. sdram=6,burst=1,icache=4096/2/16,dcache=4096/2/16,io=2,mmio=8f0050-8f006f:8", EMU_OPT_CHAR, 0, NULL},
+{"profiler_sample", "", "take a profile sample every N instructions instead of recording every event, 0 = instrumented", EMU_OPT_INT, 0, NULL},
+{"profiler_timeline", "", "also write a Chrome trace / Perfetto timeline of calls and frames to this file", EMU_OPT_CHAR, 0, NULL},
+{"profiler_timeline_depth", "", "deepest call shown on the profiler timeline", EMU_OPT_INT, 16, NULL},
+{"profiler_trace", "", "record raw profiler events to this file for profiler_replay instead of writing callgrind.out", EMU_OPT_CHAR, 0, NULL},
+{"profiler_window", "", "stop profiling this many frames after it starts, 0 = only when stopped or at exit", EMU_OPT_INT, 0, NULL},
+#endif
 #ifdef NEXTP8
 {"ramtop", "r", "The memory space top (not valid if ramsize set)", EMU_OPT_INT, 4096, NULL},
 #else
 {"ramtop", "r", "The memory space top (128K + QL ram, not valid if ramsize set)", EMU_OPT_INT, 4096, NULL},
 #endif
 {"ramsize", "", "The size of ram", EMU_OPT_INT, 0, NULL},
+#ifdef NEXTP8
+{"record_inputs", "", "record the timer, RTC, input, ESP8266 and audio status values the guest reads to this file, for replay_inputs (turns on cycle_timing)", EMU_OPT_CHAR, 0, NULL},
+{"replay_inputs", "", "feed the guest the values recorded by record_inputs in this file, to repeat that run exactly (turns on cycle_timing)", EMU_OPT_CHAR, 0, NULL},
+#endif
 {"resolution", "g", "resolution of screen in mode 4", EMU_OPT_CHAR, 0, "512x256"},
 #ifdef NEXTP8
+{"rewind", "", "take a rewind point every N frames, 0 = no rewind; F9 steps back", EMU_OPT_INT, 0, NULL},
+{"rewind_mb", "", "megabytes of rewind points kept", EMU_OPT_INT, 64, NULL},
 {"rom1", "", "rom 1", EMU_OPT_CHAR, 0, "loader.bin"},
+#if defined(PROFILER) || defined(DECODE_CACHE)
+{"rom1_elf", "", "ELF file of rom 1, for function names and source lines in the profile and the hle routines", EMU_OPT_CHAR, 0, NULL},
+#endif
 {"rom2", "", "rom 2", EMU_OPT_CHAR, 0, ""},
 #endif
 {"romdir", "", "path to the roms", EMU_OPT_CHAR, 0, "roms"},
 #ifdef NEXTP8
-{"sdcard", "", "path to the SD card image", EMU_OPT_CHAR, 0, ""},
+{"save_state", "", "save the machine to this file when the guest writes save_state_post", EMU_OPT_CHAR, 0, NULL},
+{"save_state_post", "", "POST code at which save_state is written, once", EMU_OPT_INT, -1, NULL},
+{"sd_dma", "", "expose the emulator's SD block DMA registers; the SPI interface stays available", EMU_OPT_FLAG, 0, NULL},
+{"sdcard", "", "path to the SD card image (or an http(s) URL to stream it in the browser)", EMU_OPT_CHAR, 0, ""},
+{"sdcard_overlay", "", "leave the SD card image untouched: writes go to this delta file, or stay in memory with mem", EMU_OPT_CHAR, 0, NULL},
+{"sdcard_overlay_discard", "", "remove the sdcard_overlay delta file at exit", EMU_OPT_FLAG, 0, NULL},
+{"semihost", "", "expose the emulator's semihosting registers, with guest files in this directory", EMU_OPT_CHAR, 0, NULL},
 #endif
 #ifndef NEXTP8
 {"romport", "", "rom in QL rom port (0xC000 address)", EMU_OPT_CHAR, 0, NULL},
@@ -118,10 +258,27 @@ struct emuOpts emuOptions[] = {
 #endif
 {"sound", "", "volume in range 1-8, 0 to disable", EMU_OPT_INT, 8, NULL},
 {"speed", "", "speed in factor of BBQL speed, 0.0 for full speed", EMU_OPT_CHAR, 0, "0.0"},
+{"startup_json", "", "write the start-up phase timing (printed with verbose 2) to this file as JSON", EMU_OPT_CHAR, 0, NULL},
+#ifdef NEXTP8
+{"startup_post", "", "POST code of the loader's hand-off, at which the start-up timing is reported (default: at exit)", EMU_OPT_INT, -1, NULL},
+#endif
 {"strict_lock", "", "enable strict file locking", EMU_OPT_INT, 0, NULL},
+{"sync_io", "", "do BDI, disk image and SD overlay I/O inline on the emulator thread, without io_uring or a worker", EMU_OPT_FLAG, 0, NULL},
 #ifndef NEXTP8
 {"sysrom", "", "system rom", EMU_OPT_CHAR, 0, "MIN198.rom"},
 #endif
+{"thread_cpus", "", "pin threads by role to CPUs, e.g. cpu=2,audio=3,main=0-1+4; roles main, cpu, audio, timer, profiler, worker", EMU_OPT_CHAR, 0, NULL},
+{"thread_priority", "", "thread priority by role: low, normal, high or realtime, e.g. cpu=high,audio=realtime", EMU_OPT_CHAR, 0, NULL},
+#ifdef NEXTP8
+{"trace_file", "", "write asyncTrace output to this file as a binary trace, for btrace_dump", EMU_OPT_CHAR, 0, NULL},
+#endif
+{"turbo", "", "start in fast forward (toggled with F10): unthrottled, audio muted, guest frames still counted at 50Hz", EMU_OPT_FLAG, 0, NULL},
+{"turbo_skip", "", "in fast forward show every Nth frame, 0 = one per display refresh", EMU_OPT_INT, 0, NULL},
+#ifdef NEXTP8
+{"utimer", "", "1MHz user timer: sync = host clock read once per chunk and advanced by emulated cycles in between, host = host clock on every read, emulated = emulated cycles only (always with cycle_timing)", EMU_OPT_CHAR, 0, "sync"},
+{"video", "", "record the native display to this file, audio to <file>.pcm", EMU_OPT_CHAR, 0, NULL},
+{"video_format", "", "raw = 4bpp frames and palettes, ffmpeg = encode through an ffmpeg pipe", EMU_OPT_CHAR, 0, "raw"},
+#endif
 {"win_size", "w", "window size 1x, 2x, 3x, max, full", EMU_OPT_CHAR, 0, "3x"},
 {"verbose", "v", "verbosity level 0-3", EMU_OPT_INT, 1, NULL},
 {NULL},
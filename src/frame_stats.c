@@ -0,0 +1,172 @@
+/*
+ * frame_stats.c
+ *
+ * Frame pacing and input-to-photon latency histograms.  All times are
+ * SDL performance counter values; the histograms use 0.25ms buckets up to
+ * 64ms with everything above that in the last bucket.  The vblank
+ * histogram is only touched by the emulator thread and the others only by
+ * the SDL thread, so no locking is needed until the dump at exit.
+ */
+
+#include <SDL.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "frame_stats.h"
+
+#define STAT_BUCKETS	257	/* 0.25ms each, last one is overflow */
+
+typedef struct {
+	const char *name;
+	uint32_t bucket[STAT_BUCKETS];
+	uint64_t count;
+	double sum_ms;
+	double max_ms;
+} stat_hist;
+
+enum {
+	STAT_VBLANK_INTERVAL,
+	STAT_VBLANK_TO_RENDER,
+	STAT_RENDER,
+	STAT_VBLANK_TO_PRESENT,
+	STAT_PRESENT_INTERVAL,
+	STAT_INPUT_TO_PRESENT,
+	STAT_COUNT
+};
+
+static stat_hist hists[STAT_COUNT] = {
+	{ "vblank interval" },
+	{ "vblank to render start" },
+	{ "render (convert + upload)" },
+	{ "vblank to present" },
+	{ "present interval" },
+	{ "input to first changed frame" },
+};
+
+bool frame_stats_enabled = false;
+
+static double ticks_per_ms;
+static uint64_t last_vblank;
+static uint64_t last_present;
+static uint64_t pending_input;
+static uint64_t frames_skipped;
+
+void frameStatsInit(bool enable)
+{
+	frame_stats_enabled = enable;
+	ticks_per_ms = (double)SDL_GetPerformanceFrequency() / 1000.0;
+}
+
+uint64_t frameStatsNow(void)
+{
+	return SDL_GetPerformanceCounter();
+}
+
+static void stat_add(int which, uint64_t from, uint64_t to)
+{
+	stat_hist *h = &hists[which];
+	double ms = to > from ? (double)(to - from) / ticks_per_ms : 0.0;
+	int b = (int)(ms * 4.0);
+
+	if (b >= STAT_BUCKETS)
+		b = STAT_BUCKETS - 1;
+	h->bucket[b]++;
+	h->count++;
+	h->sum_ms += ms;
+	if (ms > h->max_ms)
+		h->max_ms = ms;
+}
+
+void frameStatsVblank(uint64_t t)
+{
+	if (last_vblank)
+		stat_add(STAT_VBLANK_INTERVAL, last_vblank, t);
+	last_vblank = t;
+}
+
+void frameStatsInput(void)
+{
+	if (frame_stats_enabled && !pending_input)
+		pending_input = frameStatsNow();
+}
+
+/* vblank is 0 when the frame has no snapshot time */
+void frameStatsFrame(uint64_t vblank, uint64_t render_start,
+		     uint64_t render_end, uint64_t present, bool changed)
+{
+	if (!changed) {
+		frames_skipped++;
+		return;
+	}
+
+	if (vblank) {
+		stat_add(STAT_VBLANK_TO_RENDER, vblank, render_start);
+		stat_add(STAT_VBLANK_TO_PRESENT, vblank, present);
+	}
+	stat_add(STAT_RENDER, render_start, render_end);
+	if (last_present)
+		stat_add(STAT_PRESENT_INTERVAL, last_present, present);
+	last_present = present;
+
+	// The first new picture built from state captured after the event
+	if (pending_input && (vblank ? vblank : render_start) > pending_input) {
+		stat_add(STAT_INPUT_TO_PRESENT, pending_input, present);
+		pending_input = 0;
+	}
+}
+
+static double stat_percentile(const stat_hist *h, double p)
+{
+	uint64_t want = (uint64_t)(p * (double)h->count);
+	uint64_t seen = 0;
+
+	for (int b = 0; b < STAT_BUCKETS; b++) {
+		seen += h->bucket[b];
+		if (seen > want) {
+			double upper = (b + 1) / 4.0;
+			return upper < h->max_ms ? upper : h->max_ms;
+		}
+	}
+	return h->max_ms;
+}
+
+void frameStatsDump(void)
+{
+	if (!frame_stats_enabled)
+		return;
+
+	printf("Frame stats (ms, percentiles to 0.25ms)\n");
+	printf("%-30s %8s %8s %8s %8s %8s %8s\n", "", "count", "mean", "p50",
+	       "p95", "p99", "max");
+	for (int i = 0; i < STAT_COUNT; i++) {
+		const stat_hist *h = &hists[i];
+
+		if (!h->count) {
+			printf("%-30s %8d\n", h->name, 0);
+			continue;
+		}
+		printf("%-30s %8llu %8.2f %8.2f %8.2f %8.2f %8.2f\n", h->name,
+		       (unsigned long long)h->count, h->sum_ms / h->count,
+		       stat_percentile(h, 0.50), stat_percentile(h, 0.95),
+		       stat_percentile(h, 0.99), h->max_ms);
+	}
+	printf("%-30s %8llu\n", "unchanged frames not presented",
+	       (unsigned long long)frames_skipped);
+
+	for (int i = 0; i < STAT_COUNT; i++) {
+		const stat_hist *h = &hists[i];
+
+		if (!h->count)
+			continue;
+		printf("\n%s histogram:\n", h->name);
+		for (int b = 0; b < STAT_BUCKETS; b++) {
+			if (!h->bucket[b])
+				continue;
+			if (b == STAT_BUCKETS - 1)
+				printf("  >=%6.2f %u\n", b / 4.0, h->bucket[b]);
+			else
+				printf("  %6.2f-%6.2f %u\n", b / 4.0, (b + 1) / 4.0,
+				       h->bucket[b]);
+		}
+	}
+}
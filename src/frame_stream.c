@@ -0,0 +1,642 @@
+/*
+ * frame_stream.c
+ *
+ * Live view of the native display, see frame_stream.h.  The emulator
+ * thread only copies a frame when its hash changes and someone watches;
+ * the stream thread diffs it with the last one sent, compresses it and
+ * queues it on each client's non-blocking socket.  A client that still
+ * has a message queued when the next frame comes misses the delta and
+ * gets a key frame once it has caught up, so a slow link only lowers its
+ * own frame rate.
+ */
+
+#ifdef NEXTP8
+
+#include <SDL.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define FRAME_STREAM_NET
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+#ifdef FRAME_STREAM_LZ4
+#include <lz4.h>
+#endif
+
+#include "emulator_options.h"
+#include "frame_stream.h"
+#include "nextp8.h"
+#include "thread_policy.h"
+
+#ifdef FRAME_STREAM_NET
+
+#define STREAM_CLIENTS		8
+#define STREAM_TICK_MS		20
+#define STREAM_HDR_LEN		12
+#define STREAM_REGS_LEN		52
+#define STREAM_LINE_LEN		64
+#define STREAM_RAW_MAX		(STREAM_REGS_LEN + 32 + 256 * STREAM_LINE_LEN)
+#ifdef FRAME_STREAM_LZ4
+#define STREAM_MSG_MAX		(STREAM_HDR_LEN + LZ4_COMPRESSBOUND(STREAM_RAW_MAX))
+#else
+#define STREAM_MSG_MAX		(STREAM_HDR_LEN + STREAM_RAW_MAX)
+#endif
+
+enum {
+	CLIENT_REQUEST,		/* reading the HTTP request or "P8FB\n" */
+	CLIENT_PAGE,		/* sending the viewer, then closed */
+	CLIENT_WS,
+	CLIENT_RAW
+};
+
+typedef struct {
+	int fd;
+	int mode;
+	char req[2048];
+	size_t req_len;
+	uint8_t *out;
+	size_t out_len, out_pos, out_size;
+	bool need_key;
+} stream_client;
+
+static int listen_fd = -1;
+static SDL_Thread *thread;
+static SDL_atomic_t quit;
+static stream_client clients[STREAM_CLIENTS];
+
+/* Streaming clients, so the emulator thread can skip the copy */
+static SDL_atomic_t watching;
+
+/* Emulator thread to stream thread */
+static SDL_SpinLock pending_lock;
+static nextp8_frame pending;
+static bool pending_new;
+static uint64_t posted_hash;
+static bool posted;
+
+/* Stream thread: the frame the last message brought clients up to */
+static nextp8_frame sent;
+static bool have_sent;
+
+static const char viewer_page[] =
+	"<!DOCTYPE html>\n"
+	"<html><head><meta charset=\"utf-8\"><title>nextp8</title>\n"
+	"<style>body{background:#222;color:#ccc;font:12px monospace}"
+	"canvas{width:512px;height:512px;image-rendering:pixelated;display:block}</style>\n"
+	"</head><body><canvas id=c width=128 height=128></canvas><div id=s>connecting</div>\n"
+	"<script>\n"
+	"const C=[0x000000,0x1d2b53,0x7e2553,0x008751,0xab5236,0x5f574f,0xc2c3c7,0xfff1e8,"
+	"0xff004d,0xffa300,0xffec27,0x00e436,0x29adff,0x83769c,0xff77a8,0xffccaa,"
+	"0x291814,0x111d35,0x422136,0x125359,0x742f29,0x49333b,0xa28879,0xf3ef7d,"
+	"0xbe1250,0xff6c24,0xa8e72e,0x00b54e,0x065ab5,0x754665,0xff6e59,0xff9d81];\n"
+	"const fb=new Uint8Array(8192),ov=new Uint8Array(8192),r=new Uint8Array(52);\n"
+	"const cv=document.getElementById('c').getContext('2d'),im=cv.createImageData(128,128);\n"
+	"const ci=c=>((c>>3)&16)|(c&15),nib=(b,i)=>i&1?b[i>>1]>>4:b[i>>1]&15;\n"
+	"const st=document.getElementById('s');let bytes=0,seq=0;\n"
+	"function lz4(s,n){const d=new Uint8Array(n);let i=0,o=0;\n"
+	" for(;;){const t=s[i++];let l=t>>4,b;if(l==15)do{b=s[i++];l+=b}while(b==255);\n"
+	"  d.set(s.subarray(i,i+l),o);i+=l;o+=l;if(i>=s.length)return d;\n"
+	"  const off=s[i]|s[i+1]<<8;i+=2;let m=t&15;if(m==15)do{b=s[i++];m+=b}while(b==255);\n"
+	"  for(m+=4;m--;o++)d[o]=d[o-off]}}\n"
+	"function xf(m,x,y){switch(m){case 1:return[x>>1,y];case 2:return[x,y>>1];"
+	"case 3:return[x>>1,y>>1];case 5:return[x<64?x:127-x,y];case 6:return[x,y<64?y:127-y];"
+	"case 7:return[x<64?x:127-x,y<64?y:127-y];case 129:return[127-x,y];case 130:return[x,127-y];"
+	"case 131:case 134:return[127-x,127-y];case 133:return[127-y,x];case 135:return[y,127-x]}"
+	"return[x,y]}\n"
+	"function draw(){const pal=[],sec=[],L=[],hc=r[49],px=im.data;\n"
+	" for(let i=0;i<16;i++){pal[i]=C[ci(r[i])];sec[i]=C[ci(r[16+i])]}\n"
+	" for(let y=0;y<128;y++){const bit=(r[32+(y>>3)]>>(y&7))&1;\n"
+	"  if(hc==0x10)L[y]=bit?sec:pal;\n"
+	"  else if((hc&0xf0)==0x30){const s=C[ci(r[16+(((y>>3)+bit)&15)])];"
+	"L[y]=pal.map((c,i)=>(r[i]&15)==(hc&15)?s:c)}\n"
+	"  else L[y]=pal}\n"
+	" for(let oy=0,p=0;oy<128;oy++)for(let ox=0;ox<128;ox++,p+=4){\n"
+	"  const[sx,sy]=xf(r[48],ox,oy);let line=L[sy];\n"
+	"  if(hc==0x20){const o=((sx+64)>>1)+sy*64;if(o<8192&&((sx+64)&1?fb[o]>>4:fb[o]&15))line=sec}\n"
+	"  let c=line[nib(fb,sy*128+sx)];\n"
+	"  if(r[51]){const v=nib(ov,oy*128+ox);if(v!=(r[50]&15))c=C[v]}\n"
+	"  px[p]=c>>16;px[p+1]=(c>>8)&255;px[p+2]=c&255;px[p+3]=255}\n"
+	" cv.putImageData(im,0,0)}\n"
+	"function msg(a){const b=new Uint8Array(a),v=new DataView(a);bytes+=a.byteLength;\n"
+	" seq=v.getUint32(4,true);let p=b.subarray(12);if(b[1]&1)p=lz4(p,v.getUint32(8,true));\n"
+	" r.set(p.subarray(0,52));let o=84;\n"
+	" for(let k=0;k<256;k++)if((p[52+(k>>3)]>>(k&7))&1){\n"
+	"  (k<128?fb:ov).set(p.subarray(o,o+64),(k&127)*64);o+=64}\n"
+	" draw()}\n"
+	"const ws=new WebSocket('ws://'+location.host+'/');ws.binaryType='arraybuffer';\n"
+	"ws.onmessage=e=>msg(e.data);ws.onclose=()=>st.textContent='closed';\n"
+	"setInterval(()=>{st.textContent='frame '+seq+', '+(bytes/1024).toFixed(1)+' KB/s';bytes=0},1000);\n"
+	"</script></body></html>\n";
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/* For the WebSocket handshake only */
+static void sha1(const uint8_t *data, size_t len, uint8_t out[20])
+{
+	uint32_t h[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+	uint8_t block[64];
+	uint64_t bits = (uint64_t)len * 8;
+	size_t i, n;
+	bool ended = false;
+
+	for (i = 0; !ended; i += 64) {
+		uint32_t w[80], a, b, c, d, e, t;
+		int j;
+
+		n = i < len ? (len - i < 64 ? len - i : 64) : 0;
+		memset(block, 0, sizeof(block));
+		memcpy(block, data + i, n);
+		if (n < 64 && i <= len)
+			block[n] = 0x80;
+		if (n < 56) {
+			for (j = 0; j < 8; j++)
+				block[56 + j] = bits >> (56 - 8 * j);
+			ended = true;
+		}
+		for (j = 0; j < 16; j++)
+			w[j] = (uint32_t)block[4 * j] << 24 | block[4 * j + 1] << 16 |
+			       block[4 * j + 2] << 8 | block[4 * j + 3];
+		for (; j < 80; j++) {
+			t = w[j - 3] ^ w[j - 8] ^ w[j - 14] ^ w[j - 16];
+			w[j] = t << 1 | t >> 31;
+		}
+		a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+		for (j = 0; j < 80; j++) {
+			uint32_t f, k;
+
+			if (j < 20) {
+				f = (b & c) | (~b & d);
+				k = 0x5a827999;
+			} else if (j < 40) {
+				f = b ^ c ^ d;
+				k = 0x6ed9eba1;
+			} else if (j < 60) {
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8f1bbcdc;
+			} else {
+				f = b ^ c ^ d;
+				k = 0xca62c1d6;
+			}
+			t = (a << 5 | a >> 27) + f + e + k + w[j];
+			e = d;
+			d = c;
+			c = b << 30 | b >> 2;
+			b = a;
+			a = t;
+		}
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+	}
+	for (i = 0; i < 20; i++)
+		out[i] = h[i / 4] >> (24 - 8 * (i % 4));
+}
+
+static void base64(const uint8_t *in, size_t len, char *out)
+{
+	static const char digits[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	size_t i;
+
+	for (i = 0; i < len; i += 3) {
+		uint32_t v = in[i] << 16 | (i + 1 < len ? in[i + 1] << 8 : 0) |
+			     (i + 2 < len ? in[i + 2] : 0);
+
+		*out++ = digits[v >> 18];
+		*out++ = digits[(v >> 12) & 63];
+		*out++ = i + 1 < len ? digits[(v >> 6) & 63] : '=';
+		*out++ = i + 2 < len ? digits[v & 63] : '=';
+	}
+	*out = 0;
+}
+
+/* The message for the lines of f set in mask; returns its length */
+static size_t encode(uint8_t *msg, const nextp8_frame *f, const uint8_t mask[32],
+		     uint32_t seq, bool key)
+{
+	static uint8_t raw[STREAM_RAW_MAX];
+	size_t n = 0;
+	int line;
+
+	memcpy(raw, f->palette, 16);
+	memcpy(raw + 16, f->secondary, 16);
+	memcpy(raw + 32, f->bitfield, 16);
+	raw[48] = f->transform;
+	raw[49] = f->high_colour;
+	raw[50] = f->overlay_control;
+	raw[51] = (f->overlay_control & _OVERLAY_ENABLE_BIT) != 0;
+	memcpy(raw + STREAM_REGS_LEN, mask, 32);
+	n = STREAM_REGS_LEN + 32;
+	for (line = 0; line < 256; line++) {
+		if (mask[line >> 3] & (1 << (line & 7))) {
+			memcpy(raw + n, line < 128 ? f->fb + line * STREAM_LINE_LEN :
+			       f->ov + (line - 128) * STREAM_LINE_LEN, STREAM_LINE_LEN);
+			n += STREAM_LINE_LEN;
+		}
+	}
+
+	msg[0] = key ? 'K' : 'D';
+	msg[1] = 0;
+	msg[2] = 1;
+	msg[3] = 0;
+	put_le32(msg + 4, seq);
+	put_le32(msg + 8, n);
+#ifdef FRAME_STREAM_LZ4
+	{
+		int z = LZ4_compress_default((const char *)raw, (char *)msg + STREAM_HDR_LEN,
+					     n, STREAM_MSG_MAX - STREAM_HDR_LEN);
+
+		if (z > 0 && (size_t)z < n) {
+			msg[1] = 1;
+			return STREAM_HDR_LEN + z;
+		}
+	}
+#endif
+	memcpy(msg + STREAM_HDR_LEN, raw, n);
+	return STREAM_HDR_LEN + n;
+}
+
+static void client_close(stream_client *c)
+{
+	if (c->mode == CLIENT_WS || c->mode == CLIENT_RAW)
+		SDL_AtomicAdd(&watching, -1);
+	close(c->fd);
+	free(c->out);
+	memset(c, 0, sizeof(*c));
+	c->fd = -1;
+}
+
+static bool reserve(stream_client *c, size_t len)
+{
+	if (c->out_len + len > c->out_size) {
+		size_t size = c->out_len + len + 4096;
+		uint8_t *p = realloc(c->out, size);
+
+		if (!p)
+			return false;
+		c->out = p;
+		c->out_size = size;
+	}
+	return true;
+}
+
+static bool queue(stream_client *c, const void *data, size_t len)
+{
+	if (!reserve(c, len))
+		return false;
+	memcpy(c->out + c->out_len, data, len);
+	c->out_len += len;
+	return true;
+}
+
+/* One message in the client's framing */
+static void queue_msg(stream_client *c, const uint8_t *msg, size_t len)
+{
+	uint8_t hdr[10];
+	size_t n = 0;
+
+	if (c->mode == CLIENT_WS) {
+		hdr[n++] = 0x82;		// FIN, binary
+		if (len < 126) {
+			hdr[n++] = len;
+		} else {
+			hdr[n++] = 126;
+			hdr[n++] = len >> 8;
+			hdr[n++] = len;
+		}
+	} else {
+		put_le32(hdr, len);
+		n = 4;
+	}
+	// All or nothing, or the stream would be out of step
+	if (!reserve(c, n + len)) {
+		c->need_key = true;
+		return;
+	}
+	queue(c, hdr, n);
+	queue(c, msg, len);
+}
+
+static void queue_key(stream_client *c)
+{
+	static uint8_t msg[STREAM_MSG_MAX];
+	uint8_t mask[32];
+
+	if (!have_sent)
+		return;
+	memset(mask, 0xff, sizeof(mask));
+	queue_msg(c, msg, encode(msg, &sent, mask, sent.seq, true));
+	c->need_key = false;
+}
+
+static void client_flush(stream_client *c)
+{
+	while (c->out_pos < c->out_len) {
+		ssize_t n = send(c->fd, c->out + c->out_pos, c->out_len - c->out_pos,
+				 MSG_NOSIGNAL);
+
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			return;
+		if (n <= 0) {
+			client_close(c);
+			return;
+		}
+		c->out_pos += n;
+	}
+	c->out_pos = c->out_len = 0;
+	if (c->mode == CLIENT_PAGE)
+		client_close(c);
+	else if (c->need_key)
+		queue_key(c);
+}
+
+static void client_request(stream_client *c)
+{
+	static const char guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+	char resp[256], accept_key[32], buf[128];
+	uint8_t digest[20];
+	const char *key;
+	size_t n;
+
+	if (c->req_len >= 5 && !memcmp(c->req, "P8FB\n", 5)) {
+		c->mode = CLIENT_RAW;
+	} else if (!strstr(c->req, "\r\n\r\n")) {
+		if (c->req_len == sizeof(c->req) - 1)
+			client_close(c);
+		return;
+	} else if (strncmp(c->req, "GET ", 4)) {
+		client_close(c);
+		return;
+	} else if ((key = strcasestr(c->req, "\nSec-WebSocket-Key:"))) {
+		key += 19;
+		while (*key == ' ')
+			key++;
+		n = strcspn(key, "\r\n");
+		if (n > 64) {
+			client_close(c);
+			return;
+		}
+		memcpy(buf, key, n);
+		memcpy(buf + n, guid, sizeof(guid) - 1);
+		sha1((const uint8_t *)buf, n + sizeof(guid) - 1, digest);
+		base64(digest, sizeof(digest), accept_key);
+		n = snprintf(resp, sizeof(resp), "HTTP/1.1 101 Switching Protocols\r\n"
+			     "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+			     "Sec-WebSocket-Accept: %s\r\n\r\n", accept_key);
+		queue(c, resp, n);
+		c->mode = CLIENT_WS;
+	} else {
+		n = snprintf(resp, sizeof(resp), "HTTP/1.0 200 OK\r\n"
+			     "Content-Type: text/html\r\n"
+			     "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+			     sizeof(viewer_page) - 1);
+		queue(c, resp, n);
+		queue(c, viewer_page, sizeof(viewer_page) - 1);
+		c->mode = CLIENT_PAGE;
+		client_flush(c);
+		return;
+	}
+	SDL_AtomicAdd(&watching, 1);
+	c->need_key = true;
+	client_flush(c);
+}
+
+static void client_read(stream_client *c)
+{
+	char buf[1024];
+	ssize_t n;
+
+	if (c->mode != CLIENT_REQUEST) {
+		// Viewers have nothing to say; a WebSocket close is followed by EOF
+		n = recv(c->fd, buf, sizeof(buf), 0);
+		if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+			client_close(c);
+		return;
+	}
+	n = recv(c->fd, c->req + c->req_len, sizeof(c->req) - 1 - c->req_len, 0);
+	if (n <= 0) {
+		if (n == 0 || (errno != EAGAIN && errno != EINTR))
+			client_close(c);
+		return;
+	}
+	c->req_len += n;
+	c->req[c->req_len] = 0;
+	client_request(c);
+}
+
+static void client_accept(void)
+{
+	int fd = accept(listen_fd, NULL, NULL);
+	int i;
+
+	if (fd < 0)
+		return;
+	for (i = 0; i < STREAM_CLIENTS && clients[i].fd >= 0; i++)
+		;
+	if (i == STREAM_CLIENTS) {
+		close(fd);
+		return;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	clients[i].fd = fd;
+	clients[i].mode = CLIENT_REQUEST;
+}
+
+/* Send f to everyone streaming, as a delta from the frame sent before */
+static void broadcast(const nextp8_frame *f)
+{
+	static uint8_t msg[STREAM_MSG_MAX];
+	uint8_t mask[32];
+	size_t len = 0;
+	int line, i;
+
+	memset(mask, 0, sizeof(mask));
+	for (line = 0; line < 128; line++) {
+		size_t off = line * STREAM_LINE_LEN;
+
+		if (!have_sent || memcmp(f->fb + off, sent.fb + off, STREAM_LINE_LEN))
+			mask[line >> 3] |= 1 << (line & 7);
+		if (!have_sent || memcmp(f->ov + off, sent.ov + off, STREAM_LINE_LEN))
+			mask[16 + (line >> 3)] |= 1 << (line & 7);
+	}
+	memcpy(&sent, f, sizeof(sent));
+	have_sent = true;
+
+	for (i = 0; i < STREAM_CLIENTS; i++) {
+		stream_client *c = &clients[i];
+
+		if (c->fd < 0 || (c->mode != CLIENT_WS && c->mode != CLIENT_RAW))
+			continue;
+		if (c->out_len) {
+			c->need_key = true;
+			continue;
+		}
+		if (c->need_key) {
+			queue_key(c);
+		} else {
+			if (!len)
+				len = encode(msg, f, mask, f->seq, false);
+			queue_msg(c, msg, len);
+		}
+		client_flush(c);
+	}
+}
+
+static int stream_thread(void *arg)
+{
+	static nextp8_frame frame;
+	struct pollfd p[STREAM_CLIENTS + 1];
+	int i, n;
+	bool have;
+
+	threadPolicyApply(THREAD_WORKER);
+
+	while (!SDL_AtomicGet(&quit)) {
+		p[0].fd = listen_fd;
+		p[0].events = POLLIN;
+		for (i = 0; i < STREAM_CLIENTS; i++) {
+			p[i + 1].fd = clients[i].fd;
+			p[i + 1].events = POLLIN | (clients[i].out_len ? POLLOUT : 0);
+		}
+		n = poll(p, STREAM_CLIENTS + 1, STREAM_TICK_MS);
+		if (n > 0) {
+			if (p[0].revents & POLLIN)
+				client_accept();
+			for (i = 0; i < STREAM_CLIENTS; i++) {
+				if (clients[i].fd < 0 || clients[i].fd != p[i + 1].fd)
+					continue;
+				if (p[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+					client_read(&clients[i]);
+				if (clients[i].fd >= 0 && (p[i + 1].revents & POLLOUT))
+					client_flush(&clients[i]);
+			}
+		}
+
+		SDL_AtomicLock(&pending_lock);
+		have = pending_new;
+		if (have)
+			memcpy(&frame, &pending, sizeof(frame));
+		pending_new = false;
+		SDL_AtomicUnlock(&pending_lock);
+		if (have)
+			broadcast(&frame);
+	}
+	return 0;
+}
+
+void frameStreamInit(void)
+{
+	int port = emulatorOptionInt("fb_stream_port");
+	const char *addr_str = emulatorOptionString("fb_stream_addr");
+	struct sockaddr_in addr;
+	int one = 1, i;
+
+	if (port <= 0)
+		return;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (!addr_str || !*addr_str)
+		addr_str = "127.0.0.1";
+	if (inet_pton(AF_INET, addr_str, &addr.sin_addr) != 1) {
+		fprintf(stderr, "Frame stream: bad fb_stream_addr %s\n", addr_str);
+		return;
+	}
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0) {
+		perror("fb_stream_port");
+		return;
+	}
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(listen_fd, 4) < 0) {
+		perror("fb_stream_port");
+		close(listen_fd);
+		listen_fd = -1;
+		return;
+	}
+	for (i = 0; i < STREAM_CLIENTS; i++)
+		clients[i].fd = -1;
+
+	SDL_AtomicSet(&quit, 0);
+	thread = SDL_CreateThread(stream_thread, "sQLux Frame stream", NULL);
+	if (!thread) {
+		fprintf(stderr, "Frame stream: thread creation failed: %s\n", SDL_GetError());
+		close(listen_fd);
+		listen_fd = -1;
+		return;
+	}
+	printf("Frame stream: viewer on http://%s:%d/%s\n", addr_str, port,
+#ifdef FRAME_STREAM_LZ4
+	       ""
+#else
+	       " (uncompressed, no liblz4 in this build)"
+#endif
+	       );
+}
+
+void frameStreamFrame(const nextp8_frame *f)
+{
+	if (!SDL_AtomicGet(&watching) || (posted && f->hash == posted_hash))
+		return;
+	SDL_AtomicLock(&pending_lock);
+	memcpy(&pending, f, sizeof(pending));
+	pending_new = true;
+	SDL_AtomicUnlock(&pending_lock);
+	posted_hash = f->hash;
+	posted = true;
+}
+
+void frameStreamStop(void)
+{
+	int i;
+
+	if (!thread)
+		return;
+	SDL_AtomicSet(&quit, 1);
+	SDL_WaitThread(thread, NULL);
+	thread = NULL;
+	for (i = 0; i < STREAM_CLIENTS; i++) {
+		if (clients[i].fd >= 0)
+			client_close(&clients[i]);
+	}
+	close(listen_fd);
+	listen_fd = -1;
+}
+
+#else
+
+void frameStreamInit(void)
+{
+	if (emulatorOptionInt("fb_stream_port") > 0)
+		fprintf(stderr, "Frame stream: fb_stream_port is not supported on this platform\n");
+}
+
+void frameStreamFrame(const nextp8_frame *f)
+{
+}
+
+void frameStreamStop(void)
+{
+}
+
+#endif /* FRAME_STREAM_NET */
+
+#endif /* NEXTP8 */
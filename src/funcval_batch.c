@@ -0,0 +1,334 @@
+/*
+ * funcval_batch.c
+ *
+ * Runs the FuncVal tests listed in a manifest, funcval_jobs at a time.
+ * Each manifest line is a test name followed by its emulator options,
+ * separated by white space; blank lines and lines starting with '#' are
+ * skipped.  Options given on the command line besides the batch ones
+ * apply to every test.
+ *
+ * Every test gets its own headless machine in a forked process, with
+ * stdout and stderr in <name>/output.log and its screenshots and WAV
+ * recordings in <name>/.  Idle workers take the next test from the
+ * manifest as they finish, so long tests don't hold up the rest.  The
+ * results file has one line per test: name, pass/fail, exit status,
+ * last POST code, seconds, screenshots and WAVs.
+ */
+
+#ifdef NEXTP8
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emulator_options.h"
+#include "funcval_batch.h"
+
+#if !defined(__WIN32__) && !defined(__EMSCRIPTEN__)
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BATCH_LINE	4096
+
+typedef struct {
+	char *name;
+	char **args;
+	int nargs;
+	pid_t pid;
+	double start;
+	double secs;
+	int status;
+} batch_job;
+
+static batch_job *jobs;
+static int njobs;
+
+static const char *const batch_options[] = {
+	"funcval_batch", "funcval_jobs", "funcval_results", NULL
+};
+
+static double batch_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void batch_add(char *line)
+{
+	batch_job *j;
+	char *tok, *save;
+
+	tok = strtok_r(line, " \t\r\n", &save);
+	if (!tok || *tok == '#')
+		return;
+
+	jobs = realloc(jobs, (njobs + 1) * sizeof(*jobs));
+	if (!jobs) {
+		fprintf(stderr, "funcval_batch: out of memory\n");
+		exit(1);
+	}
+	j = &jobs[njobs++];
+	memset(j, 0, sizeof(*j));
+	j->name = strdup(tok);
+	while ((tok = strtok_r(NULL, " \t\r\n", &save))) {
+		j->args = realloc(j->args, (j->nargs + 1) * sizeof(char *));
+		j->args[j->nargs++] = strdup(tok);
+	}
+}
+
+static int batch_read(const char *manifest)
+{
+	char line[BATCH_LINE];
+	FILE *f = fopen(manifest, "r");
+
+	if (!f) {
+		perror(manifest);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f))
+		batch_add(line);
+	fclose(f);
+	return 0;
+}
+
+/* argv[i] is one of the batch options; *skip counts its value too */
+static bool batch_option(const char *arg, int *skip)
+{
+	int i;
+
+	while (*arg == '-')
+		arg++;
+	for (i = 0; batch_options[i]; i++) {
+		size_t len = strlen(batch_options[i]);
+
+		if (strncmp(arg, batch_options[i], len))
+			continue;
+		if (arg[len] == '=') {
+			*skip = 1;
+			return true;
+		}
+		if (arg[len] == 0) {
+			*skip = 2;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Child: direct output to the test's directory and parse its options */
+static void batch_child(int argc, char **argv, batch_job *j)
+{
+	char path[BATCH_LINE];
+	char **args;
+	int fd, n = 0, i, skip;
+
+	if (mkdir(j->name, 0777) && errno != EEXIST) {
+		perror(j->name);
+		_exit(127);
+	}
+	snprintf(path, sizeof(path), "%s/output.log", j->name);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		perror(path);
+		_exit(127);
+	}
+	dup2(fd, 1);
+	dup2(fd, 2);
+	close(fd);
+
+	args = calloc(argc + j->nargs + 6, sizeof(char *));
+	if (!args)
+		_exit(127);
+	args[n++] = argv[0];
+	for (i = 1; i < argc; i += skip) {
+		skip = 1;
+		if (!batch_option(argv[i], &skip))
+			args[n++] = argv[i];
+	}
+	args[n++] = "--funcval";
+	args[n++] = "--headless";
+	args[n++] = "--funcval_outdir";
+	args[n++] = j->name;
+	for (i = 0; i < j->nargs; i++)
+		args[n++] = j->args[i];
+
+	emulatorOptionsRemove();
+	if (emulatorOptionParse(n, args))
+		_exit(127);
+}
+
+static int batch_count(const char *dir, const char *prefix)
+{
+	DIR *d = opendir(dir);
+	struct dirent *e;
+	int n = 0;
+
+	if (!d)
+		return 0;
+	while ((e = readdir(d))) {
+		if (!strncmp(e->d_name, prefix, strlen(prefix)))
+			n++;
+	}
+	closedir(d);
+	return n;
+}
+
+static int batch_post(const char *dir)
+{
+	char path[BATCH_LINE], line[BATCH_LINE];
+	unsigned code;
+	int post = -1;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/output.log", dir);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "POST: %u", &code) == 1)
+			post = code;
+	}
+	fclose(f);
+	return post;
+}
+
+static bool batch_passed(const batch_job *j)
+{
+	return WIFEXITED(j->status) && WEXITSTATUS(j->status) == 0;
+}
+
+static int batch_results(const char *file)
+{
+	FILE *f = fopen(file, "w");
+	int i, failed = 0;
+
+	if (!f) {
+		perror(file);
+		return -1;
+	}
+	fprintf(f, "# name\tresult\texit\tpost\tseconds\tscreenshots\twavs\n");
+	for (i = 0; i < njobs; i++) {
+		batch_job *j = &jobs[i];
+		int post = batch_post(j->name);
+		char exitstr[32];
+
+		if (WIFEXITED(j->status))
+			snprintf(exitstr, sizeof(exitstr), "%d", WEXITSTATUS(j->status));
+		else
+			snprintf(exitstr, sizeof(exitstr), "signal %d", WTERMSIG(j->status));
+		if (!batch_passed(j))
+			failed++;
+
+		fprintf(f, "%s\t%s\t%s\t", j->name, batch_passed(j) ? "pass" : "fail", exitstr);
+		if (post >= 0)
+			fprintf(f, "%d", post);
+		else
+			fprintf(f, "-");
+		fprintf(f, "\t%.2f\t%d\t%d\n", j->secs,
+			batch_count(j->name, "screenshot_"),
+			batch_count(j->name, "funcval_audio_"));
+	}
+	fclose(f);
+	return failed;
+}
+
+void funcvalBatch(int argc, char **argv)
+{
+	const char *manifest = emulatorOptionString("funcval_batch");
+	int workers = emulatorOptionInt("funcval_jobs");
+	int next = 0, running = 0, failed, i;
+	double start;
+
+	if (!strlen(manifest))
+		return;
+	if (batch_read(manifest))
+		exit(1);
+	if (!njobs) {
+		fprintf(stderr, "funcval_batch: no tests in %s\n", manifest);
+		exit(1);
+	}
+	if (workers <= 0)
+		workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers <= 0)
+		workers = 1;
+
+	printf("funcval_batch: %d tests, %d at a time\n", njobs, workers);
+	fflush(stdout);
+	start = batch_now();
+
+	while (next < njobs || running) {
+		int status;
+		pid_t pid;
+
+		while (running < workers && next < njobs) {
+			batch_job *j = &jobs[next++];
+
+			j->start = batch_now();
+			pid = fork();
+			if (pid == 0) {
+				batch_child(argc, argv, j);
+				return;
+			}
+			if (pid < 0) {
+				perror("fork");
+				j->status = 127 << 8;
+				continue;
+			}
+			j->pid = pid;
+			running++;
+		}
+		if (!running)
+			break;
+
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("waitpid");
+			break;
+		}
+		for (i = 0; i < njobs; i++) {
+			batch_job *j = &jobs[i];
+
+			if (j->pid != pid)
+				continue;
+			j->status = status;
+			j->secs = batch_now() - j->start;
+			j->pid = 0;
+			running--;
+			printf("funcval_batch: %s %s (%.2fs)\n", j->name,
+			       batch_passed(j) ? "pass" : "fail", j->secs);
+			break;
+		}
+	}
+
+	failed = batch_results(emulatorOptionString("funcval_results"));
+	printf("funcval_batch: %d of %d tests failed in %.2fs, results in %s\n",
+	       failed < 0 ? njobs : failed, njobs, batch_now() - start,
+	       emulatorOptionString("funcval_results"));
+	emulatorOptionsRemove();
+	exit(failed ? 1 : 0);
+}
+
+#else
+
+void funcvalBatch(int argc, char **argv)
+{
+	if (strlen(emulatorOptionString("funcval_batch"))) {
+		fprintf(stderr, "funcval_batch is not supported on this platform\n");
+		exit(1);
+	}
+}
+
+#endif
+
+#endif /* NEXTP8 */
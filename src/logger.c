@@ -0,0 +1,230 @@
+/*
+ * logger.c
+ *
+ * Leveled logger, see logger.h.  The ring is a bounded multi-producer
+ * queue of fixed size lines: a producer claims a slot by advancing head
+ * with a compare and swap and publishes it by setting the slot's
+ * sequence number, which the logger thread waits for.  When the ring is
+ * full a line is dropped and counted rather than waited for.
+ */
+
+#include <SDL.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "thread_policy.h"
+
+#define LOG_SLOTS	1024	/* a power of two */
+#define LOG_LINE	240
+#define LOG_IDLE_MS	10
+
+typedef struct {
+	SDL_atomic_t seq;
+	uint8_t level;
+	char text[LOG_LINE];
+} log_slot;
+
+uint8_t log_levels[LOG_MODULES] = {
+	LOG_INFO, LOG_INFO, LOG_INFO
+};
+
+static const char *const module_names[LOG_MODULES] = {
+	"emu", "hw", "audio"
+};
+
+static const char *const level_names[] = {
+	"error", "warn", "info", "debug"
+};
+
+static log_slot ring[LOG_SLOTS];
+static SDL_atomic_t head;
+static unsigned tail;
+static SDL_atomic_t dropped;
+static SDL_atomic_t quit;
+static SDL_Thread *thread;
+static bool queued;
+
+static void output(int level, const char *text)
+{
+	fputs(text, level <= LOG_WARN ? stderr : stdout);
+}
+
+static void push(int level, const char *text)
+{
+	for (;;) {
+		unsigned pos = SDL_AtomicGet(&head);
+		log_slot *s = &ring[pos & (LOG_SLOTS - 1)];
+		int d = (int)((unsigned)SDL_AtomicGet(&s->seq) - pos);
+
+		if (d == 0) {
+			if (!SDL_AtomicCAS(&head, pos, pos + 1))
+				continue;
+			s->level = level;
+			strcpy(s->text, text);
+			SDL_AtomicSet(&s->seq, pos + 1);
+			return;
+		}
+		if (d < 0) {
+			SDL_AtomicAdd(&dropped, 1);
+			return;
+		}
+	}
+}
+
+/* Logger thread, or logClose once it has stopped */
+static bool drain(void)
+{
+	bool any = false;
+	int n;
+
+	for (;;) {
+		log_slot *s = &ring[tail & (LOG_SLOTS - 1)];
+
+		if ((unsigned)SDL_AtomicGet(&s->seq) != tail + 1)
+			break;
+		output(s->level, s->text);
+		SDL_AtomicSet(&s->seq, tail + LOG_SLOTS);
+		tail++;
+		any = true;
+	}
+	n = SDL_AtomicSet(&dropped, 0);
+	if (n)
+		fprintf(stderr, "Log: %d messages dropped, the ring was full\n", n);
+	if (any) {
+		fflush(stdout);
+		fflush(stderr);
+	}
+	return any;
+}
+
+static int logger_thread(void *arg)
+{
+	(void)arg;
+	threadPolicyApply(THREAD_WORKER);
+	while (!SDL_AtomicGet(&quit)) {
+		if (!drain())
+			SDL_Delay(LOG_IDLE_MS);
+	}
+	return 0;
+}
+
+static void emit(int level, const char *text)
+{
+	if (queued)
+		push(level, text);
+	else
+		output(level, text);
+}
+
+void logWrite(log_site *site, int module, int level, const char *fmt, ...)
+{
+	char text[LOG_LINE];
+	uint32_t window = SDL_GetTicks() / 1000;
+	va_list args;
+
+	(void)module;
+	if (window != site->window) {
+		if (site->suppressed) {
+			snprintf(text, sizeof(text), "Log: %u more like the last suppressed\n",
+				 site->suppressed);
+			emit(level, text);
+		}
+		site->window = window;
+		site->count = 0;
+		site->suppressed = 0;
+	}
+	if (++site->count > LOG_BURST) {
+		site->suppressed++;
+		return;
+	}
+
+	va_start(args, fmt);
+	vsnprintf(text, sizeof(text), fmt, args);
+	va_end(args);
+	emit(level, text);
+}
+
+static int parse_level(const char *s, size_t len)
+{
+	int l;
+
+	for (l = 0; l <= LOG_DEBUG; l++) {
+		if (strlen(level_names[l]) == len && !strncmp(s, level_names[l], len))
+			return l;
+	}
+	if (len == 1 && *s >= '0' && *s <= '0' + LOG_DEBUG)
+		return *s - '0';
+	return -1;
+}
+
+static void parse_spec(const char *spec)
+{
+	const char *p = spec;
+	int m, l;
+
+	while (*p) {
+		const char *end = strchr(p, ',');
+		const char *eq;
+		size_t len;
+
+		if (!end)
+			end = p + strlen(p);
+		eq = memchr(p, '=', end - p);
+		len = end - (eq ? eq + 1 : p);
+		l = parse_level(eq ? eq + 1 : p, len);
+		if (l < 0) {
+			fprintf(stderr, "Log: bad level in %.*s\n", (int)(end - p), p);
+		} else if (!eq) {
+			for (m = 0; m < LOG_MODULES; m++)
+				log_levels[m] = l;
+		} else {
+			for (m = 0; m < LOG_MODULES; m++) {
+				if (strlen(module_names[m]) == (size_t)(eq - p) &&
+				    !strncmp(p, module_names[m], eq - p))
+					break;
+			}
+			if (m == LOG_MODULES)
+				fprintf(stderr, "Log: no module %.*s\n", (int)(eq - p), p);
+			else
+				log_levels[m] = l;
+		}
+		p = *end ? end + 1 : end;
+	}
+	for (m = 0; m < LOG_MODULES; m++) {
+		if (log_levels[m] > LOG_COMPILED_LEVEL) {
+			fprintf(stderr, "Log: messages above %s are not compiled in\n",
+				level_names[LOG_COMPILED_LEVEL]);
+			break;
+		}
+	}
+}
+
+void logInit(const char *spec)
+{
+	int i;
+
+	if (spec && *spec)
+		parse_spec(spec);
+	for (i = 0; i < LOG_SLOTS; i++)
+		SDL_AtomicSet(&ring[i].seq, i);
+	SDL_AtomicSet(&quit, 0);
+	thread = SDL_CreateThread(logger_thread, "Logger", NULL);
+	if (!thread)
+		fprintf(stderr, "Log: no logger thread, printing directly: %s\n", SDL_GetError());
+	queued = thread != NULL;
+}
+
+void logClose(void)
+{
+	if (!thread)
+		return;
+	SDL_AtomicSet(&quit, 1);
+	SDL_WaitThread(thread, NULL);
+	thread = NULL;
+	drain();
+	queued = false;
+}
@@ -0,0 +1,321 @@
+/*
+ * metrics.c
+ *
+ * Runtime counters and histograms, see metrics.h.  Histograms use the
+ * same power of two buckets as the audio stats (0, 1, 2-3, 4-7, ...).
+ * One reporting thread prints the interval log line and the SIGUSR1
+ * dump and serves the Prometheus endpoint, so nothing is formatted on
+ * the threads being measured.
+ */
+
+#include <SDL.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define METRICS_HTTP
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "emulator_options.h"
+#include "metrics.h"
+#include "thread_policy.h"
+
+#define HIST_BUCKETS	33
+#define METRICS_TICK_MS	100
+
+typedef struct {
+	uint64_t bucket[HIST_BUCKETS];
+	uint64_t count;
+	uint64_t sum;
+} metric_hist;
+
+bool metrics_enabled = false;
+uint64_t metric_values[METRIC_COUNT];
+uint64_t metric_hw_reads[METRIC_REGIONS];
+uint64_t metric_hw_writes[METRIC_REGIONS];
+
+static metric_hist hists[METRIC_HIST_COUNT];
+
+static const char *const metric_names[METRIC_COUNT] = {
+	"instructions",
+	"chunks",
+	"exceptions",
+	"interrupts",
+	"sd_sectors_read",
+	"sd_sectors_written",
+	"sd_cache_hits",
+	"sd_cache_misses",
+	"esp_uart_tx_bytes",
+	"esp_uart_rx_bytes",
+	"esp_commands",
+	"esp_net_tx_bytes",
+	"esp_net_rx_bytes",
+	"frames_rendered",
+	"frames_skipped",
+	"audio_callbacks",
+	"audio_underruns",
+};
+
+static const char *const region_names[METRIC_REGIONS] = {
+	"regs", "kbd", "da", "fb", "palette", "p8audio", "sd_dma",
+};
+
+static const char *const hist_names[METRIC_HIST_COUNT] = {
+	"render_us",
+	"audio_callback_us",
+	"input_latency_us",
+};
+
+static uint64_t ticks_per_us = 1;
+static int interval_ms;
+static SDL_atomic_t dump_requested;
+static SDL_atomic_t quit;
+static SDL_Thread *thread;
+#ifdef METRICS_HTTP
+static int listen_fd = -1;
+#endif
+
+uint64_t metricsNow(void)
+{
+	return SDL_GetPerformanceCounter();
+}
+
+uint64_t metricsSinceUs(uint64_t start)
+{
+	uint64_t now = SDL_GetPerformanceCounter();
+
+	return now > start ? (now - start) / ticks_per_us : 0;
+}
+
+void metricHist(int hist, uint64_t value)
+{
+	metric_hist *h = &hists[hist];
+	int b = 0;
+
+	if (!metrics_enabled)
+		return;
+	while (b < HIST_BUCKETS - 1 && (value >> b))
+		b++;
+	h->bucket[b]++;
+	h->count++;
+	h->sum += value;
+}
+
+void metricsRequestDump(void)
+{
+	if (metrics_enabled)
+		SDL_AtomicSet(&dump_requested, 1);
+}
+
+/* Counters as "name=value" pairs, with the rate of instructions */
+static void log_line(double secs)
+{
+	static uint64_t last_insns;
+	uint64_t insns = metric_values[METRIC_INSNS];
+
+	printf("Metrics: mips=%.2f", secs > 0 ? (insns - last_insns) / secs / 1e6 : 0.0);
+	last_insns = insns;
+	for (int i = 0; i < METRIC_COUNT; i++)
+		printf(" %s=%llu", metric_names[i], (unsigned long long)metric_values[i]);
+	printf("\n");
+}
+
+static void dump(void)
+{
+	printf("Metrics\n");
+	for (int i = 0; i < METRIC_COUNT; i++)
+		printf("%-24s %12llu\n", metric_names[i],
+		       (unsigned long long)metric_values[i]);
+	printf("%-24s %12s %12s\n", "HW region", "reads", "writes");
+	for (int i = 0; i < METRIC_REGIONS; i++)
+		printf("%-24s %12llu %12llu\n", region_names[i],
+		       (unsigned long long)metric_hw_reads[i],
+		       (unsigned long long)metric_hw_writes[i]);
+	for (int i = 0; i < METRIC_HIST_COUNT; i++) {
+		const metric_hist *h = &hists[i];
+
+		printf("%-24s %12llu mean %.1f\n", hist_names[i],
+		       (unsigned long long)h->count,
+		       h->count ? (double)h->sum / h->count : 0.0);
+	}
+}
+
+#ifdef METRICS_HTTP
+static size_t put(char *buf, size_t size, size_t len, const char *fmt, ...)
+	__attribute__((format(printf, 4, 5)));
+
+static size_t put(char *buf, size_t size, size_t len, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (len >= size)
+		return len;
+	va_start(ap, fmt);
+	n = vsnprintf(buf + len, size - len, fmt, ap);
+	va_end(ap);
+	return n > 0 ? len + n : len;
+}
+
+/* Prometheus text exposition format */
+static size_t prometheus_text(char *buf, size_t size)
+{
+	size_t len = 0;
+
+	for (int i = 0; i < METRIC_COUNT; i++)
+		len = put(buf, size, len, "# TYPE sqlux_%s_total counter\nsqlux_%s_total %llu\n",
+			  metric_names[i], metric_names[i],
+			  (unsigned long long)metric_values[i]);
+	len = put(buf, size, len, "# TYPE sqlux_hw_reads_total counter\n");
+	for (int i = 0; i < METRIC_REGIONS; i++)
+		len = put(buf, size, len, "sqlux_hw_reads_total{region=\"%s\"} %llu\n",
+			  region_names[i], (unsigned long long)metric_hw_reads[i]);
+	len = put(buf, size, len, "# TYPE sqlux_hw_writes_total counter\n");
+	for (int i = 0; i < METRIC_REGIONS; i++)
+		len = put(buf, size, len, "sqlux_hw_writes_total{region=\"%s\"} %llu\n",
+			  region_names[i], (unsigned long long)metric_hw_writes[i]);
+	for (int i = 0; i < METRIC_HIST_COUNT; i++) {
+		const metric_hist *h = &hists[i];
+		uint64_t seen = 0;
+
+		len = put(buf, size, len, "# TYPE sqlux_%s histogram\n", hist_names[i]);
+		// Bucket b holds values below 2^b
+		for (int b = 0; b < HIST_BUCKETS - 1; b++) {
+			seen += h->bucket[b];
+			len = put(buf, size, len, "sqlux_%s_bucket{le=\"%llu\"} %llu\n",
+				  hist_names[i], b ? (1ULL << b) - 1 : 0ULL,
+				  (unsigned long long)seen);
+		}
+		len = put(buf, size, len, "sqlux_%s_bucket{le=\"+Inf\"} %llu\n"
+			  "sqlux_%s_sum %llu\nsqlux_%s_count %llu\n",
+			  hist_names[i], (unsigned long long)h->count,
+			  hist_names[i], (unsigned long long)h->sum,
+			  hist_names[i], (unsigned long long)h->count);
+	}
+	return len < size ? len : size - 1;
+}
+
+/* Any request gets the metrics; one client at a time is plenty */
+static void serve_one(void)
+{
+	static char body[16384];
+	char req[1024], hdr[128];
+	size_t len;
+	int fd = accept(listen_fd, NULL, NULL);
+
+	if (fd < 0)
+		return;
+	if (recv(fd, req, sizeof(req), 0) >= 0) {
+		len = prometheus_text(body, sizeof(body));
+		snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\n"
+			 "Content-Type: text/plain; version=0.0.4\r\n"
+			 "Content-Length: %zu\r\n\r\n", len);
+		if (send(fd, hdr, strlen(hdr), 0) >= 0)
+			send(fd, body, len, 0);
+	}
+	close(fd);
+}
+
+static bool http_open(int port)
+{
+	struct sockaddr_in addr;
+	int one = 1;
+
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0) {
+		perror("metrics_port");
+		return false;
+	}
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(listen_fd, 4) < 0) {
+		perror("metrics_port");
+		close(listen_fd);
+		listen_fd = -1;
+		return false;
+	}
+	printf("Metrics: Prometheus endpoint on http://127.0.0.1:%d/metrics\n", port);
+	return true;
+}
+#endif
+
+static int metrics_thread(void *arg)
+{
+	Uint32 last_log = SDL_GetTicks();
+
+	threadPolicyApply(THREAD_WORKER);
+
+	while (!SDL_AtomicGet(&quit)) {
+#ifdef METRICS_HTTP
+		if (listen_fd >= 0) {
+			struct pollfd p = { listen_fd, POLLIN, 0 };
+
+			if (poll(&p, 1, METRICS_TICK_MS) > 0)
+				serve_one();
+		} else
+#endif
+			SDL_Delay(METRICS_TICK_MS);
+
+		if (SDL_AtomicGet(&dump_requested)) {
+			SDL_AtomicSet(&dump_requested, 0);
+			dump();
+		}
+		if (interval_ms && SDL_GetTicks() - last_log >= (Uint32)interval_ms) {
+			Uint32 now = SDL_GetTicks();
+
+			log_line((now - last_log) / 1000.0);
+			last_log = now;
+		}
+	}
+	return 0;
+}
+
+void metricsInit(void)
+{
+	int port = emulatorOptionInt("metrics_port");
+
+	interval_ms = emulatorOptionInt("metrics_interval") * 1000;
+	metrics_enabled = emulatorOptionFlag("metrics") || interval_ms > 0 || port > 0;
+	if (!metrics_enabled)
+		return;
+	ticks_per_us = SDL_GetPerformanceFrequency() / 1000000;
+	if (!ticks_per_us)
+		ticks_per_us = 1;
+#ifdef METRICS_HTTP
+	if (port > 0)
+		http_open(port);
+#else
+	if (port > 0)
+		fprintf(stderr, "Metrics: metrics_port is not supported on this platform\n");
+#endif
+	SDL_AtomicSet(&quit, 0);
+	thread = SDL_CreateThread(metrics_thread, "sQLux Metrics", NULL);
+	if (!thread)
+		fprintf(stderr, "Metrics: reporting thread creation failed: %s\n",
+			SDL_GetError());
+}
+
+void metricsClose(void)
+{
+	if (!thread)
+		return;
+	SDL_AtomicSet(&quit, 1);
+	SDL_WaitThread(thread, NULL);
+	thread = NULL;
+#ifdef METRICS_HTTP
+	if (listen_fd >= 0) {
+		close(listen_fd);
+		listen_fd = -1;
+	}
+#endif
+}
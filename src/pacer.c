@@ -0,0 +1,367 @@
+/*
+ * pacer.c
+ *
+ * Replaces the SDL_AddTimer based 50Hz tick.  In timer mode a thread
+ * sleeps to absolute deadlines on the monotonic clock and runs the tick
+ * handler; in vsync mode the SDL thread ticks after every present, so
+ * frames follow the display refresh.  When a speed is set, instructions
+ * executed are the emulated time base: the emulator thread sleeps until
+ * the wall clock catches up with the work it has done instead of waiting
+ * for the next tick in 20ms bursts.
+ *
+ * Headless runs have no clock at all: emulation runs free and a tick is
+ * raised every headless_tick instructions (or the speed's tick budget).
+ *
+ * With --cycle_timing the time base is CPU cycles at --cpu_mhz instead:
+ * the tick is raised from here every 20ms of emulated cycles, and in
+ * windowed timer mode emulation is paced to the wall clock at that rate.
+ *
+ * An idle guest (see idle.h) skips ahead to the pacer's next tick where
+ * the pacer raises it, and otherwise sleeps until the host tick arrives.
+ *
+ * Fast forward runs like headless: the host ticks stop, the emulator
+ * thread raises a tick every 50Hz worth of instructions and only every
+ * --turbo_skip th tick (or one per display refresh) is rendered.  The
+ * emulated clock keeps the time gained, so it never runs backwards.
+ */
+
+#include <SDL.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "cycles.h"
+#include "emulator_options.h"
+#ifdef NEXTP8
+#include "netplay.h"
+#endif
+#include "pacer.h"
+#include "replay.h"
+#include "thread_policy.h"
+#ifdef NEXTP8
+#include "savestate.h"
+#endif
+#include "SDL2screen.h"
+#include "unixstuff.h"
+
+#define NS_PER_SEC	1000000000ULL
+#define NS_PER_MS	1000000ULL
+#define TICK_NS		(NS_PER_SEC / PACER_TICK_HZ)
+#define INSNS_PER_LOOP	300	/* speed counts 300 instruction loops per tick */
+#define MAX_LAG_NS	(100 * NS_PER_MS)
+#define MIN_VSYNC_NS	(NS_PER_SEC / 240)
+#define IDLE_BRIEF_NS	(200 * 1000ULL)
+
+bool pacer_vsync = false;
+
+static SDL_Thread *tick_thread = NULL;
+static SDL_atomic_t tick_quit;
+static SDL_atomic_t turbo;
+static uint64_t headless_tick;
+static int turbo_skip;
+static uint64_t turbo_frame_ns;
+
+/* Emulator thread only */
+static uint64_t base_ns;	/* emulated time at the start of this tick */
+static uint64_t done;		/* instructions or cycles run since base_ns */
+static uint64_t per_tick;	/* instructions or cycles per tick, 0 if not counted */
+static uint64_t ahead_ns;	/* emulated time gained by fast forward */
+static bool was_turbo;
+static bool free_run;
+
+uint64_t pacerNowNs(void)
+{
+#ifdef __linux__
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+#else
+	static uint64_t freq;
+	uint64_t c = SDL_GetPerformanceCounter();
+
+	if (!freq)
+		freq = SDL_GetPerformanceFrequency();
+	return (c / freq) * NS_PER_SEC + (c % freq) * NS_PER_SEC / freq;
+#endif
+}
+
+void pacerSleepUntil(uint64_t deadline_ns)
+{
+#ifdef __linux__
+	struct timespec ts;
+
+	ts.tv_sec = deadline_ns / NS_PER_SEC;
+	ts.tv_nsec = deadline_ns % NS_PER_SEC;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+#else
+	uint64_t now;
+
+	while ((now = pacerNowNs()) < deadline_ns)
+		SDL_Delay((Uint32)((deadline_ns - now + NS_PER_MS - 1) / NS_PER_MS));
+#endif
+}
+
+static int pacer_tick_thread(void *data)
+{
+	uint64_t next = pacerNowNs() + TICK_NS;
+
+	threadPolicyApply(THREAD_TIMER);
+
+	while (!SDL_AtomicGet(&tick_quit)) {
+		uint64_t now;
+
+		pacerSleepUntil(next);
+		if (!SDL_AtomicGet(&turbo))
+			QLSDL50Hz(1000 / PACER_TICK_HZ, NULL);
+
+		// After a host stall carry on from now rather than tick in a burst
+		next += TICK_NS;
+		now = pacerNowNs();
+		if (now > next + TICK_NS)
+			next = now + TICK_NS;
+	}
+	return 0;
+}
+
+void pacerInit(void)
+{
+	const char *mode = emulatorOptionString("pacer");
+	int n = emulatorOptionInt("headless_tick");
+
+	headless_tick = n > 0 ? (uint64_t)n : 80000;
+	if (ql_headless)
+		return;
+
+	turbo_skip = emulatorOptionInt("turbo_skip");
+	turbo_frame_ns = NS_PER_SEC / 60;
+
+	pacer_vsync = mode && !strcmp(mode, "vsync");
+#ifdef NEXTP8
+	if (pacer_vsync && (replay_mode != REPLAY_OFF || netplay_on)) {
+		printf("%s: display refresh ticks can't be replayed, using timer\n",
+		       netplay_on ? "Netplay" : "Replay");
+		pacer_vsync = false;
+	}
+#endif
+	if (pacer_vsync) {
+		// The first tick starts the render loop, presents drive the rest
+		QLSDL50Hz(1000 / PACER_TICK_HZ, NULL);
+		return;
+	}
+	if (mode && strcmp(mode, "timer"))
+		printf("Unknown pacer %s, using timer\n", mode);
+	if (cycle_timing)
+		return;
+
+	SDL_AtomicSet(&tick_quit, 0);
+	tick_thread = SDL_CreateThread(pacer_tick_thread, "sQLux Pacer", NULL);
+	if (!tick_thread)
+		printf("Pacer thread creation failed: %s\n", SDL_GetError());
+}
+
+void pacerStop(void)
+{
+	if (tick_thread) {
+		SDL_AtomicSet(&tick_quit, 1);
+		SDL_WaitThread(tick_thread, NULL);
+		tick_thread = NULL;
+	}
+}
+
+void pacerPresented(void)
+{
+	static uint64_t last;
+	uint64_t now = pacerNowNs();
+
+	// Don't spin if the present came back without waiting for vsync
+	if (last && now < last + MIN_VSYNC_NS) {
+		pacerSleepUntil(last + MIN_VSYNC_NS);
+		now = pacerNowNs();
+	}
+	last = now;
+	if (!SDL_AtomicGet(&turbo))
+		QLSDL50Hz(1000 / PACER_TICK_HZ, NULL);
+}
+
+void pacerSetTurbo(bool on, int refresh_hz)
+{
+	if (ql_headless || SDL_AtomicGet(&turbo) == on)
+		return;
+	if (refresh_hz > 0)
+		turbo_frame_ns = NS_PER_SEC / refresh_hz;
+	SDL_AtomicSet(&turbo, on);
+	// Presents stopped ticking, start the render loop again
+	if (!on && pacer_vsync)
+		QLSDL50Hz(1000 / PACER_TICK_HZ, NULL);
+}
+
+bool pacerTurbo(void)
+{
+	return SDL_AtomicGet(&turbo);
+}
+
+bool pacerTurboFrame(void)
+{
+	static int skipped;
+	static uint64_t last;
+	uint64_t now;
+
+	if (turbo_skip > 0) {
+		if (++skipped < turbo_skip)
+			return false;
+		skipped = 0;
+		return true;
+	}
+	now = pacerNowNs();
+	if (now < last + turbo_frame_ns)
+		return false;
+	last = now;
+	return true;
+}
+
+// The clock emulated time follows when it isn't counted in instructions
+static uint64_t emu_clock(void)
+{
+	return pacerNowNs() + ahead_ns;
+}
+
+// Emulated time in ns on the emulator thread: counted in instructions
+// when they are the time base, otherwise the clock the ticks come from
+uint64_t pacerEmuNs(void)
+{
+	if (!per_tick || (pacer_vsync && !was_turbo))
+		return emu_clock();
+	return base_ns + done * TICK_NS / per_tick;
+}
+
+uint64_t pacerUntilTick(void)
+{
+	if (!per_tick)
+		return 0;
+	return done < per_tick ? per_tick - done : 1;
+}
+
+void pacerIdleWait(bool brief)
+{
+	if (SDL_AtomicGet(&doPoll))
+		return;
+	if (brief || !sem50Hz)
+		pacerSleepUntil(pacerNowNs() + (brief ? IDLE_BRIEF_NS : TICK_NS));
+	else
+		SDL_SemWaitTimeout(sem50Hz, 1000 / PACER_TICK_HZ);
+}
+
+// Emulated time starts again from now.  With cycle timing the next tick
+// stays where it was in the cycles, so stalls can't move it
+static void restart(uint64_t now)
+{
+	if (!cycle_timing || done >= per_tick)
+		done = 0;
+	base_ns = now - (per_tick ? done * TICK_NS / per_tick : 0);
+}
+
+void pacerFreeRun(bool on)
+{
+	free_run = on;
+}
+
+#ifdef NEXTP8
+void pacerSaveState(ss_buf *b)
+{
+	ssPut64(b, base_ns);
+	ssPut64(b, done);
+}
+
+int pacerLoadState(ss_buf *b)
+{
+	uint64_t base = ssGet64(b);
+
+	done = ssGet64(b);
+	// Another run's clock means nothing here, start again from now
+	base_ns = base <= emu_clock() || ql_headless ? base : 0;
+	return b->error ? -1 : 0;
+}
+#endif
+
+void pacerThrottle(long n)
+{
+	static int last_speed;
+	uint64_t now, deadline;
+	bool fast = !ql_headless && SDL_AtomicGet(&turbo);
+
+	if (fast != was_turbo) {
+		now = pacerNowNs();
+		if (fast) {
+			base_ns = pacerEmuNs();
+			if (cycle_timing && per_tick)
+				base_ns -= done * TICK_NS / per_tick;
+		} else {
+			// Carry on from the emulated time reached
+			if (base_ns > now)
+				ahead_ns = base_ns - now;
+			base_ns = 0;
+		}
+		if (!cycle_timing)
+			done = 0;
+		was_turbo = fast;
+	}
+
+	if (ql_headless || fast) {
+		if (cycle_timing)
+			per_tick = (uint64_t)cpu_mhz * 1000000 / PACER_TICK_HZ;
+		else
+			per_tick = speed > 0 ? (uint64_t)speed * INSNS_PER_LOOP : headless_tick;
+		done += n;
+		while (done >= per_tick) {
+			done -= per_tick;
+			base_ns += TICK_NS;
+			QLSDL50Hz(1000 / PACER_TICK_HZ, NULL);
+		}
+		return;
+	}
+
+	if (cycle_timing) {
+		per_tick = (uint64_t)cpu_mhz * 1000000 / PACER_TICK_HZ;
+	} else if (speed > 0) {
+		per_tick = (uint64_t)speed * INSNS_PER_LOOP;
+	} else {
+		per_tick = 0;
+		return;
+	}
+
+	if (pacer_vsync) {
+		// One tick's worth of work per displayed frame
+		done += n;
+		if (done >= per_tick) {
+			SDL_SemWait(sem50Hz);
+			done = 0;
+		}
+		return;
+	}
+
+	now = emu_clock();
+	if (!base_ns || speed != last_speed) {
+		restart(now);
+		last_speed = speed;
+	}
+
+	done += n;
+	while (done >= per_tick) {
+		base_ns += TICK_NS;
+		done -= per_tick;
+		if (cycle_timing)
+			QLSDL50Hz(1000 / PACER_TICK_HZ, NULL);
+	}
+	deadline = base_ns + done * TICK_NS / per_tick;
+
+	if (free_run)
+		return;
+	if (deadline > now + NS_PER_MS) {
+		pacerSleepUntil(deadline);
+	} else if (now > deadline + MAX_LAG_NS) {
+		// Too far behind to catch up smoothly, start again from now
+		restart(now);
+	}
+}
@@ -0,0 +1,137 @@
+/*
+ * startup_timing.c
+ *
+ * Start-up phase timing, see startup_timing.h.  Times are SDL
+ * performance counter ticks, which need no SDL_Init().  Each phase and
+ * event is timed from one thread; the report may come from the emulator
+ * thread (the hand-off) or the main one (exit), whichever is first.
+ */
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "startup_timing.h"
+
+uint64_t startup_at[STARTUP_PHASES];
+
+static const char *const names[STARTUP_PHASES] = {
+	"options", "emulator_init", "rom_load", "optable", "screen", "audio",
+	"verilator", "esp", "ssl",
+	"first_insn", "first_vblank", "first_sd_read", "handoff",
+};
+
+static uint64_t t0;
+static uint64_t spent[STARTUP_PHASES];
+static bool timed[STARTUP_PHASES];
+static char *json_file;
+static int handoff_post = -1;
+static int last_post = -1;
+static SDL_atomic_t dumped;
+
+void startupTimingStart(void)
+{
+	t0 = SDL_GetPerformanceCounter();
+}
+
+void startupTimingInit(const char *json, int post)
+{
+	json_file = json && *json ? strdup(json) : NULL;
+	handoff_post = post;
+}
+
+uint64_t startupNow(void)
+{
+	return SDL_GetPerformanceCounter();
+}
+
+void startupAdd(enum startup_phase p, uint64_t since)
+{
+	spent[p] += SDL_GetPerformanceCounter() - since;
+	timed[p] = true;
+}
+
+void startupAddUs(enum startup_phase p, uint64_t us)
+{
+	spent[p] += us * SDL_GetPerformanceFrequency() / 1000000;
+	timed[p] = true;
+}
+
+void startupEvent(enum startup_phase p)
+{
+	uint64_t now = SDL_GetPerformanceCounter();
+
+	// 0 is "not yet"
+	startup_at[p] = now > t0 ? now : t0 + 1;
+}
+
+void startupPost(unsigned d)
+{
+	// Without a hand-off code, the last one before the report stands in
+	if (handoff_post < 0) {
+		last_post = (int)d;
+		startupEvent(STARTUP_HANDOFF);
+		return;
+	}
+	if ((int)d != handoff_post || startup_at[STARTUP_HANDOFF])
+		return;
+	last_post = (int)d;
+	startupEvent(STARTUP_HANDOFF);
+	startupTimingDump();
+}
+
+/* ms, or -1 if it didn't happen */
+static double phase_ms(int p, double ticks_per_ms)
+{
+	if (p < STARTUP_FIRST_INSN)
+		return timed[p] ? spent[p] / ticks_per_ms : -1.0;
+	return startup_at[p] ? (startup_at[p] - t0) / ticks_per_ms : -1.0;
+}
+
+void startupTimingDump(void)
+{
+	double ticks_per_ms, ms;
+	FILE *f;
+	int p;
+
+	if (!SDL_AtomicCAS(&dumped, 0, 1))
+		return;
+	ticks_per_ms = (double)SDL_GetPerformanceFrequency() / 1000.0;
+
+	if (V2) {
+		printf("Start-up timing (ms; phases spent, events since main):\n");
+		for (p = 0; p < STARTUP_PHASES; p++) {
+			ms = phase_ms(p, ticks_per_ms);
+			if (ms < 0)
+				printf("  %-14s %9s\n", names[p], "-");
+			else if (p == STARTUP_HANDOFF)
+				printf("  %-14s %9.3f (POST %d)\n", names[p], ms, last_post);
+			else
+				printf("  %-14s %9.3f\n", names[p], ms);
+		}
+	}
+
+	if (!json_file)
+		return;
+	f = fopen(json_file, "w");
+	if (!f) {
+		perror(json_file);
+		return;
+	}
+	fprintf(f, "{\"phases_ms\":{");
+	for (p = 0; p < STARTUP_PHASES; p++) {
+		if (p == STARTUP_FIRST_INSN)
+			fprintf(f, "},\"events_ms\":{");
+		else if (p)
+			fprintf(f, ",");
+		ms = phase_ms(p, ticks_per_ms);
+		if (ms < 0)
+			fprintf(f, "\"%s\":null", names[p]);
+		else
+			fprintf(f, "\"%s\":%.3f", names[p], ms);
+	}
+	fprintf(f, "},\"handoff_post\":%d}\n", startup_at[STARTUP_HANDOFF] ? last_post : -1);
+	fclose(f);
+}
@@ -0,0 +1,230 @@
+/*
+ * thread_policy.c
+ *
+ * Thread placement and priority, see thread_policy.h.  Both options are
+ * role=value lists separated by commas, e.g.
+ *
+ *   --thread_cpus cpu=2,audio=3,main=0-1,worker=0-1
+ *   --thread_priority cpu=high,audio=realtime
+ *
+ * A CPU set is CPU numbers and ranges joined by '+' (0-1+3), up to CPU
+ * 63.  A priority is low, normal, high or realtime.  realtime asks for
+ * MMCSS on Windows and SDL's time critical priority elsewhere, which SDL
+ * makes real-time scheduling (through rtkit when need be); when that is
+ * refused the thread falls back to high priority.  Placement works on
+ * Linux and Windows only; on Linux it is the raw system call.
+ */
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <SDL.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "thread_policy.h"
+
+enum {
+	PRIO_DEFAULT,
+	PRIO_LOW,
+	PRIO_NORMAL,
+	PRIO_HIGH,
+	PRIO_REALTIME
+};
+
+static const char *const role_names[THREAD_ROLES] = {
+	"main", "cpu", "audio", "timer", "profiler", "worker"
+};
+
+static const char *const prio_names[] = {
+	"", "low", "normal", "high", "realtime"
+};
+
+static uint64_t cpus[THREAD_ROLES];	/* 0 for anywhere */
+static int prios[THREAD_ROLES];
+static SDL_atomic_t warned;		/* a failure reported */
+
+static void warn_once(const char *what, int role)
+{
+	if (SDL_AtomicCAS(&warned, 0, 1))
+		fprintf(stderr, "Threads: %s not allowed for %s, keeping the default (%s)\n",
+			what, role_names[role], SDL_GetError());
+}
+
+static int parse_role(const char *s, size_t len)
+{
+	int r;
+
+	for (r = 0; r < THREAD_ROLES; r++) {
+		if (strlen(role_names[r]) == len && !strncmp(s, role_names[r], len))
+			return r;
+	}
+	return -1;
+}
+
+/* 0-1+3 style; 0 when it doesn't parse */
+static uint64_t parse_cpus(const char *s, const char *end)
+{
+	uint64_t mask = 0;
+
+	while (s < end) {
+		char *next;
+		long first = strtol(s, &next, 10), last = first;
+
+		if (next == s)
+			return 0;
+		if (next < end && *next == '-') {
+			s = next + 1;
+			last = strtol(s, &next, 10);
+			if (next == s)
+				return 0;
+		}
+		if (first < 0 || last > 63 || first > last)
+			return 0;
+		while (first <= last)
+			mask |= 1ull << first++;
+		if (next < end && *next != '+')
+			return 0;
+		s = next < end ? next + 1 : end;
+	}
+	return mask;
+}
+
+static int parse_prio(const char *s, size_t len)
+{
+	int p;
+
+	for (p = PRIO_LOW; p <= PRIO_REALTIME; p++) {
+		if (strlen(prio_names[p]) == len && !strncmp(s, prio_names[p], len))
+			return p;
+	}
+	return -1;
+}
+
+static void parse_spec(const char *spec, const char *option, int is_cpus)
+{
+	const char *p = spec;
+
+	while (*p) {
+		const char *end = strchr(p, ',');
+		const char *eq;
+		int role, prio = 0;
+		uint64_t mask = 0;
+
+		if (!end)
+			end = p + strlen(p);
+		eq = memchr(p, '=', end - p);
+		role = eq ? parse_role(p, eq - p) : -1;
+		if (role >= 0 && is_cpus)
+			mask = parse_cpus(eq + 1, end);
+		else if (role >= 0)
+			prio = parse_prio(eq + 1, end - eq - 1);
+		if (role < 0 || (is_cpus ? !mask : prio < 0))
+			fprintf(stderr, "Threads: bad %s entry %.*s\n", option, (int)(end - p), p);
+		else if (is_cpus)
+			cpus[role] = mask;
+		else
+			prios[role] = prio;
+		p = *end ? end + 1 : end;
+	}
+}
+
+static void apply_cpus(int role)
+{
+#if defined(__linux__)
+	unsigned long set[64 / (8 * sizeof(unsigned long))];
+	size_t i;
+
+	/* The kernel's mask: bit n of word n / bits per word */
+	for (i = 0; i < sizeof(set) / sizeof(set[0]); i++)
+		set[i] = (unsigned long)(cpus[role] >> (i * 8 * sizeof(unsigned long)));
+	if (syscall(SYS_sched_setaffinity, 0, sizeof(set), set) != 0) {
+		SDL_SetError("no such CPUs");
+		warn_once("thread_cpus", role);
+	}
+#elif defined(_WIN32)
+	if (!SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)cpus[role])) {
+		SDL_SetError("no such CPUs");
+		warn_once("thread_cpus", role);
+	}
+#else
+	SDL_SetError("not supported on this platform");
+	warn_once("thread_cpus", role);
+#endif
+}
+
+/* The host's own real-time scheduling; false when refused */
+static int apply_realtime(int role)
+{
+#if defined(_WIN32)
+	typedef HANDLE (WINAPI *avset_fn)(LPCSTR, LPDWORD);
+	static avset_fn avset;
+	static int loaded;
+	DWORD index = 0;
+
+	if (!loaded) {
+		HMODULE avrt = LoadLibraryA("avrt.dll");
+
+		if (avrt)
+			avset = (avset_fn)GetProcAddress(avrt, "AvSetMmThreadCharacteristicsA");
+		loaded = 1;
+	}
+	return avset && avset(role == THREAD_AUDIO ? "Pro Audio" : "Games", &index) != NULL;
+#else
+	(void)role;
+	return 0;
+#endif
+}
+
+static void apply_prio(int role)
+{
+	SDL_ThreadPriority sdl = SDL_THREAD_PRIORITY_NORMAL;
+
+	switch (prios[role]) {
+	case PRIO_LOW:
+		sdl = SDL_THREAD_PRIORITY_LOW;
+		break;
+	case PRIO_HIGH:
+		sdl = SDL_THREAD_PRIORITY_HIGH;
+		break;
+	case PRIO_REALTIME:
+		if (apply_realtime(role))
+			return;
+		if (SDL_SetThreadPriority(SDL_THREAD_PRIORITY_TIME_CRITICAL) == 0)
+			return;
+		sdl = SDL_THREAD_PRIORITY_HIGH;
+		break;
+	}
+	if (SDL_SetThreadPriority(sdl) != 0)
+		warn_once(prio_names[prios[role]], role);
+}
+
+void threadPolicyApply(int role)
+{
+	if (role < 0 || role >= THREAD_ROLES)
+		return;
+	if (cpus[role])
+		apply_cpus(role);
+	if (prios[role] != PRIO_DEFAULT)
+		apply_prio(role);
+}
+
+void threadPolicyInit(const char *cpu_spec, const char *prio_spec)
+{
+	if (cpu_spec && *cpu_spec)
+		parse_spec(cpu_spec, "thread_cpus", 1);
+	if (prio_spec && *prio_spec)
+		parse_spec(prio_spec, "thread_priority", 0);
+#ifdef SDL_HINT_THREAD_FORCE_REALTIME_TIME_CRITICAL
+	SDL_SetHint(SDL_HINT_THREAD_FORCE_REALTIME_TIME_CRITICAL, "1");
+#endif
+	threadPolicyApply(THREAD_MAIN);
+}
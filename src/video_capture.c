@@ -0,0 +1,229 @@
+/*
+ * video_capture.c
+ *
+ * Records the native 128x128 display at 50 frames per second, with the
+ * p8audio output alongside it in <video>.pcm (22050Hz mono S16, host byte
+ * order).  The emulator thread only copies a frame when its hash changes;
+ * conversion and file writes run on the IO worker.
+ *
+ * video_format=raw writes a "P8VIDEO" header (magic, then little endian
+ * u16 version, width, height, fps and u32 audio rate, padded to 32 bytes)
+ * followed by one record per changed frame: "P8VF", the u32 vblank number
+ * of the frame, then the frame state up to and including overlay_control
+ * in nextp8_frame order (4bpp framebuffer, 4bpp overlay, palette,
+ * secondary palette, high colour bitfield, transform, high colour mode,
+ * overlay control).  Frames between two records repeat the earlier one.
+ *
+ * video_format=ffmpeg pipes RGBA frames to ffmpeg, which encodes to the
+ * file named by --video; unchanged frames resend the last picture.
+ */
+
+#ifdef NEXTP8
+
+#include <SDL.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emulator_options.h"
+#include "io_worker.h"
+#include "p8audio_verilated.h"
+#include "video_capture.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#define popen _popen
+#define pclose _pclose
+#endif
+
+#define VIDEO_FPS		50
+#define VIDEO_AUDIO_RATE	22050
+#define VIDEO_STATE_LEN		(offsetof(nextp8_frame, overlay_control) + 1)
+
+bool video_capture_enabled = false;
+
+static FILE *video_file;
+static FILE *audio_file;
+static bool video_ffmpeg;
+static uint32_t video_vblank;
+static uint64_t video_last_hash;
+static bool video_have_frame;
+
+/* Only touched on the IO worker */
+static uint32_t video_pixels[128 * 128];
+
+typedef struct {
+	uint32_t vblank;
+	bool repeat;		/* ffmpeg: resend video_pixels */
+	nextp8_frame frame;
+} video_job;
+
+typedef struct {
+	int n;
+	int16_t s[];
+} audio_job;
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	put_le16(p, v);
+	put_le16(p + 2, v >> 16);
+}
+
+static void video_write_frame(void *arg)
+{
+	video_job *job = arg;
+
+	if (!video_file) {
+		free(job);
+		return;
+	}
+	if (video_ffmpeg) {
+		if (!job->repeat)
+			QLSDLFramePixels(video_pixels, &job->frame);
+		fwrite(video_pixels, sizeof(video_pixels), 1, video_file);
+	} else {
+		uint8_t hdr[8];
+
+		memcpy(hdr, "P8VF", 4);
+		put_le32(hdr + 4, job->vblank);
+		fwrite(hdr, sizeof(hdr), 1, video_file);
+		fwrite(&job->frame, VIDEO_STATE_LEN, 1, video_file);
+	}
+	free(job);
+}
+
+static void video_write_audio(void *arg)
+{
+	audio_job *job = arg;
+
+	// A callback already under way at stop can land after the close
+	if (audio_file)
+		fwrite(job->s, sizeof(int16_t), job->n, audio_file);
+	free(job);
+}
+
+static void video_close(void *arg)
+{
+	if (video_ffmpeg)
+		pclose(video_file);
+	else
+		fclose(video_file);
+	if (audio_file)
+		fclose(audio_file);
+	video_file = NULL;
+	audio_file = NULL;
+}
+
+/* Audio thread */
+static void video_audio_tap(const int16_t *samples, int n)
+{
+	audio_job *job = malloc(sizeof(*job) + n * sizeof(int16_t));
+
+	if (!job)
+		return;
+	job->n = n;
+	memcpy(job->s, samples, n * sizeof(int16_t));
+	ioWorkerSubmit(video_write_audio, job);
+}
+
+void videoCaptureInit(void)
+{
+	const char *path = emulatorOptionString("video");
+	const char *format = emulatorOptionString("video_format");
+	char *audio_path;
+
+	if (!path || !path[0])
+		return;
+
+	video_ffmpeg = format && !strcmp(format, "ffmpeg");
+	if (format && !video_ffmpeg && strcmp(format, "raw"))
+		printf("Unknown video_format %s, using raw\n", format);
+
+	if (video_ffmpeg) {
+		char cmd[1024];
+
+		snprintf(cmd, sizeof(cmd),
+			 "ffmpeg -loglevel error -y -f rawvideo -pix_fmt rgba "
+			 "-s 128x128 -r %d -i - \"%s\"", VIDEO_FPS, path);
+		video_file = popen(cmd, "w");
+#ifdef _WIN32
+		/* _popen defaults to text mode */
+		if (video_file)
+			_setmode(_fileno(video_file), _O_BINARY);
+#endif
+	} else {
+		video_file = fopen(path, "wb");
+	}
+	if (!video_file) {
+		fprintf(stderr, "Video capture: failed to open %s\n", path);
+		return;
+	}
+
+	if (!video_ffmpeg) {
+		uint8_t hdr[32] = { 0 };
+
+		memcpy(hdr, "P8VIDEO", 8);
+		put_le16(hdr + 8, 1);
+		put_le16(hdr + 10, 128);
+		put_le16(hdr + 12, 128);
+		put_le16(hdr + 14, VIDEO_FPS);
+		put_le32(hdr + 16, VIDEO_AUDIO_RATE);
+		fwrite(hdr, sizeof(hdr), 1, video_file);
+	}
+
+	audio_path = malloc(strlen(path) + 5);
+	if (audio_path) {
+		sprintf(audio_path, "%s.pcm", path);
+		audio_file = fopen(audio_path, "wb");
+		if (!audio_file)
+			fprintf(stderr, "Video capture: failed to open %s\n", audio_path);
+		free(audio_path);
+	}
+	if (audio_file)
+		p8audio_verilated_add_tap(video_audio_tap);
+
+	video_capture_enabled = true;
+	printf("Video capture: recording to %s (%s)\n", path,
+	       video_ffmpeg ? "ffmpeg" : "raw");
+}
+
+void videoCaptureFrame(const nextp8_frame *f)
+{
+	bool changed = !video_have_frame || f->hash != video_last_hash;
+	uint32_t vblank = video_vblank++;
+	video_job *job;
+
+	if (!changed && !video_ffmpeg)
+		return;
+
+	job = malloc(changed ? sizeof(*job) : offsetof(video_job, frame));
+	if (!job)
+		return;
+	job->vblank = vblank;
+	job->repeat = !changed;
+	if (changed) {
+		memcpy(&job->frame, f, sizeof(job->frame));
+		video_last_hash = f->hash;
+		video_have_frame = true;
+	}
+	ioWorkerSubmit(video_write_frame, job);
+}
+
+void videoCaptureStop(void)
+{
+	if (!video_capture_enabled)
+		return;
+	video_capture_enabled = false;
+	p8audio_verilated_remove_tap(video_audio_tap);
+	ioWorkerSubmit(video_close, NULL);
+}
+
+#endif
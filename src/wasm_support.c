@@ -1,3 +1,5 @@
+#include <SDL.h>
+
 #include "emscripten.h"
 #include "wasm_support.h"
 
@@ -29,3 +31,154 @@ EM_JS(void, wasm_init_storage, (), {
             }
     });
 });
+
+// Persists /local to IndexedDB.  A sync asked for while one is running
+// is run once that finishes.
+void wasm_sync_storage(void) {
+	MAIN_THREAD_ASYNC_EM_ASM({
+	    if (Module.sqluxSyncing) {
+	        Module.sqluxSyncPending = true;
+	        return;
+	    }
+	    Module.sqluxSyncing = true;
+	    FS.syncfs(false, function done(err) {
+	        if (err)
+	            console.log('Storage sync failed: ' + err);
+	        if (Module.sqluxSyncPending) {
+	            Module.sqluxSyncPending = false;
+	            FS.syncfs(false, done);
+	        } else {
+	            Module.sqluxSyncing = false;
+	        }
+	    });
+	});
+}
+
+// Size in bytes of the resource at url, -1 if it can't be had
+EM_JS(double, wasm_http_size, (const char *url), {
+    var xhr = new XMLHttpRequest();
+    xhr.open('HEAD', UTF8ToString(url), false);
+    try {
+        xhr.send(null);
+    } catch (e) {
+        return -1;
+    }
+    var len = xhr.getResponseHeader('Content-Length');
+    if (xhr.status !== 200 || len === null)
+        return -1;
+    return Number(len);
+});
+
+// Reads len bytes at offset of url into buf with a synchronous range
+// request, so a worker thread; returns the bytes read or -1.  A server
+// without range support sends the whole resource, which still works.
+// The binary string form is used as synchronous XHR on the main thread
+// can't have an arraybuffer response.
+EM_JS(int, wasm_http_range, (const char *url, double offset, int len, uint8_t *buf), {
+    var xhr = new XMLHttpRequest();
+    xhr.open('GET', UTF8ToString(url), false);
+    xhr.overrideMimeType('text/plain; charset=x-user-defined');
+    xhr.setRequestHeader('Range', 'bytes=' + offset + '-' + (offset + len - 1));
+    try {
+        xhr.send(null);
+    } catch (e) {
+        return -1;
+    }
+    var start = 0;
+    if (xhr.status === 200)
+        start = offset;
+    else if (xhr.status !== 206)
+        return -1;
+    var text = xhr.responseText;
+    var n = Math.min(len, text.length - start);
+    if (n < 0)
+        return -1;
+    for (var i = 0; i < n; i++)
+        HEAPU8[buf + i] = text.charCodeAt(start + i) & 0xff;
+    return n;
+});
+
+#ifdef AUDIO_WORKLET
+// Plays a ring of mono S16 samples at rate from an AudioWorklet, which
+// reads wasm memory directly: pos[0] is the worklet's read index, pos[1]
+// the writer's, both free running.  Returns 0 once the node is being set
+// up, -1 if the browser lacks AudioWorklet or shared memory.  The
+// worklet interpolates linearly to the context rate and holds the last
+// sample when the ring runs dry.
+EM_JS(int, wasm_audio_start, (int16_t *ring, SDL_atomic_t *pos, int capacity, int rate), {
+    if (typeof AudioWorkletNode === 'undefined' ||
+        typeof SharedArrayBuffer === 'undefined' ||
+        !(HEAPU8.buffer instanceof SharedArrayBuffer))
+        return -1;
+
+    var src = `
+class SqluxRing extends AudioWorkletProcessor {
+    constructor() {
+        super();
+        this.ring = null;
+        this.port.onmessage = (e) => {
+            var d = e.data;
+            this.ring = new Int16Array(d.buffer, d.ring, d.capacity);
+            this.pos = new Int32Array(d.buffer, d.pos, 2);
+            this.mask = d.capacity - 1;
+            this.step = d.rate / sampleRate;
+            this.frac = 0;
+            this.last = 0;
+            this.next = 0;
+        };
+    }
+    process(inputs, outputs) {
+        var out = outputs[0][0];
+        if (!this.ring)
+            return true;
+        var head = Atomics.load(this.pos, 0);
+        var tail = Atomics.load(this.pos, 1);
+        for (var i = 0; i < out.length; i++) {
+            this.frac += this.step;
+            while (this.frac >= 1) {
+                this.frac -= 1;
+                this.last = this.next;
+                if (head !== tail) {
+                    this.next = this.ring[head & this.mask] / 32768;
+                    head = (head + 1) | 0;
+                }
+            }
+            out[i] = this.last + (this.next - this.last) * this.frac;
+        }
+        Atomics.store(this.pos, 0, head);
+        return true;
+    }
+}
+registerProcessor('sqlux-ring', SqluxRing);
+`;
+    var ctx = new AudioContext();
+    var url = URL.createObjectURL(new Blob([src], { type: 'application/javascript' }));
+    var buffer = HEAPU8.buffer;
+
+    Module.sqluxAudio = ctx;
+    ctx.audioWorklet.addModule(url).then(function() {
+        var node = new AudioWorkletNode(ctx, 'sqlux-ring', { outputChannelCount: [1] });
+        node.port.postMessage({ buffer: buffer, ring: ring, pos: pos,
+                                capacity: capacity, rate: rate });
+        node.connect(ctx.destination);
+    }).catch(function(err) {
+        console.log('AudioWorklet setup failed: ' + err);
+    });
+    // Browsers start audio suspended until the page is interacted with
+    var resume = function() {
+        if (ctx.state === 'suspended')
+            ctx.resume();
+    };
+    document.addEventListener('keydown', resume);
+    document.addEventListener('mousedown', resume);
+    document.addEventListener('touchstart', resume);
+    return 0;
+});
+
+EM_JS(void, wasm_audio_stop, (), {
+    if (Module.sqluxAudio) {
+        Module.sqluxAudio.close();
+        Module.sqluxAudio = null;
+    }
+});
+#endif
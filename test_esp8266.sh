@@ -47,5 +47,11 @@ echo "Test 4: SSL connection to real HTTPS server"
  timeout 6 ./build/esp8266_test 2>&1 | \
  grep -v "^ESP8266" | grep -v "^Type" | grep -v "^---" | grep -v "Exiting" | head -20
 
+echo
+echo "Test 5: Benchmark against a local echo server (JSON results)"
+for baud in 115200 921600 0; do
+    timeout 30 ./build/esp8266_test --bench --baud $baud --seconds 3
+done
+
 echo
 echo "=== Tests Complete ==="
@@ -50,7 +50,27 @@
 #include "uxfile.h"
 #include "QL_screen.h"
 #include "SDL2screen.h"
+#include "cycles.h"
+#include "idle.h"
+#include "netplay.h"
+#include "rewind.h"
+#include "savestate.h"
+#include "forkserver.h"
+#include "gdbstub.h"
+#include "cart_bench.h"
+#include "input_script.h"
+#include "startup_timing.h"
+#include "metrics.h"
+#include "pacer.h"
+#include "scheduler.h"
+#include "thread_policy.h"
 #include "version.h"
+#ifdef NEXTP8
+#include "p8audio_verilated.h"
+#endif
+#ifdef PROFILER
+#include "profiler/profiler_control.h"
+#endif
 #include "Xscreen.h"
 
 #define TIME_DIFF 283996800
@@ -153,10 +173,12 @@ static long aa_cnt = 0;
 #endif
 
 static int flptest = 0;
+static uint64_t frame_count;	/* 50Hz ticks taken, for QLRunFrames() */
 
 void dosignal()
 {
 	SDL_AtomicSet(&doPoll, 0);
+	frame_count++;
 
 	if (--scrcnt < 0) {
 		set_rtc_emu();
@@ -170,6 +192,16 @@ void dosignal()
 #ifndef xx_VTIME
 	FrameInt();
 #endif
+#ifdef NEXTP8
+	inputScriptFrame(frame_count);
+	QLSDLVblank();
+	p8audio_verilated_advance_to(pacerEmuNs());
+	rewindFrame();
+	netplayFrame();
+#endif
+#ifdef PROFILER
+	Profiler_Frame();
+#endif
 }
 
 extern int xbreak;
@@ -186,6 +218,12 @@ void cleanup(int err)
 
 	event.type = SDL_USEREVENT;
 
+#ifdef NEXTP8
+	// A fork server child has no main thread to take the event
+	if (forkServerChild())
+		exit(err);
+#endif
+
 	ret = SDL_PushEvent(&event);
 	if (ret <= 0) {
 		printf("PushEvent error %d\n", ret);
@@ -367,42 +405,50 @@ void SetHome()
 
 int speed = 0;
 
-int QLRun(void *data)
+/* One chunk, then the peripherals and the pacer */
+static void run_chunk(void)
 {
-	int scrchange, i;
-	int loop = 0;
+	long chunk, elapsed;
+	uint64_t start;
 
-	speed = (int)(atof(emulatorOptionString("speed")) * 20.0);
-	speed = (speed >= 0) && (sem50Hz != NULL) ? speed : 0;
-
-exec:
 #ifdef NEXTP8
-	extern void UART_TickAndReceive(int cycles);
-	UART_TickAndReceive(12);
-	extern void i2c_rtc_update(void);
-	i2c_rtc_update();
-	// Poll ESP8266 for network events every cycle
-	struct ESP8266_t;
-	typedef struct ESP8266_t ESP8266_t;
-	extern ESP8266_t *esp8266;
-	if (esp8266) {
-		extern void ESP8266_Poll(ESP8266_t *esp);
-		ESP8266_Poll(esp8266);
-	}
+	savestatePoll();
+	rewindPoll();
+	netplayPoll();
+	forkServerPoll();
+#endif
+	gdbPoll();
+#ifdef PROFILER
+	Profiler_Poll();
 #endif
 
-	if (!speed) {
-		ExecuteChunk(3000);
-	}
-	else {
-		ExecuteChunk(300);
-		++loop;
-
-		if (loop >= speed) {
-			SDL_SemWait(sem50Hz);
-			loop = 0;
+	// Nothing else runs the tick while the CPU is stopped
+	if (stopped && SDL_AtomicGet(&doPoll))
+		dosignal();
+
+	if (idleWaiting()) {
+		elapsed = idleSkip();
+	} else {
+		// Run up to the next peripheral deadline, then dispatch what is due
+		chunk = schedBudget(speed ? 300 : 3000);
+		start = cpu_cycles;
+		utimerSync();
+		ExecuteChunk(chunk);
+		elapsed = chunk;
+		if (cart_bench_enabled && !stopped)
+			cart_bench_insns += chunk;
+		if (!stopped)
+			metricAdd(METRIC_INSNS, chunk);
+		metricAdd(METRIC_CHUNKS, 1);
+		if (cycle_timing) {
+			// A stopped CPU still lets the clock run
+			if (cpu_cycles == start)
+				cpu_cycles += (uint64_t)chunk * CYCLES_PER_INSN;
+			elapsed = cpu_cycles - start;
 		}
 	}
+	pacerThrottle(elapsed);
+	schedAdvance(elapsed);
 
 #ifdef UX_WAIT
 	if (run_reaper)
@@ -422,9 +468,32 @@ exec:
 		/*dosignal();*/
 	}
 #endif
+}
 
-	if (!QLdone)
-		goto exec;
+int QLRun(void *data)
+{
+	threadPolicyApply(THREAD_CPU);
+	speed = (int)(atof(emulatorOptionString("speed")) * 20.0);
+	speed = (speed >= 0) && (sem50Hz != NULL) ? speed : 0;
+
+#ifdef NEXTP8
+	extern void UART_Start(void);
+	UART_Start();
+#endif
+
+	startupMark(STARTUP_FIRST_INSN);
+	while (!QLdone)
+		run_chunk();
 
 	return 0;
 }
+
+void QLRunFrames(int n)
+{
+	uint64_t end = frame_count + n;
+
+	pacerFreeRun(true);
+	while (frame_count < end && !QLdone)
+		run_chunk();
+	pacerFreeRun(false);
+}
@@ -12,6 +12,9 @@ void set_rtc_emu(void);
 void SetHome(void);
 void uqlxInit(void);
 int QLRun(void *data);
+/* Runs unpaced until n more 50Hz ticks have been taken, e.g. to run
+   frames again after a netplay rollback */
+void QLRunFrames(int n);
 long ql2uxtime(long t);
 long ux2qltime(long t);
 int qm_fork(void (*cleanup)(), unsigned long id);
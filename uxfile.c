@@ -25,6 +25,7 @@
 #include "QL.h"
 #include "QLfiles.h"
 #include "QFilesPriv.h"
+#include "uxfile.h"
 #include "QSerial.h"
 
 #include "QInstAddr.h"
@@ -56,6 +57,7 @@
 #define max(_a_, _b_) (_a_ > _b_ ? _a_ : _b_)
 
 int match(char *, char *, char *, int, int, int, int);
+static void lookup_flush(void);
 
 static void addpath(char *to, char *name, int maxnlen);
 
@@ -80,6 +82,7 @@ static int qunlinkfile(char *mount, char *name, int maxnlen)
 	int res, q = strlen(mount);
 	qaddpath(mount, name, maxnlen);
 
+	lookup_flush();
 	res = unlink(mount);
 
 	mount[q] = 0;
@@ -134,6 +137,97 @@ long qlseek(struct mdvFile *f, off_t pos, int how)
 	return r;
 }
 
+/*
+ * QDOS name -> host name cache.  match() walks every directory level with
+ * readdir, so resolved names are remembered; a hit is checked with one
+ * stat() so files removed behind our back fall out, and the whole cache
+ * is dropped whenever the emulator itself creates, deletes or renames.
+ */
+#define LOOKUP_CACHE_SIZE 256 /* power of two */
+
+struct lookup_entry {
+	unsigned hash;
+	char used;
+	char isdir;
+	char fstype;
+	char qname[128];	/* QVFS passes whole paths */
+	char mount[400];
+	char uxname[320];
+};
+
+static struct lookup_entry lookup_cache[LOOKUP_CACHE_SIZE];
+
+static unsigned lookup_hash(const char *mount, const char *qname, int isdir,
+			    int fstype)
+{
+	unsigned h = 2166136261u;
+
+	while (*mount)
+		h = (h ^ (unsigned char)*mount++) * 16777619u;
+	h = (h ^ '/') * 16777619u;
+	while (*qname)
+		h = (h ^ (unsigned char)*qname++) * 16777619u;
+	return h ^ (isdir << 8) ^ fstype;
+}
+
+static int lookup_exists(const char *mount, const char *uxname)
+{
+	char path[800];
+	struct stat st;
+
+	strncpy(path, mount, sizeof(path) - 1);
+	path[sizeof(path) - 1] = 0;
+	qaddpath(path, (char *)uxname, sizeof(path) - 1);
+	return stat(*path ? path : ".", &st) == 0;
+}
+
+static void lookup_flush(void)
+{
+	int i;
+
+	for (i = 0; i < LOOKUP_CACHE_SIZE; i++)
+		lookup_cache[i].used = 0;
+}
+
+void uxLookupFlush(void)
+{
+	lookup_flush();
+}
+
+int uxLookupName(char *mount, char *uxname, char *qname, int isdir,
+		 int create, int maxnlen, int fstype)
+{
+	unsigned h = lookup_hash(mount, qname, isdir, fstype);
+	struct lookup_entry *e = &lookup_cache[h & (LOOKUP_CACHE_SIZE - 1)];
+	int res;
+
+	if (e->used && e->hash == h && e->isdir == isdir &&
+	    e->fstype == fstype && !strcmp(e->qname, qname) &&
+	    !strcmp(e->mount, mount)) {
+		if (lookup_exists(mount, e->uxname)) {
+			strcpy(uxname, e->uxname);
+			return 1;
+		}
+		e->used = 0;
+	}
+
+	res = match(mount, uxname, qname, isdir, create, maxnlen, fstype);
+
+	/* Names made up for a file about to be created aren't cached */
+	if (res && strlen(qname) < sizeof(e->qname) &&
+	    strlen(mount) < sizeof(e->mount) &&
+	    strlen(uxname) < sizeof(e->uxname) && lookup_exists(mount, uxname)) {
+		e->used = 1;
+		e->hash = h;
+		e->isdir = isdir;
+		e->fstype = fstype;
+		strcpy(e->qname, qname);
+		strcpy(e->mount, mount);
+		strcpy(e->uxname, uxname);
+	}
+	return res;
+}
+
 int uxLookupDir(char *mount, char *qdname, struct mdvFile *f, char *uxname,
 		int fstype)
 {
@@ -149,7 +243,7 @@ int uxLookupDir(char *mount, char *qdname, struct mdvFile *f, char *uxname,
 	if (qlen && temp[qlen - 1] == '_')
 		temp[qlen - 1] = 0;
 
-	return match(mount, uxname, temp, 1, 0, 320, fstype);
+	return uxLookupName(mount, uxname, temp, 1, 0, 320, fstype);
 }
 
 int uxLookupFile(char *mount, char *qdname, struct mdvFile *f, char *uxname,
@@ -163,7 +257,7 @@ int uxLookupFile(char *mount, char *qdname, struct mdvFile *f, char *uxname,
 	strncpy(temp, qdname + 2, 36);
 	uxname[0] = 0;
 
-	return match(mount, uxname, temp, 0, create, 320, fstype);
+	return uxLookupName(mount, uxname, temp, 0, create, 320, fstype);
 }
 
 int path_match_char(char p, char u)
@@ -354,6 +448,7 @@ int HCreate(struct mdvFile *f, unsigned char *name, unsigned char *s1,
 	if (!err)
 		return -7;
 
+	lookup_flush();
 	fd = creat(mname, 0666);
 	if (fd >= 0) {
 		close(fd);
@@ -689,6 +784,9 @@ int QHOpenDir(struct mdvFile *f, int fstype)
 
 	long i, j, mlen;
 
+	/* Sizes in the listing must include buffered writes */
+	QHostFlush();
+
 #ifdef __WIN32__
 	sqlux_getemppath(sizeof(templ), templ);
 	strncat(templ, "/QDOSXXXXXX", sizeof(templ)-1);
@@ -797,6 +895,7 @@ int FSClose(int fd)
 {
 	int err;
 
+	QHostFlush();
 	err = close(fd);
 	/*printf("FSClose file %d, res %d\n",fd,err);*/
 	return 0;
@@ -809,6 +908,7 @@ int HOpenDF(int drive, long dir, unsigned char *name, long perm,
 	char mname[64], mount[400];
 	struct fileHeader h;
 
+	QHostFlush();
 	/*printf("calling HOpenDF %s, perm %d\n",name+2,perm);*/
 	strncpy(mount, qdevs[GET_FILESYS(f)].mountPoints[GET_DRIVE(f)], 320);
 	err = uxLookupFile(mount, (char *)name, f, mname, canCreate, fstype);
@@ -865,25 +965,107 @@ int HDfLen(struct mdvFile *f, int fstype)
 	return flen(GET_HFILE(f));
 }
 
-/*static char buff[512];*/
+/*
+ * One host file at a time gets a stream buffer: single bytes fetched with
+ * IO.FBYTE come out of a read-ahead block, and short writes are collected
+ * and written together.  The buffer is given back (the file offset moved
+ * back over unread bytes, or pending bytes written) before any other
+ * operation on any file, so everything else sees the plain fd.
+ */
+#define STREAM_BUF_SIZE 4096
+
+static struct {
+	int fd;
+	int writing;
+	int pos, len;
+	char buf[STREAM_BUF_SIZE];
+} stream = { -1 };
+
+void QHostFlush(void)
+{
+	int n, off = 0;
+
+	if (stream.fd < 0)
+		return;
+	if (stream.writing) {
+		while (off < stream.len) {
+			n = write(stream.fd, stream.buf + off, stream.len - off);
+			if (n < 0 && eretry())
+				continue;
+			if (n <= 0) {
+				perror("QHostFlush write");
+				break;
+			}
+			off += n;
+		}
+	} else if (stream.pos < stream.len) {
+		lseek(stream.fd, stream.pos - stream.len, SEEK_CUR);
+	}
+	stream.fd = -1;
+	stream.pos = stream.len = 0;
+}
+
+static int stream_getc(int fd, char *c)
+{
+	int n;
+
+	if (stream.fd != fd || stream.writing) {
+		QHostFlush();
+		stream.fd = fd;
+		stream.writing = 0;
+	}
+	if (stream.pos == stream.len) {
+		do
+			n = read(fd, stream.buf, sizeof(stream.buf));
+		while (n < 0 && eretry());
+		if (n <= 0) {
+			stream.pos = stream.len = 0;
+			return 0;
+		}
+		stream.pos = 0;
+		stream.len = n;
+	}
+	*c = stream.buf[stream.pos++];
+	return 1;
+}
+
+static int read_full(int fd, char *p, int cnt)
+{
+	int n, done = 0;
+
+	while (done < cnt) {
+		n = read(fd, p + done, cnt - done);
+		if (n < 0 && eretry())
+			continue;
+		if (n <= 0)
+			return done ? done : n;
+		done += n;
+	}
+	return done;
+}
+
 int QHread(int fd, w32 *addr, long *count, Cond lf)
 {
-	int cnt, startpos;
-	int c, fn, err, sz, e;
-	Ptr /*to,from,*/ p, i = 0;
+	int cnt, startpos, flength, skip = 0;
+	int fn, err, sz, e;
+	Ptr p, i = 0;
 	w32 from, to;
 
+	QHostFlush();
+
 	cnt = *count;
 	from = *addr;
 	startpos = lseek(fd, 0, SEEK_CUR);
+	flength = flen(fd);
 
-	if (cnt + startpos > flen(fd))
-		cnt = flen(fd) - startpos;
+	if (cnt + startpos > flength)
+		cnt = flength - startpos;
 	to = from + cnt;
 
 	if (from < 131072) {
 		lseek(fd, 131072 - from, SEEK_CUR);
 		from = 131072;
+		skip = 1;
 	}
 	if (to >= RTOP)
 		to = RTOP;
@@ -891,10 +1073,10 @@ int QHread(int fd, w32 *addr, long *count, Cond lf)
 
 	if (cnt > 0) {
 		if (lf) {
-			for (i = 0, fn = cnt, p = (Ptr)memBase + from; fn > 0;
-			     fn = fn - 1024, p = p + 1024) {
-				sz = min(1024, fn);
-				err = read(fd, p, sz);
+			for (fn = cnt, p = (Ptr)memBase + from; fn > 0;
+			     fn = fn - sz, p = p + sz) {
+				sz = min(STREAM_BUF_SIZE, fn);
+				err = read_full(fd, p, sz);
 				if (err <= 0) {
 					cnt = (Ptr)p - (Ptr)memBase - from;
 					if (cnt > 0) {
@@ -906,20 +1088,25 @@ int QHread(int fd, w32 *addr, long *count, Cond lf)
 						goto ret;
 					}
 				}
+				sz = err;
 				if ((i = memchr(p, 10, sz)))
 					break;
 			}
 			if (i)
 				cnt = (Ptr)i - (Ptr)memBase - from + 1;
-
+			else
+				cnt = (Ptr)p - (Ptr)memBase - from;
 		} else {
-			cnt = read(fd, (Ptr)memBase + from, cnt);
+			/* The whole transfer in one read where the host allows */
+			cnt = read_full(fd, (Ptr)memBase + from, cnt);
 			if (cnt < 0 && eretry()) {
 				cnt = 0;
 				e = QERR_NC;
 				goto ret;
 			}
 		}
+		if (cnt > 0)
+			MemoryDMAWritten(from, cnt);
 	}
 	if (cnt < *count && (!lf || (lf && !i))) {
 		e = QERR_EF;
@@ -927,7 +1114,9 @@ int QHread(int fd, w32 *addr, long *count, Cond lf)
 		e = QERR_BF;
 	else
 		e = 0;
-	lseek(fd, startpos + cnt, SEEK_SET);
+	/* Only LF reads overshoot; whole reads already sit at the right place */
+	if (lf || skip || cnt < 0)
+		lseek(fd, startpos + cnt, SEEK_SET);
 
 ret:
 	*count = cnt;
@@ -939,8 +1128,29 @@ int QWrite(int fd, Ptr addr, long *count)
 {
 	int err;
 
+	if (*count <= 0)
+		return 0;
+
+	if (*count < STREAM_BUF_SIZE) {
+		if (stream.fd != fd || !stream.writing ||
+		    stream.len + *count > STREAM_BUF_SIZE) {
+			static int registered;
+
+			QHostFlush();
+			stream.fd = fd;
+			stream.writing = 1;
+			if (!registered)
+				atexit(QHostFlush);
+			registered = 1;
+		}
+		memcpy(stream.buf + stream.len, addr, *count);
+		stream.len += *count;
+		return 0;
+	}
+
+	QHostFlush();
 	err = write(fd, addr, *count);
-	if (err <= 0 && *count > 0) {
+	if (err <= 0) {
 		*count = 0;
 		return qmaperr();
 	}
@@ -964,6 +1174,7 @@ int rename_file(struct mdvFile *f, int fd, char *qln, int qlen, int fstype)
 		strncpy(nname, qln, qlen);
 		nname[qlen] = 0;
 
+		lookup_flush();
 		res = rename(name, nname);
 	} else {
 		name = mount;
@@ -1008,6 +1219,7 @@ int rename_file(struct mdvFile *f, int fd, char *qln, int qlen, int fstype)
 		}
 		qaddpath(ren, mname, 320);
 		/* printf("rename file %s, %.*s %s\n", mount, qlen, qln, ren); */
+		lookup_flush();
 		res = rename(mount, ren);
 		res = (res) ? qmaperr() : 0;
 		if (res == 0) {
@@ -1097,6 +1309,7 @@ int rename_single(struct mdvFile *f, const char *fsmount, char *localdir, char *
 
 	qaddpath(mount, name, 4200);
 	/* printf("rename file %s, to %s\n", mount, temp); */
+	lookup_flush();
 	res = rename(mount, temp);
 	if (res) {
 		perror("rename failed");
@@ -1141,6 +1354,9 @@ int QHostIO(struct mdvFile *f, int op, int fstype)
 
 	*reg = 0;
 
+	if (op != 1 && op != 5 && op != 7)
+		QHostFlush();
+
 	/*printf("QHostIO op %x-%d file %x, d1=%d, d2=%d, a1=%d  \n",op,op,f,reg[1],reg[2],aReg[1]);*/
 
 	switch (op) {
@@ -1149,7 +1365,7 @@ int QHostIO(struct mdvFile *f, int op, int fstype)
 			*reg = -10;
 		break;
 	case 1: /* fetch byte */
-		err = read(fd, &c, 1);
+		err = stream_getc(fd, &c);
 		if (err == 1)
 			*((char *)reg + 4 + RBO) = c;
 		else
@@ -1211,6 +1427,7 @@ int QHostIO(struct mdvFile *f, int op, int fstype)
 				10);
 		else
 			strncpy((char *)memBase + aReg[1], "uQVFSx     ", 10);
+		MemoryDMAWritten(aReg[1], 10);
 		break;
 	case 0x46: /* set file header */
 		h = aReg[1] + (Ptr)memBase;
@@ -1350,6 +1567,7 @@ int QHostIO(struct mdvFile *f, int op, int fstype)
 		}
 		/*printf(" MAKEDIR %s \n",GET_FCB(f)->uxname);*/
 
+		lookup_flush();
 		if (GET_FILESYS(f) < 0) {
 			unlink(GET_FCB(f)->uxname);
 #ifdef __WIN32__
@@ -1438,6 +1656,7 @@ int QHostIO(struct mdvFile *f, int op, int fstype)
 		WriteLong(aReg[1] + 0x20, mxs);
 		WriteLong(aReg[1] + 0x24, mxs);
 		WriteLong(aReg[1] + 0x28, 64);
+		MemoryDMAWritten(aReg[1], 64);
 	}
 #else
 		*reg = -15;
@@ -4,6 +4,13 @@
 void qaddpath(char *mount, char *name, int maxnlen);
 int FSClose(int fd);
 int eretry(void);
+void QHostFlush(void);
+
+/* match() through the name cache, which is dropped on create, delete and
+   rename */
+int uxLookupName(char *mount, char *uxname, char *qname, int isdir,
+		 int create, int maxnlen, int fstype);
+void uxLookupFlush(void);
 
 #endif /* __UXFILE_H */
 